@@ -121,6 +121,12 @@ static void gather_stats(struct upipe *upipe, struct uref *uref)
     unsigned nack_overflow = (repairs && repairs < nacks) ? (nacks - repairs ) * 100 / repairs : 0;
     upipe_notice_va(upipe, "%5u (%3zu) %5u\t%zu repairs %zu NACKS (%u%% too much)\tlost %zu\tduplicates %zu",
             last_output_seqnum, buffers, expected_seqnum, repairs, nacks, nack_overflow, loss, dups);
+
+    uint64_t requested, recovered, late;
+    if (ubase_check(upipe_rtpfb_get_retransmit_stats(upipe_rtpfb,
+                &requested, &recovered, &late)))
+        upipe_notice_va(upipe, "requested %"PRIu64" recovered %"PRIu64" late %"PRIu64,
+                requested, recovered, late);
 }
 
 /** definition of our uprobe */
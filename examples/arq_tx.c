@@ -80,7 +80,8 @@
 #define READ_SIZE 4096
 
 static void usage(const char *argv0) {
-    fprintf(stdout, "Usage: %s [-t 96] [-d] <udp source> <udp dest> <latency>\n", argv0);
+    fprintf(stdout, "Usage: %s [-t 96] [-r 0] [-d] <udp source> <udp dest> <latency>\n", argv0);
+    fprintf(stdout, "   -r: maximum retransmitted packets per second and per peer\n");
     fprintf(stdout, "   -d: more verbose\n");
     fprintf(stdout, "   -q: more quiet\n");
     exit(EXIT_FAILURE);
@@ -271,16 +272,20 @@ static void stop(struct upump *upump)
 int main(int argc, char *argv[])
 {
     uint8_t rtx_pt = 96;
+    uint64_t rtx_rate = 0;
     const char *srcpath, *dirpath, *latency;
     int opt;
     enum uprobe_log_level loglevel = UPROBE_LOG_DEBUG;
 
     /* parse options */
-    while ((opt = getopt(argc, argv, "t:qd")) != -1) {
+    while ((opt = getopt(argc, argv, "t:r:qd")) != -1) {
         switch (opt) {
             case 't':
                 rtx_pt = atoi(optarg);
                 break;
+            case 'r':
+                rtx_rate = strtoull(optarg, NULL, 10);
+                break;
             case 'q':
                 loglevel++;
                 break;
@@ -342,6 +347,7 @@ int main(int argc, char *argv[])
     struct upipe *upipe_rtcpfb = upipe_void_alloc_output(upipe_udpsrc, upipe_rtcpfb_mgr,
             uprobe_pfx_alloc(uprobe_use(logger), loglevel, "rtcp fb"));
     upipe_rtcpfb_set_rtx_pt(upipe_rtcpfb, rtx_pt);
+    upipe_rtcpfb_set_rtx_rate(upipe_rtcpfb, rtx_rate);
     upipe_mgr_release(upipe_rtcpfb_mgr);
 
     if (!ubase_check(upipe_set_option(upipe_rtcpfb, "latency", latency)))
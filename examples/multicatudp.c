@@ -37,6 +37,8 @@
  * The start date is 270000000 (coded in aux files).
  * Please pay attention to the trailing slash in "foo/".
  * If the first argument is a file name, it is opened.
+ * The -p option selects how the udp sink paces the datagrams (timer, busy,
+ * fq or etf), see @ref upipe_udpsink_pacing.
  */
 
 #undef NDEBUG
@@ -75,6 +77,7 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <inttypes.h>
 #include <signal.h>
@@ -96,13 +99,14 @@
 #define DEFAULT_MTU 1316
 
 static void usage(const char *argv0) {
-    fprintf(stdout, "Usage: %s [-d] [-r <rotate>] [-O <rotate offset>] [-R <read-ahead>] [-k <start>] (-m <MTU>] [-l <syslog ident>] <source dir/prefix> <data suffix> <aux suffix> <destination>\n", argv0);
+    fprintf(stdout, "Usage: %s [-d] [-r <rotate>] [-O <rotate offset>] [-R <read-ahead>] [-k <start>] (-m <MTU>] [-p <pacing>] [-l <syslog ident>] <source dir/prefix> <data suffix> <aux suffix> <destination>\n", argv0);
     fprintf(stdout, "   -d: force debug log level\n");
     fprintf(stdout, "   -r: rotate interval in 27MHz unit\n");
     fprintf(stdout, "   -O: rotate offset in 27MHz unit\n");
     fprintf(stdout, "   -R: read-ahead in 27MHz unit\n");
     fprintf(stdout, "   -k: start time in 27MHz unit\n");
     fprintf(stdout, "   -m: data packet size\n");
+    fprintf(stdout, "   -p: udp pacing (timer, busy, fq or etf)\n");
     exit(EXIT_FAILURE);
 }
 
@@ -133,11 +137,12 @@ int main(int argc, char *argv[])
     int64_t start = 0;
     unsigned long mtu = DEFAULT_MTU;
     unsigned int rt_priority = 0;
+    enum upipe_udpsink_pacing pacing = UPIPE_UDPSINK_PACING_TIMER;
     int opt;
     enum uprobe_log_level loglevel = UPROBE_LOG_LEVEL;
 
     /* parse options */
-    while ((opt = getopt(argc, argv, "r:O:R:k:m:l:i:d")) != -1) {
+    while ((opt = getopt(argc, argv, "r:O:R:k:m:p:l:i:d")) != -1) {
         switch (opt) {
             case 'r':
                 rotate = strtoull(optarg, NULL, 0);
@@ -154,6 +159,18 @@ int main(int argc, char *argv[])
             case 'm':
                 mtu = strtoul(optarg, NULL, 0);
                 break;
+            case 'p':
+                if (!strcmp(optarg, "timer"))
+                    pacing = UPIPE_UDPSINK_PACING_TIMER;
+                else if (!strcmp(optarg, "busy"))
+                    pacing = UPIPE_UDPSINK_PACING_BUSY;
+                else if (!strcmp(optarg, "fq"))
+                    pacing = UPIPE_UDPSINK_PACING_TXTIME_FQ;
+                else if (!strcmp(optarg, "etf"))
+                    pacing = UPIPE_UDPSINK_PACING_TXTIME_ETF;
+                else
+                    usage(argv[0]);
+                break;
             case 'd':
                 loglevel = UPROBE_LOG_DEBUG;
                 break;
@@ -237,6 +254,7 @@ int main(int argc, char *argv[])
             uprobe_err_va(logger, NULL, "unable to open '%s'", dstpath);
             exit(EXIT_FAILURE);
         }
+        ubase_assert(upipe_udpsink_set_pacing(sink, pacing));
     }
     upipe_attach_uclock(sink);
     upipe_set_max_length(sink, SINK_QUEUE_LENGTH);
@@ -0,0 +1,311 @@
+/*
+ * Copyright (C) 2017 OpenHeadend S.A.R.L.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/** @file
+ * @short measurement of the inter-packet jitter of a udp stream
+ *
+ * This example receives a udp stream, timestamps each datagram in the kernel
+ * on arrival, and periodically reports statistics on the intervals between
+ * consecutive datagrams. It is meant to evaluate the pacing of a udp sink,
+ * for instance over the loopback interface.
+ *
+ * Usage example :
+ *   ./udpjitter -n 1000 127.0.0.1:1234
+ * while in another terminal:
+ *   ./multicatudp -p busy foo/ .ts .aux 127.0.0.1:1234
+ * will print every 1000 datagrams the minimum, mean, maximum and standard
+ * deviation of the intervals, and the largest deviation of the arrival dates
+ * from a constant rate.
+ */
+
+#undef NDEBUG
+
+#define _GNU_SOURCE
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <assert.h>
+
+#define DEFAULT_REPORT 1000
+#define BUFFER_SIZE 65536
+#define NSEC_PER_SEC UINT64_C(1000000000)
+
+/** statistics over a report period */
+struct jitter_stats {
+    /** number of intervals */
+    uint64_t count;
+    /** minimum interval in nanoseconds */
+    uint64_t min;
+    /** maximum interval in nanoseconds */
+    uint64_t max;
+    /** sum of intervals */
+    double sum;
+    /** sum of squared intervals */
+    double sum2;
+    /** arrival dates of the period, in nanoseconds */
+    uint64_t *dates;
+};
+
+static void usage(const char *argv0) {
+    fprintf(stdout, "Usage: %s [-n <datagrams>] [-c <count>] <[address]:port>\n", argv0);
+    fprintf(stdout, "   -n: number of datagrams between reports\n");
+    fprintf(stdout, "   -c: exit after this number of reports\n");
+    exit(EXIT_FAILURE);
+}
+
+/** @This opens and binds the receiving socket, and joins the multicast group
+ * if needed.
+ *
+ * @param uri [address]:port to bind
+ * @return socket or -1 in case of error
+ */
+static int open_socket(const char *uri)
+{
+    char *host = strdup(uri);
+    assert(host != NULL);
+    char *port = strrchr(host, ':');
+    if (port == NULL) {
+        free(host);
+        return -1;
+    }
+    *port++ = '\0';
+
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = AI_PASSIVE;
+    int err = getaddrinfo(*host ? host : NULL, port, &hints, &res);
+    free(host);
+    if (err) {
+        fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(err));
+        return -1;
+    }
+
+    int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (fd == -1) {
+        perror("socket");
+        freeaddrinfo(res);
+        return -1;
+    }
+
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+#ifdef SO_TIMESTAMPNS
+    if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) == -1)
+#else
+    if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMP, &on, sizeof(on)) == -1)
+#endif
+        perror("setsockopt timestamp");
+
+    if (bind(fd, res->ai_addr, res->ai_addrlen) == -1) {
+        perror("bind");
+        close(fd);
+        freeaddrinfo(res);
+        return -1;
+    }
+
+    if (res->ai_family == AF_INET) {
+        struct sockaddr_in *sin = (struct sockaddr_in *)res->ai_addr;
+        if (IN_MULTICAST(ntohl(sin->sin_addr.s_addr))) {
+            struct ip_mreq mreq;
+            mreq.imr_multiaddr = sin->sin_addr;
+            mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+            if (setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP,
+                           &mreq, sizeof(mreq)) == -1)
+                perror("IP_ADD_MEMBERSHIP");
+        }
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+/** @This receives a datagram and returns its arrival date.
+ *
+ * @param fd socket
+ * @param date_p filled in with the arrival date in nanoseconds
+ * @return false in case of error
+ */
+static bool receive(int fd, uint64_t *date_p)
+{
+    static uint8_t buffer[BUFFER_SIZE];
+    union {
+        char buf[CMSG_SPACE(sizeof(struct timespec))];
+        struct cmsghdr align;
+    } control;
+    struct iovec iovec = {
+        .iov_base = buffer,
+        .iov_len = sizeof(buffer),
+    };
+    struct msghdr msghdr = {
+        .msg_name = NULL,
+        .msg_namelen = 0,
+        .msg_iov = &iovec,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof(control.buf),
+        .msg_flags = 0,
+    };
+
+    if (recvmsg(fd, &msghdr, 0) == -1) {
+        perror("recvmsg");
+        return false;
+    }
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msghdr); cmsg != NULL;
+         cmsg = CMSG_NXTHDR(&msghdr, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET)
+            continue;
+#ifdef SO_TIMESTAMPNS
+        if (cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+            struct timespec ts;
+            memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+            *date_p = (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+            return true;
+        }
+#else
+        if (cmsg->cmsg_type == SCM_TIMESTAMP) {
+            struct timeval tv;
+            memcpy(&tv, CMSG_DATA(cmsg), sizeof(tv));
+            *date_p = (uint64_t)tv.tv_sec * NSEC_PER_SEC + tv.tv_usec * 1000;
+            return true;
+        }
+#endif
+    }
+
+    /* no kernel timestamp, fall back to the reception date */
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    *date_p = (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+    return true;
+}
+
+/** @This prints the statistics of a period and resets them.
+ *
+ * @param stats statistics of the period
+ */
+static void report(struct jitter_stats *stats)
+{
+    double mean = stats->sum / stats->count;
+    double var = stats->sum2 / stats->count - mean * mean;
+
+    /* largest deviation of the arrival dates from a constant rate, starting
+     * from the first datagram of the period */
+    double deviation = 0.;
+    for (uint64_t i = 0; i <= stats->count; i++) {
+        double expected = stats->dates[0] + mean * i;
+        double delta = fabs((double)stats->dates[i] - expected);
+        if (delta > deviation)
+            deviation = delta;
+    }
+
+    printf("%"PRIu64" intervals: min %.3f us, mean %.3f us, max %.3f us, "
+           "stddev %.3f us, max deviation %.3f us\n", stats->count,
+           stats->min / 1000., mean / 1000., stats->max / 1000.,
+           sqrt(var > 0. ? var : 0.) / 1000., deviation / 1000.);
+    fflush(stdout);
+
+    stats->dates[0] = stats->dates[stats->count];
+    stats->count = 0;
+    stats->min = UINT64_MAX;
+    stats->max = 0;
+    stats->sum = stats->sum2 = 0.;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long period = DEFAULT_REPORT;
+    unsigned long reports = 0;
+    int opt;
+
+    /* parse options */
+    while ((opt = getopt(argc, argv, "n:c:")) != -1) {
+        switch (opt) {
+            case 'n':
+                period = strtoul(optarg, NULL, 0);
+                break;
+            case 'c':
+                reports = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (argc - optind < 1 || !period)
+        usage(argv[0]);
+
+    int fd = open_socket(argv[optind]);
+    if (fd == -1)
+        exit(EXIT_FAILURE);
+
+    struct jitter_stats stats;
+    stats.count = 0;
+    stats.min = UINT64_MAX;
+    stats.max = 0;
+    stats.sum = stats.sum2 = 0.;
+    stats.dates = malloc(sizeof(uint64_t) * (period + 1));
+    assert(stats.dates != NULL);
+
+    if (!receive(fd, &stats.dates[0]))
+        exit(EXIT_FAILURE);
+
+    for ( ; ; ) {
+        uint64_t date;
+        if (!receive(fd, &date))
+            break;
+
+        uint64_t last = stats.dates[stats.count];
+        uint64_t interval = date > last ? date - last : 0;
+        stats.dates[++stats.count] = date;
+        if (interval < stats.min)
+            stats.min = interval;
+        if (interval > stats.max)
+            stats.max = interval;
+        stats.sum += interval;
+        stats.sum2 += (double)interval * interval;
+
+        if (stats.count == period) {
+            report(&stats);
+            if (reports && !--reports)
+                break;
+        }
+    }
+
+    free(stats.dates);
+    close(fd);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2017 OpenHeadend S.A.R.L.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** @file
+ * @short Upipe ubuf manager for block formats wrapping libavutil buffers
+ *
+ * This manager allows to pass refcounted AVBufferRef (typically the buffer
+ * of an AVPacket) to Upipe pipes without copying the data.
+ */
+
+#ifndef _UPIPE_AV_UBUF_BLOCK_AV_H_
+/** @hidden */
+#define _UPIPE_AV_UBUF_BLOCK_AV_H_
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <upipe/ubase.h>
+#include <upipe/ubuf.h>
+#include <upipe/ubuf_block.h>
+
+#include <stdint.h>
+
+#include <libavutil/buffer.h>
+
+/** @This is the signature to use to allocate from an AVBufferRef. */
+#define UBUF_BLOCK_AV_ALLOC_BUFFER UBASE_FOURCC('a','v','b','k')
+
+/** @This extends ubuf_command with specific commands for block av
+ * manager. */
+enum ubuf_block_av_command {
+    UBUF_BLOCK_AV_SENTINEL = UBUF_CONTROL_LOCAL,
+
+    /** returns the AVBufferRef of the first segment (AVBufferRef **,
+     * size_t *, size_t *) */
+    UBUF_BLOCK_AV_GET_BUFFER
+};
+
+/** @This returns a new ubuf pointing to part of an AVBufferRef. A new
+ * reference to the buffer is taken, so the caller may unref it afterwards.
+ *
+ * @param mgr management structure for this ubuf type
+ * @param buf refcounted libavutil buffer
+ * @param data pointer to the start of the data in the buffer
+ * @param size size of the data, in octets
+ * @return pointer to ubuf or NULL in case of failure
+ */
+static inline struct ubuf *ubuf_block_av_alloc(struct ubuf_mgr *mgr,
+                                               AVBufferRef *buf,
+                                               const uint8_t *data, int size)
+{
+    return ubuf_alloc(mgr, UBUF_BLOCK_AV_ALLOC_BUFFER, buf, data, size);
+}
+
+/** @This returns the AVBufferRef of the first segment of a block. The
+ * reference counter is not incremented.
+ *
+ * @param ubuf pointer to ubuf
+ * @param buf_p filled in with a pointer to the libavutil buffer
+ * @param offset_p filled in with the offset of the segment in the buffer
+ * @param size_p filled in with the size of the segment
+ * @return an error code
+ */
+static inline int ubuf_block_av_get_buffer(struct ubuf *ubuf,
+                                           AVBufferRef **buf_p,
+                                           size_t *offset_p, size_t *size_p)
+{
+    return ubuf_control(ubuf, UBUF_BLOCK_AV_GET_BUFFER,
+                        UBUF_BLOCK_AV_ALLOC_BUFFER, buf_p, offset_p, size_p);
+}
+
+/** @This allocates a new instance of the ubuf manager for block formats
+ * wrapping libavutil buffers. Regular block allocations are served with
+ * av_buffer_alloc.
+ *
+ * @param ubuf_pool_depth maximum number of ubuf structures in the pool
+ * @return pointer to manager, or NULL in case of error
+ */
+struct ubuf_mgr *ubuf_block_av_mgr_alloc(uint16_t ubuf_pool_depth);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -47,7 +47,12 @@ enum upipe_avfsrc_command {
      * (uint64_t *) */
     UPIPE_AVFSRC_GET_TIME,
     /** asks to read at the given time (uint64_t) */
-    UPIPE_AVFSRC_SET_TIME
+    UPIPE_AVFSRC_SET_TIME,
+    /** sets the read-ahead budget (unsigned int, uint64_t, uint64_t) */
+    UPIPE_AVFSRC_SET_READAHEAD,
+    /** returns the occupancy of the read-ahead queue (unsigned int *,
+     * uint64_t *, uint64_t *, unsigned int *, uint64_t *, uint64_t *) */
+    UPIPE_AVFSRC_GET_READAHEAD_STATS
 };
 
 /** @deprecated @This returns the content of an avformat option.
@@ -103,6 +108,52 @@ static inline int upipe_avfsrc_set_time(struct upipe *upipe, uint64_t time)
                          time);
 }
 
+/** @This enables read-ahead mode, where packets are demuxed by a dedicated
+ * thread and queued until the pipe outputs them, so that slow reads do not
+ * block the event loop. The reader thread waits when any of the limits is
+ * reached. It only takes effect after the next call to @ref upipe_set_uri.
+ *
+ * @param upipe description structure of the pipe
+ * @param packets maximum number of queued packets (at most 255), or 0 to
+ * disable read-ahead
+ * @param bytes maximum number of queued octets, or 0 for no limit
+ * @param duration maximum span of the queued timestamps, in clock units,
+ * or 0 for no limit
+ * @return an error code
+ */
+static inline int upipe_avfsrc_set_readahead(struct upipe *upipe,
+                                             unsigned int packets,
+                                             uint64_t bytes, uint64_t duration)
+{
+    return upipe_control(upipe, UPIPE_AVFSRC_SET_READAHEAD,
+                         UPIPE_AVFSRC_SIGNATURE, packets, bytes, duration);
+}
+
+/** @This returns the occupancy of the read-ahead queue. The maximum values
+ * are reset after being read.
+ *
+ * @param upipe description structure of the pipe
+ * @param packets_p filled in with the number of queued packets
+ * @param bytes_p filled in with the number of queued octets
+ * @param duration_p filled in with the span of the queued timestamps, in
+ * clock units
+ * @param max_packets_p filled in with the maximum number of queued packets
+ * @param max_bytes_p filled in with the maximum number of queued octets
+ * @param max_duration_p filled in with the maximum span of the queued
+ * timestamps, in clock units
+ * @return an error code
+ */
+static inline int upipe_avfsrc_get_readahead_stats(struct upipe *upipe,
+        unsigned int *packets_p, uint64_t *bytes_p, uint64_t *duration_p,
+        unsigned int *max_packets_p, uint64_t *max_bytes_p,
+        uint64_t *max_duration_p)
+{
+    return upipe_control(upipe, UPIPE_AVFSRC_GET_READAHEAD_STATS,
+                         UPIPE_AVFSRC_SIGNATURE, packets_p, bytes_p,
+                         duration_p, max_packets_p, max_bytes_p,
+                         max_duration_p);
+}
+
 /** @This returns the management structure for all avformat sources.
  *
  * @return pointer to manager
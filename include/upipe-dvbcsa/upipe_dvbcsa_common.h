@@ -52,6 +52,11 @@ enum upipe_dvbcsa_command {
     /** delete a pid from the encryption/decryption list (uint64_t) */
     UPIPE_DVBCSA_DEL_PID,
 
+    /** enable or disable adaptive batching (int) */
+    UPIPE_DVBCSA_SET_ADAPTIVE,
+    /** get batching statistics (unsigned *, unsigned *, uint64_t *) */
+    UPIPE_DVBCSA_GET_BATCH_STATS,
+
     /** custom dvbcsa commands start here */
     UPIPE_DVBCSA_CONTROL_LOCAL,
 };
@@ -107,6 +112,44 @@ static inline int upipe_dvbcsa_del_pid(struct upipe *upipe,
                          UPIPE_DVBCSA_COMMON_SIGNATURE, pid);
 }
 
+/** @This enables or disables adaptive batching on the bitslice pipes.
+ *
+ * In adaptive mode, batches are sized from the measured input packet rate
+ * (based on cr_sys) so that no packet is delayed by more than the maximum
+ * latency, instead of waiting for a full batch or the latency timer.
+ *
+ * @param upipe description structure of the pipe
+ * @param adaptive true to enable adaptive batching
+ * @return an error code
+ */
+static inline int upipe_dvbcsa_set_adaptive(struct upipe *upipe,
+                                            bool adaptive)
+{
+    return upipe_control(upipe, UPIPE_DVBCSA_SET_ADAPTIVE,
+                         UPIPE_DVBCSA_COMMON_SIGNATURE, adaptive ? 1 : 0);
+}
+
+/** @This gets the batching statistics of the bitslice pipes, and resets
+ * them.
+ *
+ * @param upipe description structure of the pipe
+ * @param target_p filled in with the expected number of packets per batch
+ * @param fill_p filled in with the average batch fill since the last call,
+ * in percent of the maximum batch size
+ * @param latency_p filled in with the maximum added latency since the last
+ * call
+ * @return an error code
+ */
+static inline int upipe_dvbcsa_get_batch_stats(struct upipe *upipe,
+                                               unsigned *target_p,
+                                               unsigned *fill_p,
+                                               uint64_t *latency_p)
+{
+    return upipe_control(upipe, UPIPE_DVBCSA_GET_BATCH_STATS,
+                         UPIPE_DVBCSA_COMMON_SIGNATURE,
+                         target_p, fill_p, latency_p);
+}
+
 /** @This stores a parsed dvbcsa control word. */
 struct ustring_dvbcsa_cw {
     /** matching part of the string */
@@ -46,6 +46,13 @@ enum upipe_rtcpfb_command {
 
      /** sets the payload type of the retransmit stream (unsigned) */
      UPIPE_RTCPFB_SET_RTX_PT,
+     /** sets the maximum retransmit rate per peer (uint64_t) */
+     UPIPE_RTCPFB_SET_RTX_RATE,
+     /** returns the maximum retransmit rate per peer (uint64_t *) */
+     UPIPE_RTCPFB_GET_RTX_RATE,
+     /** returns the retransmit statistics (uint64_t *, uint64_t *,
+      * uint64_t *, uint64_t *, unsigned int *) */
+     UPIPE_RTCPFB_GET_STATS,
 };
 
 /** @This sets the value of the rtx_pt channel.
@@ -61,6 +68,58 @@ static inline int upipe_rtcpfb_set_rtx_pt(struct upipe *upipe,
                          UPIPE_RTCPFB_SIGNATURE, (unsigned)rtx_pt);
 }
 
+/** @This sets the maximum number of packets retransmitted per second to
+ * each peer, that is each input subpipe. Requests exceeding the rate are
+ * ignored.
+ *
+ * @param upipe description structure of the pipe
+ * @param rate number of packets per second, or 0 for no limit (default)
+ * @return an error code
+ */
+static inline int upipe_rtcpfb_set_rtx_rate(struct upipe *upipe,
+        uint64_t rate)
+{
+    return upipe_control(upipe, UPIPE_RTCPFB_SET_RTX_RATE,
+                         UPIPE_RTCPFB_SIGNATURE, rate);
+}
+
+/** @This returns the maximum number of packets retransmitted per second to
+ * each peer.
+ *
+ * @param upipe description structure of the pipe
+ * @param rate_p filled in with the number of packets per second, or 0
+ * @return an error code
+ */
+static inline int upipe_rtcpfb_get_rtx_rate(struct upipe *upipe,
+        uint64_t *rate_p)
+{
+    return upipe_control(upipe, UPIPE_RTCPFB_GET_RTX_RATE,
+                         UPIPE_RTCPFB_SIGNATURE, rate_p);
+}
+
+/** @This returns the cumulative retransmit statistics of the pipe.
+ *
+ * @param upipe description structure of the pipe
+ * @param nacked_p filled in with the number of packets requested, or NULL
+ * @param retransmitted_p filled in with the number of packets retransmitted,
+ * or NULL
+ * @param missing_p filled in with the number of requested packets which
+ * were not in the history anymore, or NULL
+ * @param rate_limited_p filled in with the number of requests ignored
+ * because of the rate limit, or NULL
+ * @param history_p filled in with the number of packets in the history, or
+ * NULL
+ * @return an error code
+ */
+static inline int upipe_rtcpfb_get_stats(struct upipe *upipe,
+        uint64_t *nacked_p, uint64_t *retransmitted_p, uint64_t *missing_p,
+        uint64_t *rate_limited_p, unsigned int *history_p)
+{
+    return upipe_control(upipe, UPIPE_RTCPFB_GET_STATS,
+                         UPIPE_RTCPFB_SIGNATURE, nacked_p, retransmitted_p,
+                         missing_p, rate_limited_p, history_p);
+}
+
 /** @This returns the management structure for rtcpfb pipes.
  *
  * @return pointer to manager
@@ -45,6 +45,7 @@ enum upipe_rtpfb_command {
 
     UPIPE_RTPFB_GET_STATS, /* int sig, unsigned *, unsigned *, size_t *, size_t *, size_t *, size_t *, size_t * */
     UPIPE_RTPFB_SET_RTX_PT, /* int sig, unsigned */
+    UPIPE_RTPFB_GET_RETRANSMIT_STATS, /* int sig, uint64_t *, uint64_t *, uint64_t * */
 };
 
 static inline int upipe_rtpfb_get_stats(struct upipe *upipe,
@@ -70,6 +71,24 @@ static inline int upipe_rtpfb_set_rtx_pt(struct upipe *upipe,
                          UPIPE_RTPFB_SIGNATURE, (unsigned)rtx_pt);
 }
 
+/** @This returns the cumulative retransmission counters of the pipe.
+ *
+ * @param upipe description structure of the pipe
+ * @param requested_p filled in with the number of packets for which a
+ * retransmission was requested, or NULL
+ * @param recovered_p filled in with the number of missing packets received
+ * in time, or NULL
+ * @param late_p filled in with the number of packets received after their
+ * output date, or NULL
+ * @return an error code
+ */
+static inline int upipe_rtpfb_get_retransmit_stats(struct upipe *upipe,
+        uint64_t *requested_p, uint64_t *recovered_p, uint64_t *late_p)
+{
+    return upipe_control(upipe, UPIPE_RTPFB_GET_RETRANSMIT_STATS,
+                         UPIPE_RTPFB_SIGNATURE, requested_p, recovered_p,
+                         late_p);
+}
 
 /** @This returns the management structure for rtpfb pipes.
  *
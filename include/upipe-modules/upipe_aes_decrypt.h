@@ -4,8 +4,50 @@
 extern "C" {
 #endif
 
+#include <upipe/upipe.h>
+
 #define UPIPE_AES_DECRYPT_SIGNATURE     UBASE_FOURCC('a','e','s','d')
 
+/** @This extends upipe_command with specific commands for aes decrypt
+ * pipes. */
+enum upipe_aes_decrypt_command {
+    UPIPE_AES_DECRYPT_SENTINEL = UPIPE_CONTROL_LOCAL,
+
+    /** returns true if AES-NI instructions are used (bool *) */
+    UPIPE_AES_DECRYPT_GET_AESNI,
+    /** enables or disables AES-NI instructions (bool) */
+    UPIPE_AES_DECRYPT_SET_AESNI,
+};
+
+/** @This returns true if the pipe uses AES-NI instructions.
+ *
+ * @param upipe description structure of the pipe
+ * @param aesni_p filled in with true if AES-NI instructions are used
+ * @return an error code
+ */
+static inline int upipe_aes_decrypt_get_aesni(struct upipe *upipe,
+                                              bool *aesni_p)
+{
+    return upipe_control(upipe, UPIPE_AES_DECRYPT_GET_AESNI,
+                         UPIPE_AES_DECRYPT_SIGNATURE, aesni_p);
+}
+
+/** @This enables or disables the use of AES-NI instructions. They are used
+ * by default if the CPU supports them; disabling them falls back to the
+ * portable implementation.
+ *
+ * @param upipe description structure of the pipe
+ * @param aesni true to use AES-NI instructions
+ * @return an error code, @ref UBASE_ERR_INVALID if the CPU doesn't support
+ * them
+ */
+static inline int upipe_aes_decrypt_set_aesni(struct upipe *upipe,
+                                              bool aesni)
+{
+    return upipe_control(upipe, UPIPE_AES_DECRYPT_SET_AESNI,
+                         UPIPE_AES_DECRYPT_SIGNATURE, aesni ? 1 : 0);
+}
+
 struct upipe_mgr *upipe_aes_decrypt_mgr_alloc(void);
 
 #ifdef __cplusplus
@@ -25,6 +25,9 @@
 
 /** @file
  * @short Upipe module allowing to duplicate to several outputs
+ *
+ * The duplicated urefs share their buffers. Their attributes are copied,
+ * unless sharing is enabled with @ref upipe_dup_set_shared.
  */
 
 #ifndef _UPIPE_MODULES_UPIPE_DUP_H_
@@ -39,12 +42,50 @@ extern "C" {
 #define UPIPE_DUP_SIGNATURE UBASE_FOURCC('d','u','p',' ')
 #define UPIPE_DUP_OUTPUT_SIGNATURE UBASE_FOURCC('d','u','p','o')
 
+/** @This extends upipe_command with specific commands for dup pipes. */
+enum upipe_dup_command {
+    UPIPE_DUP_SENTINEL = UPIPE_CONTROL_LOCAL,
+
+    /** returns true if the attributes are shared (bool *) */
+    UPIPE_DUP_GET_SHARED,
+    /** enables or disables the sharing of attributes (bool) */
+    UPIPE_DUP_SET_SHARED
+};
+
 /** @This returns the management structure for all dup pipes.
  *
  * @return pointer to manager
  */
 struct upipe_mgr *upipe_dup_mgr_alloc(void);
 
+/** @This returns true if the outputs share the attributes of the urefs.
+ *
+ * @param upipe description structure of the pipe
+ * @param shared_p filled in with true if the attributes are shared
+ * @return an error code
+ */
+static inline int upipe_dup_get_shared(struct upipe *upipe, bool *shared_p)
+{
+    return upipe_control(upipe, UPIPE_DUP_GET_SHARED, UPIPE_DUP_SIGNATURE,
+                         shared_p);
+}
+
+/** @This enables or disables the sharing of attributes between the outputs
+ * (see @ref uref_share). It is disabled by default, because an output
+ * writing its attributes then pays for the copy, in addition to the
+ * reference counting. It is worth it when most outputs don't modify the
+ * attributes, for instance when they feed sinks running in other threads.
+ *
+ * @param upipe description structure of the pipe
+ * @param shared true to share the attributes
+ * @return an error code
+ */
+static inline int upipe_dup_set_shared(struct upipe *upipe, bool shared)
+{
+    return upipe_control(upipe, UPIPE_DUP_SET_SHARED, UPIPE_DUP_SIGNATURE,
+                         shared ? 1 : 0);
+}
+
 #ifdef __cplusplus
 }
 #endif
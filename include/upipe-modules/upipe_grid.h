@@ -27,6 +27,7 @@
 #define _UPIPE_MODULES_UPIPE_GRID_H_
 
 #include <upipe/upipe.h>
+#include <upipe/umutex.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -51,6 +52,10 @@ enum upipe_grid_command {
     UPIPE_GRID_SENTINEL = UPIPE_CONTROL_LOCAL,
     /** set the max retention time (uint64_t) */
     UPIPE_GRID_SET_MAX_RETENTION,
+    /** set the frame capacity of new inputs (unsigned int) */
+    UPIPE_GRID_SET_INPUT_CAPACITY,
+    /** switch to threaded mode (struct umutex *) */
+    UPIPE_GRID_SET_THREADED,
 };
 
 /** @This sets the max retention time for input buffers.
@@ -66,6 +71,43 @@ static inline int upipe_grid_set_max_retention(struct upipe *upipe,
                          UPIPE_GRID_SIGNATURE, max_retention);
 }
 
+/** @This sets the maximum number of frames retained by each input. It
+ * only applies to inputs allocated afterwards. When an input is full, its
+ * oldest frame is dropped.
+ *
+ * @param upipe description structure of the pipe
+ * @param capacity maximum number of retained frames per input
+ * @return an error code
+ */
+static inline int upipe_grid_set_input_capacity(struct upipe *upipe,
+                                                unsigned int capacity)
+{
+    return upipe_control(upipe, UPIPE_GRID_SET_INPUT_CAPACITY,
+                         UPIPE_GRID_SIGNATURE, capacity);
+}
+
+/** @This switches the grid to threaded mode, in which inputs and outputs
+ * may run on different threads. Each input then only keeps its latest
+ * frame, which outputs read without locking or waiting; a frame is dropped
+ * if outputs still read all the previous ones. An output keeps the frame
+ * of its current input until it switches, even if the input is released;
+ * the input itself is always cleaned up on its own thread. The optional
+ * mutex protects the allocation and the release of inputs and outputs,
+ * which is otherwise expected to happen on a single thread; iterating the
+ * inputs must still be done on the thread of the grid. This must be called
+ * before any input or output is allocated.
+ *
+ * @param upipe description structure of the pipe
+ * @param mutex mutual exclusion primitives for sub pipe lists, or NULL
+ * @return an error code
+ */
+static inline int upipe_grid_set_threaded(struct upipe *upipe,
+                                          struct umutex *mutex)
+{
+    return upipe_control(upipe, UPIPE_GRID_SET_THREADED,
+                         UPIPE_GRID_SIGNATURE, mutex);
+}
+
 /** @This allocates a new grid input.
  *
  * @param upipe description structure of the pipe
@@ -57,9 +57,49 @@ enum upipe_qsrc_command {
     /** returns the maximum length of the queue (unsigned int *) */
     UPIPE_QSRC_GET_MAX_LENGTH,
     /** returns the current length of the queue (unsigned int *) */
-    UPIPE_QSRC_GET_LENGTH
+    UPIPE_QSRC_GET_LENGTH,
+    /** returns the number of elements currently accepted in the queue
+     * (unsigned int *) */
+    UPIPE_QSRC_GET_LIMIT,
+    /** returns the statistics of the queue (unsigned int *, uint64_t *,
+     * uint64_t *) */
+    UPIPE_QSRC_GET_STATS,
+    /** sets the occupancy thresholds (unsigned int, unsigned int) */
+    UPIPE_QSRC_SET_THRESHOLDS,
+    /** sets the bounds of the elastic mode (unsigned int, unsigned int) */
+    UPIPE_QSRC_SET_ELASTIC
 };
 
+/** @This extends uprobe_event with specific events for queue source. */
+enum uprobe_qsrc_event {
+    UPROBE_QSRC_SENTINEL = UPROBE_LOCAL,
+
+    /** the occupancy of the queue reached the high threshold
+     * (unsigned int) */
+    UPROBE_QSRC_HIGH,
+    /** the occupancy of the queue fell back to the low threshold
+     * (unsigned int) */
+    UPROBE_QSRC_LOW,
+    /** the number of elements accepted in the queue changed (unsigned int) */
+    UPROBE_QSRC_RESIZE
+};
+
+/** @This converts @ref uprobe_qsrc_event to a string.
+ *
+ * @param event event to convert
+ * @return a string or NULL if invalid
+ */
+static inline const char *upipe_qsrc_event_str(int event)
+{
+    switch ((enum uprobe_qsrc_event)event) {
+    UBASE_CASE_TO_STR(UPROBE_QSRC_HIGH);
+    UBASE_CASE_TO_STR(UPROBE_QSRC_LOW);
+    UBASE_CASE_TO_STR(UPROBE_QSRC_RESIZE);
+    case UPROBE_QSRC_SENTINEL: break;
+    }
+    return NULL;
+}
+
 /** @This returns the management structure for all queue sources.
  *
  * @return pointer to manager
@@ -95,6 +135,83 @@ static inline int upipe_qsrc_get_length(struct upipe *upipe,
                          UPIPE_QSRC_SIGNATURE, length_p);
 }
 
+/** @This returns the number of elements currently accepted in the queue. It
+ * is equal to the maximum length, unless the elastic mode is enabled.
+ *
+ * @param upipe description structure of the pipe
+ * @param limit_p filled in with the number of elements accepted
+ * @return an error code
+ */
+static inline int upipe_qsrc_get_limit(struct upipe *upipe,
+                                       unsigned int *limit_p)
+{
+    return upipe_control(upipe, UPIPE_QSRC_GET_LIMIT,
+                         UPIPE_QSRC_SIGNATURE, limit_p);
+}
+
+/** @This returns the statistics of the queue. The maximum values are reset
+ * after being read.
+ *
+ * The latency is only measured if both the queue sink and the queue source
+ * have a uclock attached (see @ref upipe_attach_uclock). The input date
+ * recorded by the sink is removed by the source in any case.
+ *
+ * @param upipe description structure of the pipe
+ * @param high_water_p filled in with the maximum number of elements in the
+ * queue
+ * @param latency_p filled in with the time spent between the input of the
+ * queue sink and the output of the queue source by the last uref, or
+ * UINT64_MAX if unknown
+ * @param max_latency_p filled in with the maximum time spent between the
+ * queue sink and the queue source, or UINT64_MAX if unknown
+ * @return an error code
+ */
+static inline int upipe_qsrc_get_stats(struct upipe *upipe,
+        unsigned int *high_water_p, uint64_t *latency_p,
+        uint64_t *max_latency_p)
+{
+    return upipe_control(upipe, UPIPE_QSRC_GET_STATS, UPIPE_QSRC_SIGNATURE,
+                         high_water_p, latency_p, max_latency_p);
+}
+
+/** @This sets the occupancy thresholds of the queue. The pipe throws
+ * @ref UPROBE_QSRC_HIGH when the number of elements in the queue reaches the
+ * high threshold, and then @ref UPROBE_QSRC_LOW when it falls back to the
+ * low threshold.
+ *
+ * @param upipe description structure of the pipe
+ * @param low low threshold
+ * @param high high threshold, or 0 to disable the events
+ * @return an error code
+ */
+static inline int upipe_qsrc_set_thresholds(struct upipe *upipe,
+                                            unsigned int low,
+                                            unsigned int high)
+{
+    return upipe_control(upipe, UPIPE_QSRC_SET_THRESHOLDS,
+                         UPIPE_QSRC_SIGNATURE, low, high);
+}
+
+/** @This enables the elastic mode of the queue. The number of elements
+ * accepted in the queue starts at the lower bound, doubles each time the
+ * queue is found full, and halves when the queue stays mostly empty, without
+ * exceeding the bounds. The pipe throws @ref UPROBE_QSRC_RESIZE on each
+ * change. The upper bound may not exceed the maximum length given at
+ * allocation, as the queue is not reallocated.
+ *
+ * @param upipe description structure of the pipe
+ * @param min_length lower bound, or 0 to disable the elastic mode
+ * @param max_length upper bound
+ * @return an error code
+ */
+static inline int upipe_qsrc_set_elastic(struct upipe *upipe,
+                                         unsigned int min_length,
+                                         unsigned int max_length)
+{
+    return upipe_control(upipe, UPIPE_QSRC_SET_ELASTIC,
+                         UPIPE_QSRC_SIGNATURE, min_length, max_length);
+}
+
 /** @hidden */
 #define ARGS_DECL , unsigned int queue_length
 /** @hidden */
@@ -51,6 +51,34 @@ enum upipe_udpsink_command {
     UPIPE_UDPSINK_SET_FD,
     /** set remote address (const struct sockaddr *, socklen_t) **/
     UPIPE_UDPSINK_SET_PEER,
+    /** get pacing mode (enum upipe_udpsink_pacing *) **/
+    UPIPE_UDPSINK_GET_PACING,
+    /** set pacing mode (enum upipe_udpsink_pacing) **/
+    UPIPE_UDPSINK_SET_PACING,
+};
+
+/** @This defines the ways a live udp sink paces its datagrams. Pacing only
+ * applies when a uclock is attached, and each datagram departs at its
+ * cr_sys date plus the latency of the flow.
+ *
+ * The SO_TXTIME modes only attach the departure date to the datagrams: the
+ * caller must configure the matching qdisc on the outgoing interface (for
+ * instance with tc), otherwise the kernel ignores the dates and sends the
+ * datagrams as soon as they are written, up to a few milliseconds early. */
+enum upipe_udpsink_pacing {
+    /** wait for the departure date with event loop timers (default) */
+    UPIPE_UDPSINK_PACING_TIMER,
+    /** wait with event loop timers until shortly before the departure date,
+     * then busy-poll the clock; the pipe should run in a dedicated thread,
+     * for instance behind a @ref upipe_wsink */
+    UPIPE_UDPSINK_PACING_BUSY,
+    /** hand datagrams to the kernel in advance with their departure date
+     * (SO_TXTIME) on CLOCK_MONOTONIC, as expected by the fq qdisc */
+    UPIPE_UDPSINK_PACING_TXTIME_FQ,
+    /** hand datagrams to the kernel in advance with their departure date
+     * (SO_TXTIME) on CLOCK_TAI, as expected by the etf qdisc; this requires
+     * CAP_NET_ADMIN */
+    UPIPE_UDPSINK_PACING_TXTIME_ETF,
 };
 
 /** @This returns the management structure for all udp sinks.
@@ -96,6 +124,37 @@ static inline int upipe_udpsink_set_peer(struct upipe *upipe,
     return upipe_control(upipe, UPIPE_UDPSINK_SET_PEER, UPIPE_UDPSINK_SIGNATURE,
             addr, addrlen);
 }
+
+/** @This returns the pacing mode requested from the socket, which differs
+ * from the mode set if the socket does not support SO_TXTIME. For the
+ * SO_TXTIME modes, it does not tell whether the qdisc of the interface
+ * honours the departure dates, which the pipe cannot check.
+ *
+ * @param upipe description structure of the pipe
+ * @param pacing_p filled in with the pacing mode
+ * @return an error code
+ */
+static inline int upipe_udpsink_get_pacing(struct upipe *upipe,
+        enum upipe_udpsink_pacing *pacing_p)
+{
+    return upipe_control(upipe, UPIPE_UDPSINK_GET_PACING,
+                         UPIPE_UDPSINK_SIGNATURE, pacing_p);
+}
+
+/** @This sets the pacing mode. If SO_TXTIME cannot be enabled on the socket,
+ * the pipe falls back to @ref UPIPE_UDPSINK_PACING_BUSY.
+ *
+ * @param upipe description structure of the pipe
+ * @param pacing pacing mode
+ * @return an error code
+ */
+static inline int upipe_udpsink_set_pacing(struct upipe *upipe,
+        enum upipe_udpsink_pacing pacing)
+{
+    return upipe_control(upipe, UPIPE_UDPSINK_SET_PACING,
+                         UPIPE_UDPSINK_SIGNATURE, pacing);
+}
+
 #ifdef __cplusplus
 }
 #endif
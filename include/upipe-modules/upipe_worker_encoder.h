@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2017 OpenHeadend S.A.R.L.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** @file
+ * @short Bin pipe running an encoder on a remote thread
+ *
+ * It wraps a worker linear pipe (see @ref upipe_wlin_alloc) around an
+ * encoder pipe, so that the encoder runs on the remote upump_mgr with
+ * bounded queues in both directions. When the input queue is full, the
+ * source feeding the bin is blocked until the encoder catches up.
+ *
+ * The bin also keeps track of the number of frames sent to the encoder
+ * whose output has not been received yet, computed from the number of input
+ * and output frames, and of the time spent between the input of a frame and
+ * the output of the encoded frame (only if a uclock is available, and for
+ * encoders which keep the attributes of the input frames).
+ *
+ * Please note that the remote subpipeline is not "used" so its refcount is not
+ * incremented. For that reason it shouldn't be "released" afterwards. Only
+ * release the wenc pipe.
+ *
+ * Note that the allocator requires four additional parameters:
+ * @table 2
+ * @item upipe_remote @item encoder subpipeline to transfer to remote
+ * upump_mgr (belongs to the callee)
+ * @item uprobe_remote @item probe hierarchy to use on the remote thread
+ * (belongs to the callee)
+ * @item input_queue_length @item number of packets in the queue between main
+ * and remote thread
+ * @item output_queue_length @item number of packets in the queue between remote
+ * and main thread
+ * @end table
+ */
+
+#ifndef _UPIPE_MODULES_UPIPE_WORKER_ENCODER_H_
+/** @hidden */
+#define _UPIPE_MODULES_UPIPE_WORKER_ENCODER_H_
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <upipe/upipe.h>
+
+#define UPIPE_WENC_SIGNATURE UBASE_FOURCC('w','e','n','c')
+
+/** @This extends upipe_command with specific commands for wenc pipes. */
+enum upipe_wenc_command {
+    UPIPE_WENC_SENTINEL = UPIPE_CONTROL_LOCAL,
+
+    /** returns the statistics of the pipe (unsigned int *, unsigned int *,
+     * uint64_t *, uint64_t *) */
+    UPIPE_WENC_GET_STATS
+};
+
+/** @This returns the statistics of the pipe. The maximum values are reset
+ * after being read.
+ *
+ * @param upipe description structure of the pipe
+ * @param depth_p filled in with the number of frames in the queues and the
+ * encoder
+ * @param max_depth_p filled in with the maximum number of frames in the
+ * queues and the encoder
+ * @param latency_p filled in with the time spent in the queues and the
+ * encoder by the last frame, or UINT64_MAX if no uclock is available
+ * @param max_latency_p filled in with the maximum time spent in the queues
+ * and the encoder, or UINT64_MAX if no uclock is available
+ * @return an error code
+ */
+static inline int upipe_wenc_get_stats(struct upipe *upipe,
+        unsigned int *depth_p, unsigned int *max_depth_p,
+        uint64_t *latency_p, uint64_t *max_latency_p)
+{
+    return upipe_control(upipe, UPIPE_WENC_GET_STATS, UPIPE_WENC_SIGNATURE,
+                         depth_p, max_depth_p, latency_p, max_latency_p);
+}
+
+/** @This returns the management structure for all wenc pipes.
+ *
+ * @param xfer_mgr manager to transfer pipes to the remote thread
+ * @return pointer to manager
+ */
+struct upipe_mgr *upipe_wenc_mgr_alloc(struct upipe_mgr *xfer_mgr);
+
+/** @hidden */
+#define ARGS_DECL , struct upipe *upipe_remote, struct uprobe *uprobe_remote, unsigned int input_queue_length, unsigned int output_queue_length
+/** @hidden */
+#define ARGS , upipe_remote, uprobe_remote, input_queue_length, output_queue_length
+UPIPE_HELPER_ALLOC(wenc, UPIPE_WENC_SIGNATURE)
+#undef ARGS
+#undef ARGS_DECL
+
+#ifdef __cplusplus
+}
+#endif
+#endif
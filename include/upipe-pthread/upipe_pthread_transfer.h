@@ -45,6 +45,34 @@ extern "C" {
 /** @hidden */
 struct umutex;
 
+/** @This describes where the thread created by
+ * @ref upipe_pthread_xfer_mgr_alloc_placement runs and allocates memory. */
+struct upipe_pthread_placement {
+    /** CPUs the thread is bound to, or NULL to bind it to the CPUs of
+     * numa_node, if set */
+    const unsigned int *cpus;
+    /** number of CPUs in cpus */
+    unsigned int nb_cpus;
+    /** NUMA node from which the thread preferably allocates memory, or -1 */
+    int numa_node;
+    /** priority of the thread in the SCHED_FIFO class, or 0 to keep the
+     * default scheduling policy */
+    int fifo_priority;
+};
+
+/** @This initializes a placement structure with no constraint.
+ *
+ * @param placement pointer to placement structure
+ */
+static inline void
+    upipe_pthread_placement_init(struct upipe_pthread_placement *placement)
+{
+    placement->cpus = NULL;
+    placement->nb_cpus = 0;
+    placement->numa_node = -1;
+    placement->fifo_priority = 0;
+}
+
 /** @This returns a management structure for transfer pipes, using a new
  * pthread. You would need one management structure per target thread.
  *
@@ -67,6 +95,35 @@ struct upipe_mgr *upipe_pthread_xfer_mgr_alloc(uint8_t queue_length,
         uint16_t upump_blocker_pool_depth, struct umutex *mutex,
         pthread_t *pthread_id_p, const pthread_attr_t *restrict attr);
 
+/** @This returns a management structure for transfer pipes, using a new
+ * pthread bound to the given CPUs and NUMA node. Memory allocated by the
+ * pipes running in the thread, including the buffers of ubuf managers
+ * backed by @ref umem_alloc_mgr_alloc, comes preferably from that node.
+ *
+ * Failures to apply the placement (for instance missing privileges for
+ * SCHED_FIFO) are reported as warnings, and the thread runs anyway.
+ *
+ * @param queue_length maximum length of the internal queue of commands
+ * @param msg_pool_depth maximum number of messages in the pool
+ * @param uprobe_pthread_upump_mgr pointer to optional probe, that will be set
+ * with the created upump_mgr
+ * @param upump_mgr_alloc alloc function provided by the upump manager
+ * @param upump_pool_depth maximum number of upump structures in the pool
+ * @param upump_blocker_pool_depth maximum number of upump_blocker structures in
+ * the pool
+ * @param mutex mutual exclusion pimitives to access the event loop, or NULL
+ * @param pthread_id_p reference to created thread ID (may be NULL)
+ * @param attr pthread attributes
+ * @param placement placement of the thread, or NULL
+ * @return pointer to xfer manager
+ */
+struct upipe_mgr *upipe_pthread_xfer_mgr_alloc_placement(uint8_t queue_length,
+        uint16_t msg_pool_depth, struct uprobe *uprobe_pthread_upump_mgr,
+        upump_mgr_alloc upump_mgr_alloc, uint16_t upump_pool_depth,
+        uint16_t upump_blocker_pool_depth, struct umutex *mutex,
+        pthread_t *pthread_id_p, const pthread_attr_t *restrict attr,
+        const struct upipe_pthread_placement *placement);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2017 OpenHeadend S.A.R.L.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/** @file
+ * @short Upipe module generating SMPTE 2022-1 FEC streams
+ *
+ * The pipe outputs its RTP input unchanged, and builds column and row FEC
+ * packets for a matrix of L columns and D rows, which are emitted by two
+ * output subpipes and may be sent to separate UDP ports.
+ */
+
+#ifndef _UPIPE_TS_UPIPE_RTP_FEC_ENC_H_
+/** @hidden */
+#define _UPIPE_TS_UPIPE_RTP_FEC_ENC_H_
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <upipe/upipe.h>
+
+#define UPIPE_RTP_FEC_ENC_SIGNATURE UBASE_FOURCC('r','f','c','e')
+#define UPIPE_RTP_FEC_ENC_OUTPUT_SIGNATURE UBASE_FOURCC('r','f','c','o')
+
+/** @This extends upipe_command with specific commands for rtp fec encoder
+ * pipes. */
+enum upipe_rtp_fec_enc_command {
+    UPIPE_RTP_FEC_ENC_SENTINEL = UPIPE_CONTROL_LOCAL,
+
+    /** returns the fec-column subpipe (struct upipe **) */
+    UPIPE_RTP_FEC_ENC_GET_COL_SUB,
+    /** returns the fec-row subpipe (struct upipe **) */
+    UPIPE_RTP_FEC_ENC_GET_ROW_SUB,
+    /** sets the size of the matrix (unsigned, unsigned) */
+    UPIPE_RTP_FEC_ENC_SET_MATRIX,
+    /** returns the size of the matrix (unsigned *, unsigned *) */
+    UPIPE_RTP_FEC_ENC_GET_MATRIX,
+};
+
+/** @This returns the fec-column subpipe. The refcount is not incremented so
+ * you have to use it if you want to keep the pointer.
+ *
+ * @param upipe description structure of the super pipe
+ * @param upipe_p filled in with a pointer to the fec-column subpipe
+ * @return an error code
+ */
+static inline int upipe_rtp_fec_enc_get_col_sub(struct upipe *upipe,
+                                                struct upipe **upipe_p)
+{
+    return upipe_control(upipe, UPIPE_RTP_FEC_ENC_GET_COL_SUB,
+                         UPIPE_RTP_FEC_ENC_SIGNATURE, upipe_p);
+}
+
+/** @This returns the fec-row subpipe. The refcount is not incremented so
+ * you have to use it if you want to keep the pointer.
+ *
+ * @param upipe description structure of the super pipe
+ * @param upipe_p filled in with a pointer to the fec-row subpipe
+ * @return an error code
+ */
+static inline int upipe_rtp_fec_enc_get_row_sub(struct upipe *upipe,
+                                                struct upipe **upipe_p)
+{
+    return upipe_control(upipe, UPIPE_RTP_FEC_ENC_GET_ROW_SUB,
+                         UPIPE_RTP_FEC_ENC_SIGNATURE, upipe_p);
+}
+
+/** @This sets the size of the FEC matrix. SMPTE 2022-1 allows 1 to 20
+ * columns, 4 to 20 rows, and at most 100 packets per matrix. The current
+ * matrix is discarded.
+ *
+ * @param upipe description structure of the pipe
+ * @param columns number of columns (L)
+ * @param rows number of rows (D)
+ * @return an error code
+ */
+static inline int upipe_rtp_fec_enc_set_matrix(struct upipe *upipe,
+                                               unsigned columns,
+                                               unsigned rows)
+{
+    return upipe_control(upipe, UPIPE_RTP_FEC_ENC_SET_MATRIX,
+                         UPIPE_RTP_FEC_ENC_SIGNATURE, columns, rows);
+}
+
+/** @This returns the size of the FEC matrix.
+ *
+ * @param upipe description structure of the pipe
+ * @param columns_p filled in with the number of columns (L)
+ * @param rows_p filled in with the number of rows (D)
+ * @return an error code
+ */
+static inline int upipe_rtp_fec_enc_get_matrix(struct upipe *upipe,
+                                               unsigned *columns_p,
+                                               unsigned *rows_p)
+{
+    return upipe_control(upipe, UPIPE_RTP_FEC_ENC_GET_MATRIX,
+                         UPIPE_RTP_FEC_ENC_SIGNATURE, columns_p, rows_p);
+}
+
+/** @This returns the management structure for rtp fec encoder pipes.
+ *
+ * @return pointer to manager
+ */
+struct upipe_mgr *upipe_rtp_fec_enc_mgr_alloc(void);
+
+/** @This allocates and initializes a rtp fec encoder pipe.
+ *
+ * @param mgr management structure for rtp fec encoder type
+ * @param uprobe structure used to raise events for the super pipe
+ * @param uprobe_col structure used to raise events for the fec-column
+ * subpipe
+ * @param uprobe_row structure used to raise events for the fec-row subpipe
+ * @return pointer to allocated pipe, or NULL in case of failure
+ */
+static inline struct upipe *upipe_rtp_fec_enc_alloc(struct upipe_mgr *mgr,
+                                                    struct uprobe *uprobe,
+                                                    struct uprobe *uprobe_col,
+                                                    struct uprobe *uprobe_row)
+{
+    return upipe_alloc(mgr, uprobe, UPIPE_RTP_FEC_ENC_SIGNATURE,
+                       uprobe_col, uprobe_row);
+}
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -123,6 +123,13 @@ enum upipe_ts_demux_mgr_command {
 
     UPIPE_TS_DEMUX_MGR_GET_SET_MGR(autof, AUTOF)
 #undef UPIPE_TS_DEMUX_MGR_GET_SET_MGR
+
+    /** returns true if ts_pesd inner pipes reassemble PES in contiguous
+     * buffers (bool *) */
+    UPIPE_TS_DEMUX_MGR_GET_PESD_CONTIGUOUS,
+    /** sets the reassembly of PES in contiguous buffers by ts_pesd inner
+     * pipes (bool) */
+    UPIPE_TS_DEMUX_MGR_SET_PESD_CONTIGUOUS
 };
 
 /** @hidden */
@@ -178,6 +185,35 @@ UPIPE_TS_DEMUX_MGR_GET_SET_MGR2(ts_scte35d, TS_SCTE35D)
 UPIPE_TS_DEMUX_MGR_GET_SET_MGR2(autof, AUTOF)
 #undef UPIPE_TS_DEMUX_MGR_GET_SET_MGR2
 
+/** @This returns whether ts_pesd inner pipes reassemble PES in contiguous
+ * buffers.
+ *
+ * @param mgr pointer to manager
+ * @param contiguous_p filled in with true if PES are reassembled
+ * @return an error code
+ */
+static inline int upipe_ts_demux_mgr_get_pesd_contiguous(struct upipe_mgr *mgr,
+                                                         bool *contiguous_p)
+{
+    return upipe_mgr_control(mgr, UPIPE_TS_DEMUX_MGR_GET_PESD_CONTIGUOUS,
+                             UPIPE_TS_DEMUX_SIGNATURE, contiguous_p);
+}
+
+/** @This sets whether ts_pesd inner pipes reassemble PES in contiguous
+ * buffers (see @ref upipe_ts_pesd_set_contiguous). This only applies to
+ * elementary streams set up afterwards.
+ *
+ * @param mgr pointer to manager
+ * @param contiguous true to reassemble PES
+ * @return an error code
+ */
+static inline int upipe_ts_demux_mgr_set_pesd_contiguous(struct upipe_mgr *mgr,
+                                                         bool contiguous)
+{
+    return upipe_mgr_control(mgr, UPIPE_TS_DEMUX_MGR_SET_PESD_CONTIGUOUS,
+                             UPIPE_TS_DEMUX_SIGNATURE, contiguous);
+}
+
 #ifdef __cplusplus
 }
 #endif
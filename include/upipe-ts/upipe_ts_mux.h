@@ -158,6 +158,10 @@ enum upipe_ts_mux_command {
     /** prepares the next access unit/section for the given date
      * (uint64_t, uint64_t) */
     UPIPE_TS_MUX_PREPARE,
+    /** returns true if output packets are contiguous buffers (bool *) */
+    UPIPE_TS_MUX_GET_CONTIGUOUS,
+    /** sets whether output packets are contiguous buffers (bool) */
+    UPIPE_TS_MUX_SET_CONTIGUOUS,
 
     /** ts_encaps commands begin here */
     UPIPE_TS_MUX_ENCAPS = UPIPE_CONTROL_LOCAL + 0x1000,
@@ -712,6 +716,37 @@ static inline int upipe_ts_mux_prepare(struct upipe *upipe, uint64_t cr_sys,
                                UPIPE_TS_MUX_SIGNATURE, cr_sys, latency);
 }
 
+/** @This returns whether the mux writes its output packets in contiguous
+ * buffers.
+ *
+ * @param upipe description structure of the pipe
+ * @param contiguous_p filled in with true if output packets are contiguous
+ * @return an error code
+ */
+static inline int upipe_ts_mux_get_contiguous(struct upipe *upipe,
+                                              bool *contiguous_p)
+{
+    return upipe_control(upipe, UPIPE_TS_MUX_GET_CONTIGUOUS,
+                         UPIPE_TS_MUX_SIGNATURE, contiguous_p);
+}
+
+/** @This sets whether the mux writes its output packets in contiguous
+ * buffers. By default, each TS packet of the output is made of a header
+ * segment and payload segments shared with the input; in contiguous mode,
+ * the TS packets are copied into a single buffer of the output size, so
+ * that an output packet can be sent with a single iovec.
+ *
+ * @param upipe description structure of the pipe
+ * @param contiguous true to output contiguous buffers (default: false)
+ * @return an error code
+ */
+static inline int upipe_ts_mux_set_contiguous(struct upipe *upipe,
+                                              bool contiguous)
+{
+    return upipe_control(upipe, UPIPE_TS_MUX_SET_CONTIGUOUS,
+                         UPIPE_TS_MUX_SIGNATURE, contiguous ? 1 : 0);
+}
+
 /** @This returns a description string for local commands.
  *
  * @param cmd control command
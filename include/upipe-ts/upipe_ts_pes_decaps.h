@@ -31,8 +31,56 @@ extern "C" {
 
 #include <upipe/upipe.h>
 
+#include <stdbool.h>
+
 #define UPIPE_TS_PESD_SIGNATURE UBASE_FOURCC('t','s','p','d')
 
+/** @This extends upipe_command with specific commands for ts_pesd. */
+enum upipe_ts_pesd_command {
+    UPIPE_TS_PESD_SENTINEL = UPIPE_CONTROL_LOCAL,
+
+    /** returns true if PES are reassembled in contiguous buffers (bool *) */
+    UPIPE_TS_PESD_GET_CONTIGUOUS,
+    /** sets the reassembly of PES in contiguous buffers (bool) */
+    UPIPE_TS_PESD_SET_CONTIGUOUS
+};
+
+/** @This returns whether the payload of PES is reassembled in contiguous
+ * buffers.
+ *
+ * @param upipe description structure of the pipe
+ * @param contiguous_p filled in with true if PES are reassembled
+ * @return an error code
+ */
+static inline int upipe_ts_pesd_get_contiguous(struct upipe *upipe,
+                                               bool *contiguous_p)
+{
+    return upipe_control(upipe, UPIPE_TS_PESD_GET_CONTIGUOUS,
+                         UPIPE_TS_PESD_SIGNATURE, contiguous_p);
+}
+
+/** @This sets whether the payload of PES is reassembled in contiguous
+ * buffers. By default the pipe outputs the payload of each TS packet as
+ * soon as it is received, and downstream pipes append them in long chains
+ * of small segments. In contiguous mode, the pipe copies the payload of
+ * each PES into a single buffer, sized after the PES length or after the
+ * previous PES when the length is unknown, and outputs it when the PES is
+ * complete. PES of unknown length are only output when the next PES
+ * starts, which adds the duration of one PES to the latency. The buffers
+ * are allocated from a ubuf manager requested downstream; until it is
+ * provided, the payload is output as in the default mode.
+ *
+ * @param upipe description structure of the pipe
+ * @param contiguous true to reassemble PES
+ * @return an error code
+ */
+static inline int upipe_ts_pesd_set_contiguous(struct upipe *upipe,
+                                               bool contiguous)
+{
+    return upipe_control(upipe, UPIPE_TS_PESD_SET_CONTIGUOUS,
+                         UPIPE_TS_PESD_SIGNATURE, contiguous);
+}
+
 /** @This returns the management structure for all ts_pesd pipes.
  *
  * @return pointer to manager
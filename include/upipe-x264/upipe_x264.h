@@ -63,7 +63,10 @@ enum upipe_x264_command {
     UPIPE_X264_SET_SC_LATENCY,
 
     /** set slice type enforcement mode (int) */
-    UPIPE_X264_SET_SLICE_TYPE_ENFORCE
+    UPIPE_X264_SET_SLICE_TYPE_ENFORCE,
+
+    /** set zero-copy output mode (int) */
+    UPIPE_X264_SET_ZEROCOPY
 };
 
 /** @This reconfigures encoder with updated parameters.
@@ -151,6 +154,26 @@ static inline int upipe_x264_set_slice_type_enforce(struct upipe *upipe,
                          UPIPE_X264_SIGNATURE, enforce ? 1 : 0);
 }
 
+/** @This sets the zero-copy output mode (true or false). In this mode, the
+ * output buffers point directly to the NAL buffer of x264, which is only
+ * copied if it is still in use when the next picture is encoded. The output
+ * buffers are read-only.
+ *
+ * Downstream pipes may keep the output urefs, but they must unmap the
+ * buffers before the next picture is sent to the encoder, as x264 then
+ * overwrites its NAL buffer. If a mapping is still in progress, the picture
+ * is dropped with a warning instead of waiting for it.
+ *
+ * @param upipe description structure of the pipe
+ * @param zerocopy true if the NAL buffer of x264 must be output without copy
+ * @return an error code
+ */
+static inline int upipe_x264_set_zerocopy(struct upipe *upipe, bool zerocopy)
+{
+    return upipe_control(upipe, UPIPE_X264_SET_ZEROCOPY, UPIPE_X264_SIGNATURE,
+                         zerocopy ? 1 : 0);
+}
+
 /** @This returns the management structure for x264 pipes.
  *
  * @return pointer to manager
@@ -40,8 +40,40 @@ extern "C" {
 
 #include <stdint.h>
 
+/** @This is the signature to use to call the local commands of the block
+ * mem manager. */
+#define UBUF_BLOCK_MEM_SIGNATURE UBASE_FOURCC('m','e','m','b')
+
 /** @hidden */
 struct umem_mgr;
+/** @hidden */
+struct ubuf_mem_shared;
+
+/** @This extends ubuf_command with specific commands for block mem manager. */
+enum ubuf_block_mem_command {
+    UBUF_BLOCK_MEM_SENTINEL = UBUF_CONTROL_LOCAL,
+
+    /** returns the shared substructure of the first segment
+     * (struct ubuf_mem_shared **, size_t *, size_t *) */
+    UBUF_BLOCK_MEM_GET_SHARED
+};
+
+/** @This returns the underlying shared buffer of the first segment of a
+ * block. The reference counter is not incremented.
+ *
+ * @param ubuf pointer to ubuf
+ * @param shared_p filled in with a pointer to the underlying shared buffer
+ * @param offset_p filled in with the offset of the segment in the shared
+ * buffer
+ * @param size_p filled in with the size of the segment
+ * @return an error code
+ */
+static inline int ubuf_block_mem_get_shared(struct ubuf *ubuf,
+        struct ubuf_mem_shared **shared_p, size_t *offset_p, size_t *size_p)
+{
+    return ubuf_control(ubuf, UBUF_BLOCK_MEM_GET_SHARED,
+                        UBUF_BLOCK_MEM_SIGNATURE, shared_p, offset_p, size_p);
+}
 
 /** @This is the signature to use to allocate from an ubuf_pic plane. */
 #define UBUF_BLOCK_MEM_ALLOC_FROM_PIC UBASE_FOURCC('m','e','m','p')
@@ -292,6 +292,8 @@ static void STRUCTURE##_mgr_init_pool(struct ubuf_mgr *mgr,                 \
     upool_init(&mem_mgr->SHARED_POOL, mgr->refcount, shared_pool_depth,     \
                extra + upool_sizeof(ubuf_pool_depth),                       \
                ubuf_mem_shared_alloc_inner, ubuf_mem_shared_free_inner);    \
+    upool_set_name(&mem_mgr->UBUF_POOL, #STRUCTURE);                        \
+    upool_set_name(&mem_mgr->SHARED_POOL, #STRUCTURE "_shared");            \
 }
 
 #ifdef __cplusplus
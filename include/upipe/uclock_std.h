@@ -36,10 +36,19 @@ extern "C" {
 
 #include <upipe/uclock.h>
 
+struct upump_mgr;
+
 /** flags for the creation of a uclock structure */
 enum uclock_std_flags {
     /** force using a real-time clock even if a monotonic clock is available */
-    UCLOCK_FLAG_REALTIME = 0x1
+    UCLOCK_FLAG_REALTIME = 0x1,
+    /** use a coarse system clock if available, which is cheaper to read but
+     * only has the resolution of the kernel tick (1 to 10 ms) */
+    UCLOCK_FLAG_COARSE = 0x2,
+    /** interpolate the system clock with the time stamp counter of the CPU
+     * if it is invariant, which avoids calling the system; the TSC is
+     * calibrated against the system clock every 10 ms */
+    UCLOCK_FLAG_TSC = 0x4
 };
 
 /** @This allocates a new uclock structure.
@@ -49,6 +58,19 @@ enum uclock_std_flags {
  */
 struct uclock *uclock_std_alloc(enum uclock_std_flags flags);
 
+/** @This allocates a new uclock structure returning a cached time, which is
+ * refreshed once per iteration of the event loop of the given upump manager.
+ * It is meant for pipes which only need the resolution of the event loop,
+ * and must only be used from the thread running the event loop.
+ *
+ * @param flags flags for the creation of a uclock structure
+ * @param upump_mgr upump manager of the event loop
+ * @return pointer to uclock, or NULL in case of error, including if the
+ * upump manager doesn't support @ref UPUMP_TYPE_ITERATION pumps
+ */
+struct uclock *uclock_std_alloc_cached(enum uclock_std_flags flags,
+                                       struct upump_mgr *upump_mgr);
+
 #ifdef __cplusplus
 }
 #endif
@@ -168,6 +168,9 @@ enum udict_command {
     /** name a shorthand attribute (enum udict_type, const char **,
      * enum udict_type *) */
     UDICT_NAME,
+    /** duplicate a given udict, sharing its attributes until one of the
+     * udicts is modified (struct udict **) */
+    UDICT_SHARE,
 
     /** non-standard commands implemented by a module type can start from
      * there (first arg = signature) */
@@ -279,6 +282,24 @@ static inline struct udict *udict_dup(struct udict *udict)
     return dup_udict;
 }
 
+/** @This duplicates a given udict, sharing the attributes with the original
+ * udict until one of them is modified. If the manager doesn't support
+ * sharing, the attributes are copied as with @ref udict_dup.
+ *
+ * @param udict pointer to udict
+ * @return duplicated udict
+ */
+static inline struct udict *udict_share(struct udict *udict)
+{
+    struct udict *dup_udict;
+    int err = udict_control(udict, UDICT_SHARE, &dup_udict);
+    if (err == UBASE_ERR_UNHANDLED)
+        return udict_dup(udict);
+    if (unlikely(!ubase_check(err)))
+        return NULL;
+    return dup_udict;
+}
+
 /** @This finds an attribute of the given name and type and returns
  * the name and type of the next attribute.
  *
@@ -39,6 +39,7 @@ extern "C" {
 #include <upipe/uprobe.h>
 #include <upipe/urequest.h>
 #include <upipe/udict_dump.h>
+#include <upipe/upool_audit.h>
 
 #include <stdint.h>
 #include <stdarg.h>
@@ -1056,9 +1057,12 @@ static inline void upipe_input(struct upipe *upipe, struct uref *uref,
         uref_free(uref);
         return;
     }
+    struct upipe *audit_prev = NULL;
+    bool audit = upool_audit_enter(upipe, &audit_prev);
     upipe_use(upipe);
     upipe->mgr->upipe_input(upipe, uref, upump_p);
     upipe_release(upipe);
+    upool_audit_leave(audit, audit_prev);
 }
 
 /** @internal @This sends a control command to the pipe. Note that all control
@@ -1081,9 +1085,12 @@ static inline int upipe_control_nodbg_va(struct upipe *upipe,
         return UBASE_ERR_UNHANDLED;
 
     int err;
+    struct upipe *audit_prev = NULL;
+    bool audit = upool_audit_enter(upipe, &audit_prev);
     upipe_use(upipe);
     err = upipe->mgr->upipe_control(upipe, command, args);
     upipe_release(upipe);
+    upool_audit_leave(audit, audit_prev);
     return err;
 }
 
@@ -43,7 +43,8 @@ typedef char *(upipe_dump_pipe_label)(struct upipe *);
 /** @This represents a dumping function for flow def labels. */
 typedef char *(upipe_dump_flow_def_label)(struct uref *);
 
-/** @This converts a pipe to a label (default function).
+/** @This converts a pipe to a label (default function). The number of
+ * pool misses reported while the pool audit is active is appended.
  *
  * @param upipe upipe structure
  * @return allocated string
@@ -68,7 +68,7 @@ extern "C" {
  *  void upipe_foo_wait_upump(struct upipe *upipe, uint64_t delay, upump_cb cb)
  * @end code
  * Creates a time upump waiting for the given delay, and calling the
- * callback cb.
+ * callback cb. If the current upump is a timer, it is re-armed instead.
  *
  * @item @code
  *  void upipe_foo_clean_upump(struct upipe *upipe)
@@ -117,6 +117,11 @@ static void UBASE_UNUSED STRUCTURE##_wait_##UPUMP(struct upipe *upipe,      \
                                                   upump_cb cb)              \
 {                                                                           \
     struct STRUCTURE *s = STRUCTURE##_from_upipe(upipe);                    \
+    if (s->UPUMP != NULL) {                                                 \
+        upump_set_cb(s->UPUMP, cb, upipe);                                  \
+        if (ubase_check(upump_rearm(s->UPUMP, timeout, 0)))                 \
+            return;                                                         \
+    }                                                                       \
     struct upump *watcher = upump_alloc_timer(s->UPUMP_MGR, cb, upipe,      \
                                               upipe->refcount, timeout, 0); \
     if (unlikely(watcher == NULL)) {                                        \
@@ -37,6 +37,7 @@ extern "C" {
 #include <upipe/ubase.h>
 #include <upipe/urefcount.h>
 #include <upipe/ulifo.h>
+#include <upipe/upool_audit.h>
 
 /** @hidden */
 struct upool;
@@ -56,6 +57,8 @@ struct upool {
     upool_alloc_cb alloc_cb;
     /** call-back to release unused elements */
     upool_free_cb free_cb;
+    /** name of the pool, for the audit */
+    const char *name;
 };
 
 /** @This returns the required size of extra data space for upool.
@@ -81,6 +84,17 @@ static inline void upool_init(struct upool *upool, struct urefcount *refcount,
     ulifo_init(&upool->lifo, length, extra);
     upool->alloc_cb = alloc_cb;
     upool->free_cb = free_cb;
+    upool->name = NULL;
+}
+
+/** @This sets the name of a upool, which is reported by the pool audit.
+ *
+ * @param upool pointer to a upool structure
+ * @param name name of the pool
+ */
+static inline void upool_set_name(struct upool *upool, const char *name)
+{
+    upool->name = name;
 }
 
 /** @This increments the reference count of a upool.
@@ -114,8 +128,11 @@ static inline void upool_release(struct upool *upool)
 static inline void *upool_alloc_internal(struct upool *upool)
 {
     void *obj = ulifo_pop(&upool->lifo, void *);
-    if (unlikely(obj == NULL))
+    if (unlikely(obj == NULL)) {
+        if (unlikely(uatomic_load(&upool_audit_tracking)))
+            upool_audit_miss(upool->name, 0);
         obj = upool->alloc_cb(upool);
+    }
     if (obj != NULL)
         upool_use(upool);
     return obj;
@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2017 OpenHeadend S.A.R.L.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** @file
+ * @short Upipe audit of the pools of the core managers
+ *
+ * The pools of the core managers (uref, udict, ubuf, umem and upump) fall
+ * back to the system allocator when they are empty. Once a pipeline is
+ * warmed up, the audit reports each of these misses with the pipe running
+ * on the current thread, so that pool depths can be tuned until the steady
+ * state performs no allocation at all.
+ */
+
+#ifndef _UPIPE_UPOOL_AUDIT_H_
+/** @hidden */
+#define _UPIPE_UPOOL_AUDIT_H_
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <upipe/ubase.h>
+#include <upipe/uatomic.h>
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/** @hidden */
+struct upipe;
+/** @hidden */
+struct uprobe;
+
+/** @This defines the modes of the pool audit. */
+enum upool_audit_mode {
+    /** pool misses are not tracked (default) */
+    UPOOL_AUDIT_NONE,
+    /** pool misses are counted, logged and thrown as
+     * @ref UPROBE_POOL_MISS events */
+    UPOOL_AUDIT_EVENT,
+    /** same as @ref UPOOL_AUDIT_EVENT, and the process is aborted */
+    UPOOL_AUDIT_TRAP
+};
+
+/** @internal @This is non-zero when pool misses are tracked. */
+extern uatomic_uint32_t upool_audit_tracking;
+
+/** @This sets the mode of the pool audit, and resets the count of misses.
+ * It is typically called once the pipelines are warmed up. Changes are
+ * picked up asynchronously by other threads, and the previous probe is
+ * released once no thread is taking a reference to it. It must not be called
+ * concurrently with itself.
+ *
+ * @param mode mode of the audit
+ * @param uprobe probe receiving the misses occurring outside of any pipe,
+ * for instance in pump callbacks (may be NULL)
+ */
+void upool_audit_set(enum upool_audit_mode mode, struct uprobe *uprobe);
+
+/** @This returns the number of pool misses since the audit was set.
+ *
+ * @return number of misses
+ */
+uint32_t upool_audit_misses(void);
+
+/** @This reports a pool miss. It is called by the managers before they call
+ * the system allocator.
+ *
+ * @param name name of the pool
+ * @param size size of the requested buffer, or 0 for pools of structures
+ */
+void upool_audit_miss(const char *name, size_t size);
+
+/** @internal @This replaces the pipe running on the current thread.
+ *
+ * @param upipe pipe entering, or pipe to restore
+ * @return pipe previously running
+ */
+struct upipe *upool_audit_swap(struct upipe *upipe);
+
+/** @internal @This marks the entry into a pipe if pool misses are tracked.
+ *
+ * @param upipe pipe entering
+ * @param prev_p filled in with the pipe previously running
+ * @return true if the previous pipe must be restored
+ */
+static inline bool upool_audit_enter(struct upipe *upipe,
+                                     struct upipe **prev_p)
+{
+    if (likely(!uatomic_load(&upool_audit_tracking)))
+        return false;
+    *prev_p = upool_audit_swap(upipe);
+    return true;
+}
+
+/** @internal @This marks the exit from a pipe.
+ *
+ * @param entered return value of @ref upool_audit_enter
+ * @param prev pipe previously running
+ */
+static inline void upool_audit_leave(bool entered, struct upipe *prev)
+{
+    if (unlikely(entered))
+        upool_audit_swap(prev);
+}
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -107,6 +107,9 @@ enum uprobe_event {
     /** a pipe signals that a uref contains a UTC clock reference
      * (struct uref *, uint64_t) */
     UPROBE_CLOCK_UTC,
+    /** a pool was empty and the system allocator was called, while the
+     * pool audit is active (const char *, size_t) */
+    UPROBE_POOL_MISS,
 
     /** non-standard events implemented by a module type can start from
      * there (first arg = signature) */
@@ -142,6 +145,7 @@ static inline const char *uprobe_event_str(int event)
     case UPROBE_CLOCK_REF: return "UPROBE_CLOCK_REF";
     case UPROBE_CLOCK_TS: return "UPROBE_CLOCK_TS";
     case UPROBE_CLOCK_UTC: return "UPROBE_CLOCK_UTC";
+    case UPROBE_POOL_MISS: return "UPROBE_POOL_MISS";
     case UPROBE_LOCAL: break;
     }
     return NULL;
@@ -34,10 +34,12 @@
 extern "C" {
 #endif
 
+#include <upipe/uatomic.h>
 #include <upipe/uprobe.h>
 #include <upipe/uprobe_helper_uprobe.h>
 
 #include <stdbool.h>
+#include <stdint.h>
 
 /** @This is a super-set of the uprobe structure with additional local
  * members. */
@@ -46,6 +48,9 @@ struct uprobe_pfx {
     char *name;
     /** minimum level of messages to pass-through */
     enum uprobe_log_level min_level;
+    /** number of pool misses reported by the pipe, possibly from several
+     * threads */
+    uatomic_uint32_t pool_misses;
 
     /** structure exported to modules */
     struct uprobe uprobe;
@@ -79,6 +84,15 @@ void uprobe_pfx_clean(struct uprobe_pfx *uprobe_pfx);
  */
 const char *uprobe_pfx_get_name(struct uprobe *uprobe);
 
+/** @This returns the number of pool misses reported by the pipe, while the
+ * pool audit is active (see @ref upool_audit_set).
+ *
+ * @param uprobe pointer to probe
+ * @param pool_misses_p filled in with the number of pool misses
+ * @return an error code
+ */
+int uprobe_pfx_get_pool_misses(struct uprobe *uprobe, uint64_t *pool_misses_p);
+
 /** @This allocates a new uprobe pfx structure.
  *
  * @param next next probe to test if this one doesn't catch the event
@@ -52,6 +52,10 @@ struct upump_blocker;
 /** @hidden */
 struct umutex;
 
+/** resolution of the timer wheels of upump managers, in ticks of a 27 MHz
+ * clock (1 ms) */
+#define UPUMP_WHEEL_TICK UINT64_C(27000)
+
 /** @This defines the standard types of pumps. */
 enum upump_type {
     /** event continuously triggers (no argument) */
@@ -67,6 +71,13 @@ enum upump_type {
     UPUMP_TYPE_FD_WRITE,
     /** event triggers on a UNIX signal (argument = int) */
     UPUMP_TYPE_SIGNAL,
+    /** event triggers once after a given timeout, with the resolution of
+     * the timer wheel of the manager (arguments = uint64_t, uint64_t) */
+    UPUMP_TYPE_WHEEL_TIMER,
+    /** event triggers once per iteration of the event loop, after it has
+     * waited for events and before other pumps are dispatched (no
+     * argument) */
+    UPUMP_TYPE_ITERATION,
     /* TODO: Windows objects */
 
     /** non-standard types implemented by a upump handler can start
@@ -92,6 +103,9 @@ enum upump_command {
     UPUMP_FREE_BLOCKER,
     /** restarts the pump (void) */
     UPUMP_RESTART,
+    /** changes the timeout of a timer pump and starts it
+     * (uint64_t, uint64_t) */
+    UPUMP_REARM,
 
     /** non-standard commands implemented by a upump handler can start
      * from there (first arg = signature) */
@@ -234,6 +248,50 @@ static inline struct upump *upump_alloc_timer(struct upump_mgr *mgr,
                        after, repeat);
 }
 
+/** @This allocates and initializes a pump for a timer handled by the timer
+ * wheel of the manager. The timeout is rounded up to the resolution of the
+ * wheel (@ref UPUMP_WHEEL_TICK), but starting, stopping and triggering the
+ * pump take constant time regardless of the number of timers, which makes
+ * it suitable for large numbers of short timers, such as I/O timeouts.
+ *
+ * @param mgr management structure for this event loop
+ * @param cb function to call when the pump triggers
+ * @param opaque pointer to the module's internal structure
+ * @param refcount pointer to urefcount structure to increment during callback,
+ * or NULL
+ * @param after time after which it triggers, in ticks of a 27 MHz monotonic
+ * clock
+ * @param repeat pump will trigger again each repeat occurrence, in ticks
+ * of a 27 MHz monotonic clock (0 to disable)
+ * @return pointer to allocated pump, or NULL in case of failure
+ */
+static inline struct upump *upump_alloc_wheel_timer(struct upump_mgr *mgr,
+        upump_cb cb, void *opaque, struct urefcount *refcount,
+        uint64_t after, uint64_t repeat)
+{
+    return upump_alloc(mgr, cb, opaque, refcount, UPUMP_TYPE_WHEEL_TIMER,
+                       after, repeat);
+}
+
+/** @This allocates and initializes a pump triggering once per iteration of
+ * the event loop, before the other pumps are dispatched. Such pumps are
+ * typically used to refresh per-iteration caches, and are usually made
+ * non-blocking with @ref upump_set_status. Not all managers support them.
+ *
+ * @param mgr management structure for this event loop
+ * @param cb function to call when the pump triggers
+ * @param opaque pointer to the module's internal structure
+ * @param refcount pointer to urefcount structure to increment during callback,
+ * or NULL
+ * @return pointer to allocated pump, or NULL in case of failure
+ */
+static inline struct upump *upump_alloc_iteration(struct upump_mgr *mgr,
+                                                  upump_cb cb, void *opaque,
+                                                  struct urefcount *refcount)
+{
+    return upump_alloc(mgr, cb, opaque, refcount, UPUMP_TYPE_ITERATION);
+}
+
 /** @This allocates and initializes a pump for a readable file descriptor.
  *
  * @param mgr management structure for this event loop
@@ -358,6 +416,25 @@ static inline void upump_restart(struct upump *upump)
     upump_control(upump, UPUMP_RESTART);
 }
 
+/** @This changes the timeout of a timer pump, and starts it. It replaces
+ * the sequence of freeing a one-shot timer and allocating a new one with
+ * another timeout, which is costly when done on every event.
+ *
+ * @param upump description structure of the pump
+ * @param after time after which it triggers, in ticks of a 27 MHz monotonic
+ * clock
+ * @param repeat pump will trigger again each repeat occurrence, in ticks
+ * of a 27 MHz monotonic clock (0 to disable)
+ * @return an error code, including @ref UBASE_ERR_INVALID if the pump is
+ * not a timer, and @ref UBASE_ERR_UNHANDLED if the manager doesn't support
+ * it
+ */
+static inline int upump_rearm(struct upump *upump, uint64_t after,
+                              uint64_t repeat)
+{
+    return upump_control(upump, UPUMP_REARM, after, repeat);
+}
+
 /** @This frees a upump structure.
  * Please note that the pump must be stopped before.
  *
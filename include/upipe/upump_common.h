@@ -44,6 +44,15 @@ extern "C" {
 
 /** @hidden */
 struct upump_blocker;
+/** @hidden */
+struct uclock;
+
+/** number of levels of the timer wheel */
+#define UPUMP_WHEEL_LEVELS 4
+/** log2 of the number of slots per level of the timer wheel */
+#define UPUMP_WHEEL_BITS 6
+/** number of slots per level of the timer wheel */
+#define UPUMP_WHEEL_SLOTS (1 << UPUMP_WHEEL_BITS)
 
 /** @This stores upump parameters invisible from modules but usually common.
  */
@@ -55,11 +64,21 @@ struct upump_common {
     /** list of blockers registered on this pump */
     struct uchain blockers;
 
+    /** structure for the slot list of the timer wheel */
+    struct uchain wheel_uchain;
+    /** wheel tick at which the pump triggers */
+    uint64_t wheel_expires;
+    /** initial timeout, in wheel ticks */
+    uint64_t wheel_after;
+    /** repeat interval, in wheel ticks, or 0 */
+    uint64_t wheel_repeat;
+
     /** public upump structure */
     struct upump upump;
 };
 
 UBASE_FROM_TO(upump_common, upump, upump, upump)
+UBASE_FROM_TO(upump_common, uchain, wheel_uchain, wheel_uchain)
 
 /** @This allocates and initializes a blocker.
  *
@@ -124,6 +143,72 @@ void upump_common_set_status(struct upump *upump, int status);
  */
 void upump_common_clean(struct upump *upump);
 
+/** @This sets the timeout of a pump of type
+ * @ref UPUMP_TYPE_WHEEL_TIMER. The pump must not be running.
+ *
+ * @param upump description structure of the pump
+ * @param after time after which it triggers, in 27 MHz ticks
+ * @param repeat repeat interval, in 27 MHz ticks, or 0
+ */
+void upump_common_wheel_set(struct upump *upump, uint64_t after,
+                            uint64_t repeat);
+
+/** @This really starts a pump of type @ref UPUMP_TYPE_WHEEL_TIMER. It is
+ * meant to be called by the real start function of the manager, which may
+ * fall back to a plain timer in case of error.
+ *
+ * @param upump description structure of the pump
+ * @param status blocking status of the pump
+ * @return an error code
+ */
+int upump_common_wheel_start(struct upump *upump, bool status);
+
+/** @This really stops a pump of type @ref UPUMP_TYPE_WHEEL_TIMER. It is
+ * meant to be called by the real stop function of the manager.
+ *
+ * @param upump description structure of the pump
+ * @param status blocking status of the pump
+ */
+void upump_common_wheel_stop(struct upump *upump, bool status);
+
+/** @This really restarts a pump of type @ref UPUMP_TYPE_WHEEL_TIMER. It is
+ * meant to be called by the real restart function of the manager, which may
+ * fall back to a plain timer in case of error.
+ *
+ * @param upump description structure of the pump
+ * @param status blocking status of the pump
+ * @return an error code
+ */
+int upump_common_wheel_restart(struct upump *upump, bool status);
+
+/** @This stores the timer wheel of a manager. Timers are kept in lists
+ * hashed by expiration tick, at a level depending on how far they expire,
+ * and cascade to the lower levels as time passes, so that starting and
+ * stopping a timer take constant time. The wheel is driven by a single
+ * one-shot timer pump of the manager, armed for the next occupied slot, which
+ * only exists while timers are armed.
+ */
+struct upump_common_wheel {
+    /** lists of timers */
+    struct uchain slots[UPUMP_WHEEL_LEVELS][UPUMP_WHEEL_SLOTS];
+    /** next tick to process */
+    uint64_t tick;
+    /** number of armed timers */
+    unsigned int timers;
+    /** number of armed blocking timers */
+    unsigned int blocking;
+    /** timer pump driving the wheel */
+    struct upump *upump;
+    /** blocking status of the timer pump */
+    bool upump_status;
+    /** tick for which the timer pump is armed, or UINT64_MAX */
+    uint64_t deadline;
+    /** monotonic clock */
+    struct uclock *uclock;
+    /** true while expired timers are processed */
+    bool running;
+};
+
 /** @This stores management parameters invisible from modules but usually
  * common.
  */
@@ -140,6 +225,9 @@ struct upump_common_mgr {
     /** function to really stop a watcher */
     void (*upump_real_stop)(struct upump *, bool);
 
+    /** timer wheel */
+    struct upump_common_wheel wheel;
+
     /** structure exported to modules */
     struct upump_mgr mgr;
 };
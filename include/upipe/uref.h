@@ -254,12 +254,15 @@ static inline struct uref *uref_sibling_alloc_control(struct uref *uref)
     return uref_alloc_control(uref->mgr);
 }
 
-/** @internal @This duplicates a uref without duplicating the ubuf.
+/** @internal @This duplicates a uref without duplicating the ubuf, and
+ * copies or shares the attributes.
  *
  * @param uref source structure to duplicate
+ * @param share true to share the attributes (see @ref udict_share)
  * @return duplicated uref or NULL in case of allocation failure
  */
-static inline struct uref *uref_dup_inner(struct uref *uref)
+static inline struct uref *uref_dup_inner_udict(struct uref *uref,
+                                                bool share)
 {
     assert(uref != NULL);
     struct uref *new_uref = uref->mgr->uref_alloc(uref->mgr);
@@ -268,7 +271,8 @@ static inline struct uref *uref_dup_inner(struct uref *uref)
 
     new_uref->ubuf = NULL;
     if (uref->udict != NULL) {
-        new_uref->udict = udict_dup(uref->udict);
+        new_uref->udict = share ? udict_share(uref->udict) :
+                                  udict_dup(uref->udict);
         if (unlikely(new_uref->udict == NULL)) {
             uref_free(new_uref);
             return NULL;
@@ -288,14 +292,25 @@ static inline struct uref *uref_dup_inner(struct uref *uref)
     return new_uref;
 }
 
-/** @This duplicates a uref.
+/** @internal @This duplicates a uref without duplicating the ubuf.
  *
  * @param uref source structure to duplicate
  * @return duplicated uref or NULL in case of allocation failure
  */
-static inline struct uref *uref_dup(struct uref *uref)
+static inline struct uref *uref_dup_inner(struct uref *uref)
 {
-    struct uref *new_uref = uref_dup_inner(uref);
+    return uref_dup_inner_udict(uref, false);
+}
+
+/** @internal @This duplicates a uref, and copies or shares the attributes.
+ *
+ * @param uref source structure to duplicate
+ * @param share true to share the attributes (see @ref udict_share)
+ * @return duplicated uref or NULL in case of allocation failure
+ */
+static inline struct uref *uref_dup_udict(struct uref *uref, bool share)
+{
+    struct uref *new_uref = uref_dup_inner_udict(uref, share);
     if (unlikely(new_uref == NULL))
         return NULL;
 
@@ -309,6 +324,29 @@ static inline struct uref *uref_dup(struct uref *uref)
     return new_uref;
 }
 
+/** @This duplicates a uref.
+ *
+ * @param uref source structure to duplicate
+ * @return duplicated uref or NULL in case of allocation failure
+ */
+static inline struct uref *uref_dup(struct uref *uref)
+{
+    return uref_dup_udict(uref, false);
+}
+
+/** @This duplicates a uref, sharing the attributes with the original uref
+ * until one of them is modified. This avoids copying the attributes when the
+ * duplicate is not expected to be modified, at the price of a copy on the
+ * first write.
+ *
+ * @param uref source structure to duplicate
+ * @return duplicated uref or NULL in case of allocation failure
+ */
+static inline struct uref *uref_share(struct uref *uref)
+{
+    return uref_dup_udict(uref, true);
+}
+
 /** @This attaches a ubuf to a given uref. The ubuf pointer may no longer be
  * used by the module afterwards.
  *
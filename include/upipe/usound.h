@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2017 OpenHeadend S.A.R.L.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** @file
+ * @short Upipe sample processing kernels for sound pipes
+ *
+ * The kernels are selected at run-time depending on the features of the
+ * CPU, and are gathered in a structure that pipes initialize once and keep
+ * in their private context.
+ */
+
+#ifndef _UPIPE_USOUND_H_
+/** @hidden */
+#define _UPIPE_USOUND_H_
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+/** @This lists the CPU features that may be used by the kernels. */
+enum usound_cpu {
+    /** SSE2 instructions */
+    USOUND_CPU_SSE2 = 0x1,
+    /** AVX2 instructions */
+    USOUND_CPU_AVX2 = 0x2
+};
+
+/** @This is the table of sample processing kernels. */
+struct usound_dsp {
+    /** returns the maximum absolute value of s16 samples */
+    uint32_t (*peak_s16)(const int16_t *src, size_t samples);
+    /** returns the maximum absolute value of s32 samples */
+    uint32_t (*peak_s32)(const int32_t *src, size_t samples);
+    /** returns the maximum absolute value of f32 samples, ignoring NaNs */
+    float (*peak_flt)(const float *src, size_t samples);
+
+    /** adds src to dst with a linear gain ramp, starting at gain and
+     * incremented by step for each sample of channels values; the gain
+     * applied to sample i is gain + i * step */
+    void (*mix_flt)(float *dst, const float *src, size_t samples,
+                    uint8_t channels, float gain, float step);
+
+    /** interleaves planar 16-bit samples */
+    void (*interleave_16)(int16_t *dst, const int16_t *const *src,
+                          size_t samples, uint8_t channels);
+    /** interleaves planar 32-bit (s32 or f32) samples */
+    void (*interleave_32)(int32_t *dst, const int32_t *const *src,
+                          size_t samples, uint8_t channels);
+    /** deinterleaves packed 16-bit samples */
+    void (*deinterleave_16)(int16_t *const *dst, const int16_t *src,
+                            size_t samples, uint8_t channels);
+    /** deinterleaves packed 32-bit (s32 or f32) samples */
+    void (*deinterleave_32)(int32_t *const *dst, const int32_t *src,
+                            size_t samples, uint8_t channels);
+
+    /** converts s16 values to f32 in the range [-1.0, 1.0[ */
+    void (*s16_to_flt)(float *dst, const int16_t *src, size_t values);
+    /** converts f32 values to s16, rounding to nearest and clipping */
+    void (*flt_to_s16)(int16_t *dst, const float *src, size_t values);
+    /** converts s32 values to f32 in the range [-1.0, 1.0] */
+    void (*s32_to_flt)(float *dst, const int32_t *src, size_t values);
+    /** converts f32 values to s32, rounding to nearest and clipping */
+    void (*flt_to_s32)(int32_t *dst, const float *src, size_t values);
+};
+
+/** @This initializes the kernels using the given CPU features. Features
+ * that the CPU or compiler don't support must not be passed.
+ *
+ * @param dsp table of kernels to fill in
+ * @param cpu bitmask of allowed CPU features (@ref usound_cpu)
+ */
+void usound_dsp_init_cpu(struct usound_dsp *dsp, unsigned int cpu);
+
+/** @This initializes the kernels with the best versions available on the
+ * running CPU.
+ *
+ * @param dsp table of kernels to fill in
+ */
+void usound_dsp_init(struct usound_dsp *dsp);
+
+/** @This returns the CPU features that the kernels may use on the running
+ * CPU.
+ *
+ * @return bitmask of CPU features (@ref usound_cpu)
+ */
+unsigned int usound_dsp_cpu(void);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
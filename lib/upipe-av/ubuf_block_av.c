@@ -0,0 +1,339 @@
+/*
+ * Copyright (C) 2017 OpenHeadend S.A.R.L.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** @file
+ * @short Upipe ubuf manager for block formats wrapping libavutil buffers
+ */
+
+#include <upipe/ubase.h>
+#include <upipe/urefcount.h>
+#include <upipe/upool.h>
+#include <upipe/ubuf.h>
+#include <upipe/ubuf_block.h>
+#include <upipe/ubuf_block_common.h>
+#include <upipe-av/ubuf_block_av.h>
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <assert.h>
+
+#include <libavutil/buffer.h>
+
+/** @This is a super-set of the @ref ubuf (and @ref ubuf_block)
+ * structure with a reference to the libavutil buffer. */
+struct ubuf_block_av {
+    /** reference to the libavutil buffer */
+    AVBufferRef *buf;
+
+    /** block structure */
+    struct ubuf_block ubuf_block;
+};
+
+UBASE_FROM_TO(ubuf_block_av, ubuf, ubuf, ubuf_block.ubuf)
+
+/** @This is a super-set of the ubuf_mgr structure with additional local
+ * members. */
+struct ubuf_block_av_mgr {
+    /** refcount management structure */
+    struct urefcount urefcount;
+
+    /** ubuf pool */
+    struct upool ubuf_pool;
+
+    /** common management structure */
+    struct ubuf_mgr mgr;
+
+    /** extra space for upool */
+    uint8_t upool_extra[];
+};
+
+UBASE_FROM_TO(ubuf_block_av_mgr, ubuf_mgr, ubuf_mgr, mgr)
+UBASE_FROM_TO(ubuf_block_av_mgr, urefcount, urefcount, urefcount)
+UBASE_FROM_TO(ubuf_block_av_mgr, upool, ubuf_pool, ubuf_pool)
+
+/** @internal @This allocates a ubuf pointing to a libavutil buffer.
+ *
+ * @param mgr common management structure
+ * @param buf reference to the buffer, which is stolen
+ * @param offset offset of the data in the buffer
+ * @param size size of the data
+ * @return pointer to ubuf or NULL in case of allocation error
+ */
+static struct ubuf *ubuf_block_av_alloc_buf(struct ubuf_mgr *mgr,
+                                            AVBufferRef *buf,
+                                            size_t offset, size_t size)
+{
+    struct ubuf_block_av_mgr *av_mgr = ubuf_block_av_mgr_from_ubuf_mgr(mgr);
+    struct ubuf_block_av *block_av =
+        upool_alloc(&av_mgr->ubuf_pool, struct ubuf_block_av *);
+    if (unlikely(block_av == NULL)) {
+        av_buffer_unref(&buf);
+        return NULL;
+    }
+
+    struct ubuf *ubuf = ubuf_block_av_to_ubuf(block_av);
+    ubuf_block_common_init(ubuf, false);
+    block_av->buf = buf;
+    ubuf_block_common_set(ubuf, offset, size);
+    ubuf_block_common_set_buffer(ubuf, buf->data);
+    return ubuf;
+}
+
+/** @This allocates a ubuf.
+ *
+ * @param mgr common management structure
+ * @param signature type of allocation
+ * @param args optional arguments
+ * @return pointer to ubuf or NULL in case of allocation error
+ */
+static struct ubuf *_ubuf_block_av_alloc(struct ubuf_mgr *mgr,
+                                         uint32_t signature, va_list args)
+{
+    switch (signature) {
+        case UBUF_ALLOC_BLOCK: {
+            int size = va_arg(args, int);
+            if (unlikely(size < 0))
+                return NULL;
+            AVBufferRef *buf = av_buffer_alloc(size);
+            if (unlikely(buf == NULL))
+                return NULL;
+            return ubuf_block_av_alloc_buf(mgr, buf, 0, size);
+        }
+
+        case UBUF_BLOCK_AV_ALLOC_BUFFER: {
+            AVBufferRef *buf = va_arg(args, AVBufferRef *);
+            const uint8_t *data = va_arg(args, const uint8_t *);
+            int size = va_arg(args, int);
+            if (unlikely(buf == NULL || size < 0 || data < buf->data ||
+                         data + size > buf->data + buf->size))
+                return NULL;
+            AVBufferRef *ref = av_buffer_ref(buf);
+            if (unlikely(ref == NULL))
+                return NULL;
+            return ubuf_block_av_alloc_buf(mgr, ref, data - buf->data, size);
+        }
+
+        default:
+            return NULL;
+    }
+}
+
+/** @This asks for the creation of a new reference to the same buffer space.
+ *
+ * @param ubuf pointer to ubuf
+ * @param new_ubuf_p reference written with a pointer to the newly allocated
+ * ubuf
+ * @param offset offset in the buffer, or -1 to duplicate the whole ubuf
+ * @param size final size of the buffer
+ * @return an error code
+ */
+static int ubuf_block_av_splice(struct ubuf *ubuf, struct ubuf **new_ubuf_p,
+                                int offset, int size)
+{
+    assert(new_ubuf_p != NULL);
+    struct ubuf_block_av *block_av = ubuf_block_av_from_ubuf(ubuf);
+    AVBufferRef *buf = av_buffer_ref(block_av->buf);
+    if (unlikely(buf == NULL))
+        return UBASE_ERR_ALLOC;
+
+    struct ubuf *new_ubuf = ubuf_block_av_alloc_buf(ubuf->mgr, buf, 0, 0);
+    if (unlikely(new_ubuf == NULL))
+        return UBASE_ERR_ALLOC;
+
+    int err = offset == -1 ? ubuf_block_common_dup(ubuf, new_ubuf) :
+        ubuf_block_common_splice(ubuf, new_ubuf, offset, size);
+    if (unlikely(!ubase_check(err))) {
+        ubuf_free(new_ubuf);
+        return UBASE_ERR_INVALID;
+    }
+    *new_ubuf_p = new_ubuf;
+    return UBASE_ERR_NONE;
+}
+
+/** @This returns the libavutil buffer of the first segment.
+ *
+ * @param ubuf pointer to ubuf
+ * @param buf_p filled in with a pointer to the buffer
+ * @param offset_p filled in with the offset in the buffer
+ * @param size_p filled in with the size of the segment
+ * @return an error code
+ */
+static int _ubuf_block_av_get_buffer(struct ubuf *ubuf, AVBufferRef **buf_p,
+                                     size_t *offset_p, size_t *size_p)
+{
+    struct ubuf_block_av *block_av = ubuf_block_av_from_ubuf(ubuf);
+    struct ubuf_block *block = ubuf_block_from_ubuf(ubuf);
+    if (buf_p != NULL)
+        *buf_p = block_av->buf;
+    if (offset_p != NULL)
+        *offset_p = block->offset;
+    if (size_p != NULL)
+        *size_p = block->size;
+    return UBASE_ERR_NONE;
+}
+
+/** @This handles control commands.
+ *
+ * @param ubuf pointer to ubuf
+ * @param command type of command to process
+ * @param args arguments of the command
+ * @return an error code
+ */
+static int ubuf_block_av_control(struct ubuf *ubuf, int command, va_list args)
+{
+    switch (command) {
+        case UBUF_DUP: {
+            struct ubuf **new_ubuf_p = va_arg(args, struct ubuf **);
+            return ubuf_block_av_splice(ubuf, new_ubuf_p, -1, -1);
+        }
+        case UBUF_SINGLE: {
+            struct ubuf_block_av *block_av = ubuf_block_av_from_ubuf(ubuf);
+            return av_buffer_is_writable(block_av->buf) ?
+                   UBASE_ERR_NONE : UBASE_ERR_BUSY;
+        }
+        case UBUF_SPLICE_BLOCK: {
+            struct ubuf **new_ubuf_p = va_arg(args, struct ubuf **);
+            int offset = va_arg(args, int);
+            int size = va_arg(args, int);
+            return ubuf_block_av_splice(ubuf, new_ubuf_p, offset, size);
+        }
+        case UBUF_BLOCK_AV_GET_BUFFER: {
+            UBASE_SIGNATURE_CHECK(args, UBUF_BLOCK_AV_ALLOC_BUFFER)
+            AVBufferRef **buf_p = va_arg(args, AVBufferRef **);
+            size_t *offset_p = va_arg(args, size_t *);
+            size_t *size_p = va_arg(args, size_t *);
+            return _ubuf_block_av_get_buffer(ubuf, buf_p, offset_p, size_p);
+        }
+        default:
+            return UBASE_ERR_UNHANDLED;
+    }
+}
+
+/** @This recycles or frees a ubuf.
+ *
+ * @param ubuf pointer to a ubuf structure
+ */
+static void ubuf_block_av_free(struct ubuf *ubuf)
+{
+    struct ubuf_block_av_mgr *av_mgr =
+        ubuf_block_av_mgr_from_ubuf_mgr(ubuf->mgr);
+    struct ubuf_block_av *block_av = ubuf_block_av_from_ubuf(ubuf);
+
+    ubuf_block_common_clean(ubuf);
+    av_buffer_unref(&block_av->buf);
+    upool_free(&av_mgr->ubuf_pool, block_av);
+}
+
+/** @internal @This allocates the data structure.
+ *
+ * @param upool pointer to upool
+ * @return pointer to ubuf_block_av or NULL in case of allocation error
+ */
+static void *ubuf_block_av_alloc_inner(struct upool *upool)
+{
+    struct ubuf_block_av_mgr *av_mgr = ubuf_block_av_mgr_from_ubuf_pool(upool);
+    struct ubuf_block_av *block_av = malloc(sizeof(struct ubuf_block_av));
+    if (unlikely(block_av == NULL))
+        return NULL;
+    struct ubuf *ubuf = ubuf_block_av_to_ubuf(block_av);
+    ubuf->mgr = ubuf_block_av_mgr_to_ubuf_mgr(av_mgr);
+    return block_av;
+}
+
+/** @internal @This frees a ubuf_block_av.
+ *
+ * @param upool pointer to upool
+ * @param block_av pointer to a ubuf_block_av structure to free
+ */
+static void ubuf_block_av_free_inner(struct upool *upool, void *block_av)
+{
+    free(block_av);
+}
+
+/** @This handles manager control commands.
+ *
+ * @param mgr pointer to ubuf manager
+ * @param command type of command to process
+ * @param args arguments of the command
+ * @return an error code
+ */
+static int ubuf_block_av_mgr_control(struct ubuf_mgr *mgr,
+                                     int command, va_list args)
+{
+    switch (command) {
+        case UBUF_MGR_VACUUM: {
+            struct ubuf_block_av_mgr *av_mgr =
+                ubuf_block_av_mgr_from_ubuf_mgr(mgr);
+            upool_vacuum(&av_mgr->ubuf_pool);
+            return UBASE_ERR_NONE;
+        }
+        default:
+            return UBASE_ERR_UNHANDLED;
+    }
+}
+
+/** @This frees a ubuf manager.
+ *
+ * @param urefcount pointer to urefcount
+ */
+static void ubuf_block_av_mgr_free(struct urefcount *urefcount)
+{
+    struct ubuf_block_av_mgr *av_mgr =
+        ubuf_block_av_mgr_from_urefcount(urefcount);
+    upool_clean(&av_mgr->ubuf_pool);
+
+    urefcount_clean(urefcount);
+    free(av_mgr);
+}
+
+/** @This allocates a new instance of the ubuf manager for block formats
+ * wrapping libavutil buffers.
+ *
+ * @param ubuf_pool_depth maximum number of ubuf structures in the pool
+ * @return pointer to manager, or NULL in case of error
+ */
+struct ubuf_mgr *ubuf_block_av_mgr_alloc(uint16_t ubuf_pool_depth)
+{
+    struct ubuf_block_av_mgr *av_mgr =
+        malloc(sizeof(struct ubuf_block_av_mgr) +
+               upool_sizeof(ubuf_pool_depth));
+    if (unlikely(av_mgr == NULL))
+        return NULL;
+
+    struct ubuf_mgr *mgr = ubuf_block_av_mgr_to_ubuf_mgr(av_mgr);
+    urefcount_init(ubuf_block_av_mgr_to_urefcount(av_mgr),
+                   ubuf_block_av_mgr_free);
+    mgr->refcount = ubuf_block_av_mgr_to_urefcount(av_mgr);
+    mgr->signature = UBUF_ALLOC_BLOCK;
+    mgr->ubuf_alloc = _ubuf_block_av_alloc;
+    mgr->ubuf_control = ubuf_block_av_control;
+    mgr->ubuf_free = ubuf_block_av_free;
+    mgr->ubuf_mgr_control = ubuf_block_av_mgr_control;
+
+    upool_init(&av_mgr->ubuf_pool, mgr->refcount, ubuf_pool_depth,
+               av_mgr->upool_extra,
+               ubuf_block_av_alloc_inner, ubuf_block_av_free_inner);
+
+    return mgr;
+}
@@ -32,6 +32,8 @@
 #include <upipe/uprobe.h>
 #include <upipe/uclock.h>
 #include <upipe/ubuf.h>
+#include <upipe/ubuf_block_mem.h>
+#include <upipe/ubuf_mem_common.h>
 #include <upipe/uref.h>
 #include <upipe/uref_attr.h>
 #include <upipe/uref_pic.h>
@@ -54,6 +56,7 @@
 #include <upipe/upipe_helper_upump.h>
 #include <upipe/upipe_helper_input.h>
 #include <upipe-av/upipe_avcodec_decode.h>
+#include <upipe-av/ubuf_block_av.h>
 #include <upipe-framers/uref_h26x.h>
 
 #include <stdlib.h>
@@ -67,6 +70,7 @@
 
 #include <libavcodec/avcodec.h>
 #include <libavutil/avutil.h>
+#include <libavutil/buffer.h>
 #include <libavutil/pixdesc.h>
 #include <libavutil/opt.h>
 #include <upipe-av/upipe_av_pixfmt.h>
@@ -76,6 +80,8 @@
 #include <bitstream/dvb/sub.h>
 
 #define EXPECTED_FLOW_DEF "block."
+/** granularity of the size of pooled packet buffers */
+#define AVPKT_POOL_ALIGN 4096
 
 /** @hidden */
 static int upipe_avcdec_check(struct upipe *upipe, struct uref *flow_format);
@@ -166,6 +172,10 @@ struct upipe_avcdec {
     AVCodecContext *context;
     /** avcodec frame */
     AVFrame *frame;
+    /** pool of padded packet buffers, for segmented input */
+    AVBufferPool *avpkt_pool;
+    /** size of the buffers of the pool */
+    size_t avpkt_pool_size;
     /** true if the context will be closed */
     bool close;
 
@@ -1295,6 +1305,146 @@ static void upipe_avcdec_store_uref(struct upipe *upipe, struct uref *uref)
     upipe_avcdec->uref = uref;
 }
 
+/** @internal @This releases an input buffer wrapped into an AVBufferRef.
+ *
+ * @param opaque pointer to the ubuf
+ * @param data pointer to the mapped data
+ */
+static void upipe_avcdec_free_avpkt_ubuf(void *opaque, uint8_t *data)
+{
+    struct ubuf *ubuf = (struct ubuf *)opaque;
+    ubuf_block_unmap(ubuf, 0);
+    ubuf_free(ubuf);
+}
+
+/** @internal @This wraps an input buffer into an AVPacket, without copying.
+ * This is only possible if the buffer is made of a single segment followed
+ * by enough zeroed padding in the underlying memory (see
+ * @ref upipe_avcdec_amend_ubuf_mgr).
+ *
+ * @param upipe description structure of the pipe
+ * @param ubuf input buffer, ownership is transferred on success
+ * @param size size of the buffer
+ * @param avpkt filled in with the wrapped buffer
+ * @return false if the buffer cannot be wrapped
+ */
+static bool upipe_avcdec_wrap_avpkt(struct upipe *upipe, struct ubuf *ubuf,
+                                    size_t size, AVPacket *avpkt)
+{
+    static const uint8_t zero[AV_INPUT_BUFFER_PADDING_SIZE];
+    struct ubuf_mem_shared *shared;
+    size_t offset, segment_size;
+    if (!ubase_check(ubuf_block_mem_get_shared(ubuf, &shared, &offset,
+                                               &segment_size)) ||
+        segment_size != size ||
+        offset + size + AV_INPUT_BUFFER_PADDING_SIZE >
+            umem_size(&shared->umem))
+        return false;
+
+    int read_size = -1;
+    const uint8_t *buffer;
+    if (unlikely(!ubase_check(ubuf_block_read(ubuf, 0, &read_size,
+                                              &buffer))))
+        return false;
+
+    /* the padding may only be written if no one else uses the memory */
+    uint8_t *padding = (uint8_t *)buffer + size;
+    if (ubase_check(ubuf_control(ubuf, UBUF_SINGLE)))
+        memset(padding, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+    else if (memcmp(padding, zero, AV_INPUT_BUFFER_PADDING_SIZE)) {
+        ubuf_block_unmap(ubuf, 0);
+        return false;
+    }
+
+    avpkt->buf = av_buffer_create((uint8_t *)buffer,
+                                  size + AV_INPUT_BUFFER_PADDING_SIZE,
+                                  upipe_avcdec_free_avpkt_ubuf, ubuf,
+                                  AV_BUFFER_FLAG_READONLY);
+    if (unlikely(avpkt->buf == NULL)) {
+        ubuf_block_unmap(ubuf, 0);
+        return false;
+    }
+    avpkt->data = avpkt->buf->data;
+    avpkt->size = size;
+    return true;
+}
+
+/** @internal @This passes an input buffer coming from libavutil (see
+ * @ref ubuf_block_av_alloc) to an AVPacket by taking a new reference.
+ *
+ * @param upipe description structure of the pipe
+ * @param ubuf input buffer, ownership is transferred on success
+ * @param size size of the buffer
+ * @param avpkt filled in with the referenced buffer
+ * @return false if the buffer cannot be referenced
+ */
+static bool upipe_avcdec_ref_avpkt(struct upipe *upipe, struct ubuf *ubuf,
+                                   size_t size, AVPacket *avpkt)
+{
+    static const uint8_t zero[AV_INPUT_BUFFER_PADDING_SIZE];
+    AVBufferRef *buf;
+    size_t offset, segment_size;
+    if (!ubase_check(ubuf_block_av_get_buffer(ubuf, &buf, &offset,
+                                              &segment_size)) ||
+        segment_size != size ||
+        offset + size + AV_INPUT_BUFFER_PADDING_SIZE > buf->size)
+        return false;
+
+    uint8_t *padding = buf->data + offset + size;
+    if (av_buffer_is_writable(buf))
+        memset(padding, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+    else if (memcmp(padding, zero, AV_INPUT_BUFFER_PADDING_SIZE))
+        return false;
+
+    avpkt->buf = av_buffer_ref(buf);
+    if (unlikely(avpkt->buf == NULL))
+        return false;
+    avpkt->data = buf->data + offset;
+    avpkt->size = size;
+    ubuf_free(ubuf);
+    return true;
+}
+
+/** @internal @This copies an input buffer into a pooled padded buffer.
+ *
+ * @param upipe description structure of the pipe
+ * @param ubuf input buffer
+ * @param size size of the buffer
+ * @param avpkt filled in with the copied buffer
+ * @return an error code
+ */
+static int upipe_avcdec_copy_avpkt(struct upipe *upipe, struct ubuf *ubuf,
+                                   size_t size, AVPacket *avpkt)
+{
+    struct upipe_avcdec *upipe_avcdec = upipe_avcdec_from_upipe(upipe);
+    size_t buf_size = size + AV_INPUT_BUFFER_PADDING_SIZE;
+
+    if (unlikely(upipe_avcdec->avpkt_pool == NULL ||
+                 upipe_avcdec->avpkt_pool_size < buf_size)) {
+        /* buffers in use are freed when they are released */
+        av_buffer_pool_uninit(&upipe_avcdec->avpkt_pool);
+        upipe_avcdec->avpkt_pool_size =
+            (buf_size + AVPKT_POOL_ALIGN - 1) & ~(AVPKT_POOL_ALIGN - 1);
+        upipe_avcdec->avpkt_pool =
+            av_buffer_pool_init(upipe_avcdec->avpkt_pool_size, NULL);
+        if (unlikely(upipe_avcdec->avpkt_pool == NULL))
+            return UBASE_ERR_ALLOC;
+    }
+
+    avpkt->buf = av_buffer_pool_get(upipe_avcdec->avpkt_pool);
+    if (unlikely(avpkt->buf == NULL))
+        return UBASE_ERR_ALLOC;
+    avpkt->data = avpkt->buf->data;
+    avpkt->size = size;
+    int err = ubuf_block_extract(ubuf, 0, size, avpkt->data);
+    if (unlikely(!ubase_check(err))) {
+        av_buffer_unref(&avpkt->buf);
+        return err;
+    }
+    memset(avpkt->data + size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+    return UBASE_ERR_NONE;
+}
+
 /** @internal @This decodes packets.
  *
  * @param upipe description structure of the pipe
@@ -1313,10 +1463,9 @@ static bool upipe_avcdec_decode(struct upipe *upipe, struct uref *uref,
     memset(&avpkt, 0, sizeof(AVPacket));
     av_init_packet(&avpkt);
 
-    /* avcodec input buffer needs to be at least 4-byte aligned and
-       AV_INPUT_BUFFER_PADDING_SIZE larger than actual input size.
-       Thus, extract ubuf content in a properly allocated buffer.
-       Padding must be zeroed. */
+    /* avcodec input buffer needs to be AV_INPUT_BUFFER_PADDING_SIZE larger
+       than actual input size, and padding must be zeroed. The buffer is
+       passed by reference when possible, and copied otherwise. */
     size_t size = 0;
     uref_block_size(uref, &size);
     if (unlikely(!size)) {
@@ -1328,16 +1477,17 @@ static bool upipe_avcdec_decode(struct upipe *upipe, struct uref *uref,
 
     upipe_verbose_va(upipe, "Received packet %"PRIu64" - size : %d",
                      upipe_avcdec->counter, avpkt.size);
-    /* TODO replace with umem */
-    avpkt.data = malloc(avpkt.size + AV_INPUT_BUFFER_PADDING_SIZE);
-    if (unlikely(avpkt.data == NULL)) {
-        uref_free(uref);
-        upipe_throw_fatal(upipe, UBASE_ERR_ALLOC);
-        return true;
+    struct ubuf *ubuf = uref_detach_ubuf(uref);
+    if (!upipe_avcdec_ref_avpkt(upipe, ubuf, size, &avpkt) &&
+        !upipe_avcdec_wrap_avpkt(upipe, ubuf, size, &avpkt)) {
+        int err = upipe_avcdec_copy_avpkt(upipe, ubuf, size, &avpkt);
+        ubuf_free(ubuf);
+        if (unlikely(!ubase_check(err))) {
+            uref_free(uref);
+            upipe_throw_fatal(upipe, err);
+            return true;
+        }
     }
-    uref_block_extract(uref, 0, avpkt.size, avpkt.data);
-    ubuf_free(uref_detach_ubuf(uref));
-    memset(avpkt.data + avpkt.size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
 
     uref_pic_set_number(uref, upipe_avcdec->counter++);
     uref_clock_get_rate(uref, &upipe_avcdec->drift_rate);
@@ -1351,7 +1501,7 @@ static bool upipe_avcdec_decode(struct upipe *upipe, struct uref *uref,
     upipe_avcdec_store_uref(upipe, uref);
     upipe_avcdec_decode_avpkt(upipe, &avpkt, upump_p);
 
-    free(avpkt.data);
+    av_packet_unref(&avpkt);
     return true;
 }
 
@@ -1379,6 +1529,33 @@ static void upipe_avcdec_input(struct upipe *upipe, struct uref *uref,
     upipe_avcdec_decode(upipe, uref, upump_p);
 }
 
+/** @internal @This requires a ubuf manager by proxy, and amends the flow
+ * format so that input buffers can be passed to avcodec by reference.
+ *
+ * @param upipe description structure of the pipe
+ * @param request description structure of the request
+ * @return an error code
+ */
+static int upipe_avcdec_amend_ubuf_mgr(struct upipe *upipe,
+                                       struct urequest *request)
+{
+    struct uref *flow_format = uref_dup(request->uref);
+    UBASE_ALLOC_RETURN(flow_format);
+
+    uint64_t append;
+    if (!ubase_check(uref_block_flow_get_append(flow_format, &append)) ||
+        append < AV_INPUT_BUFFER_PADDING_SIZE)
+        uref_block_flow_set_append(flow_format, AV_INPUT_BUFFER_PADDING_SIZE);
+
+    struct urequest ubuf_mgr_request;
+    urequest_set_opaque(&ubuf_mgr_request, request);
+    urequest_init_ubuf_mgr(&ubuf_mgr_request, flow_format,
+                           upipe_avcdec_provide_output_proxy, NULL);
+    upipe_throw_provide_request(upipe, &ubuf_mgr_request);
+    urequest_clean(&ubuf_mgr_request);
+    return UBASE_ERR_NONE;
+}
+
 /** @internal @This sets the input flow definition.
  *
  * @param upipe description structure of the pipe
@@ -1549,8 +1726,9 @@ static int upipe_avcdec_control(struct upipe *upipe, int command, va_list args)
     switch (command) {
         case UPIPE_REGISTER_REQUEST: {
             struct urequest *request = va_arg(args, struct urequest *);
-            if (request->type == UREQUEST_UBUF_MGR ||
-                request->type == UREQUEST_FLOW_FORMAT)
+            if (request->type == UREQUEST_UBUF_MGR)
+                return upipe_avcdec_amend_ubuf_mgr(upipe, request);
+            if (request->type == UREQUEST_FLOW_FORMAT)
                 return upipe_throw_provide_request(upipe, request);
             return upipe_avcdec_alloc_output_proxy(upipe, request);
         }
@@ -1599,6 +1777,7 @@ static void upipe_avcdec_free(struct upipe *upipe)
         av_free(upipe_avcdec->context);
     }
     av_frame_free(&upipe_avcdec->frame);
+    av_buffer_pool_uninit(&upipe_avcdec->avpkt_pool);
 
     upipe_throw_dead(upipe);
     uref_free(upipe_avcdec->uref);
@@ -1649,6 +1828,8 @@ static struct upipe *upipe_avcdec_alloc(struct upipe_mgr *mgr,
     struct upipe_avcdec *upipe_avcdec = upipe_avcdec_from_upipe(upipe);
     upipe_avcdec->context = NULL;
     upipe_avcdec->frame = frame;
+    upipe_avcdec->avpkt_pool = NULL;
+    upipe_avcdec->avpkt_pool_size = 0;
     upipe_avcdec->counter = 0;
     upipe_avcdec->close = false;
     upipe_avcdec->pix_fmt = AV_PIX_FMT_NONE;
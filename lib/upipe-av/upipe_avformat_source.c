@@ -29,6 +29,8 @@
 
 #include <upipe/ubase.h>
 #include <upipe/ulist.h>
+#include <upipe/uatomic.h>
+#include <upipe/uqueue.h>
 #include <upipe/uprobe.h>
 #include <upipe/uprobe_prefix.h>
 #include <upipe/uclock.h>
@@ -60,6 +62,7 @@
 #include <upipe/upipe_helper_subpipe.h>
 #include <upipe-modules/upipe_idem.h>
 #include <upipe-av/uref_av_flow.h>
+#include <upipe-av/ubuf_block_av.h>
 #include <upipe-av/upipe_avformat_source.h>
 
 #include "upipe_av_internal.h"
@@ -76,6 +79,7 @@
 #include <sys/ioctl.h>
 #include <errno.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include <libavutil/dict.h>
 #include <libavformat/avformat.h>
@@ -84,6 +88,26 @@
 #define AV_CLOCK_MIN UINT32_MAX
 /** offset between DTS and (artificial) clock references */
 #define PCR_OFFSET (UCLOCK_FREQ * 3)
+/** depth of the pool of ubuf structures wrapping packets */
+#define UBUF_AV_POOL_DEPTH 32
+/** maximum number of packets in the read-ahead queue */
+#define READAHEAD_MAX_PACKETS UINT8_MAX
+/** unit of the timestamps in the read-ahead queue */
+#define READAHEAD_TS_UNIT (UCLOCK_FREQ / 1000)
+
+/** @internal @This is a packet slot of the read-ahead queue. */
+struct upipe_avfsrc_readahead_pkt {
+    /** packet read by avformat */
+    AVPacket pkt;
+    /** time base of the stream of the packet */
+    AVRational time_base;
+    /** return value of av_read_frame */
+    int error;
+    /** true if the packet has a timestamp */
+    bool has_ts;
+    /** timestamp of the packet, in READAHEAD_TS_UNIT */
+    uint32_t ts;
+};
 
 /** @internal @This is the private context of an avfsrc manager. */
 struct upipe_avfsrc_mgr {
@@ -120,6 +144,8 @@ struct upipe_avfsrc {
     struct uref_mgr *uref_mgr;
     /** uref manager request */
     struct urequest uref_mgr_request;
+    /** ubuf manager wrapping the buffers of avformat packets */
+    struct ubuf_mgr *av_ubuf_mgr;
 
     /** uclock structure, if not NULL we are in live mode */
     struct uclock *uclock;
@@ -140,6 +166,49 @@ struct upipe_avfsrc {
     /** list of subs */
     struct uchain subs;
 
+    /** read-ahead budget for the next URL, in packets (0 = disabled) */
+    unsigned int readahead_packets;
+    /** read-ahead budget for the next URL, in octets */
+    uint32_t readahead_bytes;
+    /** read-ahead budget for the next URL, in READAHEAD_TS_UNIT */
+    uint32_t readahead_duration;
+    /** read-ahead budget of the current URL, in packets (0 = disabled) */
+    unsigned int reader_packets;
+    /** read-ahead budget of the current URL, in octets */
+    uint32_t reader_bytes;
+    /** read-ahead budget of the current URL, in READAHEAD_TS_UNIT */
+    uint32_t reader_duration;
+    /** true if the reader thread has been started */
+    bool reader_running;
+    /** reader thread */
+    pthread_t reader_thread;
+    /** queue of packets read by the reader thread */
+    struct uqueue reader_queue;
+    /** extra data for the queue */
+    uint8_t *reader_queue_extra;
+    /** packet slots, used in a round-robin fashion */
+    struct upipe_avfsrc_readahead_pkt *reader_slots;
+    /** number of octets in the queue */
+    uatomic_uint32_t reader_queued_bytes;
+    /** timestamp of the last packet pushed, in READAHEAD_TS_UNIT */
+    uatomic_uint32_t reader_pushed_ts;
+    /** timestamp of the last packet popped, in READAHEAD_TS_UNIT */
+    uatomic_uint32_t reader_popped_ts;
+    /** set to ask the reader thread to exit */
+    uatomic_uint32_t reader_stop;
+    /** set while the reader thread waits for room in the queue */
+    uatomic_uint32_t reader_waiting;
+    /** mutex associated with reader_cond */
+    pthread_mutex_t reader_mutex;
+    /** signaled when room is made in the queue */
+    pthread_cond_t reader_cond;
+    /** maximum number of queued packets since the stats were last read */
+    unsigned int reader_max_packets;
+    /** maximum number of queued octets since the stats were last read */
+    uint32_t reader_max_bytes;
+    /** maximum span of the queue since the stats were last read */
+    uint32_t reader_max_duration;
+
     /** URL */
     char *url;
 
@@ -151,6 +220,16 @@ struct upipe_avfsrc {
     AVFormatContext *context;
     /** true if the URL has already been probed by avformat */
     bool probed;
+    /** streams found by the probe; the array of the context may be
+     * reallocated by av_read_frame in the reader thread */
+    AVStream **streams;
+    /** number of streams found by the probe */
+    unsigned int nb_streams;
+    /** discard settings requested for the streams found by the probe,
+     * applied by the thread calling av_read_frame */
+    uatomic_uint32_t *discards;
+    /** set when a discard setting has been requested */
+    uatomic_uint32_t discards_changed;
 
     /** manager to create subs */
     struct upipe_mgr sub_mgr;
@@ -239,6 +318,57 @@ UBASE_FROM_TO(upipe_avfsrc_sub, urefcount, urefcount_real, urefcount_real)
 /** @hidden */
 static void upipe_avfsrc_sub_free(struct urefcount *urefcount_real);
 
+/** @internal @This requests a new discard setting for a stream. It is
+ * applied by the thread calling av_read_frame, before the next read.
+ *
+ * @param upipe_avfsrc private context of the pipe
+ * @param id ID of the stream, lower than nb_streams
+ * @param discard new discard setting
+ */
+static void upipe_avfsrc_set_discard(struct upipe_avfsrc *upipe_avfsrc,
+                                     uint64_t id, enum AVDiscard discard)
+{
+    uatomic_store(&upipe_avfsrc->discards[id], discard);
+    uatomic_store(&upipe_avfsrc->discards_changed, 1);
+}
+
+/** @internal @This applies the requested discard settings to the streams.
+ * It must be called from the thread calling av_read_frame.
+ *
+ * @param upipe_avfsrc private context of the pipe
+ */
+static void upipe_avfsrc_apply_discards(struct upipe_avfsrc *upipe_avfsrc)
+{
+    uint32_t changed = 1;
+    if (likely(!uatomic_compare_exchange(&upipe_avfsrc->discards_changed,
+                                         &changed, 0)))
+        return;
+    for (unsigned int i = 0; i < upipe_avfsrc->nb_streams; i++)
+        upipe_avfsrc->streams[i]->discard =
+            uatomic_load(&upipe_avfsrc->discards[i]);
+}
+
+/** @internal @This frees the streams found by the probe and their flow
+ * definitions. The reader thread must have been stopped beforehand.
+ *
+ * @param upipe_avfsrc private context of the pipe
+ */
+static void upipe_avfsrc_clean_streams(struct upipe_avfsrc *upipe_avfsrc)
+{
+    for (unsigned int i = 0; i < upipe_avfsrc->nb_streams; i++) {
+        AVCodecContext *codec = upipe_avfsrc->streams[i]->codec;
+        uref_free((struct uref *)codec->opaque);
+        codec->opaque = NULL;
+        uatomic_clean(&upipe_avfsrc->discards[i]);
+    }
+    free(upipe_avfsrc->streams);
+    free(upipe_avfsrc->discards);
+    upipe_avfsrc->streams = NULL;
+    upipe_avfsrc->discards = NULL;
+    upipe_avfsrc->nb_streams = 0;
+    uatomic_store(&upipe_avfsrc->discards_changed, 0);
+}
+
 /** @internal @This allocates an output subpipe of an avfsrc pipe.
  *
  * @param mgr common management structure
@@ -291,8 +421,7 @@ static struct upipe *upipe_avfsrc_sub_alloc(struct upipe_mgr *mgr,
     }
 
     /* select the stream */
-    if (upipe_avfsrc->context == NULL ||
-        id >= upipe_avfsrc->context->nb_streams) {
+    if (upipe_avfsrc->context == NULL || id >= upipe_avfsrc->nb_streams) {
         upipe_warn_va(upipe, "ID %"PRIu64" doesn't exist", id);
         upipe_release(upipe);
         return NULL;
@@ -320,7 +449,7 @@ static struct upipe *upipe_avfsrc_sub_alloc(struct upipe_mgr *mgr,
     }
     upipe_avfsrc_sub_store_last_inner(upipe, inner);
 
-    upipe_avfsrc->context->streams[id]->discard = AVDISCARD_DEFAULT;
+    upipe_avfsrc_set_discard(upipe_avfsrc, id, AVDISCARD_DEFAULT);
     upipe_throw_ready(upipe);
 
     upipe_avfsrc_sub_require_ubuf_mgr(upipe, uref_dup(flow_def));
@@ -412,7 +541,8 @@ static void upipe_avfsrc_sub_free(struct urefcount *urefcount_real)
     upipe_throw_dead(upipe);
 
     uref_free(sub->flow_def);
-    avfsrc->context->streams[sub->id]->discard = AVDISCARD_ALL;
+    if (sub->id < avfsrc->nb_streams)
+        upipe_avfsrc_set_discard(avfsrc, sub->id, AVDISCARD_ALL);
     upipe_avfsrc_sub_clean_ubuf_mgr(upipe);
     upipe_avfsrc_sub_clean_last_inner_probe(upipe);
     urefcount_clean(urefcount_real);
@@ -479,6 +609,26 @@ static struct upipe *upipe_avfsrc_alloc(struct upipe_mgr *mgr,
     upipe_avfsrc_init_upump_mgr(upipe);
     upipe_avfsrc_init_upump(upipe);
     upipe_avfsrc_init_uclock(upipe);
+    upipe_avfsrc->av_ubuf_mgr = ubuf_block_av_mgr_alloc(UBUF_AV_POOL_DEPTH);
+    upipe_avfsrc->readahead_packets = 0;
+    upipe_avfsrc->readahead_bytes = 0;
+    upipe_avfsrc->readahead_duration = 0;
+    upipe_avfsrc->reader_packets = 0;
+    upipe_avfsrc->reader_bytes = 0;
+    upipe_avfsrc->reader_duration = 0;
+    upipe_avfsrc->reader_running = false;
+    upipe_avfsrc->reader_queue_extra = NULL;
+    upipe_avfsrc->reader_slots = NULL;
+    uatomic_init(&upipe_avfsrc->reader_queued_bytes, 0);
+    uatomic_init(&upipe_avfsrc->reader_pushed_ts, 0);
+    uatomic_init(&upipe_avfsrc->reader_popped_ts, 0);
+    uatomic_init(&upipe_avfsrc->reader_stop, 0);
+    uatomic_init(&upipe_avfsrc->reader_waiting, 0);
+    pthread_mutex_init(&upipe_avfsrc->reader_mutex, NULL);
+    pthread_cond_init(&upipe_avfsrc->reader_cond, NULL);
+    upipe_avfsrc->reader_max_packets = 0;
+    upipe_avfsrc->reader_max_bytes = 0;
+    upipe_avfsrc->reader_max_duration = 0;
     upipe_avfsrc->timestamp_offset = 0;
     upipe_avfsrc->timestamp_highest = AV_CLOCK_MIN;
     upipe_avfsrc->systime_rap = UINT64_MAX;
@@ -489,6 +639,10 @@ static struct upipe *upipe_avfsrc_alloc(struct upipe_mgr *mgr,
     upipe_avfsrc->options = NULL;
     upipe_avfsrc->context = NULL;
     upipe_avfsrc->probed = false;
+    upipe_avfsrc->streams = NULL;
+    upipe_avfsrc->nb_streams = 0;
+    upipe_avfsrc->discards = NULL;
+    uatomic_init(&upipe_avfsrc->discards_changed, 0);
     upipe_throw_ready(upipe);
     return upipe;
 }
@@ -527,81 +681,117 @@ static struct upipe_avfsrc_sub *upipe_avfsrc_find_output(struct upipe *upipe,
     return NULL;
 }
 
-/** @internal @This reads data from the source and outputs it.
- * It is called either when the idler triggers (permanent storage mode) or
- * when data is available on the file descriptor (live stream mode).
+/** @internal @This wraps the buffer of a packet into a uref, without
+ * copying the data. The packet keeps its own reference to the buffer.
  *
- * @param upump description structure of the read watcher
+ * @param upipe description structure of the pipe
+ * @param pkt packet returned by avformat
+ * @return pointer to uref, or NULL if the packet cannot be wrapped
  */
-static void upipe_avfsrc_worker(struct upump *upump)
+static struct uref *upipe_avfsrc_wrap_pkt(struct upipe *upipe, AVPacket *pkt)
 {
-    struct upipe *upipe = upump_get_opaque(upump, struct upipe *);
     struct upipe_avfsrc *upipe_avfsrc = upipe_avfsrc_from_upipe(upipe);
-    AVPacket pkt;
+    if (pkt->buf == NULL || upipe_avfsrc->av_ubuf_mgr == NULL)
+        return NULL;
 
-    int error = av_read_frame(upipe_avfsrc->context, &pkt);
-    if (unlikely(error < 0)) {
-        upipe_av_strerror(error, buf);
-        upipe_err_va(upipe, "read error from %s (%s)", upipe_avfsrc->url, buf);
-        upipe_avfsrc_set_upump(upipe, NULL);
-        upipe_throw_source_end(upipe);
-        return;
+    struct ubuf *ubuf = ubuf_block_av_alloc(upipe_avfsrc->av_ubuf_mgr,
+                                            pkt->buf, pkt->data, pkt->size);
+    if (unlikely(ubuf == NULL))
+        return NULL;
+
+    struct uref *uref = uref_alloc(upipe_avfsrc->uref_mgr);
+    if (unlikely(uref == NULL)) {
+        ubuf_free(ubuf);
+        return NULL;
+    }
+    uref_attach_ubuf(uref, ubuf);
+    return uref;
+}
+
+/** @internal @This copies the data of a packet into a newly allocated uref.
+ *
+ * @param upipe description structure of the pipe
+ * @param ubuf_mgr block buffer manager of the output
+ * @param pkt packet returned by avformat
+ * @return pointer to uref, or NULL in case of allocation error
+ */
+static struct uref *upipe_avfsrc_copy_pkt(struct upipe *upipe,
+                                          struct ubuf_mgr *ubuf_mgr,
+                                          AVPacket *pkt)
+{
+    struct upipe_avfsrc *upipe_avfsrc = upipe_avfsrc_from_upipe(upipe);
+    struct uref *uref = uref_block_alloc(upipe_avfsrc->uref_mgr,
+                                         ubuf_mgr, pkt->size);
+    if (unlikely(uref == NULL))
+        return NULL;
+
+    uint8_t *buffer;
+    int read_size = -1;
+    if (unlikely(!ubase_check(uref_block_write(uref, 0, &read_size,
+                                               &buffer)))) {
+        uref_free(uref);
+        return NULL;
     }
+    assert(read_size == pkt->size);
+    memcpy(buffer, pkt->data, pkt->size);
+    uref_block_unmap(uref, 0);
+    return uref;
+}
 
+/** @internal @This converts a packet read by avformat to a uref and
+ * outputs it.
+ *
+ * @param upipe description structure of the pipe
+ * @param pkt packet read by avformat, which is unreferenced
+ * @param time_base time base of the stream of the packet
+ */
+static void upipe_avfsrc_output_pkt(struct upipe *upipe, AVPacket *pkt,
+                                    AVRational time_base)
+{
+    struct upipe_avfsrc *upipe_avfsrc = upipe_avfsrc_from_upipe(upipe);
     struct upipe_avfsrc_sub *output =
-        upipe_avfsrc_find_output(upipe, pkt.stream_index);
+        upipe_avfsrc_find_output(upipe, pkt->stream_index);
     if (output == NULL) {
-        av_packet_unref(&pkt);
+        av_packet_unref(pkt);
         return;
     }
-    if (unlikely(output->ubuf_mgr == NULL)) {
-        if (unlikely(!upipe_avfsrc_sub_demand_ubuf_mgr(upipe_avfsrc_sub_to_upipe(output), uref_dup(output->flow_def)))) {
-            av_packet_unref(&pkt);
-            return;
+    struct uref *uref = upipe_avfsrc_wrap_pkt(upipe, pkt);
+    if (uref == NULL) {
+        if (unlikely(output->ubuf_mgr == NULL)) {
+            if (unlikely(!upipe_avfsrc_sub_demand_ubuf_mgr(upipe_avfsrc_sub_to_upipe(output), uref_dup(output->flow_def)))) {
+                av_packet_unref(pkt);
+                return;
+            }
         }
+        uref = upipe_avfsrc_copy_pkt(upipe, output->ubuf_mgr, pkt);
     }
-
-    struct uref *uref = uref_block_alloc(upipe_avfsrc->uref_mgr,
-                                         output->ubuf_mgr, pkt.size);
     if (unlikely(uref == NULL)) {
-        av_packet_unref(&pkt);
+        av_packet_unref(pkt);
         upipe_throw_fatal(upipe, UBASE_ERR_ALLOC);
         return;
     }
 
-    AVStream *stream = upipe_avfsrc->context->streams[pkt.stream_index];
     uint64_t systime = upipe_avfsrc->uclock != NULL ?
                        uclock_now(upipe_avfsrc->uclock) : UINT64_MAX;
-    uint8_t *buffer;
-    int read_size = -1;
-    if (unlikely(!ubase_check(uref_block_write(uref, 0, &read_size, &buffer)))) {
-        uref_free(uref);
-        av_packet_unref(&pkt);
-        upipe_throw_fatal(upipe, UBASE_ERR_ALLOC);
-        return;
-    }
-    assert(read_size == pkt.size);
-    memcpy(buffer, pkt.data, pkt.size);
-    uref_block_unmap(uref, 0);
 
     bool ts = false;
     if (upipe_avfsrc->uclock != NULL)
         uref_clock_set_cr_sys(uref, systime);
-    if (pkt.flags & AV_PKT_FLAG_KEY) {
+    if (pkt->flags & AV_PKT_FLAG_KEY) {
         UBASE_FATAL(upipe, uref_pic_set_key(uref))
         upipe_avfsrc->systime_rap = systime;
     }
 
     uint64_t dts_orig = UINT64_MAX, dts_pts_delay = 0;
-    if (pkt.dts != (int64_t)AV_NOPTS_VALUE) {
-        dts_orig = pkt.dts * stream->time_base.num * (int64_t)UCLOCK_FREQ /
-                   stream->time_base.den - INT64_MIN;
-        if (pkt.pts != (int64_t)AV_NOPTS_VALUE)
-            dts_pts_delay = (pkt.pts - pkt.dts) * stream->time_base.num *
-                            UCLOCK_FREQ / stream->time_base.den;
-    } else if (pkt.pts != (int64_t)AV_NOPTS_VALUE) {
-        dts_orig = pkt.pts * stream->time_base.num * (int64_t)UCLOCK_FREQ /
-                   stream->time_base.den - INT64_MIN;
+    if (pkt->dts != (int64_t)AV_NOPTS_VALUE) {
+        dts_orig = pkt->dts * time_base.num * (int64_t)UCLOCK_FREQ /
+                   time_base.den - INT64_MIN;
+        if (pkt->pts != (int64_t)AV_NOPTS_VALUE)
+            dts_pts_delay = (pkt->pts - pkt->dts) * time_base.num *
+                            UCLOCK_FREQ / time_base.den;
+    } else if (pkt->pts != (int64_t)AV_NOPTS_VALUE) {
+        dts_orig = pkt->pts * time_base.num * (int64_t)UCLOCK_FREQ /
+                   time_base.den - INT64_MIN;
     }
 
     if (dts_orig != UINT64_MAX) {
@@ -620,9 +810,9 @@ static void upipe_avfsrc_worker(struct upump *upump)
         /* this is subtly wrong, but whatever */
         upipe_throw_clock_ref(upipe, uref, dts - PCR_OFFSET, 0);
     }
-    if (pkt.duration > 0) {
-        uint64_t duration = pkt.duration * stream->time_base.num * UCLOCK_FREQ /
-                            stream->time_base.den;
+    if (pkt->duration > 0) {
+        uint64_t duration = pkt->duration * time_base.num *
+                            UCLOCK_FREQ / time_base.den;
         UBASE_FATAL(upipe, uref_clock_set_duration(uref, duration))
     }
     if (upipe_avfsrc->systime_rap != UINT64_MAX)
@@ -630,11 +820,325 @@ static void upipe_avfsrc_worker(struct upump *upump)
 
     if (ts)
         upipe_throw_clock_ts(upipe, uref);
-    av_packet_unref(&pkt);
+    av_packet_unref(pkt);
 
     upipe_input(output->last_inner, uref, &upipe_avfsrc->upump);
 }
 
+/** @internal @This reads data from the source and outputs it.
+ * It is called either when the idler triggers (permanent storage mode) or
+ * when data is available on the file descriptor (live stream mode).
+ *
+ * @param upump description structure of the read watcher
+ */
+static void upipe_avfsrc_worker(struct upump *upump)
+{
+    struct upipe *upipe = upump_get_opaque(upump, struct upipe *);
+    struct upipe_avfsrc *upipe_avfsrc = upipe_avfsrc_from_upipe(upipe);
+    AVPacket pkt;
+
+    upipe_avfsrc_apply_discards(upipe_avfsrc);
+    int error = av_read_frame(upipe_avfsrc->context, &pkt);
+    if (unlikely(error < 0)) {
+        upipe_av_strerror(error, buf);
+        upipe_err_va(upipe, "read error from %s (%s)", upipe_avfsrc->url, buf);
+        upipe_avfsrc_set_upump(upipe, NULL);
+        upipe_throw_source_end(upipe);
+        return;
+    }
+
+    upipe_avfsrc_output_pkt(upipe, &pkt,
+            upipe_avfsrc->context->streams[pkt.stream_index]->time_base);
+}
+
+/** @internal @This returns the span of the timestamps in the read-ahead
+ * queue.
+ *
+ * @param upipe_avfsrc private context of the pipe
+ * @return span in READAHEAD_TS_UNIT
+ */
+static uint32_t upipe_avfsrc_reader_span(struct upipe_avfsrc *upipe_avfsrc)
+{
+    /* timestamps of interleaved streams are not strictly monotonic */
+    int32_t span = uatomic_load(&upipe_avfsrc->reader_pushed_ts) -
+                   uatomic_load(&upipe_avfsrc->reader_popped_ts);
+    return span > 0 ? span : 0;
+}
+
+/** @internal @This checks if the read-ahead budget is exhausted. It is
+ * called from the reader thread.
+ *
+ * @param upipe_avfsrc private context of the pipe
+ * @return true if the reader thread must wait
+ */
+static bool upipe_avfsrc_reader_full(struct upipe_avfsrc *upipe_avfsrc)
+{
+    unsigned int packets = uqueue_length(&upipe_avfsrc->reader_queue);
+    if (!packets)
+        return false;
+    if (packets >= upipe_avfsrc->reader_packets)
+        return true;
+    if (upipe_avfsrc->reader_bytes &&
+        uatomic_load(&upipe_avfsrc->reader_queued_bytes) >=
+            upipe_avfsrc->reader_bytes)
+        return true;
+    if (upipe_avfsrc->reader_duration &&
+        upipe_avfsrc_reader_span(upipe_avfsrc) >=
+            upipe_avfsrc->reader_duration)
+        return true;
+    return false;
+}
+
+/** @internal @This waits until there is room in the read-ahead queue. It is
+ * called from the reader thread.
+ *
+ * @param upipe_avfsrc private context of the pipe
+ * @return false if the reader thread must exit
+ */
+static bool upipe_avfsrc_reader_wait(struct upipe_avfsrc *upipe_avfsrc)
+{
+    if (likely(!upipe_avfsrc_reader_full(upipe_avfsrc)))
+        return !uatomic_load(&upipe_avfsrc->reader_stop);
+
+    pthread_mutex_lock(&upipe_avfsrc->reader_mutex);
+    uatomic_store(&upipe_avfsrc->reader_waiting, 1);
+    while (upipe_avfsrc_reader_full(upipe_avfsrc) &&
+           !uatomic_load(&upipe_avfsrc->reader_stop))
+        pthread_cond_wait(&upipe_avfsrc->reader_cond,
+                          &upipe_avfsrc->reader_mutex);
+    uatomic_store(&upipe_avfsrc->reader_waiting, 0);
+    pthread_mutex_unlock(&upipe_avfsrc->reader_mutex);
+    return !uatomic_load(&upipe_avfsrc->reader_stop);
+}
+
+/** @internal @This wakes up the reader thread if it waits for room in the
+ * read-ahead queue.
+ *
+ * @param upipe_avfsrc private context of the pipe
+ */
+static void upipe_avfsrc_reader_signal(struct upipe_avfsrc *upipe_avfsrc)
+{
+    if (likely(!uatomic_load(&upipe_avfsrc->reader_waiting)))
+        return;
+    pthread_mutex_lock(&upipe_avfsrc->reader_mutex);
+    pthread_cond_signal(&upipe_avfsrc->reader_cond);
+    pthread_mutex_unlock(&upipe_avfsrc->reader_mutex);
+}
+
+/** @internal @This is the main loop of the reader thread. It demuxes
+ * packets and pushes them into the read-ahead queue, until an error occurs
+ * or it is asked to exit. No probe may be thrown from this thread.
+ *
+ * @param opaque private context of the pipe
+ * @return NULL
+ */
+static void *upipe_avfsrc_reader(void *opaque)
+{
+    struct upipe_avfsrc *upipe_avfsrc = (struct upipe_avfsrc *)opaque;
+    unsigned int nb_slots = upipe_avfsrc->reader_packets + 1;
+    unsigned int slot = 0;
+    bool has_ts = false;
+
+    for ( ; ; ) {
+        AVPacket pkt;
+        upipe_avfsrc_apply_discards(upipe_avfsrc);
+        int error = av_read_frame(upipe_avfsrc->context, &pkt);
+        bool pkt_has_ts = false;
+        uint32_t pkt_ts = 0;
+        AVRational time_base = { .num = 0, .den = 1 };
+        if (!error) {
+            /* the streams of the context may only be accessed from this
+             * thread, so the pipe gets a copy of the time base */
+            time_base =
+                upipe_avfsrc->context->streams[pkt.stream_index]->time_base;
+            int64_t ts = pkt.dts != (int64_t)AV_NOPTS_VALUE ? pkt.dts : pkt.pts;
+            if (ts != (int64_t)AV_NOPTS_VALUE) {
+                pkt_has_ts = true;
+                pkt_ts = ts * time_base.num *
+                         (int64_t)(UCLOCK_FREQ / READAHEAD_TS_UNIT) /
+                         time_base.den;
+            }
+        }
+
+        if (unlikely(!upipe_avfsrc_reader_wait(upipe_avfsrc))) {
+            if (!error)
+                av_packet_unref(&pkt);
+            break;
+        }
+
+        /* at most reader_packets - 1 slots are queued, and one may still be
+         * read by the pipe, so this slot is free */
+        struct upipe_avfsrc_readahead_pkt *rpkt =
+            &upipe_avfsrc->reader_slots[slot];
+        slot = (slot + 1) % nb_slots;
+        rpkt->pkt = pkt;
+        rpkt->time_base = time_base;
+        rpkt->error = error;
+        rpkt->has_ts = pkt_has_ts;
+        rpkt->ts = pkt_ts;
+        if (!error) {
+            uatomic_fetch_add(&upipe_avfsrc->reader_queued_bytes, pkt.size);
+            if (pkt_has_ts) {
+                if (unlikely(!has_ts)) {
+                    uatomic_store(&upipe_avfsrc->reader_popped_ts, pkt_ts);
+                    has_ts = true;
+                }
+                uatomic_store(&upipe_avfsrc->reader_pushed_ts, pkt_ts);
+            }
+        }
+
+        if (unlikely(!uqueue_push(&upipe_avfsrc->reader_queue, rpkt))) {
+            /* cannot happen as the queue length was checked */
+            if (!error)
+                av_packet_unref(&rpkt->pkt);
+            break;
+        }
+        if (error)
+            break;
+    }
+    return NULL;
+}
+
+/** @internal @This outputs a packet from the read-ahead queue.
+ *
+ * @param upump description structure of the queue watcher
+ */
+static void upipe_avfsrc_reader_worker(struct upump *upump)
+{
+    struct upipe *upipe = upump_get_opaque(upump, struct upipe *);
+    struct upipe_avfsrc *upipe_avfsrc = upipe_avfsrc_from_upipe(upipe);
+
+    unsigned int packets = uqueue_length(&upipe_avfsrc->reader_queue);
+    struct upipe_avfsrc_readahead_pkt *rpkt =
+        uqueue_pop(&upipe_avfsrc->reader_queue,
+                   struct upipe_avfsrc_readahead_pkt *);
+    if (unlikely(rpkt == NULL))
+        return;
+
+    uint32_t bytes = uatomic_load(&upipe_avfsrc->reader_queued_bytes);
+    uint32_t span = upipe_avfsrc_reader_span(upipe_avfsrc);
+    if (upipe_avfsrc->reader_max_packets < packets)
+        upipe_avfsrc->reader_max_packets = packets;
+    if (upipe_avfsrc->reader_max_bytes < bytes)
+        upipe_avfsrc->reader_max_bytes = bytes;
+    if (upipe_avfsrc->reader_max_duration < span)
+        upipe_avfsrc->reader_max_duration = span;
+
+    /* the slot may be reused by the reader thread once signaled */
+    int error = rpkt->error;
+    AVPacket pkt = rpkt->pkt;
+    AVRational time_base = rpkt->time_base;
+    if (!error) {
+        uatomic_fetch_sub(&upipe_avfsrc->reader_queued_bytes, pkt.size);
+        if (rpkt->has_ts)
+            uatomic_store(&upipe_avfsrc->reader_popped_ts, rpkt->ts);
+    }
+    upipe_avfsrc_reader_signal(upipe_avfsrc);
+
+    if (unlikely(error < 0)) {
+        upipe_av_strerror(error, buf);
+        upipe_err_va(upipe, "read error from %s (%s)", upipe_avfsrc->url, buf);
+        upipe_avfsrc_set_upump(upipe, NULL);
+        upipe_throw_source_end(upipe);
+        return;
+    }
+
+    upipe_avfsrc_output_pkt(upipe, &pkt, time_base);
+}
+
+/** @internal @This starts the reader thread.
+ *
+ * @param upipe description structure of the pipe
+ * @return false in case of error
+ */
+static bool upipe_avfsrc_start_reader(struct upipe *upipe)
+{
+    struct upipe_avfsrc *upipe_avfsrc = upipe_avfsrc_from_upipe(upipe);
+    unsigned int packets = upipe_avfsrc->reader_packets;
+
+    upipe_avfsrc->reader_queue_extra = malloc(uqueue_sizeof(packets));
+    upipe_avfsrc->reader_slots =
+        malloc((packets + 1) * sizeof(struct upipe_avfsrc_readahead_pkt));
+    if (unlikely(upipe_avfsrc->reader_queue_extra == NULL ||
+                 upipe_avfsrc->reader_slots == NULL)) {
+        free(upipe_avfsrc->reader_queue_extra);
+        free(upipe_avfsrc->reader_slots);
+        upipe_avfsrc->reader_queue_extra = NULL;
+        upipe_avfsrc->reader_slots = NULL;
+        return false;
+    }
+    if (unlikely(!uqueue_init(&upipe_avfsrc->reader_queue, packets,
+                              upipe_avfsrc->reader_queue_extra))) {
+        free(upipe_avfsrc->reader_queue_extra);
+        free(upipe_avfsrc->reader_slots);
+        upipe_avfsrc->reader_queue_extra = NULL;
+        upipe_avfsrc->reader_slots = NULL;
+        return false;
+    }
+
+    uatomic_store(&upipe_avfsrc->reader_queued_bytes, 0);
+    uatomic_store(&upipe_avfsrc->reader_pushed_ts, 0);
+    uatomic_store(&upipe_avfsrc->reader_popped_ts, 0);
+    uatomic_store(&upipe_avfsrc->reader_stop, 0);
+    if (unlikely(pthread_create(&upipe_avfsrc->reader_thread, NULL,
+                                upipe_avfsrc_reader, upipe_avfsrc) != 0)) {
+        uqueue_clean(&upipe_avfsrc->reader_queue);
+        free(upipe_avfsrc->reader_queue_extra);
+        free(upipe_avfsrc->reader_slots);
+        upipe_avfsrc->reader_queue_extra = NULL;
+        upipe_avfsrc->reader_slots = NULL;
+        return false;
+    }
+    upipe_avfsrc->reader_running = true;
+    upipe_verbose_va(upipe, "started reader thread (%u packets)", packets);
+    return true;
+}
+
+/** @internal @This stops the reader thread and flushes the read-ahead
+ * queue. The queue watcher must have been released beforehand.
+ *
+ * @param upipe description structure of the pipe
+ */
+static void upipe_avfsrc_stop_reader(struct upipe *upipe)
+{
+    struct upipe_avfsrc *upipe_avfsrc = upipe_avfsrc_from_upipe(upipe);
+    if (!upipe_avfsrc->reader_running)
+        return;
+
+    /* also interrupts blocking reads, see upipe_avfsrc_interrupt */
+    uatomic_store(&upipe_avfsrc->reader_stop, 1);
+    pthread_mutex_lock(&upipe_avfsrc->reader_mutex);
+    pthread_cond_signal(&upipe_avfsrc->reader_cond);
+    pthread_mutex_unlock(&upipe_avfsrc->reader_mutex);
+    pthread_join(upipe_avfsrc->reader_thread, NULL);
+    uatomic_store(&upipe_avfsrc->reader_stop, 0);
+
+    struct upipe_avfsrc_readahead_pkt *rpkt;
+    while ((rpkt = uqueue_pop(&upipe_avfsrc->reader_queue,
+                              struct upipe_avfsrc_readahead_pkt *)) != NULL)
+        if (!rpkt->error)
+            av_packet_unref(&rpkt->pkt);
+    uqueue_clean(&upipe_avfsrc->reader_queue);
+    free(upipe_avfsrc->reader_queue_extra);
+    free(upipe_avfsrc->reader_slots);
+    upipe_avfsrc->reader_queue_extra = NULL;
+    upipe_avfsrc->reader_slots = NULL;
+    uatomic_store(&upipe_avfsrc->reader_queued_bytes, 0);
+    upipe_avfsrc->reader_running = false;
+}
+
+/** @internal @This is called by avformat during blocking operations, to
+ * check if they must be aborted.
+ *
+ * @param opaque private context of the pipe
+ * @return 1 if the operation must be aborted
+ */
+static int upipe_avfsrc_interrupt(void *opaque)
+{
+    struct upipe_avfsrc *upipe_avfsrc = (struct upipe_avfsrc *)opaque;
+    return uatomic_load(&upipe_avfsrc->reader_stop) ? 1 : 0;
+}
+
 /** @internal @This starts the worker.
  *
  * @param upipe description structure of the pipe
@@ -642,9 +1146,22 @@ static void upipe_avfsrc_worker(struct upump *upump)
 static bool upipe_avfsrc_start(struct upipe *upipe)
 {
     struct upipe_avfsrc *upipe_avfsrc = upipe_avfsrc_from_upipe(upipe);
-    struct upump *upump = upump_alloc_idler(upipe_avfsrc->upump_mgr,
-                                            upipe_avfsrc_worker, upipe,
-                                            upipe->refcount);
+    struct upump *upump;
+    if (upipe_avfsrc->reader_packets) {
+        if (!upipe_avfsrc->reader_running &&
+            unlikely(!upipe_avfsrc_start_reader(upipe))) {
+            upipe_err(upipe, "can't start reader thread");
+            upipe_throw_fatal(upipe, UBASE_ERR_EXTERNAL);
+            return false;
+        }
+        upump = uqueue_upump_alloc_pop(&upipe_avfsrc->reader_queue,
+                                       upipe_avfsrc->upump_mgr,
+                                       upipe_avfsrc_reader_worker, upipe,
+                                       upipe->refcount);
+    } else
+        upump = upump_alloc_idler(upipe_avfsrc->upump_mgr,
+                                  upipe_avfsrc_worker, upipe,
+                                  upipe->refcount);
     if (unlikely(upump == NULL)) {
         upipe_throw_fatal(upipe, UBASE_ERR_UPUMP);
         return false;
@@ -838,6 +1355,21 @@ static void upipe_avfsrc_probe(struct upump *upump)
     upipe_avfsrc->upump_av_deal = NULL;
     upipe_avfsrc->probed = true;
 
+    if (likely(error >= 0 && context->nb_streams)) {
+        upipe_avfsrc->streams =
+            malloc(context->nb_streams * sizeof(AVStream *));
+        upipe_avfsrc->discards =
+            malloc(context->nb_streams * sizeof(uatomic_uint32_t));
+        if (unlikely(upipe_avfsrc->streams == NULL ||
+                     upipe_avfsrc->discards == NULL)) {
+            free(upipe_avfsrc->streams);
+            free(upipe_avfsrc->discards);
+            upipe_avfsrc->streams = NULL;
+            upipe_avfsrc->discards = NULL;
+            error = AVERROR(ENOMEM);
+        }
+    }
+
     if (unlikely(error < 0)) {
         upipe_av_strerror(error, buf);
         upipe_err_va(upipe, "can't probe URL %s (%s)", upipe_avfsrc->url, buf);
@@ -856,6 +1388,9 @@ static void upipe_avfsrc_probe(struct upump *upump)
 
         // discard all packets from this stream
         stream->discard = AVDISCARD_ALL;
+        upipe_avfsrc->streams[i] = stream;
+        uatomic_init(&upipe_avfsrc->discards[i], AVDISCARD_ALL);
+        upipe_avfsrc->nb_streams = i + 1;
 
         switch (codec->codec_type) {
             case AVMEDIA_TYPE_AUDIO:
@@ -936,9 +1471,10 @@ static int upipe_avfsrc_iterate(struct upipe *upipe, struct uref **p)
         id++;
     }
 
-    while (id < context->nb_streams) {
-        if (context->streams[id]->codec->opaque != NULL) {
-            *p = (struct uref *)context->streams[id]->codec->opaque;
+    while (id < upipe_avfsrc->nb_streams) {
+        AVCodecContext *codec = upipe_avfsrc->streams[id]->codec;
+        if (codec->opaque != NULL) {
+            *p = (struct uref *)codec->opaque;
             return UBASE_ERR_NONE;
         }
         id++;
@@ -1019,9 +1555,11 @@ static int upipe_avfsrc_set_uri(struct upipe *upipe, const char *url)
     if (unlikely(upipe_avfsrc->context != NULL)) {
         if (likely(upipe_avfsrc->url != NULL))
             upipe_notice_va(upipe, "closing URL %s", upipe_avfsrc->url);
+        upipe_avfsrc_set_upump(upipe, NULL);
+        upipe_avfsrc_stop_reader(upipe);
+        upipe_avfsrc_clean_streams(upipe_avfsrc);
         avformat_close_input(&upipe_avfsrc->context);
         upipe_avfsrc->context = NULL;
-        upipe_avfsrc_set_upump(upipe, NULL);
         upipe_avfsrc_abort_av_deal(upipe);
         upipe_avfsrc_throw_sub_subs(upipe, UPROBE_SOURCE_END);
     }
@@ -1041,6 +1579,13 @@ static int upipe_avfsrc_set_uri(struct upipe *upipe, const char *url)
     struct uref *uref = uref_alloc(upipe_avfsrc->uref_mgr);
     upipe_avfsrc_output(upipe, uref, NULL);
 
+    upipe_avfsrc->context = avformat_alloc_context();
+    if (unlikely(upipe_avfsrc->context == NULL))
+        return UBASE_ERR_ALLOC;
+    upipe_avfsrc->context->interrupt_callback.callback =
+        upipe_avfsrc_interrupt;
+    upipe_avfsrc->context->interrupt_callback.opaque = upipe_avfsrc;
+
     AVDictionary *options = NULL;
     av_dict_copy(&options, upipe_avfsrc->options, 0);
     int error = avformat_open_input(&upipe_avfsrc->context, url, NULL,
@@ -1055,6 +1600,9 @@ static int upipe_avfsrc_set_uri(struct upipe *upipe, const char *url)
     /* http://stackoverflow.com/questions/40991412/ffmpeg-producing-strange-nal-suffixes-for-mpeg-ts-with-h264 */
     upipe_avfsrc->context->flags |= AVFMT_FLAG_KEEP_SIDE_DATA;
     upipe_avfsrc->timestamp_offset = 0;
+    upipe_avfsrc->reader_packets = upipe_avfsrc->readahead_packets;
+    upipe_avfsrc->reader_bytes = upipe_avfsrc->readahead_bytes;
+    upipe_avfsrc->reader_duration = upipe_avfsrc->readahead_duration;
     upipe_avfsrc->url = strdup(url);
     upipe_avfsrc->probed = false;
     upipe_notice_va(upipe, "opening URL %s", upipe_avfsrc->url);
@@ -1091,6 +1639,73 @@ static int _upipe_avfsrc_set_time(struct upipe *upipe, uint64_t time)
     return UBASE_ERR_UNHANDLED;
 }
 
+/** @internal @This sets the read-ahead budget for the next URL.
+ *
+ * @param upipe description structure of the pipe
+ * @param packets maximum number of queued packets, or 0 to disable
+ * @param bytes maximum number of queued octets, or 0
+ * @param duration maximum span of the queued timestamps, or 0
+ * @return an error code
+ */
+static int _upipe_avfsrc_set_readahead(struct upipe *upipe,
+                                       unsigned int packets,
+                                       uint64_t bytes, uint64_t duration)
+{
+    struct upipe_avfsrc *upipe_avfsrc = upipe_avfsrc_from_upipe(upipe);
+    if (packets > READAHEAD_MAX_PACKETS)
+        return UBASE_ERR_INVALID;
+
+    duration = (duration + READAHEAD_TS_UNIT - 1) / READAHEAD_TS_UNIT;
+    upipe_avfsrc->readahead_packets = packets;
+    upipe_avfsrc->readahead_bytes = bytes < UINT32_MAX ? bytes : UINT32_MAX;
+    upipe_avfsrc->readahead_duration =
+        duration < INT32_MAX ? duration : INT32_MAX;
+    return UBASE_ERR_NONE;
+}
+
+/** @internal @This returns the occupancy of the read-ahead queue, and
+ * resets the maximum values.
+ *
+ * @param upipe description structure of the pipe
+ * @param packets_p filled in with the number of queued packets
+ * @param bytes_p filled in with the number of queued octets
+ * @param duration_p filled in with the span of the queued timestamps
+ * @param max_packets_p filled in with the maximum number of queued packets
+ * @param max_bytes_p filled in with the maximum number of queued octets
+ * @param max_duration_p filled in with the maximum span of the queue
+ * @return an error code
+ */
+static int _upipe_avfsrc_get_readahead_stats(struct upipe *upipe,
+        unsigned int *packets_p, uint64_t *bytes_p, uint64_t *duration_p,
+        unsigned int *max_packets_p, uint64_t *max_bytes_p,
+        uint64_t *max_duration_p)
+{
+    struct upipe_avfsrc *upipe_avfsrc = upipe_avfsrc_from_upipe(upipe);
+    if (!upipe_avfsrc->reader_packets)
+        return UBASE_ERR_INVALID;
+
+    bool running = upipe_avfsrc->reader_running;
+    if (packets_p != NULL)
+        *packets_p = running ? uqueue_length(&upipe_avfsrc->reader_queue) : 0;
+    if (bytes_p != NULL)
+        *bytes_p = uatomic_load(&upipe_avfsrc->reader_queued_bytes);
+    if (duration_p != NULL)
+        *duration_p = running ?
+            (uint64_t)upipe_avfsrc_reader_span(upipe_avfsrc) *
+            READAHEAD_TS_UNIT : 0;
+    if (max_packets_p != NULL)
+        *max_packets_p = upipe_avfsrc->reader_max_packets;
+    if (max_bytes_p != NULL)
+        *max_bytes_p = upipe_avfsrc->reader_max_bytes;
+    if (max_duration_p != NULL)
+        *max_duration_p = (uint64_t)upipe_avfsrc->reader_max_duration *
+                          READAHEAD_TS_UNIT;
+    upipe_avfsrc->reader_max_packets = 0;
+    upipe_avfsrc->reader_max_bytes = 0;
+    upipe_avfsrc->reader_max_duration = 0;
+    return UBASE_ERR_NONE;
+}
+
 /** @internal @This processes control commands on an avformat source pipe.
  *
  * @param upipe description structure of the pipe
@@ -1151,6 +1766,26 @@ static int _upipe_avfsrc_control(struct upipe *upipe,
             uint64_t time = va_arg(args, uint64_t);
             return _upipe_avfsrc_set_time(upipe, time);
         }
+        case UPIPE_AVFSRC_SET_READAHEAD: {
+            UBASE_SIGNATURE_CHECK(args, UPIPE_AVFSRC_SIGNATURE)
+            unsigned int packets = va_arg(args, unsigned int);
+            uint64_t bytes = va_arg(args, uint64_t);
+            uint64_t duration = va_arg(args, uint64_t);
+            return _upipe_avfsrc_set_readahead(upipe, packets, bytes,
+                                               duration);
+        }
+        case UPIPE_AVFSRC_GET_READAHEAD_STATS: {
+            UBASE_SIGNATURE_CHECK(args, UPIPE_AVFSRC_SIGNATURE)
+            unsigned int *packets_p = va_arg(args, unsigned int *);
+            uint64_t *bytes_p = va_arg(args, uint64_t *);
+            uint64_t *duration_p = va_arg(args, uint64_t *);
+            unsigned int *max_packets_p = va_arg(args, unsigned int *);
+            uint64_t *max_bytes_p = va_arg(args, uint64_t *);
+            uint64_t *max_duration_p = va_arg(args, uint64_t *);
+            return _upipe_avfsrc_get_readahead_stats(upipe, packets_p,
+                    bytes_p, duration_p, max_packets_p, max_bytes_p,
+                    max_duration_p);
+        }
         default:
             return UBASE_ERR_UNHANDLED;
     }
@@ -1205,14 +1840,13 @@ static void upipe_avfsrc_free(struct urefcount *urefcount_real)
     upipe_avfsrc_clean_sub_subs(upipe);
 
     upipe_avfsrc_abort_av_deal(upipe);
+    upipe_avfsrc_set_upump(upipe, NULL);
+    upipe_avfsrc_stop_reader(upipe);
     if (likely(upipe_avfsrc->context != NULL)) {
         if (likely(upipe_avfsrc->url != NULL))
             upipe_notice_va(upipe, "closing URL %s", upipe_avfsrc->url);
 
-        for (int i = 0; i < upipe_avfsrc->context->nb_streams; i++)
-            if (upipe_avfsrc->context->streams[i]->codec->opaque != NULL)
-                uref_free((struct uref *)upipe_avfsrc->context->streams[i]->codec->opaque);
-
+        upipe_avfsrc_clean_streams(upipe_avfsrc);
         avformat_close_input(&upipe_avfsrc->context);
     }
     upipe_throw_dead(upipe);
@@ -1223,6 +1857,15 @@ static void upipe_avfsrc_free(struct urefcount *urefcount_real)
     upipe_avfsrc_clean_uclock(upipe);
     upipe_avfsrc_clean_upump(upipe);
     upipe_avfsrc_clean_upump_mgr(upipe);
+    ubuf_mgr_release(upipe_avfsrc->av_ubuf_mgr);
+    pthread_cond_destroy(&upipe_avfsrc->reader_cond);
+    pthread_mutex_destroy(&upipe_avfsrc->reader_mutex);
+    uatomic_clean(&upipe_avfsrc->reader_queued_bytes);
+    uatomic_clean(&upipe_avfsrc->reader_pushed_ts);
+    uatomic_clean(&upipe_avfsrc->reader_popped_ts);
+    uatomic_clean(&upipe_avfsrc->reader_stop);
+    uatomic_clean(&upipe_avfsrc->reader_waiting);
+    uatomic_clean(&upipe_avfsrc->discards_changed);
     upipe_avfsrc_clean_uref_mgr(upipe);
     upipe_avfsrc_clean_output(upipe);
     urefcount_clean(urefcount_real);
@@ -31,6 +31,8 @@
 
 /** default maximum latency */
 #define UPIPE_DVBCSA_MAX_LATENCY UCLOCK_FREQ
+/** weight of the last interval in the averaged packet interval (1/8) */
+#define UPIPE_DVBCSA_INTERVAL_SHIFT 3
 
 /** @This is the item of a pid list. */
 struct upipe_dvbcsa_common_pid {
@@ -198,4 +200,166 @@ upipe_dvbcsa_common_control(struct upipe_dvbcsa_common *common,
     return ret;
 }
 
+/** @This is the batching state of the dvbcsa bitslice pipes. */
+struct upipe_dvbcsa_batch {
+    /** maximum number of packets per batch */
+    unsigned max_size;
+    /** true if batches are sized from the input packet rate */
+    bool adaptive;
+    /** system date of the last batched packet */
+    uint64_t last_cr_sys;
+    /** averaged interval between batched packets, in system time */
+    uint64_t interval;
+    /** system date of the first packet of the current batch */
+    uint64_t first_cr_sys;
+    /** date of the first packet of the current batch on the pipe uclock */
+    uint64_t first_date;
+    /** number of batches processed since the last statistics */
+    uint64_t batches;
+    /** number of packets processed since the last statistics */
+    uint64_t packets;
+    /** maximum added latency since the last statistics */
+    uint64_t max_latency;
+};
+
+/** @This initializes the batching state.
+ *
+ * @param batch pointer to the batching state
+ * @param max_size maximum number of packets per batch
+ */
+static inline void upipe_dvbcsa_batch_init(struct upipe_dvbcsa_batch *batch,
+                                           unsigned max_size)
+{
+    batch->max_size = max_size;
+    batch->adaptive = false;
+    batch->last_cr_sys = UINT64_MAX;
+    batch->interval = 0;
+    batch->first_cr_sys = UINT64_MAX;
+    batch->first_date = UINT64_MAX;
+    batch->batches = 0;
+    batch->packets = 0;
+    batch->max_latency = 0;
+}
+
+/** @This accounts for a packet added to the current batch and tells whether
+ * the batch must be processed now.
+ *
+ * In adaptive mode, the batch is closed as soon as the next packet, expected
+ * after the averaged interval, would be delayed by more than the maximum
+ * latency. Low bitrate inputs thus get small batches while high bitrate
+ * inputs fill them.
+ *
+ * @param batch pointer to the batching state
+ * @param current number of packets in the batch, including this one
+ * @param cr_sys system date of the packet or UINT64_MAX
+ * @param now current date or UINT64_MAX
+ * @param latency maximum added latency
+ * @return true if the batch must be processed
+ */
+static inline bool upipe_dvbcsa_batch_add(struct upipe_dvbcsa_batch *batch,
+                                          unsigned current, uint64_t cr_sys,
+                                          uint64_t now, uint64_t latency)
+{
+    if (current == 1) {
+        batch->first_cr_sys = cr_sys;
+        batch->first_date = now;
+    }
+
+    if (cr_sys != UINT64_MAX) {
+        if (batch->last_cr_sys != UINT64_MAX && cr_sys > batch->last_cr_sys) {
+            uint64_t delta = cr_sys - batch->last_cr_sys;
+            if (!batch->interval)
+                batch->interval = delta;
+            else
+                batch->interval += (int64_t)(delta - batch->interval) >>
+                    UPIPE_DVBCSA_INTERVAL_SHIFT;
+        }
+        batch->last_cr_sys = cr_sys;
+        if (cr_sys < batch->first_cr_sys)
+            batch->first_cr_sys = cr_sys;
+    }
+
+    if (current >= batch->max_size)
+        return true;
+    if (!batch->adaptive || cr_sys == UINT64_MAX ||
+        batch->first_cr_sys == UINT64_MAX || !batch->interval)
+        return false;
+    return cr_sys + batch->interval - batch->first_cr_sys > latency;
+}
+
+/** @This accounts for a processed batch.
+ *
+ * @param batch pointer to the batching state
+ * @param current number of packets in the batch
+ * @param now current date or UINT64_MAX
+ */
+static inline void upipe_dvbcsa_batch_done(struct upipe_dvbcsa_batch *batch,
+                                           unsigned current, uint64_t now)
+{
+    batch->batches++;
+    batch->packets += current;
+    if (now != UINT64_MAX && batch->first_date != UINT64_MAX &&
+        now > batch->first_date && now - batch->first_date > batch->max_latency)
+        batch->max_latency = now - batch->first_date;
+    batch->first_cr_sys = UINT64_MAX;
+    batch->first_date = UINT64_MAX;
+}
+
+/** @This returns the expected number of packets per batch.
+ *
+ * @param batch pointer to the batching state
+ * @param latency maximum added latency
+ * @return expected number of packets per batch
+ */
+static inline unsigned
+upipe_dvbcsa_batch_target(struct upipe_dvbcsa_batch *batch, uint64_t latency)
+{
+    if (!batch->adaptive || !batch->interval)
+        return batch->max_size;
+    /* packets received within the latency, including the first one */
+    uint64_t target = latency / batch->interval + 1;
+    return target < batch->max_size ? target : batch->max_size;
+}
+
+/** @This handles batching control commands.
+ *
+ * @param batch pointer to the batching state
+ * @param latency maximum added latency
+ * @param command control command to handle
+ * @param args optional arguments
+ * @return an error code
+ */
+static inline int
+upipe_dvbcsa_batch_control(struct upipe_dvbcsa_batch *batch, uint64_t latency,
+                           int command, va_list args)
+{
+    switch (command) {
+        case UPIPE_DVBCSA_SET_ADAPTIVE: {
+            UBASE_SIGNATURE_CHECK(args, UPIPE_DVBCSA_COMMON_SIGNATURE);
+            batch->adaptive = !!va_arg(args, int);
+            return UBASE_ERR_NONE;
+        }
+
+        case UPIPE_DVBCSA_GET_BATCH_STATS: {
+            UBASE_SIGNATURE_CHECK(args, UPIPE_DVBCSA_COMMON_SIGNATURE);
+            unsigned *target_p = va_arg(args, unsigned *);
+            unsigned *fill_p = va_arg(args, unsigned *);
+            uint64_t *latency_p = va_arg(args, uint64_t *);
+            if (target_p)
+                *target_p = upipe_dvbcsa_batch_target(batch, latency);
+            if (fill_p)
+                *fill_p = batch->batches && batch->max_size ?
+                    (batch->packets * 100) /
+                    (batch->batches * (uint64_t)batch->max_size) : 0;
+            if (latency_p)
+                *latency_p = batch->max_latency;
+            batch->batches = 0;
+            batch->packets = 0;
+            batch->max_latency = 0;
+            return UBASE_ERR_NONE;
+        }
+    }
+    return UBASE_ERR_UNHANDLED;
+}
+
 #endif
@@ -94,6 +94,8 @@ struct upipe_dvbcsa_bs_dec {
     struct uref **mapped;
     /** current batch item */
     unsigned current;
+    /** batching state */
+    struct upipe_dvbcsa_batch batching;
     /** common dvbcsa structure */
     struct upipe_dvbcsa_common common;
 };
@@ -184,6 +186,7 @@ static struct upipe *upipe_dvbcsa_bs_dec_alloc(struct upipe_mgr *mgr,
                                         sizeof (struct dvbcsa_bs_batch_s));
     upipe_dvbcsa_bs_dec->mapped = malloc(bs_size * sizeof (struct uref *));
     upipe_dvbcsa_bs_dec->current = 0;
+    upipe_dvbcsa_batch_init(&upipe_dvbcsa_bs_dec->batching, bs_size);
 
     upipe_throw_ready(upipe);
 
@@ -236,13 +239,16 @@ static void upipe_dvbcsa_bs_dec_flush(struct upipe *upipe,
         upipe_dvbcsa_bs_dec->current = 0;
         upipe_dvbcsa_bs_dec->batch[current].data = NULL;
         upipe_dvbcsa_bs_dec->batch[current].len = 0;
-        uint64_t before = uclock_now(upipe_dvbcsa_bs_dec->uclock);
+        struct uclock *uclock = upipe_dvbcsa_bs_dec->uclock;
+        uint64_t before = uclock ? uclock_now(uclock) : UINT64_MAX;
         dvbcsa_bs_decrypt(upipe_dvbcsa_bs_dec->key,
                           upipe_dvbcsa_bs_dec->batch, 184);
-        uint64_t after = uclock_now(upipe_dvbcsa_bs_dec->uclock);
-        if ((after - before) > DVBCSA_LATENCY)
+        uint64_t after = uclock ? uclock_now(uclock) : UINT64_MAX;
+        if (uclock && (after - before) > DVBCSA_LATENCY)
             upipe_warn_va(upipe, "dvbcsa latency too high %"PRIu64 "ms",
                           (after - before) / (UCLOCK_FREQ / 1000));
+        upipe_dvbcsa_batch_done(&upipe_dvbcsa_bs_dec->batching, current,
+                                after);
         for (unsigned i = 0; i < current; i++)
             uref_block_unmap(upipe_dvbcsa_bs_dec->mapped[i], 0);
     }
@@ -370,6 +376,11 @@ static void upipe_dvbcsa_bs_dec_input(struct upipe *upipe,
     upipe_dvbcsa_bs_dec->current++;
     ts_set_scrambling(ts, 0);
 
+    uint64_t cr_sys = UINT64_MAX;
+    uref_clock_get_cr_sys(uref, &cr_sys);
+    uint64_t now = upipe_dvbcsa_bs_dec->uclock ?
+        uclock_now(upipe_dvbcsa_bs_dec->uclock) : UINT64_MAX;
+
     /* hold uref */
     upipe_dvbcsa_bs_dec_hold_input(upipe, uref);
     if (unlikely(first)) {
@@ -380,7 +391,8 @@ static void upipe_dvbcsa_bs_dec_input(struct upipe *upipe,
     }
 
     /* descramble if we have enough buffered scrambled TS packets */
-    if (upipe_dvbcsa_bs_dec->current >= upipe_dvbcsa_bs_dec->batch_size)
+    if (upipe_dvbcsa_batch_add(&upipe_dvbcsa_bs_dec->batching, current + 1,
+                               cr_sys, now, common->latency))
         upipe_dvbcsa_bs_dec_flush(upipe, upump_p);
 }
 
@@ -431,6 +443,10 @@ static int upipe_dvbcsa_bs_dec_set_key(struct upipe *upipe, const char *key)
     struct upipe_dvbcsa_bs_dec *upipe_dvbcsa_bs_dec =
         upipe_dvbcsa_bs_dec_from_upipe(upipe);
 
+    /* the pending batch must be processed with the previous key */
+    if (!upipe_dvbcsa_bs_dec_check_input(upipe))
+        upipe_dvbcsa_bs_dec_flush(upipe, NULL);
+
     dvbcsa_bs_key_free(upipe_dvbcsa_bs_dec->key);
     upipe_dvbcsa_bs_dec->key = NULL;
 
@@ -484,6 +500,11 @@ static int upipe_dvbcsa_bs_dec_control_real(struct upipe *upipe,
         case UPIPE_DVBCSA_DEL_PID:
         case UPIPE_DVBCSA_SET_MAX_LATENCY:
             return upipe_dvbcsa_common_control(common, command, args);
+
+        case UPIPE_DVBCSA_SET_ADAPTIVE:
+        case UPIPE_DVBCSA_GET_BATCH_STATS:
+            return upipe_dvbcsa_batch_control(&upipe_dvbcsa_bs_dec->batching,
+                                              common->latency, command, args);
     }
     return UBASE_ERR_UNHANDLED;
 }
@@ -92,6 +92,8 @@ struct upipe_dvbcsa_bs_enc {
     unsigned current;
     /** mapped list */
     struct uref **mapped;
+    /** batching state */
+    struct upipe_dvbcsa_batch batching;
     /** common dvbcsa structure */
     struct upipe_dvbcsa_common common;
 };
@@ -180,6 +182,7 @@ static struct upipe *upipe_dvbcsa_bs_enc_alloc(struct upipe_mgr *mgr,
                                         sizeof (struct dvbcsa_bs_batch_s));
     upipe_dvbcsa_bs_enc->mapped = malloc(bs_size * sizeof (struct uref *));
     upipe_dvbcsa_bs_enc->current = 0;
+    upipe_dvbcsa_batch_init(&upipe_dvbcsa_bs_enc->batching, bs_size);
 
     upipe_throw_ready(upipe);
 
@@ -232,13 +235,16 @@ static void upipe_dvbcsa_bs_enc_flush(struct upipe *upipe,
         upipe_dvbcsa_bs_enc->batch[current].data = NULL;
         upipe_dvbcsa_bs_enc->batch[current].len = 0;
 
-        uint64_t before = uclock_now(upipe_dvbcsa_bs_enc->uclock);
+        struct uclock *uclock = upipe_dvbcsa_bs_enc->uclock;
+        uint64_t before = uclock ? uclock_now(uclock) : UINT64_MAX;
         dvbcsa_bs_encrypt(upipe_dvbcsa_bs_enc->key,
                           upipe_dvbcsa_bs_enc->batch, 184);
-        uint64_t after = uclock_now(upipe_dvbcsa_bs_enc->uclock);
-        if ((after - before) > DVBCSA_LATENCY)
+        uint64_t after = uclock ? uclock_now(uclock) : UINT64_MAX;
+        if (uclock && (after - before) > DVBCSA_LATENCY)
             upipe_warn_va(upipe, "dvbcsa latency too high %"PRIu64 "ms",
-                          (after - before) / 1000);
+                          (after - before) / (UCLOCK_FREQ / 1000));
+        upipe_dvbcsa_batch_done(&upipe_dvbcsa_bs_enc->batching, current,
+                                after);
         for (unsigned i = 0; i < current; i++)
             uref_block_unmap(upipe_dvbcsa_bs_enc->mapped[i], 0);
     }
@@ -363,13 +369,18 @@ static void upipe_dvbcsa_bs_enc_input(struct upipe *upipe,
         return;
     }
 
-    uint8_t current = upipe_dvbcsa_bs_enc->current;
+    unsigned current = upipe_dvbcsa_bs_enc->current;
     ts_set_scrambling(ts, 0x2);
     upipe_dvbcsa_bs_enc->batch[current].data = ts + ts_header_size;
     upipe_dvbcsa_bs_enc->batch[current].len = size - ts_header_size;
     upipe_dvbcsa_bs_enc->mapped[current] = uref;
     upipe_dvbcsa_bs_enc->current++;
 
+    uint64_t cr_sys = UINT64_MAX;
+    uref_clock_get_cr_sys(uref, &cr_sys);
+    uint64_t now = upipe_dvbcsa_bs_enc->uclock ?
+        uclock_now(upipe_dvbcsa_bs_enc->uclock) : UINT64_MAX;
+
     /* hold uref */
     upipe_dvbcsa_bs_enc_hold_input(upipe, uref);
     if (unlikely(first)) {
@@ -380,7 +391,8 @@ static void upipe_dvbcsa_bs_enc_input(struct upipe *upipe,
     }
 
     /* scramble if we have enough packets */
-    if (upipe_dvbcsa_bs_enc->current >= upipe_dvbcsa_bs_enc->batch_size)
+    if (upipe_dvbcsa_batch_add(&upipe_dvbcsa_bs_enc->batching, current + 1,
+                               cr_sys, now, common->latency))
         upipe_dvbcsa_bs_enc_flush(upipe, upump_p);
 }
 
@@ -432,6 +444,10 @@ static int upipe_dvbcsa_bs_enc_set_key(struct upipe *upipe,
     struct upipe_dvbcsa_bs_enc *upipe_dvbcsa_bs_enc =
         upipe_dvbcsa_bs_enc_from_upipe(upipe);
 
+    /* the pending batch must be processed with the previous key */
+    if (!upipe_dvbcsa_bs_enc_check_input(upipe))
+        upipe_dvbcsa_bs_enc_flush(upipe, NULL);
+
     dvbcsa_bs_key_free(upipe_dvbcsa_bs_enc->key);
     upipe_dvbcsa_bs_enc->key = NULL;
     if (!key)
@@ -485,6 +501,11 @@ static int upipe_dvbcsa_bs_enc_control_real(struct upipe *upipe,
         case UPIPE_DVBCSA_DEL_PID:
         case UPIPE_DVBCSA_SET_MAX_LATENCY:
             return upipe_dvbcsa_common_control(common, cmd, args);
+
+        case UPIPE_DVBCSA_SET_ADAPTIVE:
+        case UPIPE_DVBCSA_GET_BATCH_STATS:
+            return upipe_dvbcsa_batch_control(&upipe_dvbcsa_bs_enc->batching,
+                                              common->latency, cmd, args);
     }
     return UBASE_ERR_UNHANDLED;
 }
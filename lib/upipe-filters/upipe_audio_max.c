@@ -29,6 +29,7 @@
 #include <upipe/uref_flow.h>
 #include <upipe/uref_sound_flow.h>
 #include <upipe/uref_sound.h>
+#include <upipe/usound.h>
 #include <upipe/upipe.h>
 #include <upipe/upipe_helper_upipe.h>
 #include <upipe/upipe_helper_urefcount.h>
@@ -50,6 +51,8 @@ struct upipe_amax {
     struct urefcount urefcount;
 
     upipe_amax_process process;
+    /** sample processing kernels */
+    struct usound_dsp dsp;
 
     /** output */
     struct upipe *output;
@@ -89,6 +92,7 @@ static struct upipe *upipe_amax_alloc(struct upipe_mgr *mgr,
     upipe_amax_init_urefcount(upipe);
     upipe_amax_init_output(upipe);
     upipe_amax->process = NULL;
+    usound_dsp_init(&upipe_amax->dsp);
 
     upipe_throw_ready(upipe);
     return upipe;
@@ -123,12 +127,36 @@ static double upipe_amax_process_##type(struct upipe *upipe,                \
     return (max * 1.0f) / type_max;                                         \
 }
 UPIPE_AMAX_TEMPLATE(uint8_t, UINT8_MAX)
-UPIPE_AMAX_TEMPLATE(int16_t, INT16_MAX)
-UPIPE_AMAX_TEMPLATE(int32_t, INT32_MAX)
-UPIPE_AMAX_TEMPLATE(float, 1.)
 UPIPE_AMAX_TEMPLATE(double, 1.)
 #undef UPIPE_AMAX_TEMPLATE
 
+#define UPIPE_AMAX_TEMPLATE_DSP(type, kernel, type_max)                     \
+/** @internal @This processes input of format type with the peak kernel.    \
+ *                                                                          \
+ * @param upipe description structure of the pipe                           \
+ * @param uref uref structure                                               \
+ * @param channel channel name                                              \
+ * @param samples number of samples                                         \
+ */                                                                         \
+static double upipe_amax_process_##type(struct upipe *upipe,                \
+        struct uref *uref, const char *channel, size_t samples)             \
+{                                                                           \
+    struct upipe_amax *upipe_amax = upipe_amax_from_upipe(upipe);           \
+    const type *buf = NULL;                                                 \
+    if (unlikely(!ubase_check(uref_sound_plane_read_##type(uref,            \
+            channel, 0, -1, &buf)))) {                                      \
+        upipe_warn(upipe, "error mapping sound buffer");                    \
+        return 0.;                                                          \
+    }                                                                       \
+    double max = (upipe_amax->dsp.kernel(buf, samples) * 1.0f) / type_max;  \
+    uref_sound_plane_unmap(uref, channel, 0, -1);                           \
+    return max;                                                             \
+}
+UPIPE_AMAX_TEMPLATE_DSP(int16_t, peak_s16, INT16_MAX)
+UPIPE_AMAX_TEMPLATE_DSP(int32_t, peak_s32, INT32_MAX)
+UPIPE_AMAX_TEMPLATE_DSP(float, peak_flt, 1.)
+#undef UPIPE_AMAX_TEMPLATE_DSP
+
 /** @internal @This handles input.
  *
  * @param upipe description structure of the pipe
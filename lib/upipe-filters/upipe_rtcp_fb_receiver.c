@@ -66,6 +66,10 @@
 #include <bitstream/ietf/rtcp_fb.h>
 
 #define EXPECTED_FLOW_DEF "block."
+/** number of sequence numbers, and size of the history */
+#define RTCPFB_SEQNUMS (UINT16_MAX + 1)
+/** period of the timer evicting packets from the history */
+#define RTCPFB_EVICT_PERIOD (UCLOCK_FREQ / 10)
 
 /** upipe_rtcpfb structure */
 struct upipe_rtcpfb {
@@ -90,7 +94,13 @@ struct upipe_rtcpfb {
     struct upump *upump_timer;
     struct uclock *uclock;
     struct urequest uclock_request;
-    struct uchain queue;
+    /** history of the packets, indexed by sequence number */
+    struct uref *history[RTCPFB_SEQNUMS];
+    /** sequence number of the oldest packet in the history */
+    uint16_t first_seq;
+    /** number of packets in the history */
+    unsigned int nb_history;
+    /** sequence number of the newest packet in the history */
     unsigned last_seq;
 
     /** list of input subpipes */
@@ -119,6 +129,19 @@ struct upipe_rtcpfb {
     /** buffer latency */
     uint64_t latency;
 
+    /** maximum number of retransmitted packets per second and per peer, or
+     * 0 */
+    uint64_t rtx_rate;
+
+    /** number of packets requested by NACKs */
+    uint64_t nacked;
+    /** number of packets retransmitted */
+    uint64_t retransmitted;
+    /** number of requested packets not found in the history */
+    uint64_t missing;
+    /** number of requested packets dropped because of the rate limit */
+    uint64_t rate_limited;
+
     /** public upipe structure */
     struct upipe upipe;
 };
@@ -163,6 +186,11 @@ struct upipe_rtcpfb_input {
     unsigned int nb_urefs;
     unsigned int max_urefs;
     struct uchain blockers;
+
+    /** retransmission credit of the peer, in packets * UCLOCK_FREQ */
+    uint64_t rtx_credit;
+    /** date of the last credit update */
+    uint64_t rtx_date;
 };
 
 static void upipe_rtcpfb_lost_sub(struct upipe *upipe, uint16_t seq, uint16_t mask);
@@ -242,79 +270,149 @@ static int ctz(unsigned int x)
 #endif
 }
 
-/** @internal @This retransmits a list of packets described by a single FCI.
- * TODO: handle a list of FCIs.
+/** @internal @This checks the retransmission rate limit of a peer, and
+ * consumes one packet of credit.
+ *
+ * @param upipe description structure of the subpipe
+ * @param now current date
+ * @return false if the packet must not be retransmitted
  */
-static void upipe_rtcpfb_lost_sub(struct upipe *upipe, uint16_t seq, uint16_t mask)
+static bool upipe_rtcpfb_input_take_credit(struct upipe *upipe, uint64_t now)
 {
+    struct upipe_rtcpfb_input *upipe_rtcpfb_input =
+        upipe_rtcpfb_input_from_upipe(upipe);
     struct upipe *upipe_super = NULL;
     upipe_rtcpfb_input_get_super(upipe, &upipe_super);
     struct upipe_rtcpfb *upipe_rtcpfb = upipe_rtcpfb_from_upipe(upipe_super);
 
-    struct uchain *uchain;
-    ulist_foreach(&upipe_rtcpfb->queue, uchain) {
-        struct uref *uref = uref_from_uchain(uchain);
-        uint64_t uref_seqnum = 0;
-        uref_attr_get_priv(uref, &uref_seqnum);
+    uint64_t rate = upipe_rtcpfb->rtx_rate;
+    if (!rate)
+        return true;
+
+    /* token bucket allowing bursts of 1/10th of a second */
+    uint64_t burst = rate * UCLOCK_FREQ / 10;
+    if (burst < UCLOCK_FREQ)
+        burst = UCLOCK_FREQ;
+    if (upipe_rtcpfb_input->rtx_date == UINT64_MAX ||
+        now - upipe_rtcpfb_input->rtx_date >= UCLOCK_FREQ)
+        upipe_rtcpfb_input->rtx_credit = burst;
+    else {
+        upipe_rtcpfb_input->rtx_credit +=
+            (now - upipe_rtcpfb_input->rtx_date) * rate;
+        if (upipe_rtcpfb_input->rtx_credit > burst)
+            upipe_rtcpfb_input->rtx_credit = burst;
+    }
+    upipe_rtcpfb_input->rtx_date = now;
 
-        if (seq != uref_seqnum)
-            continue;
+    if (upipe_rtcpfb_input->rtx_credit < UCLOCK_FREQ)
+        return false;
+    upipe_rtcpfb_input->rtx_credit -= UCLOCK_FREQ;
+    return true;
+}
 
-        upipe_warn_va(upipe, "Retransmit %hu", seq);
-        size_t size;
-        UBASE_FATAL_RETURN(upipe, uref_block_size(uref, &size));
+/** @internal @This retransmits a packet from the history.
+ *
+ * @param upipe description structure of the subpipe
+ * @param seq sequence number of the packet
+ * @param now current date
+ */
+static void upipe_rtcpfb_retransmit(struct upipe *upipe, uint16_t seq,
+                                    uint64_t now)
+{
+    struct upipe *upipe_super = NULL;
+    upipe_rtcpfb_input_get_super(upipe, &upipe_super);
+    struct upipe_rtcpfb *upipe_rtcpfb = upipe_rtcpfb_from_upipe(upipe_super);
 
-        struct ubuf *retransmit = ubuf_block_alloc(upipe_rtcpfb->ubuf_mgr,
-                size + 2 /* OSN */);
+    upipe_rtcpfb->nacked++;
+    struct uref *uref = upipe_rtcpfb->history[seq];
+    if (uref == NULL) {
+        upipe_rtcpfb->missing++;
+        upipe_warn_va(upipe, "Couldn't find seq %hu", seq);
+        return;
+    }
 
-        if (!retransmit) {
-            upipe_throw_fatal(upipe, UBASE_ERR_ALLOC);
-            return;
-        }
+    if (!upipe_rtcpfb_input_take_credit(upipe, now)) {
+        upipe_rtcpfb->rate_limited++;
+        upipe_verbose_va(upipe, "Rate limiting retransmit of %hu", seq);
+        return;
+    }
+
+    upipe_verbose_va(upipe, "Retransmit %hu", seq);
+    size_t size;
+    UBASE_FATAL_RETURN(upipe, uref_block_size(uref, &size));
+
+    struct ubuf *retransmit = ubuf_block_alloc(upipe_rtcpfb->ubuf_mgr,
+            size + 2 /* OSN */);
+
+    if (!retransmit) {
+        upipe_throw_fatal(upipe, UBASE_ERR_ALLOC);
+        return;
+    }
 
-        int s = -1;
-        const uint8_t *buf;
-        uint8_t *buf_retransmit;
+    int s = -1;
+    const uint8_t *buf;
+    uint8_t *buf_retransmit;
 
-        ubuf_block_write(retransmit, 0, &s, &buf_retransmit);
-        uref_block_read(uref, 0, &s, &buf);
+    ubuf_block_write(retransmit, 0, &s, &buf_retransmit);
+    uref_block_read(uref, 0, &s, &buf);
 
-        uint32_t ts = rtp_get_timestamp(buf);
-        memcpy(buf_retransmit, buf, RTP_HEADER_SIZE);
+    uint32_t ts = rtp_get_timestamp(buf);
+    memcpy(buf_retransmit, buf, RTP_HEADER_SIZE);
 
-        uint8_t ssrc[4];
-        rtp_get_ssrc(buf, ssrc);
+    uint8_t ssrc[4];
+    rtp_get_ssrc(buf, ssrc);
 
-        rtp_set_type(buf_retransmit, upipe_rtcpfb->type);
-        rtp_set_seqnum(buf_retransmit,
-                upipe_rtcpfb->retransmit_seq++);
-        rtp_set_timestamp(buf_retransmit, ts);
-        ssrc[3]++; /* XXX */
-        rtp_set_ssrc(buf_retransmit, ssrc);
+    rtp_set_type(buf_retransmit, upipe_rtcpfb->type);
+    rtp_set_seqnum(buf_retransmit,
+            upipe_rtcpfb->retransmit_seq++);
+    rtp_set_timestamp(buf_retransmit, ts);
+    ssrc[3]++; /* XXX */
+    rtp_set_ssrc(buf_retransmit, ssrc);
 
-        uint16_t osn = rtp_get_seqnum(buf);
+    uint16_t osn = rtp_get_seqnum(buf);
 
-        buf_retransmit[RTP_HEADER_SIZE] = osn >> 8;
-        buf_retransmit[RTP_HEADER_SIZE + 1] = osn & 0xff;
+    buf_retransmit[RTP_HEADER_SIZE] = osn >> 8;
+    buf_retransmit[RTP_HEADER_SIZE + 1] = osn & 0xff;
 
-        memcpy(&buf_retransmit[RTP_HEADER_SIZE+2],
-                &buf[RTP_HEADER_SIZE], s - RTP_HEADER_SIZE);
+    memcpy(&buf_retransmit[RTP_HEADER_SIZE+2],
+            &buf[RTP_HEADER_SIZE], s - RTP_HEADER_SIZE);
 
-        ubuf_block_unmap(retransmit, 0);
-        uref_block_unmap(uref, 0);
+    ubuf_block_unmap(retransmit, 0);
+    uref_block_unmap(uref, 0);
 
-        upipe_rtcpfb_output(upipe_super,
-                uref_fork(uref, retransmit), NULL);
+    struct uref *rtx = uref_fork(uref, retransmit);
+    if (unlikely(rtx == NULL)) {
+        ubuf_free(retransmit);
+        upipe_throw_fatal(upipe, UBASE_ERR_ALLOC);
+        return;
+    }
+    upipe_rtcpfb->retransmitted++;
+    upipe_rtcpfb_output(upipe_super, rtx, NULL);
+}
 
-        if (!mask)
-            return;
+/** @internal @This retransmits a list of packets described by a single FCI.
+ *
+ * @param upipe description structure of the subpipe
+ * @param seq first lost sequence number (PID)
+ * @param mask bitmask of the following lost packets (BLP)
+ */
+static void upipe_rtcpfb_lost_sub(struct upipe *upipe, uint16_t seq, uint16_t mask)
+{
+    struct upipe *upipe_super = NULL;
+    upipe_rtcpfb_input_get_super(upipe, &upipe_super);
+    struct upipe_rtcpfb *upipe_rtcpfb = upipe_rtcpfb_from_upipe(upipe_super);
+    if (unlikely(upipe_rtcpfb->ubuf_mgr == NULL || upipe_rtcpfb->uclock == NULL))
+        return;
 
+    uint64_t now = uclock_now(upipe_rtcpfb->uclock);
+    upipe_rtcpfb_retransmit(upipe, seq, now);
+
+    while (mask) {
         int zeros = ctz(mask);
         mask >>= zeros + 1;
         seq += zeros + 1;
+        upipe_rtcpfb_retransmit(upipe, seq, now);
     }
-
-    upipe_warn_va(upipe, "Couldn't find seq %hu", seq);
 }
 
 /** @This is called when there is no external reference to the pipe anymore.
@@ -356,6 +454,8 @@ static struct upipe *upipe_rtcpfb_input_alloc(struct upipe_mgr *mgr,
     upipe_rtcpfb_input_init_urefcount(upipe);
     upipe_rtcpfb_input_init_input(upipe);
     upipe_rtcpfb_input_init_sub(upipe);
+    upipe_rtcpfb_input->rtx_credit = 0;
+    upipe_rtcpfb_input->rtx_date = UINT64_MAX;
 
     upipe_throw_ready(upipe);
     return upipe;
@@ -469,8 +569,21 @@ static void upipe_rtcpfb_init_sub_mgr(struct upipe *upipe)
 
 static void upipe_rtcpfb_free(struct urefcount *urefcount_real);
 
-/** @internal this timer removes from the queue packets that are too
- * early to be recovered by receiver.
+/** @internal @This removes the oldest packet from the history.
+ *
+ * @param upipe description structure of the pipe
+ */
+static void upipe_rtcpfb_evict(struct upipe *upipe)
+{
+    struct upipe_rtcpfb *upipe_rtcpfb = upipe_rtcpfb_from_upipe(upipe);
+    uint16_t seq = upipe_rtcpfb->first_seq++;
+    uref_free(upipe_rtcpfb->history[seq]);
+    upipe_rtcpfb->history[seq] = NULL;
+    upipe_rtcpfb->nb_history--;
+}
+
+/** @internal this timer removes from the history packets that are too
+ * old to be recovered by receiver.
  */
 static void upipe_rtcpfb_timer(struct upump *upump)
 {
@@ -478,29 +591,28 @@ static void upipe_rtcpfb_timer(struct upump *upump)
     struct upipe_rtcpfb *upipe_rtcpfb = upipe_rtcpfb_from_upipe(upipe);
 
     uint64_t now = uclock_now(upipe_rtcpfb->uclock);
-
-    struct uchain *uchain, *uchain_tmp;
-    ulist_delete_foreach(&upipe_rtcpfb->queue, uchain, uchain_tmp) {
-        struct uref *uref = uref_from_uchain(uchain);
-
-        uint64_t seqnum = 0;
-        uref_attr_get_priv(uref, &seqnum);
-
-        uint64_t cr_sys = 0;
-        if (unlikely(!ubase_check(uref_clock_get_cr_sys(uref, &cr_sys))))
-            upipe_warn(upipe, "Couldn't read cr_sys");
-
-        if (now - cr_sys < upipe_rtcpfb->latency * UCLOCK_FREQ / 1000)
-            return;
-
-        upipe_verbose_va(upipe, "Delete seq %" PRIu64 " after %"PRIu64" clocks",
-                seqnum, now - cr_sys);
-
-        ulist_delete(uchain);
-        uref_free(uref);
+    uint64_t latency = upipe_rtcpfb->latency * UCLOCK_FREQ / 1000;
+    unsigned int evicted = 0;
+
+    /* packets are in input order, stop at the first recent one */
+    while (upipe_rtcpfb->nb_history) {
+        struct uref *uref = upipe_rtcpfb->history[upipe_rtcpfb->first_seq];
+        if (uref != NULL) {
+            uint64_t cr_sys = 0;
+            if (unlikely(!ubase_check(uref_clock_get_cr_sys(uref, &cr_sys))))
+                upipe_warn(upipe, "Couldn't read cr_sys");
+
+            if (now - cr_sys < latency)
+                break;
+            evicted++;
+        }
+        upipe_rtcpfb_evict(upipe);
     }
-}
 
+    if (evicted)
+        upipe_verbose_va(upipe, "Deleted %u packets, %u remaining",
+                         evicted, upipe_rtcpfb->nb_history);
+}
 
 /** @internal @This allocates a rtcpfb pipe.
  *
@@ -524,7 +636,9 @@ static struct upipe *upipe_rtcpfb_alloc(struct upipe_mgr *mgr,
     upipe_rtcpfb_init_upump_mgr(upipe);
     upipe_rtcpfb_check_upump_mgr(upipe);
     upipe_rtcpfb_init_uclock(upipe);
-    ulist_init(&upipe_rtcpfb->queue);
+    memset(upipe_rtcpfb->history, 0, sizeof(upipe_rtcpfb->history));
+    upipe_rtcpfb->first_seq = 0;
+    upipe_rtcpfb->nb_history = 0;
     upipe_rtcpfb_init_output(upipe);
     upipe_rtcpfb_init_sub_mgr(upipe);
     upipe_rtcpfb_init_sub_outputs(upipe);
@@ -537,11 +651,16 @@ static struct upipe *upipe_rtcpfb_alloc(struct upipe_mgr *mgr,
     upipe_rtcpfb->latency = 1000; /* 1 sec */
     upipe_rtcpfb->retransmit_seq = 0;
     upipe_rtcpfb->type = 1; /* reserved */
+    upipe_rtcpfb->rtx_rate = 0;
+    upipe_rtcpfb->nacked = 0;
+    upipe_rtcpfb->retransmitted = 0;
+    upipe_rtcpfb->missing = 0;
+    upipe_rtcpfb->rate_limited = 0;
 
     /* This timer does not need to run frequently */
     upipe_rtcpfb->upump_timer = upump_alloc_timer(upipe_rtcpfb->upump_mgr,
             upipe_rtcpfb_timer, upipe, upipe->refcount,
-            UCLOCK_FREQ, UCLOCK_FREQ);
+            RTCPFB_EVICT_PERIOD, RTCPFB_EVICT_PERIOD);
     upump_start(upipe_rtcpfb->upump_timer);
 
     upipe_throw_ready(upipe);
@@ -582,9 +701,43 @@ static inline void upipe_rtcpfb_input(struct upipe *upipe, struct uref *uref,
     upipe_verbose_va(upipe, "Output & buffer %hu", seqnum);
 
     /* Buffer packet in case retransmission is needed */
-    ulist_add(&upipe_rtcpfb->queue, uref_to_uchain(uref));
+    if (!upipe_rtcpfb->nb_history) {
+        upipe_rtcpfb->first_seq = seqnum;
+        upipe_rtcpfb->last_seq = (uint16_t)(seqnum - 1);
+    }
 
-    upipe_rtcpfb->last_seq = seqnum;
+    uint16_t offset = seqnum - upipe_rtcpfb->first_seq;
+    uint16_t diff = seqnum - upipe_rtcpfb->last_seq;
+    if (diff && diff < 0x8000) {
+        if (offset < upipe_rtcpfb->nb_history) {
+            /* the history is full, or the jump wraps into the window: the
+             * packets up to this one belong to an older cycle of sequence
+             * numbers */
+            if (diff > 1)
+                upipe_warn_va(upipe, "seqnum jump %u -> %hu, resetting window",
+                              upipe_rtcpfb->last_seq, seqnum);
+            while (upipe_rtcpfb->nb_history &&
+                   upipe_rtcpfb->first_seq != (uint16_t)(seqnum + 1))
+                upipe_rtcpfb_evict(upipe);
+            if (!upipe_rtcpfb->nb_history)
+                upipe_rtcpfb->first_seq = seqnum;
+            offset = seqnum - upipe_rtcpfb->first_seq;
+        }
+        /* leave holes for the skipped sequence numbers */
+        upipe_rtcpfb->nb_history = offset + 1;
+        upipe_rtcpfb->last_seq = seqnum;
+    } else if (offset < upipe_rtcpfb->nb_history) {
+        if (upipe_rtcpfb->history[seqnum] != NULL)
+            upipe_warn_va(upipe, "seqnum %hu out of order, replacing",
+                          seqnum);
+        uref_free(upipe_rtcpfb->history[seqnum]);
+    } else {
+        upipe_warn_va(upipe, "seqnum %hu older than the window, dropping",
+                      seqnum);
+        uref_free(uref);
+        return;
+    }
+    upipe_rtcpfb->history[seqnum] = uref;
 }
 
 /** @internal @This sets the input flow definition.
@@ -672,6 +825,39 @@ static int _upipe_rtcpfb_control(struct upipe *upipe, int command, va_list args)
             uint8_t pt = va_arg(args, unsigned);
             return _upipe_rtcpfb_set_pt(upipe, pt);
         }
+        case UPIPE_RTCPFB_SET_RTX_RATE: {
+            UBASE_SIGNATURE_CHECK(args, UPIPE_RTCPFB_SIGNATURE);
+            struct upipe_rtcpfb *upipe_rtcpfb = upipe_rtcpfb_from_upipe(upipe);
+            upipe_rtcpfb->rtx_rate = va_arg(args, uint64_t);
+            return UBASE_ERR_NONE;
+        }
+        case UPIPE_RTCPFB_GET_RTX_RATE: {
+            UBASE_SIGNATURE_CHECK(args, UPIPE_RTCPFB_SIGNATURE);
+            struct upipe_rtcpfb *upipe_rtcpfb = upipe_rtcpfb_from_upipe(upipe);
+            uint64_t *rate_p = va_arg(args, uint64_t *);
+            *rate_p = upipe_rtcpfb->rtx_rate;
+            return UBASE_ERR_NONE;
+        }
+        case UPIPE_RTCPFB_GET_STATS: {
+            UBASE_SIGNATURE_CHECK(args, UPIPE_RTCPFB_SIGNATURE);
+            struct upipe_rtcpfb *upipe_rtcpfb = upipe_rtcpfb_from_upipe(upipe);
+            uint64_t *nacked_p = va_arg(args, uint64_t *);
+            uint64_t *retransmitted_p = va_arg(args, uint64_t *);
+            uint64_t *missing_p = va_arg(args, uint64_t *);
+            uint64_t *rate_limited_p = va_arg(args, uint64_t *);
+            unsigned int *history_p = va_arg(args, unsigned int *);
+            if (nacked_p != NULL)
+                *nacked_p = upipe_rtcpfb->nacked;
+            if (retransmitted_p != NULL)
+                *retransmitted_p = upipe_rtcpfb->retransmitted;
+            if (missing_p != NULL)
+                *missing_p = upipe_rtcpfb->missing;
+            if (rate_limited_p != NULL)
+                *rate_limited_p = upipe_rtcpfb->rate_limited;
+            if (history_p != NULL)
+                *history_p = upipe_rtcpfb->nb_history;
+            return UBASE_ERR_NONE;
+        }
 
         default:
             return UBASE_ERR_UNHANDLED;
@@ -705,12 +891,8 @@ static void upipe_rtcpfb_free(struct urefcount *urefcount_real)
     upipe_rtcpfb_clean_upump_mgr(upipe);
     upipe_rtcpfb_clean_uclock(upipe);
 
-    struct uchain *uchain, *uchain_tmp;
-    ulist_delete_foreach(&upipe_rtcpfb->queue, uchain, uchain_tmp) {
-        struct uref *uref = uref_from_uchain(uchain);
-        ulist_delete(uchain);
-        uref_free(uref);
-    }
+    while (upipe_rtcpfb->nb_history)
+        upipe_rtcpfb_evict(upipe);
 
     upipe_rtcpfb_free_void(upipe);
 }
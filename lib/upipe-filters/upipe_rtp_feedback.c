@@ -69,6 +69,13 @@
 #include <bitstream/ietf/rtcp3611.h>
 
 #define EXPECTED_FLOW_DEF "block."
+/** number of sequence numbers */
+#define RTPFB_SEQNUMS (UINT16_MAX + 1)
+/** maximum number of sequence numbers between the oldest buffered packet
+ * and the newest one */
+#define RTPFB_WINDOW_MAX 0x8000
+/** maximum number of FCIs in a NACK packet, so that it fits in a datagram */
+#define RTPFB_NACK_MAX_FCI 64
 
 /** upipe_rtpfb structure */
 struct upipe_rtpfb {
@@ -96,9 +103,17 @@ struct upipe_rtpfb {
     struct upump *upump_timer_lost;
     struct uclock *uclock;
     struct urequest uclock_request;
-    struct uchain queue;
     struct uprobe *uprobe;
 
+    /** buffered packets, indexed by sequence number */
+    struct uref *packets[RTPFB_SEQNUMS];
+    /** bitmap of the packets missing from the buffer, indexed by sequence
+     * number */
+    uint64_t missing[RTPFB_SEQNUMS / 64];
+    /** sequence number of the next packet to output, if expected_seqnum is
+     * valid */
+    uint16_t first_seqnum;
+
     /** expected sequence number */
     unsigned expected_seqnum;
 
@@ -111,6 +126,12 @@ struct upipe_rtpfb {
     size_t repaired;
     size_t loss;
     size_t dups;
+    /** number of retransmissions requested */
+    uint64_t requested;
+    /** number of missing packets received */
+    uint64_t recovered;
+    /** number of packets received after their output date */
+    uint64_t late;
 
     /** retransmit payload type */
     uint8_t rtx_pt;
@@ -143,7 +164,7 @@ struct upipe_rtpfb {
     uint64_t xr_cr;
 
     /** last time a NACK was sent */
-    uint64_t last_nack[65536];
+    uint64_t last_nack[RTPFB_SEQNUMS];
 
     uint64_t rtt;
 
@@ -272,19 +293,69 @@ static void upipe_rtpfb_output_free(struct upipe *upipe)
     free(upipe_rtpfb_output);
 }
 
-/** @internal @This sends a retransmission request for a number of seqnums.
+/** @internal @This returns true if a sequence number is in the buffer
+ * window, that is between the next packet to output and the expected
+ * sequence number.
  *
  * @param upipe description structure of the pipe
- * @param lost_seqnum First sequence number missing
- * @param seqnum First sequence number NOT missing
+ * @param seqnum sequence number
+ * @return true if the sequence number is in the window
+ */
+static inline bool upipe_rtpfb_in_window(struct upipe *upipe, uint16_t seqnum)
+{
+    struct upipe_rtpfb *upipe_rtpfb = upipe_rtpfb_from_upipe(upipe);
+    if (upipe_rtpfb->expected_seqnum == UINT_MAX)
+        return false;
+    uint16_t window = upipe_rtpfb->expected_seqnum - upipe_rtpfb->first_seqnum;
+    return (uint16_t)(seqnum - upipe_rtpfb->first_seqnum) < window;
+}
+
+/** @internal @This marks a packet as missing or not.
+ *
+ * @param upipe description structure of the pipe
+ * @param seqnum sequence number
+ * @param missing true if the packet is missing
+ */
+static inline void upipe_rtpfb_set_missing(struct upipe *upipe,
+                                           uint16_t seqnum, bool missing)
+{
+    struct upipe_rtpfb *upipe_rtpfb = upipe_rtpfb_from_upipe(upipe);
+    uint64_t bit = UINT64_C(1) << (seqnum % 64);
+    if (missing)
+        upipe_rtpfb->missing[seqnum / 64] |= bit;
+    else
+        upipe_rtpfb->missing[seqnum / 64] &= ~bit;
+}
+
+/** @internal @This returns true if a packet is marked as missing.
+ *
+ * @param upipe description structure of the pipe
+ * @param seqnum sequence number
+ * @return true if the packet is missing
+ */
+static inline bool upipe_rtpfb_is_missing(struct upipe *upipe,
+                                          uint16_t seqnum)
+{
+    struct upipe_rtpfb *upipe_rtpfb = upipe_rtpfb_from_upipe(upipe);
+    return (upipe_rtpfb->missing[seqnum / 64] >> (seqnum % 64)) & 1;
+}
+
+/** @internal @This sends a retransmission request for a list of seqnums, as
+ * a generic NACK with one FCI per list of up to 17 seqnums.
+ *
+ * @param upipe description structure of the pipe
+ * @param pids first missing sequence number of each FCI
+ * @param blps bitmask of the following missing packets of each FCI
+ * @param nb_fci number of FCIs
  * @param ssrc TODO
  */
-static void upipe_rtpfb_lost(struct upipe *upipe, uint16_t lost_seqnum, uint16_t seqnum, uint8_t *ssrc)
+static void upipe_rtpfb_lost(struct upipe *upipe, const uint16_t *pids,
+                             const uint16_t *blps, unsigned nb_fci,
+                             const uint8_t *ssrc)
 {
     struct upipe_rtpfb *upipe_rtpfb = upipe_rtpfb_from_upipe(upipe);
 
-    /* Send a single NACK packet, with a single FCI */
-    int s = RTCP_FB_HEADER_SIZE + 1 * RTCP_FB_FCI_GENERIC_NACK_SIZE;
+    int s = RTCP_FB_HEADER_SIZE + nb_fci * RTCP_FB_FCI_GENERIC_NACK_SIZE;
 
     /* Allocate NACK packet */
     struct uref *pkt = uref_block_alloc(upipe_rtpfb->uref_mgr,
@@ -308,25 +379,16 @@ static void upipe_rtpfb_lost(struct upipe *upipe, uint16_t lost_seqnum, uint16_t
     rtcp_fb_set_ssrc_pkt_sender(buf, ssrc_sender);
     rtcp_fb_set_ssrc_media_src(buf, ssrc);
 
-    uint8_t *fci = &buf[RTCP_FB_HEADER_SIZE];
-    rtcp_fb_nack_set_packet_id(fci, lost_seqnum);
-
-    uint16_t pkts = seqnum - 1 - lost_seqnum;
-    // TODO : add several FCI if more than 17 packets are missing
-    if (pkts > 16)
-        pkts = 16;
-
-    uint16_t bits = 0;
-    for (size_t i = 0; i < pkts; i++)
-        bits |= 1 << i;
-
-    rtcp_fb_nack_set_bitmask_lost(fci, bits);
-    upipe_rtpfb->nacks += pkts + 1;
+    for (unsigned i = 0; i < nb_fci; i++) {
+        uint8_t *fci = &buf[RTCP_FB_HEADER_SIZE +
+                            i * RTCP_FB_FCI_GENERIC_NACK_SIZE];
+        rtcp_fb_nack_set_packet_id(fci, pids[i]);
+        rtcp_fb_nack_set_bitmask_lost(fci, blps[i]);
+        upipe_verbose_va(upipe, "NACKing %hu (+0x%hx)", pids[i], blps[i]);
+    }
 
     rtcp_set_length(buf, s / 4 - 1);
 
-    upipe_verbose_va(upipe, "NACKing %hu (+0x%hx)", lost_seqnum, bits);
-
     uref_block_unmap(pkt, 0);
 
     // XXX : date NACK packet?
@@ -342,10 +404,8 @@ static void upipe_rtpfb_timer_lost(struct upump *upump)
     struct upipe *upipe = upump_get_opaque(upump, struct upipe *);
     struct upipe_rtpfb *upipe_rtpfb = upipe_rtpfb_from_upipe(upipe);
 
-    uint64_t expected_seq = UINT64_MAX;
-
     /* Wait to know RTT before asking for retransmits */
-    if (upipe_rtpfb->rtt == 0)
+    if (upipe_rtpfb->rtt == 0 || upipe_rtpfb->expected_seqnum == UINT_MAX)
         return;
 
     uint64_t now = uclock_now(upipe_rtpfb->uclock);
@@ -358,62 +418,135 @@ static void upipe_rtpfb_timer_lost(struct upump *upump)
      * XXX: use cr_sys, because pkts/s also accounts for
      * the retransmitted packets */
 
-    struct uchain *uchain;
-    int holes = 0;
-    ulist_foreach(&upipe_rtpfb->queue, uchain) {
-        struct uref *uref = uref_from_uchain(uchain);
-        uint64_t seqnum = 0;
-        uref_attr_get_priv(uref, &seqnum);
-
-        if (likely(expected_seq != UINT64_MAX) && seqnum != expected_seq) {
-            /* hole found */
-            uint8_t ssrc[4] = {0,}; // TODO
-            upipe_dbg_va(upipe, "Found hole from %"PRIu64" (incl) to %"PRIu64" (excl)",
-                expected_seq, seqnum);
-
-            for (uint16_t seq = expected_seq; seq != seqnum; seq++) {
-                /* if packet was lost, we should have detected it already */
-                if (upipe_rtpfb->last_nack[seq] == 0) {
-                    upipe_err_va(upipe, "packet %hu missing but was not marked as lost!", seq);
-                    continue;
-                }
-
-                /* if we sent a NACK not too long ago, do not repeat it */
-                /* since NACKs are sent in a batch, break loop if the first packet is too early */
-                if (upipe_rtpfb->last_nack[seq] > next_nack) {
-                    if (0) upipe_err_va(upipe, "Cancelling NACK due to RTT (seq %hu diff %"PRId64"",
-                        seq, next_nack - upipe_rtpfb->last_nack[seq]
-                    );
-                    goto next;
-                }
-            }
-
-            /* update NACK request time */
-            for (uint16_t seq = expected_seq; seq != seqnum; seq++) {
-                upipe_rtpfb->last_nack[seq] = now;
+    uint8_t ssrc[4] = {0,}; // TODO
+    uint16_t pids[RTPFB_NACK_MAX_FCI];
+    uint16_t blps[RTPFB_NACK_MAX_FCI];
+    unsigned nb_fci = 0;
+    unsigned requested = 0;
+    uint16_t first = upipe_rtpfb->first_seqnum;
+    unsigned window = (uint16_t)(upipe_rtpfb->expected_seqnum - first);
+
+    /* walk the bitmap of missing packets, 64 seqnums at a time */
+    for (unsigned i = 0; i < window; ) {
+        uint16_t seq = first + i;
+        uint64_t word = upipe_rtpfb->missing[seq / 64] >> (seq % 64);
+        if (!word) {
+            i += 64 - seq % 64;
+            continue;
+        }
+        i += __builtin_ctzll(word);
+        if (i >= window)
+            break;
+        seq = first + i++;
+
+        /* if we sent a NACK not too long ago, do not repeat it */
+        if (upipe_rtpfb->last_nack[seq] > next_nack)
+            continue;
+        upipe_rtpfb->last_nack[seq] = now;
+        requested++;
+
+        if (nb_fci) {
+            uint16_t offset = seq - pids[nb_fci - 1] - 1;
+            if (offset < 16) {
+                blps[nb_fci - 1] |= 1 << offset;
+                continue;
             }
+        }
 
-            /* TODO:
-                - check the following packets to fill in bitmask
-                - send request in a single batch (multiple FCI)
-             */
+        if (nb_fci == RTPFB_NACK_MAX_FCI) {
             if (upipe_rtpfb->rtpfb_output)
-                upipe_rtpfb_lost(upipe, expected_seq, seqnum, ssrc);
-            holes++;
+                upipe_rtpfb_lost(upipe, pids, blps, nb_fci, ssrc);
+            nb_fci = 0;
         }
+        pids[nb_fci] = seq;
+        blps[nb_fci] = 0;
+        nb_fci++;
+    }
+
+    if (nb_fci && upipe_rtpfb->rtpfb_output)
+        upipe_rtpfb_lost(upipe, pids, blps, nb_fci, ssrc);
+
+    if (requested) {
+        upipe_dbg_va(upipe, "requested %u packets", requested);
+        upipe_rtpfb->nacks += requested;
+        upipe_rtpfb->requested += requested;
+    }
+}
+
+/** @internal @This re-arms the timer checking for missing seqnums after the
+ * RTT changed. The existing timer is reused if the pump manager supports it.
+ *
+ * @param upipe description structure of the pipe
+ */
+static void upipe_rtpfb_rearm_timer_lost(struct upipe *upipe)
+{
+    struct upipe_rtpfb *upipe_rtpfb = upipe_rtpfb_from_upipe(upipe);
+    uint64_t interval = upipe_rtpfb->rtt / 10;
+
+    if (upipe_rtpfb->upump_timer_lost) {
+        if (ubase_check(upump_rearm(upipe_rtpfb->upump_timer_lost,
+                                    0, interval)))
+            return;
+        upump_stop(upipe_rtpfb->upump_timer_lost);
+        upump_free(upipe_rtpfb->upump_timer_lost);
+        upipe_rtpfb->upump_timer_lost = NULL;
+    }
+    if (upipe_rtpfb->upump_mgr) {
+        upipe_rtpfb->upump_timer_lost = upump_alloc_timer(upipe_rtpfb->upump_mgr,
+                upipe_rtpfb_timer_lost, upipe, upipe->refcount,
+                0, interval);
+        upump_start(upipe_rtpfb->upump_timer_lost);
+    }
+}
+
+/** @internal @This returns the sequence number of the next buffered
+ * packet, skipping the missing packets.
+ *
+ * @param upipe description structure of the pipe
+ * @return sequence number of the next buffered packet
+ */
+static uint16_t upipe_rtpfb_next_seqnum(struct upipe *upipe)
+{
+    struct upipe_rtpfb *upipe_rtpfb = upipe_rtpfb_from_upipe(upipe);
+    uint16_t seqnum = upipe_rtpfb->first_seqnum;
+    while (upipe_rtpfb->packets[seqnum] == NULL)
+        seqnum++;
+    return seqnum;
+}
+
+/** @internal @This outputs the next buffered packet, giving up on the
+ * missing packets before it.
+ *
+ * @param upipe description structure of the pipe
+ * @param seqnum sequence number of the next buffered packet
+ */
+static void upipe_rtpfb_output_seqnum(struct upipe *upipe, uint16_t seqnum)
+{
+    struct upipe_rtpfb *upipe_rtpfb = upipe_rtpfb_from_upipe(upipe);
+    struct uref *uref = upipe_rtpfb->packets[seqnum];
 
-next:
-        expected_seq = (seqnum + 1) & UINT16_MAX;
+    for (uint16_t seq = upipe_rtpfb->first_seqnum; seq != seqnum; seq++)
+        upipe_rtpfb_set_missing(upipe, seq, false);
+
+    if (likely(upipe_rtpfb->last_output_seqnum != UINT_MAX)) {
+        uint16_t diff = seqnum - upipe_rtpfb->last_output_seqnum - 1;
+        if (diff) {
+            upipe_rtpfb->loss += diff;
+            upipe_dbg_va(upipe, "PKT LOSS: %u -> %hu DIFF %hu",
+                    upipe_rtpfb->last_output_seqnum, seqnum, diff);
+        }
     }
 
-    if (holes) { /* debug stats */
-        uint64_t now = uclock_now(upipe_rtpfb->uclock);
-        static uint64_t old;
-        if (likely(old != 0))
-            upipe_dbg_va(upipe, "%d holes after %"PRIu64" ms",
-                    holes, 1000 * (now - old) / UCLOCK_FREQ);
-        old = now;
+    upipe_rtpfb->last_output_seqnum = seqnum;
+    upipe_rtpfb->packets[seqnum] = NULL;
+    upipe_rtpfb->first_seqnum = seqnum + 1;
+
+    if (--upipe_rtpfb->buffered == 0) {
+        upipe_warn_va(upipe, "Exhausted buffer");
+        upipe_rtpfb->expected_seqnum = UINT_MAX;
     }
+
+    upipe_rtpfb_output(upipe, uref, NULL); // XXX: use timer upump ?
 }
 
 /** @internal @This periodic timer remove seqnums from the buffer.
@@ -425,13 +558,9 @@ static void upipe_rtpfb_timer(struct upump *upump)
 
     uint64_t now = uclock_now(upipe_rtpfb->uclock);
 
-    struct uchain *uchain, *uchain_tmp;
-    ulist_delete_foreach(&upipe_rtpfb->queue, uchain, uchain_tmp) {
-        struct uref *uref = uref_from_uchain(uchain);
-        uint64_t seqnum = 0;
-        if (!ubase_check(uref_attr_get_priv(uref, &seqnum))) {
-            upipe_err_va(upipe, "Could not read seqnum from uref");
-        }
+    while (upipe_rtpfb->buffered) {
+        uint16_t seqnum = upipe_rtpfb_next_seqnum(upipe);
+        struct uref *uref = upipe_rtpfb->packets[seqnum];
 
         uint64_t cr_sys = 0;
         if (unlikely(!ubase_check(uref_clock_get_cr_sys(uref, &cr_sys))))
@@ -440,24 +569,8 @@ static void upipe_rtpfb_timer(struct upump *upump)
         if (now - cr_sys <= upipe_rtpfb->latency)
             break;
 
-        upipe_verbose_va(upipe, "Output seq %"PRIu64" after %"PRIu64" clocks", seqnum, now - cr_sys);
-        if (likely(upipe_rtpfb->last_output_seqnum != UINT_MAX)) {
-            uint16_t diff = seqnum - upipe_rtpfb->last_output_seqnum - 1;
-            if (diff) {
-                upipe_rtpfb->loss += diff;
-                upipe_dbg_va(upipe, "PKT LOSS: %u -> %"PRIu64" DIFF %hu",
-                        upipe_rtpfb->last_output_seqnum, seqnum, diff);
-            }
-        }
-
-        upipe_rtpfb->last_output_seqnum = seqnum;
-
-        ulist_delete(uchain);
-        upipe_rtpfb_output(upipe, uref, NULL); // XXX: use timer upump ?
-        if (--upipe_rtpfb->buffered == 0) {
-            upipe_warn_va(upipe, "Exhausted buffer");
-            upipe_rtpfb->expected_seqnum = UINT_MAX;
-        }
+        upipe_verbose_va(upipe, "Output seq %hu after %"PRIu64" clocks", seqnum, now - cr_sys);
+        upipe_rtpfb_output_seqnum(upipe, seqnum);
     }
 }
 
@@ -684,7 +797,9 @@ static struct upipe *upipe_rtpfb_alloc(struct upipe_mgr *mgr,
     upipe_rtpfb_init_uref_mgr(upipe);
     upipe_rtpfb_init_upump_mgr(upipe);
     upipe_rtpfb_init_uclock(upipe);
-    ulist_init(&upipe_rtpfb->queue);
+    memset(upipe_rtpfb->packets, 0, sizeof(upipe_rtpfb->packets));
+    memset(upipe_rtpfb->missing, 0, sizeof(upipe_rtpfb->missing));
+    upipe_rtpfb->first_seqnum = 0;
     memset(upipe_rtpfb->last_nack, 0, sizeof(upipe_rtpfb->last_nack));
     upipe_rtpfb->rtt = 0;
     upipe_rtpfb_require_uclock(upipe);
@@ -696,6 +811,9 @@ static struct upipe *upipe_rtpfb_alloc(struct upipe_mgr *mgr,
     upipe_rtpfb->repaired = 0;
     upipe_rtpfb->loss = 0;
     upipe_rtpfb->dups = 0;
+    upipe_rtpfb->requested = 0;
+    upipe_rtpfb->recovered = 0;
+    upipe_rtpfb->late = 0;
     upipe_rtpfb->type = UINT16_MAX;
     upipe_rtpfb->rtx_pt = 1; /* Reserved */
     upipe_rtpfb->sr_cr = UINT64_MAX;
@@ -709,44 +827,40 @@ static struct upipe *upipe_rtpfb_alloc(struct upipe_mgr *mgr,
     return upipe;
 }
 
-/* returns true if uref was inserted in the queue */
-static bool upipe_rtpfb_insert_inner(struct upipe *upipe, struct uref *uref,
-        const uint16_t seqnum, struct uref *next)
+/** @internal @This inserts a packet from the past in the buffer, if it is
+ * missing.
+ *
+ * @param upipe description structure of the pipe
+ * @param uref uref structure
+ * @param seqnum sequence number of the packet
+ * @return true if uref was inserted in the buffer or dropped as a duplicate
+ */
+static bool upipe_rtpfb_insert(struct upipe *upipe, struct uref *uref,
+                               const uint16_t seqnum)
 {
     struct upipe_rtpfb *upipe_rtpfb = upipe_rtpfb_from_upipe(upipe);
-    uint64_t next_seqnum = 0;
-    uref_attr_get_priv(next, &next_seqnum);
 
-    uint16_t diff = seqnum - next_seqnum;
-    if (!diff) {
-        upipe_dbg_va(upipe, "dropping duplicate %hu", seqnum);
-        upipe_rtpfb->dups++;
-        uref_free(uref);
-        return true;
-    }
-
-    /* browse the list until we find a seqnum bigger than ours */
-    if (diff < 0x8000) // seqnum > next_seqnum
+    /* if the packet was already output we're too late */
+    if (!upipe_rtpfb_in_window(upipe, seqnum))
         return false;
 
-    /* if there's no previous packet we're too late */
-    struct uchain *uchain = uref_to_uchain(next);
-    if (unlikely(ulist_is_first(&upipe_rtpfb->queue, uchain))) {
-        upipe_dbg_va(upipe,
-                "LATE packet drop: Expected %u, got %hu, didn't insert after %"PRIu64,
-                upipe_rtpfb->expected_seqnum, seqnum, next_seqnum);
+    if (upipe_rtpfb->packets[seqnum] != NULL ||
+        !upipe_rtpfb_is_missing(upipe, seqnum)) {
+        upipe_dbg_va(upipe, "dropping duplicate %hu", seqnum);
+        upipe_rtpfb->dups++;
         uref_free(uref);
         return true;
     }
 
-    /* Read previous packet seq & cr_sys */
-    uint64_t prev_seqnum = 0, cr_sys = 0;
+    /* overwrite this uref' cr_sys with the previous buffered one's, or the
+     * next one's if there is none, so it get scheduled at the right time */
+    struct uref *prev = NULL;
+    for (uint16_t seq = seqnum; seq != upipe_rtpfb->first_seqnum && !prev; )
+        prev = upipe_rtpfb->packets[--seq];
+    for (uint16_t seq = seqnum + 1; !prev; seq++)
+        prev = upipe_rtpfb->packets[seq];
 
-    struct uref *prev = uref_from_uchain(uchain->prev);
-    uref_attr_get_priv(prev, &prev_seqnum);
-
-    /* overwrite this uref' cr_sys with previous one's
-     * so it get scheduled at the right time */
+    uint64_t cr_sys = 0;
     if (ubase_check(uref_clock_get_cr_sys(prev, &cr_sys)))
         uref_clock_set_cr_sys(uref, cr_sys);
     else
@@ -754,31 +868,19 @@ static bool upipe_rtpfb_insert_inner(struct upipe *upipe, struct uref *uref,
                 __func__, upipe_rtpfb->buffered);
 
     upipe_rtpfb->buffered++;
-    ulist_insert(uchain->prev, uchain, uref_to_uchain(uref));
+    upipe_rtpfb->packets[seqnum] = uref;
+    upipe_rtpfb_set_missing(upipe, seqnum, false);
     upipe_rtpfb->repaired++;
+    upipe_rtpfb->recovered++;
     upipe_rtpfb->last_nack[seqnum] = 0;
 
-    upipe_dbg_va(upipe, "Repaired %"PRIu64" > %hu > %"PRIu64" -diff %d",
-            prev_seqnum, seqnum, next_seqnum, -diff);
+    upipe_dbg_va(upipe, "Repaired %hu (window %hu -> %u)",
+            seqnum, upipe_rtpfb->first_seqnum,
+            upipe_rtpfb->expected_seqnum);
 
     return true;
 }
 
-static bool upipe_rtpfb_insert(struct upipe *upipe, struct uref *uref, const uint16_t seqnum)
-{
-    struct upipe_rtpfb *upipe_rtpfb = upipe_rtpfb_from_upipe(upipe);
-
-    struct uchain *uchain, *uchain_tmp;
-    ulist_delete_foreach(&upipe_rtpfb->queue, uchain, uchain_tmp) {
-        struct uref *next = uref_from_uchain(uchain);
-        if (upipe_rtpfb_insert_inner(upipe, uref, seqnum, next))
-            return true;
-    }
-
-    /* Could not insert packet */
-    return false;
-}
-
 static void upipe_rtpfb_handle_sr(struct upipe *upipe, struct uref *uref)
 {
     struct upipe_rtpfb *upipe_rtpfb = upipe_rtpfb_from_upipe(upipe);
@@ -906,16 +1008,7 @@ static void upipe_rtpfb_input(struct upipe *upipe, struct uref *uref,
         upipe_notice_va(upipe, "RTT %f", (float)rtt / UCLOCK_FREQ);
         upipe_rtpfb->rtt = rtt;
 
-        if (upipe_rtpfb->upump_timer_lost) {
-            upump_stop(upipe_rtpfb->upump_timer_lost);
-            upump_free(upipe_rtpfb->upump_timer_lost);
-        }
-        if (upipe_rtpfb->upump_mgr) {
-            upipe_rtpfb->upump_timer_lost = upump_alloc_timer(upipe_rtpfb->upump_mgr,
-                    upipe_rtpfb_timer_lost, upipe, upipe->refcount,
-                    0, rtt / 10);
-            upump_start(upipe_rtpfb->upump_timer_lost);
-        }
+        upipe_rtpfb_rearm_timer_lost(upipe);
 unmap:
         uref_block_unmap(uref, 0);
 free:
@@ -933,16 +1026,7 @@ free:
                     upipe_verbose_va(upipe, "RTT %f", (float)rtt / UCLOCK_FREQ);
                     upipe_rtpfb->rtt = rtt;
 
-                    if (upipe_rtpfb->upump_timer_lost) {
-                        upump_stop(upipe_rtpfb->upump_timer_lost);
-                        upump_free(upipe_rtpfb->upump_timer_lost);
-                    }
-                    if (upipe_rtpfb->upump_mgr) {
-                        upipe_rtpfb->upump_timer_lost = upump_alloc_timer(upipe_rtpfb->upump_mgr,
-                                upipe_rtpfb_timer_lost, upipe, upipe->refcount,
-                                0, rtt / 10);
-                        upump_start(upipe_rtpfb->upump_timer_lost);
-                    }
+                    upipe_rtpfb_rearm_timer_lost(upipe);
                 }
             } else {
                 upipe_err(upipe, "malformed RTCP APP obe packet");
@@ -989,26 +1073,41 @@ free:
     uref_attr_set_priv(uref, seqnum);
 
     /* first packet */
-    if (unlikely(upipe_rtpfb->expected_seqnum == UINT_MAX))
+    if (unlikely(upipe_rtpfb->expected_seqnum == UINT_MAX)) {
         upipe_rtpfb->expected_seqnum = seqnum;
+        upipe_rtpfb->first_seqnum = seqnum;
+    }
 
     uint16_t diff = seqnum - upipe_rtpfb->expected_seqnum;
 
     if (diff < 0x8000) { // seqnum > last seq, insert at the end
-        /* packet is from the future */
+        /* packet is from the future, make room for it in the window */
+        while (upipe_rtpfb->buffered &&
+               (uint16_t)(seqnum - upipe_rtpfb->first_seqnum) >=
+                   RTPFB_WINDOW_MAX) {
+            upipe_warn_va(upipe, "buffer window exceeded, flushing");
+            upipe_rtpfb_output_seqnum(upipe, upipe_rtpfb_next_seqnum(upipe));
+        }
+        if (upipe_rtpfb->expected_seqnum == UINT_MAX) {
+            upipe_rtpfb->expected_seqnum = seqnum;
+            upipe_rtpfb->first_seqnum = seqnum;
+        }
+
         upipe_rtpfb->buffered++;
-        ulist_add(&upipe_rtpfb->queue, uref_to_uchain(uref));
+        upipe_rtpfb->packets[seqnum] = uref;
         upipe_rtpfb->last_nack[seqnum] = 0;
 
-        if (diff != 0) {
+        if (seqnum != upipe_rtpfb->expected_seqnum) {
             /* wait a bit to send a NACK, in case of reordering */
             uint64_t fake_last_nack = uclock_now(upipe_rtpfb->uclock) - upipe_rtpfb->rtt;
-            for (uint16_t seq = upipe_rtpfb->expected_seqnum; seq != seqnum; seq++)
+            for (uint16_t seq = upipe_rtpfb->expected_seqnum; seq != seqnum; seq++) {
+                upipe_rtpfb_set_missing(upipe, seq, true);
                 if (upipe_rtpfb->last_nack[seq] == 0)
                     upipe_rtpfb->last_nack[seq] = fake_last_nack;
+            }
         }
 
-        upipe_rtpfb->expected_seqnum = seqnum + 1;
+        upipe_rtpfb->expected_seqnum = (uint16_t)(seqnum + 1);
         return;
     }
 
@@ -1016,12 +1115,10 @@ free:
     if (upipe_rtpfb_insert(upipe, uref, seqnum))
         return;
 
-    uint64_t first_seq = 0, last_seq = 0;
-    uref_attr_get_priv(uref_from_uchain(upipe_rtpfb->queue.next), &first_seq);
-    uref_attr_get_priv(uref_from_uchain(upipe_rtpfb->queue.prev), &last_seq);
     // XXX : when much too late, it could mean RTP source restart
-    upipe_err_va(upipe, "LATE packet %hu, dropped (buffered %"PRIu64" -> %"PRIu64")",
-            seqnum, first_seq, last_seq);
+    upipe_rtpfb->late++;
+    upipe_err_va(upipe, "LATE packet %hu, dropped (window %hu -> %u)",
+            seqnum, upipe_rtpfb->first_seqnum, upipe_rtpfb->expected_seqnum);
     uref_free(uref);
 }
 
@@ -1145,6 +1242,20 @@ static int _upipe_rtpfb_control(struct upipe *upipe, int command, va_list args)
 
             return UBASE_ERR_NONE;
 
+        case UPIPE_RTPFB_GET_RETRANSMIT_STATS: {
+            UBASE_SIGNATURE_CHECK(args, UPIPE_RTPFB_SIGNATURE)
+            uint64_t *requested = va_arg(args, uint64_t *);
+            uint64_t *recovered = va_arg(args, uint64_t *);
+            uint64_t *late = va_arg(args, uint64_t *);
+            if (requested != NULL)
+                *requested = upipe_rtpfb->requested;
+            if (recovered != NULL)
+                *recovered = upipe_rtpfb->recovered;
+            if (late != NULL)
+                *late = upipe_rtpfb->late;
+            return UBASE_ERR_NONE;
+        }
+
         case UPIPE_RTPFB_SET_RTX_PT:
             UBASE_SIGNATURE_CHECK(args, UPIPE_RTPFB_SIGNATURE)
             upipe_rtpfb->rtx_pt = va_arg(args, unsigned);
@@ -1190,12 +1301,8 @@ static void upipe_rtpfb_free(struct urefcount *urefcount_real)
     upipe_rtpfb_clean_uclock(upipe);
     uprobe_release(upipe_rtpfb->uprobe);
 
-    struct uchain *uchain, *uchain_tmp;
-    ulist_delete_foreach(&upipe_rtpfb->queue, uchain, uchain_tmp) {
-        struct uref *uref = uref_from_uchain(uchain);
-        ulist_delete(uchain);
-        uref_free(uref);
-    }
+    for (unsigned i = 0; i < RTPFB_SEQNUMS; i++)
+        uref_free(upipe_rtpfb->packets[i]);
 
     upipe_rtpfb_free_void(upipe);
 }
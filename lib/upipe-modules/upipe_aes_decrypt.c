@@ -35,7 +35,17 @@
 #include <upipe/uref_block.h>
 #include <upipe/urefcount.h>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+/** AES-NI instructions may be used */
+# define HAVE_AESNI
+# include <wmmintrin.h>
+#endif
+
 #define EXPECTED_FLOW_DEF       "block.aes."
+/** size of an AES block */
+#define AES_BLOCK_SIZE          16
+/** number of blocks decrypted in parallel with AES-NI */
+#define AESNI_LANES             8
 
 /** @internal @This is the private context of an aes pipe. */
 struct upipe_aes_decrypt {
@@ -78,8 +88,12 @@ struct upipe_aes_decrypt {
     bool restart;
     /** store round keys */
     uint8_t round_keys[11][4][4];
+    /** store round keys for AES-NI decryption */
+    uint8_t dec_keys[11][16];
     /** store initialization vector */
     uint8_t iv[16];
+    /** true if AES-NI instructions are used */
+    bool aesni;
 };
 
 static int upipe_aes_decrypt_check(struct upipe *upipe, struct uref *uref);
@@ -369,18 +383,133 @@ static inline void aes_xor_iv(uint8_t state[4][4],
             state[i][j] ^= iv[i * 4 + j];
 }
 
-/** @internal @This decrypts an AES block.
+/** @internal @This decrypts AES blocks in CBC mode.
+ *
+ * @param buffer the blocks to decrypt inplace
+ * @param blocks number of blocks
+ * @param round_keys the generated round keys
+ * @param iv the initialization vector, updated for the next blocks
+ */
+static void aes_cbc_decrypt(uint8_t *buffer, size_t blocks,
+                            uint8_t round_keys[11][4][4],
+                            uint8_t iv[AES_BLOCK_SIZE])
+{
+    for (; blocks; blocks--, buffer += AES_BLOCK_SIZE) {
+        uint8_t cipher[AES_BLOCK_SIZE];
+        memcpy(cipher, buffer, sizeof (cipher));
+        aes_inv_cipher((uint8_t (*)[])buffer, round_keys);
+        aes_xor_iv((uint8_t (*)[])buffer, iv);
+        memcpy(iv, cipher, sizeof (cipher));
+    }
+}
+
+#ifdef HAVE_AESNI
+/** @internal @This returns true if the CPU supports AES-NI instructions.
+ *
+ * @return true if AES-NI instructions are supported
+ */
+static bool aesni_supported(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("aes") && __builtin_cpu_supports("sse2");
+}
+
+/** @internal @This generates the round keys for AES-NI decryption, from
+ * the round keys of the cipher, in reverse order.
  *
- * @param buffer the block to decrypt inplace
  * @param round_keys the generated round keys
- * @param iv the initialization vector
+ * @param dec_keys filled in with the decryption round keys
  */
-static inline void aes_cbc_decrypt(uint8_t buffer[16],
-                                   uint8_t round_keys[11][4][4],
-                                   const uint8_t iv[16])
+__attribute__((target("aes,sse2")))
+static void aesni_key_expansion(uint8_t round_keys[11][4][4],
+                                uint8_t dec_keys[11][16])
 {
-    aes_inv_cipher((uint8_t (*)[])buffer, round_keys);
-    aes_xor_iv((uint8_t (*)[])buffer, iv);
+    _mm_storeu_si128((__m128i *)dec_keys[0],
+                     _mm_loadu_si128((const __m128i *)round_keys[10]));
+    for (unsigned i = 1; i < 10; i++)
+        _mm_storeu_si128((__m128i *)dec_keys[i],
+            _mm_aesimc_si128(_mm_loadu_si128(
+                    (const __m128i *)round_keys[10 - i])));
+    _mm_storeu_si128((__m128i *)dec_keys[10],
+                     _mm_loadu_si128((const __m128i *)round_keys[0]));
+}
+
+/** @internal @This decrypts AES blocks in CBC mode with AES-NI
+ * instructions. Unlike encryption, CBC decryption doesn't depend on the
+ * result of the previous block, so several blocks are interleaved to hide
+ * the latency of the instructions.
+ *
+ * @param buffer the blocks to decrypt inplace
+ * @param blocks number of blocks
+ * @param dec_keys the decryption round keys
+ * @param iv the initialization vector, updated for the next blocks
+ */
+__attribute__((target("aes,sse2")))
+static void aesni_cbc_decrypt(uint8_t *buffer, size_t blocks,
+                              uint8_t dec_keys[11][16],
+                              uint8_t iv[AES_BLOCK_SIZE])
+{
+    __m128i keys[11];
+    for (unsigned i = 0; i < 11; i++)
+        keys[i] = _mm_loadu_si128((const __m128i *)dec_keys[i]);
+    __m128i prev = _mm_loadu_si128((const __m128i *)iv);
+
+    for (; blocks >= AESNI_LANES; blocks -= AESNI_LANES,
+                                  buffer += AESNI_LANES * AES_BLOCK_SIZE) {
+        __m128i *p = (__m128i *)buffer;
+        __m128i cipher[AESNI_LANES], state[AESNI_LANES];
+        for (unsigned j = 0; j < AESNI_LANES; j++) {
+            cipher[j] = _mm_loadu_si128(p + j);
+            state[j] = _mm_xor_si128(cipher[j], keys[0]);
+        }
+        for (unsigned i = 1; i < 10; i++)
+            for (unsigned j = 0; j < AESNI_LANES; j++)
+                state[j] = _mm_aesdec_si128(state[j], keys[i]);
+        for (unsigned j = 0; j < AESNI_LANES; j++)
+            state[j] = _mm_aesdeclast_si128(state[j], keys[10]);
+
+        _mm_storeu_si128(p, _mm_xor_si128(state[0], prev));
+        for (unsigned j = 1; j < AESNI_LANES; j++)
+            _mm_storeu_si128(p + j, _mm_xor_si128(state[j], cipher[j - 1]));
+        prev = cipher[AESNI_LANES - 1];
+    }
+
+    for (; blocks; blocks--, buffer += AES_BLOCK_SIZE) {
+        __m128i cipher = _mm_loadu_si128((const __m128i *)buffer);
+        __m128i state = _mm_xor_si128(cipher, keys[0]);
+        for (unsigned i = 1; i < 10; i++)
+            state = _mm_aesdec_si128(state, keys[i]);
+        state = _mm_aesdeclast_si128(state, keys[10]);
+        _mm_storeu_si128((__m128i *)buffer, _mm_xor_si128(state, prev));
+        prev = cipher;
+    }
+
+    _mm_storeu_si128((__m128i *)iv, prev);
+}
+#endif
+
+/** @internal @This decrypts AES blocks in CBC mode with the fastest
+ * implementation available.
+ *
+ * @param upipe description structure of the pipe
+ * @param buffer the blocks to decrypt inplace
+ * @param blocks number of blocks
+ */
+static void upipe_aes_decrypt_blocks(struct upipe *upipe,
+                                     uint8_t *buffer, size_t blocks)
+{
+    struct upipe_aes_decrypt *upipe_aes_decrypt =
+        upipe_aes_decrypt_from_upipe(upipe);
+
+#ifdef HAVE_AESNI
+    if (upipe_aes_decrypt->aesni) {
+        aesni_cbc_decrypt(buffer, blocks, upipe_aes_decrypt->dec_keys,
+                          upipe_aes_decrypt->iv);
+        return;
+    }
+#endif
+    aes_cbc_decrypt(buffer, blocks, upipe_aes_decrypt->round_keys,
+                    upipe_aes_decrypt->iv);
 }
 
 /** @internal @This allocates an aes decryption pipe.
@@ -411,6 +540,11 @@ static struct upipe *upipe_aes_decrypt_alloc(struct upipe_mgr *mgr,
     upipe_aes_decrypt_init_uref_stream(upipe);
     upipe_aes_decrypt->input_flow_def = NULL;
     upipe_aes_decrypt->restart = true;
+#ifdef HAVE_AESNI
+    upipe_aes_decrypt->aesni = aesni_supported();
+#else
+    upipe_aes_decrypt->aesni = false;
+#endif
 
     upipe_throw_ready(upipe);
 
@@ -456,7 +590,7 @@ static int upipe_aes_decrypt_restart(struct upipe *upipe)
     }
     if (unlikely(key_size != 16)) {
         upipe_warn(upipe, "invalid aes key");
-        return ret;
+        return UBASE_ERR_INVALID;
     }
 
     const uint8_t *iv;
@@ -468,10 +602,96 @@ static int upipe_aes_decrypt_restart(struct upipe *upipe)
     }
     if (unlikely(iv_size != 16)) {
         upipe_warn(upipe, "invalid aes initialization vector");
-        return ret;
+        return UBASE_ERR_INVALID;
     }
 
     aes_key_expansion(key, upipe_aes_decrypt->round_keys);
+#ifdef HAVE_AESNI
+    if (upipe_aes_decrypt->aesni)
+        aesni_key_expansion(upipe_aes_decrypt->round_keys,
+                            upipe_aes_decrypt->dec_keys);
+#endif
+    memcpy(upipe_aes_decrypt->iv, iv, sizeof (upipe_aes_decrypt->iv));
+    return UBASE_ERR_NONE;
+}
+
+/** @internal @This makes sure the buffer of a uref can be written, and
+ * copies the segments that are shared with other urefs, along with the
+ * following ones.
+ *
+ * @param upipe description structure of the pipe
+ * @param uref uref to write
+ * @param size size of the uref
+ * @return an error code
+ */
+static int upipe_aes_decrypt_make_writable(struct upipe *upipe,
+                                           struct uref *uref, size_t size)
+{
+    struct upipe_aes_decrypt *upipe_aes_decrypt =
+        upipe_aes_decrypt_from_upipe(upipe);
+
+    size_t offset = 0;
+    while (offset < size) {
+        int wsize = -1;
+        uint8_t *wbuf;
+        if (ubase_check(uref_block_write(uref, offset, &wsize, &wbuf))) {
+            uref_block_unmap(uref, offset);
+            offset += wsize;
+            continue;
+        }
+
+        struct ubuf *ubuf = ubuf_block_copy(upipe_aes_decrypt->ubuf_mgr,
+                                            uref->ubuf, offset, -1);
+        UBASE_ALLOC_RETURN(ubuf);
+        if (!offset) {
+            uref_attach_ubuf(uref, ubuf);
+            return UBASE_ERR_NONE;
+        }
+        int ret = uref_block_resize(uref, 0, offset);
+        if (ubase_check(ret))
+            ret = uref_block_append(uref, ubuf);
+        if (unlikely(!ubase_check(ret)))
+            ubuf_free(ubuf);
+        return ret;
+    }
+    return UBASE_ERR_NONE;
+}
+
+/** @internal @This decrypts a uref inplace. Blocks spanning two segments
+ * are decrypted in a temporary buffer.
+ *
+ * @param upipe description structure of the pipe
+ * @param uref uref to decrypt, which must be writable
+ * @param size size of the uref, multiple of the AES block size
+ * @return an error code
+ */
+static int upipe_aes_decrypt_uref(struct upipe *upipe, struct uref *uref,
+                                  size_t size)
+{
+    size_t offset = 0;
+    while (offset < size) {
+        int wsize = size - offset;
+        uint8_t *wbuf;
+        UBASE_RETURN(uref_block_write(uref, offset, &wsize, &wbuf));
+        size_t blocks = wsize / AES_BLOCK_SIZE;
+        if (blocks)
+            upipe_aes_decrypt_blocks(upipe, wbuf, blocks);
+        uref_block_unmap(uref, offset);
+        if (blocks) {
+            offset += blocks * AES_BLOCK_SIZE;
+            continue;
+        }
+
+        uint8_t block[AES_BLOCK_SIZE];
+        UBASE_RETURN(uref_block_extract(uref, offset, AES_BLOCK_SIZE, block));
+        upipe_aes_decrypt_blocks(upipe, block, 1);
+        for (size_t i = 0; i < AES_BLOCK_SIZE; i += wsize, offset += wsize) {
+            wsize = AES_BLOCK_SIZE - i;
+            UBASE_RETURN(uref_block_write(uref, offset, &wsize, &wbuf));
+            memcpy(wbuf, block + i, wsize);
+            uref_block_unmap(uref, offset);
+        }
+    }
     return UBASE_ERR_NONE;
 }
 
@@ -496,48 +716,25 @@ static void upipe_aes_decrypt_worker(struct upipe *upipe,
 
     size_t block_size;
     ubase_assert(uref_block_size(upipe_aes_decrypt->next_uref, &block_size));
-    for (size_t size = block_size; size >= 16; size -= 16) {
-        int ret;
-
-        struct uref *uref = upipe_aes_decrypt_extract_uref_stream(upipe, 16);
-        if (unlikely(!uref)) {
-            upipe_throw_fatal(upipe, UBASE_ERR_INVALID);
-            return;
-        }
-
-        uint8_t iv[16];
-        ret = uref_block_extract(uref, 0, 16, iv);
-        if (unlikely(!ubase_check(ret))) {
-            uref_free(uref);
-            upipe_throw_fatal(upipe, UBASE_ERR_INVALID);
-            return;
-        }
-
-        struct ubuf *ubuf =
-            ubuf_block_alloc(upipe_aes_decrypt->ubuf_mgr, 16);
-        if (unlikely(!ubuf)) {
-            uref_free(uref);
-            upipe_throw_fatal(upipe, UBASE_ERR_ALLOC);
-            return;
-        }
-        uref_attach_ubuf(uref, ubuf);
+    size_t size = block_size - block_size % AES_BLOCK_SIZE;
+    if (!size)
+        return;
+
+    struct uref *uref = upipe_aes_decrypt_extract_uref_stream(upipe, size);
+    if (unlikely(!uref)) {
+        upipe_throw_fatal(upipe, UBASE_ERR_ALLOC);
+        return;
+    }
 
-        int wsize = 16;
-        uint8_t *wbuf;
-        ret = uref_block_write(uref, 0, &wsize, &wbuf);
-        if (unlikely(!ubase_check(ret)) || wsize != 16) {
-            uref_free(uref);
-            upipe_throw_fatal(upipe, UBASE_ERR_INVALID);
-            return;
-        }
-        memcpy(wbuf, iv, wsize);
-        aes_cbc_decrypt(wbuf,
-                        upipe_aes_decrypt->round_keys,
-                        upipe_aes_decrypt->iv);
-        ubase_assert(uref_block_unmap(uref, 0));
-        memcpy(upipe_aes_decrypt->iv, iv, sizeof (upipe_aes_decrypt->iv));
-        upipe_aes_decrypt_output(upipe, uref, upump_p);
+    int ret = upipe_aes_decrypt_make_writable(upipe, uref, size);
+    if (likely(ubase_check(ret)))
+        ret = upipe_aes_decrypt_uref(upipe, uref, size);
+    if (unlikely(!ubase_check(ret))) {
+        uref_free(uref);
+        upipe_throw_fatal(upipe, ret);
+        return;
     }
+    upipe_aes_decrypt_output(upipe, uref, upump_p);
 }
 
 /** @internal @This outputs the last block.
@@ -673,6 +870,31 @@ static int upipe_aes_decrypt_set_flow_def(struct upipe *upipe,
     return UBASE_ERR_NONE;
 }
 
+/** @internal @This enables or disables the use of AES-NI instructions.
+ *
+ * @param upipe description structure of the pipe
+ * @param aesni true to use AES-NI instructions
+ * @return an error code
+ */
+static int _upipe_aes_decrypt_set_aesni(struct upipe *upipe, bool aesni)
+{
+    struct upipe_aes_decrypt *upipe_aes_decrypt =
+        upipe_aes_decrypt_from_upipe(upipe);
+
+#ifdef HAVE_AESNI
+    if (aesni && !aesni_supported())
+        return UBASE_ERR_INVALID;
+    if (aesni && !upipe_aes_decrypt->aesni && !upipe_aes_decrypt->restart)
+        aesni_key_expansion(upipe_aes_decrypt->round_keys,
+                            upipe_aes_decrypt->dec_keys);
+#else
+    if (aesni)
+        return UBASE_ERR_INVALID;
+#endif
+    upipe_aes_decrypt->aesni = aesni;
+    return UBASE_ERR_NONE;
+}
+
 /** @internal @This dispatches commands.
  *
  * @param upipe description structure of the pipe
@@ -702,11 +924,22 @@ static int upipe_aes_decrypt_control(struct upipe *upipe,
     case UPIPE_GET_OUTPUT:
     case UPIPE_SET_OUTPUT:
     case UPIPE_GET_FLOW_DEF:
-        return upipe_aes_decrypt_control(upipe, command, args);
+        return upipe_aes_decrypt_control_output(upipe, command, args);
     case UPIPE_SET_FLOW_DEF: {
         struct uref *flow_def = va_arg(args, struct uref *);
         return upipe_aes_decrypt_set_flow_def(upipe, flow_def);
     }
+    case UPIPE_AES_DECRYPT_GET_AESNI: {
+        UBASE_SIGNATURE_CHECK(args, UPIPE_AES_DECRYPT_SIGNATURE)
+        bool *aesni_p = va_arg(args, bool *);
+        *aesni_p = upipe_aes_decrypt_from_upipe(upipe)->aesni;
+        return UBASE_ERR_NONE;
+    }
+    case UPIPE_AES_DECRYPT_SET_AESNI: {
+        UBASE_SIGNATURE_CHECK(args, UPIPE_AES_DECRYPT_SIGNATURE)
+        bool aesni = va_arg(args, int);
+        return _upipe_aes_decrypt_set_aesni(upipe, aesni);
+    }
     }
     return UBASE_ERR_UNHANDLED;
 }
@@ -38,6 +38,7 @@
 #include <upipe/ubuf.h>
 #include <upipe/uref_sound.h>
 #include <upipe/uref_sound_flow.h>
+#include <upipe/usound.h>
 #include <upipe/upipe.h>
 #include <upipe/upipe_helper_upipe.h>
 #include <upipe/upipe_helper_urefcount.h>
@@ -96,6 +97,8 @@ struct upipe_audiocont {
     uint64_t crossblend_period;
     /** crossblend step between each sample */
     float crossblend_step;
+    /** sample processing kernels */
+    struct usound_dsp dsp;
 
     /** list of input subpipes */
     struct uchain subs;
@@ -490,27 +493,30 @@ static int upipe_audiocont_sub_extract(struct upipe *upipe, struct ubuf *ubuf,
             float *ref_buffer = ref_buffers[plane] +
                                 offset * sample_size / sizeof(float);
             const float *in_buffer = in_buffers[plane];
-            size_t extracted_plane = extracted;
+            uint8_t channels = sample_size / sizeof(float);
             float crossblend = initial_crossblend;
+            size_t blended = 0;
 
-            while (extracted_plane) {
-                if (crossblend >= 1.) {
-                    if (!previous)
-                        memcpy(ref_buffer, in_buffer,
-                               extracted_plane * sample_size);
-                    break;
-                }
-
-                float real_crossblend = previous ?
-                                        (1. - crossblend) : crossblend;
-                for (int i = 0; i < sample_size / sizeof(float); i++)
-                    ref_buffer[i] += in_buffer[i] * real_crossblend;
-
-                ref_buffer += sample_size / sizeof(float);
-                in_buffer += sample_size / sizeof(float);
-                extracted_plane--;
+            /* count the samples before the end of the crossblend */
+            while (blended < extracted && crossblend < 1.) {
                 crossblend += upipe_audiocont->crossblend_step;
+                blended++;
             }
+
+            if (blended) {
+                if (previous)
+                    upipe_audiocont->dsp.mix_flt(ref_buffer, in_buffer,
+                            blended, channels, 1. - initial_crossblend,
+                            -upipe_audiocont->crossblend_step);
+                else
+                    upipe_audiocont->dsp.mix_flt(ref_buffer, in_buffer,
+                            blended, channels, initial_crossblend,
+                            upipe_audiocont->crossblend_step);
+            }
+            if (!previous && blended < extracted)
+                memcpy(ref_buffer + blended * channels,
+                       in_buffer + blended * channels,
+                       (extracted - blended) * sample_size);
         }
 
         uref_sound_unmap(input_uref, 0, extracted, planes);
@@ -614,6 +620,7 @@ static struct upipe *upipe_audiocont_alloc(struct upipe_mgr *mgr,
                                        upipe_audiocont->crossblend_period;
     upipe_audiocont->crossblend = 0.;
     upipe_audiocont->latency = 0;
+    usound_dsp_init(&upipe_audiocont->dsp);
 
     upipe_throw_ready(upipe);
     upipe_dbg_va(upipe, "using crossblend step %f",
@@ -725,9 +732,7 @@ static void upipe_audiocont_input(struct upipe *upipe, struct uref *uref,
     uref_sound_foreach_plane(uref, channel) {
         float *buf;
         uref_sound_plane_write_float(uref, channel, 0, -1, &buf);
-        for (int i = 0; i < ref_size; i++)
-            for (int j = 0; j < sample_size / sizeof(float); j++)
-                *buf++ = 0.;
+        memset(buf, 0, ref_size * sample_size);
         uref_sound_plane_unmap(uref, channel, 0, -1);
     }
 
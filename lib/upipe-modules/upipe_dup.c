@@ -61,6 +61,8 @@ struct upipe_dup {
     enum upipe_helper_output_state output_state;
     /** main output requests */
     struct uchain requests;
+    /** true if the attributes are shared between the outputs */
+    bool shared;
 
     /** manager to create output subpipes */
     struct upipe_mgr sub_mgr;
@@ -218,6 +220,7 @@ static struct upipe *upipe_dup_alloc(struct upipe_mgr *mgr,
     upipe_dup_init_sub_outputs(upipe);
     upipe_dup_init_output(upipe);
     upipe_dup->flow_def = NULL;
+    upipe_dup->shared = false;
     upipe_throw_ready(upipe);
     return upipe;
 }
@@ -232,29 +235,31 @@ static void upipe_dup_input(struct upipe *upipe, struct uref *uref,
                             struct upump **upump_p)
 {
     struct upipe_dup *upipe_dup = upipe_dup_from_upipe(upipe);
-    struct upipe *output = upipe_dup->output;
     struct uchain *uchain;
     ulist_foreach (&upipe_dup->outputs, uchain) {
         struct upipe_dup_output *upipe_dup_output =
             upipe_dup_output_from_uchain(uchain);
         struct upipe *output = upipe_dup_output_to_upipe(upipe_dup_output);
-        if (ulist_is_last(&upipe_dup->outputs, uchain) && !output) {
+        if (ulist_is_last(&upipe_dup->outputs, uchain) &&
+            upipe_dup->output == NULL) {
+            /* the last output gets the original uref */
             upipe_dup_output_output(output, uref, upump_p);
-            uref = NULL;
-        } else {
-            struct uref *new_uref = uref_dup(uref);
-            if (unlikely(new_uref == NULL)) {
-                uref_free(uref);
-                upipe_throw_fatal(upipe, UBASE_ERR_ALLOC);
-                return;
-            }
-            upipe_dup_output_output(output, new_uref, upump_p);
+            return;
         }
+
+        struct uref *new_uref = upipe_dup->shared ? uref_share(uref) :
+                                                    uref_dup(uref);
+        if (unlikely(new_uref == NULL)) {
+            uref_free(uref);
+            upipe_throw_fatal(upipe, UBASE_ERR_ALLOC);
+            return;
+        }
+        upipe_dup_output_output(output, new_uref, upump_p);
     }
 
-    if (output)
+    if (upipe_dup->output != NULL)
         upipe_dup_output(upipe, uref, upump_p);
-    else if (uref != NULL)
+    else
         uref_free(uref);
 }
 
@@ -306,6 +311,17 @@ static int upipe_dup_control(struct upipe *upipe, int command, va_list args)
             struct uref *uref = va_arg(args, struct uref *);
             return upipe_dup_set_flow_def(upipe, uref);
         }
+        case UPIPE_DUP_GET_SHARED: {
+            UBASE_SIGNATURE_CHECK(args, UPIPE_DUP_SIGNATURE)
+            bool *shared_p = va_arg(args, bool *);
+            *shared_p = upipe_dup_from_upipe(upipe)->shared;
+            return UBASE_ERR_NONE;
+        }
+        case UPIPE_DUP_SET_SHARED: {
+            UBASE_SIGNATURE_CHECK(args, UPIPE_DUP_SIGNATURE)
+            upipe_dup_from_upipe(upipe)->shared = va_arg(args, int);
+            return UBASE_ERR_NONE;
+        }
 
         default:
             return UBASE_ERR_UNHANDLED;
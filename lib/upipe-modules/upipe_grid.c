@@ -33,6 +33,8 @@
 #include <upipe/upipe_helper_uclock.h>
 
 #include <upipe/uclock.h>
+#include <upipe/uatomic.h>
+#include <upipe/umutex.h>
 #include <upipe/uref_clock.h>
 #include <upipe/uref_void_flow.h>
 #include <upipe/uref_pic_flow.h>
@@ -44,12 +46,21 @@
 
 #include <upipe-modules/upipe_grid.h>
 
+#include <stdlib.h>
+#include <limits.h>
+
 /** expected flow def for reference input */
 #define REF_EXPECTED_FLOW "void."
 /** default pts tolerance (late packets) */
 #define DEFAULT_TOLERANCE ((UCLOCK_FREQ / 25) - 1)
 /** maximum retention when there is no packet afterwards */
 #define MAX_RETENTION UCLOCK_FREQ
+/** default maximum number of retained frames per input */
+#define DEFAULT_INPUT_CAPACITY 256
+/** number of slots of published frames per input in threaded mode */
+#define SLOTS 3
+/** slot state flag set while the input rewrites the slot */
+#define SLOT_WRITING UINT32_C(0x80000000)
 
 /** @internal @This is the private structure of a grid pipe. */
 struct upipe_grid {
@@ -79,6 +90,12 @@ struct upipe_grid {
     uint64_t next_update;
     /** grid max rentention */
     uint64_t max_retention;
+    /** frame capacity of new inputs */
+    unsigned int input_capacity;
+    /** true if inputs and outputs may run on different threads */
+    bool threaded;
+    /** mutual exclusion primitives for the sub pipe lists, or NULL */
+    struct umutex *mutex;
 };
 
 /** @hidden */
@@ -96,16 +113,53 @@ UPIPE_HELPER_VOID(upipe_grid);
 UPIPE_HELPER_UCLOCK(upipe_grid, uclock, uclock_request, NULL,
                     upipe_throw_provide_request, NULL);
 
+/** @internal @This is a frame retained by a grid input. */
+struct upipe_grid_frame {
+    /** flow def to apply before the frame, or NULL */
+    struct uref *flow_def;
+    /** frame buffer */
+    struct uref *uref;
+    /** system pts of the frame */
+    uint64_t pts;
+};
+
+/** @internal @This is the latest frame published by a grid input in
+ * threaded mode. */
+struct upipe_grid_slot {
+    /** number of outputs reading the slot, or SLOT_WRITING */
+    uatomic_uint32_t state;
+    /** generation of the flow def of the frame */
+    uint32_t flow_def_gen;
+    /** published frame, with its own flow def */
+    struct upipe_grid_frame frame;
+};
+
 /** @internal @This is the private structure for grid input sub pipe. */
 struct upipe_grid_in {
     /** pipe public structure */
     struct upipe upipe;
     /** refcount public structure */
     struct urefcount urefcount;
+    /** real refcount structure, also held by outputs in threaded mode */
+    struct urefcount urefcount_real;
     /** uchain for upipe_grid input list */
     struct uchain uchain;
-    /** list of input urefs */
-    struct uchain urefs;
+    /** ring of retained frames, in pts order */
+    struct upipe_grid_frame *frames;
+    /** size of the ring (power of 2) */
+    unsigned int capacity;
+    /** index of the oldest frame */
+    unsigned int head;
+    /** number of retained frames */
+    unsigned int count;
+    /** flow def received after the last frame, or NULL */
+    struct uref *flow_def_next;
+    /** published frames in threaded mode */
+    struct upipe_grid_slot slots[SLOTS];
+    /** index of the slot of the latest published frame */
+    uatomic_uint32_t slot;
+    /** generation of the input flow def */
+    uint32_t flow_def_gen;
     /** input flow def */
     struct uref *flow_def;
     /** flow def attr */
@@ -123,7 +177,8 @@ struct upipe_grid_in {
 };
 
 UPIPE_HELPER_UPIPE(upipe_grid_in, upipe, UPIPE_GRID_IN_SIGNATURE);
-UPIPE_HELPER_UREFCOUNT(upipe_grid_in, urefcount, upipe_grid_in_free);
+UPIPE_HELPER_UREFCOUNT(upipe_grid_in, urefcount, upipe_grid_in_no_ref);
+UPIPE_HELPER_UREFCOUNT_REAL(upipe_grid_in, urefcount_real, upipe_grid_in_free);
 UPIPE_HELPER_VOID(upipe_grid_in);
 UPIPE_HELPER_SUBPIPE(upipe_grid, upipe_grid_in, input, in_mgr,
                      inputs, uchain);
@@ -170,6 +225,10 @@ struct upipe_grid_out {
     uint64_t tolerance;
     /** last input pts */
     uint64_t last_input_pts;
+    /** flow def of the selected input in threaded mode */
+    struct uref *slot_flow_def;
+    /** generation of slot_flow_def */
+    uint32_t slot_flow_def_gen;
 };
 
 static void upipe_grid_out_handle_input_changed(struct upipe *upipe,
@@ -187,7 +246,98 @@ UPIPE_HELPER_SUBPIPE(upipe_grid, upipe_grid_out, output, out_mgr,
                      outputs, uchain);
 UPIPE_HELPER_FLOW_DEF(upipe_grid_out, input_flow_def, input_flow_attr);
 
-/** @internal @This frees a grid input sub pipe.
+/** @internal @This locks the sub pipe lists in threaded mode.
+ *
+ * @param upipe_grid private structure of the grid pipe
+ */
+static inline void upipe_grid_lock(struct upipe_grid *upipe_grid)
+{
+    if (upipe_grid->mutex)
+        umutex_lock(upipe_grid->mutex);
+}
+
+/** @internal @This unlocks the sub pipe lists in threaded mode.
+ *
+ * @param upipe_grid private structure of the grid pipe
+ */
+static inline void upipe_grid_unlock(struct upipe_grid *upipe_grid)
+{
+    if (upipe_grid->mutex)
+        umutex_unlock(upipe_grid->mutex);
+}
+
+/** @internal @This returns the oldest frame retained by an input.
+ *
+ * @param upipe_grid_in private structure of the input pipe
+ * @return the oldest frame, or NULL if there is none
+ */
+static inline struct upipe_grid_frame *
+    upipe_grid_in_peek(struct upipe_grid_in *upipe_grid_in)
+{
+    if (!upipe_grid_in->count)
+        return NULL;
+    return &upipe_grid_in->frames[upipe_grid_in->head];
+}
+
+/** @internal @This drops the oldest frame retained by an input. A flow def
+ * that was not applied yet is carried over to the next frame, unless it is
+ * superseded by a later flow def.
+ *
+ * @param upipe_grid_in private structure of the input pipe
+ */
+static void upipe_grid_in_drop(struct upipe_grid_in *upipe_grid_in)
+{
+    struct upipe_grid_frame *frame = upipe_grid_in_peek(upipe_grid_in);
+    struct uref *flow_def = frame->flow_def;
+    uref_free(frame->uref);
+    frame->uref = NULL;
+    frame->flow_def = NULL;
+    upipe_grid_in->head =
+        (upipe_grid_in->head + 1) & (upipe_grid_in->capacity - 1);
+    upipe_grid_in->count--;
+
+    if (flow_def) {
+        struct uref **flow_def_p = upipe_grid_in->count ?
+            &upipe_grid_in->frames[upipe_grid_in->head].flow_def :
+            &upipe_grid_in->flow_def_next;
+        if (*flow_def_p)
+            uref_free(flow_def);
+        else
+            *flow_def_p = flow_def;
+    }
+}
+
+/** @internal @This appends a frame to an input, dropping the oldest frame
+ * if the input is full.
+ *
+ * @param upipe description structure of the input pipe
+ * @param uref frame buffer
+ * @param pts system pts of the frame
+ */
+static void upipe_grid_in_push(struct upipe *upipe, struct uref *uref,
+                               uint64_t pts)
+{
+    struct upipe_grid_in *upipe_grid_in = upipe_grid_in_from_upipe(upipe);
+
+    if (unlikely(upipe_grid_in->count == upipe_grid_in->capacity)) {
+        upipe_warn(upipe, "too many retained frames, dropping oldest");
+        upipe_grid_in_drop(upipe_grid_in);
+    }
+
+    struct upipe_grid_frame *frame =
+        &upipe_grid_in->frames[(upipe_grid_in->head + upipe_grid_in->count) &
+                               (upipe_grid_in->capacity - 1)];
+    frame->flow_def = upipe_grid_in->flow_def_next;
+    frame->uref = uref;
+    frame->pts = pts;
+    upipe_grid_in->flow_def_next = NULL;
+    upipe_grid_in->count++;
+}
+
+/** @internal @This frees a grid input sub pipe. In threaded mode, it may
+ * be called from the thread of an output, so the input was already cleaned
+ * up by @ref upipe_grid_in_no_ref on its own thread, and only the published
+ * frames remain.
  *
  * @param upipe description structure of the pipe
  */
@@ -196,18 +346,44 @@ static void upipe_grid_in_free(struct upipe *upipe)
     struct upipe_grid_in *upipe_grid_in =
         upipe_grid_in_from_upipe(upipe);
 
+    for (unsigned i = 0; i < SLOTS; i++) {
+        struct upipe_grid_slot *slot = &upipe_grid_in->slots[i];
+        uref_free(slot->frame.uref);
+        uref_free(slot->frame.flow_def);
+        uatomic_clean(&slot->state);
+    }
+    uatomic_clean(&upipe_grid_in->slot);
+    upipe_grid_in_clean_urefcount_real(upipe);
+    upipe_grid_in_clean_urefcount(upipe);
+
+    upipe_grid_in_free_void(upipe);
+}
+
+/** @internal @This is called on the thread of the input when there is no
+ * external reference to the input anymore.
+ *
+ * @param upipe description structure of the pipe
+ */
+static void upipe_grid_in_no_ref(struct upipe *upipe)
+{
+    struct upipe_grid_in *upipe_grid_in =
+        upipe_grid_in_from_upipe(upipe);
+    struct upipe_grid *upipe_grid = upipe_grid_from_in_mgr(upipe->mgr);
+
     upipe_throw_dead(upipe);
 
-    struct uchain *uchain, *uchain_tmp;
-    ulist_delete_foreach(&upipe_grid_in->urefs, uchain, uchain_tmp) {
-        ulist_delete(uchain);
-        uref_free(uref_from_uchain(uchain));
-    }
+    while (upipe_grid_in->count)
+        upipe_grid_in_drop(upipe_grid_in);
+    uref_free(upipe_grid_in->flow_def_next);
+    upipe_grid_in->flow_def_next = NULL;
+    free(upipe_grid_in->frames);
+    upipe_grid_in->frames = NULL;
     upipe_grid_in_clean_flow_def(upipe);
+    upipe_grid_lock(upipe_grid);
     upipe_grid_in_clean_sub(upipe);
-    upipe_grid_in_clean_urefcount(upipe);
+    upipe_grid_unlock(upipe_grid);
 
-    upipe_grid_in_free_void(upipe);
+    upipe_grid_in_release_urefcount_real(upipe);
 }
 
 /** @internal @This allocates a grid input sub pipe.
@@ -222,18 +398,44 @@ static struct upipe *upipe_grid_in_alloc(struct upipe_mgr *mgr,
                                          struct uprobe *uprobe,
                                          uint32_t signature, va_list args)
 {
+    struct upipe_grid *upipe_grid = upipe_grid_from_in_mgr(mgr);
     struct upipe *upipe =
         upipe_grid_in_alloc_void(mgr, uprobe, signature, args);
     if (unlikely(!upipe))
         return NULL;
 
+    struct upipe_grid_in *upipe_grid_in =
+        upipe_grid_in_from_upipe(upipe);
+    upipe_grid_in->capacity = 1;
+    while (upipe_grid_in->capacity < upipe_grid->input_capacity)
+        upipe_grid_in->capacity <<= 1;
+    upipe_grid_in->frames = calloc(upipe_grid_in->capacity,
+                                   sizeof(struct upipe_grid_frame));
+    if (unlikely(!upipe_grid_in->frames)) {
+        upipe_grid_in_free_void(upipe);
+        return NULL;
+    }
+    upipe_grid_in->head = 0;
+    upipe_grid_in->count = 0;
+    upipe_grid_in->flow_def_next = NULL;
+    for (unsigned i = 0; i < SLOTS; i++) {
+        struct upipe_grid_slot *slot = &upipe_grid_in->slots[i];
+        uatomic_init(&slot->state, 0);
+        slot->flow_def_gen = 0;
+        slot->frame.flow_def = NULL;
+        slot->frame.uref = NULL;
+        slot->frame.pts = 0;
+    }
+    uatomic_init(&upipe_grid_in->slot, 0);
+    upipe_grid_in->flow_def_gen = 0;
+
     upipe_grid_in_init_urefcount(upipe);
+    upipe_grid_in_init_urefcount_real(upipe);
+    upipe_grid_lock(upipe_grid);
     upipe_grid_in_init_sub(upipe);
+    upipe_grid_unlock(upipe_grid);
     upipe_grid_in_init_flow_def(upipe);
 
-    struct upipe_grid_in *upipe_grid_in =
-        upipe_grid_in_from_upipe(upipe);
-    ulist_init(&upipe_grid_in->urefs);
     upipe_grid_in->last_pts = 0;
     upipe_grid_in->last_update = 0;
     upipe_grid_in->latency = 0;
@@ -262,6 +464,10 @@ static int upipe_grid_in_catch(struct uprobe *uprobe,
     struct upipe_grid *upipe_grid = upipe_grid_from_in_mgr(upipe->mgr);
     struct upipe *super = upipe_grid_to_upipe(upipe_grid);
 
+    /* outputs check the published flow def and hold their input */
+    if (upipe_grid->threaded)
+        return uprobe_throw_next(uprobe, upipe, event, args);
+
     switch (event) {
         case UPROBE_NEW_FLOW_DEF: {
             struct upipe *output = NULL;
@@ -282,6 +488,129 @@ static int upipe_grid_in_catch(struct uprobe *uprobe,
     return uprobe_throw_next(uprobe, upipe, event, args);
 }
 
+/** @internal @This sets the input flow def for real.
+ * @This applies a flow def pushed by the set flow def control command.
+ * @see upipe_grid_in_set_flow_def.
+ *
+ * @param upipe description structure of the pipe
+ * @param flow_def flow format definition
+ */
+static void upipe_grid_in_set_flow_def_real(struct upipe *upipe,
+                                            struct uref *flow_def)
+{
+    struct upipe_grid_in *upipe_grid_in = upipe_grid_in_from_upipe(upipe);
+    upipe_grid_in->flow_def_gen++;
+    upipe_grid_in_store_flow_def_input(upipe, flow_def);
+    upipe_throw_new_flow_def(upipe, flow_def);
+}
+
+/** @internal @This publishes the latest frame of an input in threaded mode.
+ * The frame is written to a slot that is neither current nor read by an
+ * output, which then becomes the current one. Outputs only hold a slot for
+ * the time of a buffer duplication, so if all the other slots are still
+ * read, the frame is dropped instead of waiting for them.
+ *
+ * @param upipe description structure of the input pipe
+ * @param uref frame buffer
+ * @param pts system pts of the frame
+ */
+static void upipe_grid_in_publish(struct upipe *upipe, struct uref *uref,
+                                  uint64_t pts)
+{
+    struct upipe_grid_in *upipe_grid_in = upipe_grid_in_from_upipe(upipe);
+
+    if (unlikely(!upipe_grid_in->flow_def)) {
+        upipe_warn(upipe, "no input flow def set");
+        uref_free(uref);
+        return;
+    }
+
+    uint32_t current = uatomic_load(&upipe_grid_in->slot);
+    struct upipe_grid_slot *slot = NULL;
+    uint32_t index;
+    for (index = 0; index < SLOTS; index++) {
+        uint32_t expected = 0;
+        if (index != current &&
+            uatomic_compare_exchange(&upipe_grid_in->slots[index].state,
+                                     &expected, SLOT_WRITING)) {
+            slot = &upipe_grid_in->slots[index];
+            break;
+        }
+    }
+    if (unlikely(!slot)) {
+        upipe_verbose(upipe, "outputs are busy, dropping frame");
+        uref_free(uref);
+        return;
+    }
+
+    if (!slot->frame.flow_def ||
+        slot->flow_def_gen != upipe_grid_in->flow_def_gen) {
+        struct uref *flow_def = uref_dup(upipe_grid_in->flow_def);
+        if (unlikely(!flow_def)) {
+            uatomic_fetch_sub(&slot->state, SLOT_WRITING);
+            uref_free(uref);
+            upipe_throw_fatal(upipe, UBASE_ERR_ALLOC);
+            return;
+        }
+        uref_free(slot->frame.flow_def);
+        slot->frame.flow_def = flow_def;
+        slot->flow_def_gen = upipe_grid_in->flow_def_gen;
+    }
+    uref_free(slot->frame.uref);
+    slot->frame.uref = uref;
+    slot->frame.pts = pts;
+    /* full barrier, so that the frame is written before it may be read */
+    uatomic_fetch_sub(&slot->state, SLOT_WRITING);
+    uatomic_store(&upipe_grid_in->slot, index);
+}
+
+/** @internal @This tries to acquire the current slot of an input in
+ * threaded mode.
+ *
+ * @param upipe_grid_in private structure of the input pipe
+ * @return the current slot, or NULL if it is being rewritten
+ */
+static struct upipe_grid_slot *
+    upipe_grid_in_try_acquire_slot(struct upipe_grid_in *upipe_grid_in)
+{
+    uint32_t index = uatomic_load(&upipe_grid_in->slot);
+    struct upipe_grid_slot *slot = &upipe_grid_in->slots[index];
+    /* the input does not rewrite a slot read by an output, and the full
+     * barrier keeps the frame from being read before */
+    if (likely(!(uatomic_fetch_add(&slot->state, 1) & SLOT_WRITING)))
+        return slot;
+    uatomic_fetch_sub(&slot->state, 1);
+    return NULL;
+}
+
+/** @internal @This acquires the latest frame published by an input in
+ * threaded mode. The slot must be released with
+ * @ref upipe_grid_in_release_slot.
+ *
+ * @param upipe_grid_in private structure of the input pipe
+ * @return the current slot, or NULL if the input rewrote it twice meanwhile
+ */
+static struct upipe_grid_slot *
+    upipe_grid_in_acquire_slot(struct upipe_grid_in *upipe_grid_in)
+{
+    struct upipe_grid_slot *slot =
+        upipe_grid_in_try_acquire_slot(upipe_grid_in);
+    if (unlikely(!slot))
+        /* a newer frame was published before the slot was rewritten */
+        slot = upipe_grid_in_try_acquire_slot(upipe_grid_in);
+    return slot;
+}
+
+/** @internal @This releases a slot acquired by
+ * @ref upipe_grid_in_acquire_slot.
+ *
+ * @param slot slot to release
+ */
+static inline void upipe_grid_in_release_slot(struct upipe_grid_slot *slot)
+{
+    uatomic_fetch_sub(&slot->state, 1);
+}
+
 /** @internal @This handles input buffer from input pipe.
  *
  * @param upipe input pipe description
@@ -300,7 +629,13 @@ static void upipe_grid_in_input(struct upipe *upipe,
     if (unlikely(ubase_check(uref_flow_get_def(uref, NULL)))) {
         upipe_grid_in->latency = 0;
         uref_clock_get_latency(uref, &upipe_grid_in->latency);
-        ulist_add(&upipe_grid_in->urefs, uref_to_uchain(uref));
+        if (upipe_grid->threaded) {
+            upipe_grid_in_set_flow_def_real(upipe, uref);
+            return;
+        }
+        /* a pending flow def is superseded by the new one */
+        uref_free(upipe_grid_in->flow_def_next);
+        upipe_grid_in->flow_def_next = uref;
         return;
     }
 
@@ -333,7 +668,11 @@ static void upipe_grid_in_input(struct upipe *upipe,
     }
 
     upipe_grid_in->last_pts = pts;
-    ulist_add(&upipe_grid_in->urefs, uref_to_uchain(uref));
+    if (upipe_grid->threaded) {
+        upipe_grid_in_publish(upipe, uref, pts);
+        return;
+    }
+    upipe_grid_in_push(upipe, uref, pts);
 
     uint64_t now;
     if (unlikely(!ubase_check(
@@ -342,60 +681,32 @@ static void upipe_grid_in_input(struct upipe *upipe,
         return;
     }
 
-    struct uref *last_flow_def = NULL;
-    struct uchain *uchain;
+    struct upipe_grid_frame *frame;
     uint64_t latency = 0;
     if (upipe_grid_in->flow_def)
         uref_clock_get_latency(upipe_grid_in->flow_def, &latency);
-    while ((uchain = ulist_pop(&upipe_grid_in->urefs))) {
-        struct uref *uref = uref_from_uchain(uchain);
-
-        if (unlikely(ubase_check(uref_flow_get_def(uref, NULL)))) {
-            uref_free(last_flow_def);
-            last_flow_def = uref;
+    while ((frame = upipe_grid_in_peek(upipe_grid_in))) {
+        if (unlikely(frame->flow_def)) {
             latency = 0;
-            uref_clock_get_latency(uref, &latency);
-            continue;
+            uref_clock_get_latency(frame->flow_def, &latency);
         }
 
-        ubase_assert(uref_clock_get_pts_sys(uref, &pts));
-        uint64_t pts_max = pts + latency + upipe_grid->tolerance;
-        if (pts_max >= now) {
-            ulist_unshift(&upipe_grid_in->urefs, uchain);
+        uint64_t pts_max = frame->pts + latency + upipe_grid->tolerance;
+        if (pts_max >= now)
             break;
-        }
 
-        if (ulist_empty(&upipe_grid_in->urefs) &&
-            pts_max + upipe_grid->max_retention >= now) {
-            ulist_unshift(&upipe_grid_in->urefs, uchain);
+        if (upipe_grid_in->count == 1 &&
+            pts_max + upipe_grid->max_retention >= now)
             break;
-        }
 
         upipe_verbose_va(upipe, "drop late frame %"PRIu64"ms, "
                          "latency %"PRIu64"ms "
                          "retention %"PRIu64"ms",
-                         (now - pts) / (UCLOCK_FREQ / 1000),
+                         (now - frame->pts) / (UCLOCK_FREQ / 1000),
                          latency / (UCLOCK_FREQ / 1000),
                          upipe_grid->max_retention / (UCLOCK_FREQ / 1000));
-        uref_free(uref);
+        upipe_grid_in_drop(upipe_grid_in);
     }
-
-    if (last_flow_def)
-        ulist_unshift(&upipe_grid_in->urefs, uref_to_uchain(last_flow_def));
-}
-
-/** @internal @This sets the input flow def for real.
- * @This applies a flow def pushed by the set flow def control command.
- * @see upipe_grid_in_set_flow_def.
- *
- * @param upipe description structure of the pipe
- * @param flow_def flow format definition
- */
-static void upipe_grid_in_set_flow_def_real(struct upipe *upipe,
-                                            struct uref *flow_def)
-{
-    upipe_grid_in_store_flow_def_input(upipe, flow_def);
-    upipe_throw_new_flow_def(upipe, flow_def);
 }
 
 /** @internal @This sets a new flow def to a grid input pipe.
@@ -455,42 +766,35 @@ static void upipe_grid_in_update_pts(struct upipe *upipe, uint64_t next_pts)
         uref_clock_get_latency(flow_def, &latency);
     }
 
-    /* iterarte through the input buffers */
-    struct uchain *uchain, *uchain_tmp;
-    ulist_delete_foreach(&upipe_grid_in->urefs, uchain, uchain_tmp) {
-        struct uref *uref = uref_from_uchain(uchain);
-
-        /* if this is a new flow def, apply it and continue */
-        if (unlikely(ubase_check(uref_flow_get_def(uref, NULL)))) {
-            ulist_delete(uchain);
-            upipe_grid_in_set_flow_def_real(upipe, uref);
+    /* iterate through the retained frames, oldest first */
+    struct upipe_grid_frame *frame;
+    while ((frame = upipe_grid_in_peek(upipe_grid_in))) {
+        /* if there is a new flow def, apply it */
+        if (unlikely(frame->flow_def)) {
+            struct uref *frame_flow_def = frame->flow_def;
+            frame->flow_def = NULL;
+            upipe_grid_in_set_flow_def_real(upipe, frame_flow_def);
             /* update current input latency */
             flow_def = upipe_grid_in->flow_def;
             latency = 0;
             uref_clock_get_latency(flow_def, &latency);
-            continue;
         }
 
         if (unlikely(!flow_def)) {
             /* no input flow definition set, drop */
             upipe_warn(upipe, "no input flow def set");
-            ulist_delete(uchain);
-            uref_free(uref);
+            upipe_grid_in_drop(upipe_grid_in);
             continue;
         }
 
         /* if late buffer, free it and continue */
-        uint64_t pts;
-        /* checked in upipe_grid_in_input */
-        ubase_assert(uref_clock_get_pts_sys(uref, &pts));
-
-        uint64_t retention = ulist_is_last(&upipe_grid_in->urefs, uchain) ?
+        uint64_t pts = frame->pts;
+        uint64_t retention = upipe_grid_in->count == 1 ?
             upipe_grid->max_retention : 0;
 
         if (pts + latency + upipe_grid->tolerance + retention < next_pts) {
             upipe_verbose_va(upipe, "drop uref pts %"PRIu64, pts);
-            ulist_delete(uchain);
-            uref_free(uref);
+            upipe_grid_in_drop(upipe_grid_in);
             continue;
         }
 
@@ -505,6 +809,13 @@ static void upipe_grid_in_update_pts(struct upipe *upipe, uint64_t next_pts)
         break;
     }
 
+    /* apply a flow def received after the last expired frame */
+    if (!upipe_grid_in->count && upipe_grid_in->flow_def_next) {
+        struct uref *flow_def_next = upipe_grid_in->flow_def_next;
+        upipe_grid_in->flow_def_next = NULL;
+        upipe_grid_in_set_flow_def_real(upipe, flow_def_next);
+    }
+
     upipe_grid_in->last_update = next_pts;
 }
 
@@ -540,10 +851,18 @@ static int upipe_grid_in_control(struct upipe *upipe,
  */
 static void upipe_grid_out_free(struct upipe *upipe)
 {
+    struct upipe_grid_out *upipe_grid_out = upipe_grid_out_from_upipe(upipe);
+    struct upipe_grid *upipe_grid = upipe_grid_from_out_mgr(upipe->mgr);
+
     upipe_throw_dead(upipe);
 
+    if (upipe_grid->threaded && upipe_grid_out->input)
+        upipe_grid_in_release_urefcount_real(upipe_grid_out->input);
+    uref_free(upipe_grid_out->slot_flow_def);
     upipe_grid_out_clean_flow_def(upipe);
+    upipe_grid_lock(upipe_grid);
     upipe_grid_out_clean_sub(upipe);
+    upipe_grid_unlock(upipe_grid);
     upipe_grid_out_clean_output(upipe);
     upipe_grid_out_clean_urefcount(upipe);
 
@@ -563,6 +882,7 @@ static struct upipe *upipe_grid_out_alloc(struct upipe_mgr *mgr,
                                           uint32_t signature,
                                           va_list args)
 {
+    struct upipe_grid *upipe_grid = upipe_grid_from_out_mgr(mgr);
     struct upipe *upipe =
         upipe_grid_out_alloc_void(mgr, uprobe, signature, args);
     if (unlikely(!upipe))
@@ -570,7 +890,9 @@ static struct upipe *upipe_grid_out_alloc(struct upipe_mgr *mgr,
 
     upipe_grid_out_init_urefcount(upipe);
     upipe_grid_out_init_output(upipe);
+    upipe_grid_lock(upipe_grid);
     upipe_grid_out_init_sub(upipe);
+    upipe_grid_unlock(upipe_grid);
     upipe_grid_out_init_flow_def(upipe);
 
     struct upipe_grid_out *upipe_grid_out =
@@ -582,6 +904,8 @@ static struct upipe *upipe_grid_out_alloc(struct upipe_mgr *mgr,
     upipe_grid_out->input = NULL;
     upipe_grid_out->tolerance = DEFAULT_TOLERANCE;
     upipe_grid_out->last_input_pts = UINT64_MAX;
+    upipe_grid_out->slot_flow_def = NULL;
+    upipe_grid_out->slot_flow_def_gen = 0;
 
     upipe_throw_ready(upipe);
 
@@ -696,29 +1020,17 @@ static int upipe_grid_out_throw_update_pts(struct upipe *upipe, uint64_t pts)
                        UPIPE_GRID_OUT_SIGNATURE, pts);
 }
 
-/** @internal @This extracts picture data from selected input pipe.
+/** @internal @This extracts picture data from an input frame.
  *
  * @param upipe description structure of the output pipe
  * @param uref picture buffer filled with input picture data
+ * @param frame input frame
  * @return an error code
  */
-static int upipe_grid_out_extract_pic(struct upipe *upipe, struct uref *uref)
+static int upipe_grid_out_extract_pic(struct upipe *upipe, struct uref *uref,
+                                      const struct upipe_grid_frame *frame)
 {
-    struct upipe_grid_out *upipe_grid_out = upipe_grid_out_from_upipe(upipe);
-    struct upipe_grid_in *upipe_grid_in =
-        upipe_grid_in_from_upipe(upipe_grid_out->input);
-
-    uint64_t pts = 0;
-    /* checked in upipe_grid_out_input */
-    ubase_assert(uref_clock_get_pts_sys(uref, &pts));
-
-    /* get first picture */
-    struct uchain *uchain = ulist_peek(&upipe_grid_in->urefs);
-    if (unlikely(!uchain)) {
-        upipe_warn(upipe, "no input buffer available");
-        return UBASE_ERR_INVALID;
-    }
-    struct uref *input_uref = uref_from_uchain(uchain);
+    struct uref *input_uref = frame->uref;
 
     /* duplicate picture buffer */
     struct ubuf *ubuf = ubuf_dup(input_uref->ubuf);
@@ -734,36 +1046,24 @@ static int upipe_grid_out_extract_pic(struct upipe *upipe, struct uref *uref)
     return UBASE_ERR_NONE;
 }
 
-/** @internal @This extracts sound data from selected input pipe to an uref.
+/** @internal @This extracts sound data from an input frame to an uref.
  *
  * @param upipe description structure of the output pipe
  * @param uref sound buffer filled with input sound data
+ * @param frame input frame
  * @return an error code
  */
-static int upipe_grid_out_extract_sound(struct upipe *upipe, struct uref *uref)
+static int upipe_grid_out_extract_sound(struct upipe *upipe, struct uref *uref,
+                                        const struct upipe_grid_frame *frame)
 {
     struct upipe_grid_out *upipe_grid_out = upipe_grid_out_from_upipe(upipe);
-    struct upipe_grid_in *upipe_grid_in =
-        upipe_grid_in_from_upipe(upipe_grid_out->input);
-    struct uref *input_flow_def = upipe_grid_in->flow_def;
+    struct uref *input_uref = frame->uref;
+    uint64_t input_pts = frame->pts;
     uint64_t next_pts;
-    int ret = UBASE_ERR_NONE;
 
-    /* checked before */
-    assert(input_flow_def);
     /* checked before */
     ubase_assert(uref_clock_get_pts_sys(uref, &next_pts));
 
-    struct uchain *uchain = ulist_peek(&upipe_grid_in->urefs);
-    if (unlikely(!uchain)) {
-        upipe_warn(upipe, "no input buffer available");
-        return UBASE_ERR_INVALID;
-    }
-    struct uref *input_uref = uref_from_uchain(uchain);
-
-    uint64_t input_pts;
-    /* checked before */
-    ubase_assert(uref_clock_get_pts_sys(input_uref, &input_pts));
     if (input_pts > next_pts + upipe_grid_out->tolerance) {
         upipe_dbg(upipe, "next input in the futur");
         return UBASE_ERR_INVALID;
@@ -785,6 +1085,87 @@ static int upipe_grid_out_extract_sound(struct upipe *upipe, struct uref *uref)
     return UBASE_ERR_NONE;
 }
 
+/** @internal @This extracts data from an input frame.
+ *
+ * @param upipe description structure of the output pipe
+ * @param uref buffer filled with input data
+ * @param flow_def flow definition of the frame
+ * @param frame input frame
+ * @return an error code
+ */
+static int upipe_grid_out_extract_frame(struct upipe *upipe, struct uref *uref,
+                                        struct uref *flow_def,
+                                        const struct upipe_grid_frame *frame)
+{
+    if (ubase_check(uref_flow_match_def(flow_def, UREF_PIC_FLOW_DEF)))
+        return upipe_grid_out_extract_pic(upipe, uref, frame);
+    else if (ubase_check(uref_flow_match_def(flow_def, UREF_SOUND_FLOW_DEF)))
+        return upipe_grid_out_extract_sound(upipe, uref, frame);
+
+    const char *def = "(none)";
+    uref_flow_get_def(flow_def, &def);
+    upipe_warn_va(upipe, "invalid input %s", def);
+    return UBASE_ERR_UNHANDLED;
+}
+
+/** @internal @This extracts data from the latest frame published by the
+ * selected input in threaded mode.
+ *
+ * @param upipe description structure of the output pipe
+ * @param uref buffer filled with input data
+ * @return an error code
+ */
+static int upipe_grid_out_extract_slot(struct upipe *upipe, struct uref *uref)
+{
+    struct upipe_grid_out *upipe_grid_out = upipe_grid_out_from_upipe(upipe);
+    struct upipe_grid *upipe_grid = upipe_grid_from_out_mgr(upipe->mgr);
+    struct upipe_grid_in *upipe_grid_in =
+        upipe_grid_in_from_upipe(upipe_grid_out->input);
+    int ret = UBASE_ERR_INVALID;
+
+    uint64_t pts = 0;
+    /* checked in upipe_grid_out_input */
+    ubase_assert(uref_clock_get_pts_sys(uref, &pts));
+
+    struct upipe_grid_slot *slot = upipe_grid_in_acquire_slot(upipe_grid_in);
+    if (unlikely(!slot)) {
+        upipe_warn(upipe, "input buffer is being replaced");
+        return UBASE_ERR_BUSY;
+    }
+    struct upipe_grid_frame *frame = &slot->frame;
+    if (unlikely(!frame->uref)) {
+        upipe_warn(upipe, "no input buffer available");
+        goto upipe_grid_out_extract_slot_err;
+    }
+
+    uint64_t latency = 0;
+    uref_clock_get_latency(frame->flow_def, &latency);
+    if (frame->pts + latency + upipe_grid->tolerance +
+        upipe_grid->max_retention < pts) {
+        upipe_warn(upipe, "no input buffer available");
+        goto upipe_grid_out_extract_slot_err;
+    }
+
+    if (!upipe_grid_out->slot_flow_def ||
+        upipe_grid_out->slot_flow_def_gen != slot->flow_def_gen) {
+        struct uref *flow_def = uref_dup(frame->flow_def);
+        if (unlikely(!flow_def)) {
+            ret = UBASE_ERR_ALLOC;
+            goto upipe_grid_out_extract_slot_err;
+        }
+        uref_free(upipe_grid_out->slot_flow_def);
+        upipe_grid_out->slot_flow_def = flow_def;
+        upipe_grid_out->slot_flow_def_gen = slot->flow_def_gen;
+        upipe_grid_out->flow_def_uptodate = false;
+    }
+
+    ret = upipe_grid_out_extract_frame(upipe, uref, frame->flow_def, frame);
+
+upipe_grid_out_extract_slot_err:
+    upipe_grid_in_release_slot(slot);
+    return ret;
+}
+
 /** @internal @This extracts data from the selected input pipe.
  *
  * @param upipe description structure of the output pipe
@@ -794,28 +1175,30 @@ static int upipe_grid_out_extract_sound(struct upipe *upipe, struct uref *uref)
 static int upipe_grid_out_extract_input(struct upipe *upipe, struct uref *uref)
 {
     struct upipe_grid_out *upipe_grid_out = upipe_grid_out_from_upipe(upipe);
+    struct upipe_grid *upipe_grid = upipe_grid_from_out_mgr(upipe->mgr);
 
     if (!upipe_grid_out->input) {
         upipe_verbose(upipe, "no input set");
         return UBASE_ERR_INVALID;
     }
 
+    if (upipe_grid->threaded)
+        return upipe_grid_out_extract_slot(upipe, uref);
+
     struct upipe_grid_in *upipe_grid_in =
         upipe_grid_in_from_upipe(upipe_grid_out->input);
     struct uref *input_flow_def = upipe_grid_in->flow_def;
     if (unlikely(!input_flow_def))
         return UBASE_ERR_INVALID;
 
-    if (ubase_check(uref_flow_match_def(input_flow_def, UREF_PIC_FLOW_DEF)))
-        return upipe_grid_out_extract_pic(upipe, uref);
-    else if (ubase_check(uref_flow_match_def(input_flow_def,
-                                             UREF_SOUND_FLOW_DEF)))
-        return upipe_grid_out_extract_sound(upipe, uref);
+    /* get first frame */
+    struct upipe_grid_frame *frame = upipe_grid_in_peek(upipe_grid_in);
+    if (unlikely(!frame)) {
+        upipe_warn(upipe, "no input buffer available");
+        return UBASE_ERR_INVALID;
+    }
 
-    const char *def = "(none)";
-    uref_flow_get_def(input_flow_def, &def);
-    upipe_warn_va(upipe, "invalid input %s", def);
-    return UBASE_ERR_UNHANDLED;
+    return upipe_grid_out_extract_frame(upipe, uref, input_flow_def, frame);
 }
 
 /** @internal @This handles grid output pipe input buffers.
@@ -830,6 +1213,7 @@ static void upipe_grid_out_input(struct upipe *upipe,
 {
     struct upipe_grid_out *upipe_grid_out =
         upipe_grid_out_from_upipe(upipe);
+    struct upipe_grid *upipe_grid = upipe_grid_from_out_mgr(upipe->mgr);
     bool sub_attached = false;
 
     /* check the input flow def */
@@ -878,7 +1262,8 @@ output:
         if (sub_attached) {
             /* import input flow def */
             upipe_grid_out_import_format(
-                upipe, flow_def, upipe_grid_in->flow_def);
+                upipe, flow_def, upipe_grid->threaded ?
+                upipe_grid_out->slot_flow_def : upipe_grid_in->flow_def);
         }
 
         /* store new flow def */
@@ -922,9 +1307,20 @@ static int upipe_grid_out_set_input_real(struct upipe *upipe,
 {
     struct upipe_grid_out *upipe_grid_out =
         upipe_grid_out_from_upipe(upipe);
+    struct upipe_grid *upipe_grid = upipe_grid_from_out_mgr(upipe->mgr);
 
     upipe_notice_va(upipe, "switch input %p -> %p",
                     upipe_grid_out->input, input);
+    if (upipe_grid->threaded) {
+        /* the input may be released from another thread, so only its
+         * published frames are kept until the output switches */
+        if (input)
+            upipe_grid_in_use_urefcount_real(input);
+        if (upipe_grid_out->input)
+            upipe_grid_in_release_urefcount_real(upipe_grid_out->input);
+        uref_free(upipe_grid_out->slot_flow_def);
+        upipe_grid_out->slot_flow_def = NULL;
+    }
     upipe_grid_out->input = input;
     upipe_grid_out->flow_def_uptodate = false;
     upipe_grid_out->last_input_pts = UINT64_MAX;
@@ -1098,6 +1494,8 @@ static void upipe_grid_free(struct upipe *upipe)
 {
     upipe_throw_dead(upipe);
 
+    struct upipe_grid *upipe_grid = upipe_grid_from_upipe(upipe);
+    umutex_release(upipe_grid->mutex);
     upipe_grid_clean_uclock(upipe);
     upipe_grid_clean_sub_outputs(upipe);
     upipe_grid_clean_sub_inputs(upipe);
@@ -1146,6 +1544,9 @@ static struct upipe *upipe_grid_alloc(struct upipe_mgr *mgr,
     upipe_grid->last_update_pts = 0;
     upipe_grid->next_update = 0;
     upipe_grid->max_retention = MAX_RETENTION;
+    upipe_grid->input_capacity = DEFAULT_INPUT_CAPACITY;
+    upipe_grid->threaded = false;
+    upipe_grid->mutex = NULL;
 
     upipe_throw_ready(upipe);
 
@@ -1181,6 +1582,44 @@ static int upipe_grid_set_max_retention_real(struct upipe *upipe,
     return UBASE_ERR_NONE;
 }
 
+/** @internal @This sets the maximum number of frames retained by new
+ * inputs.
+ *
+ * @param upipe description structure of the pipe
+ * @param capacity maximum number of retained frames per input
+ * @return an error code
+ */
+static int upipe_grid_set_input_capacity_real(struct upipe *upipe,
+                                              unsigned int capacity)
+{
+    struct upipe_grid *upipe_grid = upipe_grid_from_upipe(upipe);
+    if (!capacity || capacity > UINT_MAX / 2 + 1)
+        return UBASE_ERR_INVALID;
+    upipe_grid->input_capacity = capacity;
+    return UBASE_ERR_NONE;
+}
+
+/** @internal @This switches the grid to threaded mode.
+ *
+ * @param upipe description structure of the pipe
+ * @param mutex mutual exclusion primitives for the sub pipe lists, or NULL
+ * @return an error code
+ */
+static int upipe_grid_set_threaded_real(struct upipe *upipe,
+                                        struct umutex *mutex)
+{
+    struct upipe_grid *upipe_grid = upipe_grid_from_upipe(upipe);
+    if (!ulist_empty(&upipe_grid->inputs) ||
+        !ulist_empty(&upipe_grid->outputs)) {
+        upipe_warn(upipe, "cannot switch to threaded mode with sub pipes");
+        return UBASE_ERR_BUSY;
+    }
+    umutex_release(upipe_grid->mutex);
+    upipe_grid->mutex = umutex_use(mutex);
+    upipe_grid->threaded = true;
+    return UBASE_ERR_NONE;
+}
+
 /** @internal @This handles control command of the grid pipe.
  *
  * @param upipe description structure of the pipe
@@ -1207,6 +1646,16 @@ static int upipe_grid_control(struct upipe *upipe,
             uint64_t max_retention = va_arg(args, uint64_t);
             return upipe_grid_set_max_retention_real(upipe, max_retention);
         }
+        case UPIPE_GRID_SET_INPUT_CAPACITY: {
+            UBASE_SIGNATURE_CHECK(args, UPIPE_GRID_SIGNATURE);
+            unsigned int capacity = va_arg(args, unsigned int);
+            return upipe_grid_set_input_capacity_real(upipe, capacity);
+        }
+        case UPIPE_GRID_SET_THREADED: {
+            UBASE_SIGNATURE_CHECK(args, UPIPE_GRID_SIGNATURE);
+            struct umutex *mutex = va_arg(args, struct umutex *);
+            return upipe_grid_set_threaded_real(upipe, mutex);
+        }
     }
 
     return UBASE_ERR_UNHANDLED;
@@ -1222,6 +1671,10 @@ static int upipe_grid_update_pts(struct upipe *upipe, uint64_t next_pts)
 {
     struct upipe_grid *upipe_grid = upipe_grid_from_upipe(upipe);
 
+    /* inputs only keep their latest frame in threaded mode */
+    if (upipe_grid->threaded)
+        return UBASE_ERR_NONE;
+
     if (upipe_grid->last_update_pts &&
         upipe_grid->last_update_pts + upipe_grid->next_update >= next_pts)
         return UBASE_ERR_NONE;
@@ -28,15 +28,34 @@
  */
 
 #include <upipe/ubase.h>
+#include <upipe/uatomic.h>
+#include <upipe/ueventfd.h>
 #include <upipe/uqueue.h>
+#include <upipe/uref_attr.h>
 #include <upipe/upipe.h>
 
 #include <assert.h>
 
+UREF_ATTR_UNSIGNED(queue, date, "queue.date", queue sink input date)
+
 /** @internal @This is the structure exported from source to sinks. */
 struct upipe_queue {
     /** max length of the queue */
     unsigned int max_length;
+    /** number of urefs accepted in the queue, lower than max_length in
+     * elastic mode */
+    uatomic_uint32_t limit;
+    /** non-zero if a sink waits for the queue to go below its limit */
+    uatomic_uint32_t limited;
+    /** ueventfd triggered when the queue goes below its limit */
+    struct ueventfd event_limit;
+    /** high threshold of the source, or 0 */
+    uatomic_uint32_t high;
+    /** non-zero if the source was told that the high threshold was reached */
+    uatomic_uint32_t above;
+    /** ueventfd triggered when a sink makes the queue reach the high
+     * threshold */
+    struct ueventfd event_high;
     /** uref queue */
     struct uqueue uqueue;
     /** out of band downstream queue */
@@ -59,6 +78,73 @@ static inline struct upipe_queue *upipe_queue(struct upipe *upipe)
     return container_of(upipe, struct upipe_queue, upipe);
 }
 
+/** @internal @This checks if the queue has reached the number of urefs
+ * accepted in elastic mode. The limit is enforced by the sinks rather than
+ * by @ref uqueue_push, so that other users of uqueue do not pay for it.
+ *
+ * @param upipe_queue pointer to the upipe_queue structure
+ * @return true if no uref may be pushed
+ */
+static inline bool upipe_queue_limited(struct upipe_queue *upipe_queue)
+{
+    if (likely(uatomic_load(&upipe_queue->limit) >= upipe_queue->max_length))
+        return false;
+    /* the counter may briefly underflow if an element is popped before its
+     * push has been accounted */
+    if ((int32_t)uqueue_length(&upipe_queue->uqueue) <
+        (int32_t)uatomic_load(&upipe_queue->limit))
+        return false;
+
+    /* consume previous wake-ups before signalling that we wait, so that any
+     * wake-up sent by the source after seeing the flag is noticed */
+    ueventfd_read(&upipe_queue->event_limit);
+    uatomic_store(&upipe_queue->limited, 1);
+
+    /* double-check, in case the source popped before seeing the flag */
+    if (likely((int32_t)uqueue_length(&upipe_queue->uqueue) >=
+               (int32_t)uatomic_load(&upipe_queue->limit)))
+        return true;
+
+    /* another sink may have been waiting as well */
+    ueventfd_write(&upipe_queue->event_limit);
+    return false;
+}
+
+/** @internal @This wakes up the sinks waiting for the queue to go below its
+ * limit. It is called by the source after popping a uref.
+ *
+ * @param upipe_queue pointer to the upipe_queue structure
+ */
+static inline void upipe_queue_unlimit(struct upipe_queue *upipe_queue)
+{
+    if (likely(!uatomic_load(&upipe_queue->limited)) ||
+        (int32_t)uqueue_length(&upipe_queue->uqueue) >=
+        (int32_t)uatomic_load(&upipe_queue->limit))
+        return;
+
+    uatomic_store(&upipe_queue->limited, 0);
+    ueventfd_write(&upipe_queue->event_limit);
+}
+
+/** @internal @This wakes up the source when a push made the queue reach its
+ * high threshold, so that the event is thrown even if the source does not
+ * pop anymore. It is called by the sinks after pushing a uref.
+ *
+ * @param upipe_queue pointer to the upipe_queue structure
+ */
+static inline void upipe_queue_check_high(struct upipe_queue *upipe_queue)
+{
+    uint32_t high = uatomic_load(&upipe_queue->high);
+    if (likely(!high) ||
+        (int32_t)uqueue_length(&upipe_queue->uqueue) < (int32_t)high)
+        return;
+
+    /* only the first sink seeing the threshold wakes up the source */
+    uint32_t above = 0;
+    if (uatomic_compare_exchange(&upipe_queue->above, &above, 1))
+        ueventfd_write(&upipe_queue->event_high);
+}
+
 /** @internal @This is a super-set of @ref urequest. */
 struct upipe_queue_request {
     /** refcount management structure */
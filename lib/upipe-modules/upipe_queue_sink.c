@@ -31,6 +31,7 @@
 #include <upipe/ulist.h>
 #include <upipe/uqueue.h>
 #include <upipe/uprobe.h>
+#include <upipe/uclock.h>
 #include <upipe/uref.h>
 #include <upipe/upump.h>
 #include <upipe/upump_blocker.h>
@@ -40,6 +41,7 @@
 #include <upipe/upipe_helper_uref_mgr.h>
 #include <upipe/upipe_helper_upump_mgr.h>
 #include <upipe/upipe_helper_upump.h>
+#include <upipe/upipe_helper_uclock.h>
 #include <upipe/upipe_helper_input.h>
 #include <upipe-modules/upipe_queue_sink.h>
 #include <upipe-modules/upipe_queue_source.h>
@@ -70,8 +72,16 @@ struct upipe_qsink {
     struct upump_mgr *upump_mgr;
     /** write watcher */
     struct upump *upump;
+    /** watcher of the limit of the queue in elastic mode */
+    struct upump *upump_limit;
+    /** true if the last output failed because of the limit of the queue */
+    bool limited;
     /** oob watcher */
     struct upump *upump_oob;
+    /** uclock structure, if not NULL the input date of urefs is recorded */
+    struct uclock *uclock;
+    /** uclock request */
+    struct urequest uclock_request;
 
     /** pseudo-output */
     struct upipe *output;
@@ -101,7 +111,10 @@ UPIPE_HELPER_UPIPE(upipe_qsink, upipe, UPIPE_QSINK_SIGNATURE)
 UPIPE_HELPER_UREFCOUNT(upipe_qsink, urefcount, upipe_qsink_free)
 UPIPE_HELPER_UPUMP_MGR(upipe_qsink, upump_mgr)
 UPIPE_HELPER_UPUMP(upipe_qsink, upump, upump_mgr)
+UPIPE_HELPER_UPUMP(upipe_qsink, upump_limit, upump_mgr)
 UPIPE_HELPER_UPUMP(upipe_qsink, upump_oob, upump_mgr)
+UPIPE_HELPER_UCLOCK(upipe_qsink, uclock, uclock_request, NULL,
+                    upipe_throw_provide_request, NULL)
 UPIPE_HELPER_INPUT(upipe_qsink, urefs, nb_urefs, max_urefs, blockers, upipe_qsink_output)
 
 /** @internal @This allocates a queue sink pipe.
@@ -131,9 +144,12 @@ static struct upipe *_upipe_qsink_alloc(struct upipe_mgr *mgr,
     upipe_qsink_init_urefcount(upipe);
     upipe_qsink_init_upump_mgr(upipe);
     upipe_qsink_init_upump(upipe);
+    upipe_qsink_init_upump_limit(upipe);
     upipe_qsink_init_upump_oob(upipe);
+    upipe_qsink_init_uclock(upipe);
     upipe_qsink_init_input(upipe);
     upipe_qsink->qsrc = upipe_use(qsrc);
+    upipe_qsink->limited = false;
     upipe_qsink->flow_def = NULL;
     upipe_qsink->flow_def_sent = false;
     upipe_qsink->output = NULL;
@@ -159,8 +175,30 @@ static bool upipe_qsink_output(struct upipe *upipe, struct uref *uref,
                                struct upump **upump_p)
 {
     struct upipe_qsink *upipe_qsink = upipe_qsink_from_upipe(upipe);
-    return uqueue_push(&upipe_queue(upipe_qsink->qsrc)->uqueue,
-                       uref_to_uchain(uref));
+    struct upipe_queue *queue = upipe_queue(upipe_qsink->qsrc);
+    upipe_qsink->limited = upipe_queue_limited(queue);
+    if (unlikely(upipe_qsink->limited) ||
+        unlikely(!uqueue_push(&queue->uqueue, uref_to_uchain(uref))))
+        return false;
+    upipe_queue_check_high(queue);
+    return true;
+}
+
+/** @internal @This starts the watcher matching the reason why the queue
+ * could not be written.
+ *
+ * @param upipe description structure of the pipe
+ */
+static void upipe_qsink_wait(struct upipe *upipe)
+{
+    struct upipe_qsink *upipe_qsink = upipe_qsink_from_upipe(upipe);
+    if (upipe_qsink->limited) {
+        upump_stop(upipe_qsink->upump);
+        upump_start(upipe_qsink->upump_limit);
+    } else {
+        upump_stop(upipe_qsink->upump_limit);
+        upump_start(upipe_qsink->upump);
+    }
 }
 
 /** @internal @This is called when the queue can be written again.
@@ -171,17 +209,20 @@ static bool upipe_qsink_output(struct upipe *upipe, struct uref *uref,
 static void upipe_qsink_watcher(struct upump *upump)
 {
     struct upipe *upipe = upump_get_opaque(upump, struct upipe *);
+    struct upipe_qsink *upipe_qsink = upipe_qsink_from_upipe(upipe);
     upipe_qsink_output_input(upipe);
     upipe_qsink_unblock_input(upipe);
     if (upipe_qsink_check_input(upipe)) {
-        upump_stop(upump);
+        upump_stop(upipe_qsink->upump);
+        upump_stop(upipe_qsink->upump_limit);
         /* All packets have been output, release again the pipe that has been
          * used in @ref upipe_qsink_input. */
         upipe_release(upipe);
-    }
+    } else
+        upipe_qsink_wait(upipe);
 }
 
-/** @internal @This checks and creates the upump watcher to wait for the
+/** @internal @This checks and creates the upump watchers to wait for the
  * availability of the queue.
  *
  * @param upipe description structure of the pipe
@@ -207,6 +248,17 @@ static bool upipe_qsink_check_watcher(struct upipe *upipe)
         return false;
     }
     upipe_qsink_set_upump(upipe, upump);
+
+    upump = ueventfd_upump_alloc(&upipe_queue(upipe_qsink->qsrc)->event_limit,
+                                 upipe_qsink->upump_mgr,
+                                 upipe_qsink_watcher, upipe, upipe->refcount);
+    if (unlikely(upump == NULL)) {
+        upipe_qsink_set_upump(upipe, NULL);
+        upipe_err_va(upipe, "can't create watcher");
+        upipe_throw_fatal(upipe, UBASE_ERR_UPUMP);
+        return false;
+    }
+    upipe_qsink_set_upump_limit(upipe, upump);
     return true;
 }
 
@@ -230,6 +282,15 @@ static void upipe_qsink_input(struct upipe *upipe, struct uref *uref,
         }
     }
 
+    if (upipe_qsink->uclock != NULL) {
+        uint64_t now = uclock_now(upipe_qsink->uclock);
+        if (unlikely(!ubase_check(uref_queue_set_date(uref, now)))) {
+            uref_free(uref);
+            upipe_throw_fatal(upipe, UBASE_ERR_ALLOC);
+            return;
+        }
+    }
+
     if (!upipe_qsink_check_input(upipe)) {
         upipe_qsink_hold_input(upipe, uref);
         upipe_qsink_block_input(upipe, upump_p);
@@ -239,7 +300,7 @@ static void upipe_qsink_input(struct upipe *upipe, struct uref *uref,
             uref_free(uref);
             return;
         }
-        upump_start(upipe_qsink->upump);
+        upipe_qsink_wait(upipe);
         upipe_qsink_hold_input(upipe, uref);
         upipe_qsink_block_input(upipe, upump_p);
         /* Increment upipe refcount to avoid disappearing before all packets
@@ -317,6 +378,7 @@ static int upipe_qsink_flush(struct upipe *upipe)
     if (upipe_qsink_flush_input(upipe)) {
         struct upipe_qsink *upipe_qsink = upipe_qsink_from_upipe(upipe);
         upump_stop(upipe_qsink->upump);
+        upump_stop(upipe_qsink->upump_limit);
         /* All packets have been output, release again the pipe that has been
          * used in @ref upipe_qsink_input. */
         upipe_release(upipe);
@@ -495,7 +557,11 @@ static int _upipe_qsink_control(struct upipe *upipe, int command, va_list args)
         }
         case UPIPE_ATTACH_UPUMP_MGR:
             upipe_qsink_set_upump(upipe, NULL);
+            upipe_qsink_set_upump_limit(upipe, NULL);
             return upipe_qsink_attach_upump_mgr(upipe);
+        case UPIPE_ATTACH_UCLOCK:
+            upipe_qsink_require_uclock(upipe);
+            return UBASE_ERR_NONE;
         case UPIPE_GET_OUTPUT: {
             struct upipe **p = va_arg(args, struct upipe **);
             return upipe_qsink_get_output(upipe, p);
@@ -540,7 +606,7 @@ static int upipe_qsink_control(struct upipe *upipe, int command, va_list args)
     struct upipe_qsink *upipe_qsink = upipe_qsink_from_upipe(upipe);
     if (unlikely(!upipe_qsink_check_input(upipe))) {
         upipe_qsink_check_watcher(upipe);
-        upump_start(upipe_qsink->upump);
+        upipe_qsink_wait(upipe);
     }
 
     return UBASE_ERR_NONE;
@@ -564,8 +630,10 @@ static void upipe_qsink_free(struct upipe *upipe)
     upipe_release(upipe_qsink->output);
     uref_free(upipe_qsink->flow_def);
     upipe_qsink_clean_upump(upipe);
+    upipe_qsink_clean_upump_limit(upipe);
     upipe_qsink_clean_upump_oob(upipe);
     upipe_qsink_clean_upump_mgr(upipe);
+    upipe_qsink_clean_uclock(upipe);
     upipe_qsink_clean_input(upipe);
     upipe_qsink_clean_urefcount(upipe);
     upipe_clean(upipe);
@@ -37,6 +37,7 @@
 
 #include <upipe/ubase.h>
 #include <upipe/uprobe.h>
+#include <upipe/uclock.h>
 #include <upipe/uref.h>
 #include <upipe/upump.h>
 #include <upipe/upipe.h>
@@ -45,6 +46,7 @@
 #include <upipe/upipe_helper_output.h>
 #include <upipe/upipe_helper_upump_mgr.h>
 #include <upipe/upipe_helper_upump.h>
+#include <upipe/upipe_helper_uclock.h>
 #include <upipe-modules/upipe_queue_source.h>
 
 #include "upipe_queue.h"
@@ -58,6 +60,9 @@
 
 /** maximum length of out of band queues */
 #define OOB_QUEUES 255
+/** number of urefs output before the elastic mode considers shrinking the
+ * queue */
+#define ELASTIC_WINDOW 256
 
 /** @internal @This is the private context of a queue source pipe. */
 struct upipe_qsrc {
@@ -70,6 +75,34 @@ struct upipe_qsrc {
     struct upump *upump;
     /** oob watcher */
     struct upump *upump_oob;
+    /** watcher of the high threshold reached by the sinks */
+    struct upump *upump_high;
+    /** uclock structure, if not NULL the latency of the queue is measured */
+    struct uclock *uclock;
+    /** uclock request */
+    struct urequest uclock_request;
+
+    /** maximum number of elements in the queue since the last read */
+    unsigned int high_water;
+    /** time spent in the queue by the last uref, or UINT64_MAX */
+    uint64_t latency;
+    /** maximum time spent in the queue since the last read, or UINT64_MAX */
+    uint64_t max_latency;
+    /** low threshold */
+    unsigned int low;
+    /** high threshold, or 0 */
+    unsigned int high;
+    /** true if the high threshold has been reached */
+    bool above;
+    /** lower bound of the elastic mode, or 0 */
+    unsigned int elastic_min;
+    /** upper bound of the elastic mode */
+    unsigned int elastic_max;
+    /** number of urefs output in the current elastic window */
+    unsigned int elastic_count;
+    /** maximum number of elements in the queue in the current elastic
+     * window */
+    unsigned int elastic_high_water;
 
     /** pipe acting as output */
     struct upipe *output;
@@ -95,6 +128,9 @@ UPIPE_HELPER_OUTPUT(upipe_qsrc, output, flow_def, output_state, request_list)
 UPIPE_HELPER_UPUMP_MGR(upipe_qsrc, upump_mgr)
 UPIPE_HELPER_UPUMP(upipe_qsrc, upump, upump_mgr)
 UPIPE_HELPER_UPUMP(upipe_qsrc, upump_oob, upump_mgr)
+UPIPE_HELPER_UPUMP(upipe_qsrc, upump_high, upump_mgr)
+UPIPE_HELPER_UCLOCK(upipe_qsrc, uclock, uclock_request, NULL,
+                    upipe_throw_provide_request, NULL)
 
 /** @internal @This allocates a queue source pipe.
  *
@@ -133,13 +169,44 @@ static struct upipe *_upipe_qsrc_alloc(struct upipe_mgr *mgr,
         free(upipe_qsrc);
         goto upipe_qsrc_alloc_err;
     }
+    if (unlikely(!ueventfd_init(&upipe_queue(upipe)->event_limit, false))) {
+        uqueue_clean(&upipe_queue(upipe)->uqueue);
+        uqueue_clean(&upipe_queue(upipe)->downstream_oob);
+        uqueue_clean(&upipe_queue(upipe)->upstream_oob);
+        free(upipe_qsrc);
+        goto upipe_qsrc_alloc_err;
+    }
+    if (unlikely(!ueventfd_init(&upipe_queue(upipe)->event_high, false))) {
+        ueventfd_clean(&upipe_queue(upipe)->event_limit);
+        uqueue_clean(&upipe_queue(upipe)->uqueue);
+        uqueue_clean(&upipe_queue(upipe)->downstream_oob);
+        uqueue_clean(&upipe_queue(upipe)->upstream_oob);
+        free(upipe_qsrc);
+        goto upipe_qsrc_alloc_err;
+    }
 
     upipe_qsrc_init_urefcount(upipe);
     upipe_qsrc_init_output(upipe);
     upipe_qsrc_init_upump_mgr(upipe);
     upipe_qsrc_init_upump(upipe);
     upipe_qsrc_init_upump_oob(upipe);
+    upipe_qsrc_init_upump_high(upipe);
+    upipe_qsrc_init_uclock(upipe);
     upipe_qsrc->upipe_queue.max_length = length;
+    uatomic_init(&upipe_qsrc->upipe_queue.limit, length);
+    uatomic_init(&upipe_qsrc->upipe_queue.limited, 0);
+    uatomic_init(&upipe_qsrc->upipe_queue.high, 0);
+    uatomic_init(&upipe_qsrc->upipe_queue.above, 0);
+    upipe_qsrc->high_water = 0;
+    upipe_qsrc->latency = UINT64_MAX;
+    upipe_qsrc->max_latency = UINT64_MAX;
+    upipe_qsrc->low = 0;
+    upipe_qsrc->high = 0;
+    upipe_qsrc->above = false;
+    upipe_qsrc->elastic_min = 0;
+    upipe_qsrc->elastic_max = 0;
+    upipe_qsrc->elastic_count = 0;
+    upipe_qsrc->elastic_high_water = 0;
     upipe_throw_ready(upipe);
 
     return upipe;
@@ -167,6 +234,144 @@ static void upipe_qsrc_input(struct upipe *upipe, struct uref *uref,
     upipe_qsrc_output(upipe, uref, upump_p);
 }
 
+/** @internal @This changes the number of elements accepted in the queue.
+ *
+ * @param upipe description structure of the pipe
+ * @param limit new number of elements accepted
+ */
+static void upipe_qsrc_set_limit(struct upipe *upipe, unsigned int limit)
+{
+    struct upipe_queue *queue = upipe_queue(upipe);
+    unsigned int prev = uatomic_load(&queue->limit);
+    if (limit == prev)
+        return;
+
+    upipe_verbose_va(upipe, "resizing queue to %u", limit);
+    uatomic_store(&queue->limit, limit);
+    if (limit > prev) {
+        /* wake up the blocked sinks */
+        uatomic_store(&queue->limited, 0);
+        ueventfd_write(&queue->event_limit);
+    }
+    upipe_throw(upipe, UPROBE_QSRC_RESIZE, UPIPE_QSRC_SIGNATURE, limit);
+}
+
+/** @internal @This throws the threshold events if the occupancy of the queue
+ * crossed them.
+ *
+ * @param upipe description structure of the pipe
+ * @param length number of elements in the queue
+ */
+static void upipe_qsrc_check_thresholds(struct upipe *upipe,
+                                        unsigned int length)
+{
+    struct upipe_qsrc *upipe_qsrc = upipe_qsrc_from_upipe(upipe);
+    if (!upipe_qsrc->high)
+        return;
+
+    if (!upipe_qsrc->above && length >= upipe_qsrc->high) {
+        upipe_qsrc->above = true;
+        uatomic_store(&upipe_queue(upipe)->above, 1);
+        upipe_throw(upipe, UPROBE_QSRC_HIGH, UPIPE_QSRC_SIGNATURE, length);
+    } else if (upipe_qsrc->above && length <= upipe_qsrc->low) {
+        upipe_qsrc->above = false;
+        uatomic_store(&upipe_queue(upipe)->above, 0);
+        upipe_throw(upipe, UPROBE_QSRC_LOW, UPIPE_QSRC_SIGNATURE, length);
+    }
+}
+
+/** @internal @This is called when a sink made the queue reach the high
+ * threshold, which the source would not notice if it was blocked.
+ *
+ * @param upump description structure of the watcher
+ */
+static void upipe_qsrc_high(struct upump *upump)
+{
+    struct upipe *upipe = upump_get_opaque(upump, struct upipe *);
+    struct upipe_qsrc *upipe_qsrc = upipe_qsrc_from_upipe(upipe);
+    struct upipe_queue *queue = upipe_queue(upipe);
+    ueventfd_read(&queue->event_high);
+    if (upipe_qsrc->above)
+        return;
+
+    /* the queue may have been popped in the meantime, let the sinks wake us
+     * up again */
+    uatomic_store(&queue->above, 0);
+    upipe_qsrc_check_thresholds(upipe, uqueue_length(&queue->uqueue));
+}
+
+/** @internal @This updates the statistics of the queue when a uref is
+ * popped, throws threshold events and adapts the number of elements accepted
+ * in elastic mode.
+ *
+ * @param upipe description structure of the pipe
+ * @param uref popped uref
+ * @param length number of elements in the queue before the uref was popped
+ */
+static void upipe_qsrc_account(struct upipe *upipe, struct uref *uref,
+                               unsigned int length)
+{
+    struct upipe_qsrc *upipe_qsrc = upipe_qsrc_from_upipe(upipe);
+    if (length > upipe_qsrc->high_water)
+        upipe_qsrc->high_water = length;
+
+    uint64_t date;
+    if (ubase_check(uref_queue_get_date(uref, &date))) {
+        /* the sink may have a uclock while the source has none */
+        uref_queue_delete_date(uref);
+        if (upipe_qsrc->uclock != NULL) {
+            uint64_t now = uclock_now(upipe_qsrc->uclock);
+            upipe_qsrc->latency = now > date ? now - date : 0;
+            if (upipe_qsrc->max_latency == UINT64_MAX ||
+                upipe_qsrc->latency > upipe_qsrc->max_latency)
+                upipe_qsrc->max_latency = upipe_qsrc->latency;
+        }
+    }
+
+    upipe_qsrc_check_thresholds(upipe, length);
+
+    if (!upipe_qsrc->elastic_min)
+        return;
+
+    upipe_queue_unlimit(upipe_queue(upipe));
+
+    unsigned int limit = uatomic_load(&upipe_queue(upipe)->limit);
+    if (length >= limit && limit < upipe_qsrc->elastic_max) {
+        /* the queue was full, the sink may be blocked */
+        upipe_qsrc_set_limit(upipe, limit * 2 < upipe_qsrc->elastic_max ?
+                                    limit * 2 : upipe_qsrc->elastic_max);
+        upipe_qsrc->elastic_count = 0;
+        upipe_qsrc->elastic_high_water = 0;
+        return;
+    }
+
+    if (length > upipe_qsrc->elastic_high_water)
+        upipe_qsrc->elastic_high_water = length;
+    if (++upipe_qsrc->elastic_count < ELASTIC_WINDOW)
+        return;
+
+    if (upipe_qsrc->elastic_high_water <= limit / 4 &&
+        limit > upipe_qsrc->elastic_min)
+        upipe_qsrc_set_limit(upipe, limit / 2 > upipe_qsrc->elastic_min ?
+                                    limit / 2 : upipe_qsrc->elastic_min);
+    upipe_qsrc->elastic_count = 0;
+    upipe_qsrc->elastic_high_water = 0;
+}
+
+/** @internal @This pops a uref from the queue and updates the statistics.
+ *
+ * @param upipe description structure of the pipe
+ * @return pointer to uref, or NULL if the queue is empty
+ */
+static struct uref *upipe_qsrc_pop(struct upipe *upipe)
+{
+    unsigned int length = uqueue_length(&upipe_queue(upipe)->uqueue);
+    struct uref *uref = uqueue_pop(&upipe_queue(upipe)->uqueue, struct uref *);
+    if (likely(uref != NULL))
+        upipe_qsrc_account(upipe, uref, length);
+    return uref;
+}
+
 /** @internal @This reads data from the queue and outputs it.
  *
  * @param upump description structure of the read watcher
@@ -175,7 +380,7 @@ static void upipe_qsrc_worker(struct upump *upump)
 {
     struct upipe *upipe = upump_get_opaque(upump, struct upipe *);
     struct upipe_qsrc *upipe_qsrc = upipe_qsrc_from_upipe(upipe);
-    struct uref *uref = uqueue_pop(&upipe_queue(upipe)->uqueue, struct uref *);
+    struct uref *uref = upipe_qsrc_pop(upipe);
     if (likely(uref != NULL))
         upipe_qsrc_input(upipe, uref, &upipe_qsrc->upump);
 }
@@ -268,8 +473,7 @@ static int upipe_qsrc_unregister_request(struct upipe *upipe,
 static void upipe_qsrc_source_end(struct upipe *upipe)
 {
     struct uref *uref;
-    while ((uref = uqueue_pop(&upipe_queue(upipe)->uqueue,
-                              struct uref *)) != NULL)
+    while ((uref = upipe_qsrc_pop(upipe)) != NULL)
         upipe_qsrc_input(upipe, uref, NULL);
 
     upipe_throw_source_end(upipe);
@@ -283,8 +487,7 @@ static void upipe_qsrc_source_end(struct upipe *upipe)
 static void upipe_qsrc_ref_end(struct upipe *upipe)
 {
     struct uref *uref;
-    while ((uref = uqueue_pop(&upipe_queue(upipe)->uqueue,
-                              struct uref *)) != NULL)
+    while ((uref = upipe_qsrc_pop(upipe)) != NULL)
         upipe_qsrc_input(upipe, uref, NULL);
 
     upipe_notice_va(upipe, "freeing queue %p", upipe);
@@ -302,12 +505,20 @@ static void upipe_qsrc_ref_end(struct upipe *upipe)
 
     upipe_qsrc_clean_upump(upipe);
     upipe_qsrc_clean_upump_oob(upipe);
+    upipe_qsrc_clean_upump_high(upipe);
     upipe_qsrc_clean_upump_mgr(upipe);
+    upipe_qsrc_clean_uclock(upipe);
     upipe_qsrc_clean_output(upipe);
 
     uqueue_clean(&upipe_queue(upipe)->uqueue);
     uqueue_clean(&upipe_queue(upipe)->downstream_oob);
     uqueue_clean(&upipe_queue(upipe)->upstream_oob);
+    ueventfd_clean(&upipe_queue(upipe)->event_limit);
+    ueventfd_clean(&upipe_queue(upipe)->event_high);
+    uatomic_clean(&upipe_queue(upipe)->limit);
+    uatomic_clean(&upipe_queue(upipe)->limited);
+    uatomic_clean(&upipe_queue(upipe)->high);
+    uatomic_clean(&upipe_queue(upipe)->above);
 
     upipe_qsrc_clean_urefcount(upipe);
     upipe_clean(upipe);
@@ -380,6 +591,83 @@ static int _upipe_qsrc_get_length(struct upipe *upipe, unsigned int *length_p)
     return UBASE_ERR_NONE;
 }
 
+/** @internal @This returns the statistics of the queue, and resets the
+ * maximum values.
+ *
+ * @param upipe description structure of the pipe
+ * @param high_water_p filled in with the maximum number of elements in the
+ * queue
+ * @param latency_p filled in with the time spent in the queue by the last
+ * uref
+ * @param max_latency_p filled in with the maximum time spent in the queue
+ * @return an error code
+ */
+static int _upipe_qsrc_get_stats(struct upipe *upipe,
+                                 unsigned int *high_water_p,
+                                 uint64_t *latency_p, uint64_t *max_latency_p)
+{
+    struct upipe_qsrc *upipe_qsrc = upipe_qsrc_from_upipe(upipe);
+    if (high_water_p != NULL)
+        *high_water_p = upipe_qsrc->high_water;
+    if (latency_p != NULL)
+        *latency_p = upipe_qsrc->latency;
+    if (max_latency_p != NULL)
+        *max_latency_p = upipe_qsrc->max_latency;
+    upipe_qsrc->high_water = uqueue_length(&upipe_queue(upipe)->uqueue);
+    upipe_qsrc->max_latency = UINT64_MAX;
+    return UBASE_ERR_NONE;
+}
+
+/** @internal @This sets the occupancy thresholds of the queue.
+ *
+ * @param upipe description structure of the pipe
+ * @param low low threshold
+ * @param high high threshold, or 0 to disable the events
+ * @return an error code
+ */
+static int _upipe_qsrc_set_thresholds(struct upipe *upipe,
+                                      unsigned int low, unsigned int high)
+{
+    struct upipe_qsrc *upipe_qsrc = upipe_qsrc_from_upipe(upipe);
+    if (high && (low >= high || high > upipe_qsrc->upipe_queue.max_length))
+        return UBASE_ERR_INVALID;
+    upipe_qsrc->low = low;
+    upipe_qsrc->high = high;
+    upipe_qsrc->above = false;
+    uatomic_store(&upipe_queue(upipe)->above, 0);
+    uatomic_store(&upipe_queue(upipe)->high, high);
+    return UBASE_ERR_NONE;
+}
+
+/** @internal @This sets the bounds of the elastic mode.
+ *
+ * @param upipe description structure of the pipe
+ * @param min_length lower bound, or 0 to disable the elastic mode
+ * @param max_length upper bound
+ * @return an error code
+ */
+static int _upipe_qsrc_set_elastic(struct upipe *upipe,
+                                   unsigned int min_length,
+                                   unsigned int max_length)
+{
+    struct upipe_qsrc *upipe_qsrc = upipe_qsrc_from_upipe(upipe);
+    if (!min_length) {
+        upipe_qsrc->elastic_min = upipe_qsrc->elastic_max = 0;
+        upipe_qsrc_set_limit(upipe, upipe_qsrc->upipe_queue.max_length);
+        return UBASE_ERR_NONE;
+    }
+
+    if (min_length > max_length ||
+        max_length > upipe_qsrc->upipe_queue.max_length)
+        return UBASE_ERR_INVALID;
+    upipe_qsrc->elastic_min = min_length;
+    upipe_qsrc->elastic_max = max_length;
+    upipe_qsrc->elastic_count = 0;
+    upipe_qsrc->elastic_high_water = 0;
+    upipe_qsrc_set_limit(upipe, min_length);
+    return UBASE_ERR_NONE;
+}
+
 /** @internal @This processes control commands on a queue source pipe.
  *
  * @param upipe description structure of the pipe
@@ -393,6 +681,9 @@ static int _upipe_qsrc_control(struct upipe *upipe, int command, va_list args)
         case UPIPE_ATTACH_UPUMP_MGR:
             upipe_qsrc_set_upump(upipe, NULL);
             return upipe_qsrc_attach_upump_mgr(upipe);
+        case UPIPE_ATTACH_UCLOCK:
+            upipe_qsrc_require_uclock(upipe);
+            return UBASE_ERR_NONE;
         case UPIPE_GET_FLOW_DEF:
         case UPIPE_GET_OUTPUT:
         case UPIPE_SET_OUTPUT:
@@ -408,6 +699,33 @@ static int _upipe_qsrc_control(struct upipe *upipe, int command, va_list args)
             unsigned int *length_p = va_arg(args, unsigned int *);
             return _upipe_qsrc_get_length(upipe, length_p);
         }
+        case UPIPE_QSRC_GET_LIMIT: {
+            UBASE_SIGNATURE_CHECK(args, UPIPE_QSRC_SIGNATURE)
+            unsigned int *limit_p = va_arg(args, unsigned int *);
+            assert(limit_p != NULL);
+            *limit_p = uatomic_load(&upipe_queue(upipe)->limit);
+            return UBASE_ERR_NONE;
+        }
+        case UPIPE_QSRC_GET_STATS: {
+            UBASE_SIGNATURE_CHECK(args, UPIPE_QSRC_SIGNATURE)
+            unsigned int *high_water_p = va_arg(args, unsigned int *);
+            uint64_t *latency_p = va_arg(args, uint64_t *);
+            uint64_t *max_latency_p = va_arg(args, uint64_t *);
+            return _upipe_qsrc_get_stats(upipe, high_water_p, latency_p,
+                                         max_latency_p);
+        }
+        case UPIPE_QSRC_SET_THRESHOLDS: {
+            UBASE_SIGNATURE_CHECK(args, UPIPE_QSRC_SIGNATURE)
+            unsigned int low = va_arg(args, unsigned int);
+            unsigned int high = va_arg(args, unsigned int);
+            return _upipe_qsrc_set_thresholds(upipe, low, high);
+        }
+        case UPIPE_QSRC_SET_ELASTIC: {
+            UBASE_SIGNATURE_CHECK(args, UPIPE_QSRC_SIGNATURE)
+            unsigned int min_length = va_arg(args, unsigned int);
+            unsigned int max_length = va_arg(args, unsigned int);
+            return _upipe_qsrc_set_elastic(upipe, min_length, max_length);
+        }
         default:
             return UBASE_ERR_UNHANDLED;
     }
@@ -449,6 +767,17 @@ static int upipe_qsrc_control(struct upipe *upipe, int command, va_list args)
         }
         upipe_qsrc_set_upump_oob(upipe, upump);
         upump_start(upump);
+        upump = ueventfd_upump_alloc(&upipe_queue(upipe)->event_high,
+                                     upipe_qsrc->upump_mgr,
+                                     upipe_qsrc_high, upipe, upipe->refcount);
+        if (unlikely(upump == NULL)) {
+            upipe_throw_fatal(upipe, UBASE_ERR_UPUMP);
+            upipe_qsrc_set_upump(upipe, NULL);
+            upipe_qsrc_set_upump_oob(upipe, NULL);
+            return UBASE_ERR_UPUMP;
+        }
+        upipe_qsrc_set_upump_high(upipe, upump);
+        upump_start(upump);
     }
 
     return UBASE_ERR_NONE;
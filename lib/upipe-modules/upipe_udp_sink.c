@@ -60,12 +60,28 @@
 #include <fcntl.h>
 #include <sys/ioctl.h>
 #include <errno.h>
+#include <time.h>
 #include <assert.h>
 
+#ifdef __linux__
+#include <linux/net_tstamp.h>
+#endif
+
+#if defined(SO_TXTIME) && defined(SCM_TXTIME)
+/** @hidden */
+#define HAVE_SO_TXTIME 1
+#endif
+
 /** tolerance for late packets */
 #define SYSTIME_TOLERANCE UCLOCK_FREQ
 /** print late packets */
 #define SYSTIME_PRINT (UCLOCK_FREQ / 100)
+/** how long before their departure date datagrams are handed to the kernel
+ * with SO_TXTIME */
+#define TXTIME_HORIZON (UCLOCK_FREQ / 200)
+/** how long before their departure date the pipe stops sleeping and starts
+ * polling the clock, in busy pacing mode */
+#define BUSY_HORIZON (UCLOCK_FREQ / 1000)
 /** expected flow definition on all flows */
 #define EXPECTED_FLOW_DEF    "block."
 
@@ -95,6 +111,12 @@ struct upipe_udpsink {
 
     /** delay applied to systime attribute when uclock is provided */
     uint64_t latency;
+    /** requested pacing mode */
+    enum upipe_udpsink_pacing pacing;
+    /** true if SO_TXTIME is enabled on the socket */
+    bool txtime;
+    /** clock used by SO_TXTIME */
+    clockid_t txtime_clock;
     /** file descriptor */
     int fd;
     /** socket uri */
@@ -154,6 +176,9 @@ static struct upipe *upipe_udpsink_alloc(struct upipe_mgr *mgr,
     upipe_udpsink_init_input(upipe);
     upipe_udpsink_init_uclock(upipe);
     upipe_udpsink->latency = 0;
+    upipe_udpsink->pacing = UPIPE_UDPSINK_PACING_TIMER;
+    upipe_udpsink->txtime = false;
+    upipe_udpsink->txtime_clock = CLOCK_MONOTONIC;
     upipe_udpsink->fd = -1;
     upipe_udpsink->uri = NULL;
     upipe_udpsink->raw = false;
@@ -185,6 +210,78 @@ static void upipe_udpsink_poll(struct upipe *upipe)
     }
 }
 
+/** @internal @This configures the socket for the requested pacing mode.
+ *
+ * @param upipe description structure of the pipe
+ */
+static void upipe_udpsink_setup_pacing(struct upipe *upipe)
+{
+    struct upipe_udpsink *upipe_udpsink = upipe_udpsink_from_upipe(upipe);
+    upipe_udpsink->txtime = false;
+    if (upipe_udpsink->fd == -1 ||
+        (upipe_udpsink->pacing != UPIPE_UDPSINK_PACING_TXTIME_FQ &&
+         upipe_udpsink->pacing != UPIPE_UDPSINK_PACING_TXTIME_ETF))
+        return;
+
+#ifdef HAVE_SO_TXTIME
+    clockid_t clock = CLOCK_MONOTONIC;
+    if (upipe_udpsink->pacing == UPIPE_UDPSINK_PACING_TXTIME_ETF) {
+#ifdef CLOCK_TAI
+        clock = CLOCK_TAI;
+#else
+        upipe_warn(upipe,
+                   "CLOCK_TAI is not supported, falling back to busy pacing");
+        return;
+#endif
+    }
+
+    struct sock_txtime sock_txtime = {
+        .clockid = clock,
+        .flags = 0,
+    };
+    if (unlikely(setsockopt(upipe_udpsink->fd, SOL_SOCKET, SO_TXTIME,
+                            &sock_txtime, sizeof(sock_txtime)) == -1)) {
+        upipe_warn_va(upipe,
+                "can't enable SO_TXTIME (%m), falling back to busy pacing");
+        return;
+    }
+    upipe_udpsink->txtime = true;
+    upipe_udpsink->txtime_clock = clock;
+    upipe_notice_va(upipe, "SO_TXTIME enabled, departure dates require the %s "
+                    "qdisc on the interface",
+                    clock == CLOCK_MONOTONIC ? "fq" : "etf");
+#else
+    upipe_warn(upipe,
+               "SO_TXTIME is not supported, falling back to busy pacing");
+#endif
+}
+
+#ifdef HAVE_SO_TXTIME
+/** @internal @This converts a departure date to the clock used by SO_TXTIME.
+ *
+ * @param upipe description structure of the pipe
+ * @param systime departure date, in uclock time
+ * @param now current uclock time
+ * @return departure date in nanoseconds of the SO_TXTIME clock
+ */
+static uint64_t upipe_udpsink_txtime(struct upipe *upipe,
+                                     uint64_t systime, uint64_t now)
+{
+    struct upipe_udpsink *upipe_udpsink = upipe_udpsink_from_upipe(upipe);
+    struct timespec ts;
+    clock_gettime(upipe_udpsink->txtime_clock, &ts);
+    uint64_t txtime = (uint64_t)ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+
+    /* late datagrams depart as soon as possible */
+    if (systime > now) {
+        uint64_t delay = systime - now;
+        txtime += delay / UCLOCK_FREQ * UINT64_C(1000000000) +
+                  delay % UCLOCK_FREQ * UINT64_C(1000000000) / UCLOCK_FREQ;
+    }
+    return txtime;
+}
+#endif
+
 /** @internal @This outputs data to the udp sink.
  *
  * @param upipe description structure of the pipe
@@ -196,6 +293,9 @@ static bool upipe_udpsink_output(struct upipe *upipe, struct uref *uref,
                                  struct upump **upump_p)
 {
     struct upipe_udpsink *upipe_udpsink = upipe_udpsink_from_upipe(upipe);
+    bool txtime = false;
+    uint64_t systime = 0;
+    uint64_t now = 0;
     const char *def;
     if (unlikely(ubase_check(uref_flow_get_def(uref, &def)))) {
         uint64_t latency = 0;
@@ -215,24 +315,40 @@ static bool upipe_udpsink_output(struct upipe *upipe, struct uref *uref,
     if (likely(upipe_udpsink->uclock == NULL))
         goto write_buffer;
 
-    uint64_t systime = 0;
     if (unlikely(!ubase_check(uref_clock_get_cr_sys(uref, &systime)))) {
         upipe_warn(upipe, "received non-dated buffer");
         goto write_buffer;
     }
 
-    uint64_t now = uclock_now(upipe_udpsink->uclock);
+    now = uclock_now(upipe_udpsink->uclock);
     systime += upipe_udpsink->latency;
-    if (unlikely(now < systime)) {
+
+    /* date at which the datagram is handed to the kernel */
+    uint64_t wakeup = systime;
+    if (upipe_udpsink->txtime)
+        wakeup = systime > TXTIME_HORIZON ? systime - TXTIME_HORIZON : 0;
+    else if (upipe_udpsink->pacing != UPIPE_UDPSINK_PACING_TIMER)
+        wakeup = systime > BUSY_HORIZON ? systime - BUSY_HORIZON : 0;
+
+    if (unlikely(now < wakeup)) {
         upipe_udpsink_check_upump_mgr(upipe);
         if (likely(upipe_udpsink->upump_mgr != NULL)) {
             upipe_verbose_va(upipe, "sleeping %"PRIu64" (%"PRIu64")",
-                             systime - now, systime);
-            upipe_udpsink_wait_upump(upipe, systime - now,
+                             wakeup - now, systime);
+            upipe_udpsink_wait_upump(upipe, wakeup - now,
                                      upipe_udpsink_watcher);
             return false;
         }
-    } else if (now > systime + SYSTIME_TOLERANCE) {
+    }
+
+    if (upipe_udpsink->txtime)
+        txtime = true;
+    else if (upipe_udpsink->pacing != UPIPE_UDPSINK_PACING_TIMER &&
+             now >= wakeup)
+        while (now < systime)
+            now = uclock_now(upipe_udpsink->uclock);
+
+    if (now > systime + SYSTIME_TOLERANCE) {
         upipe_warn_va(upipe,
                       "dropping late packet %"PRIu64" ms, latency %"PRIu64" ms",
                       (now - systime) / (UCLOCK_FREQ / 1000),
@@ -296,6 +412,23 @@ write_buffer:
             .msg_flags = 0,
         };
 
+#ifdef HAVE_SO_TXTIME
+        union {
+            char buf[CMSG_SPACE(sizeof(uint64_t))];
+            struct cmsghdr align;
+        } control;
+        if (txtime) {
+            uint64_t departure = upipe_udpsink_txtime(upipe, systime, now);
+            msghdr.msg_control = control.buf;
+            msghdr.msg_controllen = sizeof(control.buf);
+            struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msghdr);
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_TXTIME;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(uint64_t));
+            memcpy(CMSG_DATA(cmsg), &departure, sizeof(uint64_t));
+        }
+#endif
+
         ssize_t ret = sendmsg(upipe_udpsink->fd, &msghdr, 0);
         uref_block_iovec_unmap(uref, 0, -1, iovecs);
 
@@ -443,6 +576,7 @@ static int _upipe_udpsink_set_uri(struct upipe *upipe, const char *uri)
         upipe_throw_fatal(upipe, UBASE_ERR_ALLOC);
         return UBASE_ERR_ALLOC;
     }
+    upipe_udpsink_setup_pacing(upipe);
     if (!upipe_udpsink_check_input(upipe))
         /* Use again the pipe that we previously released. */
         upipe_use(upipe);
@@ -524,6 +658,7 @@ static int _upipe_udpsink_control(struct upipe *upipe,
             UBASE_SIGNATURE_CHECK(args, UPIPE_UDPSINK_SIGNATURE)
             upipe_udpsink_set_upump(upipe, NULL);
             upipe_udpsink->fd = va_arg(args, int );
+            upipe_udpsink_setup_pacing(upipe);
             return UBASE_ERR_NONE;
         }
         case UPIPE_UDPSINK_SET_PEER: {
@@ -533,6 +668,35 @@ static int _upipe_udpsink_control(struct upipe *upipe,
             memcpy(&upipe_udpsink->addr, s, upipe_udpsink->addrlen);
             return UBASE_ERR_NONE;
         }
+        case UPIPE_UDPSINK_GET_PACING: {
+            UBASE_SIGNATURE_CHECK(args, UPIPE_UDPSINK_SIGNATURE)
+            enum upipe_udpsink_pacing *pacing_p =
+                va_arg(args, enum upipe_udpsink_pacing *);
+            if (upipe_udpsink->txtime ||
+                upipe_udpsink->pacing == UPIPE_UDPSINK_PACING_TIMER)
+                *pacing_p = upipe_udpsink->pacing;
+            else
+                *pacing_p = UPIPE_UDPSINK_PACING_BUSY;
+            return UBASE_ERR_NONE;
+        }
+        case UPIPE_UDPSINK_SET_PACING: {
+            UBASE_SIGNATURE_CHECK(args, UPIPE_UDPSINK_SIGNATURE)
+            enum upipe_udpsink_pacing pacing =
+                va_arg(args, enum upipe_udpsink_pacing);
+            switch (pacing) {
+                case UPIPE_UDPSINK_PACING_TIMER:
+                case UPIPE_UDPSINK_PACING_BUSY:
+                case UPIPE_UDPSINK_PACING_TXTIME_FQ:
+                case UPIPE_UDPSINK_PACING_TXTIME_ETF:
+                    break;
+                default:
+                    return UBASE_ERR_INVALID;
+            }
+            upipe_udpsink_set_upump(upipe, NULL);
+            upipe_udpsink->pacing = pacing;
+            upipe_udpsink_setup_pacing(upipe);
+            return UBASE_ERR_NONE;
+        }
         case UPIPE_FLUSH:
             return upipe_udpsink_flush(upipe);
         default:
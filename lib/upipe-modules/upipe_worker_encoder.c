@@ -0,0 +1,411 @@
+/*
+ * Copyright (C) 2017 OpenHeadend S.A.R.L.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** @file
+ * @short Bin pipe running an encoder on a remote thread
+ */
+
+#include <upipe/ubase.h>
+#include <upipe/uclock.h>
+#include <upipe/uprobe.h>
+#include <upipe/uprobe_prefix.h>
+#include <upipe/uref.h>
+#include <upipe/uref_attr.h>
+#include <upipe/upipe.h>
+#include <upipe/upipe_helper_upipe.h>
+#include <upipe/upipe_helper_urefcount.h>
+#include <upipe/upipe_helper_urefcount_real.h>
+#include <upipe/upipe_helper_inner.h>
+#include <upipe/upipe_helper_uprobe.h>
+#include <upipe/upipe_helper_bin_input.h>
+#include <upipe/upipe_helper_bin_output.h>
+#include <upipe/upipe_helper_uclock.h>
+#include <upipe-modules/upipe_probe_uref.h>
+#include <upipe-modules/upipe_worker_linear.h>
+#include <upipe-modules/upipe_worker_encoder.h>
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <string.h>
+#include <assert.h>
+
+UREF_ATTR_UNSIGNED(wenc, date, "wenc.date", encoder input date);
+
+/** @internal @This is the private context of a wenc manager. */
+struct upipe_wenc_mgr {
+    /** refcount management structure */
+    struct urefcount urefcount;
+
+    /** pointer to worker manager */
+    struct upipe_mgr *work_mgr;
+    /** pointer to probe_uref manager */
+    struct upipe_mgr *probe_uref_mgr;
+
+    /** public upipe_mgr structure */
+    struct upipe_mgr mgr;
+};
+
+UBASE_FROM_TO(upipe_wenc_mgr, upipe_mgr, upipe_mgr, mgr)
+UBASE_FROM_TO(upipe_wenc_mgr, urefcount, urefcount, urefcount)
+
+/** @internal @This is the private context of a wenc pipe. */
+struct upipe_wenc {
+    /** real refcount management structure */
+    struct urefcount urefcount_real;
+    /** refcount management structure exported to the public structure */
+    struct urefcount urefcount;
+
+    /** uclock structure */
+    struct uclock *uclock;
+    /** uclock request */
+    struct urequest uclock_request;
+
+    /** list of input bin requests */
+    struct uchain input_request_list;
+    /** list of output bin requests */
+    struct uchain output_request_list;
+    /** proxy probe */
+    struct uprobe proxy_probe;
+    /** probe for the probe_uref inner pipe */
+    struct uprobe probe_uref_probe;
+
+    /** worker linear pipe (first inner pipe of the bin) */
+    struct upipe *worker;
+    /** probe_uref pipe (last inner pipe of the bin) */
+    struct upipe *probe_uref;
+    /** output */
+    struct upipe *output;
+
+    /** number of frames in the queues and the encoder */
+    unsigned int depth;
+    /** maximum number of frames in the queues and the encoder */
+    unsigned int max_depth;
+    /** time spent in the queues and the encoder by the last frame */
+    uint64_t latency;
+    /** maximum time spent in the queues and the encoder */
+    uint64_t max_latency;
+
+    /** public upipe structure */
+    struct upipe upipe;
+};
+
+/** @hidden */
+static int upipe_wenc_catch_probe_uref(struct uprobe *uprobe,
+                                       struct upipe *inner,
+                                       int event, va_list args);
+
+UPIPE_HELPER_UPIPE(upipe_wenc, upipe, UPIPE_WENC_SIGNATURE)
+UPIPE_HELPER_UREFCOUNT(upipe_wenc, urefcount, upipe_wenc_no_ref)
+UPIPE_HELPER_UREFCOUNT_REAL(upipe_wenc, urefcount_real, upipe_wenc_free)
+UPIPE_HELPER_INNER(upipe_wenc, worker)
+UPIPE_HELPER_BIN_INPUT(upipe_wenc, worker, input_request_list)
+UPIPE_HELPER_INNER(upipe_wenc, probe_uref)
+UPIPE_HELPER_UPROBE(upipe_wenc, urefcount_real, proxy_probe, NULL)
+UPIPE_HELPER_UPROBE(upipe_wenc, urefcount_real, probe_uref_probe,
+                    upipe_wenc_catch_probe_uref)
+UPIPE_HELPER_BIN_OUTPUT(upipe_wenc, probe_uref, output, output_request_list)
+UPIPE_HELPER_UCLOCK(upipe_wenc, uclock, uclock_request, NULL,
+                    upipe_wenc_register_bin_output_request,
+                    upipe_wenc_unregister_bin_output_request)
+
+/** @internal @This catches events coming from the probe_uref inner pipe, to
+ * account for the encoded frames getting out of the worker.
+ *
+ * @param uprobe pointer to the probe in upipe_wenc
+ * @param inner pointer to the inner pipe
+ * @param event event triggered by the inner pipe
+ * @param args arguments of the event
+ * @return an error code
+ */
+static int upipe_wenc_catch_probe_uref(struct uprobe *uprobe,
+                                       struct upipe *inner,
+                                       int event, va_list args)
+{
+    struct upipe_wenc *upipe_wenc = upipe_wenc_from_probe_uref_probe(uprobe);
+    struct upipe *upipe = upipe_wenc_to_upipe(upipe_wenc);
+
+    if (event != UPROBE_PROBE_UREF)
+        return upipe_throw_proxy(upipe, inner, event, args);
+
+    UBASE_SIGNATURE_CHECK(args, UPIPE_PROBE_UREF_SIGNATURE)
+    struct uref *uref = va_arg(args, struct uref *);
+
+    /* the encoder may delay frames or output new urefs, so the depth only
+     * relies on the number of input and output frames */
+    if (likely(upipe_wenc->depth))
+        upipe_wenc->depth--;
+
+    uint64_t date;
+    if (unlikely(!ubase_check(uref_wenc_get_date(uref, &date))))
+        return UBASE_ERR_NONE;
+    uref_wenc_delete_date(uref);
+
+    if (date != UINT64_MAX && upipe_wenc->uclock != NULL) {
+        uint64_t now = uclock_now(upipe_wenc->uclock);
+        upipe_wenc->latency = now > date ? now - date : 0;
+        if (upipe_wenc->max_latency == UINT64_MAX ||
+            upipe_wenc->latency > upipe_wenc->max_latency)
+            upipe_wenc->max_latency = upipe_wenc->latency;
+    }
+    return UBASE_ERR_NONE;
+}
+
+/** @internal @This allocates a wenc pipe.
+ *
+ * @param mgr common management structure
+ * @param uprobe structure used to raise events
+ * @param signature signature of the pipe allocator
+ * @param args optional arguments
+ * @return pointer to upipe or NULL in case of allocation error
+ */
+static struct upipe *_upipe_wenc_alloc(struct upipe_mgr *mgr,
+                                       struct uprobe *uprobe,
+                                       uint32_t signature, va_list args)
+{
+    if (signature != UPIPE_WENC_SIGNATURE) {
+        uprobe_release(uprobe);
+        return NULL;
+    }
+    struct upipe *remote = va_arg(args, struct upipe *);
+    struct uprobe *uprobe_remote = va_arg(args, struct uprobe *);
+    unsigned int input_queue_length = va_arg(args, unsigned int);
+    unsigned int output_queue_length = va_arg(args, unsigned int);
+
+    struct upipe_wenc_mgr *wenc_mgr = upipe_wenc_mgr_from_upipe_mgr(mgr);
+    struct upipe_wenc *upipe_wenc = malloc(sizeof(struct upipe_wenc));
+    if (unlikely(upipe_wenc == NULL)) {
+        upipe_release(remote);
+        uprobe_release(uprobe_remote);
+        uprobe_release(uprobe);
+        return NULL;
+    }
+
+    struct upipe *upipe = upipe_wenc_to_upipe(upipe_wenc);
+    upipe_init(upipe, mgr, uprobe);
+    upipe_wenc_init_urefcount(upipe);
+    upipe_wenc_init_urefcount_real(upipe);
+    upipe_wenc_init_proxy_probe(upipe);
+    upipe_wenc_init_probe_uref_probe(upipe);
+    upipe_wenc_init_bin_input(upipe);
+    upipe_wenc_init_bin_output(upipe);
+    upipe_wenc_init_uclock(upipe);
+    upipe_wenc->depth = 0;
+    upipe_wenc->max_depth = 0;
+    upipe_wenc->latency = UINT64_MAX;
+    upipe_wenc->max_latency = UINT64_MAX;
+    upipe_throw_ready(upipe);
+
+    struct upipe *worker = upipe_wlin_alloc(wenc_mgr->work_mgr,
+            uprobe_pfx_alloc(uprobe_use(&upipe_wenc->proxy_probe),
+                             UPROBE_LOG_VERBOSE, "worker"),
+            remote, uprobe_remote, input_queue_length, output_queue_length);
+    if (unlikely(worker == NULL)) {
+        upipe_release(upipe);
+        return NULL;
+    }
+    upipe_wenc_store_bin_input(upipe, worker);
+
+    struct upipe *probe_uref = upipe_void_alloc_output(worker,
+            wenc_mgr->probe_uref_mgr,
+            uprobe_pfx_alloc(uprobe_use(&upipe_wenc->probe_uref_probe),
+                             UPROBE_LOG_VERBOSE, "probe"));
+    if (unlikely(probe_uref == NULL)) {
+        upipe_release(upipe);
+        return NULL;
+    }
+    upipe_wenc_store_bin_output(upipe, probe_uref);
+    return upipe;
+}
+
+/** @internal @This stamps incoming frames and sends them to the worker.
+ *
+ * @param upipe description structure of the pipe
+ * @param uref uref structure
+ * @param upump_p reference to pump that generated the buffer
+ */
+static void upipe_wenc_input(struct upipe *upipe, struct uref *uref,
+                             struct upump **upump_p)
+{
+    struct upipe_wenc *upipe_wenc = upipe_wenc_from_upipe(upipe);
+    uint64_t date = upipe_wenc->uclock != NULL ?
+                    uclock_now(upipe_wenc->uclock) : UINT64_MAX;
+    if (unlikely(!ubase_check(uref_wenc_set_date(uref, date)))) {
+        uref_free(uref);
+        upipe_throw_fatal(upipe, UBASE_ERR_ALLOC);
+        return;
+    }
+
+    if (++upipe_wenc->depth > upipe_wenc->max_depth)
+        upipe_wenc->max_depth = upipe_wenc->depth;
+
+    /* the input queue blocks upump_p when it is full */
+    upipe_wenc_bin_input(upipe, uref, upump_p);
+}
+
+/** @internal @This returns the statistics of the pipe, and resets the
+ * maximum values.
+ *
+ * @param upipe description structure of the pipe
+ * @param depth_p filled in with the number of frames in the worker
+ * @param max_depth_p filled in with the maximum number of frames in the
+ * worker
+ * @param latency_p filled in with the latency of the last frame
+ * @param max_latency_p filled in with the maximum latency
+ * @return an error code
+ */
+static int _upipe_wenc_get_stats(struct upipe *upipe,
+                                 unsigned int *depth_p,
+                                 unsigned int *max_depth_p,
+                                 uint64_t *latency_p, uint64_t *max_latency_p)
+{
+    struct upipe_wenc *upipe_wenc = upipe_wenc_from_upipe(upipe);
+    if (depth_p != NULL)
+        *depth_p = upipe_wenc->depth;
+    if (max_depth_p != NULL) {
+        *max_depth_p = upipe_wenc->max_depth;
+        upipe_wenc->max_depth = upipe_wenc->depth;
+    }
+    if (latency_p != NULL)
+        *latency_p = upipe_wenc->latency;
+    if (max_latency_p != NULL) {
+        *max_latency_p = upipe_wenc->max_latency;
+        upipe_wenc->max_latency = upipe_wenc->latency;
+    }
+    return UBASE_ERR_NONE;
+}
+
+/** @internal @This processes control commands on a wenc pipe.
+ *
+ * @param upipe description structure of the pipe
+ * @param command type of command to process
+ * @param args arguments of the command
+ * @return an error code
+ */
+static int upipe_wenc_control(struct upipe *upipe, int command, va_list args)
+{
+    switch (command) {
+        case UPIPE_ATTACH_UPUMP_MGR: {
+            struct upipe_wenc *upipe_wenc = upipe_wenc_from_upipe(upipe);
+            if (upipe_wenc->worker != NULL)
+                upipe_attach_upump_mgr(upipe_wenc->worker);
+            return UBASE_ERR_NONE;
+        }
+        case UPIPE_ATTACH_UCLOCK:
+            upipe_wenc_require_uclock(upipe);
+            return UBASE_ERR_NONE;
+        case UPIPE_WENC_GET_STATS: {
+            UBASE_SIGNATURE_CHECK(args, UPIPE_WENC_SIGNATURE)
+            unsigned int *depth_p = va_arg(args, unsigned int *);
+            unsigned int *max_depth_p = va_arg(args, unsigned int *);
+            uint64_t *latency_p = va_arg(args, uint64_t *);
+            uint64_t *max_latency_p = va_arg(args, uint64_t *);
+            return _upipe_wenc_get_stats(upipe, depth_p, max_depth_p,
+                                         latency_p, max_latency_p);
+        }
+        default:
+            break;
+    }
+
+    int err = upipe_wenc_control_bin_input(upipe, command, args);
+    if (err == UBASE_ERR_UNHANDLED)
+        return upipe_wenc_control_bin_output(upipe, command, args);
+    return err;
+}
+
+/** @This frees a upipe.
+ *
+ * @param upipe pipe to free
+ */
+static void upipe_wenc_free(struct upipe *upipe)
+{
+    struct upipe_wenc *upipe_wenc = upipe_wenc_from_upipe(upipe);
+
+    upipe_throw_dead(upipe);
+    upipe_wenc_clean_uclock(upipe);
+    upipe_wenc_clean_probe_uref_probe(upipe);
+    upipe_wenc_clean_proxy_probe(upipe);
+    upipe_wenc_clean_urefcount_real(upipe);
+    upipe_wenc_clean_urefcount(upipe);
+    upipe_clean(upipe);
+    free(upipe_wenc);
+}
+
+/** @This is called when there is no external reference to the pipe anymore.
+ *
+ * @param upipe description structure of the pipe
+ */
+static void upipe_wenc_no_ref(struct upipe *upipe)
+{
+    upipe_wenc_clean_bin_input(upipe);
+    upipe_wenc_clean_bin_output(upipe);
+    upipe_wenc_release_urefcount_real(upipe);
+}
+
+/** @This frees a upipe manager.
+ *
+ * @param urefcount pointer to urefcount structure
+ */
+static void upipe_wenc_mgr_free(struct urefcount *urefcount)
+{
+    struct upipe_wenc_mgr *wenc_mgr = upipe_wenc_mgr_from_urefcount(urefcount);
+    upipe_mgr_release(wenc_mgr->work_mgr);
+    upipe_mgr_release(wenc_mgr->probe_uref_mgr);
+
+    urefcount_clean(urefcount);
+    free(wenc_mgr);
+}
+
+/** @This returns the management structure for all wenc pipes.
+ *
+ * @param xfer_mgr manager to transfer pipes to the remote thread
+ * @return pointer to manager
+ */
+struct upipe_mgr *upipe_wenc_mgr_alloc(struct upipe_mgr *xfer_mgr)
+{
+    assert(xfer_mgr != NULL);
+    struct upipe_wenc_mgr *wenc_mgr = malloc(sizeof(struct upipe_wenc_mgr));
+    if (unlikely(wenc_mgr == NULL))
+        return NULL;
+
+    memset(wenc_mgr, 0, sizeof(*wenc_mgr));
+    wenc_mgr->work_mgr = upipe_wlin_mgr_alloc(xfer_mgr);
+    wenc_mgr->probe_uref_mgr = upipe_probe_uref_mgr_alloc();
+    if (unlikely(wenc_mgr->work_mgr == NULL ||
+                 wenc_mgr->probe_uref_mgr == NULL)) {
+        upipe_mgr_release(wenc_mgr->work_mgr);
+        upipe_mgr_release(wenc_mgr->probe_uref_mgr);
+        free(wenc_mgr);
+        return NULL;
+    }
+
+    urefcount_init(upipe_wenc_mgr_to_urefcount(wenc_mgr),
+                   upipe_wenc_mgr_free);
+    wenc_mgr->mgr.refcount = upipe_wenc_mgr_to_urefcount(wenc_mgr);
+    wenc_mgr->mgr.signature = UPIPE_WENC_SIGNATURE;
+    wenc_mgr->mgr.upipe_alloc = _upipe_wenc_alloc;
+    wenc_mgr->mgr.upipe_input = upipe_wenc_input;
+    wenc_mgr->mgr.upipe_control = upipe_wenc_control;
+    wenc_mgr->mgr.upipe_mgr_control = NULL;
+    return upipe_wenc_mgr_to_upipe_mgr(wenc_mgr);
+}
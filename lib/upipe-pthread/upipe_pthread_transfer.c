@@ -28,6 +28,9 @@
  * This is particularly helpful for multithreaded applications.
  */
 
+#define _GNU_SOURCE
+
+#include <upipe/config.h>
 #include <upipe/ubase.h>
 #include <upipe/urefcount.h>
 #include <upipe/ueventfd.h>
@@ -43,6 +46,7 @@
 #include <upipe-pthread/uprobe_pthread_upump_mgr.h>
 
 #include <stdlib.h>
+#include <stdio.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <inttypes.h>
@@ -52,8 +56,25 @@
 #include <signal.h>
 #include <errno.h>
 #include <math.h>
+#include <limits.h>
+#include <sched.h>
 #include <assert.h>
 
+#ifdef UPIPE_HAVE_SYS_SYSCALL_H
+#include <sys/syscall.h>
+#endif
+#ifdef UPIPE_HAVE_LINUX_MEMPOLICY_H
+#include <linux/mempolicy.h>
+#endif
+
+#if defined(UPIPE_HAVE_LINUX_MEMPOLICY_H) && defined(SYS_set_mempolicy)
+/** @hidden */
+#define UPIPE_PTHREAD_MEMPOLICY
+#endif
+
+/** maximum NUMA node number */
+#define MAX_NUMA_NODE 1023
+
 /** @internal @This is the private context for pthread. */
 struct upipe_pthread_ctx {
     /** xfer manager */
@@ -72,8 +93,117 @@ struct upipe_pthread_ctx {
     struct ueventfd event;
     /** mutual exclusion primitives for access to the event loop */
     struct umutex *mutex;
+
+    /** CPUs the thread is bound to */
+    unsigned int *cpus;
+    /** number of CPUs the thread is bound to */
+    unsigned int nb_cpus;
+    /** NUMA node of the thread, or -1 */
+    int numa_node;
+    /** SCHED_FIFO priority of the thread, or 0 */
+    int fifo_priority;
 };
 
+#ifdef UPIPE_HAVE_PTHREAD_SETAFFINITY_NP
+/** @internal @This reads the CPUs of a NUMA node from sysfs.
+ *
+ * @param numa_node NUMA node
+ * @param cpuset filled in with the CPUs of the node
+ * @return false if the CPUs of the node are unknown
+ */
+static bool upipe_pthread_node_cpus(int numa_node, cpu_set_t *cpuset)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+             numa_node);
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+        return false;
+
+    /* the list looks like 0-7,16-23 */
+    bool found = false;
+    unsigned int first, last;
+    int ret;
+    while ((ret = fscanf(file, "%u", &first)) == 1) {
+        last = first;
+        int c = fgetc(file);
+        if (c == '-') {
+            if (fscanf(file, "%u", &last) != 1)
+                break;
+            c = fgetc(file);
+        }
+        for (unsigned int cpu = first; cpu <= last && cpu < CPU_SETSIZE;
+             cpu++) {
+            CPU_SET(cpu, cpuset);
+            found = true;
+        }
+        if (c != ',')
+            break;
+    }
+    fclose(file);
+    return found;
+}
+#endif
+
+/** @internal @This applies the placement to the calling thread.
+ *
+ * @param pthread_ctx private context of the thread
+ */
+static void upipe_pthread_place(struct upipe_pthread_ctx *pthread_ctx)
+{
+    struct uprobe *uprobe = pthread_ctx->uprobe_pthread_upump_mgr;
+    int err;
+
+    if (pthread_ctx->nb_cpus || pthread_ctx->numa_node >= 0) {
+#ifdef UPIPE_HAVE_PTHREAD_SETAFFINITY_NP
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        for (unsigned int i = 0; i < pthread_ctx->nb_cpus; i++)
+            if (pthread_ctx->cpus[i] < CPU_SETSIZE)
+                CPU_SET(pthread_ctx->cpus[i], &cpuset);
+        if (!pthread_ctx->nb_cpus &&
+            !upipe_pthread_node_cpus(pthread_ctx->numa_node, &cpuset))
+            uprobe_warn_va(uprobe, NULL, "unable to find CPUs of node %d",
+                           pthread_ctx->numa_node);
+        else if ((err = pthread_setaffinity_np(pthread_self(),
+                                               sizeof(cpuset), &cpuset)))
+            uprobe_warn_va(uprobe, NULL, "unable to set CPU affinity (%s)",
+                           strerror(err));
+#else
+        uprobe_warn(uprobe, NULL, "CPU affinity is not supported");
+#endif
+    }
+
+    if (pthread_ctx->numa_node >= 0) {
+#ifdef UPIPE_PTHREAD_MEMPOLICY
+        /* the page allocation policy is inherited by the arenas of the
+         * allocator, and thus by the pools of umem_alloc */
+        unsigned long nodemask[(MAX_NUMA_NODE + 1) / (sizeof(unsigned long) *
+                                                      CHAR_BIT)];
+        memset(nodemask, 0, sizeof(nodemask));
+        nodemask[pthread_ctx->numa_node / (sizeof(unsigned long) * CHAR_BIT)] =
+            1UL << (pthread_ctx->numa_node % (sizeof(unsigned long) *
+                                              CHAR_BIT));
+        if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, nodemask,
+                    sizeof(nodemask) * CHAR_BIT + 1) == -1)
+            uprobe_warn_va(uprobe, NULL, "unable to set memory policy (%s)",
+                           strerror(errno));
+#else
+        uprobe_warn(uprobe, NULL, "NUMA memory policy is not supported");
+#endif
+    }
+
+    if (pthread_ctx->fifo_priority) {
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = pthread_ctx->fifo_priority;
+        if ((err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param)))
+            uprobe_warn_va(uprobe, NULL,
+                           "unable to set SCHED_FIFO priority %d (%s)",
+                           pthread_ctx->fifo_priority, strerror(err));
+    }
+}
+
 /** @internal @This is the main function of the new thread.
  *
  * @param mgr pointer to a upipe pthread manager
@@ -93,6 +223,9 @@ static void *upipe_pthread_start(void *_pthread_ctx)
 
     pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
 
+    /* before anything is allocated from this thread */
+    upipe_pthread_place(pthread_ctx);
+
     /* spawn the upump manager */
     struct upump_mgr *upump_mgr =
         pthread_ctx->upump_mgr_alloc(pthread_ctx->upump_pool_depth,
@@ -150,11 +283,12 @@ static void upipe_pthread_stop(struct upump *upump)
     pthread_join(pthread_ctx->pthread_id, NULL);
     ueventfd_clean(&pthread_ctx->event);
     umutex_release(pthread_ctx->mutex);
+    free(pthread_ctx->cpus);
     free(pthread_ctx);
 }
 
 /** @This returns a management structure for transfer pipes, using a new
- * pthread. You would need one management structure per target thread.
+ * pthread bound to the given CPUs and NUMA node.
  *
  * @param queue_length maximum length of the internal queue of commands
  * @param msg_pool_depth maximum number of messages in the pool
@@ -167,19 +301,40 @@ static void upipe_pthread_stop(struct upump *upump)
  * @param mutex mutual exclusion pimitives to access the event loop, or NULL
  * @param pthread_id_p reference to created thread ID (may be NULL)
  * @param attr pthread attributes
+ * @param placement placement of the thread, or NULL
  * @return pointer to xfer manager
  */
-struct upipe_mgr *upipe_pthread_xfer_mgr_alloc(uint8_t queue_length,
+struct upipe_mgr *upipe_pthread_xfer_mgr_alloc_placement(uint8_t queue_length,
         uint16_t msg_pool_depth, struct uprobe *uprobe_pthread_upump_mgr,
         upump_mgr_alloc upump_mgr_alloc, uint16_t upump_pool_depth,
         uint16_t upump_blocker_pool_depth, struct umutex *mutex,
-        pthread_t *pthread_id_p, const pthread_attr_t *restrict attr)
+        pthread_t *pthread_id_p, const pthread_attr_t *restrict attr,
+        const struct upipe_pthread_placement *placement)
 {
     struct upipe_pthread_ctx *pthread_ctx =
         malloc(sizeof(struct upipe_pthread_ctx));
     if (unlikely(pthread_ctx == NULL))
         goto upipe_pthread_xfer_mgr_alloc_err1;
 
+    pthread_ctx->cpus = NULL;
+    pthread_ctx->nb_cpus = 0;
+    pthread_ctx->numa_node = -1;
+    pthread_ctx->fifo_priority = 0;
+    if (placement != NULL) {
+        if (placement->nb_cpus) {
+            pthread_ctx->cpus =
+                malloc(placement->nb_cpus * sizeof(unsigned int));
+            if (unlikely(pthread_ctx->cpus == NULL))
+                goto upipe_pthread_xfer_mgr_alloc_err2;
+            memcpy(pthread_ctx->cpus, placement->cpus,
+                   placement->nb_cpus * sizeof(unsigned int));
+            pthread_ctx->nb_cpus = placement->nb_cpus;
+        }
+        if (placement->numa_node <= MAX_NUMA_NODE)
+            pthread_ctx->numa_node = placement->numa_node;
+        pthread_ctx->fifo_priority = placement->fifo_priority;
+    }
+
     if (unlikely(!ueventfd_init(&pthread_ctx->event, false)))
         goto upipe_pthread_xfer_mgr_alloc_err2;
 
@@ -226,8 +381,37 @@ upipe_pthread_xfer_mgr_alloc_err4:
 upipe_pthread_xfer_mgr_alloc_err3:
     ueventfd_clean(&pthread_ctx->event);
 upipe_pthread_xfer_mgr_alloc_err2:
+    free(pthread_ctx->cpus);
     free(pthread_ctx);
 upipe_pthread_xfer_mgr_alloc_err1:
     uprobe_release(uprobe_pthread_upump_mgr);
     return NULL;
 }
+
+/** @This returns a management structure for transfer pipes, using a new
+ * pthread. You would need one management structure per target thread.
+ *
+ * @param queue_length maximum length of the internal queue of commands
+ * @param msg_pool_depth maximum number of messages in the pool
+ * @param uprobe_pthread_upump_mgr pointer to optional probe, that will be set
+ * with the created upump_mgr
+ * @param upump_mgr_alloc alloc function provided by the upump manager
+ * @param upump_pool_depth maximum number of upump structures in the pool
+ * @param upump_blocker_pool_depth maximum number of upump_blocker structures in
+ * the pool
+ * @param mutex mutual exclusion pimitives to access the event loop, or NULL
+ * @param pthread_id_p reference to created thread ID (may be NULL)
+ * @param attr pthread attributes
+ * @return pointer to xfer manager
+ */
+struct upipe_mgr *upipe_pthread_xfer_mgr_alloc(uint8_t queue_length,
+        uint16_t msg_pool_depth, struct uprobe *uprobe_pthread_upump_mgr,
+        upump_mgr_alloc upump_mgr_alloc, uint16_t upump_pool_depth,
+        uint16_t upump_blocker_pool_depth, struct umutex *mutex,
+        pthread_t *pthread_id_p, const pthread_attr_t *restrict attr)
+{
+    return upipe_pthread_xfer_mgr_alloc_placement(queue_length,
+            msg_pool_depth, uprobe_pthread_upump_mgr, upump_mgr_alloc,
+            upump_pool_depth, upump_blocker_pool_depth, mutex, pthread_id_p,
+            attr, NULL);
+}
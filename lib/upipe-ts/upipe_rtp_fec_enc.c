@@ -0,0 +1,857 @@
+/*
+ * Copyright (C) 2017 OpenHeadend S.A.R.L.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/** @file
+ * @short Upipe module generating SMPTE 2022-1 FEC streams
+ *
+ * Media packets are numbered in the matrix in the order they arrive: packet
+ * i belongs to column i % L and row i / L. The FEC payload of a column or
+ * a row is the XOR of the payloads of its packets, and is computed in place
+ * in a FEC packet allocated when the first packet of the column or row
+ * arrives.
+ */
+
+#include <upipe/ubase.h>
+#include <upipe/uprobe.h>
+#include <upipe/uref.h>
+#include <upipe/uref_block.h>
+#include <upipe/uref_block_flow.h>
+#include <upipe/uref_flow.h>
+#include <upipe/ubuf.h>
+#include <upipe/ubuf_block.h>
+#include <upipe/upipe.h>
+#include <upipe/upipe_helper_upipe.h>
+#include <upipe/upipe_helper_urefcount.h>
+#include <upipe/upipe_helper_output.h>
+#include <upipe/upipe_helper_ubuf_mgr.h>
+
+#include <upipe-ts/upipe_rtp_fec_enc.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <bitstream/ietf/rtp.h>
+#include <bitstream/smpte/2022_1_fec.h>
+
+/** we only accept blocks */
+#define EXPECTED_FLOW_DEF "block."
+/** flow definition of the FEC streams */
+#define FEC_FLOW_DEF "block.rtp.fec."
+/** maximum number of columns */
+#define FEC_COLUMNS_MAX 20
+/** maximum number of rows */
+#define FEC_ROWS_MAX 20
+/** minimum number of rows */
+#define FEC_ROWS_MIN 4
+/** maximum number of packets in a matrix */
+#define FEC_MATRIX_MAX 100
+/** maximum size of a protected payload, so that FEC packets fit in an
+ * Ethernet frame */
+#define FEC_PAYLOAD_MAX (1500 - 20 - 8 - RTP_HEADER_SIZE - \
+                         SMPTE_2022_FEC_HEADER_SIZE)
+/** RTP payload type of the FEC streams */
+#define FEC_PT 96
+/** default number of columns */
+#define DEFAULT_COLUMNS 10
+/** default number of rows */
+#define DEFAULT_ROWS 10
+
+/** @internal @This is a FEC packet being built. */
+struct upipe_rtp_fec_enc_acc {
+    /** FEC packet, or NULL */
+    struct ubuf *ubuf;
+    /** mapped FEC packet */
+    uint8_t *buffer;
+    /** largest payload size protected so far */
+    size_t size;
+    /** sequence number of the first protected packet */
+    uint16_t snbase;
+    /** XOR of the payload sizes */
+    uint16_t length_rec;
+    /** XOR of the timestamps */
+    uint32_t ts_rec;
+    /** XOR of the payload types */
+    uint8_t pt_rec;
+};
+
+/** @internal @This is the private context of an output of a rtp fec encoder
+ * pipe. */
+struct upipe_rtp_fec_enc_output {
+    /** pipe acting as output */
+    struct upipe *output;
+    /** flow definition packet */
+    struct uref *flow_def;
+    /** output state */
+    enum upipe_helper_output_state output_state;
+    /** list of output requests */
+    struct uchain request_list;
+
+    /** sequence number of the next FEC packet */
+    uint16_t seqnum;
+
+    /** public upipe structure */
+    struct upipe upipe;
+};
+
+UPIPE_HELPER_UPIPE(upipe_rtp_fec_enc_output, upipe,
+                   UPIPE_RTP_FEC_ENC_OUTPUT_SIGNATURE)
+UPIPE_HELPER_OUTPUT(upipe_rtp_fec_enc_output, output, flow_def, output_state,
+                    request_list)
+
+/** @internal @This is the private context of a rtp fec encoder pipe. */
+struct upipe_rtp_fec_enc {
+    /** refcount management structure */
+    struct urefcount urefcount;
+
+    /** ubuf manager */
+    struct ubuf_mgr *ubuf_mgr;
+    /** flow format packet */
+    struct uref *flow_format;
+    /** ubuf manager request */
+    struct urequest ubuf_mgr_request;
+
+    /** pipe acting as output */
+    struct upipe *output;
+    /** flow definition packet */
+    struct uref *flow_def;
+    /** output state */
+    enum upipe_helper_output_state output_state;
+    /** list of output requests */
+    struct uchain request_list;
+
+    /** subpipe manager */
+    struct upipe_mgr sub_mgr;
+    /** fec-column subpipe */
+    struct upipe_rtp_fec_enc_output col_subpipe;
+    /** fec-row subpipe */
+    struct upipe_rtp_fec_enc_output row_subpipe;
+
+    /** number of columns (L) */
+    unsigned int columns;
+    /** number of rows (D) */
+    unsigned int rows;
+    /** position of the next packet in the matrix */
+    unsigned int index;
+    /** expected sequence number, or UINT32_MAX */
+    uint32_t expected_seqnum;
+    /** true if building a FEC packet failed, until the pipe is
+     * reconfigured */
+    bool failed;
+
+    /** column FEC packets being built */
+    struct upipe_rtp_fec_enc_acc col_acc[FEC_COLUMNS_MAX];
+    /** row FEC packet being built */
+    struct upipe_rtp_fec_enc_acc row_acc;
+
+    /** public upipe structure */
+    struct upipe upipe;
+};
+
+/** @hidden */
+static int upipe_rtp_fec_enc_check(struct upipe *upipe,
+                                   struct uref *flow_format);
+
+UPIPE_HELPER_UPIPE(upipe_rtp_fec_enc, upipe, UPIPE_RTP_FEC_ENC_SIGNATURE)
+UPIPE_HELPER_UREFCOUNT(upipe_rtp_fec_enc, urefcount, upipe_rtp_fec_enc_free)
+UPIPE_HELPER_OUTPUT(upipe_rtp_fec_enc, output, flow_def, output_state,
+                    request_list)
+UPIPE_HELPER_UBUF_MGR(upipe_rtp_fec_enc, ubuf_mgr, flow_format,
+                      ubuf_mgr_request, upipe_rtp_fec_enc_check,
+                      upipe_rtp_fec_enc_register_output_request,
+                      upipe_rtp_fec_enc_unregister_output_request)
+
+UBASE_FROM_TO(upipe_rtp_fec_enc, upipe_mgr, sub_mgr, sub_mgr)
+UBASE_FROM_TO(upipe_rtp_fec_enc, upipe_rtp_fec_enc_output, col_subpipe,
+              col_subpipe)
+UBASE_FROM_TO(upipe_rtp_fec_enc, upipe_rtp_fec_enc_output, row_subpipe,
+              row_subpipe)
+
+/** @internal @This XORs a buffer into another, a vector or a word at a
+ * time.
+ *
+ * @param dst buffer to XOR into
+ * @param src buffer to XOR
+ * @param size size of the buffers
+ */
+static void upipe_rtp_fec_enc_xor(uint8_t *dst, const uint8_t *src,
+                                  size_t size)
+{
+#ifdef __SSE2__
+    for ( ; size >= sizeof(__m128i);
+         size -= sizeof(__m128i), dst += sizeof(__m128i),
+         src += sizeof(__m128i)) {
+        __m128i a = _mm_loadu_si128((const __m128i *)dst);
+        __m128i b = _mm_loadu_si128((const __m128i *)src);
+        _mm_storeu_si128((__m128i *)dst, _mm_xor_si128(a, b));
+    }
+#endif
+    for ( ; size >= sizeof(uint64_t);
+         size -= sizeof(uint64_t), dst += sizeof(uint64_t),
+         src += sizeof(uint64_t)) {
+        uint64_t a, b;
+        memcpy(&a, dst, sizeof(uint64_t));
+        memcpy(&b, src, sizeof(uint64_t));
+        a ^= b;
+        memcpy(dst, &a, sizeof(uint64_t));
+    }
+    while (size--)
+        *dst++ ^= *src++;
+}
+
+/** @internal @This releases a FEC packet being built.
+ *
+ * @param acc FEC packet being built
+ */
+static void upipe_rtp_fec_enc_acc_clean(struct upipe_rtp_fec_enc_acc *acc)
+{
+    if (acc->ubuf != NULL) {
+        ubuf_block_unmap(acc->ubuf, 0);
+        ubuf_free(acc->ubuf);
+        acc->ubuf = NULL;
+    }
+}
+
+/** @internal @This discards the current matrix.
+ *
+ * @param upipe description structure of the pipe
+ */
+static void upipe_rtp_fec_enc_reset(struct upipe *upipe)
+{
+    struct upipe_rtp_fec_enc *upipe_rtp_fec_enc =
+        upipe_rtp_fec_enc_from_upipe(upipe);
+    for (unsigned int i = 0; i < FEC_COLUMNS_MAX; i++)
+        upipe_rtp_fec_enc_acc_clean(&upipe_rtp_fec_enc->col_acc[i]);
+    upipe_rtp_fec_enc_acc_clean(&upipe_rtp_fec_enc->row_acc);
+    upipe_rtp_fec_enc->index = 0;
+    upipe_rtp_fec_enc->expected_seqnum = UINT32_MAX;
+}
+
+/** @internal @This discards the current matrix after a change of
+ * configuration, and enables FEC again if it failed.
+ *
+ * @param upipe description structure of the pipe
+ */
+static void upipe_rtp_fec_enc_restart(struct upipe *upipe)
+{
+    struct upipe_rtp_fec_enc *upipe_rtp_fec_enc =
+        upipe_rtp_fec_enc_from_upipe(upipe);
+    upipe_rtp_fec_enc_reset(upipe);
+    upipe_rtp_fec_enc->failed = false;
+}
+
+/** @internal @This starts a FEC packet.
+ *
+ * @param upipe description structure of the pipe
+ * @param acc FEC packet to start
+ * @param snbase sequence number of the first protected packet
+ * @return an error code
+ */
+static int upipe_rtp_fec_enc_acc_start(struct upipe *upipe,
+                                       struct upipe_rtp_fec_enc_acc *acc,
+                                       uint16_t snbase)
+{
+    struct upipe_rtp_fec_enc *upipe_rtp_fec_enc =
+        upipe_rtp_fec_enc_from_upipe(upipe);
+    upipe_rtp_fec_enc_acc_clean(acc);
+
+    acc->ubuf = ubuf_block_alloc(upipe_rtp_fec_enc->ubuf_mgr,
+            RTP_HEADER_SIZE + SMPTE_2022_FEC_HEADER_SIZE + FEC_PAYLOAD_MAX);
+    if (unlikely(acc->ubuf == NULL))
+        return UBASE_ERR_ALLOC;
+
+    int size = -1;
+    if (unlikely(!ubase_check(ubuf_block_write(acc->ubuf, 0, &size,
+                                               &acc->buffer)))) {
+        ubuf_free(acc->ubuf);
+        acc->ubuf = NULL;
+        return UBASE_ERR_ALLOC;
+    }
+    memset(acc->buffer, 0, size);
+
+    acc->size = 0;
+    acc->snbase = snbase;
+    acc->length_rec = 0;
+    acc->ts_rec = 0;
+    acc->pt_rec = 0;
+    return UBASE_ERR_NONE;
+}
+
+/** @internal @This adds a media packet to a FEC packet.
+ *
+ * @param acc FEC packet being built
+ * @param uref media packet
+ * @param rtp RTP header of the media packet
+ * @param payload_size size of the payload of the media packet
+ * @return an error code
+ */
+static int upipe_rtp_fec_enc_acc_add(struct upipe_rtp_fec_enc_acc *acc,
+                                     struct uref *uref, const uint8_t *rtp,
+                                     size_t payload_size)
+{
+    if (unlikely(acc->ubuf == NULL))
+        return UBASE_ERR_INVALID;
+
+    uint8_t *payload = acc->buffer + RTP_HEADER_SIZE +
+                       SMPTE_2022_FEC_HEADER_SIZE;
+    int offset = RTP_HEADER_SIZE;
+    size_t remaining = payload_size;
+    while (remaining) {
+        int size = remaining;
+        const uint8_t *buffer;
+        UBASE_RETURN(uref_block_read(uref, offset, &size, &buffer))
+        upipe_rtp_fec_enc_xor(payload + offset - RTP_HEADER_SIZE, buffer,
+                              size);
+        uref_block_unmap(uref, offset);
+        offset += size;
+        remaining -= size;
+    }
+
+    if (acc->size < payload_size)
+        acc->size = payload_size;
+    acc->length_rec ^= payload_size;
+    acc->ts_rec ^= rtp_get_timestamp(rtp);
+    acc->pt_rec ^= rtp_get_type(rtp);
+    return UBASE_ERR_NONE;
+}
+
+/** @internal @This finishes a FEC packet.
+ *
+ * @param upipe description structure of the output subpipe
+ * @param acc FEC packet being built
+ * @param uref last protected media packet
+ * @param rtp RTP header of the last protected media packet
+ * @param offset offset field of the FEC header
+ * @param na NA field of the FEC header
+ * @param d D bit of the FEC header
+ * @return FEC packet, or NULL
+ */
+static struct uref *upipe_rtp_fec_enc_acc_end(struct upipe *upipe,
+                                              struct upipe_rtp_fec_enc_acc *acc,
+                                              struct uref *uref,
+                                              const uint8_t *rtp,
+                                              uint8_t offset, uint8_t na,
+                                              bool d)
+{
+    struct upipe_rtp_fec_enc_output *upipe_rtp_fec_enc_output =
+        upipe_rtp_fec_enc_output_from_upipe(upipe);
+    if (unlikely(acc->ubuf == NULL))
+        return NULL;
+
+    uint8_t *buf = acc->buffer;
+    uint8_t ssrc[4];
+    rtp_get_ssrc(rtp, ssrc);
+    rtp_set_hdr(buf);
+    rtp_set_type(buf, FEC_PT);
+    rtp_set_seqnum(buf, upipe_rtp_fec_enc_output->seqnum++);
+    rtp_set_timestamp(buf, rtp_get_timestamp(rtp));
+    rtp_set_ssrc(buf, ssrc);
+
+    buf += RTP_HEADER_SIZE;
+    smpte_fec_set_snbase_low(buf, acc->snbase);
+    smpte_fec_set_length_rec(buf, acc->length_rec);
+    smpte_fec_set_extension(buf);
+    smpte_fec_set_pt_recovery(buf, acc->pt_rec);
+    smpte_fec_set_mask(buf, 0);
+    smpte_fec_set_ts_recovery(buf, acc->ts_rec);
+    if (d)
+        smpte_fec_set_d(buf);
+    smpte_fec_set_type(buf, 0); /* XOR */
+    smpte_fec_set_index(buf, 0);
+    smpte_fec_set_offset(buf, offset);
+    smpte_fec_set_na(buf, na);
+    smpte_fec_set_snbase_ext(buf, 0);
+
+    struct ubuf *ubuf = acc->ubuf;
+    acc->ubuf = NULL;
+    ubuf_block_unmap(ubuf, 0);
+    ubuf_block_resize(ubuf, 0, RTP_HEADER_SIZE + SMPTE_2022_FEC_HEADER_SIZE +
+                               acc->size);
+
+    struct uref *fec = uref_fork(uref, ubuf);
+    if (unlikely(fec == NULL)) {
+        ubuf_free(ubuf);
+        upipe_throw_fatal(upipe, UBASE_ERR_ALLOC);
+    }
+    return fec;
+}
+
+/** @internal @This initializes an output subpipe of a rtp fec encoder pipe.
+ *
+ * @param upipe pointer to subpipe
+ * @param sub_mgr manager of the subpipe
+ * @param uprobe structure used to raise events by the subpipe
+ */
+static void upipe_rtp_fec_enc_output_init(struct upipe *upipe,
+        struct upipe_mgr *sub_mgr, struct uprobe *uprobe)
+{
+    struct upipe_rtp_fec_enc *upipe_rtp_fec_enc =
+        upipe_rtp_fec_enc_from_sub_mgr(sub_mgr);
+    upipe_init(upipe, sub_mgr, uprobe);
+    upipe->refcount = &upipe_rtp_fec_enc->urefcount;
+    struct upipe_rtp_fec_enc_output *upipe_rtp_fec_enc_output =
+        upipe_rtp_fec_enc_output_from_upipe(upipe);
+
+    upipe_rtp_fec_enc_output_init_output(upipe);
+    upipe_rtp_fec_enc_output->seqnum = 0;
+
+    upipe_throw_ready(upipe);
+}
+
+/** @internal @This processes control commands on an output subpipe of a
+ * rtp fec encoder pipe.
+ *
+ * @param upipe description structure of the pipe
+ * @param command type of command to process
+ * @param args arguments of the command
+ * @return an error code
+ */
+static int upipe_rtp_fec_enc_output_control(struct upipe *upipe,
+                                            int command, va_list args)
+{
+    switch (command) {
+        case UPIPE_REGISTER_REQUEST:
+        case UPIPE_UNREGISTER_REQUEST:
+            return upipe_control_provide_request(upipe, command, args);
+        case UPIPE_GET_FLOW_DEF:
+        case UPIPE_GET_OUTPUT:
+            return upipe_rtp_fec_enc_output_control_output(upipe, command,
+                                                           args);
+        case UPIPE_SET_OUTPUT: {
+            struct upipe_rtp_fec_enc_output *upipe_rtp_fec_enc_output =
+                upipe_rtp_fec_enc_output_from_upipe(upipe);
+            struct upipe *output = upipe_rtp_fec_enc_output->output;
+            UBASE_RETURN(upipe_rtp_fec_enc_output_control_output(upipe,
+                        command, args))
+            /* the packets of the current matrix were not all added to the
+             * FEC packets of this output */
+            if (upipe_rtp_fec_enc_output->output != NULL &&
+                upipe_rtp_fec_enc_output->output != output)
+                upipe_rtp_fec_enc_restart(upipe_rtp_fec_enc_to_upipe(
+                            upipe_rtp_fec_enc_from_sub_mgr(upipe->mgr)));
+            return UBASE_ERR_NONE;
+        }
+        case UPIPE_SUB_GET_SUPER: {
+            struct upipe **p = va_arg(args, struct upipe **);
+            *p = upipe_rtp_fec_enc_to_upipe(
+                    upipe_rtp_fec_enc_from_sub_mgr(upipe->mgr));
+            return UBASE_ERR_NONE;
+        }
+
+        default:
+            return UBASE_ERR_UNHANDLED;
+    }
+}
+
+/** @This cleans up an output subpipe.
+ *
+ * @param upipe description structure of the pipe
+ */
+static void upipe_rtp_fec_enc_output_clean(struct upipe *upipe)
+{
+    upipe_throw_dead(upipe);
+
+    upipe_rtp_fec_enc_output_clean_output(upipe);
+
+    upipe_clean(upipe);
+}
+
+/** @internal @This initializes the output manager for a rtp fec encoder
+ * pipe.
+ *
+ * @param upipe description structure of the pipe
+ */
+static void upipe_rtp_fec_enc_init_sub_mgr(struct upipe *upipe)
+{
+    struct upipe_rtp_fec_enc *upipe_rtp_fec_enc =
+        upipe_rtp_fec_enc_from_upipe(upipe);
+    struct upipe_mgr *sub_mgr = &upipe_rtp_fec_enc->sub_mgr;
+    sub_mgr->refcount = NULL;
+    sub_mgr->signature = UPIPE_RTP_FEC_ENC_OUTPUT_SIGNATURE;
+    sub_mgr->upipe_alloc = NULL;
+    sub_mgr->upipe_input = NULL;
+    sub_mgr->upipe_control = upipe_rtp_fec_enc_output_control;
+    sub_mgr->upipe_mgr_control = NULL;
+}
+
+/** @internal @This allocates a rtp fec encoder pipe.
+ *
+ * @param mgr common management structure
+ * @param uprobe structure used to raise events
+ * @param signature signature of the pipe allocator
+ * @param args optional arguments
+ * @return pointer to upipe or NULL in case of allocation error
+ */
+static struct upipe *_upipe_rtp_fec_enc_alloc(struct upipe_mgr *mgr,
+                                              struct uprobe *uprobe,
+                                              uint32_t signature,
+                                              va_list args)
+{
+    if (signature != UPIPE_RTP_FEC_ENC_SIGNATURE) {
+        uprobe_release(uprobe);
+        return NULL;
+    }
+    struct uprobe *uprobe_col = va_arg(args, struct uprobe *);
+    struct uprobe *uprobe_row = va_arg(args, struct uprobe *);
+
+    struct upipe_rtp_fec_enc *upipe_rtp_fec_enc =
+        malloc(sizeof(struct upipe_rtp_fec_enc));
+    if (unlikely(upipe_rtp_fec_enc == NULL)) {
+        uprobe_release(uprobe_col);
+        uprobe_release(uprobe_row);
+        uprobe_release(uprobe);
+        return NULL;
+    }
+
+    struct upipe *upipe = upipe_rtp_fec_enc_to_upipe(upipe_rtp_fec_enc);
+    upipe_init(upipe, mgr, uprobe);
+
+    upipe_rtp_fec_enc_init_urefcount(upipe);
+    upipe_rtp_fec_enc_init_output(upipe);
+    upipe_rtp_fec_enc_init_ubuf_mgr(upipe);
+    upipe_rtp_fec_enc_init_sub_mgr(upipe);
+    upipe_rtp_fec_enc->columns = DEFAULT_COLUMNS;
+    upipe_rtp_fec_enc->rows = DEFAULT_ROWS;
+    for (unsigned int i = 0; i < FEC_COLUMNS_MAX; i++)
+        upipe_rtp_fec_enc->col_acc[i].ubuf = NULL;
+    upipe_rtp_fec_enc->row_acc.ubuf = NULL;
+    upipe_rtp_fec_enc_restart(upipe);
+
+    upipe_rtp_fec_enc_output_init(upipe_rtp_fec_enc_output_to_upipe(
+                upipe_rtp_fec_enc_to_col_subpipe(upipe_rtp_fec_enc)),
+            &upipe_rtp_fec_enc->sub_mgr, uprobe_col);
+    upipe_rtp_fec_enc_output_init(upipe_rtp_fec_enc_output_to_upipe(
+                upipe_rtp_fec_enc_to_row_subpipe(upipe_rtp_fec_enc)),
+            &upipe_rtp_fec_enc->sub_mgr, uprobe_row);
+
+    upipe_throw_ready(upipe);
+    return upipe;
+}
+
+/** @internal @This handles data.
+ *
+ * @param upipe description structure of the pipe
+ * @param uref uref structure
+ * @param upump_p reference to pump that generated the buffer
+ */
+static void upipe_rtp_fec_enc_input(struct upipe *upipe, struct uref *uref,
+                                    struct upump **upump_p)
+{
+    struct upipe_rtp_fec_enc *upipe_rtp_fec_enc =
+        upipe_rtp_fec_enc_from_upipe(upipe);
+    struct upipe *col = upipe_rtp_fec_enc_output_to_upipe(
+            upipe_rtp_fec_enc_to_col_subpipe(upipe_rtp_fec_enc));
+    struct upipe *row = upipe_rtp_fec_enc_output_to_upipe(
+            upipe_rtp_fec_enc_to_row_subpipe(upipe_rtp_fec_enc));
+    bool col_fec = upipe_rtp_fec_enc->col_subpipe.output != NULL;
+    bool row_fec = upipe_rtp_fec_enc->row_subpipe.output != NULL;
+
+    if (unlikely(upipe_rtp_fec_enc->ubuf_mgr == NULL ||
+                 upipe_rtp_fec_enc->failed || (!col_fec && !row_fec))) {
+        upipe_rtp_fec_enc_output(upipe, uref, upump_p);
+        return;
+    }
+
+    size_t size;
+    uint8_t rtp_buffer[RTP_HEADER_SIZE];
+    const uint8_t *rtp;
+    if (unlikely(!ubase_check(uref_block_size(uref, &size)) ||
+                 size < RTP_HEADER_SIZE ||
+                 (rtp = uref_block_peek(uref, 0, RTP_HEADER_SIZE,
+                                        rtp_buffer)) == NULL)) {
+        upipe_warn(upipe, "invalid buffer received");
+        uref_free(uref);
+        return;
+    }
+    uint8_t header[RTP_HEADER_SIZE];
+    memcpy(header, rtp, RTP_HEADER_SIZE);
+    uref_block_peek_unmap(uref, 0, rtp_buffer, rtp);
+
+    uint16_t seqnum = rtp_get_seqnum(header);
+    size_t payload_size = size - RTP_HEADER_SIZE;
+    if (unlikely(payload_size > FEC_PAYLOAD_MAX)) {
+        upipe_warn_va(upipe, "payload too large for FEC (%zu)", payload_size);
+        upipe_rtp_fec_enc_reset(upipe);
+        upipe_rtp_fec_enc_output(upipe, uref, upump_p);
+        return;
+    }
+
+    if (unlikely(upipe_rtp_fec_enc->expected_seqnum != UINT32_MAX &&
+                 upipe_rtp_fec_enc->expected_seqnum != seqnum)) {
+        upipe_warn_va(upipe, "discontinuity (%"PRIu32" -> %"PRIu16"), restarting matrix",
+                      upipe_rtp_fec_enc->expected_seqnum, seqnum);
+        upipe_rtp_fec_enc_reset(upipe);
+    }
+    upipe_rtp_fec_enc->expected_seqnum = (uint16_t)(seqnum + 1);
+
+    unsigned int column = upipe_rtp_fec_enc->index % upipe_rtp_fec_enc->columns;
+    unsigned int line = upipe_rtp_fec_enc->index / upipe_rtp_fec_enc->columns;
+    struct uref *col_uref = NULL, *row_uref = NULL;
+    int err = UBASE_ERR_NONE;
+
+    if (col_fec) {
+        struct upipe_rtp_fec_enc_acc *acc =
+            &upipe_rtp_fec_enc->col_acc[column];
+        if (line == 0)
+            err = upipe_rtp_fec_enc_acc_start(upipe, acc, seqnum);
+        if (ubase_check(err))
+            err = upipe_rtp_fec_enc_acc_add(acc, uref, header, payload_size);
+        if (ubase_check(err) && line == upipe_rtp_fec_enc->rows - 1)
+            col_uref = upipe_rtp_fec_enc_acc_end(col, acc, uref, header,
+                                                 upipe_rtp_fec_enc->columns,
+                                                 upipe_rtp_fec_enc->rows,
+                                                 false);
+    }
+
+    if (row_fec && ubase_check(err)) {
+        struct upipe_rtp_fec_enc_acc *acc = &upipe_rtp_fec_enc->row_acc;
+        if (column == 0)
+            err = upipe_rtp_fec_enc_acc_start(upipe, acc, seqnum);
+        if (ubase_check(err))
+            err = upipe_rtp_fec_enc_acc_add(acc, uref, header, payload_size);
+        if (ubase_check(err) && column == upipe_rtp_fec_enc->columns - 1)
+            row_uref = upipe_rtp_fec_enc_acc_end(row, acc, uref, header,
+                                                 1, upipe_rtp_fec_enc->columns,
+                                                 true);
+    }
+
+    if (unlikely(!ubase_check(err))) {
+        /* do not warn again for each packet */
+        upipe_warn(upipe, "unable to build FEC packets, disabling FEC");
+        upipe_rtp_fec_enc->failed = true;
+        upipe_rtp_fec_enc_reset(upipe);
+        uref_free(col_uref);
+        upipe_rtp_fec_enc_output(upipe, uref, upump_p);
+        return;
+    }
+
+    if (++upipe_rtp_fec_enc->index ==
+            upipe_rtp_fec_enc->columns * upipe_rtp_fec_enc->rows)
+        upipe_rtp_fec_enc->index = 0;
+
+    /* FEC packets follow the packets they protect */
+    upipe_rtp_fec_enc_output(upipe, uref, upump_p);
+    if (row_uref != NULL)
+        upipe_rtp_fec_enc_output_output(row, row_uref, upump_p);
+    if (col_uref != NULL)
+        upipe_rtp_fec_enc_output_output(col, col_uref, upump_p);
+}
+
+/** @internal @This checks if the ubuf manager is available.
+ *
+ * @param upipe description structure of the pipe
+ * @param flow_format amended flow format
+ * @return an error code
+ */
+static int upipe_rtp_fec_enc_check(struct upipe *upipe,
+                                   struct uref *flow_format)
+{
+    if (flow_format != NULL)
+        upipe_rtp_fec_enc_store_flow_def(upipe, flow_format);
+    return UBASE_ERR_NONE;
+}
+
+/** @internal @This sets the input flow definition.
+ *
+ * @param upipe description structure of the pipe
+ * @param flow_def flow definition packet
+ * @return an error code
+ */
+static int upipe_rtp_fec_enc_set_flow_def(struct upipe *upipe,
+                                          struct uref *flow_def)
+{
+    struct upipe_rtp_fec_enc *upipe_rtp_fec_enc =
+        upipe_rtp_fec_enc_from_upipe(upipe);
+    if (flow_def == NULL)
+        return UBASE_ERR_INVALID;
+    UBASE_RETURN(uref_flow_match_def(flow_def, EXPECTED_FLOW_DEF))
+
+    struct upipe *subs[2] = {
+        upipe_rtp_fec_enc_output_to_upipe(
+                upipe_rtp_fec_enc_to_col_subpipe(upipe_rtp_fec_enc)),
+        upipe_rtp_fec_enc_output_to_upipe(
+                upipe_rtp_fec_enc_to_row_subpipe(upipe_rtp_fec_enc))
+    };
+    for (int i = 0; i < 2; i++) {
+        struct uref *fec_flow_def = uref_block_flow_alloc_def(flow_def->mgr,
+                                                              NULL);
+        if (unlikely(fec_flow_def == NULL ||
+                     !ubase_check(uref_flow_set_def(fec_flow_def,
+                                                    FEC_FLOW_DEF)))) {
+            uref_free(fec_flow_def);
+            return UBASE_ERR_ALLOC;
+        }
+        upipe_rtp_fec_enc_output_store_flow_def(subs[i], fec_flow_def);
+    }
+
+    struct uref *flow_def_dup = uref_dup(flow_def);
+    if (unlikely(flow_def_dup == NULL))
+        return UBASE_ERR_ALLOC;
+    upipe_rtp_fec_enc_restart(upipe);
+    upipe_rtp_fec_enc_require_ubuf_mgr(upipe, flow_def_dup);
+    return UBASE_ERR_NONE;
+}
+
+/** @internal @This sets the size of the matrix.
+ *
+ * @param upipe description structure of the pipe
+ * @param columns number of columns
+ * @param rows number of rows
+ * @return an error code
+ */
+static int _upipe_rtp_fec_enc_set_matrix(struct upipe *upipe,
+                                         unsigned columns, unsigned rows)
+{
+    struct upipe_rtp_fec_enc *upipe_rtp_fec_enc =
+        upipe_rtp_fec_enc_from_upipe(upipe);
+    if (!columns || columns > FEC_COLUMNS_MAX ||
+        rows < FEC_ROWS_MIN || rows > FEC_ROWS_MAX ||
+        columns * rows > FEC_MATRIX_MAX) {
+        upipe_err_va(upipe, "invalid FEC matrix %ux%u", columns, rows);
+        return UBASE_ERR_INVALID;
+    }
+
+    upipe_rtp_fec_enc_restart(upipe);
+    upipe_rtp_fec_enc->columns = columns;
+    upipe_rtp_fec_enc->rows = rows;
+    upipe_dbg_va(upipe, "using a %ux%u FEC matrix", columns, rows);
+    return UBASE_ERR_NONE;
+}
+
+/** @internal @This processes control commands on a rtp fec encoder pipe.
+ *
+ * @param upipe description structure of the pipe
+ * @param command type of command to process
+ * @param args arguments of the command
+ * @return an error code
+ */
+static int upipe_rtp_fec_enc_control(struct upipe *upipe, int command,
+                                     va_list args)
+{
+    struct upipe_rtp_fec_enc *upipe_rtp_fec_enc =
+        upipe_rtp_fec_enc_from_upipe(upipe);
+
+    switch (command) {
+        case UPIPE_REGISTER_REQUEST: {
+            struct urequest *request = va_arg(args, struct urequest *);
+            return upipe_rtp_fec_enc_alloc_output_proxy(upipe, request);
+        }
+        case UPIPE_UNREGISTER_REQUEST: {
+            struct urequest *request = va_arg(args, struct urequest *);
+            return upipe_rtp_fec_enc_free_output_proxy(upipe, request);
+        }
+        case UPIPE_GET_FLOW_DEF:
+        case UPIPE_GET_OUTPUT:
+        case UPIPE_SET_OUTPUT:
+            return upipe_rtp_fec_enc_control_output(upipe, command, args);
+        case UPIPE_SET_FLOW_DEF: {
+            struct uref *flow_def = va_arg(args, struct uref *);
+            return upipe_rtp_fec_enc_set_flow_def(upipe, flow_def);
+        }
+
+        case UPIPE_RTP_FEC_ENC_GET_COL_SUB: {
+            UBASE_SIGNATURE_CHECK(args, UPIPE_RTP_FEC_ENC_SIGNATURE)
+            struct upipe **upipe_p = va_arg(args, struct upipe **);
+            *upipe_p = upipe_rtp_fec_enc_output_to_upipe(
+                    upipe_rtp_fec_enc_to_col_subpipe(upipe_rtp_fec_enc));
+            return UBASE_ERR_NONE;
+        }
+        case UPIPE_RTP_FEC_ENC_GET_ROW_SUB: {
+            UBASE_SIGNATURE_CHECK(args, UPIPE_RTP_FEC_ENC_SIGNATURE)
+            struct upipe **upipe_p = va_arg(args, struct upipe **);
+            *upipe_p = upipe_rtp_fec_enc_output_to_upipe(
+                    upipe_rtp_fec_enc_to_row_subpipe(upipe_rtp_fec_enc));
+            return UBASE_ERR_NONE;
+        }
+        case UPIPE_RTP_FEC_ENC_SET_MATRIX: {
+            UBASE_SIGNATURE_CHECK(args, UPIPE_RTP_FEC_ENC_SIGNATURE)
+            unsigned columns = va_arg(args, unsigned);
+            unsigned rows = va_arg(args, unsigned);
+            return _upipe_rtp_fec_enc_set_matrix(upipe, columns, rows);
+        }
+        case UPIPE_RTP_FEC_ENC_GET_MATRIX: {
+            UBASE_SIGNATURE_CHECK(args, UPIPE_RTP_FEC_ENC_SIGNATURE)
+            unsigned *columns_p = va_arg(args, unsigned *);
+            unsigned *rows_p = va_arg(args, unsigned *);
+            if (columns_p != NULL)
+                *columns_p = upipe_rtp_fec_enc->columns;
+            if (rows_p != NULL)
+                *rows_p = upipe_rtp_fec_enc->rows;
+            return UBASE_ERR_NONE;
+        }
+
+        default:
+            return UBASE_ERR_UNHANDLED;
+    }
+}
+
+/** @This frees a upipe.
+ *
+ * @param upipe description structure of the pipe
+ */
+static void upipe_rtp_fec_enc_free(struct upipe *upipe)
+{
+    struct upipe_rtp_fec_enc *upipe_rtp_fec_enc =
+        upipe_rtp_fec_enc_from_upipe(upipe);
+
+    upipe_rtp_fec_enc_output_clean(upipe_rtp_fec_enc_output_to_upipe(
+                upipe_rtp_fec_enc_to_col_subpipe(upipe_rtp_fec_enc)));
+    upipe_rtp_fec_enc_output_clean(upipe_rtp_fec_enc_output_to_upipe(
+                upipe_rtp_fec_enc_to_row_subpipe(upipe_rtp_fec_enc)));
+
+    upipe_throw_dead(upipe);
+
+    upipe_rtp_fec_enc_reset(upipe);
+    upipe_rtp_fec_enc_clean_ubuf_mgr(upipe);
+    upipe_rtp_fec_enc_clean_output(upipe);
+    upipe_rtp_fec_enc_clean_urefcount(upipe);
+
+    upipe_clean(upipe);
+    free(upipe_rtp_fec_enc);
+}
+
+/** module manager static descriptor */
+static struct upipe_mgr upipe_rtp_fec_enc_mgr = {
+    .refcount = NULL,
+    .signature = UPIPE_RTP_FEC_ENC_SIGNATURE,
+
+    .upipe_alloc = _upipe_rtp_fec_enc_alloc,
+    .upipe_input = upipe_rtp_fec_enc_input,
+    .upipe_control = upipe_rtp_fec_enc_control,
+
+    .upipe_mgr_control = NULL
+};
+
+/** @This returns the management structure for rtp fec encoder pipes.
+ *
+ * @return pointer to manager
+ */
+struct upipe_mgr *upipe_rtp_fec_enc_mgr_alloc(void)
+{
+    return &upipe_rtp_fec_enc_mgr;
+}
@@ -169,6 +169,8 @@ struct upipe_ts_demux_mgr {
     struct upipe_mgr *ts_pesd_mgr;
     /** pointer to autof manager */
     struct upipe_mgr *autof_mgr;
+    /** true if ts_pesd pipes reassemble PES in contiguous buffers */
+    bool pesd_contiguous;
 
     /** public upipe_mgr structure */
     struct upipe_mgr mgr;
@@ -746,6 +748,8 @@ static int upipe_ts_demux_output_plumber(struct upipe *upipe,
                                     UPROBE_LOG_VERBOSE, "pesd"));
         if (unlikely(output == NULL))
             return UBASE_ERR_ALLOC;
+        if (ts_demux_mgr->pesd_contiguous)
+            upipe_ts_pesd_set_contiguous(output, true);
         upipe_release(output);
         return UBASE_ERR_NONE;
     }
@@ -3250,6 +3254,18 @@ static int upipe_ts_demux_mgr_control(struct upipe_mgr *mgr,
         GET_SET_MGR(autof, AUTOF)
 #undef GET_SET_MGR
 
+        case UPIPE_TS_DEMUX_MGR_GET_PESD_CONTIGUOUS: {
+            UBASE_SIGNATURE_CHECK(args, UPIPE_TS_DEMUX_SIGNATURE)
+            bool *p = va_arg(args, bool *);
+            *p = ts_demux_mgr->pesd_contiguous;
+            return UBASE_ERR_NONE;
+        }
+        case UPIPE_TS_DEMUX_MGR_SET_PESD_CONTIGUOUS: {
+            UBASE_SIGNATURE_CHECK(args, UPIPE_TS_DEMUX_SIGNATURE)
+            ts_demux_mgr->pesd_contiguous = va_arg(args, int);
+            return UBASE_ERR_NONE;
+        }
+
         default:
             return UBASE_ERR_UNHANDLED;
     }
@@ -3288,6 +3304,7 @@ struct upipe_mgr *upipe_ts_demux_mgr_alloc(void)
     ts_demux_mgr->ts_scte35d_mgr = upipe_ts_scte35d_mgr_alloc();
 
     ts_demux_mgr->autof_mgr = NULL;
+    ts_demux_mgr->pesd_contiguous = false;
 
     urefcount_init(upipe_ts_demux_mgr_to_urefcount(ts_demux_mgr),
                    upipe_ts_demux_mgr_free);
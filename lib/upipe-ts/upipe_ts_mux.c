@@ -247,6 +247,8 @@ struct upipe_ts_mux {
     struct upump_mgr *upump_mgr;
     /** write watcher */
     struct upump *upump;
+    /** true if the write watcher is waiting for the next tick */
+    bool upump_armed;
 
     /** proxy probe */
     struct uprobe probe;
@@ -339,6 +341,8 @@ struct upipe_ts_mux {
     enum upipe_ts_mux_mode mode;
     /** MTU */
     size_t mtu;
+    /** true if output packets are written in contiguous buffers */
+    bool contiguous;
     /** size of the TB buffer */
     size_t tb_size;
 
@@ -2439,6 +2443,7 @@ static struct upipe *upipe_ts_mux_alloc(struct upipe_mgr *mgr,
     upipe_ts_mux_init_output(upipe);
     upipe_ts_mux_init_upump_mgr(upipe);
     upipe_ts_mux_init_upump(upipe);
+    upipe_ts_mux->upump_armed = false;
     upipe_ts_mux_init_uref_mgr(upipe);
     upipe_ts_mux_init_ubuf_mgr(upipe);
     upipe_ts_mux_init_uclock(upipe);
@@ -2489,6 +2494,7 @@ static struct upipe *upipe_ts_mux_alloc(struct upipe_mgr *mgr,
     upipe_ts_mux->mode = UPIPE_TS_MUX_MODE_CBR;
     upipe_ts_mux->tb_size = T_STD_TS_BUFFER;
     upipe_ts_mux->mtu = TS_SIZE;
+    upipe_ts_mux->contiguous = false;
     upipe_ts_mux->latency = 0;
     upipe_ts_mux->cr_sys = UINT64_MAX;
     upipe_ts_mux->cr_sys_remainder = 0;
@@ -2715,6 +2721,36 @@ upipe_ts_mux_splice_done:
     }
 }
 
+/** @internal @This copies a TS packet at the end of the contiguous buffer
+ * of the current uref. It fails if the current uref isn't contiguous, or
+ * if the packet doesn't fit in (the MTU was raised since the allocation).
+ *
+ * @param upipe description structure of the pipe
+ * @param ubuf ubuf containing the TS packet
+ * @return an error code
+ */
+static int upipe_ts_mux_copy(struct upipe *upipe, struct ubuf *ubuf)
+{
+    struct upipe_ts_mux *mux = upipe_ts_mux_from_upipe(upipe);
+    size_t size;
+    UBASE_RETURN(uref_block_size(mux->uref, &size))
+    if (size < mux->uref_size + TS_SIZE)
+        return UBASE_ERR_INVALID;
+
+    int write_size = TS_SIZE;
+    uint8_t *buffer;
+    UBASE_RETURN(uref_block_write(mux->uref, mux->uref_size, &write_size,
+                                  &buffer))
+    if (unlikely(write_size < TS_SIZE)) {
+        /* not a contiguous buffer */
+        uref_block_unmap(mux->uref, mux->uref_size);
+        return UBASE_ERR_INVALID;
+    }
+    int err = ubuf_block_extract(ubuf, 0, TS_SIZE, buffer);
+    uref_block_unmap(mux->uref, mux->uref_size);
+    return err;
+}
+
 /** @internal @This appends a uref to our buffer.
  *
  * @param upipe description structure of the pipe
@@ -2726,7 +2762,11 @@ static void upipe_ts_mux_append(struct upipe *upipe, struct ubuf *ubuf,
 {
     struct upipe_ts_mux *mux = upipe_ts_mux_from_upipe(upipe);
     if (mux->uref == NULL) {
-        mux->uref = uref_alloc(mux->uref_mgr);
+        if (mux->contiguous)
+            mux->uref = uref_block_alloc(mux->uref_mgr, mux->ubuf_mgr,
+                                         mux->mtu);
+        else
+            mux->uref = uref_alloc(mux->uref_mgr);
         if (unlikely(mux->uref == NULL)) {
             upipe_throw_fatal(upipe, UBASE_ERR_ALLOC);
             ubuf_free(ubuf);
@@ -2736,7 +2776,6 @@ static void upipe_ts_mux_append(struct upipe *upipe, struct ubuf *ubuf,
         if (dts_sys != UINT64_MAX)
             uref_clock_set_cr_dts_delay(mux->uref,
                     dts_sys - (mux->cr_sys - mux->latency));
-        uref_attach_ubuf(mux->uref, ubuf);
     } else {
         uint64_t current_dts_sys;
         if (dts_sys != UINT64_MAX &&
@@ -2745,8 +2784,14 @@ static void upipe_ts_mux_append(struct upipe *upipe, struct ubuf *ubuf,
              current_dts_sys > dts_sys))
             uref_clock_set_cr_dts_delay(mux->uref,
                     dts_sys - (mux->cr_sys - mux->latency));
-        uref_block_append(mux->uref, ubuf);
     }
+
+    if (mux->uref->ubuf == NULL)
+        uref_attach_ubuf(mux->uref, ubuf);
+    else if (ubase_check(upipe_ts_mux_copy(upipe, ubuf)))
+        ubuf_free(ubuf);
+    else
+        uref_block_append(mux->uref, ubuf);
     mux->uref_size += TS_SIZE;
 }
 
@@ -2759,6 +2804,10 @@ static void upipe_ts_mux_complete(struct upipe *upipe, struct upump **upump_p)
 {
     struct upipe_ts_mux *mux = upipe_ts_mux_from_upipe(upipe);
     struct uref *uref = mux->uref;
+    size_t size;
+    if (ubase_check(uref_block_size(uref, &size)) && size > mux->uref_size)
+        /* the MTU was lowered since the allocation */
+        uref_block_resize(uref, 0, mux->uref_size);
     mux->uref = NULL;
     mux->uref_size = 0;
     upipe_ts_mux_output(upipe, uref, upump_p);
@@ -2808,7 +2857,10 @@ static void _upipe_ts_mux_watcher(struct upipe *upipe)
             upipe_ts_mux_complete(upipe, &mux->upump);
     }
 
-    upipe_ts_mux_set_upump(upipe, NULL);
+    /* keep the watcher, it is re-armed for the next tick if possible */
+    if (mux->upump != NULL)
+        upump_stop(mux->upump);
+    mux->upump_armed = false;
     upipe_ts_mux_work(upipe, NULL);
 }
 
@@ -2952,7 +3004,7 @@ static void upipe_ts_mux_work_file(struct upipe *upipe, struct upump **upump_p)
 static void upipe_ts_mux_work_live(struct upipe *upipe, struct upump **upump_p)
 {
     struct upipe_ts_mux *mux = upipe_ts_mux_from_upipe(upipe);
-    if (likely(mux->upump != NULL))
+    if (likely(mux->upump != NULL && mux->upump_armed))
         return;
 
     upipe_ts_mux_check_upump_mgr(upipe);
@@ -2964,9 +3016,14 @@ static void upipe_ts_mux_work_live(struct upipe *upipe, struct upump **upump_p)
         uint64_t next_cr_sys = upipe_ts_mux_show_increment(upipe);
         uint64_t now = uclock_now(mux->uclock);
         if (next_cr_sys > now + mux->mux_delay) {
+            uint64_t timeout = next_cr_sys - now - mux->mux_delay;
+            if (mux->upump != NULL &&
+                ubase_check(upump_rearm(mux->upump, timeout, 0))) {
+                mux->upump_armed = true;
+                return;
+            }
             upump = upump_alloc_timer(mux->upump_mgr, upipe_ts_mux_watcher,
-                                      upipe, upipe->refcount,
-                                      next_cr_sys - now - mux->mux_delay, 0);
+                                      upipe, upipe->refcount, timeout, 0);
             if (unlikely(upump == NULL)) {
                 upipe_throw_fatal(upipe, UBASE_ERR_UPUMP);
                 return;
@@ -2990,6 +3047,7 @@ static void upipe_ts_mux_work_live(struct upipe *upipe, struct upump **upump_p)
     }
     upump_start(upump);
     upipe_ts_mux_set_upump(upipe, upump);
+    mux->upump_armed = true;
 }
 
 /** @internal @This checks if a packet must be output.
@@ -3553,6 +3611,35 @@ static int upipe_ts_mux_get_output_size(struct upipe *upipe,
     return UBASE_ERR_NONE;
 }
 
+/** @internal @This returns whether output packets are contiguous.
+ *
+ * @param upipe description structure of the pipe
+ * @param contiguous_p filled in with true if output packets are contiguous
+ * @return an error code
+ */
+static int _upipe_ts_mux_get_contiguous(struct upipe *upipe,
+                                        bool *contiguous_p)
+{
+    struct upipe_ts_mux *upipe_ts_mux = upipe_ts_mux_from_upipe(upipe);
+    assert(contiguous_p != NULL);
+    *contiguous_p = upipe_ts_mux->contiguous;
+    return UBASE_ERR_NONE;
+}
+
+/** @internal @This sets whether output packets are contiguous. It applies
+ * from the next output packet.
+ *
+ * @param upipe description structure of the pipe
+ * @param contiguous true to write output packets in contiguous buffers
+ * @return an error code
+ */
+static int _upipe_ts_mux_set_contiguous(struct upipe *upipe, bool contiguous)
+{
+    struct upipe_ts_mux *upipe_ts_mux = upipe_ts_mux_from_upipe(upipe);
+    upipe_ts_mux->contiguous = contiguous;
+    return UBASE_ERR_NONE;
+}
+
 /** @internal @This sets the configured mtu.
  *
  * @param upipe description structure of the pipe
@@ -4411,6 +4498,16 @@ static int _upipe_ts_mux_control(struct upipe *upipe, int command, va_list args)
             const char *encoding = va_arg(args, const char *);
             return _upipe_ts_mux_set_encoding(upipe, encoding);
         }
+        case UPIPE_TS_MUX_GET_CONTIGUOUS: {
+            UBASE_SIGNATURE_CHECK(args, UPIPE_TS_MUX_SIGNATURE)
+            bool *contiguous_p = va_arg(args, bool *);
+            return _upipe_ts_mux_get_contiguous(upipe, contiguous_p);
+        }
+        case UPIPE_TS_MUX_SET_CONTIGUOUS: {
+            UBASE_SIGNATURE_CHECK(args, UPIPE_TS_MUX_SIGNATURE)
+            bool contiguous = va_arg(args, int);
+            return _upipe_ts_mux_set_contiguous(upipe, contiguous);
+        }
 
         case UPIPE_TS_MUX_GET_VERSION:
         case UPIPE_TS_MUX_SET_VERSION:
@@ -4460,9 +4557,7 @@ static void upipe_ts_mux_free(struct urefcount *urefcount_real)
     struct upipe *upipe = upipe_ts_mux_to_upipe(mux);
 
     if (mux->uref != NULL) {
-        size_t uref_size;
-        while ((ubase_check(uref_block_size(mux->uref, &uref_size)) &&
-                uref_size < mux->mtu)) {
+        while (mux->uref_size < mux->mtu) {
             struct ubuf *ubuf = ubuf_dup(mux->padding);
             if (ubuf == NULL)
                 break;
@@ -4624,6 +4719,8 @@ const char *upipe_ts_mux_command_str(int cmd)
         UBASE_CASE_TO_STR(UPIPE_TS_MUX_SET_ENCODING);
         UBASE_CASE_TO_STR(UPIPE_TS_MUX_FREEZE_PSI);
         UBASE_CASE_TO_STR(UPIPE_TS_MUX_PREPARE);
+        UBASE_CASE_TO_STR(UPIPE_TS_MUX_GET_CONTIGUOUS);
+        UBASE_CASE_TO_STR(UPIPE_TS_MUX_SET_CONTIGUOUS);
         default: break;
     }
     return NULL;
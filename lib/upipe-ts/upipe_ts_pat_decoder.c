@@ -204,7 +204,7 @@ static bool upipe_ts_patd_table_validate(struct upipe *upipe)
                                                   &section))))
             return false;
 
-        if (!pat_validate(section) || !psi_check_crc(section)) {
+        if (!pat_validate(section) || !upipe_ts_psid_check_crc(section)) {
             uref_block_unmap(section_uref, 0);
             return false;
         }
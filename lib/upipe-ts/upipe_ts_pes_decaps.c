@@ -30,6 +30,7 @@
 #include <upipe/uref_block.h>
 #include <upipe/uref_clock.h>
 #include <upipe/ubuf.h>
+#include <upipe/ubuf_block.h>
 #include <upipe/uclock.h>
 #include <upipe/upipe.h>
 #include <upipe/upipe_helper_upipe.h>
@@ -37,6 +38,7 @@
 #include <upipe/upipe_helper_void.h>
 #include <upipe/upipe_helper_sync.h>
 #include <upipe/upipe_helper_output.h>
+#include <upipe/upipe_helper_ubuf_mgr.h>
 #include <upipe-ts/upipe_ts_pes_decaps.h>
 
 #include <stdlib.h>
@@ -54,6 +56,11 @@
 #define POW2_33 UINT64_C(8589934592)
 /** max DTS/PTS delay */
 #define MAX_DELAY (UCLOCK_FREQ * 60)
+/** minimum size of the buffer of a reassembled PES of unknown length */
+#define MIN_PES_CAPACITY 4096
+
+/** @hidden */
+static int upipe_ts_pesd_check(struct upipe *upipe, struct uref *flow_format);
 
 /** @internal @This is the private context of a ts_pesd pipe. */
 struct upipe_ts_pesd {
@@ -69,6 +76,13 @@ struct upipe_ts_pesd {
     /** list of output requests */
     struct uchain request_list;
 
+    /** ubuf manager */
+    struct ubuf_mgr *ubuf_mgr;
+    /** flow format packet */
+    struct uref *flow_format;
+    /** ubuf manager request */
+    struct urequest ubuf_mgr_request;
+
     /** next uref to be processed */
     struct uref *next_uref;
     /** size of next uref */
@@ -80,6 +94,19 @@ struct upipe_ts_pesd {
     /** true if subsequent (non-start) packets have to be dropped */
     bool drop;
 
+    /** true if PES are reassembled in contiguous buffers */
+    bool contiguous;
+    /** PES being reassembled */
+    struct uref *pes_uref;
+    /** number of octets of payload in the PES being reassembled */
+    size_t pes_fill;
+    /** size of the buffer of the PES being reassembled */
+    size_t pes_capacity;
+    /** true if the length of the PES being reassembled is unknown */
+    bool pes_unbounded;
+    /** size of the last PES of unknown length */
+    size_t pes_hint;
+
     /** public upipe structure */
     struct upipe upipe;
 };
@@ -89,6 +116,10 @@ UPIPE_HELPER_UREFCOUNT(upipe_ts_pesd, urefcount, upipe_ts_pesd_free)
 UPIPE_HELPER_VOID(upipe_ts_pesd)
 UPIPE_HELPER_SYNC(upipe_ts_pesd, acquired)
 UPIPE_HELPER_OUTPUT(upipe_ts_pesd, output, flow_def, output_state, request_list)
+UPIPE_HELPER_UBUF_MGR(upipe_ts_pesd, ubuf_mgr, flow_format, ubuf_mgr_request,
+                      upipe_ts_pesd_check,
+                      upipe_ts_pesd_register_output_request,
+                      upipe_ts_pesd_unregister_output_request)
 
 /** @internal @This allocates a ts_pesd pipe.
  *
@@ -111,9 +142,16 @@ static struct upipe *upipe_ts_pesd_alloc(struct upipe_mgr *mgr,
     upipe_ts_pesd_init_urefcount(upipe);
     upipe_ts_pesd_init_sync(upipe);
     upipe_ts_pesd_init_output(upipe);
+    upipe_ts_pesd_init_ubuf_mgr(upipe);
     upipe_ts_pesd->drop = true;
     upipe_ts_pesd->next_uref = NULL;
     upipe_ts_pesd->next_uref_size = 0;
+    upipe_ts_pesd->contiguous = false;
+    upipe_ts_pesd->pes_uref = NULL;
+    upipe_ts_pesd->pes_fill = 0;
+    upipe_ts_pesd->pes_capacity = 0;
+    upipe_ts_pesd->pes_unbounded = false;
+    upipe_ts_pesd->pes_hint = 0;
     upipe_throw_ready(upipe);
     return upipe;
 }
@@ -131,11 +169,154 @@ static void upipe_ts_pesd_flush(struct upipe *upipe, bool lost)
         upipe_ts_pesd->next_uref = NULL;
         upipe_ts_pesd->next_uref_size = 0;
     }
+    if (upipe_ts_pesd->pes_uref != NULL) {
+        uref_free(upipe_ts_pesd->pes_uref);
+        upipe_ts_pesd->pes_uref = NULL;
+    }
     if (lost)
         upipe_ts_pesd_sync_lost(upipe);
     upipe_ts_pesd->drop = true;
 }
 
+/** @internal @This outputs the PES being reassembled.
+ *
+ * @param upipe description structure of the pipe
+ * @param upump_p reference to pump that generated the buffer
+ */
+static void upipe_ts_pesd_output_pes(struct upipe *upipe,
+                                     struct upump **upump_p)
+{
+    struct upipe_ts_pesd *upipe_ts_pesd = upipe_ts_pesd_from_upipe(upipe);
+    struct uref *uref = upipe_ts_pesd->pes_uref;
+    upipe_ts_pesd->pes_uref = NULL;
+    if (upipe_ts_pesd->pes_unbounded) {
+        /* the PES ends with the start of the next one */
+        upipe_ts_pesd->pes_hint = upipe_ts_pesd->pes_fill;
+        uref_block_set_end(uref);
+    }
+
+    if (unlikely(!ubase_check(uref_block_resize(uref, 0,
+                                                upipe_ts_pesd->pes_fill)))) {
+        uref_free(uref);
+        upipe_throw_fatal(upipe, UBASE_ERR_INVALID);
+        return;
+    }
+    upipe_ts_pesd_output(upipe, uref, upump_p);
+}
+
+/** @internal @This copies a PES chunk at the end of the PES being
+ * reassembled, growing its buffer if needed.
+ *
+ * @param upipe description structure of the pipe
+ * @param chunk buffer of the PES chunk
+ * @param size size of the PES chunk
+ * @param remaining number of octets of the PES still to receive, used as a
+ * size hint
+ * @return an error code
+ */
+static int upipe_ts_pesd_copy(struct upipe *upipe, struct ubuf *chunk,
+                              size_t size, size_t remaining)
+{
+    struct upipe_ts_pesd *upipe_ts_pesd = upipe_ts_pesd_from_upipe(upipe);
+    struct uref *pes_uref = upipe_ts_pesd->pes_uref;
+    size_t fill = upipe_ts_pesd->pes_fill;
+    uint8_t *buffer;
+    int write_size;
+
+    if (pes_uref->ubuf == NULL || fill + size > upipe_ts_pesd->pes_capacity) {
+        size_t capacity = upipe_ts_pesd->pes_capacity * 2;
+        if (capacity < fill + size + remaining)
+            capacity = fill + size + remaining;
+        struct ubuf *ubuf = ubuf_block_alloc(upipe_ts_pesd->ubuf_mgr,
+                                             capacity);
+        UBASE_ALLOC_RETURN(ubuf);
+        if (fill) {
+            write_size = fill;
+            if (unlikely(!ubase_check(ubuf_block_write(ubuf, 0, &write_size,
+                                                       &buffer)))) {
+                ubuf_free(ubuf);
+                return UBASE_ERR_ALLOC;
+            }
+            assert(write_size == fill);
+            ubuf_block_extract(pes_uref->ubuf, 0, fill, buffer);
+            ubuf_block_unmap(ubuf, 0);
+        }
+        uref_attach_ubuf(pes_uref, ubuf);
+        upipe_ts_pesd->pes_capacity = capacity;
+    }
+
+    write_size = size;
+    UBASE_RETURN(uref_block_write(pes_uref, fill, &write_size, &buffer))
+    assert(write_size == size);
+    ubuf_block_extract(chunk, 0, size, buffer);
+    uref_block_unmap(pes_uref, fill);
+    upipe_ts_pesd->pes_fill += size;
+    return UBASE_ERR_NONE;
+}
+
+/** @internal @This appends a PES chunk to the PES being reassembled, and
+ * outputs it if it is complete.
+ *
+ * @param upipe description structure of the pipe
+ * @param uref PES chunk
+ * @param remaining number of octets of the PES still to receive, or 0 if
+ * unknown
+ * @param upump_p reference to pump that generated the buffer
+ */
+static void upipe_ts_pesd_gather(struct upipe *upipe, struct uref *uref,
+                                 size_t remaining, struct upump **upump_p)
+{
+    struct upipe_ts_pesd *upipe_ts_pesd = upipe_ts_pesd_from_upipe(upipe);
+    bool end = ubase_check(uref_block_get_end(uref));
+    size_t size;
+    if (unlikely(!ubase_check(uref_block_size(uref, &size)))) {
+        uref_free(uref);
+        return;
+    }
+
+    if (unlikely(upipe_ts_pesd->ubuf_mgr == NULL)) {
+        /* no buffer to reassemble into, let the chunks go through */
+        if (upipe_ts_pesd->pes_uref != NULL) {
+            upipe_ts_pesd->pes_unbounded = false;
+            upipe_ts_pesd_output_pes(upipe, upump_p);
+        }
+        upipe_ts_pesd_output(upipe, uref, upump_p);
+        return;
+    }
+
+    if (upipe_ts_pesd->pes_uref == NULL && end) {
+        /* the PES fits in a single chunk */
+        upipe_ts_pesd_output(upipe, uref, upump_p);
+        return;
+    }
+
+    struct ubuf *chunk = uref_detach_ubuf(uref);
+    if (upipe_ts_pesd->pes_uref == NULL) {
+        /* the first chunk carries the attributes of the PES */
+        upipe_ts_pesd->pes_uref = uref;
+        upipe_ts_pesd->pes_fill = 0;
+        upipe_ts_pesd->pes_capacity = 0;
+        upipe_ts_pesd->pes_unbounded = !remaining;
+        if (!remaining)
+            remaining = upipe_ts_pesd->pes_hint > MIN_PES_CAPACITY ?
+                        upipe_ts_pesd->pes_hint : MIN_PES_CAPACITY;
+    } else
+        uref_free(uref);
+
+    int err = upipe_ts_pesd_copy(upipe, chunk, size, remaining);
+    ubuf_free(chunk);
+    if (unlikely(!ubase_check(err))) {
+        upipe_ts_pesd_flush(upipe, false);
+        upipe_throw_fatal(upipe, err);
+        return;
+    }
+
+    if (end) {
+        uref_block_set_end(upipe_ts_pesd->pes_uref);
+        upipe_ts_pesd_output_pes(upipe, upump_p);
+    }
+}
+
 /** @internal @This outputs a PES chunk, and checks if it is the end of the PES.
  *
  * @param upipe description structure of the pipe
@@ -147,12 +328,19 @@ static void upipe_ts_pesd_check_output(struct upipe *upipe,
     struct upipe_ts_pesd *upipe_ts_pesd = upipe_ts_pesd_from_upipe(upipe);
     upipe_ts_pesd_sync_acquired(upipe);
     upipe_ts_pesd->drop = false;
+    size_t remaining = upipe_ts_pesd->next_pes_size >
+                       upipe_ts_pesd->next_uref_size ?
+        upipe_ts_pesd->next_pes_size - upipe_ts_pesd->next_uref_size : 0;
     if (upipe_ts_pesd->next_uref_size == upipe_ts_pesd->next_pes_size) {
         uref_block_set_end(upipe_ts_pesd->next_uref);
         upipe_ts_pesd->next_uref_size = upipe_ts_pesd->next_pes_size = 0;
     }
-    upipe_ts_pesd_output(upipe, upipe_ts_pesd->next_uref, upump_p);
+    struct uref *uref = upipe_ts_pesd->next_uref;
     upipe_ts_pesd->next_uref = NULL;
+    if (upipe_ts_pesd->contiguous)
+        upipe_ts_pesd_gather(upipe, uref, remaining, upump_p);
+    else
+        upipe_ts_pesd_output(upipe, uref, upump_p);
 }
 
 /** @internal @This parses and removes the PES header of a packet.
@@ -316,6 +504,8 @@ static void upipe_ts_pesd_input(struct upipe *upipe, struct uref *uref,
     }
 
     if (ubase_check(uref_block_get_start(uref))) {
+        if (upipe_ts_pesd->pes_uref != NULL)
+            upipe_ts_pesd_output_pes(upipe, upump_p);
         if (unlikely(upipe_ts_pesd->next_uref != NULL)) {
             upipe_warn(upipe, "truncated PES header");
             uref_free(upipe_ts_pesd->next_uref);
@@ -344,6 +534,39 @@ static void upipe_ts_pesd_input(struct upipe *upipe, struct uref *uref,
         uref_free(uref);
 }
 
+/** @internal @This receives the ubuf manager used to reassemble PES.
+ *
+ * @param upipe description structure of the pipe
+ * @param flow_format amended flow format
+ * @return an error code
+ */
+static int upipe_ts_pesd_check(struct upipe *upipe, struct uref *flow_format)
+{
+    if (flow_format != NULL)
+        upipe_ts_pesd_store_flow_def(upipe, flow_format);
+    return UBASE_ERR_NONE;
+}
+
+/** @internal @This requests a ubuf manager to reassemble PES, replacing the
+ * previous one.
+ *
+ * @param upipe description structure of the pipe
+ */
+static void upipe_ts_pesd_demand(struct upipe *upipe)
+{
+    struct upipe_ts_pesd *upipe_ts_pesd = upipe_ts_pesd_from_upipe(upipe);
+    if (upipe_ts_pesd->flow_def == NULL)
+        return;
+
+    struct uref *flow_format = uref_dup(upipe_ts_pesd->flow_def);
+    if (unlikely(flow_format == NULL)) {
+        upipe_throw_fatal(upipe, UBASE_ERR_ALLOC);
+        return;
+    }
+    if (!upipe_ts_pesd_demand_ubuf_mgr(upipe, flow_format))
+        upipe_warn(upipe, "no ubuf manager, PES are not reassembled");
+}
+
 /** @internal @This sets the input flow definition.
  *
  * @param upipe description structure of the pipe
@@ -368,6 +591,29 @@ static int upipe_ts_pesd_set_flow_def(struct upipe *upipe,
                                        def + strlen(EXPECTED_FLOW_DEF)))))
         upipe_throw_fatal(upipe, UBASE_ERR_ALLOC);
     upipe_ts_pesd_store_flow_def(upipe, flow_def_dup);
+    if (upipe_ts_pesd_from_upipe(upipe)->contiguous)
+        upipe_ts_pesd_demand(upipe);
+    return UBASE_ERR_NONE;
+}
+
+/** @internal @This sets whether PES are reassembled in contiguous buffers.
+ *
+ * @param upipe description structure of the pipe
+ * @param contiguous true to reassemble PES
+ * @return an error code
+ */
+static int _upipe_ts_pesd_set_contiguous(struct upipe *upipe,
+                                         bool contiguous)
+{
+    struct upipe_ts_pesd *upipe_ts_pesd = upipe_ts_pesd_from_upipe(upipe);
+    if (!contiguous && upipe_ts_pesd->pes_uref != NULL) {
+        /* the remaining chunks will be appended downstream */
+        upipe_ts_pesd->pes_unbounded = false;
+        upipe_ts_pesd_output_pes(upipe, NULL);
+    }
+    upipe_ts_pesd->contiguous = contiguous;
+    if (contiguous && upipe_ts_pesd->ubuf_mgr == NULL)
+        upipe_ts_pesd_demand(upipe);
     return UBASE_ERR_NONE;
 }
 
@@ -386,6 +632,19 @@ static int upipe_ts_pesd_control(struct upipe *upipe, int command, va_list args)
             struct uref *flow_def = va_arg(args, struct uref *);
             return upipe_ts_pesd_set_flow_def(upipe, flow_def);
         }
+        case UPIPE_TS_PESD_GET_CONTIGUOUS: {
+            UBASE_SIGNATURE_CHECK(args, UPIPE_TS_PESD_SIGNATURE)
+            struct upipe_ts_pesd *upipe_ts_pesd =
+                upipe_ts_pesd_from_upipe(upipe);
+            bool *contiguous_p = va_arg(args, bool *);
+            *contiguous_p = upipe_ts_pesd->contiguous;
+            return UBASE_ERR_NONE;
+        }
+        case UPIPE_TS_PESD_SET_CONTIGUOUS: {
+            UBASE_SIGNATURE_CHECK(args, UPIPE_TS_PESD_SIGNATURE)
+            bool contiguous = va_arg(args, int);
+            return _upipe_ts_pesd_set_contiguous(upipe, contiguous);
+        }
         default:
             return UBASE_ERR_UNHANDLED;
     }
@@ -400,11 +659,14 @@ static void upipe_ts_pesd_free(struct upipe *upipe)
     struct upipe_ts_pesd *upipe_ts_pesd = upipe_ts_pesd_from_upipe(upipe);
     upipe_throw_dead(upipe);
 
+    upipe_ts_pesd_clean_ubuf_mgr(upipe);
     upipe_ts_pesd_clean_output(upipe);
     upipe_ts_pesd_clean_sync(upipe);
 
     if (upipe_ts_pesd->next_uref != NULL)
         uref_free(upipe_ts_pesd->next_uref);
+    if (upipe_ts_pesd->pes_uref != NULL)
+        uref_free(upipe_ts_pesd->pes_uref);
     upipe_ts_pesd_clean_urefcount(upipe);
     upipe_ts_pesd_free_void(upipe);
 }
@@ -592,7 +592,7 @@ static void upipe_ts_pmtd_input(struct upipe *upipe, struct uref *uref,
     struct upipe_ts_pmtd *upipe_ts_pmtd = upipe_ts_pmtd_from_upipe(upipe);
     assert(upipe_ts_pmtd->flow_def_input != NULL);
     if (upipe_ts_pmtd->pmt != NULL &&
-        ubase_check(uref_block_equal(upipe_ts_pmtd->pmt, uref))) {
+        upipe_ts_psid_equal(upipe_ts_pmtd->pmt, uref)) {
         /* Identical PMT. */
         upipe_throw_new_rap(upipe, uref);
         uref_free(uref);
@@ -220,7 +220,7 @@ static bool upipe_ts_sdtd_table_validate(struct upipe *upipe)
                                                   &section))))
             return false;
 
-        if (!sdt_validate(section) || !psi_check_crc(section)) {
+        if (!sdt_validate(section) || !upipe_ts_psid_check_crc(section)) {
             uref_block_unmap(section_uref, 0);
             return false;
         }
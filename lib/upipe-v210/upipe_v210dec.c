@@ -65,6 +65,8 @@ static const char *v210_chroma_str = "u10y10v10y10u10y10v10y10u10y10v10y10";
 enum v210dec_output_type {
     V2D_OUTPUT_PLANAR_8 = 1,
     V2D_OUTPUT_PLANAR_10,
+    V2D_OUTPUT_420_8,
+    V2D_OUTPUT_420_10,
 };
 
 /** upipe_v210dec structure with v210dec parameters */
@@ -104,6 +106,10 @@ struct upipe_v210dec {
     void (*v210_to_planar_8)(const void *src, uint8_t *y, uint8_t *u, uint8_t *v, uintptr_t pixels);
     /** 10-bit line packing function **/
     void (*v210_to_planar_10)(const void *src, uint16_t *y, uint16_t *u, uint16_t *v, uintptr_t pixels);
+    /** 8-bit line pair packing function, averaging chroma **/
+    void (*v210_to_yuv420p_8)(const void *src0, const void *src1, uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v, uintptr_t pixels);
+    /** 10-bit line pair packing function, averaging chroma **/
+    void (*v210_to_yuv420p_10)(const void *src0, const void *src1, uint16_t *y0, uint16_t *y1, uint16_t *u, uint16_t *v, uintptr_t pixels);
 
     /** output chroma map */
     const char *output_chroma_map[UPIPE_V210_MAX_PLANES+1];
@@ -169,6 +175,20 @@ static void v210dec_setup_asm(struct upipe *upipe, bool assembly)
 
     v210dec->v210_to_planar_8  = upipe_v210_to_planar_8_c;
     v210dec->v210_to_planar_10 = upipe_v210_to_planar_10_c;
+    v210dec->v210_to_yuv420p_8  = upipe_v210_to_yuv420p_8_c;
+    v210dec->v210_to_yuv420p_10 = upipe_v210_to_yuv420p_10_c;
+
+#ifdef UPIPE_V210_AVX512
+    /* AVX-512 versions have no alignment requirement */
+    if (__builtin_cpu_supports("avx512bw") &&
+        __builtin_cpu_supports("avx512vl")) {
+        v210dec->v210_to_planar_8  = upipe_v210_to_planar_8_avx512;
+        v210dec->v210_to_planar_10 = upipe_v210_to_planar_10_avx512;
+        v210dec->v210_to_yuv420p_8  = upipe_v210_to_yuv420p_8_avx512;
+        v210dec->v210_to_yuv420p_10 = upipe_v210_to_yuv420p_10_avx512;
+        return;
+    }
+#endif
 
     if (!assembly)
         return;
@@ -237,6 +257,19 @@ static bool upipe_v210dec_handle(struct upipe *upipe, struct uref *uref,
         return true;
     }
 
+    /* 4:2:0 chroma averages two lines of the same field, that is lines 0/1
+     * of progressive pictures, and lines 0/2 and 1/3 of interlaced ones */
+    int pair = ubase_check(uref_pic_get_progressive(uref)) ? 1 : 2;
+    if (unlikely((v210dec->output_type == V2D_OUTPUT_420_8 ||
+                  v210dec->output_type == V2D_OUTPUT_420_10) &&
+                 input_vsize % (2 * pair))) {
+        upipe_warn_va(upipe, "invalid %s picture height %zu for 4:2:0",
+                      pair == 1 ? "progressive" : "interlaced", input_vsize);
+        uref_pic_plane_unmap(uref, v210_chroma_str, 0, 0, -1, -1);
+        uref_free(uref);
+        return true;
+    }
+
     uint8_t *output_planes[3];
     size_t output_strides[3];
     struct ubuf *ubuf = ubuf_pic_alloc(v210dec->ubuf_mgr, output_hsize, input_vsize);
@@ -340,6 +373,46 @@ static bool upipe_v210dec_handle(struct upipe *upipe, struct uref *uref,
             }
         } break;
 
+        case V2D_OUTPUT_420_8: {
+            /* the last group of 6 pixels is decoded entirely, in the
+             * horizontal margin of the output planes */
+            uintptr_t w = ((output_hsize + 5) / 6) * 6;
+            for (int h = 0; h < input_vsize; h += 2 * pair) {
+                for (int f = 0; f < pair; f++) {
+                    int l = h + f;
+                    int c = h / 2 + f;
+                    v210dec->v210_to_yuv420p_8(
+                            input_plane + l * input_stride,
+                            input_plane + (l + pair) * input_stride,
+                            output_planes[0] + l * output_strides[0],
+                            output_planes[0] + (l + pair) * output_strides[0],
+                            output_planes[1] + c * output_strides[1],
+                            output_planes[2] + c * output_strides[2], w);
+                }
+            }
+        } break;
+
+        case V2D_OUTPUT_420_10: {
+            uintptr_t w = ((output_hsize + 5) / 6) * 6;
+            for (int h = 0; h < input_vsize; h += 2 * pair) {
+                for (int f = 0; f < pair; f++) {
+                    int l = h + f;
+                    int c = h / 2 + f;
+                    v210dec->v210_to_yuv420p_10(
+                            input_plane + l * input_stride,
+                            input_plane + (l + pair) * input_stride,
+                            (uint16_t *)(output_planes[0] +
+                                         l * output_strides[0]),
+                            (uint16_t *)(output_planes[0] +
+                                         (l + pair) * output_strides[0]),
+                            (uint16_t *)(output_planes[1] +
+                                         c * output_strides[1]),
+                            (uint16_t *)(output_planes[2] +
+                                         c * output_strides[2]), w);
+                }
+            }
+        } break;
+
         default:
             assert(0);
     }
@@ -491,6 +564,32 @@ static int upipe_v210dec_set_flow_def(struct upipe *upipe, struct uref *flow_def
             UBASE_RETURN(uref_pic_flow_set_hmappend(output_flow, 6 + 8));
         } break;
 
+        case V2D_OUTPUT_420_8: {
+            v210dec->output_chroma_map[0] = "y8";
+            v210dec->output_chroma_map[1] = "u8";
+            v210dec->output_chroma_map[2] = "v8";
+            uref_pic_flow_clear_format(output_flow);
+            UBASE_RETURN(uref_pic_flow_set_align(output_flow, 32));
+            UBASE_RETURN(uref_pic_flow_set_macropixel(output_flow, 1))
+            UBASE_RETURN(uref_pic_flow_add_plane(output_flow, 1, 1, 1, "y8"))
+            UBASE_RETURN(uref_pic_flow_add_plane(output_flow, 2, 2, 1, "u8"))
+            UBASE_RETURN(uref_pic_flow_add_plane(output_flow, 2, 2, 1, "v8"))
+            UBASE_RETURN(uref_pic_flow_set_hmappend(output_flow, 12 + 16));
+        } break;
+
+        case V2D_OUTPUT_420_10: {
+            v210dec->output_chroma_map[0] = "y10l";
+            v210dec->output_chroma_map[1] = "u10l";
+            v210dec->output_chroma_map[2] = "v10l";
+            uref_pic_flow_clear_format(output_flow);
+            UBASE_RETURN(uref_pic_flow_set_align(output_flow, 32));
+            UBASE_RETURN(uref_pic_flow_set_macropixel(output_flow, 1))
+            UBASE_RETURN(uref_pic_flow_add_plane(output_flow, 1, 1, 2, "y10l"))
+            UBASE_RETURN(uref_pic_flow_add_plane(output_flow, 2, 2, 2, "u10l"))
+            UBASE_RETURN(uref_pic_flow_add_plane(output_flow, 2, 2, 2, "v10l"))
+            UBASE_RETURN(uref_pic_flow_set_hmappend(output_flow, 6 + 8));
+        } break;
+
         default:
             upipe_err(upipe, "unknown output format");
             uref_dump(flow_def, upipe->uprobe);
@@ -604,6 +703,20 @@ static struct upipe *upipe_v210dec_alloc(struct upipe_mgr *manager,
         PRINT_OUTPUT_TYPE(V2D_OUTPUT_PLANAR_10);
     }
 
+    else if (ubase_check(uref_pic_flow_check_chroma(flow_def, 1, 1, 1, "y8")) &&
+             ubase_check(uref_pic_flow_check_chroma(flow_def, 2, 2, 1, "u8")) &&
+             ubase_check(uref_pic_flow_check_chroma(flow_def, 2, 2, 1, "v8"))) {
+        v210dec->output_type = V2D_OUTPUT_420_8;
+        PRINT_OUTPUT_TYPE(V2D_OUTPUT_420_8);
+    }
+
+    else if (ubase_check(uref_pic_flow_check_chroma(flow_def, 1, 1, 2, "y10l")) &&
+             ubase_check(uref_pic_flow_check_chroma(flow_def, 2, 2, 2, "u10l")) &&
+             ubase_check(uref_pic_flow_check_chroma(flow_def, 2, 2, 2, "v10l"))) {
+        v210dec->output_type = V2D_OUTPUT_420_10;
+        PRINT_OUTPUT_TYPE(V2D_OUTPUT_420_10);
+    }
+
     else {
         upipe_err(upipe, "unknown output format");
         upipe_v210dec_free_flow(upipe);
@@ -101,6 +101,8 @@ struct upipe_v210enc {
 
     /** input bit depth **/
     int input_bit_depth;
+    /** input chroma vertical subsampling (1 for 4:2:2, 2 for 4:2:0) */
+    uint8_t input_vsub;
 
     /** 8-bit line packing function **/
     upipe_v210enc_pack_line_8 pack_line_8;
@@ -260,10 +262,15 @@ static bool upipe_v210enc_handle(struct upipe *upipe, struct uref *uref,
     uint8_t *dst = output_plane;
     int h, w;
     if (upipe_v210enc->input_bit_depth == 10) {
-        const uint16_t *y = (const uint16_t *)input_planes[0];
-        const uint16_t *u = (const uint16_t *)input_planes[1];
-        const uint16_t *v = (const uint16_t *)input_planes[2];
         for (h = 0; h < input_vsize; h++) {
+            /* 4:2:0 chroma lines are used for two lines */
+            int chroma_line = h / upipe_v210enc->input_vsub;
+            const uint16_t *y = (const uint16_t *)
+                (input_planes[0] + h * input_strides[0]);
+            const uint16_t *u = (const uint16_t *)
+                (input_planes[1] + chroma_line * input_strides[1]);
+            const uint16_t *v = (const uint16_t *)
+                (input_planes[2] + chroma_line * input_strides[2]);
             uint32_t val = 0;
             w = (input_hsize / 6) * 6;
             upipe_v210enc->pack_line_10(y, u, v, dst, w);
@@ -293,16 +300,14 @@ static bool upipe_v210enc_handle(struct upipe *upipe, struct uref *uref,
 
             memset(dst, 0, line_padding);
             dst += line_padding;
-            y += input_strides[0] / 2 - input_hsize;
-            u += input_strides[1] / 2 - input_hsize / 2;
-            v += input_strides[2] / 2 - input_hsize / 2;
         }
     }
     else {
-        const uint8_t *y = input_planes[0];
-        const uint8_t *u = input_planes[1];
-        const uint8_t *v = input_planes[2];
         for (h = 0; h < input_vsize; h++) {
+            int chroma_line = h / upipe_v210enc->input_vsub;
+            const uint8_t *y = input_planes[0] + h * input_strides[0];
+            const uint8_t *u = input_planes[1] + chroma_line * input_strides[1];
+            const uint8_t *v = input_planes[2] + chroma_line * input_strides[2];
             uint32_t val = 0;
             w = (input_hsize / 12) * 12;
             upipe_v210enc->pack_line_8(y, u, v, dst, w);
@@ -338,10 +343,6 @@ static bool upipe_v210enc_handle(struct upipe *upipe, struct uref *uref,
             }
             memset(dst, 0, line_padding);
             dst += line_padding;
-
-            y += input_strides[0] - input_hsize;
-            u += input_strides[1] - input_hsize / 2;
-            v += input_strides[2] - input_hsize / 2;
         }
     }
 
@@ -460,20 +461,28 @@ static int upipe_v210enc_set_flow_def(struct upipe *upipe, struct uref *flow_def
     if (!ubase_check(uref_pic_flow_get_macropixel(flow_def, &macropixel)))
         return UBASE_ERR_INVALID;
 
+    /* 4:2:0 input is packed directly, with chroma lines repeated */
+    uint8_t vsub = 1;
+    uint8_t plane = 0;
+    if (ubase_check(uref_pic_flow_find_chroma(flow_def, "u8", &plane)) ||
+        ubase_check(uref_pic_flow_find_chroma(flow_def, "u10l", &plane)))
+        uref_pic_flow_get_vsubsampling(flow_def, &vsub, plane);
+
 #define u ubase_check
-    if (!(macropixel == 1 &&
+    if (!(macropixel == 1 && (vsub == 1 || vsub == 2) &&
            ((u(uref_pic_flow_check_chroma(flow_def, 1, 1, 1, "y8")) &&
-             u(uref_pic_flow_check_chroma(flow_def, 2, 1, 1, "u8")) &&
-             u(uref_pic_flow_check_chroma(flow_def, 2, 1, 1, "v8"))) ||
+             u(uref_pic_flow_check_chroma(flow_def, 2, vsub, 1, "u8")) &&
+             u(uref_pic_flow_check_chroma(flow_def, 2, vsub, 1, "v8"))) ||
             (u(uref_pic_flow_check_chroma(flow_def, 1, 1, 2, "y10l")) &&
-             u(uref_pic_flow_check_chroma(flow_def, 2, 1, 2, "u10l")) &&
-             u(uref_pic_flow_check_chroma(flow_def, 2, 1, 2, "v10l")))))) {
+             u(uref_pic_flow_check_chroma(flow_def, 2, vsub, 2, "u10l")) &&
+             u(uref_pic_flow_check_chroma(flow_def, 2, vsub, 2, "v10l")))))) {
         upipe_err(upipe, "incompatible input flow def");
         uref_dump(flow_def, upipe->uprobe);
         return UBASE_ERR_EXTERNAL;
     }
 
     upipe_v210enc->input_bit_depth = u(uref_pic_flow_check_chroma(flow_def, 1, 1, 1, "y8")) ? 8 : 10;
+    upipe_v210enc->input_vsub = vsub;
 #undef u
 
     upipe_v210enc->output_chroma_map = "u10y10v10y10u10y10v10y10u10y10v10y10";
@@ -504,15 +513,22 @@ static int upipe_v210enc_provide_flow_format(struct upipe *upipe,
 
     uref_pic_flow_clear_format(flow_format);
 
-    uint8_t plane;
+    /* keep 4:2:0 if it was asked, to avoid a conversion */
+    uint8_t plane = 0, vsub = 1;
+    if (ubase_check(uref_pic_flow_find_chroma(request->uref, "u8", &plane)) ||
+        ubase_check(uref_pic_flow_find_chroma(request->uref, "u10l", &plane)))
+        uref_pic_flow_get_vsubsampling(request->uref, &vsub, plane);
+    if (vsub != 2)
+        vsub = 1;
+
     if (ubase_check(uref_pic_flow_find_chroma(request->uref, "y10l", &plane))) {
         uref_pic_flow_add_plane(flow_format, 1, 1, 2, "y10l");
-        uref_pic_flow_add_plane(flow_format, 2, 1, 2, "u10l");
-        uref_pic_flow_add_plane(flow_format, 2, 1, 2, "v10l");
+        uref_pic_flow_add_plane(flow_format, 2, vsub, 2, "u10l");
+        uref_pic_flow_add_plane(flow_format, 2, vsub, 2, "v10l");
     } else {
         uref_pic_flow_add_plane(flow_format, 1, 1, 1, "y8");
-        uref_pic_flow_add_plane(flow_format, 2, 1, 1, "u8");
-        uref_pic_flow_add_plane(flow_format, 2, 1, 1, "v8");
+        uref_pic_flow_add_plane(flow_format, 2, vsub, 1, "u8");
+        uref_pic_flow_add_plane(flow_format, 2, vsub, 1, "v8");
     }
 
     uref_pic_flow_set_macropixel(flow_format, 1);
@@ -598,6 +614,15 @@ static struct upipe *upipe_v210enc_alloc(struct upipe_mgr *mgr,
 #endif
 #endif
 
+#ifdef UPIPE_V210_AVX512
+    if (__builtin_cpu_supports("avx512bw") &&
+        __builtin_cpu_supports("avx512vl")) {
+        upipe_v210enc->pack_line_8  = upipe_planar_to_v210_8_avx512;
+        upipe_v210enc->pack_line_10 = upipe_planar_to_v210_10_avx512;
+    }
+#endif
+    upipe_v210enc->input_vsub = 1;
+
     upipe_v210enc_init_urefcount(upipe);
     upipe_v210enc_init_ubuf_mgr(upipe);
     upipe_v210enc_init_output(upipe);
@@ -30,6 +30,10 @@
 
 #include "v210dec.h"
 
+#ifdef UPIPE_V210_AVX512
+#include <immintrin.h>
+#endif
+
 // TODO: handle endianess
 
 static inline uint32_t rl32(const void *src)
@@ -79,3 +83,269 @@ void upipe_v210_to_planar_10_c(const void *src, uint16_t *y, uint16_t *u, uint16
         READ_PIXELS_10(y, v, y);
     }
 }
+
+/* chroma of a line pair, rounded as _mm_avg_epu* do */
+#define AVG(a, b) (((a) + (b) + 1) >> 1)
+
+void upipe_v210_to_yuv420p_8_c(const void *src0, const void *src1, uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v, uintptr_t pixels)
+{
+    for (uintptr_t i = 0; i + 6 <= pixels; i += 6) {
+        uint8_t u0[3], v0[3], u1[3], v1[3];
+        uint8_t *pu = u0, *pv = v0;
+        const void *src = src0;
+        READ_PIXELS_8(pu, y0, pv);
+        READ_PIXELS_8(y0, pu, y0);
+        READ_PIXELS_8(pv, y0, pu);
+        READ_PIXELS_8(y0, pv, y0);
+        src0 = src;
+
+        pu = u1;
+        pv = v1;
+        src = src1;
+        READ_PIXELS_8(pu, y1, pv);
+        READ_PIXELS_8(y1, pu, y1);
+        READ_PIXELS_8(pv, y1, pu);
+        READ_PIXELS_8(y1, pv, y1);
+        src1 = src;
+
+        for (int j = 0; j < 3; j++) {
+            *u++ = AVG(u0[j], u1[j]);
+            *v++ = AVG(v0[j], v1[j]);
+        }
+    }
+}
+
+void upipe_v210_to_yuv420p_10_c(const void *src0, const void *src1, uint16_t *y0, uint16_t *y1, uint16_t *u, uint16_t *v, uintptr_t pixels)
+{
+    for (uintptr_t i = 0; i + 6 <= pixels; i += 6) {
+        uint16_t u0[3], v0[3], u1[3], v1[3];
+        uint16_t *pu = u0, *pv = v0;
+        const void *src = src0;
+        READ_PIXELS_10(pu, y0, pv);
+        READ_PIXELS_10(y0, pu, y0);
+        READ_PIXELS_10(pv, y0, pu);
+        READ_PIXELS_10(y0, pv, y0);
+        src0 = src;
+
+        pu = u1;
+        pv = v1;
+        src = src1;
+        READ_PIXELS_10(pu, y1, pv);
+        READ_PIXELS_10(y1, pu, y1);
+        READ_PIXELS_10(pv, y1, pu);
+        READ_PIXELS_10(y1, pv, y1);
+        src1 = src;
+
+        for (int j = 0; j < 3; j++) {
+            *u++ = AVG(u0[j], u1[j]);
+            *v++ = AVG(v0[j], v1[j]);
+        }
+    }
+}
+
+#ifdef UPIPE_V210_AVX512
+/*
+ * AVX-512 versions
+ *
+ * A vector holds 4 groups of 6 pixels (16 dwords). The three samples of
+ * dword k are spread over two vectors of words: the first one in word 2k of
+ * ab, the second one in word 2k + 1 of ab, and the third one in word 2k of
+ * c, which is index 32 + 2k for vpermt2w. Partial vectors are handled with
+ * masked loads and stores.
+ */
+
+#define A(k) (2 * (k))
+#define B(k) (2 * (k) + 1)
+#define C(k) (32 + 2 * (k))
+#define Y_IDX(g) B(4*g), A(4*g+1), C(4*g+1), B(4*g+2), A(4*g+3), C(4*g+3)
+#define U_IDX(g) A(4*g), B(4*g+1), C(4*g+2)
+#define V_IDX(g) C(4*g), A(4*g+2), B(4*g+3)
+
+static const uint16_t v210dec_y_idx[32] = {
+    Y_IDX(0), Y_IDX(1), Y_IDX(2), Y_IDX(3)
+};
+static const uint16_t v210dec_u_idx[32] = {
+    U_IDX(0), U_IDX(1), U_IDX(2), U_IDX(3)
+};
+static const uint16_t v210dec_v_idx[32] = {
+    V_IDX(0), V_IDX(1), V_IDX(2), V_IDX(3)
+};
+
+#undef A
+#undef B
+#undef C
+#undef Y_IDX
+#undef U_IDX
+#undef V_IDX
+
+/** @internal @This spreads 10-bit samples over two vectors of words. */
+__attribute__((target("avx512f,avx512bw,avx512vl")))
+static inline void v210_unpack_10(__m512i in, __m512i *ab, __m512i *c)
+{
+    *ab = _mm512_or_si512(
+            _mm512_and_si512(in, _mm512_set1_epi32(0x3ff)),
+            _mm512_and_si512(_mm512_slli_epi32(in, 6),
+                             _mm512_set1_epi32(0x3ff << 16)));
+    *c = _mm512_and_si512(_mm512_srli_epi32(in, 20),
+                          _mm512_set1_epi32(0x3ff));
+}
+
+/** @internal @This spreads samples truncated to 8 bits over two vectors of
+ * words. */
+__attribute__((target("avx512f,avx512bw,avx512vl")))
+static inline void v210_unpack_8(__m512i in, __m512i *ab, __m512i *c)
+{
+    *ab = _mm512_or_si512(
+            _mm512_and_si512(_mm512_srli_epi32(in, 2),
+                             _mm512_set1_epi32(0xff)),
+            _mm512_and_si512(_mm512_slli_epi32(in, 4),
+                             _mm512_set1_epi32(0xff << 16)));
+    *c = _mm512_and_si512(_mm512_srli_epi32(in, 22),
+                          _mm512_set1_epi32(0xff));
+}
+
+__attribute__((target("avx512f,avx512bw,avx512vl")))
+void upipe_v210_to_planar_10_avx512(const void *src, uint16_t *y, uint16_t *u, uint16_t *v, uintptr_t pixels)
+{
+    const __m512i y_idx = _mm512_loadu_si512(v210dec_y_idx);
+    const __m512i u_idx = _mm512_loadu_si512(v210dec_u_idx);
+    const __m512i v_idx = _mm512_loadu_si512(v210dec_v_idx);
+    const uint32_t *in = src;
+
+    while (pixels >= 6) {
+        unsigned groups = pixels >= 24 ? 4 : pixels / 6;
+        __mmask16 in_mask = (1U << (4 * groups)) - 1;
+        __mmask32 y_mask = (1U << (6 * groups)) - 1;
+        __mmask32 uv_mask = (1U << (3 * groups)) - 1;
+        __m512i ab, c;
+
+        v210_unpack_10(_mm512_maskz_loadu_epi32(in_mask, in), &ab, &c);
+        _mm512_mask_storeu_epi16(y, y_mask,
+                                 _mm512_permutex2var_epi16(ab, y_idx, c));
+        _mm512_mask_storeu_epi16(u, uv_mask,
+                                 _mm512_permutex2var_epi16(ab, u_idx, c));
+        _mm512_mask_storeu_epi16(v, uv_mask,
+                                 _mm512_permutex2var_epi16(ab, v_idx, c));
+
+        in += 4 * groups;
+        y += 6 * groups;
+        u += 3 * groups;
+        v += 3 * groups;
+        pixels -= 6 * groups;
+    }
+}
+
+__attribute__((target("avx512f,avx512bw,avx512vl")))
+void upipe_v210_to_planar_8_avx512(const void *src, uint8_t *y, uint8_t *u, uint8_t *v, uintptr_t pixels)
+{
+    const __m512i y_idx = _mm512_loadu_si512(v210dec_y_idx);
+    const __m512i u_idx = _mm512_loadu_si512(v210dec_u_idx);
+    const __m512i v_idx = _mm512_loadu_si512(v210dec_v_idx);
+    const uint32_t *in = src;
+
+    while (pixels >= 6) {
+        unsigned groups = pixels >= 24 ? 4 : pixels / 6;
+        __mmask16 in_mask = (1U << (4 * groups)) - 1;
+        __mmask32 y_mask = (1U << (6 * groups)) - 1;
+        __mmask32 uv_mask = (1U << (3 * groups)) - 1;
+        __m512i ab, c;
+
+        v210_unpack_8(_mm512_maskz_loadu_epi32(in_mask, in), &ab, &c);
+        _mm256_mask_storeu_epi8(y, y_mask, _mm512_cvtepi16_epi8(
+                    _mm512_permutex2var_epi16(ab, y_idx, c)));
+        _mm256_mask_storeu_epi8(u, uv_mask, _mm512_cvtepi16_epi8(
+                    _mm512_permutex2var_epi16(ab, u_idx, c)));
+        _mm256_mask_storeu_epi8(v, uv_mask, _mm512_cvtepi16_epi8(
+                    _mm512_permutex2var_epi16(ab, v_idx, c)));
+
+        in += 4 * groups;
+        y += 6 * groups;
+        u += 3 * groups;
+        v += 3 * groups;
+        pixels -= 6 * groups;
+    }
+}
+
+/* averaging is done before the chroma permutations, which only select
+ * words, so that they run once per line pair */
+
+__attribute__((target("avx512f,avx512bw,avx512vl")))
+void upipe_v210_to_yuv420p_10_avx512(const void *src0, const void *src1, uint16_t *y0, uint16_t *y1, uint16_t *u, uint16_t *v, uintptr_t pixels)
+{
+    const __m512i y_idx = _mm512_loadu_si512(v210dec_y_idx);
+    const __m512i u_idx = _mm512_loadu_si512(v210dec_u_idx);
+    const __m512i v_idx = _mm512_loadu_si512(v210dec_v_idx);
+    const uint32_t *in0 = src0;
+    const uint32_t *in1 = src1;
+
+    while (pixels >= 6) {
+        unsigned groups = pixels >= 24 ? 4 : pixels / 6;
+        __mmask16 in_mask = (1U << (4 * groups)) - 1;
+        __mmask32 y_mask = (1U << (6 * groups)) - 1;
+        __mmask32 uv_mask = (1U << (3 * groups)) - 1;
+        __m512i ab0, c0, ab1, c1;
+
+        v210_unpack_10(_mm512_maskz_loadu_epi32(in_mask, in0), &ab0, &c0);
+        v210_unpack_10(_mm512_maskz_loadu_epi32(in_mask, in1), &ab1, &c1);
+        _mm512_mask_storeu_epi16(y0, y_mask,
+                                 _mm512_permutex2var_epi16(ab0, y_idx, c0));
+        _mm512_mask_storeu_epi16(y1, y_mask,
+                                 _mm512_permutex2var_epi16(ab1, y_idx, c1));
+
+        __m512i ab = _mm512_avg_epu16(ab0, ab1);
+        __m512i c = _mm512_avg_epu16(c0, c1);
+        _mm512_mask_storeu_epi16(u, uv_mask,
+                                 _mm512_permutex2var_epi16(ab, u_idx, c));
+        _mm512_mask_storeu_epi16(v, uv_mask,
+                                 _mm512_permutex2var_epi16(ab, v_idx, c));
+
+        in0 += 4 * groups;
+        in1 += 4 * groups;
+        y0 += 6 * groups;
+        y1 += 6 * groups;
+        u += 3 * groups;
+        v += 3 * groups;
+        pixels -= 6 * groups;
+    }
+}
+
+__attribute__((target("avx512f,avx512bw,avx512vl")))
+void upipe_v210_to_yuv420p_8_avx512(const void *src0, const void *src1, uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v, uintptr_t pixels)
+{
+    const __m512i y_idx = _mm512_loadu_si512(v210dec_y_idx);
+    const __m512i u_idx = _mm512_loadu_si512(v210dec_u_idx);
+    const __m512i v_idx = _mm512_loadu_si512(v210dec_v_idx);
+    const uint32_t *in0 = src0;
+    const uint32_t *in1 = src1;
+
+    while (pixels >= 6) {
+        unsigned groups = pixels >= 24 ? 4 : pixels / 6;
+        __mmask16 in_mask = (1U << (4 * groups)) - 1;
+        __mmask32 y_mask = (1U << (6 * groups)) - 1;
+        __mmask32 uv_mask = (1U << (3 * groups)) - 1;
+        __m512i ab0, c0, ab1, c1;
+
+        v210_unpack_8(_mm512_maskz_loadu_epi32(in_mask, in0), &ab0, &c0);
+        v210_unpack_8(_mm512_maskz_loadu_epi32(in_mask, in1), &ab1, &c1);
+        _mm256_mask_storeu_epi8(y0, y_mask, _mm512_cvtepi16_epi8(
+                    _mm512_permutex2var_epi16(ab0, y_idx, c0)));
+        _mm256_mask_storeu_epi8(y1, y_mask, _mm512_cvtepi16_epi8(
+                    _mm512_permutex2var_epi16(ab1, y_idx, c1)));
+
+        __m512i ab = _mm512_avg_epu16(ab0, ab1);
+        __m512i c = _mm512_avg_epu16(c0, c1);
+        _mm256_mask_storeu_epi8(u, uv_mask, _mm512_cvtepi16_epi8(
+                    _mm512_permutex2var_epi16(ab, u_idx, c)));
+        _mm256_mask_storeu_epi8(v, uv_mask, _mm512_cvtepi16_epi8(
+                    _mm512_permutex2var_epi16(ab, v_idx, c)));
+
+        in0 += 4 * groups;
+        in1 += 4 * groups;
+        y0 += 6 * groups;
+        y1 += 6 * groups;
+        u += 3 * groups;
+        v += 3 * groups;
+        pixels -= 6 * groups;
+    }
+}
+#endif
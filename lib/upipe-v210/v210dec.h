@@ -10,3 +10,18 @@ void upipe_v210_to_planar_10_aligned_avx2 (const void *src, uint16_t *y, uint16_
 void upipe_v210_to_planar_8_aligned_ssse3(const void *src, uint8_t *y, uint8_t *u, uint8_t *v, uintptr_t pixels);
 void upipe_v210_to_planar_8_aligned_avx  (const void *src, uint8_t *y, uint8_t *u, uint8_t *v, uintptr_t pixels);
 void upipe_v210_to_planar_8_aligned_avx2 (const void *src, uint8_t *y, uint8_t *u, uint8_t *v, uintptr_t pixels);
+
+/* decode two lines, with the chroma of both lines averaged */
+void upipe_v210_to_yuv420p_10_c(const void *src0, const void *src1, uint16_t *y0, uint16_t *y1, uint16_t *u, uint16_t *v, uintptr_t pixels);
+void upipe_v210_to_yuv420p_8_c(const void *src0, const void *src1, uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v, uintptr_t pixels);
+
+#if defined(__x86_64__)
+#define UPIPE_V210_AVX512 1
+
+/* process 24 pixels per iteration, no alignment requirement and no
+ * overwrite past pixels */
+void upipe_v210_to_planar_10_avx512(const void *src, uint16_t *y, uint16_t *u, uint16_t *v, uintptr_t pixels);
+void upipe_v210_to_planar_8_avx512 (const void *src, uint8_t *y, uint8_t *u, uint8_t *v, uintptr_t pixels);
+void upipe_v210_to_yuv420p_10_avx512(const void *src0, const void *src1, uint16_t *y0, uint16_t *y1, uint16_t *u, uint16_t *v, uintptr_t pixels);
+void upipe_v210_to_yuv420p_8_avx512 (const void *src0, const void *src1, uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v, uintptr_t pixels);
+#endif
@@ -30,6 +30,10 @@
 #include <upipe-v210/upipe_v210enc.h>
 #include "v210enc.h"
 
+#ifdef UPIPE_V210_AVX512
+#include <immintrin.h>
+#endif
+
 #define CLIP(v) ubase_clip(v, 4, 1019)
 #define CLIP8(v) ubase_clip(v, 1, 254)
 
@@ -91,3 +95,109 @@ void upipe_planar_to_v210_10_c(const uint16_t *y, const uint16_t *u,
         WRITE_PIXELS(y, v, y);
     }
 }
+
+#ifdef UPIPE_V210_AVX512
+/*
+ * AVX-512 versions
+ *
+ * The luma of 4 groups of 6 pixels is in words 0 to 23 of a vector, and
+ * the chroma in words 0 to 11 (u) and 16 to 27 (v) of another, which are
+ * indices 32 and 48 for vpermt2w. The first two samples of dword k are
+ * gathered in words 2k and 2k + 1 of ab, and the third one in word 2k of c.
+ * Partial vectors are handled with masked loads and stores.
+ */
+
+#define Y(n) (n)
+#define U(n) (32 + (n))
+#define V(n) (48 + (n))
+#define AB_IDX(g) U(3*g), Y(6*g), Y(6*g+1), U(3*g+1), \
+                  V(3*g+1), Y(6*g+3), Y(6*g+4), V(3*g+2)
+#define C_IDX(g) V(3*g), 0, Y(6*g+2), 0, U(3*g+2), 0, Y(6*g+5), 0
+
+static const uint16_t v210enc_ab_idx[32] = {
+    AB_IDX(0), AB_IDX(1), AB_IDX(2), AB_IDX(3)
+};
+static const uint16_t v210enc_c_idx[32] = {
+    C_IDX(0), C_IDX(1), C_IDX(2), C_IDX(3)
+};
+
+#undef Y
+#undef U
+#undef V
+#undef AB_IDX
+#undef C_IDX
+
+/** @internal @This packs clipped samples, shifted to 10 bits, into dwords. */
+__attribute__((target("avx512f,avx512bw,avx512vl")))
+static inline __m512i v210_pack(__m512i y, __m512i uv)
+{
+    const __m512i ab_idx = _mm512_loadu_si512(v210enc_ab_idx);
+    const __m512i c_idx = _mm512_loadu_si512(v210enc_c_idx);
+
+    /* a + (b << 10) */
+    __m512i ab = _mm512_madd_epi16(_mm512_permutex2var_epi16(y, ab_idx, uv),
+                                   _mm512_set1_epi32(0x04000001));
+    __m512i c = _mm512_maskz_permutex2var_epi16(0x55555555, y, c_idx, uv);
+    return _mm512_or_si512(ab, _mm512_slli_epi32(c, 20));
+}
+
+__attribute__((target("avx512f,avx512bw,avx512vl")))
+void upipe_planar_to_v210_10_avx512(const uint16_t *y, const uint16_t *u,
+                                    const uint16_t *v, uint8_t *dst, ptrdiff_t pixels)
+{
+    const __m512i min = _mm512_set1_epi16(4);
+    const __m512i max = _mm512_set1_epi16(1019);
+
+    while (pixels >= 6) {
+        unsigned groups = pixels >= 24 ? 4 : pixels / 6;
+        __mmask32 y_mask = (1U << (6 * groups)) - 1;
+        __mmask16 uv_mask = (1U << (3 * groups)) - 1;
+        __mmask16 out_mask = (1U << (4 * groups)) - 1;
+
+        __m512i yv = _mm512_maskz_loadu_epi16(y_mask, y);
+        __m512i uv = _mm512_inserti64x4(
+                _mm512_castsi256_si512(_mm256_maskz_loadu_epi16(uv_mask, u)),
+                _mm256_maskz_loadu_epi16(uv_mask, v), 1);
+        yv = _mm512_max_epu16(_mm512_min_epu16(yv, max), min);
+        uv = _mm512_max_epu16(_mm512_min_epu16(uv, max), min);
+        _mm512_mask_storeu_epi32(dst, out_mask, v210_pack(yv, uv));
+
+        y += 6 * groups;
+        u += 3 * groups;
+        v += 3 * groups;
+        dst += 16 * groups;
+        pixels -= 6 * groups;
+    }
+}
+
+__attribute__((target("avx512f,avx512bw,avx512vl")))
+void upipe_planar_to_v210_8_avx512(const uint8_t *y, const uint8_t *u,
+                                   const uint8_t *v, uint8_t *dst, ptrdiff_t pixels)
+{
+    const __m256i min = _mm256_set1_epi8(1);
+    const __m256i max = _mm256_set1_epi8(254);
+
+    while (pixels >= 6) {
+        unsigned groups = pixels >= 24 ? 4 : pixels / 6;
+        __mmask32 y_mask = (1U << (6 * groups)) - 1;
+        __mmask16 uv_mask = (1U << (3 * groups)) - 1;
+        __mmask16 out_mask = (1U << (4 * groups)) - 1;
+
+        __m256i y8 = _mm256_maskz_loadu_epi8(y_mask, y);
+        __m256i uv8 = _mm256_inserti128_si256(
+                _mm256_castsi128_si256(_mm_maskz_loadu_epi8(uv_mask, u)),
+                _mm_maskz_loadu_epi8(uv_mask, v), 1);
+        y8 = _mm256_max_epu8(_mm256_min_epu8(y8, max), min);
+        uv8 = _mm256_max_epu8(_mm256_min_epu8(uv8, max), min);
+        __m512i yv = _mm512_slli_epi16(_mm512_cvtepu8_epi16(y8), 2);
+        __m512i uv = _mm512_slli_epi16(_mm512_cvtepu8_epi16(uv8), 2);
+        _mm512_mask_storeu_epi32(dst, out_mask, v210_pack(yv, uv));
+
+        y += 6 * groups;
+        u += 3 * groups;
+        v += 3 * groups;
+        dst += 16 * groups;
+        pixels -= 6 * groups;
+    }
+}
+#endif
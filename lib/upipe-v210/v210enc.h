@@ -13,3 +13,14 @@ void upipe_planar_to_v210_8_avx(const uint8_t *y, const uint8_t *u,
                                   const uint8_t *v, uint8_t *dst, ptrdiff_t pixels);
 void upipe_planar_to_v210_8_avx2(const uint8_t *y, const uint8_t *u,
                                    const uint8_t *v, uint8_t *dst, ptrdiff_t pixels);
+
+#if defined(__x86_64__)
+#define UPIPE_V210_AVX512 1
+
+/* process 24 pixels per iteration, no alignment requirement and no
+ * overwrite past pixels */
+void upipe_planar_to_v210_10_avx512(const uint16_t *y, const uint16_t *u,
+                                    const uint16_t *v, uint8_t *dst, ptrdiff_t pixels);
+void upipe_planar_to_v210_8_avx512(const uint8_t *y, const uint8_t *u,
+                                   const uint8_t *v, uint8_t *dst, ptrdiff_t pixels);
+#endif
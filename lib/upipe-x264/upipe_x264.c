@@ -29,6 +29,7 @@
 
 #define _GNU_SOURCE
 
+#include <upipe/urefcount.h>
 #include <upipe/uclock.h>
 #include <upipe/ulist.h>
 #include <upipe/uprobe.h>
@@ -44,6 +45,7 @@
 #include <upipe/uref_block.h>
 #include <upipe/uref_block_flow.h>
 #include <upipe/ubuf_block.h>
+#include <upipe/ubuf_block_common.h>
 #include <upipe/upipe.h>
 #include <upipe/upipe_helper_upipe.h>
 #include <upipe/upipe_helper_urefcount.h>
@@ -63,10 +65,12 @@
 #include <upipe-framers/upipe_h26x_common.h>
 
 #include <stdlib.h>
+#include <string.h>
 #include <strings.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <pthread.h>
 
 #include <x264.h>
 #include <bitstream/mpeg/h264.h>
@@ -76,6 +80,9 @@
 #define OUT_FLOW "block.h264.pic."
 #define OUT_FLOW_MPEG2 "block.mpeg2video.pic."
 
+/** @hidden */
+struct upipe_x264_nals;
+
 /** @internal upipe_x264 private structure */
 struct upipe_x264 {
     /** refcount management structure */
@@ -93,6 +100,10 @@ struct upipe_x264 {
     uint64_t sc_latency;
     /** true if the existing slice types must be enforced */
     bool slice_type_enforce;
+    /** true if the NAL buffer of x264 is output without copy */
+    bool zerocopy;
+    /** NAL buffer output at the last call to the encoder, in zero-copy mode */
+    struct upipe_x264_nals *nals;
 
     /** x264 "PTS" */
     uint64_t x264_ts;
@@ -198,6 +209,273 @@ static const enum uprobe_log_level loglevel_map[] = {
     [X264_LOG_DEBUG] = UPROBE_LOG_VERBOSE
 };
 
+/** @internal @This is the shared structure of the block ubufs wrapping the
+ * NAL buffer of x264. The buffer is only valid until the next call to the
+ * encoder, so it is copied at that time if downstream pipes still hold it.
+ * Mappings of the x264 buffer must be over by then, otherwise the encoder
+ * refuses to overwrite it. */
+struct upipe_x264_nals {
+    /** refcount management structure */
+    struct urefcount urefcount;
+    /** protects mapped and buffer */
+    pthread_mutex_t mutex;
+    /** number of mappings of the x264 buffer in progress */
+    unsigned int mapped;
+    /** pointer to the NAL buffer of x264, or to the private copy */
+    const uint8_t *buffer;
+    /** private copy of the NAL buffer, or NULL */
+    uint8_t *copy;
+    /** size of the buffer */
+    size_t size;
+};
+
+UBASE_FROM_TO(upipe_x264_nals, urefcount, urefcount, urefcount)
+
+/** @internal @This is a super-set of the @ref ubuf (and @ref ubuf_block)
+ * structure pointing to the shared NAL buffer. */
+struct upipe_x264_ubuf {
+    /** pointer to shared structure */
+    struct upipe_x264_nals *nals;
+    /** number of mappings in progress through this ubuf */
+    unsigned int maps;
+    /** number of them on the x264 buffer */
+    unsigned int x264_maps;
+
+    /** block structure */
+    struct ubuf_block ubuf_block;
+};
+
+UBASE_FROM_TO(upipe_x264_ubuf, ubuf, ubuf, ubuf_block.ubuf)
+
+/** @hidden */
+static struct ubuf_mgr upipe_x264_ubuf_mgr;
+
+/** @internal @This frees the shared NAL buffer structure.
+ *
+ * @param urefcount pointer to urefcount
+ */
+static void upipe_x264_nals_free(struct urefcount *urefcount)
+{
+    struct upipe_x264_nals *nals = upipe_x264_nals_from_urefcount(urefcount);
+    free(nals->copy);
+    pthread_mutex_destroy(&nals->mutex);
+    urefcount_clean(urefcount);
+    free(nals);
+}
+
+/** @internal @This allocates a block ubuf pointing to the shared NAL buffer.
+ *
+ * @param nals shared NAL buffer structure
+ * @return pointer to ubuf or NULL in case of allocation error
+ */
+static struct ubuf *upipe_x264_ubuf_alloc(struct upipe_x264_nals *nals)
+{
+    struct upipe_x264_ubuf *x264_ubuf = malloc(sizeof(struct upipe_x264_ubuf));
+    if (unlikely(x264_ubuf == NULL))
+        return NULL;
+
+    struct ubuf *ubuf = upipe_x264_ubuf_to_ubuf(x264_ubuf);
+    ubuf->mgr = &upipe_x264_ubuf_mgr;
+    ubuf_block_common_init(ubuf, true);
+    x264_ubuf->nals = nals;
+    x264_ubuf->maps = 0;
+    x264_ubuf->x264_maps = 0;
+    urefcount_use(upipe_x264_nals_to_urefcount(nals));
+    return ubuf;
+}
+
+/** @internal @This refuses to allocate buffers, as the manager only wraps
+ * NAL buffers of x264.
+ *
+ * @param mgr common management structure
+ * @param signature type of allocation
+ * @param args optional arguments
+ * @return NULL
+ */
+static struct ubuf *upipe_x264_ubuf_mgr_alloc(struct ubuf_mgr *mgr,
+                                              uint32_t signature, va_list args)
+{
+    return NULL;
+}
+
+/** @internal @This handles control commands on wrapped NAL buffers.
+ *
+ * @param ubuf pointer to ubuf
+ * @param command type of command to process
+ * @param args arguments of the command
+ * @return an error code
+ */
+static int upipe_x264_ubuf_control(struct ubuf *ubuf, int command,
+                                   va_list args)
+{
+    struct upipe_x264_ubuf *x264_ubuf = upipe_x264_ubuf_from_ubuf(ubuf);
+    struct upipe_x264_nals *nals = x264_ubuf->nals;
+    switch (command) {
+        case UBUF_DUP: {
+            struct ubuf **new_ubuf_p = va_arg(args, struct ubuf **);
+            struct ubuf *new_ubuf = upipe_x264_ubuf_alloc(nals);
+            if (unlikely(new_ubuf == NULL))
+                return UBASE_ERR_ALLOC;
+            if (unlikely(!ubase_check(ubuf_block_common_dup(ubuf,
+                                                            new_ubuf)))) {
+                ubuf_free(new_ubuf);
+                return UBASE_ERR_INVALID;
+            }
+            *new_ubuf_p = new_ubuf;
+            return UBASE_ERR_NONE;
+        }
+        case UBUF_SINGLE:
+            /* the buffer may still belong to x264 */
+            return UBASE_ERR_BUSY;
+
+        case UBUF_MAP_BLOCK: {
+            const uint8_t **buffer_p = va_arg(args, const uint8_t **);
+            pthread_mutex_lock(&nals->mutex);
+            *buffer_p = nals->buffer;
+            if (nals->copy == NULL) {
+                nals->mapped++;
+                x264_ubuf->x264_maps++;
+            }
+            pthread_mutex_unlock(&nals->mutex);
+            x264_ubuf->maps++;
+            return UBASE_ERR_NONE;
+        }
+        case UBUF_UNMAP_BLOCK:
+            /* unmapping does not tell which buffer was mapped, so the x264
+             * buffer is held until all mappings of the ubuf are over */
+            if (--x264_ubuf->maps || !x264_ubuf->x264_maps)
+                return UBASE_ERR_NONE;
+            pthread_mutex_lock(&nals->mutex);
+            nals->mapped -= x264_ubuf->x264_maps;
+            pthread_mutex_unlock(&nals->mutex);
+            x264_ubuf->x264_maps = 0;
+            return UBASE_ERR_NONE;
+
+        case UBUF_SPLICE_BLOCK: {
+            struct ubuf **new_ubuf_p = va_arg(args, struct ubuf **);
+            int offset = va_arg(args, int);
+            int size = va_arg(args, int);
+            struct ubuf *new_ubuf = upipe_x264_ubuf_alloc(nals);
+            if (unlikely(new_ubuf == NULL))
+                return UBASE_ERR_ALLOC;
+            if (unlikely(!ubase_check(ubuf_block_common_splice(ubuf,
+                                new_ubuf, offset, size)))) {
+                ubuf_free(new_ubuf);
+                return UBASE_ERR_INVALID;
+            }
+            *new_ubuf_p = new_ubuf;
+            return UBASE_ERR_NONE;
+        }
+        default:
+            return UBASE_ERR_UNHANDLED;
+    }
+}
+
+/** @internal @This frees a ubuf wrapping a NAL buffer.
+ *
+ * @param ubuf pointer to ubuf
+ */
+static void upipe_x264_ubuf_free(struct ubuf *ubuf)
+{
+    struct upipe_x264_ubuf *x264_ubuf = upipe_x264_ubuf_from_ubuf(ubuf);
+    ubuf_block_common_clean(ubuf);
+    urefcount_release(upipe_x264_nals_to_urefcount(x264_ubuf->nals));
+    free(x264_ubuf);
+}
+
+/** @internal ubuf manager for wrapped NAL buffers */
+static struct ubuf_mgr upipe_x264_ubuf_mgr = {
+    .refcount = NULL,
+    .signature = UBUF_ALLOC_BLOCK,
+    .ubuf_alloc = upipe_x264_ubuf_mgr_alloc,
+    .ubuf_control = upipe_x264_ubuf_control,
+    .ubuf_free = upipe_x264_ubuf_free,
+    .ubuf_mgr_control = NULL
+};
+
+/** @internal @This wraps the NAL buffer returned by x264 into a block ubuf.
+ *
+ * @param upipe description structure of the pipe
+ * @param buffer NAL buffer returned by x264
+ * @param size size of the NAL buffer
+ * @return pointer to ubuf or NULL in case of allocation error
+ */
+static struct ubuf *upipe_x264_wrap_nals(struct upipe *upipe,
+                                         uint8_t *buffer, int size)
+{
+    struct upipe_x264 *upipe_x264 = upipe_x264_from_upipe(upipe);
+    assert(upipe_x264->nals == NULL);
+
+    struct upipe_x264_nals *nals = malloc(sizeof(struct upipe_x264_nals));
+    if (unlikely(nals == NULL))
+        return NULL;
+    urefcount_init(upipe_x264_nals_to_urefcount(nals), upipe_x264_nals_free);
+    pthread_mutex_init(&nals->mutex, NULL);
+    nals->mapped = 0;
+    nals->buffer = buffer;
+    nals->copy = NULL;
+    nals->size = size;
+
+    struct ubuf *ubuf = upipe_x264_ubuf_alloc(nals);
+    if (unlikely(ubuf == NULL)) {
+        urefcount_release(upipe_x264_nals_to_urefcount(nals));
+        return NULL;
+    }
+    ubuf_block_common_set(ubuf, 0, size);
+
+    /* keep the initial reference until the next call to the encoder */
+    upipe_x264->nals = nals;
+    return ubuf;
+}
+
+/** @internal @This releases the NAL buffer output at the last call to the
+ * encoder, before x264 overwrites it. It is copied if downstream pipes still
+ * hold it.
+ *
+ * @param upipe description structure of the pipe
+ * @return an error code, @ref UBASE_ERR_BUSY if the x264 buffer is still
+ * mapped, in which case the encoder must not be called
+ */
+static int upipe_x264_release_nals(struct upipe *upipe)
+{
+    struct upipe_x264 *upipe_x264 = upipe_x264_from_upipe(upipe);
+    struct upipe_x264_nals *nals = upipe_x264->nals;
+    if (likely(nals == NULL))
+        return UBASE_ERR_NONE;
+
+    struct urefcount *urefcount = upipe_x264_nals_to_urefcount(nals);
+    if (!urefcount_single(urefcount) && nals->copy == NULL) {
+        uint8_t *copy = malloc(nals->size);
+        if (unlikely(copy == NULL)) {
+            upipe_throw_fatal(upipe, UBASE_ERR_ALLOC);
+            return UBASE_ERR_ALLOC;
+        }
+        /* the x264 buffer is not written until we return */
+        memcpy(copy, nals->buffer, nals->size);
+        pthread_mutex_lock(&nals->mutex);
+        nals->copy = copy;
+        nals->buffer = copy;
+        pthread_mutex_unlock(&nals->mutex);
+        upipe_verbose_va(upipe, "copied %zu octets of NAL still in use",
+                         nals->size);
+    }
+
+    /* new mappings get the copy, but older ones may still read the x264
+     * buffer */
+    pthread_mutex_lock(&nals->mutex);
+    unsigned int mapped = nals->mapped;
+    pthread_mutex_unlock(&nals->mutex);
+    if (unlikely(mapped)) {
+        upipe_warn_va(upipe, "NAL buffer still mapped %u times downstream",
+                      mapped);
+        return UBASE_ERR_BUSY;
+    }
+
+    upipe_x264->nals = NULL;
+    urefcount_release(urefcount);
+    return UBASE_ERR_NONE;
+}
+
 /** @internal @This sends x264 logs to uprobe_log
  * @param upipe description structure of the pipe
  * @param loglevel x264 loglevel
@@ -367,6 +645,21 @@ static int _upipe_x264_set_slice_type_enforce(struct upipe *upipe, bool enforce)
     return UBASE_ERR_NONE;
 }
 
+/** @This sets the zero-copy output mode (true or false).
+ *
+ * @param upipe description structure of the pipe
+ * @param zerocopy true if the NAL buffer of x264 must be output without copy
+ * @return an error code
+ */
+static int _upipe_x264_set_zerocopy(struct upipe *upipe, bool zerocopy)
+{
+    struct upipe_x264 *upipe_x264 = upipe_x264_from_upipe(upipe);
+    upipe_x264->zerocopy = zerocopy;
+    upipe_dbg_va(upipe, "%sactivating zero-copy output",
+                 zerocopy ? "" : "de");
+    return UBASE_ERR_NONE;
+}
+
 /** @internal @This allocates a filter pipe.
  *
  * @param mgr common management structure
@@ -391,6 +684,8 @@ static struct upipe *upipe_x264_alloc(struct upipe_mgr *mgr,
     upipe_x264->initial_latency = 0;
     upipe_x264->sc_latency = 0;
     upipe_x264->slice_type_enforce = false;
+    upipe_x264->zerocopy = false;
+    upipe_x264->nals = NULL;
     upipe_x264->x264_ts = 0;
 
     upipe_x264_init_urefcount(upipe);
@@ -650,11 +945,14 @@ static void upipe_x264_close(struct upipe *upipe)
 {
     struct upipe_x264 *upipe_x264 = upipe_x264_from_upipe(upipe);
     if (upipe_x264->encoder) {
-        while(x264_encoder_delayed_frames(upipe_x264->encoder)) {
+        while (x264_encoder_delayed_frames(upipe_x264->encoder) &&
+               ubase_check(upipe_x264_release_nals(upipe))) {
             upipe_x264_handle(upipe, NULL, NULL);
         }
 
         upipe_notice(upipe, "closing encoder");
+        if (unlikely(!ubase_check(upipe_x264_release_nals(upipe))))
+            upipe_err(upipe, "closing encoder with mapped NAL buffer");
         x264_encoder_close(upipe_x264->encoder);
     }
 }
@@ -693,7 +991,10 @@ static void upipe_x264_build_flow_def(struct upipe *upipe)
     if (upipe_x264->headers_requested) {
         int i, ret, nal_num, size = 0;
         x264_nal_t *nals;
-        ret = x264_encoder_headers(upipe_x264->encoder, &nals, &nal_num);
+        if (unlikely(!ubase_check(upipe_x264_release_nals(upipe))))
+            ret = -1;
+        else
+            ret = x264_encoder_headers(upipe_x264->encoder, &nals, &nal_num);
         if (unlikely(ret < 0)) {
             upipe_warn(upipe, "unable to get encoder headers");
         } else {
@@ -897,8 +1198,10 @@ static bool upipe_x264_handle(struct upipe *upipe, struct uref *uref,
         pic.img.i_plane = i;
 
         /* encode frame ! */
-        ret = x264_encoder_encode(upipe_x264->encoder,
-                                  &nals, &nals_num, &pic, &pic);
+        int err = upipe_x264_release_nals(upipe);
+        if (likely(ubase_check(err)))
+            ret = x264_encoder_encode(upipe_x264->encoder,
+                                      &nals, &nals_num, &pic, &pic);
 
         /* unmap */
         for (i = 0; i < 3; i++) {
@@ -906,8 +1209,16 @@ static bool upipe_x264_handle(struct upipe *upipe, struct uref *uref,
         }
         ubuf_free(uref_detach_ubuf(uref));
 
+        if (unlikely(!ubase_check(err))) {
+            upipe_warn(upipe, "dropping picture");
+            uref_free(uref);
+            return true;
+        }
+
     } else {
         /* NULL uref, flushing delayed frame */
+        if (unlikely(!ubase_check(upipe_x264_release_nals(upipe))))
+            return true;
         ret = x264_encoder_encode(upipe_x264->encoder,
                                   &nals, &nals_num, NULL, &pic);
         x264_encoder_parameters(upipe_x264->encoder, &curparams);
@@ -934,15 +1245,26 @@ static bool upipe_x264_handle(struct upipe *upipe, struct uref *uref,
             header_size += nals[i].i_payload;
     }
 
-    /* alloc ubuf, map, copy, unmap */
-    ubuf_block = ubuf_block_alloc(upipe_x264->ubuf_mgr, size);
-    if (unlikely(ubuf_block == NULL)) {
-        upipe_throw_fatal(upipe, UBASE_ERR_ALLOC);
-        return true;
+    if (upipe_x264->zerocopy) {
+        /* NAL payloads are contiguous and valid until the next call */
+        ubuf_block = upipe_x264_wrap_nals(upipe, nals[0].p_payload, size);
+        if (unlikely(ubuf_block == NULL)) {
+            uref_free(uref);
+            upipe_throw_fatal(upipe, UBASE_ERR_ALLOC);
+            return true;
+        }
+    } else {
+        /* alloc ubuf, map, copy, unmap */
+        ubuf_block = ubuf_block_alloc(upipe_x264->ubuf_mgr, size);
+        if (unlikely(ubuf_block == NULL)) {
+            uref_free(uref);
+            upipe_throw_fatal(upipe, UBASE_ERR_ALLOC);
+            return true;
+        }
+        ubuf_block_write(ubuf_block, 0, &size, &buf);
+        memcpy(buf, nals[0].p_payload, size);
+        ubuf_block_unmap(ubuf_block, 0);
     }
-    ubuf_block_write(ubuf_block, 0, &size, &buf);
-    memcpy(buf, nals[0].p_payload, size);
-    ubuf_block_unmap(ubuf_block, 0);
     uref_attach_ubuf(uref, ubuf_block);
     uref_block_set_header_size(uref, header_size);
 
@@ -1299,6 +1621,11 @@ static int upipe_x264_control(struct upipe *upipe, int command, va_list args)
             bool enforce = !(va_arg(args, int) == 0);
             return _upipe_x264_set_slice_type_enforce(upipe, enforce);
         }
+        case UPIPE_X264_SET_ZEROCOPY: {
+            UBASE_SIGNATURE_CHECK(args, UPIPE_X264_SIGNATURE)
+            bool zerocopy = !(va_arg(args, int) == 0);
+            return _upipe_x264_set_zerocopy(upipe, zerocopy);
+        }
         default:
             return UBASE_ERR_UNHANDLED;
     }
@@ -264,6 +264,29 @@ static int ubuf_block_mem_splice(struct ubuf *ubuf, struct ubuf **new_ubuf_p,
     return UBASE_ERR_NONE;
 }
 
+/** @This returns the shared buffer of the first segment.
+ *
+ * @param ubuf pointer to ubuf
+ * @param shared_p filled in with a pointer to the shared buffer
+ * @param offset_p filled in with the offset in the shared buffer
+ * @param size_p filled in with the size of the segment
+ * @return an error code
+ */
+static int _ubuf_block_mem_get_shared(struct ubuf *ubuf,
+                                      struct ubuf_mem_shared **shared_p,
+                                      size_t *offset_p, size_t *size_p)
+{
+    struct ubuf_block_mem *block_mem = ubuf_block_mem_from_ubuf(ubuf);
+    struct ubuf_block *block = ubuf_block_from_ubuf(ubuf);
+    if (shared_p != NULL)
+        *shared_p = block_mem->shared;
+    if (offset_p != NULL)
+        *offset_p = block->offset;
+    if (size_p != NULL)
+        *size_p = block->size;
+    return UBASE_ERR_NONE;
+}
+
 /** @This handles control commands.
  *
  * @param ubuf pointer to ubuf
@@ -287,6 +310,15 @@ static int ubuf_block_mem_control(struct ubuf *ubuf, int command, va_list args)
             int size = va_arg(args, int);
             return ubuf_block_mem_splice(ubuf, new_ubuf_p, offset, size);
         }
+        case UBUF_BLOCK_MEM_GET_SHARED: {
+            UBASE_SIGNATURE_CHECK(args, UBUF_BLOCK_MEM_SIGNATURE)
+            struct ubuf_mem_shared **shared_p =
+                va_arg(args, struct ubuf_mem_shared **);
+            size_t *offset_p = va_arg(args, size_t *);
+            size_t *size_p = va_arg(args, size_t *);
+            return _ubuf_block_mem_get_shared(ubuf, shared_p, offset_p,
+                                              size_p);
+        }
         default:
             return UBASE_ERR_UNHANDLED;
     }
@@ -32,8 +32,10 @@
 #include <upipe/urefcount.h>
 #include <upipe/uclock.h>
 #include <upipe/uclock_std.h>
+#include <upipe/upump.h>
 
 #include <stdlib.h>
+#include <stdbool.h>
 #include <time.h>
 
 #ifdef __MACH__
@@ -42,6 +44,21 @@
 #include <mach/mach.h>
 #endif
 
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <x86intrin.h>
+#include <cpuid.h>
+/** @hidden */
+#define HAVE_TSC
+#endif
+
+/** duration of the initial calibration of the TSC (1 ms) */
+#define TSC_CALIBRATION (UCLOCK_FREQ / 1000)
+/** interval between two calibrations of the TSC (10 ms) */
+#define TSC_PERIOD (UCLOCK_FREQ / 100)
+/** maximum offset between the TSC and the system clock corrected by slewing,
+ * beyond which the TSC is calibrated again from scratch (1 ms) */
+#define TSC_MAX_OFFSET (UCLOCK_FREQ / 1000)
+
 /** super-set of the uclock structure with additional local members */
 struct uclock_std {
     /** refcount management structure */
@@ -54,6 +71,33 @@ struct uclock_std {
     clock_serv_t cclock;
 #endif
 
+#ifdef HAVE_TSC
+    /** true if the TSC is used */
+    bool tsc;
+    /** sequence count of the TSC segment, odd while it is updated */
+    uint32_t tsc_seq;
+    /** duration of a segment, in TSC cycles */
+    uint64_t tsc_period;
+    /** TSC value at the origin of the calibration */
+    uint64_t tsc_origin;
+    /** system time at the origin of the calibration */
+    uint64_t tsc_origin_now;
+    /** TSC value at the start of the current segment */
+    uint64_t tsc_base;
+    /** time at the start of the current segment */
+    uint64_t tsc_base_now;
+    /** 27 MHz ticks per TSC cycle in the current segment, in 32.32 fixed
+     * point */
+    uint64_t tsc_mult;
+#endif
+
+    /** upump manager refreshing the cached time, or NULL */
+    struct upump_mgr *upump_mgr;
+    /** pump refreshing the cached time */
+    struct upump *upump;
+    /** cached time */
+    uint64_t cached;
+
     /** structure exported to modules */
     struct uclock uclock;
 };
@@ -61,6 +105,29 @@ struct uclock_std {
 UBASE_FROM_TO(uclock_std, uclock, uclock, uclock)
 UBASE_FROM_TO(uclock_std, urefcount, urefcount, urefcount)
 
+#ifndef __MACH__
+/** @This returns the system clock matching the given flags.
+ *
+ * @param flags type of clock
+ * @return clock identifier
+ */
+static clockid_t uclock_std_clockid(enum uclock_std_flags flags)
+{
+    if (flags & UCLOCK_FLAG_REALTIME) {
+#ifdef CLOCK_REALTIME_COARSE
+        if (flags & UCLOCK_FLAG_COARSE)
+            return CLOCK_REALTIME_COARSE;
+#endif
+        return CLOCK_REALTIME;
+    }
+#ifdef CLOCK_MONOTONIC_COARSE
+    if (flags & UCLOCK_FLAG_COARSE)
+        return CLOCK_MONOTONIC_COARSE;
+#endif
+    return CLOCK_MONOTONIC;
+}
+#endif
+
 /** @This returns the current time in the given clock.
  *
  * @param uclock utility structure passed to the module
@@ -77,8 +144,7 @@ static uint64_t uclock_std_now_inner(struct uclock *uclock,
 
 #else
     struct timespec ts;
-    if (unlikely(clock_gettime((flags & UCLOCK_FLAG_REALTIME) ?
-                               CLOCK_REALTIME : CLOCK_MONOTONIC, &ts) == -1))
+    if (unlikely(clock_gettime(uclock_std_clockid(flags), &ts) == -1))
         /* this should not happen as we have checked the clock existed
          * in alloc */
         return UINT64_MAX;
@@ -89,6 +155,128 @@ static uint64_t uclock_std_now_inner(struct uclock *uclock,
     return now;
 }
 
+#ifdef HAVE_TSC
+/** @This returns true if the TSC of the CPU runs at a constant rate, and
+ * doesn't stop in deep sleep states.
+ *
+ * @return true if the TSC is invariant
+ */
+static bool uclock_std_tsc_supported(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx))
+        return false;
+    return edx & (1 << 8);
+}
+
+/** @This calibrates the TSC against the system clock from scratch.
+ *
+ * @param uclock utility structure passed to the module
+ */
+static void uclock_std_tsc_init(struct uclock *uclock)
+{
+    struct uclock_std *std = uclock_std_from_uclock(uclock);
+    enum uclock_std_flags flags = std->flags & ~UCLOCK_FLAG_COARSE;
+    uint64_t origin_now = uclock_std_now_inner(uclock, flags);
+    uint64_t origin = __rdtsc();
+    uint64_t now, tsc;
+    do {
+        now = uclock_std_now_inner(uclock, flags);
+        tsc = __rdtsc();
+    } while (now - origin_now < TSC_CALIBRATION || tsc == origin);
+
+    std->tsc_origin = origin;
+    std->tsc_origin_now = origin_now;
+    std->tsc_base = tsc;
+    std->tsc_base_now = now;
+    std->tsc_mult = ((unsigned __int128)(now - origin_now) << 32) /
+                    (tsc - origin);
+    std->tsc_period = ((unsigned __int128)TSC_PERIOD << 32) / std->tsc_mult;
+}
+
+/** @This starts a new TSC segment, unless another thread is already doing
+ * it. The rate of the new segment is the average rate since the origin of
+ * the calibration, slewed so that the offset with the system clock is
+ * compensated at the end of the segment.
+ *
+ * @param uclock utility structure passed to the module
+ * @param seq sequence count of the current segment
+ * @return false if another thread is starting a new segment
+ */
+static bool uclock_std_tsc_resync(struct uclock *uclock, uint32_t seq)
+{
+    struct uclock_std *std = uclock_std_from_uclock(uclock);
+    if (!__atomic_compare_exchange_n(&std->tsc_seq, &seq, seq + 1, false,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return false;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    uint64_t now = uclock_std_now_inner(uclock,
+                                        std->flags & ~UCLOCK_FLAG_COARSE);
+    uint64_t tsc = __rdtsc();
+    uint64_t base_now = std->tsc_base_now +
+        (uint64_t)(((unsigned __int128)(tsc - std->tsc_base) *
+                    std->tsc_mult) >> 32);
+    int64_t offset = now - base_now;
+
+    if (unlikely(offset > (int64_t)TSC_MAX_OFFSET ||
+                 offset < -(int64_t)TSC_MAX_OFFSET ||
+                 tsc <= std->tsc_origin)) {
+        /* the TSC jumped, for instance after a suspend */
+        std->tsc_origin = std->tsc_base = tsc;
+        std->tsc_origin_now = std->tsc_base_now = now;
+    } else {
+        uint64_t mult =
+            ((unsigned __int128)(now - std->tsc_origin_now) << 32) /
+            (tsc - std->tsc_origin);
+        __int128 slew = (__int128)offset * ((__int128)1 << 32) /
+                       (int64_t)std->tsc_period;
+        std->tsc_base = tsc;
+        std->tsc_base_now = base_now;
+        std->tsc_mult = mult + slew;
+    }
+
+    __atomic_store_n(&std->tsc_seq, seq + 2, __ATOMIC_RELEASE);
+    return true;
+}
+
+/** @This returns the current system time interpolated with the TSC.
+ *
+ * @param uclock utility structure passed to the module
+ * @return current system time in 27 MHz ticks
+ */
+static uint64_t uclock_std_now_tsc(struct uclock *uclock)
+{
+    struct uclock_std *std = uclock_std_from_uclock(uclock);
+    uint32_t seq;
+    uint64_t base, base_now, mult, tsc;
+
+    for ( ; ; ) {
+        seq = __atomic_load_n(&std->tsc_seq, __ATOMIC_ACQUIRE);
+        base = __atomic_load_n(&std->tsc_base, __ATOMIC_RELAXED);
+        base_now = __atomic_load_n(&std->tsc_base_now, __ATOMIC_RELAXED);
+        mult = __atomic_load_n(&std->tsc_mult, __ATOMIC_RELAXED);
+        tsc = __rdtsc();
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (unlikely((seq & 1) ||
+                     seq != __atomic_load_n(&std->tsc_seq, __ATOMIC_RELAXED)))
+            continue;
+
+        /* the TSCs of different cores may be slightly apart */
+        if (unlikely((int64_t)(tsc - base) < 0))
+            tsc = base;
+        /* if another thread is starting a new segment, keep using the
+         * current one */
+        if (likely(tsc - base < std->tsc_period) ||
+            !uclock_std_tsc_resync(uclock, seq))
+            break;
+    }
+
+    return base_now +
+           (uint64_t)(((unsigned __int128)(tsc - base) * mult) >> 32);
+}
+#endif
+
 /** @This returns the current system time.
  *
  * @param uclock utility structure passed to the module
@@ -97,9 +285,35 @@ static uint64_t uclock_std_now_inner(struct uclock *uclock,
 static uint64_t uclock_std_now(struct uclock *uclock)
 {
     struct uclock_std *std = uclock_std_from_uclock(uclock);
+#ifdef HAVE_TSC
+    if (std->tsc)
+        return uclock_std_now_tsc(uclock);
+#endif
     return uclock_std_now_inner(uclock, std->flags);
 }
 
+/** @This returns the time cached during the current iteration of the event
+ * loop.
+ *
+ * @param uclock utility structure passed to the module
+ * @return cached system time in 27 MHz ticks
+ */
+static uint64_t uclock_std_now_cached(struct uclock *uclock)
+{
+    struct uclock_std *std = uclock_std_from_uclock(uclock);
+    return std->cached;
+}
+
+/** @This refreshes the cached time at each iteration of the event loop.
+ *
+ * @param upump description structure of the pump
+ */
+static void uclock_std_refresh(struct upump *upump)
+{
+    struct uclock_std *std = upump_get_opaque(upump, struct uclock_std *);
+    std->cached = uclock_std_now(uclock_std_to_uclock(std));
+}
+
 /** @This converts a system time to Epoch-based real time (from
  * 1970-01-01 00:00:00 +0000). The scale is in units of @ref #UCLOCK_FREQ,
  * divide by it to get standard time_t.
@@ -146,6 +360,8 @@ static uint64_t uclock_std_from_real(struct uclock *uclock, uint64_t real)
 static void uclock_std_free(struct urefcount *urefcount)
 {
     struct uclock_std *uclock_std = uclock_std_from_urefcount(urefcount);
+    upump_free(uclock_std->upump);
+    upump_mgr_release(uclock_std->upump_mgr);
 #ifdef __MACH__
     mach_port_deallocate(mach_task_self(), uclock_std->cclock);
 #endif
@@ -172,15 +388,21 @@ struct uclock *uclock_std_alloc(enum uclock_std_flags flags)
     }
 #else
     struct timespec ts;
-    if (unlikely(clock_gettime(unlikely(flags & UCLOCK_FLAG_REALTIME) ?
-                               CLOCK_REALTIME : CLOCK_MONOTONIC, &ts) == -1))
-        return NULL;
+    if (unlikely(clock_gettime(uclock_std_clockid(flags), &ts) == -1)) {
+        /* coarse clocks may not be supported by the kernel */
+        flags &= ~UCLOCK_FLAG_COARSE;
+        if (unlikely(clock_gettime(uclock_std_clockid(flags), &ts) == -1))
+            return NULL;
+    }
 #endif
 
     struct uclock_std *uclock_std = malloc(sizeof(struct uclock_std));
     if (unlikely(uclock_std == NULL))
         return NULL;
     uclock_std->flags = flags;
+    uclock_std->upump_mgr = NULL;
+    uclock_std->upump = NULL;
+    uclock_std->cached = 0;
     urefcount_init(uclock_std_to_urefcount(uclock_std), uclock_std_free);
     uclock_std->uclock.refcount = uclock_std_to_urefcount(uclock_std);
     uclock_std->uclock.uclock_now = uclock_std_now;
@@ -188,6 +410,45 @@ struct uclock *uclock_std_alloc(enum uclock_std_flags flags)
     uclock_std->uclock.uclock_from_real = uclock_std_from_real;
 #ifdef __MACH__
     memcpy(&uclock_std->cclock, &cclock, sizeof(cclock));
+#endif
+#ifdef HAVE_TSC
+    uclock_std->tsc = (flags & UCLOCK_FLAG_TSC) && uclock_std_tsc_supported();
+    uclock_std->tsc_seq = 0;
+    if (uclock_std->tsc) {
+        uclock_std_tsc_init(uclock_std_to_uclock(uclock_std));
+        uclock_std->uclock.uclock_now = uclock_std_now_tsc;
+    }
 #endif
     return uclock_std_to_uclock(uclock_std);
 }
+
+/** @This allocates a new uclock structure returning a cached time, which is
+ * refreshed once per iteration of the event loop of the given upump manager.
+ *
+ * @param flags flags for the creation of a uclock structure
+ * @param upump_mgr upump manager of the event loop
+ * @return pointer to uclock, or NULL in case of error
+ */
+struct uclock *uclock_std_alloc_cached(enum uclock_std_flags flags,
+                                       struct upump_mgr *upump_mgr)
+{
+    struct uclock *uclock = uclock_std_alloc(flags);
+    if (unlikely(uclock == NULL))
+        return NULL;
+
+    struct uclock_std *uclock_std = uclock_std_from_uclock(uclock);
+    uclock_std->upump = upump_alloc_iteration(upump_mgr, uclock_std_refresh,
+                                              uclock_std, NULL);
+    if (unlikely(uclock_std->upump == NULL)) {
+        uclock_release(uclock);
+        return NULL;
+    }
+    uclock_std->upump_mgr = upump_mgr_use(upump_mgr);
+    /* the pump must not keep the event loop alive */
+    upump_set_status(uclock_std->upump, false);
+    upump_start(uclock_std->upump);
+
+    uclock_std->cached = uclock_std_now(uclock);
+    uclock->uclock_now = uclock_std_now_cached;
+    return uclock;
+}
@@ -28,10 +28,16 @@
  * This manager stores all attributes inline inside a single umem block.
  * This is designed in order to minimize calls to memory allocators, and
  * to transmit dictionaries over streams.
+ *
+ * Udicts duplicated with @ref udict_share share the same block, which is
+ * copied when one of them is modified (copy-on-write). The block is
+ * refcounted with atomic operations, so that the duplicates may be used by
+ * different threads. @ref udict_dup still copies the block.
  */
 
 #include <upipe/ubase.h>
 #include <upipe/urefcount.h>
+#include <upipe/uatomic.h>
 #include <upipe/upool.h>
 #include <upipe/umem.h>
 #include <upipe/udict.h>
@@ -148,6 +154,53 @@ struct udict_inline {
 
 UBASE_FROM_TO(udict_inline, udict, udict, udict)
 
+/** @This is the header at the beginning of the umem block, before the
+ * attributes. */
+struct udict_inline_header {
+    /** number of udicts sharing the block */
+    uatomic_uint32_t refcount;
+};
+
+/** size reserved for the header at the beginning of the umem block */
+#define UDICT_INLINE_HEADER_SIZE                                            \
+    ((sizeof(struct udict_inline_header) + 7) & ~(size_t)7)
+
+/** @internal @This returns the header of the umem block of a udict.
+ *
+ * @param inl pointer to the udict_inline structure
+ * @return pointer to the header
+ */
+static inline struct udict_inline_header *
+    udict_inline_header(struct udict_inline *inl)
+{
+    return (struct udict_inline_header *)umem_buffer(&inl->umem);
+}
+
+/** @internal @This returns the beginning of the attributes of a udict.
+ *
+ * @param inl pointer to the udict_inline structure
+ * @return pointer to the first attribute
+ */
+static inline uint8_t *udict_inline_buffer(struct udict_inline *inl)
+{
+    return umem_buffer(&inl->umem) + UDICT_INLINE_HEADER_SIZE;
+}
+
+/** @internal @This releases the umem block of a udict, and frees it if it
+ * is not shared with another udict.
+ *
+ * @param inl pointer to the udict_inline structure
+ */
+static void udict_inline_release_umem(struct udict_inline *inl)
+{
+    struct udict_inline_header *header = udict_inline_header(inl);
+    if (uatomic_load(&header->refcount) == 1 ||
+        uatomic_fetch_sub(&header->refcount, 1) == 1) {
+        uatomic_clean(&header->refcount);
+        umem_free(&inl->umem);
+    }
+}
+
 /** @This allocates a udict with attributes space.
  *
  * @param mgr common management structure
@@ -159,16 +212,21 @@ static struct udict *udict_inline_alloc(struct udict_mgr *mgr, size_t size)
     struct udict_inline_mgr *inline_mgr = udict_inline_mgr_from_udict_mgr(mgr);
     struct udict_inline *inl = upool_alloc(&inline_mgr->udict_pool,
                                            struct udict_inline *);
+
+    if (unlikely(inl == NULL))
+        return NULL;
     struct udict *udict = udict_inline_to_udict(inl);
 
     if (size < inline_mgr->min_size)
         size = inline_mgr->min_size;
-    if (unlikely(!umem_alloc(inline_mgr->umem_mgr, &inl->umem, size))) {
+    if (unlikely(!umem_alloc(inline_mgr->umem_mgr, &inl->umem,
+                             UDICT_INLINE_HEADER_SIZE + size))) {
         upool_free(&inline_mgr->udict_pool, inl);
         return NULL;
     }
 
-    uint8_t *buffer = umem_buffer(&inl->umem);
+    uatomic_init(&udict_inline_header(inl)->refcount, 1);
+    uint8_t *buffer = udict_inline_buffer(inl);
     buffer[0] = UDICT_TYPE_END;
     inl->size = 1;
 
@@ -193,11 +251,66 @@ static int udict_inline_dup(struct udict *udict, struct udict **new_udict_p)
     *new_udict_p = new_udict;
 
     struct udict_inline *new_inl = udict_inline_from_udict(new_udict);
-    memcpy(umem_buffer(&new_inl->umem), umem_buffer(&inl->umem), inl->size);
+    memcpy(udict_inline_buffer(new_inl), udict_inline_buffer(inl), inl->size);
     new_inl->size = inl->size;
     return UBASE_ERR_NONE;
 }
 
+/** @This duplicates a given udict without copying the attributes. The umem
+ * block is shared until one of the udicts is modified.
+ *
+ * @param udict pointer to udict
+ * @param new_udict_p reference written with a pointer to the newly allocated
+ * udict
+ * @return an error code
+ */
+static int udict_inline_share(struct udict *udict, struct udict **new_udict_p)
+{
+    assert(new_udict_p != NULL);
+    struct udict_inline_mgr *inline_mgr =
+        udict_inline_mgr_from_udict_mgr(udict->mgr);
+    struct udict_inline *inl = udict_inline_from_udict(udict);
+    struct udict_inline *new_inl = upool_alloc(&inline_mgr->udict_pool,
+                                               struct udict_inline *);
+    if (unlikely(new_inl == NULL))
+        return UBASE_ERR_ALLOC;
+
+    uatomic_fetch_add(&udict_inline_header(inl)->refcount, 1);
+    new_inl->umem = inl->umem;
+    new_inl->size = inl->size;
+    *new_udict_p = udict_inline_to_udict(new_inl);
+    return UBASE_ERR_NONE;
+}
+
+/** @internal @This gives a udict its own copy of the umem block, if it is
+ * shared with other udicts, before it is modified.
+ *
+ * @param udict pointer to udict
+ * @return an error code
+ */
+static int udict_inline_unshare(struct udict *udict)
+{
+    struct udict_inline *inl = udict_inline_from_udict(udict);
+    if (likely(uatomic_load(&udict_inline_header(inl)->refcount) == 1))
+        return UBASE_ERR_NONE;
+
+    struct udict_inline_mgr *inline_mgr =
+        udict_inline_mgr_from_udict_mgr(udict->mgr);
+    struct umem umem;
+    if (unlikely(!umem_alloc(inline_mgr->umem_mgr, &umem,
+                             umem_size(&inl->umem))))
+        return UBASE_ERR_ALLOC;
+
+    struct udict_inline_header *header =
+        (struct udict_inline_header *)umem_buffer(&umem);
+    uatomic_init(&header->refcount, 1);
+    memcpy(umem_buffer(&umem) + UDICT_INLINE_HEADER_SIZE,
+           udict_inline_buffer(inl), inl->size);
+    udict_inline_release_umem(inl);
+    inl->umem = umem;
+    return UBASE_ERR_NONE;
+}
+
 /** @internal @This looks up a shorthand attribute in the list of shorthands.
  *
  * @param type shorthand attribute
@@ -255,7 +368,7 @@ static uint8_t *udict_inline_find(struct udict *udict, const char *name,
         inline_mgr->stats[type - UDICT_TYPE_SHORTHAND - 1]++;
     }
 #endif
-    uint8_t *attr = umem_buffer(&inl->umem);
+    uint8_t *attr = udict_inline_buffer(inl);
     while (attr != NULL) {
         if (*attr == type &&
              (type > UDICT_TYPE_SHORTHAND || type == UDICT_TYPE_END ||
@@ -288,7 +401,7 @@ static void udict_inline_iterate(struct udict *udict, const char **name_p,
         if (likely(attr != NULL))
             attr = udict_inline_next(attr);
     } else
-        attr = umem_buffer(&inl->umem);
+        attr = udict_inline_buffer(inl);
     if (unlikely(attr == NULL || *attr == UDICT_TYPE_END)) {
         *type_p = UDICT_TYPE_END;
         return;
@@ -377,12 +490,13 @@ static int udict_inline_delete(struct udict *udict, const char *name,
 {
     assert(type != UDICT_TYPE_END);
     struct udict_inline *inl = udict_inline_from_udict(udict);
-    uint8_t *attr = udict_inline_find(udict, name, type);
-    if (unlikely(attr == NULL))
+    if (unlikely(udict_inline_find(udict, name, type) == NULL))
         return UBASE_ERR_INVALID;
 
+    UBASE_RETURN(udict_inline_unshare(udict))
+    uint8_t *attr = udict_inline_find(udict, name, type);
     uint8_t *end = udict_inline_next(attr);
-    memmove(attr, end, umem_buffer(&inl->umem) + inl->size - end);
+    memmove(attr, end, udict_inline_buffer(inl) + inl->size - end);
     inl->size -= end - attr;
     return UBASE_ERR_NONE;
 }
@@ -410,6 +524,8 @@ static int udict_inline_set(struct udict *udict, const char *name,
         base_type = shorthand->base_type;
     }
 
+    UBASE_RETURN(udict_inline_unshare(udict))
+
     /* check if it already exists */
     size_t current_size;
     uint8_t *attr = _udict_inline_get(udict, name, type, &current_size);
@@ -444,17 +560,21 @@ static int udict_inline_set(struct udict *udict, const char *name,
     }
 
     /* check total attributes size */
-    attr = umem_buffer(&inl->umem) + inl->size - 1;
-    size_t total_size = (attr - umem_buffer(&inl->umem)) + header_size +
-                        attr_size + 1;
+    attr = udict_inline_buffer(inl) + inl->size - 1;
+    size_t total_size = UDICT_INLINE_HEADER_SIZE + inl->size - 1 +
+                        header_size + attr_size + 1;
     if (unlikely(total_size >= umem_size(&inl->umem))) {
         struct udict_inline_mgr *inline_mgr =
             udict_inline_mgr_from_udict_mgr(udict->mgr);
-        if (unlikely(!umem_realloc(&inl->umem, total_size +
-                                               inline_mgr->extra_size)))
+        /* the header may be moved, and the block is not shared */
+        uatomic_clean(&udict_inline_header(inl)->refcount);
+        bool ret = umem_realloc(&inl->umem,
+                                total_size + inline_mgr->extra_size);
+        uatomic_init(&udict_inline_header(inl)->refcount, 1);
+        if (unlikely(!ret))
             return UBASE_ERR_ALLOC;
 
-        attr = umem_buffer(&inl->umem) + inl->size - 1;
+        attr = udict_inline_buffer(inl) + inl->size - 1;
     }
     assert(*attr == UDICT_TYPE_END);
 
@@ -545,6 +665,10 @@ static int udict_inline_control(struct udict *udict, int command, va_list args)
             enum udict_type type = va_arg(args, enum udict_type);
             return udict_inline_delete(udict, name, type);
         }
+        case UDICT_SHARE: {
+            struct udict **udict_p = va_arg(args, struct udict **);
+            return udict_inline_share(udict, udict_p);
+        }
         case UDICT_NAME: {
             enum udict_type type = va_arg(args, enum udict_type);
             const char **name_p = va_arg(args, const char **);
@@ -566,7 +690,7 @@ static void udict_inline_free(struct udict *udict)
         udict_inline_mgr_from_udict_mgr(udict->mgr);
     struct udict_inline *inl = udict_inline_from_udict(udict);
 
-    umem_free(&inl->umem);
+    udict_inline_release_umem(inl);
     upool_free(&inline_mgr->udict_pool, inl);
 }
 
@@ -685,6 +809,7 @@ struct udict_mgr *udict_inline_mgr_alloc(uint16_t udict_pool_depth,
                udict_pool_depth,
                (void *)inline_mgr + sizeof(struct udict_inline_mgr),
                udict_inline_alloc_inner, udict_inline_free_inner);
+    upool_set_name(&inline_mgr->udict_pool, "udict_inline");
     inline_mgr->umem_mgr = umem_mgr;
     umem_mgr_use(umem_mgr);
 
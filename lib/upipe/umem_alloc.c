@@ -27,6 +27,7 @@
 #include <upipe/urefcount.h>
 #include <upipe/umem.h>
 #include <upipe/umem_alloc.h>
+#include <upipe/upool_audit.h>
 
 #include <stdlib.h>
 #include <stdbool.h>
@@ -54,6 +55,8 @@ UBASE_FROM_TO(umem_alloc_mgr, urefcount, urefcount, urefcount)
 static bool umem_alloc_alloc(struct umem_mgr *mgr, struct umem *umem,
                              size_t size)
 {
+    if (unlikely(uatomic_load(&upool_audit_tracking)))
+        upool_audit_miss("umem_alloc", size);
     uint8_t *buffer = malloc(size);
     if (unlikely(buffer == NULL))
         return false;
@@ -74,6 +77,8 @@ static bool umem_alloc_alloc(struct umem_mgr *mgr, struct umem *umem,
  */
 static bool umem_alloc_realloc(struct umem *umem, size_t new_size)
 {
+    if (unlikely(uatomic_load(&upool_audit_tracking)))
+        upool_audit_miss("umem_alloc", new_size);
     uint8_t *buffer = realloc(umem->buffer, new_size);
     if (unlikely(buffer == NULL))
         return false;
@@ -28,6 +28,7 @@
 #include <upipe/ulifo.h>
 #include <upipe/umem.h>
 #include <upipe/umem_pool.h>
+#include <upipe/upool_audit.h>
 
 #include <stdlib.h>
 #include <stdbool.h>
@@ -93,8 +94,11 @@ static bool umem_pool_alloc(struct umem_mgr *mgr, struct umem *umem,
 
     if (likely(pool < pool_mgr->nb_pools))
         buffer = ulifo_pop(&pool_mgr->pools[pool], uint8_t *);
-    if (unlikely(buffer == NULL))
+    if (unlikely(buffer == NULL)) {
+        if (unlikely(uatomic_load(&upool_audit_tracking)))
+            upool_audit_miss("umem_pool", real_size);
         buffer = malloc(real_size);
+    }
     if (unlikely(buffer == NULL))
         return false;
 
@@ -54,7 +54,8 @@ static void upipe_dump_pipe(upipe_dump_pipe_label pipe_label,
                             FILE *file, struct upipe *upipe, uint64_t *uid_p,
                             struct uchain *list, struct upipe *last_output);
 
-/** @This converts a pipe to a label (default function).
+/** @This converts a pipe to a label (default function). The number of
+ * pool misses reported while the pool audit is active is appended.
  *
  * @param upipe upipe structure
  * @return allocated string
@@ -63,15 +64,24 @@ char *upipe_dump_upipe_label_default(struct upipe *upipe)
 {
     struct uprobe *uprobe = upipe->uprobe;
     const char *prefix = NULL;
+    uint64_t pool_misses = 0;
 
     while (uprobe != NULL && prefix == NULL) {
         prefix = uprobe_pfx_get_name(uprobe);
+        if (prefix != NULL)
+            uprobe_pfx_get_pool_misses(uprobe, &pool_misses);
         uprobe = uprobe->next;
     }
 
-    char *string = malloc(prefix ? strlen(prefix) : 0 + sizeof(" (aaaa)"));
-    sprintf(string, "%s (%4.4s)", prefix ?: "",
-            (const char *)&upipe->mgr->signature);
+    size_t size = (prefix ? strlen(prefix) : 0) + sizeof(" (aaaa)");
+    if (pool_misses)
+        size += sizeof("\\n18446744073709551615 pool misses");
+    char *string = malloc(size);
+    int len = snprintf(string, size, "%s (%4.4s)", prefix ?: "",
+                       (const char *)&upipe->mgr->signature);
+    if (pool_misses)
+        snprintf(string + len, size - len, "\\n%"PRIu64" pool misses",
+                 pool_misses);
     return string;
 }
 
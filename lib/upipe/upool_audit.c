@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2017 OpenHeadend S.A.R.L.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** @file
+ * @short Upipe audit of the pools of the core managers
+ */
+
+#include <upipe/ubase.h>
+#include <upipe/uatomic.h>
+#include <upipe/uprobe.h>
+#include <upipe/upipe.h>
+#include <upipe/upool_audit.h>
+
+#include <stdlib.h>
+
+/* The global state is zero-initialized, which is the initial state of the
+ * uatomic variables, so that pipes may test it before the audit is ever set. */
+
+/** non-zero when pool misses are tracked */
+uatomic_uint32_t upool_audit_tracking;
+/** mode of the audit */
+static uatomic_uint32_t upool_audit_mode;
+/** probe receiving the misses occurring outside of any pipe */
+static uatomic_ptr_t upool_audit_uprobe;
+/** number of threads taking a reference to the probe */
+static uatomic_uint32_t upool_audit_users;
+/** number of misses since the audit was set */
+static uatomic_uint32_t upool_audit_count;
+
+/** pipe running on the current thread */
+static __thread struct upipe *upool_audit_upipe = NULL;
+/** true while a miss is being reported on the current thread */
+static __thread bool upool_audit_reporting = false;
+
+/** @This sets the mode of the pool audit, and resets the count of misses.
+ * It may be called while other threads report misses, but not concurrently
+ * with itself.
+ *
+ * @param mode mode of the audit
+ * @param uprobe probe receiving the misses occurring outside of any pipe,
+ * for instance in pump callbacks (may be NULL)
+ */
+void upool_audit_set(enum upool_audit_mode mode, struct uprobe *uprobe)
+{
+    uatomic_store(&upool_audit_tracking, 0);
+    uatomic_store(&upool_audit_mode, mode);
+    uatomic_store(&upool_audit_count, 0);
+
+    struct uprobe *prev = uatomic_ptr_load(&upool_audit_uprobe);
+    uatomic_ptr_store(&upool_audit_uprobe, uprobe_use(uprobe));
+    /* threads reporting a miss hold their own reference to the previous
+     * probe, but may be about to take it */
+    while (uatomic_load(&upool_audit_users));
+    uprobe_release(prev);
+
+    uatomic_store(&upool_audit_tracking, mode != UPOOL_AUDIT_NONE);
+}
+
+/** @This returns the number of pool misses since the audit was set.
+ *
+ * @return number of misses
+ */
+uint32_t upool_audit_misses(void)
+{
+    return uatomic_load(&upool_audit_count);
+}
+
+/** @This reports a pool miss.
+ *
+ * @param name name of the pool
+ * @param size size of the requested buffer, or 0 for pools of structures
+ */
+void upool_audit_miss(const char *name, size_t size)
+{
+    /* logging and probes may themselves allocate */
+    if (!uatomic_load(&upool_audit_tracking) || upool_audit_reporting)
+        return;
+    upool_audit_reporting = true;
+    uatomic_fetch_add(&upool_audit_count, 1);
+
+    name = name ?: "upool";
+    struct upipe *upipe = upool_audit_upipe;
+    if (upipe != NULL) {
+        upipe_throw(upipe, UPROBE_POOL_MISS, name, size);
+        if (size)
+            upipe_warn_va(upipe, "pool miss in %s (%zu octets)", name, size);
+        else
+            upipe_warn_va(upipe, "pool miss in %s", name);
+    } else {
+        uatomic_fetch_add(&upool_audit_users, 1);
+        struct uprobe *uprobe =
+            uprobe_use(uatomic_ptr_load(&upool_audit_uprobe));
+        uatomic_fetch_sub(&upool_audit_users, 1);
+
+        if (uprobe != NULL) {
+            uprobe_throw(uprobe, NULL, UPROBE_POOL_MISS, name, size);
+            if (size)
+                uprobe_warn_va(uprobe, NULL,
+                               "pool miss in %s (%zu octets)", name, size);
+            else
+                uprobe_warn_va(uprobe, NULL, "pool miss in %s", name);
+            uprobe_release(uprobe);
+        }
+    }
+
+    if (uatomic_load(&upool_audit_mode) == UPOOL_AUDIT_TRAP)
+        abort();
+    upool_audit_reporting = false;
+}
+
+/** @internal @This replaces the pipe running on the current thread.
+ *
+ * @param upipe pipe entering, or pipe to restore
+ * @return pipe previously running
+ */
+struct upipe *upool_audit_swap(struct upipe *upipe)
+{
+    struct upipe *prev = upool_audit_upipe;
+    upool_audit_upipe = upipe;
+    return prev;
+}
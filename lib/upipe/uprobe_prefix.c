@@ -28,6 +28,7 @@
  */
 
 #include <upipe/ubase.h>
+#include <upipe/uatomic.h>
 #include <upipe/ulist.h>
 #include <upipe/uprobe.h>
 #include <upipe/uprobe_prefix.h>
@@ -50,6 +51,8 @@ static int uprobe_pfx_throw(struct uprobe *uprobe, struct upipe *upipe,
                             int event, va_list args)
 {
     struct uprobe_pfx *uprobe_pfx = uprobe_pfx_from_uprobe(uprobe);
+    if (event == UPROBE_POOL_MISS)
+        uatomic_fetch_add(&uprobe_pfx->pool_misses, 1);
     if (event != UPROBE_LOG)
         return uprobe_throw_next(uprobe, upipe, event, args);
 
@@ -90,6 +93,7 @@ struct uprobe *uprobe_pfx_init(struct uprobe_pfx *uprobe_pfx,
     } else
         uprobe_pfx->name = NULL;
     uprobe_pfx->min_level = min_level;
+    uatomic_init(&uprobe_pfx->pool_misses, 0);
     uprobe_init(uprobe, uprobe_pfx_throw, next);
     return uprobe;
 }
@@ -103,6 +107,7 @@ void uprobe_pfx_clean(struct uprobe_pfx *uprobe_pfx)
     assert(uprobe_pfx != NULL);
     struct uprobe *uprobe = uprobe_pfx_to_uprobe(uprobe_pfx);
     free(uprobe_pfx->name);
+    uatomic_clean(&uprobe_pfx->pool_misses);
     uprobe_clean(uprobe);
 }
 
@@ -120,6 +125,23 @@ const char *uprobe_pfx_get_name(struct uprobe *uprobe)
     return uprobe_pfx->name;
 }
 
+/** @This returns the number of pool misses reported by the pipe, while the
+ * pool audit is active.
+ *
+ * @param uprobe pointer to probe
+ * @param pool_misses_p filled in with the number of pool misses
+ * @return an error code
+ */
+int uprobe_pfx_get_pool_misses(struct uprobe *uprobe, uint64_t *pool_misses_p)
+{
+    if (uprobe->uprobe_throw != uprobe_pfx_throw)
+        return UBASE_ERR_INVALID;
+
+    struct uprobe_pfx *uprobe_pfx = uprobe_pfx_from_uprobe(uprobe);
+    *pool_misses_p = uatomic_load(&uprobe_pfx->pool_misses);
+    return UBASE_ERR_NONE;
+}
+
 #define ARGS_DECL struct uprobe *next, enum uprobe_log_level min_level, const char *name
 #define ARGS next, min_level, name
 UPROBE_HELPER_ALLOC(uprobe_pfx)
@@ -32,6 +32,8 @@
 #include <upipe/upool.h>
 #include <upipe/upump_common.h>
 #include <upipe/upump_blocker.h>
+#include <upipe/uclock.h>
+#include <upipe/uclock_std.h>
 
 #include <stdlib.h>
 
@@ -132,6 +134,7 @@ void upump_common_init(struct upump *upump)
     common->started = false;
     common->status = true;
     ulist_init(&common->blockers);
+    uchain_init(&common->wheel_uchain);
 }
 
 /** @This dispatches a pump.
@@ -236,6 +239,326 @@ void upump_common_clean(struct upump *upump)
     urefcount_release(refcount);
 }
 
+/** @This sets the timeout of a pump of type
+ * @ref UPUMP_TYPE_WHEEL_TIMER. The pump must not be running.
+ *
+ * @param upump description structure of the pump
+ * @param after time after which it triggers, in 27 MHz ticks
+ * @param repeat repeat interval, in 27 MHz ticks, or 0
+ */
+void upump_common_wheel_set(struct upump *upump, uint64_t after,
+                            uint64_t repeat)
+{
+    struct upump_common *common = upump_common_from_upump(upump);
+    common->wheel_after = (after + UPUMP_WHEEL_TICK - 1) / UPUMP_WHEEL_TICK;
+    common->wheel_repeat = (repeat + UPUMP_WHEEL_TICK - 1) / UPUMP_WHEEL_TICK;
+    if (!common->wheel_after)
+        common->wheel_after = 1;
+}
+
+/** @internal @This inserts an armed timer in the slot of the wheel
+ * corresponding to its expiration tick.
+ *
+ * @param wheel timer wheel
+ * @param common common structure of the pump
+ */
+static void upump_common_wheel_insert(struct upump_common_wheel *wheel,
+                                      struct upump_common *common)
+{
+    uint64_t expires = common->wheel_expires;
+    if (unlikely(expires < wheel->tick)) {
+        /* late: trigger at the next processed tick */
+        ulist_add(&wheel->slots[0][wheel->tick & (UPUMP_WHEEL_SLOTS - 1)],
+                  &common->wheel_uchain);
+        return;
+    }
+
+    uint64_t delta = expires - wheel->tick;
+    unsigned int level = 0;
+    while (level < UPUMP_WHEEL_LEVELS - 1 &&
+           delta >= UINT64_C(1) << (UPUMP_WHEEL_BITS * (level + 1)))
+        level++;
+    if (unlikely(delta >= UINT64_C(1) << (UPUMP_WHEEL_BITS *
+                                          UPUMP_WHEEL_LEVELS)))
+        /* beyond the span of the wheel: park it in the farthest slot, it
+         * will be reinserted when cascading */
+        expires = wheel->tick +
+            (UINT64_C(1) << (UPUMP_WHEEL_BITS * UPUMP_WHEEL_LEVELS)) - 1;
+
+    unsigned int slot = (expires >> (UPUMP_WHEEL_BITS * level)) &
+                        (UPUMP_WHEEL_SLOTS - 1);
+    ulist_add(&wheel->slots[level][slot], &common->wheel_uchain);
+}
+
+/** @internal @This reinserts the timers of a slot of an upper level into the
+ * lower levels.
+ *
+ * @param wheel timer wheel
+ * @param level level of the slot
+ * @param slot index of the slot
+ */
+static void upump_common_wheel_cascade(struct upump_common_wheel *wheel,
+                                       unsigned int level, unsigned int slot)
+{
+    struct uchain *list = &wheel->slots[level][slot];
+    struct uchain *uchain, *uchain_tmp;
+    ulist_delete_foreach (list, uchain, uchain_tmp) {
+        ulist_delete(uchain);
+        upump_common_wheel_insert(wheel,
+                                  upump_common_from_wheel_uchain(uchain));
+    }
+}
+
+/** @internal @This returns the next tick at which the wheel has work to do,
+ * that is either the expiration of a timer of the first level, or the
+ * cascade of an occupied slot of an upper level.
+ *
+ * @param wheel timer wheel
+ * @return next tick to process, or UINT64_MAX if the wheel is empty
+ */
+static uint64_t upump_common_wheel_next(struct upump_common_wheel *wheel)
+{
+    uint64_t next = UINT64_MAX;
+    for (unsigned int i = 0; i < UPUMP_WHEEL_SLOTS; i++) {
+        if (!ulist_empty(&wheel->slots[0][(wheel->tick + i) &
+                                          (UPUMP_WHEEL_SLOTS - 1)])) {
+            next = wheel->tick + i;
+            break;
+        }
+    }
+
+    for (unsigned int level = 1; level < UPUMP_WHEEL_LEVELS; level++) {
+        /* slots of this level cascade on multiples of their span */
+        unsigned int shift = UPUMP_WHEEL_BITS * level;
+        uint64_t span = UINT64_C(1) << shift;
+        uint64_t base = (wheel->tick + span - 1) & ~(span - 1);
+        if (base >= next)
+            break;
+        unsigned int slot = (base >> shift) & (UPUMP_WHEEL_SLOTS - 1);
+        for (unsigned int i = 0; i < UPUMP_WHEEL_SLOTS; i++) {
+            if (base + i * span >= next)
+                break;
+            if (!ulist_empty(&wheel->slots[level][(slot + i) &
+                                                  (UPUMP_WHEEL_SLOTS - 1)])) {
+                next = base + i * span;
+                break;
+            }
+        }
+    }
+    return next;
+}
+
+/** @internal @This arms the timer pump driving the wheel to trigger at the
+ * given tick, unless it is already armed to trigger before.
+ *
+ * @param common_mgr common management structure
+ * @param deadline tick at which the wheel must be processed
+ */
+static void upump_common_wheel_arm(struct upump_common_mgr *common_mgr,
+                                   uint64_t deadline)
+{
+    struct upump_common_wheel *wheel = &common_mgr->wheel;
+    if (wheel->upump == NULL || wheel->running || deadline >= wheel->deadline)
+        return;
+
+    wheel->deadline = deadline;
+    uint64_t now = uclock_now(wheel->uclock);
+    uint64_t date = deadline * UPUMP_WHEEL_TICK;
+    upump_rearm(wheel->upump, date > now ? date - now : 0, 0);
+}
+
+/** @internal @This releases the timer pump driving the wheel if no timer
+ * is armed, and updates its blocking status otherwise.
+ *
+ * @param common_mgr common management structure
+ */
+static void upump_common_wheel_update(struct upump_common_mgr *common_mgr)
+{
+    struct upump_common_wheel *wheel = &common_mgr->wheel;
+    if (wheel->upump == NULL || wheel->running)
+        return;
+
+    if (!wheel->timers) {
+        upump_stop(wheel->upump);
+        upump_free(wheel->upump);
+        wheel->upump = NULL;
+        wheel->deadline = UINT64_MAX;
+        uclock_release(wheel->uclock);
+        wheel->uclock = NULL;
+        return;
+    }
+
+    bool status = wheel->blocking > 0;
+    if (status != wheel->upump_status) {
+        upump_set_status(wheel->upump, status);
+        wheel->upump_status = status;
+    }
+}
+
+/** @internal @This processes the ticks of the wheel elapsed since the last
+ * call, and triggers the expired timers.
+ *
+ * @param upump timer pump driving the wheel
+ */
+static void upump_common_wheel_run(struct upump *upump)
+{
+    struct upump_common_mgr *common_mgr =
+        upump_get_opaque(upump, struct upump_common_mgr *);
+    struct upump_common_wheel *wheel = &common_mgr->wheel;
+    uint64_t now = uclock_now(wheel->uclock) / UPUMP_WHEEL_TICK;
+
+    wheel->running = true;
+    while (wheel->tick <= now) {
+        unsigned int slot = wheel->tick & (UPUMP_WHEEL_SLOTS - 1);
+        for (unsigned int level = 1; !slot && level < UPUMP_WHEEL_LEVELS;
+             level++) {
+            slot = (wheel->tick >> (UPUMP_WHEEL_BITS * level)) &
+                   (UPUMP_WHEEL_SLOTS - 1);
+            upump_common_wheel_cascade(wheel, level, slot);
+        }
+
+        /* callbacks may stop or start any timer, including the expired
+         * ones, so detach them before triggering */
+        struct uchain expired;
+        struct uchain *list =
+            &wheel->slots[0][wheel->tick & (UPUMP_WHEEL_SLOTS - 1)];
+        ulist_init(&expired);
+        if (!ulist_empty(list)) {
+            expired.next = list->next;
+            expired.prev = list->prev;
+            expired.next->prev = &expired;
+            expired.prev->next = &expired;
+            ulist_init(list);
+        }
+        wheel->tick++;
+
+        struct uchain *uchain;
+        while ((uchain = ulist_pop(&expired)) != NULL) {
+            struct upump_common *common =
+                upump_common_from_wheel_uchain(uchain);
+            if (common->wheel_repeat) {
+                /* don't try to catch up with missed occurrences */
+                common->wheel_expires += common->wheel_repeat;
+                if (common->wheel_expires <= now)
+                    common->wheel_expires = now + 1;
+                upump_common_wheel_insert(wheel, common);
+            } else {
+                wheel->timers--;
+                if (common->status)
+                    wheel->blocking--;
+            }
+            upump_common_dispatch(upump_common_to_upump(common));
+        }
+    }
+    wheel->running = false;
+    upump_common_wheel_update(common_mgr);
+
+    if (wheel->upump != NULL) {
+        /* sleep until the next occupied slot */
+        uint64_t next = upump_common_wheel_next(wheel);
+        wheel->deadline = UINT64_MAX;
+        if (likely(next != UINT64_MAX))
+            upump_common_wheel_arm(common_mgr, next);
+        else
+            upump_stop(wheel->upump);
+    }
+}
+
+/** @This really starts a pump of type @ref UPUMP_TYPE_WHEEL_TIMER. It is
+ * meant to be called by the real start function of the manager.
+ *
+ * @param upump description structure of the pump
+ * @param status blocking status of the pump
+ * @return an error code
+ */
+int upump_common_wheel_start(struct upump *upump, bool status)
+{
+    struct upump_common *common = upump_common_from_upump(upump);
+    struct upump_common_mgr *common_mgr =
+        upump_common_mgr_from_upump_mgr(upump->mgr);
+    struct upump_common_wheel *wheel = &common_mgr->wheel;
+    if (ulist_is_in(&common->wheel_uchain))
+        return UBASE_ERR_NONE;
+
+    if (wheel->upump == NULL) {
+        /* the time of the current iteration of the loop is precise enough,
+         * and much cheaper to read at each start */
+        wheel->uclock = uclock_std_alloc_cached(0, upump->mgr);
+        if (wheel->uclock == NULL)
+            wheel->uclock = uclock_std_alloc(0);
+        UBASE_ALLOC_RETURN(wheel->uclock);
+        wheel->upump = upump_alloc_timer(upump->mgr, upump_common_wheel_run,
+                                         common_mgr, NULL,
+                                         UPUMP_WHEEL_TICK, 0);
+        if (unlikely(wheel->upump == NULL)) {
+            uclock_release(wheel->uclock);
+            wheel->uclock = NULL;
+            return UBASE_ERR_ALLOC;
+        }
+        wheel->upump_status = true;
+        wheel->deadline = UINT64_MAX;
+        wheel->tick = uclock_now(wheel->uclock) / UPUMP_WHEEL_TICK + 1;
+    }
+
+    /* the wheel may lag behind while its pump sleeps */
+    common->wheel_expires = uclock_now(wheel->uclock) / UPUMP_WHEEL_TICK + 1 +
+                            common->wheel_after;
+    upump_common_wheel_insert(wheel, common);
+    wheel->timers++;
+    if (status)
+        wheel->blocking++;
+    upump_common_wheel_update(common_mgr);
+    upump_common_wheel_arm(common_mgr, common->wheel_expires);
+    return UBASE_ERR_NONE;
+}
+
+/** @This really stops a pump of type @ref UPUMP_TYPE_WHEEL_TIMER. It is
+ * meant to be called by the real stop function of the manager.
+ *
+ * @param upump description structure of the pump
+ * @param status blocking status of the pump
+ */
+void upump_common_wheel_stop(struct upump *upump, bool status)
+{
+    struct upump_common *common = upump_common_from_upump(upump);
+    struct upump_common_mgr *common_mgr =
+        upump_common_mgr_from_upump_mgr(upump->mgr);
+    struct upump_common_wheel *wheel = &common_mgr->wheel;
+    if (!ulist_is_in(&common->wheel_uchain))
+        return;
+
+    ulist_delete(&common->wheel_uchain);
+    wheel->timers--;
+    if (status)
+        wheel->blocking--;
+    upump_common_wheel_update(common_mgr);
+}
+
+/** @This really restarts a pump of type @ref UPUMP_TYPE_WHEEL_TIMER. It is
+ * meant to be called by the real restart function of the manager.
+ *
+ * @param upump description structure of the pump
+ * @param status blocking status of the pump
+ * @return an error code
+ */
+int upump_common_wheel_restart(struct upump *upump, bool status)
+{
+    struct upump_common *common = upump_common_from_upump(upump);
+    if (ulist_is_in(&common->wheel_uchain)) {
+        /* don't release the driving pump in between */
+        struct upump_common_mgr *common_mgr =
+            upump_common_mgr_from_upump_mgr(upump->mgr);
+        struct upump_common_wheel *wheel = &common_mgr->wheel;
+        ulist_delete(&common->wheel_uchain);
+        common->wheel_expires = uclock_now(wheel->uclock) / UPUMP_WHEEL_TICK +
+                                1 + common->wheel_after;
+        upump_common_wheel_insert(wheel, common);
+        upump_common_wheel_arm(common_mgr, common->wheel_expires);
+        return UBASE_ERR_NONE;
+    }
+    return upump_common_wheel_start(upump, status);
+}
+
 /** @This returns the extra buffer space needed for pools.
  *
  * @param upump_pool_depth maximum number of upump structures in the pool
@@ -306,10 +629,25 @@ void upump_common_mgr_init(struct upump_mgr *mgr,
     common_mgr->upump_real_stop = upump_real_stop;
     common_mgr->upump_real_restart = upump_real_restart;
 
+    struct upump_common_wheel *wheel = &common_mgr->wheel;
+    for (unsigned int i = 0; i < UPUMP_WHEEL_LEVELS; i++)
+        for (unsigned int j = 0; j < UPUMP_WHEEL_SLOTS; j++)
+            ulist_init(&wheel->slots[i][j]);
+    wheel->tick = 0;
+    wheel->timers = 0;
+    wheel->blocking = 0;
+    wheel->upump = NULL;
+    wheel->upump_status = true;
+    wheel->deadline = UINT64_MAX;
+    wheel->uclock = NULL;
+    wheel->running = false;
+
     upool_init(&common_mgr->upump_pool, mgr->refcount, upump_pool_depth,
                pool_extra, upump_alloc_inner, upump_free_inner);
     upool_init(&common_mgr->upump_blocker_pool, NULL, upump_blocker_pool_depth,
                pool_extra + upool_sizeof(upump_pool_depth),
                upump_common_blocker_alloc_inner,
                upump_common_blocker_free_inner);
+    upool_set_name(&common_mgr->upump_pool, "upump");
+    upool_set_name(&common_mgr->upump_blocker_pool, "upump_blocker");
 }
@@ -177,6 +177,7 @@ struct uref_mgr *uref_std_mgr_alloc(uint16_t uref_pool_depth,
 
     upool_init(&std_mgr->uref_pool, std_mgr->mgr.refcount, uref_pool_depth,
                std_mgr->upool_extra, uref_std_alloc_inner, uref_std_free_inner);
+    upool_set_name(&std_mgr->uref_pool, "uref_std");
 
     std_mgr->mgr.control_attr_size = control_attr_size;
     std_mgr->mgr.udict_mgr = udict_mgr;
@@ -0,0 +1,834 @@
+/*
+ * Copyright (C) 2017 OpenHeadend S.A.R.L.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** @file
+ * @short Upipe sample processing kernels for sound pipes
+ */
+
+#include <upipe/ubase.h>
+#include <upipe/usound.h>
+
+#include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+
+#if defined(__i686__) || defined(__x86_64__)
+#define USOUND_X86 1
+#include <immintrin.h>
+#endif
+
+/** highest float value that may be converted to s32 */
+#define USOUND_FLT_S32_MAX 2147483520.f
+/** lowest float value that may be converted to s32 */
+#define USOUND_FLT_S32_MIN -2147483648.f
+
+/*
+ * C versions
+ */
+
+/** @internal @This returns the maximum absolute value of s16 samples.
+ *
+ * @param src samples
+ * @param samples number of samples
+ * @return maximum absolute value
+ */
+static uint32_t usound_peak_s16_c(const int16_t *src, size_t samples)
+{
+    int32_t max = 0, min = 0;
+    for (size_t i = 0; i < samples; i++) {
+        if (src[i] > max)
+            max = src[i];
+        else if (src[i] < min)
+            min = src[i];
+    }
+    return max > -min ? max : -min;
+}
+
+/** @internal @This returns the maximum absolute value of s32 samples.
+ *
+ * @param src samples
+ * @param samples number of samples
+ * @return maximum absolute value
+ */
+static uint32_t usound_peak_s32_c(const int32_t *src, size_t samples)
+{
+    int64_t max = 0, min = 0;
+    for (size_t i = 0; i < samples; i++) {
+        if (src[i] > max)
+            max = src[i];
+        else if (src[i] < min)
+            min = src[i];
+    }
+    return max > -min ? max : -min;
+}
+
+/** @internal @This returns the maximum absolute value of f32 samples.
+ *
+ * @param src samples
+ * @param samples number of samples
+ * @return maximum absolute value
+ */
+static float usound_peak_flt_c(const float *src, size_t samples)
+{
+    float max = 0.;
+    for (size_t i = 0; i < samples; i++) {
+        float c = fabsf(src[i]);
+        if (c > max)
+            max = c;
+    }
+    return max;
+}
+
+/** @internal @This adds src to dst with a linear gain ramp.
+ *
+ * @param dst samples to add to
+ * @param src samples to add
+ * @param samples number of samples
+ * @param channels number of channels in a sample
+ * @param gain gain of the first sample
+ * @param step gain increment between samples
+ */
+static void usound_mix_flt_c(float *dst, const float *src, size_t samples,
+                             uint8_t channels, float gain, float step)
+{
+    for (size_t i = 0; i < samples; i++) {
+        float g = (float)i * step + gain;
+        for (uint8_t c = 0; c < channels; c++)
+            dst[c] += src[c] * g;
+        dst += channels;
+        src += channels;
+    }
+}
+
+/** @internal @This defines the C versions of interleaving functions.
+ *
+ * @param bits size of a sample in bits
+ */
+#define USOUND_INTERLEAVE_TEMPLATE(bits)                                    \
+static void usound_interleave_##bits##_c(int##bits##_t *dst,                \
+        const int##bits##_t *const *src, size_t samples, uint8_t channels)  \
+{                                                                           \
+    for (size_t i = 0; i < samples; i++)                                    \
+        for (uint8_t c = 0; c < channels; c++)                              \
+            *dst++ = src[c][i];                                             \
+}                                                                           \
+                                                                            \
+static void usound_deinterleave_##bits##_c(int##bits##_t *const *dst,       \
+        const int##bits##_t *src, size_t samples, uint8_t channels)         \
+{                                                                           \
+    for (size_t i = 0; i < samples; i++)                                    \
+        for (uint8_t c = 0; c < channels; c++)                              \
+            dst[c][i] = *src++;                                             \
+}
+USOUND_INTERLEAVE_TEMPLATE(16)
+USOUND_INTERLEAVE_TEMPLATE(32)
+#undef USOUND_INTERLEAVE_TEMPLATE
+
+/** @internal @This converts s16 values to f32.
+ *
+ * @param dst converted values
+ * @param src values to convert
+ * @param values number of values
+ */
+static void usound_s16_to_flt_c(float *dst, const int16_t *src, size_t values)
+{
+    for (size_t i = 0; i < values; i++)
+        dst[i] = (float)src[i] * (1.f / 32768.f);
+}
+
+/** @internal @This converts f32 values to s16.
+ *
+ * @param dst converted values
+ * @param src values to convert
+ * @param values number of values
+ */
+static void usound_flt_to_s16_c(int16_t *dst, const float *src, size_t values)
+{
+    for (size_t i = 0; i < values; i++) {
+        float v = src[i] * 32768.f;
+        if (v > 32767.f)
+            v = 32767.f;
+        else if (v < -32768.f)
+            v = -32768.f;
+        dst[i] = lrintf(v);
+    }
+}
+
+/** @internal @This converts s32 values to f32.
+ *
+ * @param dst converted values
+ * @param src values to convert
+ * @param values number of values
+ */
+static void usound_s32_to_flt_c(float *dst, const int32_t *src, size_t values)
+{
+    for (size_t i = 0; i < values; i++)
+        dst[i] = (float)src[i] * (1.f / 2147483648.f);
+}
+
+/** @internal @This converts f32 values to s32.
+ *
+ * @param dst converted values
+ * @param src values to convert
+ * @param values number of values
+ */
+static void usound_flt_to_s32_c(int32_t *dst, const float *src, size_t values)
+{
+    for (size_t i = 0; i < values; i++) {
+        float v = src[i] * 2147483648.f;
+        if (v > USOUND_FLT_S32_MAX)
+            v = USOUND_FLT_S32_MAX;
+        else if (v < USOUND_FLT_S32_MIN)
+            v = USOUND_FLT_S32_MIN;
+        dst[i] = lrintf(v);
+    }
+}
+
+#ifdef USOUND_X86
+/*
+ * SSE2 versions
+ */
+
+/** @internal @This returns the maximum absolute value of s16 samples.
+ *
+ * @param src samples
+ * @param samples number of samples
+ * @return maximum absolute value
+ */
+__attribute__((target("sse2")))
+static uint32_t usound_peak_s16_sse2(const int16_t *src, size_t samples)
+{
+    __m128i max = _mm_setzero_si128(), min = _mm_setzero_si128();
+    size_t i;
+    for (i = 0; i + 8 <= samples; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        max = _mm_max_epi16(max, v);
+        min = _mm_min_epi16(min, v);
+    }
+
+    int16_t maxs[8], mins[8];
+    _mm_storeu_si128((__m128i *)maxs, max);
+    _mm_storeu_si128((__m128i *)mins, min);
+    int32_t max_value = 0, min_value = 0;
+    for (int j = 0; j < 8; j++) {
+        if (maxs[j] > max_value)
+            max_value = maxs[j];
+        if (mins[j] < min_value)
+            min_value = mins[j];
+    }
+    for ( ; i < samples; i++) {
+        if (src[i] > max_value)
+            max_value = src[i];
+        else if (src[i] < min_value)
+            min_value = src[i];
+    }
+    return max_value > -min_value ? max_value : -min_value;
+}
+
+/** @internal @This returns the maximum absolute value of f32 samples.
+ *
+ * @param src samples
+ * @param samples number of samples
+ * @return maximum absolute value
+ */
+__attribute__((target("sse2")))
+static float usound_peak_flt_sse2(const float *src, size_t samples)
+{
+    const __m128 mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    __m128 max = _mm_setzero_ps();
+    size_t i;
+    for (i = 0; i + 4 <= samples; i += 4) {
+        __m128 v = _mm_and_ps(_mm_loadu_ps(src + i), mask);
+        /* the second operand is returned if the first one is a NaN */
+        max = _mm_max_ps(v, max);
+    }
+
+    float maxs[4];
+    _mm_storeu_ps(maxs, max);
+    float max_value = 0.;
+    for (int j = 0; j < 4; j++)
+        if (maxs[j] > max_value)
+            max_value = maxs[j];
+    for ( ; i < samples; i++) {
+        float c = fabsf(src[i]);
+        if (c > max_value)
+            max_value = c;
+    }
+    return max_value;
+}
+
+/** @internal @This adds src to dst with a linear gain ramp.
+ *
+ * @param dst samples to add to
+ * @param src samples to add
+ * @param samples number of samples
+ * @param channels number of channels in a sample
+ * @param gain gain of the first sample
+ * @param step gain increment between samples
+ */
+__attribute__((target("sse2")))
+static void usound_mix_flt_sse2(float *dst, const float *src, size_t samples,
+                                uint8_t channels, float gain, float step)
+{
+    if (channels != 1) {
+        usound_mix_flt_c(dst, src, samples, channels, gain, step);
+        return;
+    }
+
+    const __m128 gains = _mm_set1_ps(gain);
+    const __m128 steps = _mm_set1_ps(step);
+    __m128i index = _mm_setr_epi32(0, 1, 2, 3);
+    const __m128i four = _mm_set1_epi32(4);
+    size_t i;
+    for (i = 0; i + 4 <= samples; i += 4) {
+        __m128 g = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(index), steps),
+                              gains);
+        __m128 v = _mm_mul_ps(_mm_loadu_ps(src + i), g);
+        _mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), v));
+        index = _mm_add_epi32(index, four);
+    }
+    for ( ; i < samples; i++)
+        dst[i] += src[i] * ((float)i * step + gain);
+}
+
+/** @internal @This interleaves planar 16-bit samples.
+ *
+ * @param dst interleaved samples
+ * @param src planar samples
+ * @param samples number of samples
+ * @param channels number of channels
+ */
+__attribute__((target("sse2")))
+static void usound_interleave_16_sse2(int16_t *dst,
+        const int16_t *const *src, size_t samples, uint8_t channels)
+{
+    if (channels != 2) {
+        usound_interleave_16_c(dst, src, samples, channels);
+        return;
+    }
+
+    size_t i;
+    for (i = 0; i + 8 <= samples; i += 8) {
+        __m128i l = _mm_loadu_si128((const __m128i *)(src[0] + i));
+        __m128i r = _mm_loadu_si128((const __m128i *)(src[1] + i));
+        _mm_storeu_si128((__m128i *)(dst + 2 * i), _mm_unpacklo_epi16(l, r));
+        _mm_storeu_si128((__m128i *)(dst + 2 * i + 8),
+                         _mm_unpackhi_epi16(l, r));
+    }
+    for ( ; i < samples; i++) {
+        dst[2 * i] = src[0][i];
+        dst[2 * i + 1] = src[1][i];
+    }
+}
+
+/** @internal @This interleaves planar 32-bit samples.
+ *
+ * @param dst interleaved samples
+ * @param src planar samples
+ * @param samples number of samples
+ * @param channels number of channels
+ */
+__attribute__((target("sse2")))
+static void usound_interleave_32_sse2(int32_t *dst,
+        const int32_t *const *src, size_t samples, uint8_t channels)
+{
+    if (channels != 2) {
+        usound_interleave_32_c(dst, src, samples, channels);
+        return;
+    }
+
+    size_t i;
+    for (i = 0; i + 4 <= samples; i += 4) {
+        __m128i l = _mm_loadu_si128((const __m128i *)(src[0] + i));
+        __m128i r = _mm_loadu_si128((const __m128i *)(src[1] + i));
+        _mm_storeu_si128((__m128i *)(dst + 2 * i), _mm_unpacklo_epi32(l, r));
+        _mm_storeu_si128((__m128i *)(dst + 2 * i + 4),
+                         _mm_unpackhi_epi32(l, r));
+    }
+    for ( ; i < samples; i++) {
+        dst[2 * i] = src[0][i];
+        dst[2 * i + 1] = src[1][i];
+    }
+}
+
+/** @internal @This deinterleaves packed 16-bit samples.
+ *
+ * @param dst planar samples
+ * @param src interleaved samples
+ * @param samples number of samples
+ * @param channels number of channels
+ */
+__attribute__((target("sse2")))
+static void usound_deinterleave_16_sse2(int16_t *const *dst,
+        const int16_t *src, size_t samples, uint8_t channels)
+{
+    if (channels != 2) {
+        usound_deinterleave_16_c(dst, src, samples, channels);
+        return;
+    }
+
+    size_t i;
+    for (i = 0; i + 8 <= samples; i += 8) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(src + 2 * i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(src + 2 * i + 8));
+        /* sign-extended values can be packed without saturation */
+        __m128i la = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+        __m128i lb = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+        __m128i ra = _mm_srai_epi32(a, 16);
+        __m128i rb = _mm_srai_epi32(b, 16);
+        _mm_storeu_si128((__m128i *)(dst[0] + i), _mm_packs_epi32(la, lb));
+        _mm_storeu_si128((__m128i *)(dst[1] + i), _mm_packs_epi32(ra, rb));
+    }
+    for ( ; i < samples; i++) {
+        dst[0][i] = src[2 * i];
+        dst[1][i] = src[2 * i + 1];
+    }
+}
+
+/** @internal @This deinterleaves packed 32-bit samples.
+ *
+ * @param dst planar samples
+ * @param src interleaved samples
+ * @param samples number of samples
+ * @param channels number of channels
+ */
+__attribute__((target("sse2")))
+static void usound_deinterleave_32_sse2(int32_t *const *dst,
+        const int32_t *src, size_t samples, uint8_t channels)
+{
+    if (channels != 2) {
+        usound_deinterleave_32_c(dst, src, samples, channels);
+        return;
+    }
+
+    size_t i;
+    for (i = 0; i + 4 <= samples; i += 4) {
+        __m128 a = _mm_castsi128_ps(
+                _mm_loadu_si128((const __m128i *)(src + 2 * i)));
+        __m128 b = _mm_castsi128_ps(
+                _mm_loadu_si128((const __m128i *)(src + 2 * i + 4)));
+        _mm_storeu_si128((__m128i *)(dst[0] + i), _mm_castps_si128(
+                    _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0))));
+        _mm_storeu_si128((__m128i *)(dst[1] + i), _mm_castps_si128(
+                    _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1))));
+    }
+    for ( ; i < samples; i++) {
+        dst[0][i] = src[2 * i];
+        dst[1][i] = src[2 * i + 1];
+    }
+}
+
+/** @internal @This converts s16 values to f32.
+ *
+ * @param dst converted values
+ * @param src values to convert
+ * @param values number of values
+ */
+__attribute__((target("sse2")))
+static void usound_s16_to_flt_sse2(float *dst, const int16_t *src,
+                                   size_t values)
+{
+    const __m128 scale = _mm_set1_ps(1.f / 32768.f);
+    size_t i;
+    for (i = 0; i + 8 <= values; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+        _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+        _mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+    }
+    usound_s16_to_flt_c(dst + i, src + i, values - i);
+}
+
+/** @internal @This converts f32 values to s16.
+ *
+ * @param dst converted values
+ * @param src values to convert
+ * @param values number of values
+ */
+__attribute__((target("sse2")))
+static void usound_flt_to_s16_sse2(int16_t *dst, const float *src,
+                                   size_t values)
+{
+    const __m128 scale = _mm_set1_ps(32768.f);
+    const __m128 max = _mm_set1_ps(32767.f);
+    const __m128 min = _mm_set1_ps(-32768.f);
+    size_t i;
+    for (i = 0; i + 8 <= values; i += 8) {
+        __m128 a = _mm_mul_ps(_mm_loadu_ps(src + i), scale);
+        __m128 b = _mm_mul_ps(_mm_loadu_ps(src + i + 4), scale);
+        a = _mm_max_ps(_mm_min_ps(a, max), min);
+        b = _mm_max_ps(_mm_min_ps(b, max), min);
+        _mm_storeu_si128((__m128i *)(dst + i),
+                _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b)));
+    }
+    usound_flt_to_s16_c(dst + i, src + i, values - i);
+}
+
+/** @internal @This converts s32 values to f32.
+ *
+ * @param dst converted values
+ * @param src values to convert
+ * @param values number of values
+ */
+__attribute__((target("sse2")))
+static void usound_s32_to_flt_sse2(float *dst, const int32_t *src,
+                                   size_t values)
+{
+    const __m128 scale = _mm_set1_ps(1.f / 2147483648.f);
+    size_t i;
+    for (i = 0; i + 4 <= values; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(v), scale));
+    }
+    usound_s32_to_flt_c(dst + i, src + i, values - i);
+}
+
+/** @internal @This converts f32 values to s32.
+ *
+ * @param dst converted values
+ * @param src values to convert
+ * @param values number of values
+ */
+__attribute__((target("sse2")))
+static void usound_flt_to_s32_sse2(int32_t *dst, const float *src,
+                                   size_t values)
+{
+    const __m128 scale = _mm_set1_ps(2147483648.f);
+    const __m128 max = _mm_set1_ps(USOUND_FLT_S32_MAX);
+    const __m128 min = _mm_set1_ps(USOUND_FLT_S32_MIN);
+    size_t i;
+    for (i = 0; i + 4 <= values; i += 4) {
+        __m128 v = _mm_mul_ps(_mm_loadu_ps(src + i), scale);
+        v = _mm_max_ps(_mm_min_ps(v, max), min);
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_cvtps_epi32(v));
+    }
+    usound_flt_to_s32_c(dst + i, src + i, values - i);
+}
+
+/*
+ * AVX2 versions
+ */
+
+/** @internal @This returns the maximum absolute value of s16 samples.
+ *
+ * @param src samples
+ * @param samples number of samples
+ * @return maximum absolute value
+ */
+__attribute__((target("avx2")))
+static uint32_t usound_peak_s16_avx2(const int16_t *src, size_t samples)
+{
+    __m256i max = _mm256_setzero_si256(), min = _mm256_setzero_si256();
+    size_t i;
+    for (i = 0; i + 16 <= samples; i += 16) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+        max = _mm256_max_epi16(max, v);
+        min = _mm256_min_epi16(min, v);
+    }
+
+    int16_t maxs[16], mins[16];
+    _mm256_storeu_si256((__m256i *)maxs, max);
+    _mm256_storeu_si256((__m256i *)mins, min);
+    int32_t max_value = 0, min_value = 0;
+    for (int j = 0; j < 16; j++) {
+        if (maxs[j] > max_value)
+            max_value = maxs[j];
+        if (mins[j] < min_value)
+            min_value = mins[j];
+    }
+    for ( ; i < samples; i++) {
+        if (src[i] > max_value)
+            max_value = src[i];
+        else if (src[i] < min_value)
+            min_value = src[i];
+    }
+    return max_value > -min_value ? max_value : -min_value;
+}
+
+/** @internal @This returns the maximum absolute value of s32 samples.
+ *
+ * @param src samples
+ * @param samples number of samples
+ * @return maximum absolute value
+ */
+__attribute__((target("avx2")))
+static uint32_t usound_peak_s32_avx2(const int32_t *src, size_t samples)
+{
+    __m256i max = _mm256_setzero_si256(), min = _mm256_setzero_si256();
+    size_t i;
+    for (i = 0; i + 8 <= samples; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+        max = _mm256_max_epi32(max, v);
+        min = _mm256_min_epi32(min, v);
+    }
+
+    int32_t maxs[8], mins[8];
+    _mm256_storeu_si256((__m256i *)maxs, max);
+    _mm256_storeu_si256((__m256i *)mins, min);
+    int64_t max_value = 0, min_value = 0;
+    for (int j = 0; j < 8; j++) {
+        if (maxs[j] > max_value)
+            max_value = maxs[j];
+        if (mins[j] < min_value)
+            min_value = mins[j];
+    }
+    for ( ; i < samples; i++) {
+        if (src[i] > max_value)
+            max_value = src[i];
+        else if (src[i] < min_value)
+            min_value = src[i];
+    }
+    return max_value > -min_value ? max_value : -min_value;
+}
+
+/** @internal @This returns the maximum absolute value of f32 samples.
+ *
+ * @param src samples
+ * @param samples number of samples
+ * @return maximum absolute value
+ */
+__attribute__((target("avx2")))
+static float usound_peak_flt_avx2(const float *src, size_t samples)
+{
+    const __m256 mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    __m256 max = _mm256_setzero_ps();
+    size_t i;
+    for (i = 0; i + 8 <= samples; i += 8) {
+        __m256 v = _mm256_and_ps(_mm256_loadu_ps(src + i), mask);
+        /* the second operand is returned if the first one is a NaN */
+        max = _mm256_max_ps(v, max);
+    }
+
+    float maxs[8];
+    _mm256_storeu_ps(maxs, max);
+    float max_value = 0.;
+    for (int j = 0; j < 8; j++)
+        if (maxs[j] > max_value)
+            max_value = maxs[j];
+    for ( ; i < samples; i++) {
+        float c = fabsf(src[i]);
+        if (c > max_value)
+            max_value = c;
+    }
+    return max_value;
+}
+
+/** @internal @This adds src to dst with a linear gain ramp.
+ *
+ * @param dst samples to add to
+ * @param src samples to add
+ * @param samples number of samples
+ * @param channels number of channels in a sample
+ * @param gain gain of the first sample
+ * @param step gain increment between samples
+ */
+__attribute__((target("avx2")))
+static void usound_mix_flt_avx2(float *dst, const float *src, size_t samples,
+                                uint8_t channels, float gain, float step)
+{
+    if (channels != 1) {
+        usound_mix_flt_c(dst, src, samples, channels, gain, step);
+        return;
+    }
+
+    const __m256 gains = _mm256_set1_ps(gain);
+    const __m256 steps = _mm256_set1_ps(step);
+    __m256i index = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i eight = _mm256_set1_epi32(8);
+    size_t i;
+    for (i = 0; i + 8 <= samples; i += 8) {
+        __m256 g = _mm256_add_ps(
+                _mm256_mul_ps(_mm256_cvtepi32_ps(index), steps), gains);
+        __m256 v = _mm256_mul_ps(_mm256_loadu_ps(src + i), g);
+        _mm256_storeu_ps(dst + i, _mm256_add_ps(_mm256_loadu_ps(dst + i), v));
+        index = _mm256_add_epi32(index, eight);
+    }
+    for ( ; i < samples; i++)
+        dst[i] += src[i] * ((float)i * step + gain);
+}
+
+/** @internal @This converts s16 values to f32.
+ *
+ * @param dst converted values
+ * @param src values to convert
+ * @param values number of values
+ */
+__attribute__((target("avx2")))
+static void usound_s16_to_flt_avx2(float *dst, const int16_t *src,
+                                   size_t values)
+{
+    const __m256 scale = _mm256_set1_ps(1.f / 32768.f);
+    size_t i;
+    for (i = 0; i + 8 <= values; i += 8) {
+        __m256i v = _mm256_cvtepi16_epi32(
+                _mm_loadu_si128((const __m128i *)(src + i)));
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+    }
+    usound_s16_to_flt_c(dst + i, src + i, values - i);
+}
+
+/** @internal @This converts f32 values to s16.
+ *
+ * @param dst converted values
+ * @param src values to convert
+ * @param values number of values
+ */
+__attribute__((target("avx2")))
+static void usound_flt_to_s16_avx2(int16_t *dst, const float *src,
+                                   size_t values)
+{
+    const __m256 scale = _mm256_set1_ps(32768.f);
+    const __m256 max = _mm256_set1_ps(32767.f);
+    const __m256 min = _mm256_set1_ps(-32768.f);
+    size_t i;
+    for (i = 0; i + 16 <= values; i += 16) {
+        __m256 a = _mm256_mul_ps(_mm256_loadu_ps(src + i), scale);
+        __m256 b = _mm256_mul_ps(_mm256_loadu_ps(src + i + 8), scale);
+        a = _mm256_max_ps(_mm256_min_ps(a, max), min);
+        b = _mm256_max_ps(_mm256_min_ps(b, max), min);
+        /* packs works within 128-bit lanes, so reorder the quadwords */
+        __m256i v = _mm256_packs_epi32(_mm256_cvtps_epi32(a),
+                                       _mm256_cvtps_epi32(b));
+        v = _mm256_permute4x64_epi64(v, _MM_SHUFFLE(3, 1, 2, 0));
+        _mm256_storeu_si256((__m256i *)(dst + i), v);
+    }
+    usound_flt_to_s16_c(dst + i, src + i, values - i);
+}
+
+/** @internal @This converts s32 values to f32.
+ *
+ * @param dst converted values
+ * @param src values to convert
+ * @param values number of values
+ */
+__attribute__((target("avx2")))
+static void usound_s32_to_flt_avx2(float *dst, const int32_t *src,
+                                   size_t values)
+{
+    const __m256 scale = _mm256_set1_ps(1.f / 2147483648.f);
+    size_t i;
+    for (i = 0; i + 8 <= values; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+    }
+    usound_s32_to_flt_c(dst + i, src + i, values - i);
+}
+
+/** @internal @This converts f32 values to s32.
+ *
+ * @param dst converted values
+ * @param src values to convert
+ * @param values number of values
+ */
+__attribute__((target("avx2")))
+static void usound_flt_to_s32_avx2(int32_t *dst, const float *src,
+                                   size_t values)
+{
+    const __m256 scale = _mm256_set1_ps(2147483648.f);
+    const __m256 max = _mm256_set1_ps(USOUND_FLT_S32_MAX);
+    const __m256 min = _mm256_set1_ps(USOUND_FLT_S32_MIN);
+    size_t i;
+    for (i = 0; i + 8 <= values; i += 8) {
+        __m256 v = _mm256_mul_ps(_mm256_loadu_ps(src + i), scale);
+        v = _mm256_max_ps(_mm256_min_ps(v, max), min);
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_cvtps_epi32(v));
+    }
+    usound_flt_to_s32_c(dst + i, src + i, values - i);
+}
+#endif
+
+/** @This initializes the kernels using the given CPU features. Features
+ * that the CPU or compiler don't support must not be passed.
+ *
+ * @param dsp table of kernels to fill in
+ * @param cpu bitmask of allowed CPU features (@ref usound_cpu)
+ */
+void usound_dsp_init_cpu(struct usound_dsp *dsp, unsigned int cpu)
+{
+    dsp->peak_s16 = usound_peak_s16_c;
+    dsp->peak_s32 = usound_peak_s32_c;
+    dsp->peak_flt = usound_peak_flt_c;
+    dsp->mix_flt = usound_mix_flt_c;
+    dsp->interleave_16 = usound_interleave_16_c;
+    dsp->interleave_32 = usound_interleave_32_c;
+    dsp->deinterleave_16 = usound_deinterleave_16_c;
+    dsp->deinterleave_32 = usound_deinterleave_32_c;
+    dsp->s16_to_flt = usound_s16_to_flt_c;
+    dsp->flt_to_s16 = usound_flt_to_s16_c;
+    dsp->s32_to_flt = usound_s32_to_flt_c;
+    dsp->flt_to_s32 = usound_flt_to_s32_c;
+
+#ifdef USOUND_X86
+    if (cpu & USOUND_CPU_SSE2) {
+        dsp->peak_s16 = usound_peak_s16_sse2;
+        dsp->peak_flt = usound_peak_flt_sse2;
+        dsp->mix_flt = usound_mix_flt_sse2;
+        dsp->interleave_16 = usound_interleave_16_sse2;
+        dsp->interleave_32 = usound_interleave_32_sse2;
+        dsp->deinterleave_16 = usound_deinterleave_16_sse2;
+        dsp->deinterleave_32 = usound_deinterleave_32_sse2;
+        dsp->s16_to_flt = usound_s16_to_flt_sse2;
+        dsp->flt_to_s16 = usound_flt_to_s16_sse2;
+        dsp->s32_to_flt = usound_s32_to_flt_sse2;
+        dsp->flt_to_s32 = usound_flt_to_s32_sse2;
+    }
+    if (cpu & USOUND_CPU_AVX2) {
+        dsp->peak_s16 = usound_peak_s16_avx2;
+        dsp->peak_s32 = usound_peak_s32_avx2;
+        dsp->peak_flt = usound_peak_flt_avx2;
+        dsp->mix_flt = usound_mix_flt_avx2;
+        dsp->s16_to_flt = usound_s16_to_flt_avx2;
+        dsp->flt_to_s16 = usound_flt_to_s16_avx2;
+        dsp->s32_to_flt = usound_s32_to_flt_avx2;
+        dsp->flt_to_s32 = usound_flt_to_s32_avx2;
+    }
+#endif
+}
+
+/** @This returns the CPU features that the kernels may use on the running
+ * CPU.
+ *
+ * @return bitmask of CPU features (@ref usound_cpu)
+ */
+unsigned int usound_dsp_cpu(void)
+{
+    unsigned int cpu = 0;
+#ifdef USOUND_X86
+    if (__builtin_cpu_supports("sse2"))
+        cpu |= USOUND_CPU_SSE2;
+    if (__builtin_cpu_supports("avx2"))
+        cpu |= USOUND_CPU_AVX2;
+#endif
+    return cpu;
+}
+
+/** @This initializes the kernels with the best versions available on the
+ * running CPU.
+ *
+ * @param dsp table of kernels to fill in
+ */
+void usound_dsp_init(struct usound_dsp *dsp)
+{
+    usound_dsp_init_cpu(dsp, usound_dsp_cpu());
+}
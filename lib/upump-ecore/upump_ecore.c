@@ -181,6 +181,12 @@ static struct upump *upump_ecore_alloc(struct upump_mgr *mgr,
             upump_ecore->repeated = false;
             break;
         }
+        case UPUMP_TYPE_WHEEL_TIMER: {
+            uint64_t after = va_arg(args, uint64_t);
+            uint64_t repeat = va_arg(args, uint64_t);
+            upump_common_wheel_set(upump, after, repeat);
+            break;
+        }
         case UPUMP_TYPE_FD_READ: {
             int fd = va_arg(args, int);
             upump_ecore->io = ecore_main_fd_handler_add(fd, ECORE_FD_READ,
@@ -210,6 +216,27 @@ static struct upump *upump_ecore_alloc(struct upump_mgr *mgr,
     return upump;
 }
 
+/** @This turns a pump of type @ref UPUMP_TYPE_WHEEL_TIMER into a plain
+ * timer, when the timer wheel cannot be driven.
+ *
+ * @param upump description structure of the pump
+ * @return an error code
+ */
+static int upump_ecore_wheel_fallback(struct upump *upump)
+{
+    struct upump_ecore *upump_ecore = upump_ecore_from_upump(upump);
+    struct upump_common *common = upump_common_from_upump(upump);
+    upump_ecore->timer = ecore_timer_add(
+            (double)(common->wheel_after * UPUMP_WHEEL_TICK) / UCLOCK_FREQ,
+            upump_ecore_dispatch_timer, upump_ecore);
+    UBASE_ALLOC_RETURN(upump_ecore->timer);
+    ecore_timer_freeze(upump_ecore->timer);
+    upump_ecore->repeat = common->wheel_repeat * UPUMP_WHEEL_TICK;
+    upump_ecore->repeated = false;
+    upump_ecore->event = UPUMP_TYPE_TIMER;
+    return UBASE_ERR_NONE;
+}
+
 /** @This starts a pump.
  *
  * @param upump description structure of the pump
@@ -221,6 +248,13 @@ static void upump_ecore_real_start(struct upump *upump, bool status)
     struct upump_ecore_mgr *ecore_mgr =
         upump_ecore_mgr_from_upump_mgr(upump->mgr);
 
+    if (upump_ecore->event == UPUMP_TYPE_WHEEL_TIMER) {
+        /* the pump driving the wheel holds the loop */
+        if (likely(ubase_check(upump_common_wheel_start(upump, status))) ||
+            unlikely(!ubase_check(upump_ecore_wheel_fallback(upump))))
+            return;
+    }
+
     switch (upump_ecore->event) {
         case UPUMP_TYPE_IDLER:
             upump_ecore->idle = ecore_idler_add(upump_ecore_dispatch_idle,
@@ -262,6 +296,12 @@ static void upump_ecore_real_restart(struct upump *upump, bool status)
         case UPUMP_TYPE_TIMER:
             ecore_timer_reset(upump_ecore->timer);
             break;
+        case UPUMP_TYPE_WHEEL_TIMER:
+            if (unlikely(!ubase_check(upump_common_wheel_restart(upump,
+                                                                 status))) &&
+                ubase_check(upump_ecore_wheel_fallback(upump)))
+                upump_ecore_real_start(upump, status);
+            break;
         default:
             break;
     }
@@ -279,6 +319,9 @@ static void upump_ecore_real_stop(struct upump *upump, bool status)
         upump_ecore_mgr_from_upump_mgr(upump->mgr);
 
     switch (upump_ecore->event) {
+        case UPUMP_TYPE_WHEEL_TIMER:
+            upump_common_wheel_stop(upump, status);
+            return;
         case UPUMP_TYPE_IDLER:
             if (upump_ecore->idle) {
                 ecore_idler_del(upump_ecore->idle);
@@ -302,6 +345,35 @@ static void upump_ecore_real_stop(struct upump *upump, bool status)
     }
 }
 
+/** @This changes the timeout of a timer pump, and starts it.
+ *
+ * @param upump description structure of the pump
+ * @param after time after which it triggers, in 27 MHz ticks
+ * @param repeat repeat interval, in 27 MHz ticks, or 0
+ * @return an error code
+ */
+static int upump_ecore_rearm(struct upump *upump, uint64_t after,
+                             uint64_t repeat)
+{
+    struct upump_ecore *upump_ecore = upump_ecore_from_upump(upump);
+    if (upump_ecore->event != UPUMP_TYPE_TIMER &&
+        upump_ecore->event != UPUMP_TYPE_WHEEL_TIMER)
+        return UBASE_ERR_INVALID;
+
+    if (upump_common_from_upump(upump)->started)
+        upump_common_stop(upump);
+    if (upump_ecore->event == UPUMP_TYPE_TIMER) {
+        ecore_timer_interval_set(upump_ecore->timer,
+                                 (double) after / UCLOCK_FREQ);
+        ecore_timer_reset(upump_ecore->timer);
+        upump_ecore->repeat = repeat;
+        upump_ecore->repeated = false;
+    } else
+        upump_common_wheel_set(upump, after, repeat);
+    upump_common_start(upump);
+    return UBASE_ERR_NONE;
+}
+
 /** @This released the memory space previously used by a pump.
  * Please note that the pump must be stopped before.
  *
@@ -360,6 +432,11 @@ static int upump_ecore_control(struct upump *upump, int command, va_list args)
         case UPUMP_RESTART:
             upump_common_restart(upump);
             return UBASE_ERR_NONE;
+        case UPUMP_REARM: {
+            uint64_t after = va_arg(args, uint64_t);
+            uint64_t repeat = va_arg(args, uint64_t);
+            return upump_ecore_rearm(upump, after, repeat);
+        }
         case UPUMP_STOP:
             upump_common_stop(upump);
             return UBASE_ERR_NONE;
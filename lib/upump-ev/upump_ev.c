@@ -72,6 +72,7 @@ struct upump_ev {
         struct ev_timer ev_timer;
         struct ev_idle ev_idle;
         struct ev_signal ev_signal;
+        struct ev_check ev_check;
     };
 
     /** common structure */
@@ -138,6 +139,21 @@ static void upump_ev_dispatch_signal(struct ev_loop *ev_loop,
     upump_common_dispatch(upump);
 }
 
+/** @This dispatches an event to a pump for type ev_check.
+ *
+ * @param ev_loop current event loop (unused parameter)
+ * @param ev_check ev pump
+ * @param revents events triggered (unused parameter)
+ */
+static void upump_ev_dispatch_check(struct ev_loop *ev_loop,
+                                    struct ev_check *ev_check, int revents)
+{
+    struct upump_ev *upump_ev = container_of(ev_check, struct upump_ev,
+                                             ev_check);
+    struct upump *upump = upump_ev_to_upump(upump_ev);
+    upump_common_dispatch(upump);
+}
+
 /** @This allocates a new upump_ev.
  *
  * @param mgr pointer to a upump_mgr structure wrapped into a
@@ -184,6 +200,18 @@ static struct upump *upump_ev_alloc(struct upump_mgr *mgr,
                            signal);
             break;
         }
+        case UPUMP_TYPE_WHEEL_TIMER: {
+            uint64_t after = va_arg(args, uint64_t);
+            uint64_t repeat = va_arg(args, uint64_t);
+            upump_common_wheel_set(upump, after, repeat);
+            break;
+        }
+        case UPUMP_TYPE_ITERATION:
+            /* check watchers are queued after the events gathered by the
+             * loop, make sure they are invoked first */
+            ev_check_init(&upump_ev->ev_check, upump_ev_dispatch_check);
+            ev_set_priority(&upump_ev->ev_check, EV_MAXPRI);
+            break;
         default:
             free(upump_ev);
             return NULL;
@@ -195,6 +223,23 @@ static struct upump *upump_ev_alloc(struct upump_mgr *mgr,
     return upump;
 }
 
+/** @This turns a pump of type @ref UPUMP_TYPE_WHEEL_TIMER into a plain
+ * timer, when the timer wheel cannot be driven.
+ *
+ * @param upump description structure of the pump
+ */
+static void upump_ev_wheel_fallback(struct upump *upump)
+{
+    struct upump_ev *upump_ev = upump_ev_from_upump(upump);
+    struct upump_common *common = upump_common_from_upump(upump);
+    ev_timer_init(&upump_ev->ev_timer, upump_ev_dispatch_timer,
+                  (ev_tstamp)(common->wheel_after * UPUMP_WHEEL_TICK) /
+                  UCLOCK_FREQ,
+                  (ev_tstamp)(common->wheel_repeat * UPUMP_WHEEL_TICK) /
+                  UCLOCK_FREQ);
+    upump_ev->event = UPUMP_TYPE_TIMER;
+}
+
 /** @This starts a pump.
  *
  * @param upump description structure of the pump
@@ -205,6 +250,13 @@ static void upump_ev_real_start(struct upump *upump, bool status)
     struct upump_ev *upump_ev = upump_ev_from_upump(upump);
     struct upump_ev_mgr *ev_mgr = upump_ev_mgr_from_upump_mgr(upump->mgr);
 
+    if (upump_ev->event == UPUMP_TYPE_WHEEL_TIMER) {
+        /* the pump driving the wheel holds the loop */
+        if (likely(ubase_check(upump_common_wheel_start(upump, status))))
+            return;
+        upump_ev_wheel_fallback(upump);
+    }
+
     switch (upump_ev->event) {
         case UPUMP_TYPE_IDLER:
             ev_idle_start(ev_mgr->ev_loop, &upump_ev->ev_idle);
@@ -219,6 +271,9 @@ static void upump_ev_real_start(struct upump *upump, bool status)
         case UPUMP_TYPE_SIGNAL:
             ev_signal_start(ev_mgr->ev_loop, &upump_ev->ev_signal);
             break;
+        case UPUMP_TYPE_ITERATION:
+            ev_check_start(ev_mgr->ev_loop, &upump_ev->ev_check);
+            break;
         default:
             break;
     }
@@ -236,6 +291,11 @@ static void upump_ev_real_stop(struct upump *upump, bool status)
     struct upump_ev *upump_ev = upump_ev_from_upump(upump);
     struct upump_ev_mgr *ev_mgr = upump_ev_mgr_from_upump_mgr(upump->mgr);
 
+    if (upump_ev->event == UPUMP_TYPE_WHEEL_TIMER) {
+        upump_common_wheel_stop(upump, status);
+        return;
+    }
+
     if (!status)
         ev_ref(ev_mgr->ev_loop);
     switch (upump_ev->event) {
@@ -252,6 +312,9 @@ static void upump_ev_real_stop(struct upump *upump, bool status)
         case UPUMP_TYPE_SIGNAL:
             ev_signal_stop(ev_mgr->ev_loop, &upump_ev->ev_signal);
             break;
+        case UPUMP_TYPE_ITERATION:
+            ev_check_stop(ev_mgr->ev_loop, &upump_ev->ev_check);
+            break;
         default:
             break;
     }
@@ -267,6 +330,12 @@ static void upump_ev_real_restart(struct upump *upump, bool status)
     struct upump_ev *upump_ev = upump_ev_from_upump(upump);
     struct upump_ev_mgr *ev_mgr = upump_ev_mgr_from_upump_mgr(upump->mgr);
 
+    if (upump_ev->event == UPUMP_TYPE_WHEEL_TIMER) {
+        if (likely(ubase_check(upump_common_wheel_restart(upump, status))))
+            return;
+        upump_ev_wheel_fallback(upump);
+    }
+
     switch (upump_ev->event) {
         case UPUMP_TYPE_TIMER: {
             bool active = ev_is_active(&upump_ev->ev_timer);
@@ -280,6 +349,32 @@ static void upump_ev_real_restart(struct upump *upump, bool status)
     }
 }
 
+/** @This changes the timeout of a timer pump, and starts it.
+ *
+ * @param upump description structure of the pump
+ * @param after time after which it triggers, in 27 MHz ticks
+ * @param repeat repeat interval, in 27 MHz ticks, or 0
+ * @return an error code
+ */
+static int upump_ev_rearm(struct upump *upump, uint64_t after,
+                          uint64_t repeat)
+{
+    struct upump_ev *upump_ev = upump_ev_from_upump(upump);
+    if (upump_ev->event != UPUMP_TYPE_TIMER &&
+        upump_ev->event != UPUMP_TYPE_WHEEL_TIMER)
+        return UBASE_ERR_INVALID;
+
+    if (upump_common_from_upump(upump)->started)
+        upump_common_stop(upump);
+    if (upump_ev->event == UPUMP_TYPE_TIMER)
+        ev_timer_set(&upump_ev->ev_timer, (ev_tstamp)after / UCLOCK_FREQ,
+                     (ev_tstamp)repeat / UCLOCK_FREQ);
+    else
+        upump_common_wheel_set(upump, after, repeat);
+    upump_common_start(upump);
+    return UBASE_ERR_NONE;
+}
+
 /** @This released the memory space previously used by a pump.
  * Please note that the pump must be stopped before.
  *
@@ -337,6 +432,11 @@ static int upump_ev_control(struct upump *upump, int command, va_list args)
         case UPUMP_RESTART:
             upump_common_restart(upump);
             return UBASE_ERR_NONE;
+        case UPUMP_REARM: {
+            uint64_t after = va_arg(args, uint64_t);
+            uint64_t repeat = va_arg(args, uint64_t);
+            return upump_ev_rearm(upump, after, repeat);
+        }
         case UPUMP_STOP:
             upump_common_stop(upump);
             return UBASE_ERR_NONE;
@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2017 OpenHeadend S.A.R.L.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** @file
+ * @short pipeline throughput benchmarks - AES decryption
+ */
+
+#undef NDEBUG
+
+#include <upipe/ubase.h>
+#include <upipe/uprobe.h>
+#include <upipe/uprobe_prefix.h>
+#include <upipe/ubuf.h>
+#include <upipe/ubuf_block_mem.h>
+#include <upipe/uref.h>
+#include <upipe/uref_block.h>
+#include <upipe/uref_block_flow.h>
+#include <upipe/upipe.h>
+#include <upipe-modules/upipe_aes_decrypt.h>
+#include <upipe-modules/uref_aes_flow.h>
+
+#include "bench.h"
+
+#include <string.h>
+#include <assert.h>
+
+#define UPROBE_LOG_LEVEL UPROBE_LOG_VERBOSE
+/** size of the chunks of an HLS segment received from an HTTP source */
+#define CHUNK_SIZE 4096
+
+/** @internal @This decrypts chunks of an AES-128 encrypted HLS segment.
+ *
+ * @param bench benchmark context
+ * @param aesni true to use AES-NI instructions
+ */
+static void bench_aes_decrypt_mode(struct bench *bench, bool aesni)
+{
+    static const uint8_t key[16] = { 0 };
+    static const uint8_t iv[16] = { 0 };
+
+    struct ubuf_mgr *block_mgr = ubuf_block_mem_mgr_alloc(BENCH_POOL_DEPTH,
+            BENCH_POOL_DEPTH, bench->umem_mgr, 0, 0, -1, 0);
+    assert(block_mgr != NULL);
+
+    struct uref *flow_def = uref_block_flow_alloc_def(bench->uref_mgr,
+                                                      "aes.");
+    assert(flow_def != NULL);
+    ubase_assert(uref_aes_set_method(flow_def, "AES-128"));
+    ubase_assert(uref_aes_set_key(flow_def, key, sizeof(key)));
+    ubase_assert(uref_aes_set_iv(flow_def, iv, sizeof(iv)));
+
+    struct upipe_mgr *upipe_aes_decrypt_mgr = upipe_aes_decrypt_mgr_alloc();
+    assert(upipe_aes_decrypt_mgr != NULL);
+    struct upipe *aes = upipe_void_alloc(upipe_aes_decrypt_mgr,
+            uprobe_pfx_alloc(uprobe_use(bench->uprobe), UPROBE_LOG_LEVEL,
+                             "aes"));
+    assert(aes != NULL);
+    upipe_mgr_release(upipe_aes_decrypt_mgr);
+    if (!ubase_check(upipe_aes_decrypt_set_aesni(aes, aesni))) {
+        uprobe_warn(bench->uprobe, NULL, "AES-NI is not supported");
+        upipe_release(aes);
+        uref_free(flow_def);
+        ubuf_mgr_release(block_mgr);
+        return;
+    }
+    ubase_assert(upipe_set_flow_def(aes, flow_def));
+    uref_free(flow_def);
+
+    struct upipe *sink = bench_sink_alloc(
+            uprobe_pfx_alloc(uprobe_use(bench->uprobe), UPROBE_LOG_LEVEL,
+                             "sink"));
+    ubase_assert(upipe_set_output(aes, sink));
+
+    /* the content doesn't matter to the cipher */
+    uint8_t chunk[CHUNK_SIZE];
+    for (unsigned int i = 0; i < CHUNK_SIZE; i++)
+        chunk[i] = i * 7;
+
+    bench_sink_reset(sink);
+    bench_start(bench);
+    while (bench_running(bench)) {
+        struct uref *uref = uref_block_alloc(bench->uref_mgr, block_mgr,
+                                             CHUNK_SIZE);
+        assert(uref != NULL);
+        int size = CHUNK_SIZE;
+        uint8_t *buffer;
+        ubase_assert(uref_block_write(uref, 0, &size, &buffer));
+        memcpy(buffer, chunk, size);
+        ubase_assert(uref_block_unmap(uref, 0));
+        upipe_input(aes, uref, NULL);
+        bench->urefs++;
+    }
+    bench->packets = bench_sink_octets(sink) / CHUNK_SIZE;
+    bench_stop(bench);
+
+    upipe_release(aes);
+    upipe_release(sink);
+    ubuf_mgr_release(block_mgr);
+}
+
+/** @This decrypts chunks of an HLS segment with the portable
+ * implementation.
+ *
+ * @param bench benchmark context
+ */
+void bench_aes_decrypt(struct bench *bench)
+{
+    bench_aes_decrypt_mode(bench, false);
+}
+
+/** @This decrypts chunks of an HLS segment with AES-NI instructions.
+ *
+ * @param bench benchmark context
+ */
+void bench_aes_decrypt_aesni(struct bench *bench)
+{
+    bench_aes_decrypt_mode(bench, true);
+}
@@ -0,0 +1,606 @@
+/*
+ * Copyright (C) 2017 OpenHeadend S.A.R.L.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** @file
+ * @short pipeline throughput benchmarks - harness
+ */
+
+#undef NDEBUG
+
+#include <upipe/ubase.h>
+#include <upipe/uatomic.h>
+#include <upipe/urefcount.h>
+#include <upipe/uprobe.h>
+#include <upipe/uprobe_stdio.h>
+#include <upipe/uprobe_uref_mgr.h>
+#include <upipe/uprobe_ubuf_mem.h>
+#include <upipe/umem.h>
+#include <upipe/umem_pool.h>
+#include <upipe/udict.h>
+#include <upipe/udict_inline.h>
+#include <upipe/uref.h>
+#include <upipe/uref_std.h>
+#include <upipe/uref_block.h>
+#include <upipe/upipe.h>
+
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <assert.h>
+
+/** default minimum duration of each benchmark, in milliseconds */
+#define DEFAULT_DURATION 1000
+/** number of calls to @ref bench_running between two clock checks */
+#define CHECK_PERIOD 16
+/** depth of the buffer pools of the memory allocator */
+#define UMEM_POOL 512
+
+/** list of benchmarks */
+static const struct {
+    const char *name;
+    void (*func)(struct bench *);
+} benches[] = {
+    { "blit", bench_blit },
+    { "audiocont", bench_audiocont },
+    { "grid_4x4", bench_grid_4x4 },
+    { "grid_16x16", bench_grid_16x16 },
+    { "aes_decrypt", bench_aes_decrypt },
+    { "aes_decrypt_aesni", bench_aes_decrypt_aesni },
+    { "dup_1", bench_dup_1 },
+    { "dup_2", bench_dup_2 },
+    { "dup_8", bench_dup_8 },
+    { "dup_8_shared", bench_dup_8_shared },
+#ifdef HAVE_TS
+    { "ts_mux", bench_ts_mux },
+    { "ts_demux", bench_ts_demux },
+    { "ts_mux_80m", bench_ts_mux_80m },
+    { "ts_mux_80m_contiguous", bench_ts_mux_80m_contiguous },
+    { "h264f", bench_h264f },
+    { "pesd_h264f", bench_pesd_h264f },
+    { "pesd_h264f_contiguous", bench_pesd_h264f_contiguous },
+#endif
+#ifdef HAVE_EV
+    { "timers_realloc", bench_timers_realloc },
+    { "timers_rearm", bench_timers_rearm },
+    { "timers_wheel", bench_timers_wheel },
+    { "clock_std", bench_clock_std },
+    { "clock_coarse", bench_clock_coarse },
+    { "clock_tsc", bench_clock_tsc },
+    { "clock_cached", bench_clock_cached },
+#endif
+#ifdef HAVE_XFER
+    { "xfer", bench_xfer },
+    { "xfer_pinned", bench_xfer_pinned },
+#endif
+    { NULL, NULL }
+};
+
+/*
+ * Allocation counter
+ *
+ * The glibc allocator may be wrapped by the program, and exports its real
+ * entry points, so we interpose the allocation functions to count the calls
+ * made by the pipes. Other C libraries don't report allocations.
+ */
+
+/** number of calls to the allocation functions */
+static uatomic_uint32_t allocs;
+/** incremented when the measurement starts, to reset the sink pipes */
+static uatomic_uint32_t epoch;
+
+#ifdef __GLIBC__
+/** allocations are counted */
+static const bool allocs_available = true;
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+
+void *malloc(size_t size)
+{
+    uatomic_fetch_add(&allocs, 1);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    uatomic_fetch_add(&allocs, 1);
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    uatomic_fetch_add(&allocs, 1);
+    return __libc_realloc(ptr, size);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    if (!alignment || (alignment & (alignment - 1)) ||
+        alignment % sizeof(void *))
+        return EINVAL;
+    uatomic_fetch_add(&allocs, 1);
+    void *ptr = __libc_memalign(alignment, size);
+    if (ptr == NULL)
+        return ENOMEM;
+    *memptr = ptr;
+    return 0;
+}
+#else
+/** allocations are not counted */
+static const bool allocs_available = false;
+#endif
+
+/** @internal @This returns the value of the monotonic clock.
+ *
+ * @return date in nanoseconds
+ */
+static uint64_t bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+}
+
+/** @This starts the measurement.
+ *
+ * @param bench benchmark context
+ */
+void bench_start(struct bench *bench)
+{
+    assert(!bench->running);
+    bench->urefs = 0;
+    bench->packets = 0;
+    bench->warmup = BENCH_WARMUP;
+    bench->checks = 0;
+    bench->running = true;
+    bench->start = bench->end = bench_now();
+}
+
+/** @This returns true until the minimum duration of the measurement has
+ * elapsed.
+ *
+ * @param bench benchmark context
+ * @return false if the benchmark must stop feeding the pipeline
+ */
+bool bench_running(struct bench *bench)
+{
+    assert(bench->running);
+    if (bench->warmup) {
+        if (!--bench->warmup) {
+            /* the pools are filled, start the measurement */
+            uatomic_fetch_add(&epoch, 1);
+            bench->urefs = 0;
+            bench->packets = 0;
+            bench->allocs_start = uatomic_load(&allocs);
+            bench->start = bench->end = bench_now();
+        }
+        return true;
+    }
+    if (++bench->checks < CHECK_PERIOD)
+        return true;
+    bench->checks = 0;
+    return bench_now() - bench->start < bench->duration;
+}
+
+/** @This stops the measurement.
+ *
+ * @param bench benchmark context
+ */
+void bench_stop(struct bench *bench)
+{
+    assert(bench->running);
+    assert(!bench->warmup);
+    bench->end = bench_now();
+    bench->allocs = uatomic_load(&allocs) - bench->allocs_start;
+    bench->running = false;
+}
+
+/** @internal @This is the private context of a sink pipe. */
+struct bench_sink {
+    /** refcount management structure */
+    struct urefcount urefcount;
+    /** number of received urefs */
+    uint64_t urefs;
+    /** number of received octets */
+    uint64_t octets;
+    /** number of received block segments */
+    uint64_t segments;
+    /** value of the epoch when the counters were last reset */
+    uint32_t epoch;
+    /** list where received urefs are kept, or NULL to free them */
+    struct uchain *capture;
+    /** filled in with the number of received urefs when the pipe dies */
+    uint64_t *urefs_p;
+    /** public upipe structure */
+    struct upipe upipe;
+};
+
+UBASE_FROM_TO(bench_sink, upipe, upipe, upipe)
+UBASE_FROM_TO(bench_sink, urefcount, urefcount, urefcount)
+
+/** @internal @This resets the counters of a sink pipe if the measurement
+ * started since the last time. The sink may run in another thread, so it is
+ * done lazily by the sink itself.
+ *
+ * @param sink private context of the sink pipe
+ * @return private context of the sink pipe
+ */
+static struct bench_sink *bench_sink_sync(struct bench_sink *sink)
+{
+    uint32_t current = uatomic_load(&epoch);
+    if (unlikely(sink->epoch != current)) {
+        sink->epoch = current;
+        sink->urefs = 0;
+        sink->octets = 0;
+        sink->segments = 0;
+    }
+    return sink;
+}
+
+/** @internal @This frees a sink pipe.
+ *
+ * @param urefcount pointer to urefcount structure
+ */
+static void bench_sink_free(struct urefcount *urefcount)
+{
+    struct bench_sink *sink = bench_sink_sync(
+            bench_sink_from_urefcount(urefcount));
+    if (sink->urefs_p != NULL)
+        *sink->urefs_p = sink->urefs;
+    upipe_throw_dead(&sink->upipe);
+    upipe_clean(&sink->upipe);
+    urefcount_clean(&sink->urefcount);
+    free(sink);
+}
+
+/** @internal @This receives data.
+ *
+ * @param upipe description structure of the pipe
+ * @param uref uref structure
+ * @param upump_p reference to pump that generated the buffer
+ */
+static void bench_sink_input(struct upipe *upipe, struct uref *uref,
+                             struct upump **upump_p)
+{
+    struct bench_sink *sink = bench_sink_sync(bench_sink_from_upipe(upipe));
+    size_t size;
+    sink->urefs++;
+    if (ubase_check(uref_block_size(uref, &size))) {
+        sink->octets += size;
+        int segments = uref_block_iovec_count(uref, 0, -1);
+        if (segments > 0)
+            sink->segments += segments;
+    }
+    if (sink->capture != NULL)
+        ulist_add(sink->capture, uref_to_uchain(uref));
+    else
+        uref_free(uref);
+}
+
+/** @internal @This processes control commands.
+ *
+ * @param upipe description structure of the pipe
+ * @param command type of command to process
+ * @param args arguments of the command
+ * @return an error code
+ */
+static int bench_sink_control(struct upipe *upipe, int command, va_list args)
+{
+    switch (command) {
+        case UPIPE_ATTACH_UPUMP_MGR:
+        case UPIPE_ATTACH_UCLOCK:
+        case UPIPE_SET_FLOW_DEF:
+        case UPIPE_UNREGISTER_REQUEST:
+            return UBASE_ERR_NONE;
+        case UPIPE_REGISTER_REQUEST: {
+            struct urequest *urequest = va_arg(args, struct urequest *);
+            return upipe_throw_provide_request(upipe, urequest);
+        }
+        default:
+            return UBASE_ERR_UNHANDLED;
+    }
+}
+
+/** @internal @This is the management structure of sink pipes. */
+static struct upipe_mgr bench_sink_mgr = {
+    .refcount = NULL,
+    .signature = UBASE_FOURCC('b','n','c','h'),
+    .upipe_alloc = NULL,
+    .upipe_input = bench_sink_input,
+    .upipe_control = bench_sink_control,
+    .upipe_mgr_control = NULL
+};
+
+/** @This allocates a sink pipe counting the urefs it receives.
+ *
+ * @param uprobe structure used to raise events
+ * @return pointer to sink pipe
+ */
+struct upipe *bench_sink_alloc(struct uprobe *uprobe)
+{
+    struct bench_sink *sink = malloc(sizeof(struct bench_sink));
+    assert(sink != NULL);
+    upipe_init(&sink->upipe, &bench_sink_mgr, uprobe);
+    urefcount_init(&sink->urefcount, bench_sink_free);
+    sink->upipe.refcount = &sink->urefcount;
+    sink->urefs = 0;
+    sink->octets = 0;
+    sink->segments = 0;
+    sink->epoch = uatomic_load(&epoch);
+    sink->capture = NULL;
+    sink->urefs_p = NULL;
+    upipe_throw_ready(&sink->upipe);
+    return &sink->upipe;
+}
+
+/** @This returns the number of urefs received by a sink pipe.
+ *
+ * @param upipe description structure of the sink pipe
+ * @return number of urefs
+ */
+uint64_t bench_sink_urefs(struct upipe *upipe)
+{
+    return bench_sink_sync(bench_sink_from_upipe(upipe))->urefs;
+}
+
+/** @This returns the number of octets received by a sink pipe.
+ *
+ * @param upipe description structure of the sink pipe
+ * @return number of octets
+ */
+uint64_t bench_sink_octets(struct upipe *upipe)
+{
+    return bench_sink_sync(bench_sink_from_upipe(upipe))->octets;
+}
+
+/** @This resets the counters of a sink pipe.
+ *
+ * @param upipe description structure of the sink pipe
+ */
+void bench_sink_reset(struct upipe *upipe)
+{
+    struct bench_sink *sink = bench_sink_from_upipe(upipe);
+    sink->urefs = 0;
+    sink->octets = 0;
+    sink->segments = 0;
+}
+
+/** @This returns the number of block segments of the urefs received by a
+ * sink pipe, that is the number of iovecs needed to send them.
+ *
+ * @param upipe description structure of the sink pipe
+ * @return number of segments
+ */
+uint64_t bench_sink_segments(struct upipe *upipe)
+{
+    return bench_sink_sync(bench_sink_from_upipe(upipe))->segments;
+}
+
+/** @This makes a sink pipe keep the urefs it receives in a list, instead
+ * of freeing them.
+ *
+ * @param upipe description structure of the sink pipe
+ * @param capture list where received urefs are appended, or NULL
+ */
+void bench_sink_capture(struct upipe *upipe, struct uchain *capture)
+{
+    bench_sink_from_upipe(upipe)->capture = capture;
+}
+
+/** @This makes a sink pipe report the number of urefs it received when it
+ * dies, which is useful when the sink is released by another thread.
+ *
+ * @param upipe description structure of the sink pipe
+ * @param urefs_p filled in with the number of urefs, or NULL
+ */
+void bench_sink_report(struct upipe *upipe, uint64_t *urefs_p)
+{
+    bench_sink_from_upipe(upipe)->urefs_p = urefs_p;
+}
+
+/** @internal @This prints the result of a benchmark in text form.
+ *
+ * @param bench benchmark context
+ */
+static void bench_print(const struct bench *bench)
+{
+    double seconds = (double)(bench->end - bench->start) / 1e9;
+    printf("%-16s %12"PRIu64" urefs %12.0f pkt/s %10.1f ns/uref",
+           bench->name, bench->urefs,
+           seconds > 0 ? bench->packets / seconds : 0,
+           bench->urefs ? (bench->end - bench->start) /
+                          (double)bench->urefs : 0);
+    if (allocs_available)
+        printf(" %8.3f allocs/uref",
+               bench->urefs ? (double)bench->allocs / bench->urefs : 0);
+    else
+        printf("      n/a allocs/uref");
+    if (bench->segments)
+        printf(" %6.2f iovecs/output", bench->segments);
+    printf("\n");
+}
+
+/** @internal @This prints the result of a benchmark as a JSON object.
+ *
+ * @param file output stream
+ * @param bench benchmark context
+ * @param first true if this is the first benchmark of the list
+ */
+static void bench_print_json(FILE *file, const struct bench *bench,
+                             bool first)
+{
+    double seconds = (double)(bench->end - bench->start) / 1e9;
+    fprintf(file, "%s\n    {\n"
+            "      \"name\": \"%s\",\n"
+            "      \"urefs\": %"PRIu64",\n"
+            "      \"packets\": %"PRIu64",\n"
+            "      \"seconds\": %.6f,\n"
+            "      \"packets_per_sec\": %.1f,\n"
+            "      \"ns_per_uref\": %.1f,\n",
+            first ? "" : ",", bench->name, bench->urefs, bench->packets,
+            seconds, seconds > 0 ? bench->packets / seconds : 0,
+            bench->urefs ? (bench->end - bench->start) /
+                           (double)bench->urefs : 0);
+    if (bench->segments)
+        fprintf(file, "      \"iovecs_per_output\": %.2f,\n",
+                bench->segments);
+    if (allocs_available)
+        fprintf(file, "      \"allocs\": %"PRIu32",\n"
+                "      \"allocs_per_uref\": %.3f\n    }",
+                bench->allocs,
+                bench->urefs ? (double)bench->allocs / bench->urefs : 0);
+    else
+        fprintf(file, "      \"allocs\": null,\n"
+                "      \"allocs_per_uref\": null\n    }");
+}
+
+/** @internal @This checks if a benchmark was selected on the command line.
+ *
+ * @param name name of the benchmark
+ * @param patterns list of patterns
+ * @param nb_patterns number of patterns
+ * @return true if the benchmark must run
+ */
+static bool bench_selected(const char *name, char **patterns,
+                           int nb_patterns)
+{
+    if (!nb_patterns)
+        return true;
+    for (int i = 0; i < nb_patterns; i++)
+        if (strstr(name, patterns[i]) != NULL)
+            return true;
+    return false;
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr, "Usage: %s [-l] [-v] [-d <ms>] [-j <json file>] "
+            "[<pattern>...]\n", argv0);
+    fprintf(stderr, "  -l: list benchmarks\n");
+    fprintf(stderr, "  -v: more verbose logs\n");
+    fprintf(stderr, "  -d: minimum duration of each benchmark "
+            "(default %u ms)\n", DEFAULT_DURATION);
+    fprintf(stderr, "  -j: write results as JSON (- for stdout)\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t duration = DEFAULT_DURATION;
+    const char *json_path = NULL;
+    enum uprobe_log_level loglevel = UPROBE_LOG_ERROR;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "lvd:j:")) != -1) {
+        switch (opt) {
+            case 'l':
+                for (int i = 0; benches[i].name != NULL; i++)
+                    printf("%s\n", benches[i].name);
+                exit(EXIT_SUCCESS);
+            case 'v':
+                if (loglevel > 0)
+                    loglevel--;
+                break;
+            case 'd':
+                duration = strtoull(optarg, NULL, 10);
+                break;
+            case 'j':
+                json_path = optarg;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    FILE *json = NULL;
+    if (json_path != NULL) {
+        json = strcmp(json_path, "-") ? fopen(json_path, "w") : stdout;
+        if (json == NULL) {
+            fprintf(stderr, "unable to open %s: %m\n", json_path);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    struct umem_mgr *umem_mgr = umem_pool_mgr_alloc_simple(UMEM_POOL);
+    assert(umem_mgr != NULL);
+    struct udict_mgr *udict_mgr = udict_inline_mgr_alloc(BENCH_POOL_DEPTH,
+                                                         umem_mgr, -1, -1);
+    assert(udict_mgr != NULL);
+    struct uref_mgr *uref_mgr = uref_std_mgr_alloc(BENCH_POOL_DEPTH,
+                                                   udict_mgr, 0);
+    assert(uref_mgr != NULL);
+
+    struct uprobe *uprobe = uprobe_stdio_alloc(NULL, stderr, loglevel);
+    assert(uprobe != NULL);
+    uprobe = uprobe_uref_mgr_alloc(uprobe, uref_mgr);
+    assert(uprobe != NULL);
+    uprobe = uprobe_ubuf_mem_alloc(uprobe, umem_mgr, BENCH_POOL_DEPTH,
+                                   BENCH_POOL_DEPTH);
+    assert(uprobe != NULL);
+
+    if (json != NULL)
+        fprintf(json, "{\n  \"duration_ms\": %"PRIu64",\n"
+                "  \"benchmarks\": [", duration);
+
+    bool first = true;
+    for (int i = 0; benches[i].name != NULL; i++) {
+        if (!bench_selected(benches[i].name, argv + optind, argc - optind))
+            continue;
+
+        struct bench bench;
+        memset(&bench, 0, sizeof(bench));
+        bench.name = benches[i].name;
+        bench.duration = duration * UINT64_C(1000000);
+        bench.umem_mgr = umem_mgr;
+        bench.uref_mgr = uref_mgr;
+        bench.uprobe = uprobe;
+
+        benches[i].func(&bench);
+        assert(!bench.running);
+
+        if (json != stdout)
+            bench_print(&bench);
+        if (json != NULL)
+            bench_print_json(json, &bench, first);
+        first = false;
+    }
+
+    if (json != NULL) {
+        fprintf(json, "\n  ]\n}\n");
+        if (json != stdout)
+            fclose(json);
+    }
+
+    uprobe_release(uprobe);
+    uref_mgr_release(uref_mgr);
+    udict_mgr_release(udict_mgr);
+    umem_mgr_release(umem_mgr);
+    return 0;
+}
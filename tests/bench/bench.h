@@ -0,0 +1,199 @@
+/*
+ * Copyright (C) 2017 OpenHeadend S.A.R.L.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** @file
+ * @short pipeline throughput benchmarks
+ *
+ * Each benchmark builds a representative pipeline fed by a synthetic
+ * in-memory source, and pushes urefs through it for a minimum duration.
+ * The harness measures the elapsed time and the number of calls to the
+ * system allocator while the pipeline runs, after a warm-up period filling
+ * the pools.
+ */
+
+#ifndef TESTS_BENCH_BENCH_H
+#define TESTS_BENCH_BENCH_H
+
+#include <upipe/ubase.h>
+#include <upipe/ulist.h>
+#include <upipe/uprobe.h>
+#include <upipe/umem.h>
+#include <upipe/uref.h>
+#include <upipe/upipe.h>
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/** pool depth used for the managers of the benchmarks, large enough for the
+ * steady state of the pipelines to run from the pools */
+#define BENCH_POOL_DEPTH 64
+/** number of calls to @ref bench_running before the measurement starts, so
+ * that the allocations filling the pools are not counted */
+#define BENCH_WARMUP (4 * BENCH_POOL_DEPTH)
+
+/** @This is the context of a running benchmark. */
+struct bench {
+    /** name of the benchmark */
+    const char *name;
+    /** minimum duration of the measurement, in nanoseconds */
+    uint64_t duration;
+
+    /** memory allocator */
+    struct umem_mgr *umem_mgr;
+    /** uref manager */
+    struct uref_mgr *uref_mgr;
+    /** probe hierarchy providing uref and ubuf managers, and logging */
+    struct uprobe *uprobe;
+
+    /** number of urefs input into the pipeline, set by the benchmark */
+    uint64_t urefs;
+    /** number of packets output by the pipeline, set by the benchmark */
+    uint64_t packets;
+    /** average number of block segments per uref output by the pipeline,
+     * set by the benchmarks where it matters, or 0 */
+    double segments;
+
+    /** start date of the measurement */
+    uint64_t start;
+    /** end date of the measurement */
+    uint64_t end;
+    /** value of the allocation counter at the start of the measurement */
+    uint32_t allocs_start;
+    /** number of allocations during the measurement */
+    uint32_t allocs;
+    /** number of calls to @ref bench_running left before the measurement
+     * starts */
+    unsigned int warmup;
+    /** number of calls to @ref bench_running since the last clock check */
+    unsigned int checks;
+    /** true while the measurement runs */
+    bool running;
+};
+
+/** @This starts the benchmark. The pipeline must be set up before, and
+ * runs for @ref BENCH_WARMUP iterations before the measurement starts, so
+ * that only the steady state of the pipeline is measured. The counters of
+ * the benchmark and of the sink pipes are reset at that time.
+ *
+ * @param bench benchmark context
+ */
+void bench_start(struct bench *bench);
+
+/** @This returns true until the minimum duration of the measurement has
+ * elapsed. It is meant to be called once per iteration, and only reads the
+ * clock once in a while.
+ *
+ * @param bench benchmark context
+ * @return false if the benchmark must stop feeding the pipeline
+ */
+bool bench_running(struct bench *bench);
+
+/** @This stops the measurement. It must be called after the pipeline has
+ * been drained, but before it is released.
+ *
+ * @param bench benchmark context
+ */
+void bench_stop(struct bench *bench);
+
+/** @This allocates a sink pipe counting the urefs it receives. It accepts
+ * any flow definition, and answers the requests of its input with the
+ * managers of the probe hierarchy.
+ *
+ * @param uprobe structure used to raise events
+ * @return pointer to sink pipe
+ */
+struct upipe *bench_sink_alloc(struct uprobe *uprobe);
+
+/** @This returns the number of urefs received by a sink pipe.
+ *
+ * @param upipe description structure of the sink pipe
+ * @return number of urefs
+ */
+uint64_t bench_sink_urefs(struct upipe *upipe);
+
+/** @This returns the number of octets of block urefs received by a sink
+ * pipe.
+ *
+ * @param upipe description structure of the sink pipe
+ * @return number of octets
+ */
+uint64_t bench_sink_octets(struct upipe *upipe);
+
+/** @This resets the counters of a sink pipe.
+ *
+ * @param upipe description structure of the sink pipe
+ */
+void bench_sink_reset(struct upipe *upipe);
+
+/** @This returns the number of block segments of the urefs received by a
+ * sink pipe, that is the number of iovecs needed to send them.
+ *
+ * @param upipe description structure of the sink pipe
+ * @return number of segments
+ */
+uint64_t bench_sink_segments(struct upipe *upipe);
+
+/** @This makes a sink pipe keep the urefs it receives in a list, instead
+ * of freeing them. The list is owned by the caller.
+ *
+ * @param upipe description structure of the sink pipe
+ * @param capture list where received urefs are appended, or NULL
+ */
+void bench_sink_capture(struct upipe *upipe, struct uchain *capture);
+
+/** @This makes a sink pipe report the number of urefs it received when it
+ * dies, which is useful when the sink is released by another thread.
+ *
+ * @param upipe description structure of the sink pipe
+ * @param urefs_p filled in with the number of urefs, or NULL
+ */
+void bench_sink_report(struct upipe *upipe, uint64_t *urefs_p);
+
+void bench_blit(struct bench *bench);
+void bench_audiocont(struct bench *bench);
+void bench_grid_4x4(struct bench *bench);
+void bench_grid_16x16(struct bench *bench);
+void bench_aes_decrypt(struct bench *bench);
+void bench_aes_decrypt_aesni(struct bench *bench);
+void bench_dup_1(struct bench *bench);
+void bench_dup_2(struct bench *bench);
+void bench_dup_8(struct bench *bench);
+void bench_dup_8_shared(struct bench *bench);
+void bench_ts_mux(struct bench *bench);
+void bench_ts_demux(struct bench *bench);
+void bench_ts_mux_80m(struct bench *bench);
+void bench_ts_mux_80m_contiguous(struct bench *bench);
+void bench_h264f(struct bench *bench);
+void bench_pesd_h264f(struct bench *bench);
+void bench_pesd_h264f_contiguous(struct bench *bench);
+void bench_timers_realloc(struct bench *bench);
+void bench_timers_rearm(struct bench *bench);
+void bench_timers_wheel(struct bench *bench);
+void bench_clock_std(struct bench *bench);
+void bench_clock_coarse(struct bench *bench);
+void bench_clock_tsc(struct bench *bench);
+void bench_clock_cached(struct bench *bench);
+void bench_xfer(struct bench *bench);
+void bench_xfer_pinned(struct bench *bench);
+
+#endif
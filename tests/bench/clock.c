@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2017 OpenHeadend S.A.R.L.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/** @file
+ * @short pipeline throughput benchmarks - system clocks
+ *
+ * Sources date each uref they receive with the system clock. These
+ * benchmarks measure the cost of reading the clock in its different modes,
+ * from the callback of a pump as a source would do.
+ */
+
+#undef NDEBUG
+
+#include <upipe/ubase.h>
+#include <upipe/uclock.h>
+#include <upipe/uclock_std.h>
+#include <upipe/upump.h>
+#include <upump-ev/upump_ev.h>
+
+#include "bench.h"
+
+#include <assert.h>
+
+#define UPUMP_POOL 1
+#define UPUMP_BLOCKER_POOL 1
+/** number of clock reads per iteration of the event loop, so that the cost
+ * of the loop itself doesn't hide the cost of the clock */
+#define BATCH 64
+
+/** @internal @This is the context of the benchmark. */
+struct clock_reader {
+    /** benchmark context */
+    struct bench *bench;
+    /** clock to read */
+    struct uclock *uclock;
+    /** last date read, so that reads are not optimized out */
+    uint64_t now;
+};
+
+/** @internal @This reads the clock as many times as a source receiving a
+ * batch of urefs would do.
+ *
+ * @param upump description structure of the idler
+ */
+static void clock_idler(struct upump *upump)
+{
+    struct clock_reader *reader =
+        upump_get_opaque(upump, struct clock_reader *);
+    if (!bench_running(reader->bench)) {
+        upump_stop(upump);
+        return;
+    }
+
+    for (unsigned int i = 0; i < BATCH; i++) {
+        uint64_t now = uclock_now(reader->uclock);
+        assert(now >= reader->now);
+        reader->now = now;
+    }
+    reader->bench->urefs += BATCH;
+}
+
+/** @internal @This reads a clock from an idler.
+ *
+ * @param bench benchmark context
+ * @param flags flags for the creation of the clock
+ * @param cached true if the clock caches the time once per iteration
+ */
+static void bench_clock(struct bench *bench, enum uclock_std_flags flags,
+                        bool cached)
+{
+    struct upump_mgr *upump_mgr =
+        upump_ev_mgr_alloc_loop(UPUMP_POOL, UPUMP_BLOCKER_POOL);
+    assert(upump_mgr != NULL);
+
+    struct clock_reader reader;
+    reader.bench = bench;
+    reader.uclock = cached ? uclock_std_alloc_cached(flags, upump_mgr) :
+                            uclock_std_alloc(flags);
+    assert(reader.uclock != NULL);
+    reader.now = 0;
+
+    struct upump *upump = upump_alloc_idler(upump_mgr, clock_idler, &reader,
+                                            NULL);
+    assert(upump != NULL);
+    upump_start(upump);
+
+    bench_start(bench);
+    upump_mgr_run(upump_mgr, NULL);
+    bench->packets = bench->urefs;
+    bench_stop(bench);
+
+    upump_free(upump);
+    uclock_release(reader.uclock);
+    upump_mgr_release(upump_mgr);
+}
+
+/** @This reads the monotonic system clock.
+ *
+ * @param bench benchmark context
+ */
+void bench_clock_std(struct bench *bench)
+{
+    bench_clock(bench, 0, false);
+}
+
+/** @This reads the coarse monotonic system clock.
+ *
+ * @param bench benchmark context
+ */
+void bench_clock_coarse(struct bench *bench)
+{
+    bench_clock(bench, UCLOCK_FLAG_COARSE, false);
+}
+
+/** @This reads the monotonic system clock interpolated with the TSC.
+ *
+ * @param bench benchmark context
+ */
+void bench_clock_tsc(struct bench *bench)
+{
+    bench_clock(bench, UCLOCK_FLAG_TSC, false);
+}
+
+/** @This reads the monotonic system clock cached once per iteration of the
+ * event loop.
+ *
+ * @param bench benchmark context
+ */
+void bench_clock_cached(struct bench *bench)
+{
+    bench_clock(bench, 0, true);
+}
@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2017 OpenHeadend S.A.R.L.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/** @file
+ * @short pipeline throughput benchmarks - duplication to several outputs
+ */
+
+#undef NDEBUG
+
+#include <upipe/ubase.h>
+#include <upipe/uprobe.h>
+#include <upipe/uprobe_prefix.h>
+#include <upipe/uclock.h>
+#include <upipe/ubuf.h>
+#include <upipe/ubuf_mem.h>
+#include <upipe/uref.h>
+#include <upipe/uref_pic.h>
+#include <upipe/uref_pic_flow.h>
+#include <upipe/uref_clock.h>
+#include <upipe/upipe.h>
+#include <upipe-modules/upipe_dup.h>
+
+#include "bench.h"
+
+#include <assert.h>
+
+#define UPROBE_LOG_LEVEL UPROBE_LOG_VERBOSE
+#define HSIZE 1920
+#define VSIZE 1080
+#define FRAME_DURATION (UCLOCK_FREQ / 25)
+/** maximum number of outputs of the dup pipe */
+#define DUP_OUTPUTS_MAX 8
+
+/** @internal @This duplicates 1080p pictures to the given number of output
+ * subpipes. Comparing the results for different numbers of outputs gives
+ * the cost of an extra output.
+ *
+ * @param bench benchmark context
+ * @param nb_outputs number of output subpipes
+ * @param shared true to share the attributes between the outputs
+ */
+static void bench_dup_outputs(struct bench *bench, unsigned int nb_outputs,
+                              bool shared)
+{
+    assert(nb_outputs <= DUP_OUTPUTS_MAX);
+    struct uref *flow_def = uref_pic_flow_alloc_def(bench->uref_mgr, 1);
+    assert(flow_def != NULL);
+    ubase_assert(uref_pic_flow_add_plane(flow_def, 1, 1, 1, "y8"));
+    ubase_assert(uref_pic_flow_add_plane(flow_def, 2, 2, 1, "u8"));
+    ubase_assert(uref_pic_flow_add_plane(flow_def, 2, 2, 1, "v8"));
+    ubase_assert(uref_pic_flow_set_hsize(flow_def, HSIZE));
+    ubase_assert(uref_pic_flow_set_vsize(flow_def, VSIZE));
+
+    struct ubuf_mgr *pic_mgr = ubuf_mem_mgr_alloc_from_flow_def(
+            BENCH_POOL_DEPTH, BENCH_POOL_DEPTH, bench->umem_mgr, flow_def);
+    assert(pic_mgr != NULL);
+
+    struct upipe_mgr *upipe_dup_mgr = upipe_dup_mgr_alloc();
+    assert(upipe_dup_mgr != NULL);
+    struct upipe *dup = upipe_void_alloc(upipe_dup_mgr,
+            uprobe_pfx_alloc(uprobe_use(bench->uprobe), UPROBE_LOG_LEVEL,
+                             "dup"));
+    assert(dup != NULL);
+    upipe_mgr_release(upipe_dup_mgr);
+    ubase_assert(upipe_dup_set_shared(dup, shared));
+    ubase_assert(upipe_set_flow_def(dup, flow_def));
+    uref_free(flow_def);
+
+    struct upipe *subs[DUP_OUTPUTS_MAX];
+    struct upipe *sinks[DUP_OUTPUTS_MAX];
+    for (unsigned int i = 0; i < nb_outputs; i++) {
+        subs[i] = upipe_void_alloc_sub(dup,
+                uprobe_pfx_alloc_va(uprobe_use(bench->uprobe),
+                                    UPROBE_LOG_LEVEL, "dup %u", i));
+        assert(subs[i] != NULL);
+        sinks[i] = bench_sink_alloc(
+                uprobe_pfx_alloc_va(uprobe_use(bench->uprobe),
+                                    UPROBE_LOG_LEVEL, "sink %u", i));
+        ubase_assert(upipe_set_output(subs[i], sinks[i]));
+        bench_sink_reset(sinks[i]);
+    }
+
+    /* a decoded picture with the usual timestamps */
+    struct uref *frame = uref_pic_alloc(bench->uref_mgr, pic_mgr,
+                                        HSIZE, VSIZE);
+    assert(frame != NULL);
+    uref_pic_set_progressive(frame);
+    uref_pic_set_tff(frame);
+    ubase_assert(uref_pic_set_number(frame, 0));
+    uref_clock_set_duration(frame, FRAME_DURATION);
+    uref_clock_set_dts_pts_delay(frame, 0);
+
+    uint64_t now = UCLOCK_FREQ;
+    bench_start(bench);
+    while (bench_running(bench)) {
+        struct uref *uref = uref_dup(frame);
+        assert(uref != NULL);
+        uref_clock_set_pts_prog(uref, now);
+        uref_clock_set_pts_sys(uref, now);
+        upipe_input(dup, uref, NULL);
+        bench->urefs++;
+        now += FRAME_DURATION;
+    }
+    for (unsigned int i = 0; i < nb_outputs; i++)
+        bench->packets += bench_sink_urefs(sinks[i]);
+    bench_stop(bench);
+
+    uref_free(frame);
+    for (unsigned int i = 0; i < nb_outputs; i++) {
+        upipe_release(subs[i]);
+        upipe_release(sinks[i]);
+    }
+    upipe_release(dup);
+    ubuf_mgr_release(pic_mgr);
+}
+
+/** @This duplicates pictures to a single output.
+ *
+ * @param bench benchmark context
+ */
+void bench_dup_1(struct bench *bench)
+{
+    bench_dup_outputs(bench, 1, false);
+}
+
+/** @This duplicates pictures to two outputs.
+ *
+ * @param bench benchmark context
+ */
+void bench_dup_2(struct bench *bench)
+{
+    bench_dup_outputs(bench, 2, false);
+}
+
+/** @This duplicates pictures to eight outputs.
+ *
+ * @param bench benchmark context
+ */
+void bench_dup_8(struct bench *bench)
+{
+    bench_dup_outputs(bench, DUP_OUTPUTS_MAX, false);
+}
+
+/** @This duplicates pictures to eight outputs sharing their attributes.
+ *
+ * @param bench benchmark context
+ */
+void bench_dup_8_shared(struct bench *bench)
+{
+    bench_dup_outputs(bench, DUP_OUTPUTS_MAX, true);
+}
@@ -0,0 +1,269 @@
+/*
+ * Copyright (C) 2017 OpenHeadend S.A.R.L.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/** @file
+ * @short pipeline throughput benchmarks - framers
+ */
+
+#undef NDEBUG
+
+#include <upipe/ubase.h>
+#include <upipe/uprobe.h>
+#include <upipe/uprobe_prefix.h>
+#include <upipe/uclock.h>
+#include <upipe/ubuf.h>
+#include <upipe/ubuf_block_mem.h>
+#include <upipe/uref.h>
+#include <upipe/uref_block.h>
+#include <upipe/uref_block_flow.h>
+#include <upipe/uref_clock.h>
+#include <upipe/upipe.h>
+#include <upipe-ts/upipe_ts_pes_decaps.h>
+#include <upipe-framers/upipe_h264_framer.h>
+#include <upipe-framers/uref_h26x_flow.h>
+
+#include <bitstream/mpeg/pes.h>
+
+#include "bench.h"
+#include "upipe_h264_framer_test.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define UPROBE_LOG_LEVEL UPROBE_LOG_VERBOSE
+/** number of access units in the elementary stream */
+#define H264_AUS 64
+/** size of the chunks of elementary stream, unaligned on access units as
+ * they would be output by a demux */
+#define CHUNK_SIZE 4096
+/** delay between two chunks */
+#define CHUNK_DURATION (UCLOCK_FREQ / 1000)
+/** size of the payload of a TS packet */
+#define TS_PAYLOAD 184
+/** size of the filler data padding each access unit to a typical frame
+ * size */
+#define FILLER_SIZE 65536
+
+/** @This frames an H.264 annex B elementary stream received in chunks
+ * unaligned on access units.
+ *
+ * @param bench benchmark context
+ */
+void bench_h264f(struct bench *bench)
+{
+    size_t au_size = sizeof(h264_headers) + sizeof(h264_pic);
+    size_t es_size = H264_AUS * au_size;
+    uint8_t *es = malloc(es_size);
+    assert(es != NULL);
+    for (int i = 0; i < H264_AUS; i++) {
+        memcpy(es + i * au_size, h264_headers, sizeof(h264_headers));
+        memcpy(es + i * au_size + sizeof(h264_headers), h264_pic,
+               sizeof(h264_pic));
+    }
+
+    struct ubuf_mgr *block_mgr = ubuf_block_mem_mgr_alloc(BENCH_POOL_DEPTH,
+            BENCH_POOL_DEPTH, bench->umem_mgr, 0, 0, -1, 0);
+    assert(block_mgr != NULL);
+
+    struct upipe *sink = bench_sink_alloc(
+            uprobe_pfx_alloc(uprobe_use(bench->uprobe), UPROBE_LOG_LEVEL,
+                             "sink"));
+
+    struct upipe_mgr *upipe_h264f_mgr = upipe_h264f_mgr_alloc();
+    assert(upipe_h264f_mgr != NULL);
+    struct upipe *h264f = upipe_void_alloc(upipe_h264f_mgr,
+            uprobe_pfx_alloc(uprobe_use(bench->uprobe), UPROBE_LOG_LEVEL,
+                             "h264f"));
+    assert(h264f != NULL);
+    upipe_mgr_release(upipe_h264f_mgr);
+    ubase_assert(upipe_set_output(h264f, sink));
+
+    struct uref *flow_def = uref_block_flow_alloc_def(bench->uref_mgr,
+                                                      "h264.pic.");
+    assert(flow_def != NULL);
+    ubase_assert(uref_h26x_flow_set_encaps(flow_def,
+                                           UREF_H26X_ENCAPS_ANNEXB));
+    ubase_assert(upipe_set_flow_def(h264f, flow_def));
+    uref_free(flow_def);
+
+    size_t offset = 0;
+    uint64_t date = UCLOCK_FREQ;
+    bench_sink_reset(sink);
+    bench_start(bench);
+    while (bench_running(bench)) {
+        int size = es_size - offset < CHUNK_SIZE ? es_size - offset :
+                   CHUNK_SIZE;
+        struct uref *uref = uref_block_alloc(bench->uref_mgr, block_mgr,
+                                             size);
+        assert(uref != NULL);
+        uint8_t *buffer;
+        ubase_assert(uref_block_write(uref, 0, &size, &buffer));
+        memcpy(buffer, es + offset, size);
+        ubase_assert(uref_block_unmap(uref, 0));
+        uref_clock_set_cr_sys(uref, date);
+        upipe_input(h264f, uref, NULL);
+
+        bench->urefs++;
+        date += CHUNK_DURATION;
+        offset += size;
+        if (offset == es_size)
+            offset = 0;
+    }
+    bench->packets = bench_sink_urefs(sink);
+    bench_stop(bench);
+
+    upipe_release(h264f);
+    upipe_release(sink);
+    ubuf_mgr_release(block_mgr);
+    free(es);
+}
+
+/** @internal @This frames an H.264 elementary stream carried in PES of
+ * unspecified length, one access unit per PES, as output by the PES decaps
+ * pipe from TS packet payloads.
+ *
+ * @param bench benchmark context
+ * @param contiguous true if the PES decaps reassembles PES in contiguous
+ * buffers
+ */
+static void bench_pesd_h264f_mode(struct bench *bench, bool contiguous)
+{
+    /* filler data NAL unit, ignored by the framer */
+    size_t filler_size = 4 + FILLER_SIZE;
+    size_t pes_size = PES_HEADER_SIZE_NOPTS + sizeof(h264_headers) +
+                      sizeof(h264_pic) + filler_size;
+    uint8_t *pes = malloc(pes_size);
+    assert(pes != NULL);
+    pes_init(pes);
+    pes_set_streamid(pes, PES_STREAM_ID_VIDEO_MPEG);
+    pes_set_length(pes, 0);
+    pes_set_headerlength(pes, 0);
+    pes_set_dataalignment(pes);
+    uint8_t *es = pes + PES_HEADER_SIZE_NOPTS;
+    memcpy(es, h264_headers, sizeof(h264_headers));
+    es += sizeof(h264_headers);
+    memcpy(es, h264_pic, sizeof(h264_pic));
+    es += sizeof(h264_pic);
+    es[0] = 0;
+    es[1] = 0;
+    es[2] = 1;
+    es[3] = 12;
+    memset(es + 4, 0xff, FILLER_SIZE - 1);
+    es[filler_size - 1] = 0x80;
+
+    struct ubuf_mgr *block_mgr = ubuf_block_mem_mgr_alloc(BENCH_POOL_DEPTH,
+            BENCH_POOL_DEPTH, bench->umem_mgr, 0, 0, -1, 0);
+    assert(block_mgr != NULL);
+
+    /* prepare the TS payloads once, they are duplicated for each PES */
+    int nb_chunks = (pes_size + TS_PAYLOAD - 1) / TS_PAYLOAD;
+    struct uref *chunks[nb_chunks];
+    for (int i = 0; i < nb_chunks; i++) {
+        int size = pes_size - i * TS_PAYLOAD < TS_PAYLOAD ?
+                   pes_size - i * TS_PAYLOAD : TS_PAYLOAD;
+        chunks[i] = uref_block_alloc(bench->uref_mgr, block_mgr, size);
+        assert(chunks[i] != NULL);
+        uint8_t *buffer;
+        ubase_assert(uref_block_write(chunks[i], 0, &size, &buffer));
+        memcpy(buffer, pes + i * TS_PAYLOAD, size);
+        ubase_assert(uref_block_unmap(chunks[i], 0));
+    }
+    uref_block_set_start(chunks[0]);
+    free(pes);
+
+    struct upipe *sink = bench_sink_alloc(
+            uprobe_pfx_alloc(uprobe_use(bench->uprobe), UPROBE_LOG_LEVEL,
+                             "sink"));
+
+    struct upipe_mgr *upipe_h264f_mgr = upipe_h264f_mgr_alloc();
+    assert(upipe_h264f_mgr != NULL);
+    struct upipe *h264f = upipe_void_alloc(upipe_h264f_mgr,
+            uprobe_pfx_alloc(uprobe_use(bench->uprobe), UPROBE_LOG_LEVEL,
+                             "h264f"));
+    assert(h264f != NULL);
+    upipe_mgr_release(upipe_h264f_mgr);
+    ubase_assert(upipe_set_output(h264f, sink));
+
+    struct upipe_mgr *upipe_ts_pesd_mgr = upipe_ts_pesd_mgr_alloc();
+    assert(upipe_ts_pesd_mgr != NULL);
+    struct upipe *pesd = upipe_void_alloc(upipe_ts_pesd_mgr,
+            uprobe_pfx_alloc(uprobe_use(bench->uprobe), UPROBE_LOG_LEVEL,
+                             "pesd"));
+    assert(pesd != NULL);
+    upipe_mgr_release(upipe_ts_pesd_mgr);
+    ubase_assert(upipe_ts_pesd_set_contiguous(pesd, contiguous));
+    ubase_assert(upipe_set_output(pesd, h264f));
+
+    struct uref *flow_def = uref_block_flow_alloc_def(bench->uref_mgr,
+                                                      "mpegtspes.h264.pic.");
+    assert(flow_def != NULL);
+    ubase_assert(uref_h26x_flow_set_encaps(flow_def,
+                                           UREF_H26X_ENCAPS_ANNEXB));
+    ubase_assert(upipe_set_flow_def(pesd, flow_def));
+    uref_free(flow_def);
+
+    uint64_t date = UCLOCK_FREQ;
+    bench_sink_reset(sink);
+    bench_start(bench);
+    while (bench_running(bench)) {
+        for (int i = 0; i < nb_chunks; i++) {
+            struct uref *uref = uref_dup(chunks[i]);
+            assert(uref != NULL);
+            uref_clock_set_cr_sys(uref, date);
+            upipe_input(pesd, uref, NULL);
+        }
+        bench->urefs += nb_chunks;
+        date += CHUNK_DURATION;
+    }
+    bench->packets = bench_sink_urefs(sink);
+    bench_stop(bench);
+
+    for (int i = 0; i < nb_chunks; i++)
+        uref_free(chunks[i]);
+    upipe_release(pesd);
+    upipe_release(h264f);
+    upipe_release(sink);
+    ubuf_mgr_release(block_mgr);
+}
+
+/** @This frames an H.264 elementary stream out of PES decapsulated in
+ * chunks of TS packet payloads, which the framer chains.
+ *
+ * @param bench benchmark context
+ */
+void bench_pesd_h264f(struct bench *bench)
+{
+    bench_pesd_h264f_mode(bench, false);
+}
+
+/** @This frames an H.264 elementary stream out of PES reassembled by the PES
+ * decaps in contiguous buffers.
+ *
+ * @param bench benchmark context
+ */
+void bench_pesd_h264f_contiguous(struct bench *bench)
+{
+    bench_pesd_h264f_mode(bench, true);
+}
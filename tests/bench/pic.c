@@ -0,0 +1,318 @@
+/*
+ * Copyright (C) 2017 OpenHeadend S.A.R.L.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** @file
+ * @short pipeline throughput benchmarks - picture pipes
+ */
+
+#undef NDEBUG
+
+#include <upipe/ubase.h>
+#include <upipe/uprobe.h>
+#include <upipe/uprobe_prefix.h>
+#include <upipe/uclock.h>
+#include <upipe/ubuf.h>
+#include <upipe/ubuf_pic_mem.h>
+#include <upipe/uref.h>
+#include <upipe/uref_pic.h>
+#include <upipe/uref_pic_flow.h>
+#include <upipe/uref_clock.h>
+#include <upipe/upipe.h>
+#include <upipe-modules/upipe_blit.h>
+#include <upipe-modules/upipe_grid.h>
+
+#include "bench.h"
+
+#include <string.h>
+#include <assert.h>
+
+#define UPROBE_LOG_LEVEL UPROBE_LOG_VERBOSE
+#define HSIZE 1920
+#define VSIZE 1080
+#define FRAME_DURATION (UCLOCK_FREQ / 25)
+/** number of sub pictures blitted on each side of the background */
+#define BLIT_SUBS 2
+
+/** @internal @This allocates a 4:2:0 flow definition.
+ *
+ * @param uref_mgr uref manager
+ * @param hsize horizontal size
+ * @param vsize vertical size
+ * @return flow definition packet
+ */
+static struct uref *pic_flow_alloc(struct uref_mgr *uref_mgr,
+                                   uint64_t hsize, uint64_t vsize)
+{
+    struct uref *flow_def = uref_pic_flow_alloc_def(uref_mgr, 1);
+    assert(flow_def != NULL);
+    ubase_assert(uref_pic_flow_add_plane(flow_def, 1, 1, 1, "y8"));
+    ubase_assert(uref_pic_flow_add_plane(flow_def, 2, 2, 1, "u8"));
+    ubase_assert(uref_pic_flow_add_plane(flow_def, 2, 2, 1, "v8"));
+    ubase_assert(uref_pic_flow_set_hsize(flow_def, hsize));
+    ubase_assert(uref_pic_flow_set_vsize(flow_def, vsize));
+    return flow_def;
+}
+
+/** @internal @This allocates a picture filled with the given value.
+ *
+ * @param uref_mgr uref manager
+ * @param pic_mgr ubuf manager for pictures
+ * @param hsize horizontal size
+ * @param vsize vertical size
+ * @param val value of the pixels
+ * @return picture
+ */
+static struct uref *pic_alloc(struct uref_mgr *uref_mgr,
+                              struct ubuf_mgr *pic_mgr,
+                              uint64_t hsize, uint64_t vsize, uint8_t val)
+{
+    static const char *chromas[] = { "y8", "u8", "v8" };
+    struct uref *uref = uref_pic_alloc(uref_mgr, pic_mgr, hsize, vsize);
+    assert(uref != NULL);
+    uref_pic_set_progressive(uref);
+    for (int i = 0; i < UBASE_ARRAY_SIZE(chromas); i++) {
+        size_t stride;
+        uint8_t hsub, vsub, macropixel_size;
+        uint8_t *buffer;
+        ubase_assert(uref_pic_plane_size(uref, chromas[i], &stride,
+                                         &hsub, &vsub, &macropixel_size));
+        ubase_assert(uref_pic_plane_write(uref, chromas[i], 0, 0, -1, -1,
+                                          &buffer));
+        memset(buffer, val, stride * vsize / vsub);
+        ubase_assert(uref_pic_plane_unmap(uref, chromas[i], 0, 0, -1, -1));
+    }
+    return uref;
+}
+
+/** @internal @This catches the flow format requested by a blit sub pipe. */
+static int blit_provide_flow_format(struct urequest *urequest, va_list args)
+{
+    struct uref **flow_format_p = urequest_get_opaque(urequest, struct uref **);
+    *flow_format_p = va_arg(args, struct uref *);
+    return UBASE_ERR_NONE;
+}
+
+/** @This blits a grid of sub pictures onto full HD backgrounds, all sub
+ * pictures being refreshed for each background.
+ *
+ * @param bench benchmark context
+ */
+void bench_blit(struct bench *bench)
+{
+    struct ubuf_mgr *pic_mgr = ubuf_pic_mem_mgr_alloc_fourcc(
+            BENCH_POOL_DEPTH, BENCH_POOL_DEPTH, bench->umem_mgr, "I420",
+            0, 0, 0, 0, 0, 0);
+    assert(pic_mgr != NULL);
+
+    struct upipe_mgr *upipe_blit_mgr = upipe_blit_mgr_alloc();
+    assert(upipe_blit_mgr != NULL);
+    struct upipe *blit = upipe_void_alloc(upipe_blit_mgr,
+            uprobe_pfx_alloc(uprobe_use(bench->uprobe), UPROBE_LOG_LEVEL,
+                             "blit"));
+    assert(blit != NULL);
+    upipe_mgr_release(upipe_blit_mgr);
+
+    struct upipe *sink = bench_sink_alloc(
+            uprobe_pfx_alloc(uprobe_use(bench->uprobe), UPROBE_LOG_LEVEL,
+                             "sink"));
+    ubase_assert(upipe_set_output(blit, sink));
+
+    struct uref *flow_def = pic_flow_alloc(bench->uref_mgr, HSIZE, VSIZE);
+    ubase_assert(upipe_set_flow_def(blit, flow_def));
+    uref_free(flow_def);
+
+    const uint64_t sub_hsize = HSIZE / BLIT_SUBS;
+    const uint64_t sub_vsize = VSIZE / BLIT_SUBS;
+    struct upipe *subs[BLIT_SUBS * BLIT_SUBS];
+    struct uref *sub_pics[BLIT_SUBS * BLIT_SUBS];
+    for (int i = 0; i < BLIT_SUBS * BLIT_SUBS; i++) {
+        uint64_t x = (i % BLIT_SUBS) * sub_hsize;
+        uint64_t y = (i / BLIT_SUBS) * sub_vsize;
+        subs[i] = upipe_void_alloc_sub(blit,
+                uprobe_pfx_alloc_va(uprobe_use(bench->uprobe),
+                                    UPROBE_LOG_LEVEL, "sub %d", i));
+        assert(subs[i] != NULL);
+        ubase_assert(upipe_blit_sub_set_rect(subs[i],
+                    x, HSIZE - x - sub_hsize, y, VSIZE - y - sub_vsize));
+
+        struct uref *flow_format = NULL;
+        struct urequest request;
+        flow_def = pic_flow_alloc(bench->uref_mgr, sub_hsize, sub_vsize);
+        urequest_init_flow_format(&request, flow_def,
+                                  blit_provide_flow_format, NULL);
+        urequest_set_opaque(&request, &flow_format);
+        ubase_assert(upipe_register_request(subs[i], &request));
+        assert(flow_format != NULL);
+        ubase_assert(upipe_unregister_request(subs[i], &request));
+        urequest_clean(&request);
+        ubase_assert(upipe_set_flow_def(subs[i], flow_format));
+        uref_free(flow_format);
+
+        sub_pics[i] = pic_alloc(bench->uref_mgr, pic_mgr,
+                                sub_hsize, sub_vsize, 16 + i * 32);
+    }
+
+    bench_sink_reset(sink);
+    bench_start(bench);
+    while (bench_running(bench)) {
+        for (int i = 0; i < BLIT_SUBS * BLIT_SUBS; i++) {
+            struct uref *uref = uref_dup(sub_pics[i]);
+            assert(uref != NULL);
+            upipe_input(subs[i], uref, NULL);
+        }
+        struct uref *uref = uref_pic_alloc(bench->uref_mgr, pic_mgr,
+                                           HSIZE, VSIZE);
+        assert(uref != NULL);
+        uref_pic_set_progressive(uref);
+        upipe_input(blit, uref, NULL);
+        ubase_assert(upipe_blit_prepare(blit, NULL));
+        bench->urefs += BLIT_SUBS * BLIT_SUBS + 1;
+    }
+    bench->packets = bench_sink_urefs(sink);
+    bench_stop(bench);
+
+    for (int i = 0; i < BLIT_SUBS * BLIT_SUBS; i++) {
+        uref_free(sub_pics[i]);
+        upipe_release(subs[i]);
+    }
+    upipe_release(blit);
+    upipe_release(sink);
+    ubuf_mgr_release(pic_mgr);
+}
+
+/** @internal @This switches frames between the inputs and outputs of a
+ * grid, each output changing input regularly.
+ *
+ * @param bench benchmark context
+ * @param nb_inputs number of inputs of the grid
+ * @param nb_outputs number of outputs of the grid
+ */
+static void bench_grid(struct bench *bench, unsigned nb_inputs,
+                       unsigned nb_outputs)
+{
+    struct ubuf_mgr *pic_mgr = ubuf_pic_mem_mgr_alloc_fourcc(
+            BENCH_POOL_DEPTH, BENCH_POOL_DEPTH, bench->umem_mgr, "I420",
+            0, 0, 0, 0, 0, 0);
+    assert(pic_mgr != NULL);
+
+    struct upipe_mgr *upipe_grid_mgr = upipe_grid_mgr_alloc();
+    assert(upipe_grid_mgr != NULL);
+    struct upipe *grid = upipe_void_alloc(upipe_grid_mgr,
+            uprobe_pfx_alloc(uprobe_use(bench->uprobe), UPROBE_LOG_LEVEL,
+                             "grid"));
+    assert(grid != NULL);
+    upipe_mgr_release(upipe_grid_mgr);
+
+    struct upipe *sink = bench_sink_alloc(
+            uprobe_pfx_alloc(uprobe_use(bench->uprobe), UPROBE_LOG_LEVEL,
+                             "sink"));
+
+    struct uref *flow_def = pic_flow_alloc(bench->uref_mgr, HSIZE, VSIZE);
+    struct upipe *inputs[nb_inputs];
+    struct uref *pics[nb_inputs];
+    for (unsigned i = 0; i < nb_inputs; i++) {
+        inputs[i] = upipe_grid_alloc_input(grid,
+                uprobe_pfx_alloc_va(uprobe_use(bench->uprobe),
+                                    UPROBE_LOG_LEVEL, "in %u", i));
+        assert(inputs[i] != NULL);
+        ubase_assert(upipe_set_flow_def(inputs[i], flow_def));
+        pics[i] = pic_alloc(bench->uref_mgr, pic_mgr, HSIZE, VSIZE, i);
+    }
+    uref_free(flow_def);
+
+    flow_def = uref_alloc_control(bench->uref_mgr);
+    assert(flow_def != NULL);
+    ubase_assert(uref_flow_set_def(flow_def, "void."));
+    struct upipe *outputs[nb_outputs];
+    for (unsigned i = 0; i < nb_outputs; i++) {
+        outputs[i] = upipe_grid_alloc_output(grid,
+                uprobe_pfx_alloc_va(uprobe_use(bench->uprobe),
+                                    UPROBE_LOG_LEVEL, "out %u", i));
+        assert(outputs[i] != NULL);
+        ubase_assert(upipe_set_flow_def(outputs[i], flow_def));
+        ubase_assert(upipe_set_output(outputs[i], sink));
+        ubase_assert(upipe_grid_out_set_input(outputs[i],
+                                              inputs[i % nb_inputs]));
+    }
+    uref_free(flow_def);
+
+    uint64_t now = UCLOCK_FREQ;
+    uint64_t tick = 0;
+    bench_sink_reset(sink);
+    bench_start(bench);
+    while (bench_running(bench)) {
+        for (unsigned i = 0; i < nb_inputs; i++) {
+            struct uref *uref = uref_dup(pics[i]);
+            assert(uref != NULL);
+            uref_clock_set_pts_sys(uref, now);
+            uref_clock_set_duration(uref, FRAME_DURATION);
+            upipe_input(inputs[i], uref, NULL);
+        }
+
+        /* switch a quarter of the outputs every second */
+        if (!(++tick % 25))
+            for (unsigned i = tick % 4; i < nb_outputs; i += 4)
+                ubase_assert(upipe_grid_out_set_input(outputs[i],
+                            inputs[(i + tick / 25) % nb_inputs]));
+
+        for (unsigned i = 0; i < nb_outputs; i++) {
+            struct uref *uref = uref_alloc_control(bench->uref_mgr);
+            assert(uref != NULL);
+            uref_clock_set_pts_sys(uref, now);
+            uref_clock_set_duration(uref, FRAME_DURATION);
+            upipe_input(outputs[i], uref, NULL);
+        }
+        bench->urefs += nb_inputs + nb_outputs;
+        now += FRAME_DURATION;
+    }
+    bench->packets = bench_sink_urefs(sink);
+    bench_stop(bench);
+
+    for (unsigned i = 0; i < nb_outputs; i++)
+        upipe_release(outputs[i]);
+    for (unsigned i = 0; i < nb_inputs; i++) {
+        upipe_release(inputs[i]);
+        uref_free(pics[i]);
+    }
+    upipe_release(grid);
+    upipe_release(sink);
+    ubuf_mgr_release(pic_mgr);
+}
+
+/** @This benchmarks a grid of 4 inputs and 4 outputs.
+ *
+ * @param bench benchmark context
+ */
+void bench_grid_4x4(struct bench *bench)
+{
+    bench_grid(bench, 4, 4);
+}
+
+/** @This benchmarks a grid of 16 inputs and 16 outputs.
+ *
+ * @param bench benchmark context
+ */
+void bench_grid_16x16(struct bench *bench)
+{
+    bench_grid(bench, 16, 16);
+}
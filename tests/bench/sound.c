@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2017 OpenHeadend S.A.R.L.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** @file
+ * @short pipeline throughput benchmarks - sound pipes
+ */
+
+#undef NDEBUG
+
+#include <upipe/ubase.h>
+#include <upipe/uprobe.h>
+#include <upipe/uprobe_prefix.h>
+#include <upipe/uclock.h>
+#include <upipe/ubuf.h>
+#include <upipe/ubuf_mem.h>
+#include <upipe/uref.h>
+#include <upipe/uref_flow.h>
+#include <upipe/uref_sound.h>
+#include <upipe/uref_sound_flow.h>
+#include <upipe/uref_clock.h>
+#include <upipe/upipe.h>
+#include <upipe-modules/upipe_audiocont.h>
+
+#include "bench.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#define UPROBE_LOG_LEVEL UPROBE_LOG_VERBOSE
+#define CHANNELS 2
+#define RATE 48000
+#define SAMPLES 1024
+#define DURATION (SAMPLES * UCLOCK_FREQ / RATE)
+#define AUDIOCONT_INPUTS 2
+/** number of frames between two input switches, so that the crossblend,
+ * lasting about 10 frames, runs most of the time */
+#define SWITCH_PERIOD 16
+
+/** @This feeds an audio continuity pipe with two inputs, switching input
+ * regularly so that frames are crossblended.
+ *
+ * @param bench benchmark context
+ */
+void bench_audiocont(struct bench *bench)
+{
+    struct uref *flow_def = uref_sound_flow_alloc_def(bench->uref_mgr, "f32.",
+            CHANNELS, CHANNELS * sizeof(float));
+    assert(flow_def != NULL);
+    ubase_assert(uref_sound_flow_add_plane(flow_def, "lr"));
+    ubase_assert(uref_sound_flow_set_rate(flow_def, RATE));
+
+    struct ubuf_mgr *sound_mgr = ubuf_mem_mgr_alloc_from_flow_def(
+            BENCH_POOL_DEPTH, BENCH_POOL_DEPTH, bench->umem_mgr, flow_def);
+    assert(sound_mgr != NULL);
+
+    struct upipe_mgr *upipe_audiocont_mgr = upipe_audiocont_mgr_alloc();
+    assert(upipe_audiocont_mgr != NULL);
+    struct upipe *audiocont = upipe_flow_alloc(upipe_audiocont_mgr,
+            uprobe_pfx_alloc(uprobe_use(bench->uprobe), UPROBE_LOG_LEVEL,
+                             "audiocont"), flow_def);
+    assert(audiocont != NULL);
+    upipe_mgr_release(upipe_audiocont_mgr);
+    ubase_assert(upipe_set_flow_def(audiocont, flow_def));
+
+    struct upipe *sink = bench_sink_alloc(
+            uprobe_pfx_alloc(uprobe_use(bench->uprobe), UPROBE_LOG_LEVEL,
+                             "sink"));
+    ubase_assert(upipe_set_output(audiocont, sink));
+
+    struct upipe *subs[AUDIOCONT_INPUTS];
+    struct uref *frames[AUDIOCONT_INPUTS];
+    for (int i = 0; i < AUDIOCONT_INPUTS; i++) {
+        subs[i] = upipe_void_alloc_sub(audiocont,
+                uprobe_pfx_alloc_va(uprobe_use(bench->uprobe),
+                                    UPROBE_LOG_LEVEL, "sub %d", i));
+        assert(subs[i] != NULL);
+        struct uref *sub_flow_def = uref_dup(flow_def);
+        assert(sub_flow_def != NULL);
+        char name[16];
+        snprintf(name, sizeof(name), "in%d", i);
+        ubase_assert(uref_flow_set_name(sub_flow_def, name));
+        ubase_assert(upipe_set_flow_def(subs[i], sub_flow_def));
+        uref_free(sub_flow_def);
+
+        frames[i] = uref_sound_alloc(bench->uref_mgr, sound_mgr, SAMPLES);
+        assert(frames[i] != NULL);
+        float *buffer;
+        ubase_assert(uref_sound_plane_write_float(frames[i], "lr", 0, -1,
+                                                  &buffer));
+        for (int j = 0; j < SAMPLES * CHANNELS; j++)
+            buffer[j] = (float)((j * (i + 1)) % 256 - 128) / 256.f;
+        ubase_assert(uref_sound_plane_unmap(frames[i], "lr", 0, -1));
+    }
+    uref_free(flow_def);
+
+    uint64_t now = UCLOCK_FREQ;
+    uint64_t frame = 0;
+    bench_sink_reset(sink);
+    bench_start(bench);
+    while (bench_running(bench)) {
+        if (!(frame % SWITCH_PERIOD)) {
+            char name[16];
+            snprintf(name, sizeof(name), "in%d",
+                     (int)(frame / SWITCH_PERIOD) % AUDIOCONT_INPUTS);
+            ubase_assert(upipe_audiocont_set_input(audiocont, name));
+        }
+
+        for (int i = 0; i < AUDIOCONT_INPUTS; i++) {
+            struct uref *uref = uref_dup(frames[i]);
+            assert(uref != NULL);
+            uref_clock_set_pts_sys(uref, now - DURATION / 10);
+            uref_clock_set_duration(uref, DURATION);
+            upipe_input(subs[i], uref, NULL);
+        }
+
+        /* the reference frame is overwritten by the pipe */
+        struct uref *uref = uref_sound_alloc(bench->uref_mgr, sound_mgr,
+                                             SAMPLES);
+        assert(uref != NULL);
+        float *buffer;
+        ubase_assert(uref_sound_plane_write_float(uref, "lr", 0, -1,
+                                                  &buffer));
+        memset(buffer, 0, SAMPLES * CHANNELS * sizeof(float));
+        ubase_assert(uref_sound_plane_unmap(uref, "lr", 0, -1));
+        uref_clock_set_pts_sys(uref, now);
+        uref_clock_set_duration(uref, DURATION);
+        upipe_input(audiocont, uref, NULL);
+
+        bench->urefs += AUDIOCONT_INPUTS + 1;
+        now += DURATION;
+        frame++;
+    }
+    bench->packets = bench_sink_urefs(sink);
+    bench_stop(bench);
+
+    for (int i = 0; i < AUDIOCONT_INPUTS; i++) {
+        uref_free(frames[i]);
+        upipe_release(subs[i]);
+    }
+    upipe_release(audiocont);
+    upipe_release(sink);
+    ubuf_mgr_release(sound_mgr);
+}
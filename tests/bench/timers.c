@@ -0,0 +1,207 @@
+/*
+ * Copyright (C) 2017 OpenHeadend S.A.R.L.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** @file
+ * @short pipeline throughput benchmarks - timers of upump managers
+ *
+ * Many pipes keep a timeout that is pushed back each time they receive
+ * data, for instance to detect the loss of a source. These benchmarks
+ * measure the cost of rescheduling such timeouts for a large number of
+ * concurrent pipes.
+ */
+
+#undef NDEBUG
+
+#include <upipe/ubase.h>
+#include <upipe/uclock.h>
+#include <upipe/upump.h>
+#include <upump-ev/upump_ev.h>
+
+#include "bench.h"
+
+#include <stdlib.h>
+#include <assert.h>
+
+/** number of concurrent timers, one per simulated pipe */
+#define TIMERS 10000
+/** base timeout of the timers (100 ms), never reached during the
+ * benchmark */
+#define TIMEOUT (UCLOCK_FREQ / 10)
+/** number of timers rescheduled per iteration of the event loop, so that
+ * the cost of the loop itself doesn't hide the cost of the timers */
+#define BATCH 64
+
+/** @internal @This describes the way timers are rescheduled. */
+enum timers_mode {
+    /** stop, free and allocate a new timer */
+    TIMERS_REALLOC,
+    /** re-arm the timer of the event loop */
+    TIMERS_REARM,
+    /** re-arm a timer of the timer wheel of the manager */
+    TIMERS_WHEEL,
+};
+
+/** @internal @This is the context of the benchmark. */
+struct timers {
+    /** benchmark context */
+    struct bench *bench;
+    /** pump manager */
+    struct upump_mgr *upump_mgr;
+    /** rescheduling mode */
+    enum timers_mode mode;
+    /** timers of the simulated pipes */
+    struct upump *upumps[TIMERS];
+    /** index of the next timer to reschedule */
+    unsigned int next;
+};
+
+/** @internal @This is called when a timeout is reached.
+ *
+ * @param upump description structure of the timer
+ */
+static void timers_timeout(struct upump *upump)
+{
+    struct timers *timers = upump_get_opaque(upump, struct timers *);
+    timers->bench->packets++;
+}
+
+/** @internal @This allocates and starts a timer.
+ *
+ * @param timers benchmark context
+ * @param timeout timeout of the timer
+ * @return pointer to timer
+ */
+static struct upump *timers_alloc(struct timers *timers, uint64_t timeout)
+{
+    struct upump *upump;
+    if (timers->mode == TIMERS_WHEEL)
+        upump = upump_alloc_wheel_timer(timers->upump_mgr, timers_timeout,
+                                        timers, NULL, timeout, 0);
+    else
+        upump = upump_alloc_timer(timers->upump_mgr, timers_timeout,
+                                  timers, NULL, timeout, 0);
+    assert(upump != NULL);
+    upump_start(upump);
+    return upump;
+}
+
+/** @internal @This reschedules the timeouts of a batch of pipes, as if they
+ * had received a packet.
+ *
+ * @param upump description structure of the idler
+ */
+static void timers_feed(struct upump *upump)
+{
+    struct timers *timers = upump_get_opaque(upump, struct timers *);
+    if (!bench_running(timers->bench)) {
+        upump_stop(upump);
+        upump_free(upump);
+        for (unsigned int i = 0; i < TIMERS; i++) {
+            upump_stop(timers->upumps[i]);
+            upump_free(timers->upumps[i]);
+            timers->upumps[i] = NULL;
+        }
+        return;
+    }
+
+    for (unsigned int j = 0; j < BATCH; j++) {
+        unsigned int i = timers->next;
+        timers->next = (i + 1) % TIMERS;
+        /* spread the timeouts so that they don't all land at the same
+         * place */
+        uint64_t timeout = TIMEOUT + (i % 64) * UPUMP_WHEEL_TICK;
+
+        switch (timers->mode) {
+            case TIMERS_REALLOC:
+                upump_stop(timers->upumps[i]);
+                upump_free(timers->upumps[i]);
+                timers->upumps[i] = timers_alloc(timers, timeout);
+                break;
+            case TIMERS_REARM:
+            case TIMERS_WHEEL:
+                ubase_assert(upump_rearm(timers->upumps[i], timeout, 0));
+                break;
+        }
+    }
+    timers->bench->urefs += BATCH;
+}
+
+/** @internal @This reschedules the timeouts of many pipes.
+ *
+ * @param bench benchmark context
+ * @param mode rescheduling mode
+ */
+static void bench_timers_mode(struct bench *bench, enum timers_mode mode)
+{
+    struct timers *timers = malloc(sizeof(struct timers));
+    assert(timers != NULL);
+    timers->bench = bench;
+    timers->mode = mode;
+    timers->next = 0;
+    timers->upump_mgr = upump_ev_mgr_alloc_loop(BENCH_POOL_DEPTH,
+                                                BENCH_POOL_DEPTH);
+    assert(timers->upump_mgr != NULL);
+
+    for (unsigned int i = 0; i < TIMERS; i++)
+        timers->upumps[i] = timers_alloc(timers,
+                TIMEOUT + (i % 64) * UPUMP_WHEEL_TICK);
+
+    struct upump *upump = upump_alloc_idler(timers->upump_mgr, timers_feed,
+                                            timers, NULL);
+    assert(upump != NULL);
+    upump_start(upump);
+
+    bench_start(bench);
+    upump_mgr_run(timers->upump_mgr, NULL);
+    bench_stop(bench);
+
+    upump_mgr_release(timers->upump_mgr);
+    free(timers);
+}
+
+/** @This reschedules timers by allocating a new one each time.
+ *
+ * @param bench benchmark context
+ */
+void bench_timers_realloc(struct bench *bench)
+{
+    bench_timers_mode(bench, TIMERS_REALLOC);
+}
+
+/** @This reschedules timers by re-arming them.
+ *
+ * @param bench benchmark context
+ */
+void bench_timers_rearm(struct bench *bench)
+{
+    bench_timers_mode(bench, TIMERS_REARM);
+}
+
+/** @This reschedules timers of the timer wheel by re-arming them.
+ *
+ * @param bench benchmark context
+ */
+void bench_timers_wheel(struct bench *bench)
+{
+    bench_timers_mode(bench, TIMERS_WHEEL);
+}
@@ -0,0 +1,382 @@
+/*
+ * Copyright (C) 2017 OpenHeadend S.A.R.L.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/** @file
+ * @short pipeline throughput benchmarks - TS mux and demux
+ */
+
+#undef NDEBUG
+
+#include <upipe/ubase.h>
+#include <upipe/ulist.h>
+#include <upipe/uprobe.h>
+#include <upipe/uprobe_prefix.h>
+#include <upipe/uprobe_select_flows.h>
+#include <upipe/uclock.h>
+#include <upipe/ubuf.h>
+#include <upipe/ubuf_block.h>
+#include <upipe/ubuf_block_mem.h>
+#include <upipe/uref.h>
+#include <upipe/uref_flow.h>
+#include <upipe/uref_block.h>
+#include <upipe/uref_block_flow.h>
+#include <upipe/uref_sound_flow.h>
+#include <upipe/uref_clock.h>
+#include <upipe/upipe.h>
+#include <upipe-ts/upipe_ts_mux.h>
+#include <upipe-ts/upipe_ts_demux.h>
+#include <upipe-ts/uref_ts_flow.h>
+
+#include "bench.h"
+
+#include <string.h>
+#include <assert.h>
+
+#include <bitstream/mpeg/ts.h>
+
+#define UPROBE_LOG_LEVEL UPROBE_LOG_VERBOSE
+/** number of programs in the multiplex, each carrying an MPEG-1 layer II
+ * elementary stream */
+#define TS_PROGRAMS 8
+#define RATE 48000
+#define SAMPLES 1152
+/** size of a 192 kbits/s frame at 48 kHz */
+#define FRAME_SIZE 576
+#define OCTETRATE (FRAME_SIZE * RATE / SAMPLES)
+#define DURATION (SAMPLES * UCLOCK_FREQ / RATE)
+/** delay between the reception and the decoding of a frame */
+#define MUX_DELAY (UCLOCK_FREQ / 10)
+/** duration of the stream replayed to the demux */
+#define DEMUX_STREAM_DURATION (UCLOCK_FREQ * 4)
+/** octetrate of the constant bitrate multiplex (80 Mbits/s) */
+#define CBR_OCTETRATE (80000000 / 8)
+/** number of TS packets in a UDP datagram */
+#define CBR_PACKETS 7
+
+/** @internal @This is the context of a multiplex fed with synthetic
+ * frames. */
+struct ts_mux {
+    /** ubuf manager for blocks */
+    struct ubuf_mgr *block_mgr;
+    /** mux pipe */
+    struct upipe *mux;
+    /** program subpipes */
+    struct upipe *programs[TS_PROGRAMS];
+    /** input subpipes */
+    struct upipe *inputs[TS_PROGRAMS];
+    /** template frame */
+    struct ubuf *frame;
+    /** date of the next frame */
+    uint64_t date;
+};
+
+/** @internal @This sets up a multiplex of @ref TS_PROGRAMS audio programs.
+ *
+ * @param ctx context of the multiplex
+ * @param bench benchmark context
+ * @param output output of the mux
+ */
+static void ts_mux_init(struct ts_mux *ctx, struct bench *bench,
+                        struct upipe *output)
+{
+    ctx->block_mgr = ubuf_block_mem_mgr_alloc(BENCH_POOL_DEPTH,
+            BENCH_POOL_DEPTH, bench->umem_mgr, 0, 0, -1, 0);
+    assert(ctx->block_mgr != NULL);
+
+    struct upipe_mgr *upipe_ts_mux_mgr = upipe_ts_mux_mgr_alloc();
+    assert(upipe_ts_mux_mgr != NULL);
+    ctx->mux = upipe_void_alloc(upipe_ts_mux_mgr,
+            uprobe_pfx_alloc(uprobe_use(bench->uprobe), UPROBE_LOG_LEVEL,
+                             "ts mux"));
+    assert(ctx->mux != NULL);
+    upipe_mgr_release(upipe_ts_mux_mgr);
+    ubase_assert(upipe_ts_mux_set_mode(ctx->mux, UPIPE_TS_MUX_MODE_CAPPED));
+    ubase_assert(upipe_set_output(ctx->mux, output));
+
+    struct uref *flow_def = uref_alloc_control(bench->uref_mgr);
+    assert(flow_def != NULL);
+    ubase_assert(uref_flow_set_def(flow_def, "void."));
+    ubase_assert(upipe_set_flow_def(ctx->mux, flow_def));
+
+    struct uref *es_flow_def = uref_block_flow_alloc_def(bench->uref_mgr,
+                                                         "mp2.sound.");
+    assert(es_flow_def != NULL);
+    ubase_assert(uref_block_flow_set_octetrate(es_flow_def, OCTETRATE));
+    ubase_assert(uref_sound_flow_set_rate(es_flow_def, RATE));
+    ubase_assert(uref_sound_flow_set_samples(es_flow_def, SAMPLES));
+
+    for (int i = 0; i < TS_PROGRAMS; i++) {
+        ctx->programs[i] = upipe_void_alloc_sub(ctx->mux,
+                uprobe_pfx_alloc_va(uprobe_use(bench->uprobe),
+                                    UPROBE_LOG_LEVEL, "program %d", i));
+        assert(ctx->programs[i] != NULL);
+        ubase_assert(uref_flow_set_id(flow_def, i + 1));
+        ubase_assert(uref_ts_flow_set_pid(flow_def, 256 + i));
+        ubase_assert(upipe_set_flow_def(ctx->programs[i], flow_def));
+
+        ctx->inputs[i] = upipe_void_alloc_sub(ctx->programs[i],
+                uprobe_pfx_alloc_va(uprobe_use(bench->uprobe),
+                                    UPROBE_LOG_LEVEL, "input %d", i));
+        assert(ctx->inputs[i] != NULL);
+        ubase_assert(uref_ts_flow_set_pid(es_flow_def, 512 + i));
+        ubase_assert(upipe_set_flow_def(ctx->inputs[i], es_flow_def));
+    }
+    uref_free(es_flow_def);
+    uref_free(flow_def);
+
+    ctx->frame = ubuf_block_alloc(ctx->block_mgr, FRAME_SIZE);
+    assert(ctx->frame != NULL);
+    uint8_t *buffer;
+    int size = -1;
+    ubase_assert(ubuf_block_write(ctx->frame, 0, &size, &buffer));
+    assert(size == FRAME_SIZE);
+    memset(buffer, 0, FRAME_SIZE);
+    /* MPEG-1 layer II, 192 kbits/s, 48 kHz, stereo */
+    buffer[0] = 0xff;
+    buffer[1] = 0xfd;
+    buffer[2] = 0xa4;
+    ubase_assert(ubuf_block_unmap(ctx->frame, 0));
+
+    ctx->date = UCLOCK_FREQ;
+}
+
+/** @internal @This feeds one frame to every program of the multiplex.
+ *
+ * @param ctx context of the multiplex
+ * @param bench benchmark context
+ * @return number of urefs input
+ */
+static unsigned int ts_mux_feed(struct ts_mux *ctx, struct bench *bench)
+{
+    for (int i = 0; i < TS_PROGRAMS; i++) {
+        struct uref *uref = uref_alloc(bench->uref_mgr);
+        assert(uref != NULL);
+        struct ubuf *ubuf = ubuf_dup(ctx->frame);
+        assert(ubuf != NULL);
+        uref_attach_ubuf(uref, ubuf);
+        uref_clock_set_cr_sys(uref, ctx->date);
+        uref_clock_set_dts_sys(uref, ctx->date + MUX_DELAY);
+        uref_clock_set_cr_prog(uref, ctx->date);
+        uref_clock_set_dts_prog(uref, ctx->date + MUX_DELAY);
+        uref_clock_set_dts_pts_delay(uref, 0);
+        uref_clock_set_duration(uref, DURATION);
+        upipe_input(ctx->inputs[i], uref, NULL);
+    }
+    ctx->date += DURATION;
+    return TS_PROGRAMS;
+}
+
+/** @internal @This releases the multiplex.
+ *
+ * @param ctx context of the multiplex
+ */
+static void ts_mux_clean(struct ts_mux *ctx)
+{
+    for (int i = 0; i < TS_PROGRAMS; i++) {
+        upipe_release(ctx->inputs[i]);
+        upipe_release(ctx->programs[i]);
+    }
+    upipe_release(ctx->mux);
+    ubuf_free(ctx->frame);
+    ubuf_mgr_release(ctx->block_mgr);
+}
+
+/** @This multiplexes audio programs into a capped VBR transport stream.
+ *
+ * @param bench benchmark context
+ */
+void bench_ts_mux(struct bench *bench)
+{
+    struct upipe *sink = bench_sink_alloc(
+            uprobe_pfx_alloc(uprobe_use(bench->uprobe), UPROBE_LOG_LEVEL,
+                             "sink"));
+    struct ts_mux ctx;
+    ts_mux_init(&ctx, bench, sink);
+
+    bench_sink_reset(sink);
+    bench_start(bench);
+    while (bench_running(bench))
+        bench->urefs += ts_mux_feed(&ctx, bench);
+    bench->packets = bench_sink_octets(sink) / TS_SIZE;
+    bench_stop(bench);
+
+    ts_mux_clean(&ctx);
+    upipe_release(sink);
+}
+
+/** @internal @This multiplexes audio programs into a constant bitrate
+ * transport stream of 80 Mbits/s, output in datagrams of 7 TS packets.
+ *
+ * @param bench benchmark context
+ * @param contiguous true if the mux writes datagrams in contiguous buffers
+ */
+static void bench_ts_mux_cbr(struct bench *bench, bool contiguous)
+{
+    struct upipe *sink = bench_sink_alloc(
+            uprobe_pfx_alloc(uprobe_use(bench->uprobe), UPROBE_LOG_LEVEL,
+                             "sink"));
+    struct ts_mux ctx;
+    ts_mux_init(&ctx, bench, sink);
+    ubase_assert(upipe_ts_mux_set_mode(ctx.mux, UPIPE_TS_MUX_MODE_CBR));
+    ubase_assert(upipe_ts_mux_set_octetrate(ctx.mux, CBR_OCTETRATE));
+    ubase_assert(upipe_set_output_size(ctx.mux, CBR_PACKETS * TS_SIZE));
+    ubase_assert(upipe_ts_mux_set_contiguous(ctx.mux, contiguous));
+
+    bench_sink_reset(sink);
+    bench_start(bench);
+    while (bench_running(bench))
+        bench->urefs += ts_mux_feed(&ctx, bench);
+    bench->packets = bench_sink_octets(sink) / TS_SIZE;
+    bench_stop(bench);
+    if (bench_sink_urefs(sink))
+        bench->segments = (double)bench_sink_segments(sink) /
+                          bench_sink_urefs(sink);
+
+    ts_mux_clean(&ctx);
+    upipe_release(sink);
+}
+
+/** @This multiplexes audio programs into an 80 Mbits/s transport stream,
+ * each TS packet of the datagrams being made of several segments.
+ *
+ * @param bench benchmark context
+ */
+void bench_ts_mux_80m(struct bench *bench)
+{
+    bench_ts_mux_cbr(bench, false);
+}
+
+/** @This multiplexes audio programs into an 80 Mbits/s transport stream,
+ * with datagrams written in contiguous buffers.
+ *
+ * @param bench benchmark context
+ */
+void bench_ts_mux_80m_contiguous(struct bench *bench)
+{
+    bench_ts_mux_cbr(bench, true);
+}
+
+/** @internal @This is the probe catching the elementary streams output by
+ * the demux. */
+struct ts_demux_es {
+    /** probe structure */
+    struct uprobe uprobe;
+    /** sink of the elementary streams */
+    struct upipe *sink;
+};
+
+UBASE_FROM_TO(ts_demux_es, uprobe, uprobe, uprobe)
+
+/** @internal @This connects the elementary streams to the sink.
+ *
+ * @param uprobe pointer to probe
+ * @param upipe pointer to pipe throwing the event
+ * @param event event thrown
+ * @param args optional event-specific parameters
+ * @return an error code
+ */
+static int ts_demux_es_catch(struct uprobe *uprobe, struct upipe *upipe,
+                             int event, va_list args)
+{
+    if (event != UPROBE_NEED_OUTPUT)
+        return uprobe_throw_next(uprobe, upipe, event, args);
+
+    struct ts_demux_es *es = ts_demux_es_from_uprobe(uprobe);
+    return upipe_set_output(upipe, es->sink);
+}
+
+/** @This demultiplexes a transport stream of audio programs, previously
+ * produced by the mux, down to the PES payloads.
+ *
+ * @param bench benchmark context
+ */
+void bench_ts_demux(struct bench *bench)
+{
+    /* produce the stream, outside of the measurement */
+    struct uchain stream;
+    ulist_init(&stream);
+    struct upipe *capture = bench_sink_alloc(
+            uprobe_pfx_alloc(uprobe_use(bench->uprobe), UPROBE_LOG_LEVEL,
+                             "capture"));
+    bench_sink_capture(capture, &stream);
+    struct ts_mux ctx;
+    ts_mux_init(&ctx, bench, capture);
+    while (ctx.date < UCLOCK_FREQ + DEMUX_STREAM_DURATION)
+        ts_mux_feed(&ctx, bench);
+    ts_mux_clean(&ctx);
+    upipe_release(capture);
+    assert(!ulist_empty(&stream));
+
+    struct upipe *sink = bench_sink_alloc(
+            uprobe_pfx_alloc(uprobe_use(bench->uprobe), UPROBE_LOG_LEVEL,
+                             "sink"));
+    struct ts_demux_es es;
+    uprobe_init(&es.uprobe, ts_demux_es_catch, uprobe_use(bench->uprobe));
+    es.sink = sink;
+
+    struct upipe_mgr *upipe_ts_demux_mgr = upipe_ts_demux_mgr_alloc();
+    assert(upipe_ts_demux_mgr != NULL);
+    struct upipe *demux = upipe_void_alloc(upipe_ts_demux_mgr,
+            uprobe_pfx_alloc(
+                uprobe_selflow_alloc(uprobe_use(bench->uprobe),
+                    uprobe_selflow_alloc(uprobe_use(bench->uprobe),
+                                         uprobe_use(&es.uprobe),
+                                         UPROBE_SELFLOW_SOUND, "all"),
+                    UPROBE_SELFLOW_VOID, "all"),
+                UPROBE_LOG_LEVEL, "ts demux"));
+    assert(demux != NULL);
+    upipe_mgr_release(upipe_ts_demux_mgr);
+
+    struct uref *flow_def = uref_block_flow_alloc_def(bench->uref_mgr,
+                                                      "mpegts.");
+    assert(flow_def != NULL);
+    ubase_assert(upipe_set_flow_def(demux, flow_def));
+    uref_free(flow_def);
+
+    /* replay the stream in a loop */
+    struct uchain *uchain = ulist_peek(&stream);
+    bench_sink_reset(sink);
+    bench_start(bench);
+    while (bench_running(bench)) {
+        struct uref *uref = uref_dup(uref_from_uchain(uchain));
+        assert(uref != NULL);
+        upipe_input(demux, uref, NULL);
+        bench->urefs++;
+        uchain = uchain->next;
+        if (uchain == &stream)
+            uchain = ulist_peek(&stream);
+    }
+    bench->packets = bench_sink_urefs(sink);
+    bench_stop(bench);
+
+    upipe_release(demux);
+    upipe_release(sink);
+    uprobe_clean(&es.uprobe);
+
+    struct uchain *uchain_tmp;
+    ulist_delete_foreach (&stream, uchain, uchain_tmp) {
+        ulist_delete(uchain);
+        uref_free(uref_from_uchain(uchain));
+    }
+}
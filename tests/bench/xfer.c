@@ -0,0 +1,214 @@
+/*
+ * Copyright (C) 2017 OpenHeadend S.A.R.L.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** @file
+ * @short pipeline throughput benchmarks - queues between threads
+ */
+
+#undef NDEBUG
+
+#define _GNU_SOURCE
+
+#include <upipe/config.h>
+#include <upipe/ubase.h>
+#include <upipe/uprobe.h>
+#include <upipe/uprobe_prefix.h>
+#include <upipe/ubuf.h>
+#include <upipe/ubuf_block_mem.h>
+#include <upipe/uref.h>
+#include <upipe/uref_block.h>
+#include <upipe/uref_block_flow.h>
+#include <upipe/upump.h>
+#include <upump-ev/upump_ev.h>
+#include <upipe/upipe.h>
+#include <upipe-modules/upipe_worker_sink.h>
+#include <upipe-pthread/upipe_pthread_transfer.h>
+#include <upipe-pthread/uprobe_pthread_upump_mgr.h>
+
+#include "bench.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <assert.h>
+
+#define UPROBE_LOG_LEVEL UPROBE_LOG_VERBOSE
+#define UPUMP_POOL 1
+#define UPUMP_BLOCKER_POOL 1
+#define XFER_QUEUE 255
+#define XFER_POOL 1
+#define WSINK_QUEUE 64
+/** size of the payload of a UDP datagram carrying 7 TS packets */
+#define PAYLOAD_SIZE 1316
+
+/** @internal @This is the context of the feeding pump. */
+struct xfer_feed {
+    /** benchmark context */
+    struct bench *bench;
+    /** ubuf manager for blocks */
+    struct ubuf_mgr *block_mgr;
+    /** worker sink */
+    struct upipe *wsink;
+};
+
+/** @internal @This feeds the worker sink with one datagram, as a UDP source
+ * would do.
+ *
+ * @param upump description structure of the idler
+ */
+static void xfer_feed(struct upump *upump)
+{
+    struct xfer_feed *feed = upump_get_opaque(upump, struct xfer_feed *);
+    if (!bench_running(feed->bench)) {
+        upump_stop(upump);
+        upump_free(upump);
+        upipe_release(feed->wsink);
+        feed->wsink = NULL;
+        return;
+    }
+
+    struct uref *uref = uref_block_alloc(feed->bench->uref_mgr,
+                                         feed->block_mgr, PAYLOAD_SIZE);
+    assert(uref != NULL);
+    upipe_input(feed->wsink, uref, &upump);
+    feed->bench->urefs++;
+}
+
+/** @internal @This transfers datagrams from the main thread to a worker
+ * thread through a worker sink.
+ *
+ * @param bench benchmark context
+ * @param placement placement of the worker thread, or NULL
+ */
+static void bench_xfer_placement(struct bench *bench,
+        const struct upipe_pthread_placement *placement)
+{
+    struct upump_mgr *upump_mgr =
+        upump_ev_mgr_alloc_loop(UPUMP_POOL, UPUMP_BLOCKER_POOL);
+    assert(upump_mgr != NULL);
+
+    struct uprobe *uprobe =
+        uprobe_pthread_upump_mgr_alloc(uprobe_use(bench->uprobe));
+    assert(uprobe != NULL);
+    ubase_assert(uprobe_pthread_upump_mgr_set(uprobe, upump_mgr));
+
+    struct ubuf_mgr *block_mgr = ubuf_block_mem_mgr_alloc(BENCH_POOL_DEPTH,
+            BENCH_POOL_DEPTH, bench->umem_mgr, 0, 0, -1, 0);
+    assert(block_mgr != NULL);
+
+    struct upipe_mgr *upipe_xfer_mgr =
+        upipe_pthread_xfer_mgr_alloc_placement(XFER_QUEUE, XFER_POOL,
+                uprobe_use(uprobe), upump_ev_mgr_alloc_loop,
+                UPUMP_POOL, UPUMP_BLOCKER_POOL, NULL, NULL, NULL,
+                placement);
+    assert(upipe_xfer_mgr != NULL);
+    struct upipe_mgr *upipe_wsink_mgr = upipe_wsink_mgr_alloc(upipe_xfer_mgr);
+    assert(upipe_wsink_mgr != NULL);
+    upipe_mgr_release(upipe_xfer_mgr);
+
+    /* the sink dies in the worker thread */
+    struct upipe *sink = bench_sink_alloc(
+            uprobe_pfx_alloc(uprobe_use(uprobe), UPROBE_LOG_LEVEL, "sink"));
+    bench_sink_report(sink, &bench->packets);
+    struct upipe *wsink = upipe_wsink_alloc(upipe_wsink_mgr,
+            uprobe_pfx_alloc(uprobe_use(uprobe), UPROBE_LOG_LEVEL, "wsink"),
+            sink,
+            uprobe_pfx_alloc(uprobe_use(uprobe), UPROBE_LOG_LEVEL,
+                             "wsink_x"),
+            WSINK_QUEUE);
+    assert(wsink != NULL);
+    upipe_mgr_release(upipe_wsink_mgr);
+    ubase_assert(upipe_attach_upump_mgr(wsink));
+
+    struct uref *flow_def = uref_block_flow_alloc_def(bench->uref_mgr, NULL);
+    assert(flow_def != NULL);
+    ubase_assert(upipe_set_flow_def(wsink, flow_def));
+    uref_free(flow_def);
+
+    struct xfer_feed feed;
+    feed.bench = bench;
+    feed.block_mgr = block_mgr;
+    feed.wsink = wsink;
+    struct upump *upump = upump_alloc_idler(upump_mgr, xfer_feed, &feed,
+                                            NULL);
+    assert(upump != NULL);
+    upump_start(upump);
+
+    bench_start(bench);
+    /* the loop returns after the worker thread is joined */
+    upump_mgr_run(upump_mgr, NULL);
+    assert(feed.wsink == NULL);
+    bench_stop(bench);
+
+    ubuf_mgr_release(block_mgr);
+    uprobe_release(uprobe);
+    upump_mgr_release(upump_mgr);
+}
+
+/** @This transfers datagrams to a worker thread placed by the scheduler.
+ *
+ * @param bench benchmark context
+ */
+void bench_xfer(struct bench *bench)
+{
+    bench_xfer_placement(bench, NULL);
+}
+
+/** @This transfers datagrams to a worker thread bound to another CPU than
+ * the main thread, which is bound to a single CPU for the duration of the
+ * benchmark.
+ *
+ * @param bench benchmark context
+ */
+void bench_xfer_pinned(struct bench *bench)
+{
+#ifdef UPIPE_HAVE_PTHREAD_SETAFFINITY_NP
+    cpu_set_t saved, cpuset;
+    assert(!pthread_getaffinity_np(pthread_self(), sizeof(saved), &saved));
+
+    /* use the first two CPUs we are allowed to run on */
+    unsigned int cpus[2];
+    unsigned int nb_cpus = 0;
+    for (unsigned int i = 0; i < CPU_SETSIZE && nb_cpus < 2; i++)
+        if (CPU_ISSET(i, &saved))
+            cpus[nb_cpus++] = i;
+    assert(nb_cpus);
+    if (nb_cpus < 2)
+        uprobe_warn(bench->uprobe, NULL,
+                    "only one CPU available, threads share it");
+
+    CPU_ZERO(&cpuset);
+    CPU_SET(cpus[0], &cpuset);
+    assert(!pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset));
+
+    struct upipe_pthread_placement placement;
+    upipe_pthread_placement_init(&placement);
+    placement.cpus = &cpus[nb_cpus - 1];
+    placement.nb_cpus = 1;
+    bench_xfer_placement(bench, &placement);
+
+    assert(!pthread_setaffinity_np(pthread_self(), sizeof(saved), &saved));
+#else
+    uprobe_warn(bench->uprobe, NULL, "CPU affinity is not supported");
+    bench_xfer_placement(bench, NULL);
+#endif
+}
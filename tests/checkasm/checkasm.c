@@ -80,6 +80,7 @@ static const struct {
 #endif
     { "v210dec", checkasm_check_v210dec },
     { "v210enc", checkasm_check_v210enc },
+    { "usound", checkasm_check_usound },
     { NULL, NULL }
 };
 
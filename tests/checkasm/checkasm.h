@@ -71,6 +71,7 @@ void checkasm_check_sdidec(void);
 void checkasm_check_sdienc(void);
 void checkasm_check_v210dec(void);
 void checkasm_check_v210enc(void);
+void checkasm_check_usound(void);
 
 struct CheckasmPerf;
 
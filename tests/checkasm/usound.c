@@ -0,0 +1,223 @@
+/*
+ * Copyright (C) 2017 OpenHeadend S.A.R.L.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "checkasm.h"
+#include "upipe/usound.h"
+
+#define BUF_SIZE 1024
+#define CHANNELS 2
+
+static unsigned int usound_cpu(void)
+{
+    int cpu_flags = av_get_cpu_flags();
+    unsigned int cpu = 0;
+    if (cpu_flags & AV_CPU_FLAG_SSE2)
+        cpu |= USOUND_CPU_SSE2;
+    if (cpu_flags & AV_CPU_FLAG_AVX2)
+        cpu |= USOUND_CPU_AVX2;
+    return cpu;
+}
+
+static void randomize_s16(int16_t *buf, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+        buf[i] = rnd();
+}
+
+static void randomize_s32(int32_t *buf, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+        buf[i] = rnd();
+}
+
+static void randomize_flt(float *buf, size_t size)
+{
+    /* go slightly beyond [-1.0, 1.0] to exercise clipping */
+    for (size_t i = 0; i < size; i++)
+        buf[i] = (float)(int32_t)rnd() * (1.25f / 2147483648.f);
+}
+
+static void check_peak(const struct usound_dsp *dsp)
+{
+    if (check_func(dsp->peak_s16, "usound_peak_s16")) {
+        int16_t src[BUF_SIZE];
+        declare_func(uint32_t, const int16_t *src, size_t samples);
+        for (size_t samples = 1; samples < BUF_SIZE; samples += 7) {
+            randomize_s16(src, BUF_SIZE);
+            if (samples % 3 == 0)
+                src[rnd() % samples] = INT16_MIN;
+            if (call_ref(src, samples) != call_new(src, samples))
+                fail();
+        }
+        bench_new(src, BUF_SIZE);
+    }
+    report("peak_s16");
+
+    if (check_func(dsp->peak_s32, "usound_peak_s32")) {
+        int32_t src[BUF_SIZE];
+        declare_func(uint32_t, const int32_t *src, size_t samples);
+        for (size_t samples = 1; samples < BUF_SIZE; samples += 7) {
+            randomize_s32(src, BUF_SIZE);
+            if (samples % 3 == 0)
+                src[rnd() % samples] = INT32_MIN;
+            if (call_ref(src, samples) != call_new(src, samples))
+                fail();
+        }
+        bench_new(src, BUF_SIZE);
+    }
+    report("peak_s32");
+
+    if (check_func(dsp->peak_flt, "usound_peak_flt")) {
+        float src[BUF_SIZE];
+        declare_func_float(float, const float *src, size_t samples);
+        for (size_t samples = 1; samples < BUF_SIZE; samples += 7) {
+            randomize_flt(src, BUF_SIZE);
+            if (call_ref(src, samples) != call_new(src, samples))
+                fail();
+        }
+        bench_new(src, BUF_SIZE);
+    }
+    report("peak_flt");
+}
+
+static void check_mix(const struct usound_dsp *dsp)
+{
+    if (check_func(dsp->mix_flt, "usound_mix_flt")) {
+        float src[BUF_SIZE * CHANNELS];
+        float dst0[BUF_SIZE * CHANNELS], dst1[BUF_SIZE * CHANNELS];
+        declare_func(void, float *dst, const float *src, size_t samples,
+                     uint8_t channels, float gain, float step);
+        for (uint8_t channels = 1; channels <= CHANNELS; channels++) {
+            for (size_t samples = 1; samples < BUF_SIZE; samples += 7) {
+                float gain = (float)(rnd() % 1000) / 1000.f;
+                float step = 1.f / 9600.f;
+                randomize_flt(src, BUF_SIZE * CHANNELS);
+                randomize_flt(dst0, BUF_SIZE * CHANNELS);
+                memcpy(dst1, dst0, sizeof(dst0));
+                call_ref(dst0, src, samples, channels, gain, step);
+                call_new(dst1, src, samples, channels, gain, step);
+                if (!float_near_ulp_array(dst0, dst1, 1,
+                                          BUF_SIZE * CHANNELS))
+                    fail();
+            }
+        }
+        bench_new(dst1, src, BUF_SIZE, 1, 0., 1.f / 9600.f);
+    }
+    report("mix_flt");
+}
+
+#define check_interleave(bits)                                              \
+    do {                                                                    \
+        if (check_func(dsp->interleave_##bits,                              \
+                       "usound_interleave_" #bits)) {                       \
+            int##bits##_t planes[CHANNELS][BUF_SIZE];                       \
+            const int##bits##_t *src[CHANNELS];                             \
+            int##bits##_t dst0[BUF_SIZE * CHANNELS];                        \
+            int##bits##_t dst1[BUF_SIZE * CHANNELS];                        \
+            declare_func(void, int##bits##_t *dst,                          \
+                         const int##bits##_t *const *src,                   \
+                         size_t samples, uint8_t channels);                 \
+            for (uint8_t c = 0; c < CHANNELS; c++) {                        \
+                randomize_s##bits(planes[c], BUF_SIZE);                     \
+                src[c] = planes[c];                                         \
+            }                                                               \
+            for (uint8_t channels = 1; channels <= CHANNELS; channels++) {  \
+                for (size_t samples = 1; samples < BUF_SIZE; samples += 7) {\
+                    memset(dst0, 0, sizeof(dst0));                          \
+                    memset(dst1, 0, sizeof(dst1));                          \
+                    call_ref(dst0, src, samples, channels);                 \
+                    call_new(dst1, src, samples, channels);                 \
+                    if (memcmp(dst0, dst1, sizeof(dst0)))                   \
+                        fail();                                             \
+                }                                                           \
+            }                                                               \
+            bench_new(dst1, src, BUF_SIZE, CHANNELS);                       \
+        }                                                                   \
+        report("interleave_" #bits);                                        \
+                                                                            \
+        if (check_func(dsp->deinterleave_##bits,                            \
+                       "usound_deinterleave_" #bits)) {                     \
+            int##bits##_t src[BUF_SIZE * CHANNELS];                         \
+            int##bits##_t planes0[CHANNELS][BUF_SIZE];                      \
+            int##bits##_t planes1[CHANNELS][BUF_SIZE];                      \
+            int##bits##_t *dst0[CHANNELS], *dst1[CHANNELS];                 \
+            declare_func(void, int##bits##_t *const *dst,                   \
+                         const int##bits##_t *src,                          \
+                         size_t samples, uint8_t channels);                 \
+            for (uint8_t c = 0; c < CHANNELS; c++) {                        \
+                dst0[c] = planes0[c];                                       \
+                dst1[c] = planes1[c];                                       \
+            }                                                               \
+            randomize_s##bits(src, BUF_SIZE * CHANNELS);                    \
+            for (uint8_t channels = 1; channels <= CHANNELS; channels++) {  \
+                for (size_t samples = 1; samples < BUF_SIZE; samples += 7) {\
+                    memset(planes0, 0, sizeof(planes0));                    \
+                    memset(planes1, 0, sizeof(planes1));                    \
+                    call_ref(dst0, src, samples, channels);                 \
+                    call_new(dst1, src, samples, channels);                 \
+                    if (memcmp(planes0, planes1, sizeof(planes0)))          \
+                        fail();                                             \
+                }                                                           \
+            }                                                               \
+            bench_new(dst1, src, BUF_SIZE, CHANNELS);                       \
+        }                                                                   \
+        report("deinterleave_" #bits);                                      \
+    } while (0)
+
+#define check_convert(type, name, from, to)                                 \
+    do {                                                                    \
+        if (check_func(dsp->name, "usound_" #name)) {                       \
+            from src[BUF_SIZE];                                             \
+            to dst0[BUF_SIZE], dst1[BUF_SIZE];                              \
+            declare_func(void, to *dst, const from *src, size_t values);    \
+            for (size_t values = 1; values < BUF_SIZE; values += 7) {       \
+                randomize_##type(src, BUF_SIZE);                            \
+                memset(dst0, 0, sizeof(dst0));                              \
+                memset(dst1, 0, sizeof(dst1));                              \
+                call_ref(dst0, src, values);                                \
+                call_new(dst1, src, values);                                \
+                if (memcmp(dst0, dst1, sizeof(dst0)))                       \
+                    fail();                                                 \
+            }                                                               \
+            bench_new(dst1, src, BUF_SIZE);                                 \
+        }                                                                   \
+        report(#name);                                                      \
+    } while (0)
+
+void checkasm_check_usound(void)
+{
+    struct usound_dsp s;
+    struct usound_dsp *dsp = &s;
+    usound_dsp_init_cpu(dsp, usound_cpu());
+
+    check_peak(dsp);
+    check_mix(dsp);
+    check_interleave(16);
+    check_interleave(32);
+    check_convert(s16, s16_to_flt, int16_t, float);
+    check_convert(flt, flt_to_s16, float, int16_t);
+    check_convert(s32, s32_to_flt, int32_t, float);
+    check_convert(flt, flt_to_s32, float, int32_t);
+}
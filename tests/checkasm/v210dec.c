@@ -69,14 +69,30 @@ static void randomize_buffers(void *src0, void *src1)
         declare_func(void, const void *src, type *y, type *u, type *v, ptrdiff_t width); \
         ptrdiff_t width, step = 12 / sizeof(type)
 
+#define declare_420(type) \
+        type y0[2][BUF_SIZE]; \
+        type y1[2][BUF_SIZE]; \
+        type u0[BUF_SIZE / 2]; \
+        type u1[BUF_SIZE / 2]; \
+        type v0[BUF_SIZE / 2]; \
+        type v1[BUF_SIZE / 2]; \
+        DECLARE_ALIGNED(32, uint32_t, src0)[2][BUF_SIZE * 8 / 3 / 4]; \
+        DECLARE_ALIGNED(32, uint32_t, src1)[2][BUF_SIZE * 8 / 3 / 4]; \
+        declare_func(void, const void *src0, const void *src1, type *y0, type *y1, type *u, type *v, ptrdiff_t width); \
+        ptrdiff_t width, step = 12 / sizeof(type)
+
 void checkasm_check_v210dec(void)
 {
     struct {
         void (*planar_10)(const void *src, uint16_t *y, uint16_t *u, uint16_t *v, uintptr_t pixels);
         void (*planar_8)(const void *src, uint8_t *y, uint8_t *u, uint8_t *v, uintptr_t pixels);
+        void (*yuv420p_10)(const void *src0, const void *src1, uint16_t *y0, uint16_t *y1, uint16_t *u, uint16_t *v, uintptr_t pixels);
+        void (*yuv420p_8)(const void *src0, const void *src1, uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v, uintptr_t pixels);
     } s = {
         .planar_10 = upipe_v210_to_planar_10_c,
         .planar_8  = upipe_v210_to_planar_8_c,
+        .yuv420p_10 = upipe_v210_to_yuv420p_10_c,
+        .yuv420p_8  = upipe_v210_to_yuv420p_8_c,
     };
 
     int cpu_flags = av_get_cpu_flags();
@@ -95,6 +111,14 @@ void checkasm_check_v210dec(void)
         s.planar_8  = upipe_v210_to_planar_8_aligned_avx2;
     }
 #endif
+#if defined(UPIPE_V210_AVX512) && defined(AV_CPU_FLAG_AVX512)
+    if (cpu_flags & AV_CPU_FLAG_AVX512) {
+        s.planar_10 = upipe_v210_to_planar_10_avx512;
+        s.planar_8  = upipe_v210_to_planar_8_avx512;
+        s.yuv420p_10 = upipe_v210_to_yuv420p_10_avx512;
+        s.yuv420p_8  = upipe_v210_to_yuv420p_8_avx512;
+    }
+#endif
 
     if (check_func(s.planar_8, "v210_to_planar8")) {
         declare(uint8_t);
@@ -121,4 +145,34 @@ void checkasm_check_v210dec(void)
         }
     }
     report("v210_to_planar10");
+
+    if (check_func(s.yuv420p_8, "v210_to_yuv420p8")) {
+        declare_420(uint8_t);
+        for (width = step; width < BUF_SIZE - 15; width += step) {
+            randomize_buffers(src0[0], src1[0]);
+            randomize_buffers(src0[1], src1[1]);
+            call_ref(src0[0], src0[1], y0[0], y0[1], u0, v0, width);
+            call_new(src1[0], src1[1], y1[0], y1[1], u1, v1, width);
+            if (memcmp(y0[0], y1[0], width) || memcmp(y0[1], y1[1], width) ||
+                memcmp(u0, u1, width / 2) || memcmp(v0, v1, width / 2))
+                fail();
+            bench_new(src1[0], src1[1], y1[0], y1[1], u1, v1, width);
+        }
+    }
+    report("v210_to_yuv420p8");
+
+    if (check_func(s.yuv420p_10, "v210_to_yuv420p10")) {
+        declare_420(uint16_t);
+        for (width = step; width < BUF_SIZE - 15; width += step) {
+            randomize_buffers(src0[0], src1[0]);
+            randomize_buffers(src0[1], src1[1]);
+            call_ref(src0[0], src0[1], y0[0], y0[1], u0, v0, width);
+            call_new(src1[0], src1[1], y1[0], y1[1], u1, v1, width);
+            if (memcmp(y0[0], y1[0], width * 2) || memcmp(y0[1], y1[1], width * 2) ||
+                memcmp(u0, u1, width) || memcmp(v0, v1, width))
+                fail();
+            bench_new(src1[0], src1[1], y1[0], y1[1], u1, v1, width);
+        }
+    }
+    report("v210_to_yuv420p10");
 }
@@ -101,6 +101,12 @@ void checkasm_check_v210enc(void)
         s.planar_8  = upipe_planar_to_v210_8_avx2;
     }
 #endif
+#if defined(UPIPE_V210_AVX512) && defined(AV_CPU_FLAG_AVX512)
+    if (cpu_flags & AV_CPU_FLAG_AVX512) {
+        s.planar_10 = upipe_planar_to_v210_10_avx512;
+        s.planar_8  = upipe_planar_to_v210_8_avx512;
+    }
+#endif
 
     if (check_func(s.planar_8, "planar_to_v210_8"))
         check_pack_line(uint8_t, 0xffffffff);
@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2017 OpenHeadend S.A.R.L.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** @file
+ * @short unit tests for ubuf manager for block formats wrapping libavutil
+ * buffers
+ */
+
+#undef NDEBUG
+
+#include <upipe/ubuf.h>
+#include <upipe/ubuf_block.h>
+#include <upipe-av/ubuf_block_av.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include <libavutil/buffer.h>
+
+#define UBUF_POOL_DEPTH     1
+#define BUF_SIZE            1316
+#define UBUF_OFFSET         16
+#define UBUF_SIZE           188
+
+int main(int argc, char **argv)
+{
+    struct ubuf_mgr *mgr = ubuf_block_av_mgr_alloc(UBUF_POOL_DEPTH);
+    assert(mgr != NULL);
+
+    AVBufferRef *buf = av_buffer_alloc(BUF_SIZE);
+    assert(buf != NULL);
+    for (int i = 0; i < BUF_SIZE; i++)
+        buf->data[i] = i;
+
+    /* out of bounds */
+    assert(ubuf_block_av_alloc(mgr, buf, buf->data + BUF_SIZE - UBUF_SIZE + 1,
+                               UBUF_SIZE) == NULL);
+
+    struct ubuf *ubuf1 = ubuf_block_av_alloc(mgr, buf, buf->data + UBUF_OFFSET,
+                                             UBUF_SIZE);
+    assert(ubuf1 != NULL);
+    av_buffer_unref(&buf);
+
+    size_t size;
+    ubase_assert(ubuf_block_size(ubuf1, &size));
+    assert(size == UBUF_SIZE);
+
+    AVBufferRef *ref;
+    size_t offset;
+    ubase_assert(ubuf_block_av_get_buffer(ubuf1, &ref, &offset, &size));
+    assert(offset == UBUF_OFFSET);
+    assert(size == UBUF_SIZE);
+    assert(ref->size == BUF_SIZE);
+
+    const uint8_t *r;
+    int wanted = -1;
+    ubase_assert(ubuf_block_read(ubuf1, 0, &wanted, &r));
+    assert(wanted == UBUF_SIZE);
+    assert(r[0] == UBUF_OFFSET);
+    ubase_assert(ubuf_block_unmap(ubuf1, 0));
+
+    /* the buffer is only referenced by ubuf1 */
+    uint8_t *w;
+    wanted = -1;
+    ubase_assert(ubuf_block_write(ubuf1, 0, &wanted, &w));
+    ubase_assert(ubuf_block_unmap(ubuf1, 0));
+
+    struct ubuf *ubuf2 = ubuf_block_splice(ubuf1, 1, UBUF_SIZE - 2);
+    assert(ubuf2 != NULL);
+    ubase_assert(ubuf_block_size(ubuf2, &size));
+    assert(size == UBUF_SIZE - 2);
+    ubase_assert(ubuf_block_av_get_buffer(ubuf2, NULL, &offset, NULL));
+    assert(offset == UBUF_OFFSET + 1);
+    ubase_assert(ubuf_block_read(ubuf2, 0, &wanted, &r));
+    assert(r[0] == UBUF_OFFSET + 1);
+    ubase_assert(ubuf_block_unmap(ubuf2, 0));
+
+    /* the buffer is now shared */
+    wanted = -1;
+    ubase_nassert(ubuf_block_write(ubuf1, 0, &wanted, &w));
+
+    struct ubuf *ubuf3 = ubuf_dup(ubuf2);
+    assert(ubuf3 != NULL);
+    ubuf_free(ubuf2);
+    ubase_assert(ubuf_block_size(ubuf3, &size));
+    assert(size == UBUF_SIZE - 2);
+    ubuf_free(ubuf3);
+
+    ubuf_free(ubuf1);
+
+    /* regular allocation */
+    ubuf1 = ubuf_block_alloc(mgr, UBUF_SIZE);
+    assert(ubuf1 != NULL);
+    ubase_assert(ubuf_block_size(ubuf1, &size));
+    assert(size == UBUF_SIZE);
+    wanted = -1;
+    ubase_assert(ubuf_block_write(ubuf1, 0, &wanted, &w));
+    assert(wanted == UBUF_SIZE);
+    ubase_assert(ubuf_block_unmap(ubuf1, 0));
+    ubuf_free(ubuf1);
+
+    ubuf_mgr_release(mgr);
+    return 0;
+}
@@ -35,6 +35,7 @@
 #include <upipe/ubuf_block.h>
 #include <upipe/ubuf_block_stream.h>
 #include <upipe/ubuf_block_mem.h>
+#include <upipe/ubuf_mem_common.h>
 
 #include <stdio.h>
 #include <string.h>
@@ -75,6 +76,15 @@ int main(int argc, char **argv)
     assert(wanted == UBUF_SIZE);
     ubase_assert(ubuf_block_unmap(ubuf1, 0));
 
+    struct ubuf_mem_shared *shared;
+    size_t shared_offset;
+    ubase_assert(ubuf_block_mem_get_shared(ubuf1, &shared, &shared_offset,
+                                           &size));
+    assert(size == UBUF_SIZE);
+    assert(shared_offset >= UBUF_PREPEND);
+    assert(ubuf_mem_shared_buffer(shared) + shared_offset == r);
+    assert(shared_offset + size + UBUF_APPEND <= umem_size(&shared->umem));
+
     wanted = -1;
     ubase_assert(ubuf_block_write(ubuf1, 0, &wanted, &w));
     assert(wanted == UBUF_SIZE);
@@ -37,6 +37,10 @@
 
 #define UREF_POOL_DEPTH 1
 #define TIME_SAMPLE 1429627742
+/** duration of the checks of each mode (50 ms) */
+#define TIME_DURATION (UCLOCK_FREQ / 20)
+/** tolerance between clock modes (20 ms) */
+#define TIME_TOLERANCE (UCLOCK_FREQ / 50)
 
 int main(int argc, char **argv)
 {
@@ -57,4 +61,30 @@ int main(int argc, char **argv)
            TIME_SAMPLE * UCLOCK_FREQ);
     uclock_release(uclock);
     uclock_release(uclock_cal);
+
+    /* the other modes read the same clock */
+    static const enum uclock_std_flags modes[] = {
+        UCLOCK_FLAG_COARSE, UCLOCK_FLAG_TSC,
+        UCLOCK_FLAG_REALTIME | UCLOCK_FLAG_COARSE,
+        UCLOCK_FLAG_REALTIME | UCLOCK_FLAG_TSC,
+    };
+    for (int i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+        uclock = uclock_std_alloc(modes[i] & UCLOCK_FLAG_REALTIME);
+        struct uclock *uclock_mode = uclock_std_alloc(modes[i]);
+        assert(uclock);
+        assert(uclock_mode);
+        /* run long enough for the TSC to be calibrated several times */
+        uint64_t first = uclock_now(uclock_mode);
+        uint64_t last = first;
+        while (last - first < TIME_DURATION) {
+            now = uclock_now(uclock_mode);
+            assert(now >= last);
+            last = now;
+        }
+        now = uclock_now(uclock);
+        /* coarse clocks lag by up to a kernel tick */
+        assert(last < now + TIME_TOLERANCE && now < last + TIME_TOLERANCE);
+        uclock_release(uclock);
+        uclock_release(uclock_mode);
+    }
 }
@@ -130,7 +130,39 @@ int main(int argc, char **argv)
     udict_dump(udict2, uprobe);
     udict_free(udict2);
 
+    /* shared duplicates share the attributes until one of them is
+     * modified */
+    udict2 = udict_share(udict1);
+    assert(udict2 != NULL);
+    struct udict *udict3 = udict_share(udict2);
+    assert(udict3 != NULL);
+    ubase_assert(udict_set_unsigned(udict2, 42, UDICT_TYPE_CLOCK_DURATION,
+                                    NULL));
+    ubase_assert(udict_delete(udict3, UDICT_TYPE_BOOL, "x.truc"));
+    ubase_assert(udict_get_unsigned(udict1, &u, UDICT_TYPE_CLOCK_DURATION,
+                                    NULL));
+    assert(u == UINT64_MAX);
+    ubase_assert(udict_get_unsigned(udict2, &u, UDICT_TYPE_CLOCK_DURATION,
+                                    NULL));
+    assert(u == 42);
+    ubase_assert(udict_get_unsigned(udict3, &u, UDICT_TYPE_CLOCK_DURATION,
+                                    NULL));
+    assert(u == UINT64_MAX);
+    ubase_assert(udict_get_bool(udict1, &b, UDICT_TYPE_BOOL, "x.truc"));
+    ubase_assert(udict_get_bool(udict2, &b, UDICT_TYPE_BOOL, "x.truc"));
+    ubase_nassert(udict_get_bool(udict3, &b, UDICT_TYPE_BOOL, "x.truc"));
+    udict_free(udict2);
+
+    /* the last duplicate keeps the shared attributes */
+    udict2 = udict_share(udict1);
+    assert(udict2 != NULL);
     udict_free(udict1);
+    ubase_assert(udict_get_string(udict2, &string, UDICT_TYPE_STRING,
+                                  "x.salutation"));
+    assert(!strcmp(string, SALUTATION));
+    udict_free(udict2);
+    udict_free(udict3);
+
     udict_mgr_release(mgr);
 
     umem_mgr_release(umem_mgr);
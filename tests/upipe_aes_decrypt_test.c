@@ -0,0 +1,307 @@
+/*
+ * Copyright (C) 2017 OpenHeadend S.A.R.L.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** @file
+ * @short unit tests for aes decrypt pipes
+ */
+
+#undef NDEBUG
+
+#include <upipe/uprobe.h>
+#include <upipe/uprobe_stdio.h>
+#include <upipe/uprobe_prefix.h>
+#include <upipe/uprobe_ubuf_mem.h>
+#include <upipe/umem.h>
+#include <upipe/umem_alloc.h>
+#include <upipe/udict.h>
+#include <upipe/udict_inline.h>
+#include <upipe/ubuf.h>
+#include <upipe/ubuf_block.h>
+#include <upipe/ubuf_block_mem.h>
+#include <upipe/uref.h>
+#include <upipe/uref_block_flow.h>
+#include <upipe/uref_block.h>
+#include <upipe/uref_std.h>
+#include <upipe/upipe.h>
+#include <upipe-modules/upipe_aes_decrypt.h>
+#include <upipe-modules/uref_aes_flow.h>
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#define UDICT_POOL_DEPTH 10
+#define UREF_POOL_DEPTH 10
+#define UBUF_POOL_DEPTH 10
+#define UPROBE_LOG_LEVEL UPROBE_LOG_DEBUG
+
+/** number of times the known-answer ciphertext is repeated */
+#define REPEATS 16
+#define BLOCKS (4 * REPEATS)
+/** one input out of SHARED_PERIOD is also referenced by the test */
+#define SHARED_PERIOD 3
+
+/* NIST SP 800-38A, F.2.5 CBC-AES128.Decrypt */
+static const uint8_t key[16] = {
+    0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6,
+    0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c
+};
+static const uint8_t iv[16] = {
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+    0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f
+};
+static const uint8_t ciphertext[4][16] = {
+    { 0x76, 0x49, 0xab, 0xac, 0x81, 0x19, 0xb2, 0x46,
+      0xce, 0xe9, 0x8e, 0x9b, 0x12, 0xe9, 0x19, 0x7d },
+    { 0x50, 0x86, 0xcb, 0x9b, 0x50, 0x72, 0x19, 0xee,
+      0x95, 0xdb, 0x11, 0x3a, 0x91, 0x76, 0x78, 0xb2 },
+    { 0x73, 0xbe, 0xd6, 0xb8, 0xe3, 0xc1, 0x74, 0x3b,
+      0x71, 0x16, 0xe6, 0x9e, 0x22, 0x22, 0x95, 0x16 },
+    { 0x3f, 0xf1, 0xca, 0xa1, 0x68, 0x1f, 0xac, 0x09,
+      0x12, 0x0e, 0xca, 0x30, 0x75, 0x86, 0xe1, 0xa7 },
+};
+static const uint8_t plaintext[4][16] = {
+    { 0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96,
+      0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a },
+    { 0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c,
+      0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51 },
+    { 0x30, 0xc8, 0x1c, 0x46, 0xa3, 0x5c, 0xe4, 0x11,
+      0xe5, 0xfb, 0xc1, 0x19, 0x1a, 0x0a, 0x52, 0xef },
+    { 0xf6, 0x9f, 0x24, 0x45, 0xdf, 0x4f, 0x9b, 0x17,
+      0xad, 0x2b, 0x41, 0x7b, 0xe6, 0x6c, 0x37, 0x10 },
+};
+
+/** sizes of the input urefs, so that blocks span several segments */
+static const int chunks[] = { 1, 7, 16, 33, 100, 15, 250, 2, 129, 64 };
+
+static uint8_t output[BLOCKS * 16];
+static size_t output_size = 0;
+
+/** definition of our uprobe */
+static int catch(struct uprobe *uprobe, struct upipe *upipe,
+                 int event, va_list args)
+{
+    switch (event) {
+        default:
+            assert(0);
+            break;
+        case UPROBE_READY:
+        case UPROBE_DEAD:
+        case UPROBE_NEW_FLOW_DEF:
+            break;
+    }
+    return UBASE_ERR_NONE;
+}
+
+/** helper phony pipe */
+static struct upipe *test_alloc(struct upipe_mgr *mgr, struct uprobe *uprobe,
+                                uint32_t signature, va_list args)
+{
+    struct upipe *upipe = malloc(sizeof(struct upipe));
+    assert(upipe != NULL);
+    upipe_init(upipe, mgr, uprobe);
+    return upipe;
+}
+
+/** helper phony pipe */
+static void test_input(struct upipe *upipe, struct uref *uref,
+                       struct upump **upump_p)
+{
+    size_t size;
+    ubase_assert(uref_block_size(uref, &size));
+    assert(size % 16 == 0);
+    assert(output_size + size <= sizeof(output));
+    ubase_assert(uref_block_extract(uref, 0, size, output + output_size));
+    output_size += size;
+    uref_free(uref);
+}
+
+/** helper phony pipe */
+static int test_control(struct upipe *upipe, int command, va_list args)
+{
+    switch (command) {
+        case UPIPE_SET_FLOW_DEF:
+        case UPIPE_REGISTER_REQUEST:
+        case UPIPE_UNREGISTER_REQUEST:
+            return UBASE_ERR_NONE;
+        default:
+            assert(0);
+            return UBASE_ERR_UNHANDLED;
+    }
+}
+
+/** helper phony pipe */
+static void test_free(struct upipe *upipe)
+{
+    upipe_clean(upipe);
+    free(upipe);
+}
+
+/** helper phony pipe */
+static struct upipe_mgr aes_test_mgr = {
+    .refcount = NULL,
+    .upipe_alloc = test_alloc,
+    .upipe_input = test_input,
+    .upipe_control = test_control
+};
+
+/** @This decrypts the repeated known-answer ciphertext, and checks the
+ * output.
+ */
+static void test_decrypt(struct upipe_mgr *upipe_aes_decrypt_mgr,
+                         struct uprobe *uprobe, struct uref_mgr *uref_mgr,
+                         struct ubuf_mgr *ubuf_mgr, struct uref *flow_def,
+                         struct upipe *sink, bool aesni)
+{
+    struct upipe *upipe = upipe_void_alloc(upipe_aes_decrypt_mgr,
+            uprobe_pfx_alloc(uprobe_use(uprobe), UPROBE_LOG_LEVEL,
+                             aesni ? "aesni" : "aes"));
+    assert(upipe != NULL);
+    ubase_assert(upipe_aes_decrypt_set_aesni(upipe, aesni));
+    bool get_aesni;
+    ubase_assert(upipe_aes_decrypt_get_aesni(upipe, &get_aesni));
+    assert(get_aesni == aesni);
+    ubase_assert(upipe_set_flow_def(upipe, flow_def));
+    ubase_assert(upipe_set_output(upipe, sink));
+
+    struct uref *shared[BLOCKS * 16];
+    size_t shared_offsets[BLOCKS * 16];
+    unsigned int nb_shared = 0;
+    output_size = 0;
+    size_t offset = 0;
+    for (unsigned int i = 0; offset < BLOCKS * 16; i++) {
+        int size = chunks[i % UBASE_ARRAY_SIZE(chunks)];
+        if (size > BLOCKS * 16 - offset)
+            size = BLOCKS * 16 - offset;
+        struct uref *uref = uref_block_alloc(uref_mgr, ubuf_mgr, size);
+        assert(uref != NULL);
+        for (int j = 0; j < size; ) {
+            int wsize = size - j;
+            uint8_t *wbuf;
+            ubase_assert(uref_block_write(uref, j, &wsize, &wbuf));
+            for (int k = 0; k < wsize; k++, j++)
+                wbuf[k] = ciphertext[((offset + j) / 16) % 4][(offset + j) % 16];
+            ubase_assert(uref_block_unmap(uref, j - wsize));
+        }
+        if (!(i % SHARED_PERIOD)) {
+            /* the input buffer must not be modified */
+            shared[nb_shared] = uref_dup(uref);
+            assert(shared[nb_shared] != NULL);
+            shared_offsets[nb_shared] = offset;
+            nb_shared++;
+        }
+        offset += size;
+        upipe_input(upipe, uref, NULL);
+    }
+    assert(output_size == BLOCKS * 16);
+
+    for (unsigned int i = 0; i < BLOCKS; i++) {
+        uint8_t expected[16];
+        memcpy(expected, plaintext[i % 4], 16);
+        if (i && !(i % 4))
+            /* the previous ciphertext block is the last one of the vector */
+            for (unsigned int j = 0; j < 16; j++)
+                expected[j] ^= iv[j] ^ ciphertext[3][j];
+        assert(!memcmp(output + i * 16, expected, 16));
+    }
+
+    for (unsigned int i = 0; i < nb_shared; i++) {
+        size_t size;
+        ubase_assert(uref_block_size(shared[i], &size));
+        uint8_t buffer[size];
+        ubase_assert(uref_block_extract(shared[i], 0, size, buffer));
+        for (size_t j = 0; j < size; j++) {
+            size_t k = shared_offsets[i] + j;
+            assert(buffer[j] == ciphertext[(k / 16) % 4][k % 16]);
+        }
+        uref_free(shared[i]);
+    }
+
+    upipe_release(upipe);
+}
+
+int main(int argc, char *argv[])
+{
+    struct umem_mgr *umem_mgr = umem_alloc_mgr_alloc();
+    assert(umem_mgr != NULL);
+    struct udict_mgr *udict_mgr = udict_inline_mgr_alloc(UDICT_POOL_DEPTH,
+                                                         umem_mgr, -1, -1);
+    assert(udict_mgr != NULL);
+    struct uref_mgr *uref_mgr = uref_std_mgr_alloc(UREF_POOL_DEPTH, udict_mgr,
+                                                   0);
+    assert(uref_mgr != NULL);
+    struct ubuf_mgr *ubuf_mgr = ubuf_block_mem_mgr_alloc(UBUF_POOL_DEPTH,
+                                                         UBUF_POOL_DEPTH,
+                                                         umem_mgr, 0, 0, -1, 0);
+    assert(ubuf_mgr != NULL);
+    struct uprobe uprobe;
+    uprobe_init(&uprobe, catch, NULL);
+    struct uprobe *logger = uprobe_stdio_alloc(&uprobe, stdout,
+                                               UPROBE_LOG_LEVEL);
+    assert(logger != NULL);
+    logger = uprobe_ubuf_mem_alloc(logger, umem_mgr, UBUF_POOL_DEPTH,
+                                   UBUF_POOL_DEPTH);
+    assert(logger != NULL);
+
+    struct uref *flow_def = uref_block_flow_alloc_def(uref_mgr, "aes.");
+    assert(flow_def != NULL);
+    ubase_assert(uref_aes_set_method(flow_def, "AES-128"));
+    ubase_assert(uref_aes_set_key(flow_def, key, sizeof(key)));
+    ubase_assert(uref_aes_set_iv(flow_def, iv, sizeof(iv)));
+
+    struct upipe *sink = upipe_void_alloc(&aes_test_mgr, uprobe_use(logger));
+    assert(sink != NULL);
+
+    struct upipe_mgr *upipe_aes_decrypt_mgr = upipe_aes_decrypt_mgr_alloc();
+    assert(upipe_aes_decrypt_mgr != NULL);
+
+    test_decrypt(upipe_aes_decrypt_mgr, logger, uref_mgr, ubuf_mgr,
+                 flow_def, sink, false);
+
+    struct upipe *upipe = upipe_void_alloc(upipe_aes_decrypt_mgr,
+                                           uprobe_use(logger));
+    assert(upipe != NULL);
+    bool aesni;
+    ubase_assert(upipe_aes_decrypt_get_aesni(upipe, &aesni));
+    upipe_release(upipe);
+    if (aesni)
+        test_decrypt(upipe_aes_decrypt_mgr, logger, uref_mgr, ubuf_mgr,
+                     flow_def, sink, true);
+    else
+        printf("AES-NI is not supported\n");
+
+    uref_free(flow_def);
+    upipe_mgr_release(upipe_aes_decrypt_mgr); // nop
+    test_free(sink);
+
+    uref_mgr_release(uref_mgr);
+    ubuf_mgr_release(ubuf_mgr);
+    udict_mgr_release(udict_mgr);
+    umem_mgr_release(umem_mgr);
+    uprobe_release(logger);
+    uprobe_clean(&uprobe);
+
+    return 0;
+}
@@ -0,0 +1,345 @@
+/*
+ * Copyright (C) 2017 OpenHeadend S.A.R.L.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/** @file
+ * @short unit tests for the read-ahead mode of avformat source pipes
+ */
+
+#undef NDEBUG
+
+#include <upipe/uprobe.h>
+#include <upipe/uprobe_stdio.h>
+#include <upipe/uprobe_prefix.h>
+#include <upipe/uprobe_uref_mgr.h>
+#include <upipe/uprobe_upump_mgr.h>
+#include <upipe/uprobe_ubuf_mem.h>
+#include <upipe/uclock.h>
+#include <upipe/umem.h>
+#include <upipe/umem_alloc.h>
+#include <upipe/udict.h>
+#include <upipe/udict_inline.h>
+#include <upipe/uref.h>
+#include <upipe/uref_std.h>
+#include <upipe/uref_block.h>
+#include <upipe/uref_flow.h>
+#include <upipe/upump.h>
+#include <upump-ev/upump_ev.h>
+#include <upipe/upipe.h>
+#include <upipe-av/upipe_av.h>
+#include <upipe-av/upipe_avformat_source.h>
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <assert.h>
+
+#define UDICT_POOL_DEPTH 10
+#define UREF_POOL_DEPTH 10
+#define UBUF_POOL_DEPTH 10
+#define UPUMP_POOL 1
+#define UPUMP_BLOCKER_POOL 1
+#define UPROBE_LOG_LEVEL UPROBE_LOG_DEBUG
+#define READAHEAD 4
+#define DATA_SIZE (256 * 1024)
+#define SLOW_SINK_DELAY 20000
+#define RELEASE_DELAY (UCLOCK_FREQ / 10)
+
+static struct uprobe *logger;
+static struct upipe *upipe_avfsrc;
+static struct upipe *upipe_sink;
+static unsigned int nb_flows;
+/** true if the sink sleeps on every packet instead of the first one */
+static bool slow_sink;
+static uint64_t nb_packets;
+static uint64_t nb_bytes;
+static bool source_end;
+static bool dead;
+
+/** definition of our uprobe */
+static int catch(struct uprobe *uprobe, struct upipe *upipe,
+                 int event, va_list args)
+{
+    switch (event) {
+        default:
+            assert(0);
+            break;
+        case UPROBE_READY:
+        case UPROBE_LOG:
+        case UPROBE_NEW_FLOW_DEF:
+        case UPROBE_CLOCK_REF:
+        case UPROBE_CLOCK_TS:
+            break;
+        case UPROBE_NEED_OUTPUT:
+            /* the source itself only outputs an empty void flow */
+            if (upipe != upipe_avfsrc)
+                ubase_assert(upipe_set_output(upipe, upipe_sink));
+            break;
+        case UPROBE_PROVIDE_REQUEST:
+            /* the source runs without a clock */
+            break;
+        case UPROBE_DEAD:
+            if (upipe == upipe_avfsrc)
+                dead = true;
+            break;
+        case UPROBE_SPLIT_UPDATE: {
+            /* also thrown when the source is released */
+            if (upipe != upipe_avfsrc || nb_flows)
+                break;
+            struct uref *flow_def = NULL;
+            while (ubase_check(upipe_split_iterate(upipe, &flow_def)) &&
+                   flow_def != NULL) {
+                uint64_t id;
+                ubase_assert(uref_flow_get_id(flow_def, &id));
+                struct upipe *upipe_avfsrc_output =
+                    upipe_flow_alloc_sub(upipe,
+                        uprobe_pfx_alloc_va(uprobe_use(logger),
+                                            UPROBE_LOG_LEVEL,
+                                            "src %"PRIu64, id), flow_def);
+                assert(upipe_avfsrc_output != NULL);
+                nb_flows++;
+            }
+            assert(nb_flows == 1);
+            break;
+        }
+        case UPROBE_SOURCE_END:
+            if (upipe == upipe_avfsrc) {
+                /* the queue is empty at the end of file */
+                unsigned int packets, max_packets;
+                uint64_t bytes, duration, max_bytes, max_duration;
+                ubase_assert(upipe_avfsrc_get_readahead_stats(upipe,
+                            &packets, &bytes, &duration, &max_packets,
+                            &max_bytes, &max_duration));
+                assert(packets == 0);
+                assert(bytes == 0);
+                assert(max_packets == READAHEAD);
+                source_end = true;
+            }
+            upipe_release(upipe);
+            break;
+    }
+    return UBASE_ERR_NONE;
+}
+
+/** helper phony pipe */
+static struct upipe *test_alloc(struct upipe_mgr *mgr, struct uprobe *uprobe,
+                                uint32_t signature, va_list args)
+{
+    struct upipe *upipe = malloc(sizeof(struct upipe));
+    assert(upipe != NULL);
+    upipe_init(upipe, mgr, uprobe);
+    return upipe;
+}
+
+/** helper phony pipe */
+static void test_input(struct upipe *upipe, struct uref *uref,
+                       struct upump **upump_p)
+{
+    size_t size;
+    ubase_assert(uref_block_size(uref, &size));
+    uref_free(uref);
+    nb_bytes += size;
+
+    if (slow_sink) {
+        usleep(SLOW_SINK_DELAY);
+    } else if (!nb_packets++) {
+        /* let the reader thread fill the queue while the packet is
+         * processed */
+        usleep(SLOW_SINK_DELAY * 5);
+        unsigned int packets, max_packets;
+        uint64_t bytes, duration, max_bytes, max_duration;
+        ubase_assert(upipe_avfsrc_get_readahead_stats(upipe_avfsrc,
+                    &packets, &bytes, &duration, &max_packets,
+                    &max_bytes, &max_duration));
+        assert(packets == READAHEAD);
+        assert(bytes > 0);
+        assert(max_packets >= 1);
+    }
+}
+
+/** helper phony pipe */
+static int test_control(struct upipe *upipe, int command, va_list args)
+{
+    switch (command) {
+        case UPIPE_SET_FLOW_DEF:
+            return UBASE_ERR_NONE;
+        case UPIPE_REGISTER_REQUEST: {
+            struct urequest *urequest = va_arg(args, struct urequest *);
+            return upipe_throw_provide_request(upipe, urequest);
+        }
+        case UPIPE_UNREGISTER_REQUEST:
+            return UBASE_ERR_NONE;
+        default:
+            assert(0);
+            return UBASE_ERR_UNHANDLED;
+    }
+}
+
+/** helper phony pipe */
+static void test_free(struct upipe *upipe)
+{
+    upipe_clean(upipe);
+    free(upipe);
+}
+
+/** helper phony pipe */
+static struct upipe_mgr test_mgr = {
+    .refcount = NULL,
+    .upipe_alloc = test_alloc,
+    .upipe_input = test_input,
+    .upipe_control = test_control
+};
+
+/** writes a little-endian integer to a file */
+static void write_le(FILE *file, uint32_t value, int size)
+{
+    for (int i = 0; i < size; i++)
+        assert(fputc((value >> (8 * i)) & 0xff, file) != EOF);
+}
+
+/** writes a WAV file with DATA_SIZE octets of 16-bit stereo PCM */
+static void write_wav(const char *path)
+{
+    FILE *file = fopen(path, "wb");
+    assert(file != NULL);
+    assert(fwrite("RIFF", 4, 1, file) == 1);
+    write_le(file, 36 + DATA_SIZE, 4);
+    assert(fwrite("WAVEfmt ", 8, 1, file) == 1);
+    write_le(file, 16, 4);
+    write_le(file, 1, 2); /* PCM */
+    write_le(file, 2, 2); /* channels */
+    write_le(file, 48000, 4);
+    write_le(file, 48000 * 4, 4);
+    write_le(file, 4, 2); /* block align */
+    write_le(file, 16, 2);
+    assert(fwrite("data", 4, 1, file) == 1);
+    write_le(file, DATA_SIZE, 4);
+    for (int i = 0; i < DATA_SIZE; i++)
+        assert(fputc(i & 0xff, file) != EOF);
+    assert(fclose(file) == 0);
+}
+
+/** allocates a source in read-ahead mode */
+static void alloc_source(struct upipe_mgr *upipe_avfsrc_mgr, const char *path)
+{
+    nb_flows = 0;
+    upipe_avfsrc = upipe_void_alloc(upipe_avfsrc_mgr,
+            uprobe_pfx_alloc(uprobe_use(logger), UPROBE_LOG_LEVEL, "avfsrc"));
+    assert(upipe_avfsrc != NULL);
+    ubase_assert(upipe_avfsrc_set_readahead(upipe_avfsrc, READAHEAD, 0, 0));
+    ubase_assert(upipe_set_uri(upipe_avfsrc, path));
+}
+
+/** releases the source while the reader thread waits for room */
+static void release_source(struct upump *upump)
+{
+    unsigned int packets, max_packets;
+    uint64_t bytes, duration, max_bytes, max_duration;
+    ubase_assert(upipe_avfsrc_get_readahead_stats(upipe_avfsrc,
+                &packets, &bytes, &duration, &max_packets,
+                &max_bytes, &max_duration));
+    assert(packets == READAHEAD);
+    upipe_release(upipe_avfsrc);
+    upump_stop(upump);
+}
+
+int main(int argc, char *argv[])
+{
+    char path[] = "/tmp/upipe_avformat_source_test.XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd != -1);
+    close(fd);
+    write_wav(path);
+
+    struct umem_mgr *umem_mgr = umem_alloc_mgr_alloc();
+    assert(umem_mgr != NULL);
+    struct udict_mgr *udict_mgr = udict_inline_mgr_alloc(UDICT_POOL_DEPTH,
+                                                         umem_mgr, -1, -1);
+    assert(udict_mgr != NULL);
+    struct uref_mgr *uref_mgr = uref_std_mgr_alloc(UREF_POOL_DEPTH, udict_mgr,
+                                                   0);
+    assert(uref_mgr != NULL);
+    struct upump_mgr *upump_mgr = upump_ev_mgr_alloc_default(UPUMP_POOL,
+            UPUMP_BLOCKER_POOL);
+    assert(upump_mgr != NULL);
+    struct uprobe uprobe;
+    uprobe_init(&uprobe, catch, NULL);
+    logger = uprobe_stdio_alloc(&uprobe, stdout, UPROBE_LOG_LEVEL);
+    assert(logger != NULL);
+    logger = uprobe_uref_mgr_alloc(logger, uref_mgr);
+    assert(logger != NULL);
+    logger = uprobe_upump_mgr_alloc(logger, upump_mgr);
+    assert(logger != NULL);
+    logger = uprobe_ubuf_mem_alloc(logger, umem_mgr, UBUF_POOL_DEPTH,
+                                   UBUF_POOL_DEPTH);
+    assert(logger != NULL);
+
+    assert(upipe_av_init(false, uprobe_use(logger)));
+
+    upipe_sink = upipe_void_alloc(&test_mgr,
+            uprobe_pfx_alloc(uprobe_use(logger), UPROBE_LOG_LEVEL, "sink"));
+    assert(upipe_sink != NULL);
+
+    struct upipe_mgr *upipe_avfsrc_mgr = upipe_avfsrc_mgr_alloc();
+    assert(upipe_avfsrc_mgr != NULL);
+
+    /* read the whole file through a backlog of full slots */
+    alloc_source(upipe_avfsrc_mgr, path);
+    upump_mgr_run(upump_mgr, NULL);
+    assert(source_end);
+    assert(dead);
+    assert(nb_bytes == DATA_SIZE);
+
+    /* release the source while the reader thread is blocked */
+    source_end = dead = false;
+    slow_sink = true;
+    nb_bytes = 0;
+    alloc_source(upipe_avfsrc_mgr, path);
+    struct upump *upump = upump_alloc_timer(upump_mgr, release_source, NULL,
+                                            NULL, RELEASE_DELAY, 0);
+    assert(upump != NULL);
+    upump_start(upump);
+    upump_mgr_run(upump_mgr, NULL);
+    upump_free(upump);
+    assert(!source_end);
+    assert(dead);
+    assert(nb_bytes < DATA_SIZE);
+
+    upipe_mgr_release(upipe_avfsrc_mgr); // nop
+    test_free(upipe_sink);
+
+    upipe_av_clean();
+
+    upump_mgr_release(upump_mgr);
+    uref_mgr_release(uref_mgr);
+    udict_mgr_release(udict_mgr);
+    umem_mgr_release(umem_mgr);
+    uprobe_release(logger);
+    uprobe_clean(&uprobe);
+
+    unlink(path);
+    return 0;
+}
@@ -39,6 +39,7 @@
 #include <upipe/uref.h>
 #include <upipe/uref_std.h>
 #include <upipe/uref_flow.h>
+#include <upipe/uref_clock.h>
 #include <upipe/uref_block_flow.h>
 #include <upipe/uref_dump.h>
 #include <upipe/upipe.h>
@@ -89,6 +90,12 @@ static void test_input(struct upipe *upipe, struct uref *uref,
 {
     assert(uref != NULL);
     counter++;
+    /* each output must see the attributes of the input */
+    uint64_t duration;
+    if (ubase_check(uref_clock_get_duration(uref, &duration))) {
+        assert(duration == 42);
+        ubase_assert(uref_clock_set_duration(uref, 43));
+    }
     uref_free(uref);
 }
 
@@ -194,6 +201,20 @@ int main(int argc, char *argv[])
     assert(counter == 2);
     assert(flow_foo_counter == 1);
     assert(flow_bar_counter == 2);
+    counter = 0;
+
+    bool shared;
+    ubase_assert(upipe_dup_get_shared(upipe_dup, &shared));
+    assert(!shared);
+    ubase_assert(upipe_dup_set_shared(upipe_dup, true));
+    ubase_assert(upipe_dup_get_shared(upipe_dup, &shared));
+    assert(shared);
+
+    uref = uref_alloc(uref_mgr);
+    assert(uref != NULL);
+    ubase_assert(uref_clock_set_duration(uref, 42));
+    upipe_input(upipe_dup, uref, NULL);
+    assert(counter == 2);
 
     upipe_release(upipe_dup);
     upipe_release(upipe_dup_output0);
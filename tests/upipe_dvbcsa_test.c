@@ -1,9 +1,113 @@
 #include <upipe/ubase.h>
+#include <upipe/ulist.h>
 
 #include <upipe-dvbcsa/upipe_dvbcsa_common.h>
 
+#include "../lib/upipe-dvbcsa/common.h"
+
+#include <stdarg.h>
+
+static int batch_control(struct upipe_dvbcsa_batch *batch, uint64_t latency,
+                         int command, ...)
+{
+    va_list args;
+    va_start(args, command);
+    int err = upipe_dvbcsa_batch_control(batch, latency, command, args);
+    va_end(args);
+    return err;
+}
+
+static void test_batch(void)
+{
+    struct upipe_dvbcsa_batch batch;
+    unsigned target, fill;
+    uint64_t latency;
+
+    /* fixed size batches */
+    upipe_dvbcsa_batch_init(&batch, 8);
+    assert(upipe_dvbcsa_batch_target(&batch, 10000) == 8);
+    for (unsigned i = 1; i < 8; i++)
+        assert(!upipe_dvbcsa_batch_add(&batch, i, i * 1000, 0, 100));
+    assert(upipe_dvbcsa_batch_add(&batch, 8, 8000, 0, 100));
+    upipe_dvbcsa_batch_done(&batch, 8, 500);
+    assert(batch.first_cr_sys == UINT64_MAX);
+    assert(batch.interval == 1000);
+
+    ubase_assert(batch_control(&batch, 10000, UPIPE_DVBCSA_GET_BATCH_STATS,
+                               UPIPE_DVBCSA_COMMON_SIGNATURE,
+                               &target, &fill, &latency));
+    assert(target == 8);
+    assert(fill == 100);
+    assert(latency == 500);
+    ubase_assert(batch_control(&batch, 10000, UPIPE_DVBCSA_GET_BATCH_STATS,
+                               UPIPE_DVBCSA_COMMON_SIGNATURE,
+                               &target, &fill, &latency));
+    assert(fill == 0);
+    assert(latency == 0);
+
+    /* adaptive batches, one packet every 1000 */
+    upipe_dvbcsa_batch_init(&batch, 64);
+    ubase_assert(batch_control(&batch, 10000, UPIPE_DVBCSA_SET_ADAPTIVE,
+                               UPIPE_DVBCSA_COMMON_SIGNATURE, 1));
+    assert(batch.adaptive);
+    /* no rate known yet */
+    assert(upipe_dvbcsa_batch_target(&batch, 10000) == 64);
+    assert(!upipe_dvbcsa_batch_add(&batch, 1, 0, 0, 10000));
+    /* the first packet must not wait more than the latency, so 11 packets
+     * (at 0 to 10000) fit in a batch */
+    for (unsigned i = 1; i < 10; i++)
+        assert(!upipe_dvbcsa_batch_add(&batch, i + 1, i * 1000, 0, 10000));
+    assert(upipe_dvbcsa_batch_add(&batch, 11, 10000, 0, 10000));
+    assert(upipe_dvbcsa_batch_target(&batch, 10000) == 11);
+    upipe_dvbcsa_batch_done(&batch, 11, UINT64_MAX);
+
+    /* packets without a date only close full batches */
+    for (unsigned i = 1; i < 64; i++)
+        assert(!upipe_dvbcsa_batch_add(&batch, i, UINT64_MAX, 0, 10000));
+    assert(upipe_dvbcsa_batch_add(&batch, 64, UINT64_MAX, 0, 10000));
+    upipe_dvbcsa_batch_done(&batch, 64, UINT64_MAX);
+
+    /* latency lower than the interval */
+    assert(upipe_dvbcsa_batch_target(&batch, 999) == 1);
+    assert(upipe_dvbcsa_batch_add(&batch, 1, 20000, 0, 999));
+    upipe_dvbcsa_batch_done(&batch, 1, UINT64_MAX);
+
+    /* high rate inputs fill the batches */
+    assert(upipe_dvbcsa_batch_target(&batch, UINT64_MAX - 1) == 64);
+
+    /* dates going backwards don't change the interval */
+    uint64_t interval = batch.interval;
+    assert(!upipe_dvbcsa_batch_add(&batch, 1, 15000, 0, 10000));
+    assert(batch.interval == interval);
+    upipe_dvbcsa_batch_done(&batch, 1, UINT64_MAX);
+
+    /* the interval follows rate changes by 1/8 of the difference */
+    batch.interval = 1000;
+    batch.last_cr_sys = 100000;
+    assert(!upipe_dvbcsa_batch_add(&batch, 1, 109000, 0, 100000));
+    assert(batch.interval == 2000);
+    upipe_dvbcsa_batch_done(&batch, 1, UINT64_MAX);
+    assert(!upipe_dvbcsa_batch_add(&batch, 1, 109000 + 400, 0, 100000));
+    assert(batch.interval == 1800);
+    upipe_dvbcsa_batch_done(&batch, 1, UINT64_MAX);
+
+    /* statistics don't overflow over long periods */
+    batch.batches = 100000000;
+    batch.packets = 32 * batch.batches;
+    ubase_assert(batch_control(&batch, 10000, UPIPE_DVBCSA_GET_BATCH_STATS,
+                               UPIPE_DVBCSA_COMMON_SIGNATURE,
+                               NULL, &fill, NULL));
+    assert(fill == 50);
+
+    assert(batch_control(&batch, 10000, UPIPE_DVBCSA_SET_KEY,
+                         UPIPE_DVBCSA_COMMON_SIGNATURE, NULL) ==
+           UBASE_ERR_UNHANDLED);
+}
+
 int main(int argc, char *argv[])
 {
+    test_batch();
+
     struct ustring_dvbcsa_cw cw =
         ustring_to_dvbcsa_cw(ustring_from_str("112233445566"));
     assert(cw.str.len == 12);
@@ -69,6 +69,10 @@
 #define N_OUTPUT            2
 
 UREF_ATTR_SMALL_UNSIGNED(test, input_id, "input_id", input id);
+UREF_ATTR_SMALL_UNSIGNED(test, frame_id, "frame_id", frame id);
+
+/** frame id of the first buffer received by a sink */
+static uint8_t first_frame_id;
 
 struct sink {
     struct upipe upipe;
@@ -135,6 +139,8 @@ static void sink_input(struct upipe *upipe, struct uref *uref,
         ubase_assert(uref_test_get_input_id(uref, &id));
         if (sink->input_id != UINT64_MAX)
             assert(id == (sink->input_id + 2) % N_INPUT);
+        else
+            uref_test_get_frame_id(uref, &first_frame_id);
         sink->input_id = id;
     }
     else
@@ -179,6 +185,82 @@ static int catch(struct uprobe *uprobe, struct upipe *upipe,
     return UBASE_ERR_NONE;
 }
 
+/* checks that a full input drops its oldest frame */
+static void test_capacity(struct upipe_mgr *upipe_grid_mgr,
+                          struct uprobe *logger,
+                          struct uref_mgr *uref_mgr,
+                          struct ubuf_mgr *ubuf_pic_mgr,
+                          unsigned int capacity)
+{
+    struct upipe *upipe_grid =
+        upipe_void_alloc(upipe_grid_mgr,
+                         uprobe_pfx_alloc(uprobe_use(logger),
+                                          UPROBE_LOG_LEVEL,
+                                          "grid capacity"));
+    assert(upipe_grid);
+    ubase_assert(upipe_grid_set_input_capacity(upipe_grid, capacity));
+
+    struct upipe *input =
+        upipe_grid_alloc_input(upipe_grid,
+                               uprobe_pfx_alloc(uprobe_use(logger),
+                                                UPROBE_LOG_LEVEL,
+                                                "in capacity"));
+    assert(input);
+    struct uref *pic_flow_def = uref_pic_flow_alloc_def(uref_mgr, 0);
+    assert(pic_flow_def);
+    ubase_assert(upipe_set_flow_def(input, pic_flow_def));
+    uref_free(pic_flow_def);
+
+    struct upipe *output =
+        upipe_grid_alloc_output(upipe_grid,
+                                uprobe_pfx_alloc(uprobe_use(logger),
+                                                 UPROBE_LOG_LEVEL,
+                                                 "out capacity"));
+    assert(output);
+    struct uref *flow_def = uref_void_flow_alloc_def(uref_mgr);
+    assert(flow_def);
+    ubase_assert(upipe_set_flow_def(output, flow_def));
+    uref_free(flow_def);
+    struct upipe *sink =
+        upipe_void_alloc_output(output, &sink_mgr,
+                                uprobe_pfx_alloc(uprobe_use(logger),
+                                                 UPROBE_LOG_LEVEL,
+                                                 "sink capacity"));
+    assert(sink);
+    upipe_release(sink);
+    ubase_assert(upipe_grid_out_set_input(output, input));
+
+    /* retain all the frames before the first output tick */
+    static const uint64_t duration = 42;
+    uint64_t now = 4242;
+    for (unsigned i = 0; i < N_UREF; i++) {
+        struct uref *uref =
+            uref_pic_alloc(uref_mgr, ubuf_pic_mgr, WIDTH, HEIGHT);
+        assert(uref);
+        ubase_assert(uref_test_set_input_id(uref, 0));
+        ubase_assert(uref_test_set_frame_id(uref, i));
+        uref_clock_set_pts_sys(uref, now + i * duration);
+        uref_clock_set_duration(uref, duration);
+        upipe_input(input, uref, NULL);
+    }
+
+    first_frame_id = UINT8_MAX;
+    for (unsigned i = 0; i < N_UREF; i++) {
+        struct uref *uref = uref_alloc_control(uref_mgr);
+        assert(uref);
+        uref_clock_set_pts_sys(uref, now + i * duration);
+        ubase_assert(uref_clock_set_duration(uref, duration));
+        upipe_input(output, uref, NULL);
+    }
+    /* capacities are rounded up to a power of 2 */
+    assert(first_frame_id == (capacity < N_UREF ? 1 : 0));
+
+    upipe_release(output);
+    upipe_release(input);
+    assert(upipe_single(upipe_grid));
+    upipe_release(upipe_grid);
+}
+
 int main(int argc, char *argv[])
 {
     struct uclock *uclock = uclock_std_alloc(0);
@@ -327,6 +409,10 @@ int main(int argc, char *argv[])
         upipe_release(inputs[i]);
     assert(upipe_single(upipe_grid));
     upipe_release(upipe_grid);
+
+    test_capacity(upipe_grid_mgr, logger, uref_mgr, ubuf_pic_mgr, N_UREF);
+    test_capacity(upipe_grid_mgr, logger, uref_mgr, ubuf_pic_mgr, N_UREF - 1);
+
     upipe_mgr_release(upipe_grid_mgr);
     uprobe_release(logger);
     uprobe_clean(&uprobe);
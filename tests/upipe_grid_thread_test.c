@@ -0,0 +1,335 @@
+/*
+ * Copyright (C) 2017 OpenHeadend S.A.R.L.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+/** @file
+ * @short unit tests for the threaded mode of the grid pipe
+ */
+
+#undef NDEBUG
+
+#include <upipe/umem.h>
+#include <upipe/umem_alloc.h>
+#include <upipe/udict.h>
+#include <upipe/udict_inline.h>
+#include <upipe/uref_std.h>
+#include <upipe/ubuf_pic_mem.h>
+
+#include <upipe/uprobe.h>
+#include <upipe/uprobe_stdio.h>
+#include <upipe/uprobe_prefix.h>
+
+#include <upipe/uref_void_flow.h>
+#include <upipe/uref_pic_flow.h>
+#include <upipe/uref_pic.h>
+#include <upipe/uref_clock.h>
+
+#include <upipe/upipe_helper_upipe.h>
+#include <upipe/upipe_helper_urefcount.h>
+#include <upipe/upipe_helper_void.h>
+
+#include <upipe-modules/upipe_grid.h>
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <assert.h>
+
+#define UPROBE_LOG_LEVEL    UPROBE_LOG_WARNING
+#define UDICT_POOL_DEPTH    32
+#define UREF_POOL_DEPTH     32
+#define UBUF_POOL_DEPTH     32
+#define UBUF_PREPEND        0
+#define UBUF_APPEND         0
+#define UBUF_ALIGN          16
+#define UBUF_ALIGN_OFFSET   0
+#define WIDTH               32
+#define HEIGHT              16
+#define N_INPUT             4
+#define N_OUTPUT            4
+#define N_FRAME             20000
+#define N_TICK              20000
+#define SWITCH_PERIOD       100
+
+UREF_ATTR_SMALL_UNSIGNED(test, input_id, "input_id", input id);
+UREF_ATTR_UNSIGNED(test, frame, "frame", frame number);
+
+static struct uref_mgr *uref_mgr;
+static struct ubuf_mgr *ubuf_mgr;
+static struct upipe *inputs[N_INPUT];
+static struct upipe *outputs[N_OUTPUT];
+static pthread_t input_threads[N_INPUT];
+static bool input_dead[N_INPUT];
+/** synchronizes the release of the inputs with the outputs */
+static pthread_barrier_t barrier;
+
+struct sink {
+    struct upipe upipe;
+    struct urefcount urefcount;
+    /** input currently selected on the output */
+    unsigned int input_id;
+    /** last frame received from each input */
+    uint64_t last_frame[N_INPUT];
+    /** number of received frames */
+    uint64_t count;
+};
+
+UPIPE_HELPER_UPIPE(sink, upipe, 0);
+UPIPE_HELPER_UREFCOUNT(sink, urefcount, sink_free);
+UPIPE_HELPER_VOID(sink);
+
+static struct upipe *sink_alloc(struct upipe_mgr *mgr,
+                                struct uprobe *uprobe,
+                                uint32_t signature, va_list args)
+{
+    struct upipe *upipe = sink_alloc_void(mgr, uprobe, signature, args);
+    assert(upipe);
+    sink_init_urefcount(upipe);
+    struct sink *sink = sink_from_upipe(upipe);
+    sink->input_id = 0;
+    for (unsigned i = 0; i < N_INPUT; i++)
+        sink->last_frame[i] = 0;
+    sink->count = 0;
+    upipe_throw_ready(upipe);
+    return upipe;
+}
+
+static void sink_free(struct upipe *upipe)
+{
+    struct sink *sink = sink_from_upipe(upipe);
+    upipe_throw_dead(upipe);
+    assert(sink->count);
+    sink_clean_urefcount(upipe);
+    sink_free_void(upipe);
+}
+
+static void sink_input(struct upipe *upipe, struct uref *uref,
+                       struct upump **upump_p)
+{
+    struct sink *sink = sink_from_upipe(upipe);
+    if (uref->ubuf) {
+        uint8_t id;
+        uint64_t frame;
+        ubase_assert(uref_test_get_input_id(uref, &id));
+        ubase_assert(uref_test_get_frame(uref, &frame));
+        /* the frame comes from the selected input and is not older than
+         * the previous one */
+        assert(id == sink->input_id);
+        assert(frame >= sink->last_frame[id]);
+        sink->last_frame[id] = frame;
+        sink->count++;
+    }
+    uref_free(uref);
+}
+
+static int sink_control(struct upipe *upipe, int command, va_list args)
+{
+    switch (command) {
+        case UPIPE_SET_FLOW_DEF:
+            return UBASE_ERR_NONE;
+    }
+    return UBASE_ERR_UNHANDLED;
+}
+
+static struct upipe_mgr sink_mgr = {
+    .refcount = NULL,
+    .signature = 0,
+    .upipe_alloc = sink_alloc,
+    .upipe_input = sink_input,
+    .upipe_control = sink_control,
+};
+
+/** feeds a frame to an input */
+static void input_frame(unsigned int id, uint64_t i)
+{
+    struct uref *uref = uref_pic_alloc(uref_mgr, ubuf_mgr, WIDTH, HEIGHT);
+    assert(uref);
+    ubase_assert(uref_test_set_input_id(uref, id));
+    ubase_assert(uref_test_set_frame(uref, i));
+    uref_clock_set_pts_sys(uref, i);
+    upipe_input(inputs[id], uref, NULL);
+}
+
+/** feeds frames to an input */
+static void *input_thread(void *arg)
+{
+    unsigned int id = (uintptr_t)arg;
+    for (uint64_t i = 2; i <= N_FRAME; i++) {
+        if (i == N_FRAME / 2) {
+            /* change the flow definition midway */
+            struct uref *flow_def =
+                uref_pic_flow_alloc_def(uref_mgr, 1);
+            assert(flow_def);
+            ubase_assert(uref_pic_flow_set_hsize(flow_def, WIDTH));
+            ubase_assert(upipe_set_flow_def(inputs[id], flow_def));
+            uref_free(flow_def);
+        }
+        input_frame(id, i);
+    }
+
+    /* release the input while outputs still hold it */
+    pthread_barrier_wait(&barrier);
+    upipe_release(inputs[id]);
+    pthread_barrier_wait(&barrier);
+    return NULL;
+}
+
+/** pulls frames from an output, switching inputs periodically */
+static void *output_thread(void *arg)
+{
+    unsigned int id = (uintptr_t)arg;
+    struct upipe *sink = NULL;
+    ubase_assert(upipe_get_output(outputs[id], &sink));
+    struct sink *sink_priv = sink_from_upipe(sink);
+
+    for (uint64_t i = 0; i < N_TICK; i++) {
+        if (!(i % SWITCH_PERIOD)) {
+            unsigned int input_id = (id + i / SWITCH_PERIOD) % N_INPUT;
+            ubase_assert(upipe_grid_out_set_input(outputs[id],
+                                                  inputs[input_id]));
+            sink_priv->input_id = input_id;
+        }
+
+        struct uref *uref = uref_alloc_control(uref_mgr);
+        assert(uref);
+        uref_clock_set_pts_sys(uref, i);
+        upipe_input(outputs[id], uref, NULL);
+    }
+
+    /* the input is released meanwhile, but its last frame is kept */
+    pthread_barrier_wait(&barrier);
+    pthread_barrier_wait(&barrier);
+    for (uint64_t i = N_TICK; i < N_TICK + SWITCH_PERIOD; i++) {
+        struct uref *uref = uref_alloc_control(uref_mgr);
+        assert(uref);
+        uref_clock_set_pts_sys(uref, i);
+        upipe_input(outputs[id], uref, NULL);
+    }
+
+    /* drop the last reference on the input from this thread */
+    ubase_assert(upipe_grid_out_set_input(outputs[id], NULL));
+    return NULL;
+}
+
+static int catch(struct uprobe *uprobe, struct upipe *upipe,
+                 int event, va_list args)
+{
+    if (event != UPROBE_DEAD)
+        return UBASE_ERR_NONE;
+    for (unsigned i = 0; i < N_INPUT; i++)
+        if (upipe == inputs[i]) {
+            /* inputs are cleaned up on their own thread */
+            assert(pthread_equal(pthread_self(), input_threads[i]));
+            input_dead[i] = true;
+        }
+    return UBASE_ERR_NONE;
+}
+
+int main(int argc, char *argv[])
+{
+    struct umem_mgr *umem_mgr = umem_alloc_mgr_alloc();
+    assert(umem_mgr);
+    struct udict_mgr *udict_mgr =
+        udict_inline_mgr_alloc(UDICT_POOL_DEPTH, umem_mgr, -1, -1);
+    assert(udict_mgr);
+    uref_mgr = uref_std_mgr_alloc(UREF_POOL_DEPTH, udict_mgr, 0);
+    assert(uref_mgr);
+    ubuf_mgr = ubuf_pic_mem_mgr_alloc(UBUF_POOL_DEPTH, UBUF_POOL_DEPTH,
+                                      umem_mgr, 1, UBUF_PREPEND, UBUF_APPEND,
+                                      UBUF_PREPEND, UBUF_APPEND,
+                                      UBUF_ALIGN, UBUF_ALIGN_OFFSET);
+    assert(ubuf_mgr);
+
+    struct uprobe uprobe;
+    uprobe_init(&uprobe, catch, NULL);
+    struct uprobe *logger =
+        uprobe_stdio_alloc(&uprobe, stderr, UPROBE_LOG_LEVEL);
+    assert(logger);
+
+    struct upipe_mgr *upipe_grid_mgr = upipe_grid_mgr_alloc();
+    assert(upipe_grid_mgr);
+    struct upipe *upipe_grid =
+        upipe_void_alloc(upipe_grid_mgr,
+                         uprobe_pfx_alloc(uprobe_use(logger),
+                                          UPROBE_LOG_LEVEL, "grid"));
+    assert(upipe_grid);
+    ubase_assert(upipe_grid_set_threaded(upipe_grid, NULL));
+
+    struct uref *flow_def = uref_pic_flow_alloc_def(uref_mgr, 1);
+    assert(flow_def);
+    for (unsigned i = 0; i < N_INPUT; i++) {
+        inputs[i] = upipe_grid_alloc_input(upipe_grid,
+                uprobe_pfx_alloc_va(uprobe_use(logger), UPROBE_LOG_LEVEL,
+                                    "in %u", i));
+        assert(inputs[i]);
+        ubase_assert(upipe_set_flow_def(inputs[i], flow_def));
+        input_frame(i, 1);
+    }
+    uref_free(flow_def);
+    /* sub pipes already exist */
+    ubase_nassert(upipe_grid_set_threaded(upipe_grid, NULL));
+
+    flow_def = uref_void_flow_alloc_def(uref_mgr);
+    assert(flow_def);
+    for (unsigned i = 0; i < N_OUTPUT; i++) {
+        outputs[i] = upipe_grid_alloc_output(upipe_grid,
+                uprobe_pfx_alloc_va(uprobe_use(logger), UPROBE_LOG_LEVEL,
+                                    "out %u", i));
+        assert(outputs[i]);
+        ubase_assert(upipe_set_flow_def(outputs[i], flow_def));
+        struct upipe *sink = upipe_void_alloc_output(outputs[i], &sink_mgr,
+                uprobe_pfx_alloc_va(uprobe_use(logger), UPROBE_LOG_LEVEL,
+                                    "sink %u", i));
+        assert(sink);
+        upipe_release(sink);
+    }
+    uref_free(flow_def);
+
+    pthread_t output_threads[N_OUTPUT];
+    assert(!pthread_barrier_init(&barrier, NULL, N_INPUT + N_OUTPUT));
+    for (unsigned i = 0; i < N_INPUT; i++)
+        assert(!pthread_create(&input_threads[i], NULL, input_thread,
+                               (void *)(uintptr_t)i));
+    for (unsigned i = 0; i < N_OUTPUT; i++)
+        assert(!pthread_create(&output_threads[i], NULL, output_thread,
+                               (void *)(uintptr_t)i));
+    for (unsigned i = 0; i < N_INPUT; i++)
+        assert(!pthread_join(input_threads[i], NULL));
+    for (unsigned i = 0; i < N_OUTPUT; i++)
+        assert(!pthread_join(output_threads[i], NULL));
+    assert(!pthread_barrier_destroy(&barrier));
+    for (unsigned i = 0; i < N_INPUT; i++)
+        assert(input_dead[i]);
+
+    for (unsigned i = 0; i < N_OUTPUT; i++)
+        upipe_release(outputs[i]);
+    assert(upipe_single(upipe_grid));
+    upipe_release(upipe_grid);
+    upipe_mgr_release(upipe_grid_mgr);
+
+    uprobe_release(logger);
+    uprobe_clean(&uprobe);
+    uref_mgr_release(uref_mgr);
+    ubuf_mgr_release(ubuf_mgr);
+    udict_mgr_release(udict_mgr);
+    umem_mgr_release(umem_mgr);
+    return 0;
+}
@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) 2017 OpenHeadend S.A.R.L.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** @file
+ * @short unit tests for upipe_pthread_transfer placement (using upump_ev)
+ */
+
+#undef NDEBUG
+
+#define _GNU_SOURCE
+
+#include <upipe/config.h>
+#include <upipe/uprobe.h>
+#include <upipe/uprobe_stdio.h>
+#include <upipe/uprobe_prefix.h>
+#include <upipe/uprobe_upump_mgr.h>
+#include <upipe/ubase.h>
+#include <upipe/urefcount.h>
+#include <upipe/upump.h>
+#include <upump-ev/upump_ev.h>
+#include <upipe/upipe.h>
+#include <upipe-modules/upipe_transfer.h>
+#include <upipe-pthread/upipe_pthread_transfer.h>
+#include <upipe-pthread/uprobe_pthread_upump_mgr.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <assert.h>
+
+#define UPUMP_POOL 1
+#define UPUMP_BLOCKER_POOL 1
+#define XFER_QUEUE 255
+#define XFER_POOL 1
+
+static bool transferred = false;
+static pthread_t xfer_thread_id;
+static unsigned int cpu = 0;
+
+/** helper phony pipe */
+struct test_pipe {
+    struct urefcount urefcount;
+    struct upipe upipe;
+};
+
+/** helper phony pipe */
+static void test_free(struct urefcount *urefcount)
+{
+    struct test_pipe *test_pipe =
+        container_of(urefcount, struct test_pipe, urefcount);
+    urefcount_clean(&test_pipe->urefcount);
+    upipe_clean(&test_pipe->upipe);
+    free(test_pipe);
+}
+
+/** helper phony pipe */
+static struct upipe *test_alloc(struct upipe_mgr *mgr,
+                                struct uprobe *uprobe, uint32_t signature,
+                                va_list args)
+{
+    struct test_pipe *test_pipe = malloc(sizeof(struct test_pipe));
+    assert(test_pipe != NULL);
+    upipe_init(&test_pipe->upipe, mgr, uprobe);
+    urefcount_init(&test_pipe->urefcount, test_free);
+    test_pipe->upipe.refcount = &test_pipe->urefcount;
+    return &test_pipe->upipe;
+}
+
+/** helper phony pipe */
+static int test_control(struct upipe *upipe, int command, va_list args)
+{
+    switch (command) {
+        case UPIPE_ATTACH_UPUMP_MGR: {
+            assert(pthread_equal(pthread_self(), xfer_thread_id));
+#ifdef UPIPE_HAVE_PTHREAD_SETAFFINITY_NP
+            cpu_set_t cpuset;
+            assert(!pthread_getaffinity_np(pthread_self(), sizeof(cpuset),
+                                           &cpuset));
+            assert(CPU_COUNT(&cpuset) == 1);
+            assert(CPU_ISSET(cpu, &cpuset));
+#endif
+            transferred = true;
+            return UBASE_ERR_NONE;
+        }
+        default:
+            return UBASE_ERR_UNHANDLED;
+    }
+}
+
+/** helper phony pipe */
+static struct upipe_mgr test_mgr = {
+    .refcount = NULL,
+    .upipe_alloc = test_alloc,
+    .upipe_input = NULL,
+    .upipe_control = test_control
+};
+
+int main(int argc, char **argv)
+{
+    struct upump_mgr *upump_mgr =
+        upump_ev_mgr_alloc_default(UPUMP_POOL, UPUMP_BLOCKER_POOL);
+    assert(upump_mgr != NULL);
+
+    struct uprobe *logger = uprobe_stdio_alloc(NULL, stdout,
+                                               UPROBE_LOG_DEBUG);
+    assert(logger != NULL);
+    struct uprobe *uprobe_upump_mgr =
+        uprobe_upump_mgr_alloc(uprobe_use(logger), upump_mgr);
+    assert(uprobe_upump_mgr != NULL);
+    struct uprobe *uprobe_pthread_upump_mgr =
+        uprobe_pthread_upump_mgr_alloc(uprobe_use(logger));
+    assert(uprobe_pthread_upump_mgr != NULL);
+    uprobe_pthread_upump_mgr_set(uprobe_pthread_upump_mgr, upump_mgr);
+
+#ifdef UPIPE_HAVE_PTHREAD_SETAFFINITY_NP
+    /* bind to the last CPU we are allowed to run on */
+    cpu_set_t cpuset;
+    assert(!pthread_getaffinity_np(pthread_self(), sizeof(cpuset), &cpuset));
+    for (unsigned int i = 0; i < CPU_SETSIZE; i++)
+        if (CPU_ISSET(i, &cpuset))
+            cpu = i;
+#endif
+
+    struct upipe_pthread_placement placement;
+    upipe_pthread_placement_init(&placement);
+    placement.cpus = &cpu;
+    placement.nb_cpus = 1;
+    placement.numa_node = 0;
+
+    struct upipe_mgr *upipe_xfer_mgr =
+        upipe_pthread_xfer_mgr_alloc_placement(XFER_QUEUE, XFER_POOL,
+                uprobe_use(uprobe_pthread_upump_mgr), upump_ev_mgr_alloc_loop,
+                UPUMP_POOL, UPUMP_BLOCKER_POOL, NULL, &xfer_thread_id, NULL,
+                &placement);
+    assert(upipe_xfer_mgr != NULL);
+
+    struct upipe *upipe_test = upipe_void_alloc(&test_mgr,
+            uprobe_pfx_alloc(uprobe_use(logger), UPROBE_LOG_VERBOSE, "test"));
+    assert(upipe_test != NULL);
+
+    struct upipe *upipe_handle = upipe_xfer_alloc(upipe_xfer_mgr,
+            uprobe_pfx_alloc(uprobe_use(uprobe_upump_mgr), UPROBE_LOG_VERBOSE,
+                             "xfer"),
+            upipe_test);
+    assert(upipe_handle != NULL);
+    ubase_assert(upipe_attach_upump_mgr(upipe_handle));
+    upipe_release(upipe_handle);
+    upipe_mgr_release(upipe_xfer_mgr);
+
+    upump_mgr_run(upump_mgr, NULL);
+    assert(transferred);
+
+    uprobe_release(uprobe_pthread_upump_mgr);
+    uprobe_release(uprobe_upump_mgr);
+    uprobe_release(logger);
+    upump_mgr_release(upump_mgr);
+    return 0;
+}
@@ -34,6 +34,9 @@
 #include <upipe/uprobe_prefix.h>
 #include <upipe/uprobe_uref_mgr.h>
 #include <upipe/uprobe_upump_mgr.h>
+#include <upipe/uprobe_uclock.h>
+#include <upipe/uclock.h>
+#include <upipe/uclock_std.h>
 #include <upipe/umem.h>
 #include <upipe/umem_alloc.h>
 #include <upipe/udict.h>
@@ -43,6 +46,7 @@
 #include <upipe/uref_flow.h>
 #include <upipe/uref_block_flow.h>
 #include <upipe/upump.h>
+#include <upipe/upump_blocker.h>
 #include <upump-ev/upump_ev.h>
 #include <upipe/upipe.h>
 #include <upipe-modules/upipe_queue_source.h>
@@ -57,6 +61,10 @@
 #define UPUMP_POOL 0
 #define UPUMP_BLOCKER_POOL 0
 #define QUEUE_LENGTH 6
+#define ELASTIC_LENGTH 8
+#define ELASTIC_UREFS 5
+#define STALL_LOW 1
+#define STALL_HIGH 3
 #define UPROBE_LOG_LEVEL UPROBE_LOG_VERBOSE
 
 UREF_ATTR_SMALL_UNSIGNED(test, test, "x.test", test)
@@ -67,6 +75,12 @@ static uint8_t counter = 0;
 static struct uref_mgr *uref_mgr;
 static struct urequest request;
 static bool request_was_unregistered = false;
+static unsigned int elastic_counter = 0;
+static unsigned int nb_high = 0;
+static unsigned int nb_low = 0;
+static unsigned int nb_resize = 0;
+static struct upump_blocker *stall_blocker = NULL;
+static unsigned int stall_counter = 0;
 
 /** definition of our uprobe */
 static int catch(struct uprobe *uprobe, struct upipe *upipe,
@@ -79,6 +93,7 @@ static int catch(struct uprobe *uprobe, struct upipe *upipe,
         case UPROBE_READY:
         case UPROBE_DEAD:
         case UPROBE_NEW_FLOW_DEF:
+        case UPROBE_STALLED:
             break;
         case UPROBE_SOURCE_END:
             upipe_release(upipe);
@@ -87,6 +102,47 @@ static int catch(struct uprobe *uprobe, struct upipe *upipe,
     return UBASE_ERR_NONE;
 }
 
+/** definition of the probe of the elastic queue source */
+static int catch_elastic(struct uprobe *uprobe, struct upipe *upipe,
+                         int event, va_list args)
+{
+    if (event < UPROBE_LOCAL) {
+        if (event != UPROBE_SOURCE_END)
+            return uprobe_throw_next(uprobe, upipe, event, args);
+
+        unsigned int high_water, limit;
+        uint64_t latency, max_latency;
+        ubase_assert(upipe_qsrc_get_stats(upipe, &high_water, &latency,
+                                          &max_latency));
+        assert(high_water >= 2 && high_water <= 4);
+        assert(latency != UINT64_MAX);
+        assert(max_latency != UINT64_MAX && max_latency >= latency);
+        ubase_assert(upipe_qsrc_get_limit(upipe, &limit));
+        assert(limit == 4);
+        return uprobe_throw_next(uprobe, upipe, event, args);
+    }
+
+    UBASE_SIGNATURE_CHECK(args, UPIPE_QSRC_SIGNATURE)
+    unsigned int length = va_arg(args, unsigned int);
+    switch (event) {
+        case UPROBE_QSRC_HIGH:
+            assert(length >= 2);
+            nb_high++;
+            break;
+        case UPROBE_QSRC_LOW:
+            assert(length <= 1);
+            nb_low++;
+            break;
+        case UPROBE_QSRC_RESIZE:
+            assert(length == 2 || length == 4);
+            nb_resize++;
+            break;
+        default:
+            assert(0);
+    }
+    return UBASE_ERR_NONE;
+}
+
 static void check_end(void)
 {
     if (counter >= 1 && request_was_unregistered)
@@ -152,6 +208,35 @@ static int test_control(struct upipe *upipe, int command, va_list args)
 }
 
 /** helper phony pipe */
+/** definition of the probe of the queue source with a stalled output */
+static int catch_stall(struct uprobe *uprobe, struct upipe *upipe,
+                       int event, va_list args)
+{
+    if (event < UPROBE_LOCAL)
+        return uprobe_throw_next(uprobe, upipe, event, args);
+
+    UBASE_SIGNATURE_CHECK(args, UPIPE_QSRC_SIGNATURE)
+    unsigned int length = va_arg(args, unsigned int);
+    switch (event) {
+        case UPROBE_QSRC_HIGH:
+            /* the source does not pop while its output is blocked */
+            assert(length >= STALL_HIGH);
+            assert(stall_blocker != NULL);
+            upump_blocker_free(stall_blocker);
+            stall_blocker = NULL;
+            upipe_release(upipe_qsink);
+            nb_high++;
+            break;
+        case UPROBE_QSRC_LOW:
+            assert(length <= STALL_LOW);
+            nb_low++;
+            break;
+        default:
+            assert(0);
+    }
+    return UBASE_ERR_NONE;
+}
+
 static void test_free(struct upipe *upipe)
 {
     upipe_throw_dead(upipe);
@@ -159,6 +244,47 @@ static void test_free(struct upipe *upipe)
     free(upipe);
 }
 
+/** helper phony pipe */
+static void elastic_input(struct upipe *upipe, struct uref *uref,
+                          struct upump **upump_p)
+{
+    assert(uref != NULL);
+    uint64_t date;
+    assert(!ubase_check(uref_attr_get_unsigned(uref, &date,
+                                               UDICT_TYPE_UNSIGNED,
+                                               "queue.date")));
+    elastic_counter++;
+    uref_free(uref);
+}
+
+/** helper phony pipe */
+static void stall_blocker_cb(struct upump_blocker *blocker)
+{
+    upump_blocker_free(blocker);
+    stall_blocker = NULL;
+}
+
+/** helper phony pipe blocking the queue source on the first uref, while the
+ * queue is filled */
+static void stall_input(struct upipe *upipe, struct uref *uref,
+                        struct upump **upump_p)
+{
+    assert(uref != NULL);
+    uref_free(uref);
+    if (stall_counter++)
+        return;
+
+    assert(upump_p != NULL && *upump_p != NULL);
+    stall_blocker = upump_blocker_alloc(*upump_p, stall_blocker_cb, NULL,
+                                        NULL);
+    assert(stall_blocker != NULL);
+    for (int i = 0; i < STALL_HIGH; i++) {
+        uref = uref_alloc(uref_mgr);
+        assert(uref != NULL);
+        upipe_input(upipe_qsink, uref, NULL);
+    }
+}
+
 /** helper phony pipe */
 static struct upipe_mgr queue_test_mgr = {
     .refcount = NULL,
@@ -167,6 +293,22 @@ static struct upipe_mgr queue_test_mgr = {
     .upipe_control = test_control
 };
 
+/** helper phony pipe */
+static struct upipe_mgr elastic_test_mgr = {
+    .refcount = NULL,
+    .upipe_alloc = test_alloc,
+    .upipe_input = elastic_input,
+    .upipe_control = test_control
+};
+
+/** helper phony pipe */
+static struct upipe_mgr stall_test_mgr = {
+    .refcount = NULL,
+    .upipe_alloc = test_alloc,
+    .upipe_input = stall_input,
+    .upipe_control = test_control
+};
+
 int main(int argc, char *argv[])
 {
     upump_mgr = upump_ev_mgr_alloc_default(UPUMP_POOL, UPUMP_BLOCKER_POOL);
@@ -251,6 +393,140 @@ int main(int argc, char *argv[])
     upipe_release(upipe_qsrc);
     upipe_release(upipe_qsink);
 
+    /* check the elastic mode and the statistics */
+    struct uclock *uclock = uclock_std_alloc(0);
+    assert(uclock != NULL);
+    struct uprobe *uprobe_clock = uprobe_uclock_alloc(uprobe_use(logger),
+                                                      uclock);
+    assert(uprobe_clock != NULL);
+    struct uprobe uprobe_elastic;
+    uprobe_init(&uprobe_elastic, catch_elastic, uprobe_use(uprobe_clock));
+
+    struct upipe *upipe_elastic = upipe_void_alloc(&elastic_test_mgr,
+            uprobe_pfx_alloc(uprobe_use(logger), UPROBE_LOG_LEVEL,
+                             "elastic sink"));
+    assert(upipe_elastic != NULL);
+
+    upipe_qsrc = upipe_qsrc_alloc(upipe_qsrc_mgr,
+            uprobe_pfx_alloc(uprobe_use(&uprobe_elastic), UPROBE_LOG_LEVEL,
+                             "elastic queue source"), ELASTIC_LENGTH);
+    assert(upipe_qsrc != NULL);
+    ubase_assert(upipe_set_output(upipe_qsrc, upipe_elastic));
+    ubase_assert(upipe_attach_uclock(upipe_qsrc));
+    ubase_nassert(upipe_qsrc_set_elastic(upipe_qsrc, 2, ELASTIC_LENGTH + 1));
+    ubase_assert(upipe_qsrc_set_elastic(upipe_qsrc, 2, 4));
+    ubase_nassert(upipe_qsrc_set_thresholds(upipe_qsrc, 2, 2));
+    ubase_assert(upipe_qsrc_set_thresholds(upipe_qsrc, 1, 2));
+    unsigned int limit;
+    ubase_assert(upipe_qsrc_get_max_length(upipe_qsrc, &limit));
+    assert(limit == ELASTIC_LENGTH);
+    ubase_assert(upipe_qsrc_get_limit(upipe_qsrc, &limit));
+    assert(limit == 2);
+    assert(nb_resize == 1);
+    nb_resize = 0;
+
+    upipe_qsink = upipe_qsink_alloc(upipe_qsink_mgr,
+            uprobe_pfx_alloc(uprobe_use(uprobe_clock), UPROBE_LOG_LEVEL,
+                             "elastic queue sink"),
+            upipe_qsrc);
+    assert(upipe_qsink != NULL);
+    ubase_assert(upipe_attach_uclock(upipe_qsink));
+    uref = uref_block_flow_alloc_def(uref_mgr, NULL);
+    assert(uref != NULL);
+    ubase_assert(upipe_set_flow_def(upipe_qsink, uref));
+    uref_free(uref);
+
+    /* the second uref blocks the sink until the queue grows, as the flow
+     * definition takes one element */
+    for (int i = 0; i < ELASTIC_UREFS; i++) {
+        uref = uref_alloc(uref_mgr);
+        assert(uref != NULL);
+        upipe_input(upipe_qsink, uref, NULL);
+    }
+    ubase_assert(upipe_qsrc_get_length(upipe_qsrc, &length));
+    assert(length == 2);
+    upipe_release(upipe_qsink);
+
+    upump_mgr_run(upump_mgr, NULL);
+
+    assert(elastic_counter == ELASTIC_UREFS);
+    assert(nb_high >= 1);
+    assert(nb_low == nb_high);
+    assert(nb_resize == 1);
+
+    /* check that the input date is removed when only the sink has a uclock */
+    upipe_qsrc = upipe_qsrc_alloc(upipe_qsrc_mgr,
+            uprobe_pfx_alloc(uprobe_use(logger), UPROBE_LOG_LEVEL,
+                             "queue source"), QUEUE_LENGTH);
+    assert(upipe_qsrc != NULL);
+    ubase_assert(upipe_set_output(upipe_qsrc, upipe_elastic));
+
+    upipe_qsink = upipe_qsink_alloc(upipe_qsink_mgr,
+            uprobe_pfx_alloc(uprobe_use(uprobe_clock), UPROBE_LOG_LEVEL,
+                             "queue sink"),
+            upipe_qsrc);
+    assert(upipe_qsink != NULL);
+    ubase_assert(upipe_attach_uclock(upipe_qsink));
+    uref = uref_block_flow_alloc_def(uref_mgr, NULL);
+    assert(uref != NULL);
+    ubase_assert(upipe_set_flow_def(upipe_qsink, uref));
+    uref_free(uref);
+
+    uref = uref_alloc(uref_mgr);
+    assert(uref != NULL);
+    upipe_input(upipe_qsink, uref, NULL);
+    upipe_release(upipe_qsink);
+
+    upump_mgr_run(upump_mgr, NULL);
+    assert(elastic_counter == ELASTIC_UREFS + 1);
+
+    /* check that the high threshold is signalled by the sink while the
+     * source is blocked */
+    struct uprobe uprobe_stall;
+    uprobe_init(&uprobe_stall, catch_stall, uprobe_use(logger));
+
+    struct upipe *upipe_stall = upipe_void_alloc(&stall_test_mgr,
+            uprobe_pfx_alloc(uprobe_use(logger), UPROBE_LOG_LEVEL,
+                             "stalled sink"));
+    assert(upipe_stall != NULL);
+
+    upipe_qsrc = upipe_qsrc_alloc(upipe_qsrc_mgr,
+            uprobe_pfx_alloc(uprobe_use(&uprobe_stall), UPROBE_LOG_LEVEL,
+                             "stalled queue source"), QUEUE_LENGTH);
+    assert(upipe_qsrc != NULL);
+    ubase_assert(upipe_set_output(upipe_qsrc, upipe_stall));
+    ubase_assert(upipe_qsrc_set_thresholds(upipe_qsrc, STALL_LOW,
+                                           STALL_HIGH));
+
+    upipe_qsink = upipe_qsink_alloc(upipe_qsink_mgr,
+            uprobe_pfx_alloc(uprobe_use(logger), UPROBE_LOG_LEVEL,
+                             "stalled queue sink"),
+            upipe_qsrc);
+    assert(upipe_qsink != NULL);
+    uref = uref_block_flow_alloc_def(uref_mgr, NULL);
+    assert(uref != NULL);
+    ubase_assert(upipe_set_flow_def(upipe_qsink, uref));
+    uref_free(uref);
+
+    uref = uref_alloc(uref_mgr);
+    assert(uref != NULL);
+    upipe_input(upipe_qsink, uref, NULL);
+
+    nb_high = nb_low = 0;
+    upump_mgr_run(upump_mgr, NULL);
+    assert(stall_counter == STALL_HIGH + 1);
+    assert(stall_blocker == NULL);
+    assert(nb_high == 1);
+    assert(nb_low == 1);
+
+    test_free(upipe_stall);
+    uprobe_clean(&uprobe_stall);
+
+    test_free(upipe_elastic);
+    uprobe_clean(&uprobe_elastic);
+    uprobe_release(uprobe_clock);
+    uclock_release(uclock);
+
     upipe_mgr_release(upipe_qsink_mgr); // nop
     upipe_mgr_release(upipe_qsrc_mgr); // nop
 
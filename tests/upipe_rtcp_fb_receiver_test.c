@@ -0,0 +1,402 @@
+/*
+ * Copyright (C) 2017 OpenHeadend S.A.R.L.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** @file
+ * @short unit tests for rtcp feedback receiver pipe
+ */
+
+#undef NDEBUG
+
+#include <upipe/uprobe.h>
+#include <upipe/uprobe_stdio.h>
+#include <upipe/uprobe_prefix.h>
+#include <upipe/uprobe_uref_mgr.h>
+#include <upipe/uprobe_upump_mgr.h>
+#include <upipe/uprobe_uclock.h>
+#include <upipe/uprobe_ubuf_mem.h>
+#include <upipe/uclock.h>
+#include <upipe/umem.h>
+#include <upipe/umem_alloc.h>
+#include <upipe/udict.h>
+#include <upipe/udict_inline.h>
+#include <upipe/ubuf.h>
+#include <upipe/ubuf_block_mem.h>
+#include <upipe/uref.h>
+#include <upipe/uref_block.h>
+#include <upipe/uref_block_flow.h>
+#include <upipe/uref_clock.h>
+#include <upipe/uref_std.h>
+#include <upipe/upump.h>
+#include <upump-ev/upump_ev.h>
+#include <upipe/upipe.h>
+#include <upipe/upipe_helper_upipe.h>
+#include <upipe-filters/upipe_rtcp_fb_receiver.h>
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include <assert.h>
+
+#include <bitstream/ietf/rtp.h>
+#include <bitstream/ietf/rtcp_fb.h>
+
+#define UDICT_POOL_DEPTH 0
+#define UREF_POOL_DEPTH 0
+#define UBUF_POOL_DEPTH 0
+#define UPUMP_POOL 0
+#define UPUMP_BLOCKER_POOL 0
+#define UPROBE_LOG_LEVEL UPROBE_LOG_DEBUG
+#define MEDIA_PT 33
+#define RTX_PT 96
+/** the payload holds the sequence number and the cycle of the packet */
+#define PAYLOAD_SIZE 4
+#define NB_PACKETS 50
+/** maximum number of retransmitted packets per second */
+#define RTX_RATE 50
+/** number of packets retransmitted in a burst */
+#define RTX_BURST (RTX_RATE / 10)
+
+static uint64_t now = 10 * UCLOCK_FREQ;
+static struct uref_mgr *uref_mgr;
+static struct ubuf_mgr *ubuf_mgr;
+static struct upipe *rtcpfb;
+static struct upipe *rtcpfb_input;
+
+/** number of media packets output */
+static unsigned int nb_media = 0;
+/** sequence numbers of the retransmitted packets */
+static uint16_t rtx[UINT16_MAX + 1];
+/** cycles of the retransmitted packets */
+static uint8_t rtx_cycle[UINT16_MAX + 1];
+static unsigned int nb_rtx = 0;
+
+/** definition of our uprobe */
+static int catch(struct uprobe *uprobe, struct upipe *upipe,
+                 int event, va_list args)
+{
+    switch (event) {
+        default:
+            assert(0);
+            break;
+        case UPROBE_READY:
+        case UPROBE_DEAD:
+        case UPROBE_NEW_FLOW_DEF:
+        case UPROBE_SOURCE_END:
+            break;
+    }
+    return UBASE_ERR_NONE;
+}
+
+/** helper uclock */
+static uint64_t test_now(struct uclock *uclock)
+{
+    return now;
+}
+
+/** helper phony pipe */
+static struct upipe *test_alloc(struct upipe_mgr *mgr, struct uprobe *uprobe,
+                                uint32_t signature, va_list args)
+{
+    struct upipe *upipe = malloc(sizeof(struct upipe));
+    assert(upipe != NULL);
+    upipe_init(upipe, mgr, uprobe);
+    upipe_throw_ready(upipe);
+    return upipe;
+}
+
+/** helper phony pipe */
+static void test_input(struct upipe *upipe, struct uref *uref,
+                       struct upump **upump_p)
+{
+    assert(uref != NULL);
+    size_t size;
+    ubase_assert(uref_block_size(uref, &size));
+    uint8_t buf[RTP_HEADER_SIZE + 2 + PAYLOAD_SIZE];
+    assert(size <= sizeof(buf));
+    ubase_assert(uref_block_extract(uref, 0, size, buf));
+    uref_free(uref);
+    assert(rtp_check_hdr(buf));
+
+    if (rtp_get_type(buf) == MEDIA_PT) {
+        assert(size == RTP_HEADER_SIZE + PAYLOAD_SIZE);
+        nb_media++;
+        return;
+    }
+
+    /* retransmitted packet, with the original sequence number first */
+    assert(rtp_get_type(buf) == RTX_PT);
+    assert(size == RTP_HEADER_SIZE + 2 + PAYLOAD_SIZE);
+    assert(rtp_get_seqnum(buf) == (uint16_t)nb_rtx);
+    const uint8_t *payload = buf + RTP_HEADER_SIZE;
+    uint16_t osn = (payload[0] << 8) | payload[1];
+    assert(((payload[2] << 8) | payload[3]) == osn);
+    rtx[nb_rtx] = osn;
+    rtx_cycle[nb_rtx] = payload[4];
+    nb_rtx++;
+}
+
+/** helper phony pipe */
+static int test_control(struct upipe *upipe, int command, va_list args)
+{
+    switch (command) {
+        case UPIPE_SET_FLOW_DEF:
+            return UBASE_ERR_NONE;
+        case UPIPE_REGISTER_REQUEST: {
+            struct urequest *urequest = va_arg(args, struct urequest *);
+            return upipe_throw_provide_request(upipe, urequest);
+        }
+        case UPIPE_UNREGISTER_REQUEST:
+            return UBASE_ERR_NONE;
+        default:
+            assert(0);
+            return UBASE_ERR_UNHANDLED;
+    }
+}
+
+/** helper phony pipe */
+static void test_free(struct upipe *upipe)
+{
+    upipe_dbg_va(upipe, "releasing pipe %p", upipe);
+    upipe_throw_dead(upipe);
+    upipe_clean(upipe);
+    free(upipe);
+}
+
+/** helper phony pipe */
+static struct upipe_mgr test_mgr = {
+    .refcount = NULL,
+    .signature = 0,
+    .upipe_alloc = test_alloc,
+    .upipe_input = test_input,
+    .upipe_control = test_control
+};
+
+/** sends a media packet */
+static void send_packet(uint16_t seqnum, uint8_t cycle)
+{
+    struct uref *uref = uref_block_alloc(uref_mgr, ubuf_mgr,
+                                         RTP_HEADER_SIZE + PAYLOAD_SIZE);
+    assert(uref != NULL);
+    uint8_t *buf;
+    int size = -1;
+    ubase_assert(uref_block_write(uref, 0, &size, &buf));
+    memset(buf, 0, size);
+    rtp_set_hdr(buf);
+    rtp_set_type(buf, MEDIA_PT);
+    rtp_set_seqnum(buf, seqnum);
+    buf[RTP_HEADER_SIZE] = seqnum >> 8;
+    buf[RTP_HEADER_SIZE + 1] = seqnum & 0xff;
+    buf[RTP_HEADER_SIZE + 2] = cycle;
+    uref_block_unmap(uref, 0);
+    uref_clock_set_cr_sys(uref, now);
+    upipe_input(rtcpfb, uref, NULL);
+}
+
+/** sends a generic NACK */
+static void send_nack(const uint16_t *pids, const uint16_t *blps,
+                      unsigned int nb_fci)
+{
+    int size = RTCP_FB_HEADER_SIZE + nb_fci * RTCP_FB_FCI_GENERIC_NACK_SIZE;
+    struct uref *uref = uref_block_alloc(uref_mgr, ubuf_mgr, size);
+    assert(uref != NULL);
+    uint8_t *buf;
+    ubase_assert(uref_block_write(uref, 0, &size, &buf));
+    memset(buf, 0, size);
+    rtcp_set_rtp_version(buf);
+    rtcp_fb_set_fmt(buf, RTCP_PT_RTPFB_GENERIC_NACK);
+    rtcp_set_pt(buf, RTCP_PT_RTPFB);
+    rtcp_set_length(buf, size / 4 - 1);
+    for (unsigned int i = 0; i < nb_fci; i++) {
+        uint8_t *fci = buf + RTCP_FB_HEADER_SIZE +
+                       i * RTCP_FB_FCI_GENERIC_NACK_SIZE;
+        rtcp_fb_nack_set_packet_id(fci, pids[i]);
+        rtcp_fb_nack_set_bitmask_lost(fci, blps[i]);
+    }
+    uref_block_unmap(uref, 0);
+    upipe_input(rtcpfb_input, uref, NULL);
+}
+
+/** checks the statistics of the pipe */
+static void check_stats(uint64_t nacked, uint64_t retransmitted,
+                        uint64_t missing, uint64_t rate_limited,
+                        unsigned int history)
+{
+    uint64_t n, r, m, l;
+    unsigned int h;
+    ubase_assert(upipe_rtcpfb_get_stats(rtcpfb, &n, &r, &m, &l, &h));
+    assert(n == nacked);
+    assert(r == retransmitted);
+    assert(m == missing);
+    assert(l == rate_limited);
+    assert(h == history);
+}
+
+/** checks the packets retransmitted since the given index */
+static void check_rtx(unsigned int from, const uint16_t *seqnums,
+                      unsigned int nb, uint8_t cycle)
+{
+    assert(nb_rtx >= from + nb);
+    for (unsigned int i = 0; i < nb; i++) {
+        assert(rtx[from + i] == seqnums[i]);
+        assert(rtx_cycle[from + i] == cycle);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    struct upump_mgr *upump_mgr = upump_ev_mgr_alloc_default(UPUMP_POOL,
+            UPUMP_BLOCKER_POOL);
+    assert(upump_mgr != NULL);
+    struct umem_mgr *umem_mgr = umem_alloc_mgr_alloc();
+    assert(umem_mgr != NULL);
+    struct udict_mgr *udict_mgr = udict_inline_mgr_alloc(UDICT_POOL_DEPTH,
+                                                         umem_mgr, -1, -1);
+    assert(udict_mgr != NULL);
+    uref_mgr = uref_std_mgr_alloc(UREF_POOL_DEPTH, udict_mgr, 0);
+    assert(uref_mgr != NULL);
+    ubuf_mgr = ubuf_block_mem_mgr_alloc(UBUF_POOL_DEPTH, UBUF_POOL_DEPTH,
+                                        umem_mgr, 0, 0, -1, 0);
+    assert(ubuf_mgr != NULL);
+
+    struct uclock uclock;
+    uclock.refcount = NULL;
+    uclock.uclock_now = test_now;
+    uclock.uclock_to_real = uclock.uclock_from_real = NULL;
+
+    struct uprobe uprobe;
+    uprobe_init(&uprobe, catch, NULL);
+    struct uprobe *logger = uprobe_stdio_alloc(&uprobe, stdout,
+                                               UPROBE_LOG_LEVEL);
+    assert(logger != NULL);
+    logger = uprobe_uref_mgr_alloc(logger, uref_mgr);
+    assert(logger != NULL);
+    logger = uprobe_upump_mgr_alloc(logger, upump_mgr);
+    assert(logger != NULL);
+    logger = uprobe_uclock_alloc(logger, &uclock);
+    assert(logger != NULL);
+    logger = uprobe_ubuf_mem_alloc(logger, umem_mgr, UBUF_POOL_DEPTH,
+                                   UBUF_POOL_DEPTH);
+    assert(logger != NULL);
+
+    struct upipe *sink = upipe_void_alloc(&test_mgr,
+            uprobe_pfx_alloc(uprobe_use(logger), UPROBE_LOG_LEVEL, "sink"));
+    assert(sink != NULL);
+
+    struct upipe_mgr *upipe_rtcpfb_mgr = upipe_rtcpfb_mgr_alloc();
+    assert(upipe_rtcpfb_mgr != NULL);
+    rtcpfb = upipe_void_alloc(upipe_rtcpfb_mgr,
+            uprobe_pfx_alloc(uprobe_use(logger), UPROBE_LOG_LEVEL, "rtcpfb"));
+    assert(rtcpfb != NULL);
+    ubase_assert(upipe_set_output(rtcpfb, sink));
+    ubase_assert(upipe_rtcpfb_set_rtx_pt(rtcpfb, RTX_PT));
+
+    struct uref *flow_def = uref_block_flow_alloc_def(uref_mgr, "rtp.");
+    assert(flow_def != NULL);
+    ubase_assert(upipe_set_flow_def(rtcpfb, flow_def));
+
+    rtcpfb_input = upipe_void_alloc_sub(rtcpfb,
+            uprobe_pfx_alloc(uprobe_use(logger), UPROBE_LOG_LEVEL,
+                             "rtcpfb input"));
+    assert(rtcpfb_input != NULL);
+    ubase_assert(upipe_set_flow_def(rtcpfb_input, flow_def));
+    uref_free(flow_def);
+
+    for (uint16_t i = 0; i < NB_PACKETS; i++)
+        send_packet(i, 0);
+    assert(nb_media == NB_PACKETS);
+    check_stats(0, 0, 0, 0, NB_PACKETS);
+
+    /* packets older than the window are output but not kept */
+    send_packet(UINT16_MAX - 5, 0);
+    assert(nb_media == NB_PACKETS + 1);
+    check_stats(0, 0, 0, 0, NB_PACKETS);
+
+    /* several FCIs, with BLP bits and a packet not in the history */
+    static const uint16_t pids[] = { 5, 20, 60 };
+    static const uint16_t blps[] = { 0x0005, 0x8000, 0x0000 };
+    send_nack(pids, blps, 3);
+    static const uint16_t first_rtx[] = { 5, 6, 8, 20, 36 };
+    check_rtx(0, first_rtx, 5, 0);
+    assert(nb_rtx == 5);
+    check_stats(6, 5, 1, 0, NB_PACKETS);
+
+    /* rate limit */
+    ubase_assert(upipe_rtcpfb_set_rtx_rate(rtcpfb, RTX_RATE));
+    uint64_t rate;
+    ubase_assert(upipe_rtcpfb_get_rtx_rate(rtcpfb, &rate));
+    assert(rate == RTX_RATE);
+    static const uint16_t burst_pids[] = { 10 };
+    static const uint16_t burst_blps[] = { 0xffff };
+    send_nack(burst_pids, burst_blps, 1);
+    static const uint16_t burst_rtx[] = { 10, 11, 12, 13, 14 };
+    check_rtx(5, burst_rtx, RTX_BURST, 0);
+    assert(nb_rtx == 5 + RTX_BURST);
+    check_stats(6 + 17, 5 + RTX_BURST, 1, 17 - RTX_BURST, NB_PACKETS);
+
+    /* the credit is restored at the given rate */
+    now += UCLOCK_FREQ / RTX_RATE;
+    static const uint16_t single_pids[] = { 40 };
+    static const uint16_t single_blps[] = { 0x0003 };
+    send_nack(single_pids, single_blps, 1);
+    static const uint16_t single_rtx[] = { 40 };
+    check_rtx(5 + RTX_BURST, single_rtx, 1, 0);
+    assert(nb_rtx == 5 + RTX_BURST + 1);
+    check_stats(6 + 17 + 3, 5 + RTX_BURST + 1, 1, 17 - RTX_BURST + 2,
+                NB_PACKETS);
+    ubase_assert(upipe_rtcpfb_set_rtx_rate(rtcpfb, 0));
+    unsigned int rtx_base = nb_rtx;
+
+    /* forward jumps, leaving holes, until the seqnums wrap into the window:
+     * the packets of the previous cycle up to the new one are forgotten */
+    send_packet(20000, 0);
+    send_packet(40000, 0);
+    check_stats(26, 11, 1, 14, 40001);
+    send_packet(5000, 1);
+    check_stats(26, 11, 1, 14, UINT16_MAX + 1);
+
+    static const uint16_t wrap_pids[] = { 3, 5000, 20000 };
+    static const uint16_t wrap_blps[] = { 0x0000, 0x0000, 0x0000 };
+    send_nack(wrap_pids, wrap_blps, 3);
+    static const uint16_t new_rtx[] = { 5000 };
+    check_rtx(rtx_base, new_rtx, 1, 1);
+    static const uint16_t old_rtx[] = { 20000 };
+    check_rtx(rtx_base + 1, old_rtx, 1, 0);
+    assert(nb_rtx == rtx_base + 2);
+    check_stats(29, 13, 2, 14, UINT16_MAX + 1);
+
+    upipe_release(rtcpfb_input);
+    upipe_release(rtcpfb);
+    upipe_mgr_release(upipe_rtcpfb_mgr); // nop
+    test_free(sink);
+
+    upump_mgr_release(upump_mgr);
+    ubuf_mgr_release(ubuf_mgr);
+    uref_mgr_release(uref_mgr);
+    udict_mgr_release(udict_mgr);
+    umem_mgr_release(umem_mgr);
+    uprobe_release(logger);
+    uprobe_clean(&uprobe);
+    return 0;
+}
@@ -0,0 +1,434 @@
+/*
+ * Copyright (C) 2017 OpenHeadend S.A.R.L.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/** @file
+ * @short unit tests for rtp fec encoder pipe, through the rtp fec decoder
+ */
+
+#undef NDEBUG
+
+#include <upipe/uprobe.h>
+#include <upipe/uprobe_stdio.h>
+#include <upipe/uprobe_prefix.h>
+#include <upipe/uprobe_uref_mgr.h>
+#include <upipe/uprobe_upump_mgr.h>
+#include <upipe/uprobe_uclock.h>
+#include <upipe/uprobe_ubuf_mem.h>
+#include <upipe/uclock.h>
+#include <upipe/uclock_std.h>
+#include <upipe/umem.h>
+#include <upipe/umem_alloc.h>
+#include <upipe/udict.h>
+#include <upipe/udict_inline.h>
+#include <upipe/ubuf.h>
+#include <upipe/ubuf_block.h>
+#include <upipe/ubuf_block_mem.h>
+#include <upipe/uref.h>
+#include <upipe/uref_block.h>
+#include <upipe/uref_block_flow.h>
+#include <upipe/uref_clock.h>
+#include <upipe/uref_std.h>
+#include <upipe/upump.h>
+#include <upump-ev/upump_ev.h>
+#include <upipe/upipe.h>
+#include <upipe/upipe_helper_upipe.h>
+#include <upipe-ts/upipe_rtp_fec.h>
+#include <upipe-ts/upipe_rtp_fec_enc.h>
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include <assert.h>
+
+#include <bitstream/ietf/rtp.h>
+#include <bitstream/mpeg/ts.h>
+#include <bitstream/smpte/2022_1_fec.h>
+
+#define UDICT_POOL_DEPTH 0
+#define UREF_POOL_DEPTH 0
+#define UBUF_POOL_DEPTH 0
+#define UPUMP_POOL 0
+#define UPUMP_BLOCKER_POOL 0
+#define UPROBE_LOG_LEVEL UPROBE_LOG_DEBUG
+#define COLUMNS 4
+#define ROWS 4
+#define MATRICES 8
+#define NB_PACKETS (COLUMNS * ROWS * MATRICES)
+/** the row output is detached in the middle of the second matrix, and the
+ * matrix restarts when it is attached again */
+#define DETACH (COLUMNS * ROWS + 5)
+#define REATTACH (COLUMNS * ROWS + 9)
+#define SEQNUM_BASE 100
+#define PAYLOAD_SIZE (7 * TS_SIZE)
+#define MEDIA_PT 33
+/** interval between two packets */
+#define PERIOD (UCLOCK_FREQ / 1000)
+
+/** dropped packets: two in the same row, recovered by column FEC, and one in
+ * the next matrix */
+static const uint16_t dropped[] = {
+    SEQNUM_BASE + 3 * COLUMNS * ROWS + 1,
+    SEQNUM_BASE + 3 * COLUMNS * ROWS + 2,
+    SEQNUM_BASE + 4 * COLUMNS * ROWS + 6,
+};
+#define NB_DROPPED (sizeof(dropped) / sizeof(dropped[0]))
+
+static struct upipe *fec_main = NULL;
+static struct upipe *fec = NULL;
+static bool received[UINT16_MAX + 1];
+static unsigned int nb_received = 0;
+static unsigned int nb_col = 0;
+static unsigned int nb_row = 0;
+static uint64_t recovered = 0;
+
+/** definition of our uprobe */
+static int catch(struct uprobe *uprobe, struct upipe *upipe,
+                 int event, va_list args)
+{
+    switch (event) {
+        default:
+            assert(0);
+            break;
+        case UPROBE_READY:
+        case UPROBE_DEAD:
+        case UPROBE_NEW_FLOW_DEF:
+            break;
+    }
+    return UBASE_ERR_NONE;
+}
+
+/** @This fills the payload of a media packet. */
+static uint8_t payload_byte(uint16_t seqnum, int i)
+{
+    return (seqnum * 7 + i) & 0xff;
+}
+
+/** helper phony pipe */
+struct test_pipe {
+    /** pipe to forward to, or NULL for the final sink */
+    struct upipe *forward;
+    /** counter of received packets, or NULL */
+    unsigned int *counter;
+    /** public upipe structure */
+    struct upipe upipe;
+};
+
+/** helper phony pipe */
+UPIPE_HELPER_UPIPE(test_pipe, upipe, 0);
+
+/** helper phony pipe */
+static struct upipe *test_alloc(struct upipe_mgr *mgr, struct uprobe *uprobe,
+                                uint32_t signature, va_list args)
+{
+    struct test_pipe *test_pipe = malloc(sizeof(struct test_pipe));
+    assert(test_pipe != NULL);
+    test_pipe->forward = NULL;
+    test_pipe->counter = NULL;
+    upipe_init(&test_pipe->upipe, mgr, uprobe);
+    upipe_throw_ready(&test_pipe->upipe);
+    return &test_pipe->upipe;
+}
+
+/** helper phony pipe */
+static void test_input(struct upipe *upipe, struct uref *uref,
+                       struct upump **upump_p)
+{
+    struct test_pipe *test_pipe = test_pipe_from_upipe(upipe);
+    assert(uref != NULL);
+    if (test_pipe->counter != NULL)
+        (*test_pipe->counter)++;
+
+    uint8_t buf[RTP_HEADER_SIZE];
+    const uint8_t *rtp = uref_block_peek(uref, 0, RTP_HEADER_SIZE, buf);
+    assert(rtp != NULL);
+    uint16_t seqnum = rtp_get_seqnum(rtp);
+    uint8_t pt = rtp_get_type(rtp);
+    uint32_t timestamp = rtp_get_timestamp(rtp);
+    uref_block_peek_unmap(uref, 0, buf, rtp);
+
+    if (pt != MEDIA_PT) {
+        /* FEC packets carry the timestamp of the last protected packet */
+        uint8_t fec_buf[SMPTE_2022_FEC_HEADER_SIZE];
+        const uint8_t *fec = uref_block_peek(uref, RTP_HEADER_SIZE,
+                                             SMPTE_2022_FEC_HEADER_SIZE,
+                                             fec_buf);
+        assert(fec != NULL);
+        uint16_t last = smpte_fec_get_snbase_low(fec) +
+            (smpte_fec_get_na(fec) - 1) * smpte_fec_get_offset(fec);
+        uref_block_peek_unmap(uref, RTP_HEADER_SIZE, fec_buf, fec);
+        assert(timestamp == (uint16_t)(last - SEQNUM_BASE) * 90);
+    }
+
+    if (test_pipe->forward != NULL) {
+        /* loss simulation on the media stream */
+        if (pt == MEDIA_PT)
+            for (int i = 0; i < NB_DROPPED; i++)
+                if (seqnum == dropped[i]) {
+                    upipe_dbg_va(upipe, "dropping %hu", seqnum);
+                    uref_free(uref);
+                    return;
+                }
+        upipe_input(test_pipe->forward, uref, upump_p);
+        return;
+    }
+
+    /* final sink: check the payload of the packets */
+    size_t size;
+    ubase_assert(uref_block_size(uref, &size));
+    assert(size == RTP_HEADER_SIZE + PAYLOAD_SIZE);
+    assert(pt == MEDIA_PT);
+    uint8_t payload[PAYLOAD_SIZE];
+    ubase_assert(uref_block_extract(uref, RTP_HEADER_SIZE, PAYLOAD_SIZE,
+                                    payload));
+    for (int i = 0; i < PAYLOAD_SIZE; i++)
+        assert(payload[i] == payload_byte(seqnum, i));
+    assert(!received[seqnum]);
+    received[seqnum] = true;
+    nb_received++;
+    uref_free(uref);
+}
+
+/** helper phony pipe */
+static int test_control(struct upipe *upipe, int command, va_list args)
+{
+    struct test_pipe *test_pipe = test_pipe_from_upipe(upipe);
+    switch (command) {
+        case UPIPE_SET_FLOW_DEF:
+            if (test_pipe->forward != NULL) {
+                struct uref *flow_def = va_arg(args, struct uref *);
+                return upipe_set_flow_def(test_pipe->forward, flow_def);
+            }
+            return UBASE_ERR_NONE;
+        case UPIPE_REGISTER_REQUEST: {
+            struct urequest *urequest = va_arg(args, struct urequest *);
+            return upipe_throw_provide_request(upipe, urequest);
+        }
+        case UPIPE_UNREGISTER_REQUEST:
+            return UBASE_ERR_NONE;
+        default:
+            assert(0);
+            return UBASE_ERR_UNHANDLED;
+    }
+}
+
+/** helper phony pipe */
+static void test_free(struct upipe *upipe)
+{
+    struct test_pipe *test_pipe = test_pipe_from_upipe(upipe);
+    upipe_dbg_va(upipe, "releasing pipe %p", upipe);
+    upipe_throw_dead(upipe);
+    upipe_clean(upipe);
+    free(test_pipe);
+}
+
+/** helper phony pipe */
+static struct upipe_mgr test_mgr = {
+    .refcount = NULL,
+    .signature = 0,
+    .upipe_alloc = test_alloc,
+    .upipe_input = test_input,
+    .upipe_control = test_control
+};
+
+/** stops the test once all packets had a chance to be output */
+static void stop(struct upump *upump)
+{
+    upump_stop(upump);
+    upump_free(upump);
+    ubase_assert(upipe_rtp_fec_get_packets_recovered(fec, &recovered));
+    upipe_release(fec);
+    fec = NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    struct umem_mgr *umem_mgr = umem_alloc_mgr_alloc();
+    assert(umem_mgr != NULL);
+    struct udict_mgr *udict_mgr = udict_inline_mgr_alloc(UDICT_POOL_DEPTH,
+                                                         umem_mgr, -1, -1);
+    assert(udict_mgr != NULL);
+    struct uref_mgr *uref_mgr = uref_std_mgr_alloc(UREF_POOL_DEPTH,
+                                                   udict_mgr, 0);
+    assert(uref_mgr != NULL);
+    struct ubuf_mgr *ubuf_mgr = ubuf_block_mem_mgr_alloc(UBUF_POOL_DEPTH,
+            UBUF_POOL_DEPTH, umem_mgr, 0, 0, -1, 0);
+    assert(ubuf_mgr != NULL);
+    struct upump_mgr *upump_mgr = upump_ev_mgr_alloc_default(UPUMP_POOL,
+            UPUMP_BLOCKER_POOL);
+    assert(upump_mgr != NULL);
+    struct uclock *uclock = uclock_std_alloc(0);
+    assert(uclock != NULL);
+    struct uprobe uprobe;
+    uprobe_init(&uprobe, catch, NULL);
+    struct uprobe *logger = uprobe_stdio_alloc(&uprobe, stdout,
+                                               UPROBE_LOG_LEVEL);
+    assert(logger != NULL);
+    logger = uprobe_uref_mgr_alloc(logger, uref_mgr);
+    assert(logger != NULL);
+    logger = uprobe_upump_mgr_alloc(logger, upump_mgr);
+    assert(logger != NULL);
+    logger = uprobe_uclock_alloc(logger, uclock);
+    assert(logger != NULL);
+    logger = uprobe_ubuf_mem_alloc(logger, umem_mgr, UBUF_POOL_DEPTH,
+                                   UBUF_POOL_DEPTH);
+    assert(logger != NULL);
+
+    /* decoder and final sink */
+    struct upipe_mgr *upipe_rtp_fec_mgr = upipe_rtp_fec_mgr_alloc();
+    assert(upipe_rtp_fec_mgr != NULL);
+    fec = upipe_rtp_fec_alloc(upipe_rtp_fec_mgr,
+            uprobe_pfx_alloc(uprobe_use(logger), UPROBE_LOG_LEVEL, "fec"),
+            uprobe_pfx_alloc(uprobe_use(logger), UPROBE_LOG_LEVEL,
+                             "fec main"),
+            uprobe_pfx_alloc(uprobe_use(logger), UPROBE_LOG_LEVEL, "fec col"),
+            uprobe_pfx_alloc(uprobe_use(logger), UPROBE_LOG_LEVEL,
+                             "fec row"));
+    assert(fec != NULL);
+    upipe_mgr_release(upipe_rtp_fec_mgr);
+    ubase_assert(upipe_rtp_fec_set_pt(fec, MEDIA_PT));
+    ubase_assert(upipe_attach_uclock(fec));
+    struct upipe *fec_col, *fec_row;
+    ubase_assert(upipe_rtp_fec_get_main_sub(fec, &fec_main));
+    ubase_assert(upipe_rtp_fec_get_col_sub(fec, &fec_col));
+    ubase_assert(upipe_rtp_fec_get_row_sub(fec, &fec_row));
+
+    struct upipe *sink = upipe_void_alloc(&test_mgr,
+            uprobe_pfx_alloc(uprobe_use(logger), UPROBE_LOG_LEVEL, "sink"));
+    assert(sink != NULL);
+    ubase_assert(upipe_set_output(fec, sink));
+
+    /* encoder, with phony pipes counting packets between both */
+    struct upipe_mgr *upipe_rtp_fec_enc_mgr = upipe_rtp_fec_enc_mgr_alloc();
+    assert(upipe_rtp_fec_enc_mgr != NULL);
+    struct upipe *enc = upipe_rtp_fec_enc_alloc(upipe_rtp_fec_enc_mgr,
+            uprobe_pfx_alloc(uprobe_use(logger), UPROBE_LOG_LEVEL,
+                             "fec enc"),
+            uprobe_pfx_alloc(uprobe_use(logger), UPROBE_LOG_LEVEL,
+                             "fec enc col"),
+            uprobe_pfx_alloc(uprobe_use(logger), UPROBE_LOG_LEVEL,
+                             "fec enc row"));
+    assert(enc != NULL);
+    upipe_mgr_release(upipe_rtp_fec_enc_mgr);
+    assert(!ubase_check(upipe_rtp_fec_enc_set_matrix(enc, 0, ROWS)));
+    assert(!ubase_check(upipe_rtp_fec_enc_set_matrix(enc, 20, 20)));
+    ubase_assert(upipe_rtp_fec_enc_set_matrix(enc, COLUMNS, ROWS));
+    unsigned columns, rows;
+    ubase_assert(upipe_rtp_fec_enc_get_matrix(enc, &columns, &rows));
+    assert(columns == COLUMNS);
+    assert(rows == ROWS);
+
+    struct upipe *loss = upipe_void_alloc(&test_mgr,
+            uprobe_pfx_alloc(uprobe_use(logger), UPROBE_LOG_LEVEL, "loss"));
+    assert(loss != NULL);
+    test_pipe_from_upipe(loss)->forward = fec_main;
+    ubase_assert(upipe_set_output(enc, loss));
+
+    struct upipe *enc_col, *enc_row;
+    ubase_assert(upipe_rtp_fec_enc_get_col_sub(enc, &enc_col));
+    ubase_assert(upipe_rtp_fec_enc_get_row_sub(enc, &enc_row));
+    struct upipe *col = upipe_void_alloc(&test_mgr,
+            uprobe_pfx_alloc(uprobe_use(logger), UPROBE_LOG_LEVEL, "col"));
+    assert(col != NULL);
+    test_pipe_from_upipe(col)->forward = fec_col;
+    test_pipe_from_upipe(col)->counter = &nb_col;
+    ubase_assert(upipe_set_output(enc_col, col));
+    struct upipe *row = upipe_void_alloc(&test_mgr,
+            uprobe_pfx_alloc(uprobe_use(logger), UPROBE_LOG_LEVEL, "row"));
+    assert(row != NULL);
+    test_pipe_from_upipe(row)->forward = fec_row;
+    test_pipe_from_upipe(row)->counter = &nb_row;
+    ubase_assert(upipe_set_output(enc_row, row));
+
+    struct uref *flow_def = uref_block_flow_alloc_def(uref_mgr,
+                                                      "rtp.mpegts.");
+    assert(flow_def != NULL);
+    ubase_assert(upipe_set_flow_def(enc, flow_def));
+    uref_free(flow_def);
+
+    /* feed the encoder, with increasing dates in the past as if the packets
+     * had been buffered by the socket */
+    memset(received, 0, sizeof(received));
+    uint64_t now = uclock_now(uclock) - NB_PACKETS * PERIOD;
+    for (int i = 0; i < NB_PACKETS; i++) {
+        uint16_t seqnum = SEQNUM_BASE + i;
+        struct uref *uref = uref_block_alloc(uref_mgr, ubuf_mgr,
+                                             RTP_HEADER_SIZE + PAYLOAD_SIZE);
+        assert(uref != NULL);
+        uint8_t *buf;
+        int size = -1;
+        ubase_assert(uref_block_write(uref, 0, &size, &buf));
+        memset(buf, 0, RTP_HEADER_SIZE);
+        rtp_set_hdr(buf);
+        rtp_set_type(buf, MEDIA_PT);
+        rtp_set_seqnum(buf, seqnum);
+        rtp_set_timestamp(buf, i * 90);
+        for (int j = 0; j < PAYLOAD_SIZE; j++)
+            buf[RTP_HEADER_SIZE + j] = payload_byte(seqnum, j);
+        ubase_assert(uref_block_unmap(uref, 0));
+        uref_clock_set_cr_sys(uref, now + i * PERIOD);
+        if (i == DETACH)
+            ubase_assert(upipe_set_output(enc_row, NULL));
+        else if (i == REATTACH)
+            ubase_assert(upipe_set_output(enc_row, row));
+        upipe_input(enc, uref, NULL);
+    }
+    /* the columns of the second matrix are never complete */
+    assert(nb_col == COLUMNS +
+           (NB_PACKETS - REATTACH) / (COLUMNS * ROWS) * COLUMNS);
+    assert(nb_row == DETACH / COLUMNS + (NB_PACKETS - REATTACH) / COLUMNS);
+
+    struct upump *upump = upump_alloc_timer(upump_mgr, stop, NULL, NULL,
+                                            UCLOCK_FREQ, 0);
+    assert(upump != NULL);
+    upump_start(upump);
+
+    /* fire */
+    upump_mgr_run(upump_mgr, NULL);
+
+    /* the decoder only outputs the matrices it could protect */
+    printf("received %u packets, recovered %"PRIu64"\n", nb_received,
+           recovered);
+    assert(recovered == NB_DROPPED);
+    for (int i = 0; i < NB_DROPPED; i++)
+        assert(received[dropped[i]]);
+
+    /* release */
+    upipe_release(enc);
+    test_free(loss);
+    test_free(col);
+    test_free(row);
+    test_free(sink);
+    upump_mgr_release(upump_mgr);
+    uref_mgr_release(uref_mgr);
+    ubuf_mgr_release(ubuf_mgr);
+    udict_mgr_release(udict_mgr);
+    umem_mgr_release(umem_mgr);
+    uclock_release(uclock);
+    uprobe_release(logger);
+    uprobe_clean(&uprobe);
+
+    return 0;
+}
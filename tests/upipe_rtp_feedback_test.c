@@ -0,0 +1,507 @@
+/*
+ * Copyright (C) 2017 OpenHeadend S.A.R.L.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** @file
+ * @short unit tests for rtp feedback pipe
+ */
+
+#undef NDEBUG
+
+#include <upipe/uprobe.h>
+#include <upipe/uprobe_stdio.h>
+#include <upipe/uprobe_prefix.h>
+#include <upipe/uprobe_uref_mgr.h>
+#include <upipe/uprobe_upump_mgr.h>
+#include <upipe/uprobe_uclock.h>
+#include <upipe/uprobe_ubuf_mem.h>
+#include <upipe/uclock.h>
+#include <upipe/umem.h>
+#include <upipe/umem_alloc.h>
+#include <upipe/udict.h>
+#include <upipe/udict_inline.h>
+#include <upipe/ubuf.h>
+#include <upipe/ubuf_block_mem.h>
+#include <upipe/uref.h>
+#include <upipe/uref_block.h>
+#include <upipe/uref_block_flow.h>
+#include <upipe/uref_clock.h>
+#include <upipe/uref_std.h>
+#include <upipe/upump.h>
+#include <upump-ev/upump_ev.h>
+#include <upipe/upipe.h>
+#include <upipe/upipe_helper_upipe.h>
+#include <upipe-filters/upipe_rtp_feedback.h>
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <string.h>
+#include <assert.h>
+
+#include <bitstream/ietf/rtp.h>
+#include <bitstream/ietf/rtcp_fb.h>
+
+#define UDICT_POOL_DEPTH 0
+#define UREF_POOL_DEPTH 0
+#define UBUF_POOL_DEPTH 0
+#define UPUMP_POOL 0
+#define UPUMP_BLOCKER_POOL 0
+#define UPROBE_LOG_LEVEL UPROBE_LOG_DEBUG
+#define MEDIA_PT 33
+#define PAYLOAD_SIZE 4
+/** buffer latency, in milliseconds */
+#define LATENCY_MS 200
+#define LATENCY (UCLOCK_FREQ * LATENCY_MS / 1000)
+/** round-trip time announced to the pipe */
+#define RTT (UCLOCK_FREQ / 10)
+/** real time during which the event loop runs, in milliseconds */
+#define RUN_MS 50
+/** maximum size of a NACK packet */
+#define NACK_MAX_SIZE (RTCP_FB_HEADER_SIZE + 64 * RTCP_FB_FCI_GENERIC_NACK_SIZE)
+
+static struct ev_loop *loop;
+static uint64_t now = 10 * UCLOCK_FREQ;
+static struct uref_mgr *uref_mgr;
+static struct ubuf_mgr *ubuf_mgr;
+static struct upipe *rtpfb;
+
+/** sequence numbers output by the pipe */
+static uint16_t output[UINT16_MAX + 1];
+static unsigned int nb_output = 0;
+/** last NACK packet */
+static uint8_t nack[NACK_MAX_SIZE];
+static size_t nack_size = 0;
+static unsigned int nb_nacks = 0;
+
+/** definition of our uprobe */
+static int catch(struct uprobe *uprobe, struct upipe *upipe,
+                 int event, va_list args)
+{
+    switch (event) {
+        default:
+            assert(0);
+            break;
+        case UPROBE_READY:
+        case UPROBE_DEAD:
+        case UPROBE_NEW_FLOW_DEF:
+        case UPROBE_SOURCE_END:
+            break;
+    }
+    return UBASE_ERR_NONE;
+}
+
+/** helper uclock */
+static uint64_t test_now(struct uclock *uclock)
+{
+    return now;
+}
+
+/** helper phony pipe */
+struct test_pipe {
+    /** true if the pipe receives the NACKs */
+    bool nack;
+    /** public upipe structure */
+    struct upipe upipe;
+};
+
+/** helper phony pipe */
+UPIPE_HELPER_UPIPE(test_pipe, upipe, 0);
+
+/** helper phony pipe */
+static struct upipe *test_alloc(struct upipe_mgr *mgr, struct uprobe *uprobe,
+                                uint32_t signature, va_list args)
+{
+    struct test_pipe *test_pipe = malloc(sizeof(struct test_pipe));
+    assert(test_pipe != NULL);
+    test_pipe->nack = false;
+    upipe_init(&test_pipe->upipe, mgr, uprobe);
+    upipe_throw_ready(&test_pipe->upipe);
+    return &test_pipe->upipe;
+}
+
+/** helper phony pipe */
+static void test_input(struct upipe *upipe, struct uref *uref,
+                       struct upump **upump_p)
+{
+    struct test_pipe *test_pipe = test_pipe_from_upipe(upipe);
+    assert(uref != NULL);
+    size_t size;
+    ubase_assert(uref_block_size(uref, &size));
+
+    if (test_pipe->nack) {
+        assert(size <= NACK_MAX_SIZE);
+        ubase_assert(uref_block_extract(uref, 0, size, nack));
+        nack_size = size;
+        nb_nacks++;
+        uref_free(uref);
+        return;
+    }
+
+    assert(size == RTP_HEADER_SIZE + PAYLOAD_SIZE);
+    uint8_t buf[RTP_HEADER_SIZE];
+    const uint8_t *rtp = uref_block_peek(uref, 0, RTP_HEADER_SIZE, buf);
+    assert(rtp != NULL);
+    assert(rtp_get_type(rtp) == MEDIA_PT);
+    output[nb_output++] = rtp_get_seqnum(rtp);
+    uref_block_peek_unmap(uref, 0, buf, rtp);
+    uref_free(uref);
+}
+
+/** helper phony pipe */
+static int test_control(struct upipe *upipe, int command, va_list args)
+{
+    switch (command) {
+        case UPIPE_SET_FLOW_DEF:
+            return UBASE_ERR_NONE;
+        case UPIPE_REGISTER_REQUEST: {
+            struct urequest *urequest = va_arg(args, struct urequest *);
+            return upipe_throw_provide_request(upipe, urequest);
+        }
+        case UPIPE_UNREGISTER_REQUEST:
+            return UBASE_ERR_NONE;
+        default:
+            assert(0);
+            return UBASE_ERR_UNHANDLED;
+    }
+}
+
+/** helper phony pipe */
+static void test_free(struct upipe *upipe)
+{
+    struct test_pipe *test_pipe = test_pipe_from_upipe(upipe);
+    upipe_dbg_va(upipe, "releasing pipe %p", upipe);
+    upipe_throw_dead(upipe);
+    upipe_clean(upipe);
+    free(test_pipe);
+}
+
+/** helper phony pipe */
+static struct upipe_mgr test_mgr = {
+    .refcount = NULL,
+    .signature = 0,
+    .upipe_alloc = test_alloc,
+    .upipe_input = test_input,
+    .upipe_control = test_control
+};
+
+/** sends a media packet dated now */
+static void send_packet(uint16_t seqnum)
+{
+    struct uref *uref = uref_block_alloc(uref_mgr, ubuf_mgr,
+                                         RTP_HEADER_SIZE + PAYLOAD_SIZE);
+    assert(uref != NULL);
+    uint8_t *buf;
+    int size = -1;
+    ubase_assert(uref_block_write(uref, 0, &size, &buf));
+    memset(buf, 0, size);
+    rtp_set_hdr(buf);
+    rtp_set_type(buf, MEDIA_PT);
+    rtp_set_seqnum(buf, seqnum);
+    uref_block_unmap(uref, 0);
+    uref_clock_set_cr_sys(uref, now);
+    upipe_input(rtpfb, uref, NULL);
+}
+
+/** sends the application-defined RTCP packet announcing the RTT */
+static void send_rtt(uint32_t rtt)
+{
+    struct uref *uref = uref_block_alloc(uref_mgr, ubuf_mgr, 16);
+    assert(uref != NULL);
+    uint8_t *buf;
+    int size = -1;
+    ubase_assert(uref_block_write(uref, 0, &size, &buf));
+    memset(buf, 0, size);
+    buf[0] = 0x80;
+    buf[1] = 204;
+    buf[3] = size / 4 - 1;
+    memcpy(&buf[8], "OBSR", 4);
+    buf[12] = rtt >> 24;
+    buf[13] = rtt >> 16;
+    buf[14] = rtt >> 8;
+    buf[15] = rtt;
+    uref_block_unmap(uref, 0);
+    upipe_input(rtpfb, uref, NULL);
+}
+
+/** breaks the event loop */
+static void stop(struct upump *upump)
+{
+    upump_stop(upump);
+    upump_free(upump);
+    ev_break(loop, EVBREAK_ALL);
+}
+
+/** runs the timers of the pipe for a while, without moving the clock */
+static void run(struct upump_mgr *upump_mgr)
+{
+    struct upump *upump = upump_alloc_timer(upump_mgr, stop, NULL, NULL,
+                                            UCLOCK_FREQ * RUN_MS / 1000, 0);
+    assert(upump != NULL);
+    upump_start(upump);
+    ev_run(loop, 0);
+}
+
+/** checks the retransmission counters */
+static void check_retransmit(uint64_t requested, uint64_t recovered,
+                             uint64_t late)
+{
+    uint64_t r, c, l;
+    ubase_assert(upipe_rtpfb_get_retransmit_stats(rtpfb, &r, &c, &l));
+    assert(r == requested);
+    assert(c == recovered);
+    assert(l == late);
+}
+
+/** checks the generic NACK FCIs of the last NACK packet */
+static void check_nack(const uint16_t *pids, const uint16_t *blps,
+                       unsigned int nb_fci)
+{
+    static const uint8_t header[RTCP_FB_HEADER_SIZE] = {
+        0x81, 205, 0, 0,            /* V=2, FMT=1, PT=RTPFB, length */
+        0x01, 0x02, 0x03, 0x04,     /* packet sender SSRC */
+        0x00, 0x00, 0x00, 0x00      /* media source SSRC */
+    };
+    assert(nack_size == RTCP_FB_HEADER_SIZE +
+                        nb_fci * RTCP_FB_FCI_GENERIC_NACK_SIZE);
+    assert(!memcmp(nack, header, 2));
+    assert(nack[2] == 0 && nack[3] == nack_size / 4 - 1);
+    assert(!memcmp(nack + 4, header + 4, 8));
+    for (unsigned int i = 0; i < nb_fci; i++) {
+        const uint8_t *fci = nack + RTCP_FB_HEADER_SIZE +
+                             i * RTCP_FB_FCI_GENERIC_NACK_SIZE;
+        assert(fci[0] == pids[i] >> 8 && fci[1] == (pids[i] & 0xff));
+        assert(fci[2] == blps[i] >> 8 && fci[3] == (blps[i] & 0xff));
+    }
+}
+
+/** checks the sequence numbers output since the given index */
+static void check_output(unsigned int from, const uint16_t *seqnums,
+                         unsigned int nb)
+{
+    assert(nb_output == from + nb);
+    for (unsigned int i = 0; i < nb; i++)
+        assert(output[from + i] == seqnums[i]);
+}
+
+int main(int argc, char *argv[])
+{
+    loop = ev_default_loop(0);
+    struct upump_mgr *upump_mgr = upump_ev_mgr_alloc(loop, UPUMP_POOL,
+                                                     UPUMP_BLOCKER_POOL);
+    assert(upump_mgr != NULL);
+    struct umem_mgr *umem_mgr = umem_alloc_mgr_alloc();
+    assert(umem_mgr != NULL);
+    struct udict_mgr *udict_mgr = udict_inline_mgr_alloc(UDICT_POOL_DEPTH,
+                                                         umem_mgr, -1, -1);
+    assert(udict_mgr != NULL);
+    uref_mgr = uref_std_mgr_alloc(UREF_POOL_DEPTH, udict_mgr, 0);
+    assert(uref_mgr != NULL);
+    ubuf_mgr = ubuf_block_mem_mgr_alloc(UBUF_POOL_DEPTH, UBUF_POOL_DEPTH,
+                                        umem_mgr, 0, 0, -1, 0);
+    assert(ubuf_mgr != NULL);
+
+    struct uclock uclock;
+    uclock.refcount = NULL;
+    uclock.uclock_now = test_now;
+    uclock.uclock_to_real = uclock.uclock_from_real = NULL;
+
+    struct uprobe uprobe;
+    uprobe_init(&uprobe, catch, NULL);
+    struct uprobe *logger = uprobe_stdio_alloc(&uprobe, stdout,
+                                               UPROBE_LOG_LEVEL);
+    assert(logger != NULL);
+    logger = uprobe_uref_mgr_alloc(logger, uref_mgr);
+    assert(logger != NULL);
+    logger = uprobe_upump_mgr_alloc(logger, upump_mgr);
+    assert(logger != NULL);
+    logger = uprobe_uclock_alloc(logger, &uclock);
+    assert(logger != NULL);
+    logger = uprobe_ubuf_mem_alloc(logger, umem_mgr, UBUF_POOL_DEPTH,
+                                   UBUF_POOL_DEPTH);
+    assert(logger != NULL);
+
+    struct upipe *sink = upipe_void_alloc(&test_mgr,
+            uprobe_pfx_alloc(uprobe_use(logger), UPROBE_LOG_LEVEL, "sink"));
+    assert(sink != NULL);
+    struct upipe *nack_sink = upipe_void_alloc(&test_mgr,
+            uprobe_pfx_alloc(uprobe_use(logger), UPROBE_LOG_LEVEL, "nack"));
+    assert(nack_sink != NULL);
+    test_pipe_from_upipe(nack_sink)->nack = true;
+
+    struct upipe_mgr *upipe_rtpfb_mgr = upipe_rtpfb_mgr_alloc();
+    assert(upipe_rtpfb_mgr != NULL);
+    rtpfb = upipe_void_alloc(upipe_rtpfb_mgr,
+            uprobe_pfx_alloc(uprobe_use(logger), UPROBE_LOG_LEVEL, "rtpfb"));
+    assert(rtpfb != NULL);
+    struct upipe *rtpfb_output = upipe_void_alloc_sub(rtpfb,
+            uprobe_pfx_alloc(uprobe_use(logger), UPROBE_LOG_LEVEL,
+                             "rtpfb output"));
+    assert(rtpfb_output != NULL);
+    ubase_assert(upipe_set_output(rtpfb_output, nack_sink));
+    ubase_assert(upipe_set_output(rtpfb, sink));
+
+    char latency[16];
+    snprintf(latency, sizeof(latency), "%u", LATENCY_MS);
+    ubase_assert(upipe_set_option(rtpfb, "latency", latency));
+
+    struct uref *flow_def = uref_block_flow_alloc_def(uref_mgr, "rtp.");
+    assert(flow_def != NULL);
+    ubase_assert(upipe_set_flow_def(rtpfb, flow_def));
+    uref_free(flow_def);
+
+    send_rtt(RTT);
+    run(upump_mgr);
+
+    /* reordering and duplicates */
+    send_packet(100);
+    send_packet(102);
+    send_packet(101);
+    send_packet(103);
+    send_packet(102);
+    check_retransmit(0, 1, 0);
+
+    unsigned int expected_seqnum, last_output_seqnum;
+    size_t buffered, nacks, repaired, lost, dups;
+    ubase_assert(upipe_rtpfb_get_stats(rtpfb, &expected_seqnum,
+                &last_output_seqnum, &buffered, &nacks, &repaired, &lost,
+                &dups));
+    assert(expected_seqnum == 104);
+    assert(buffered == 4);
+    assert(dups == 1);
+
+    /* the reordered packet arrived before a NACK was due */
+    run(upump_mgr);
+    assert(nb_nacks == 0);
+    assert(nb_output == 0);
+
+    now += LATENCY + 1;
+    run(upump_mgr);
+    static const uint16_t first_output[] = { 100, 101, 102, 103 };
+    check_output(0, first_output, 4);
+    assert(nb_nacks == 0);
+
+    /* holes, NACKed once the reordering delay elapsed */
+    uint64_t t0 = now;
+    send_packet(104);
+    send_packet(110);
+    send_packet(140);
+    now = t0 + RTT / 4;
+    run(upump_mgr);
+    assert(nb_nacks == 1);
+    static const uint16_t pids[] = { 105, 122, 139 };
+    static const uint16_t blps[] = { 0xffef, 0xffff, 0x0000 };
+    check_nack(pids, blps, 3);
+    check_retransmit(34, 1, 0);
+
+    /* hole recovered inside the window, and NACKs spaced by more than RTT */
+    send_packet(107);
+    check_retransmit(34, 2, 0);
+    run(upump_mgr);
+    assert(nb_nacks == 1);
+
+    now = t0 + RTT / 4 + RTT * 13 / 10;
+    run(upump_mgr);
+    assert(nb_nacks == 2);
+    static const uint16_t blps_recovered[] = { 0xffed, 0xffff, 0x0000 };
+    check_nack(pids, blps_recovered, 3);
+    check_retransmit(67, 2, 0);
+
+    /* the packets still missing are given up at their output date */
+    send_packet(141);
+    now = t0 + LATENCY + 1;
+    run(upump_mgr);
+    assert(nb_nacks == 2);
+    static const uint16_t second_output[] = { 104, 107, 110, 140 };
+    check_output(4, second_output, 4);
+    ubase_assert(upipe_rtpfb_get_stats(rtpfb, &expected_seqnum,
+                &last_output_seqnum, &buffered, &nacks, &repaired, &lost,
+                &dups));
+    assert(last_output_seqnum == 140);
+    assert(expected_seqnum == 142);
+    assert(buffered == 1);
+    assert(lost == 33);
+
+    /* late packet, outside of the window */
+    send_packet(105);
+    check_retransmit(67, 2, 1);
+    assert(nb_output == 8);
+
+    /* jump of at least 0x8000 seqnums past the next packet to output: the
+     * packets and holes which no longer fit in the window are flushed right
+     * away */
+    send_packet(141 + 0x4000);
+    assert(nb_output == 8);
+    send_packet(141 + 0x8000 + 10);
+    static const uint16_t flushed_output[] = { 141, 141 + 0x4000 };
+    check_output(8, flushed_output, 2);
+
+    now += LATENCY + 1;
+    run(upump_mgr);
+    static const uint16_t jump_output[] = { 141 + 0x8000 + 10 };
+    check_output(10, jump_output, 1);
+    ubase_assert(upipe_rtpfb_get_stats(rtpfb, &expected_seqnum,
+                &last_output_seqnum, &buffered, &nacks, &repaired, &lost,
+                &dups));
+    assert(buffered == 0);
+    assert(expected_seqnum == UINT_MAX);
+
+    /* sequence number wraparound, with a reordered packet */
+    send_packet(UINT16_MAX - 1);
+    send_packet(UINT16_MAX);
+    send_packet(1);
+    send_packet(0);
+    send_packet(2);
+    uint64_t requested;
+    ubase_assert(upipe_rtpfb_get_retransmit_stats(rtpfb, &requested, NULL,
+                                                  NULL));
+    check_retransmit(requested, 3, 1);
+
+    now += LATENCY + 1;
+    run(upump_mgr);
+    static const uint16_t wrap_output[] = { UINT16_MAX - 1, UINT16_MAX, 0, 1, 2 };
+    check_output(11, wrap_output, 5);
+    ubase_assert(upipe_rtpfb_get_stats(rtpfb, &expected_seqnum,
+                &last_output_seqnum, &buffered, &nacks, &repaired, &lost,
+                &dups));
+    assert(last_output_seqnum == 2);
+    assert(dups == 1);
+
+    upipe_release(rtpfb_output);
+    upipe_release(rtpfb);
+    upipe_mgr_release(upipe_rtpfb_mgr); // nop
+    test_free(sink);
+    test_free(nack_sink);
+
+    upump_mgr_release(upump_mgr);
+    ubuf_mgr_release(ubuf_mgr);
+    uref_mgr_release(uref_mgr);
+    udict_mgr_release(udict_mgr);
+    umem_mgr_release(umem_mgr);
+    uprobe_release(logger);
+    uprobe_clean(&uprobe);
+
+    ev_default_destroy();
+    return 0;
+}
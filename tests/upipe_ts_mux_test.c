@@ -0,0 +1,311 @@
+/*
+ * Copyright (C) 2017 OpenHeadend S.A.R.L.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** @file
+ * @short unit tests for TS mux module
+ */
+
+#undef NDEBUG
+
+#include <upipe/uprobe.h>
+#include <upipe/uprobe_stdio.h>
+#include <upipe/uprobe_prefix.h>
+#include <upipe/uprobe_uref_mgr.h>
+#include <upipe/uprobe_ubuf_mem.h>
+#include <upipe/umem.h>
+#include <upipe/umem_alloc.h>
+#include <upipe/uclock.h>
+#include <upipe/udict.h>
+#include <upipe/udict_inline.h>
+#include <upipe/ubuf.h>
+#include <upipe/ubuf_block.h>
+#include <upipe/ubuf_block_mem.h>
+#include <upipe/uref.h>
+#include <upipe/uref_flow.h>
+#include <upipe/uref_block_flow.h>
+#include <upipe/uref_block.h>
+#include <upipe/uref_sound_flow.h>
+#include <upipe/uref_clock.h>
+#include <upipe/uref_std.h>
+#include <upipe/upipe.h>
+#include <upipe-ts/upipe_ts_mux.h>
+#include <upipe-ts/uref_ts_flow.h>
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include <bitstream/mpeg/ts.h>
+
+#define UDICT_POOL_DEPTH 0
+#define UREF_POOL_DEPTH 0
+#define UBUF_POOL_DEPTH 0
+#define UPROBE_LOG_LEVEL UPROBE_LOG_DEBUG
+#define RATE 48000
+#define SAMPLES 1152
+/** size of a 192 kbits/s frame at 48 kHz */
+#define FRAME_SIZE 576
+#define OCTETRATE (FRAME_SIZE * RATE / SAMPLES)
+#define DURATION (SAMPLES * UCLOCK_FREQ / RATE)
+/** delay between the reception and the decoding of a frame */
+#define MUX_DELAY (UCLOCK_FREQ / 10)
+/** octetrate of the constant bitrate multiplex (1 Mbits/s) */
+#define CBR_OCTETRATE (1000000 / 8)
+/** number of TS packets in an output packet */
+#define CBR_PACKETS 7
+#define MTU (CBR_PACKETS * TS_SIZE)
+/** number of frames fed to the mux */
+#define NB_FRAMES 100
+
+/** true if output packets must be contiguous */
+static bool contiguous = false;
+/** true while output packets are captured */
+static bool capture = false;
+/** captured stream */
+static uint8_t *stream = NULL;
+/** size of the captured stream */
+static size_t stream_size = 0;
+
+/** definition of our uprobe */
+static int catch(struct uprobe *uprobe, struct upipe *upipe,
+                 int event, va_list args)
+{
+    /* the mux and its inner pipes throw a lot of informational events */
+    return UBASE_ERR_NONE;
+}
+
+/** helper phony pipe */
+static struct upipe *test_alloc(struct upipe_mgr *mgr, struct uprobe *uprobe,
+                                uint32_t signature, va_list args)
+{
+    struct upipe *upipe = malloc(sizeof(struct upipe));
+    assert(upipe != NULL);
+    upipe_init(upipe, mgr, uprobe);
+    return upipe;
+}
+
+/** helper phony pipe */
+static void test_input(struct upipe *upipe, struct uref *uref,
+                       struct upump **upump_p)
+{
+    assert(uref != NULL);
+    if (!capture) {
+        /* output packets flushed by the release of the mux */
+        uref_free(uref);
+        return;
+    }
+
+    size_t size;
+    ubase_assert(uref_block_size(uref, &size));
+    assert(size == MTU);
+    if (contiguous) {
+        size_t linear;
+        ubase_assert(uref_block_size_linear(uref, 0, &linear));
+        assert(linear == MTU);
+        assert(uref_block_iovec_count(uref, 0, -1) == 1);
+    }
+
+    stream = realloc(stream, stream_size + size);
+    assert(stream != NULL);
+    ubase_assert(uref_block_extract(uref, 0, size, stream + stream_size));
+    for (size_t i = 0; i < size; i += TS_SIZE)
+        assert(ts_validate(stream + stream_size + i));
+    stream_size += size;
+    uref_free(uref);
+}
+
+/** helper phony pipe */
+static int test_control(struct upipe *upipe, int command, va_list args)
+{
+    switch (command) {
+        case UPIPE_SET_FLOW_DEF:
+            return UBASE_ERR_NONE;
+        case UPIPE_REGISTER_REQUEST: {
+            struct urequest *urequest = va_arg(args, struct urequest *);
+            return upipe_throw_provide_request(upipe, urequest);
+        }
+        case UPIPE_UNREGISTER_REQUEST:
+            return UBASE_ERR_NONE;
+        default:
+            return UBASE_ERR_UNHANDLED;
+    }
+}
+
+/** helper phony pipe */
+static void test_free(struct upipe *upipe)
+{
+    upipe_clean(upipe);
+    free(upipe);
+}
+
+/** helper phony pipe */
+static struct upipe_mgr test_mgr = {
+    .refcount = NULL,
+    .upipe_alloc = test_alloc,
+    .upipe_input = test_input,
+    .upipe_control = test_control
+};
+
+/** @This multiplexes an MPEG-1 layer II stream into a constant bitrate
+ * transport stream, and captures the output.
+ *
+ * @param uprobe probe hierarchy providing the managers
+ * @param uref_mgr uref manager
+ * @param ubuf_mgr block manager
+ */
+static void test_mux(struct uprobe *uprobe, struct uref_mgr *uref_mgr,
+                     struct ubuf_mgr *ubuf_mgr)
+{
+    struct upipe *upipe_sink = upipe_void_alloc(&test_mgr,
+                                                uprobe_use(uprobe));
+    assert(upipe_sink != NULL);
+
+    struct upipe_mgr *upipe_ts_mux_mgr = upipe_ts_mux_mgr_alloc();
+    assert(upipe_ts_mux_mgr != NULL);
+    struct upipe *upipe_ts_mux = upipe_void_alloc(upipe_ts_mux_mgr,
+            uprobe_pfx_alloc(uprobe_use(uprobe), UPROBE_LOG_LEVEL, "ts mux"));
+    assert(upipe_ts_mux != NULL);
+    upipe_mgr_release(upipe_ts_mux_mgr);
+    ubase_assert(upipe_ts_mux_set_mode(upipe_ts_mux, UPIPE_TS_MUX_MODE_CBR));
+    ubase_assert(upipe_ts_mux_set_octetrate(upipe_ts_mux, CBR_OCTETRATE));
+    ubase_assert(upipe_set_output_size(upipe_ts_mux, MTU));
+    ubase_assert(upipe_ts_mux_set_contiguous(upipe_ts_mux, contiguous));
+    bool contiguous_mode;
+    ubase_assert(upipe_ts_mux_get_contiguous(upipe_ts_mux, &contiguous_mode));
+    assert(contiguous_mode == contiguous);
+    ubase_assert(upipe_set_output(upipe_ts_mux, upipe_sink));
+
+    struct uref *flow_def = uref_alloc_control(uref_mgr);
+    assert(flow_def != NULL);
+    ubase_assert(uref_flow_set_def(flow_def, "void."));
+    ubase_assert(upipe_set_flow_def(upipe_ts_mux, flow_def));
+
+    struct upipe *upipe_ts_mux_program = upipe_void_alloc_sub(upipe_ts_mux,
+            uprobe_pfx_alloc(uprobe_use(uprobe), UPROBE_LOG_LEVEL,
+                             "ts mux program"));
+    assert(upipe_ts_mux_program != NULL);
+    ubase_assert(uref_flow_set_id(flow_def, 1));
+    ubase_assert(uref_ts_flow_set_pid(flow_def, 256));
+    ubase_assert(upipe_set_flow_def(upipe_ts_mux_program, flow_def));
+    uref_free(flow_def);
+
+    flow_def = uref_block_flow_alloc_def(uref_mgr, "mp2.sound.");
+    assert(flow_def != NULL);
+    ubase_assert(uref_block_flow_set_octetrate(flow_def, OCTETRATE));
+    ubase_assert(uref_sound_flow_set_rate(flow_def, RATE));
+    ubase_assert(uref_sound_flow_set_samples(flow_def, SAMPLES));
+    ubase_assert(uref_ts_flow_set_pid(flow_def, 257));
+    struct upipe *upipe_ts_mux_input = upipe_void_alloc_sub(
+            upipe_ts_mux_program,
+            uprobe_pfx_alloc(uprobe_use(uprobe), UPROBE_LOG_LEVEL,
+                             "ts mux input"));
+    assert(upipe_ts_mux_input != NULL);
+    ubase_assert(upipe_set_flow_def(upipe_ts_mux_input, flow_def));
+    uref_free(flow_def);
+
+    capture = true;
+    uint64_t date = UCLOCK_FREQ;
+    for (int i = 0; i < NB_FRAMES; i++) {
+        struct uref *uref = uref_block_alloc(uref_mgr, ubuf_mgr, FRAME_SIZE);
+        assert(uref != NULL);
+        uint8_t *buffer;
+        int size = -1;
+        ubase_assert(uref_block_write(uref, 0, &size, &buffer));
+        assert(size == FRAME_SIZE);
+        /* MPEG-1 layer II, 192 kbits/s, 48 kHz, stereo */
+        buffer[0] = 0xff;
+        buffer[1] = 0xfd;
+        buffer[2] = 0xa4;
+        for (int j = 3; j < FRAME_SIZE; j++)
+            buffer[j] = i + j;
+        ubase_assert(uref_block_unmap(uref, 0));
+        uref_clock_set_cr_sys(uref, date);
+        uref_clock_set_dts_sys(uref, date + MUX_DELAY);
+        uref_clock_set_cr_prog(uref, date);
+        uref_clock_set_dts_prog(uref, date + MUX_DELAY);
+        uref_clock_set_dts_pts_delay(uref, 0);
+        uref_clock_set_duration(uref, DURATION);
+        upipe_input(upipe_ts_mux_input, uref, NULL);
+        date += DURATION;
+    }
+    capture = false;
+
+    upipe_release(upipe_ts_mux_input);
+    upipe_release(upipe_ts_mux_program);
+    upipe_release(upipe_ts_mux);
+    test_free(upipe_sink);
+}
+
+int main(int argc, char *argv[])
+{
+    struct umem_mgr *umem_mgr = umem_alloc_mgr_alloc();
+    assert(umem_mgr != NULL);
+    struct udict_mgr *udict_mgr = udict_inline_mgr_alloc(UDICT_POOL_DEPTH,
+                                                         umem_mgr, -1, -1);
+    assert(udict_mgr != NULL);
+    struct uref_mgr *uref_mgr = uref_std_mgr_alloc(UREF_POOL_DEPTH, udict_mgr,
+                                                   0);
+    assert(uref_mgr != NULL);
+    struct ubuf_mgr *ubuf_mgr = ubuf_block_mem_mgr_alloc(UBUF_POOL_DEPTH,
+                                                         UBUF_POOL_DEPTH,
+                                                         umem_mgr, 0, 0, -1, 0);
+    assert(ubuf_mgr != NULL);
+    struct uprobe uprobe;
+    uprobe_init(&uprobe, catch, NULL);
+    struct uprobe *logger = uprobe_stdio_alloc(&uprobe, stdout,
+                                               UPROBE_LOG_LEVEL);
+    assert(logger != NULL);
+    logger = uprobe_uref_mgr_alloc(logger, uref_mgr);
+    assert(logger != NULL);
+    logger = uprobe_ubuf_mem_alloc(logger, umem_mgr, UBUF_POOL_DEPTH,
+                                   UBUF_POOL_DEPTH);
+    assert(logger != NULL);
+
+    /* TS packets made of header and payload segments */
+    contiguous = false;
+    test_mux(logger, uref_mgr, ubuf_mgr);
+    assert(stream_size);
+    uint8_t *segmented = stream;
+    size_t segmented_size = stream_size;
+    stream = NULL;
+    stream_size = 0;
+
+    /* the same TS packets copied into single-segment buffers */
+    contiguous = true;
+    test_mux(logger, uref_mgr, ubuf_mgr);
+    assert(stream_size == segmented_size);
+    assert(!memcmp(stream, segmented, stream_size));
+    free(stream);
+    free(segmented);
+
+    uref_mgr_release(uref_mgr);
+    ubuf_mgr_release(ubuf_mgr);
+    udict_mgr_release(udict_mgr);
+    umem_mgr_release(umem_mgr);
+    uprobe_release(logger);
+    uprobe_clean(&uprobe);
+
+    return 0;
+}
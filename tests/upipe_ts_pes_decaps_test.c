@@ -32,6 +32,7 @@
 #include <upipe/uprobe.h>
 #include <upipe/uprobe_stdio.h>
 #include <upipe/uprobe_prefix.h>
+#include <upipe/uprobe_ubuf_mem.h>
 #include <upipe/umem.h>
 #include <upipe/umem_alloc.h>
 #include <upipe/udict.h>
@@ -61,6 +62,7 @@
 #define UREF_POOL_DEPTH 0
 #define UBUF_POOL_DEPTH 0
 #define UPROBE_LOG_LEVEL UPROBE_LOG_DEBUG
+#define TS_PAYLOAD 184
 
 static unsigned int nb_packets = 0;
 static uint64_t pts = 0x112121212;
@@ -70,6 +72,7 @@ static int end = UBASE_ERR_NONE;
 static size_t payload_size = 12;
 static bool expect_lost = false;
 static bool expect_acquired = true;
+static bool contiguous = false;
 
 /** definition of our uprobe */
 static int catch(struct uprobe *uprobe, struct upipe *upipe,
@@ -126,6 +129,11 @@ static void test_input(struct upipe *upipe, struct uref *uref,
     assert(size == payload_size);
     assert(dataalignment == uref_flow_get_random(uref));
     assert(end == uref_block_get_end(uref));
+    if (contiguous) {
+        size_t linear;
+        ubase_assert(uref_block_size_linear(uref, 0, &linear));
+        assert(linear == size);
+    }
     uref_free(uref);
     nb_packets--;
 }
@@ -136,6 +144,12 @@ static int test_control(struct upipe *upipe, int command, va_list args)
     switch (command) {
         case UPIPE_SET_FLOW_DEF:
             return UBASE_ERR_NONE;
+        case UPIPE_REGISTER_REQUEST: {
+            struct urequest *urequest = va_arg(args, struct urequest *);
+            return upipe_throw_provide_request(upipe, urequest);
+        }
+        case UPIPE_UNREGISTER_REQUEST:
+            return UBASE_ERR_NONE;
         default:
             assert(0);
             return UBASE_ERR_UNHANDLED;
@@ -176,6 +190,9 @@ int main(int argc, char *argv[])
     struct uprobe *uprobe_stdio = uprobe_stdio_alloc(&uprobe, stdout,
                                                      UPROBE_LOG_LEVEL);
     assert(uprobe_stdio != NULL);
+    uprobe_stdio = uprobe_ubuf_mem_alloc(uprobe_stdio, umem_mgr,
+                                         UBUF_POOL_DEPTH, UBUF_POOL_DEPTH);
+    assert(uprobe_stdio != NULL);
 
     struct upipe *upipe_sink = upipe_void_alloc(&test_mgr,
                                                 uprobe_use(uprobe_stdio));
@@ -350,6 +367,67 @@ int main(int argc, char *argv[])
     assert(!nb_packets);
     assert(!expect_lost);
 
+    /* reassemble PES in contiguous buffers */
+    ubase_assert(upipe_ts_pesd_set_contiguous(upipe_ts_pesd, true));
+    contiguous = true;
+    uref = uref_block_alloc(uref_mgr, ubuf_mgr, PES_HEADER_SIZE_NOPTS + 400);
+    assert(uref != NULL);
+    size = -1;
+    ubase_assert(uref_block_write(uref, 0, &size, &buffer));
+    assert(size == PES_HEADER_SIZE_NOPTS + 400);
+    pes_init(buffer);
+    pes_set_streamid(buffer, PES_STREAM_ID_VIDEO_MPEG);
+    pes_set_length(buffer, PES_HEADER_SIZE_NOPTS + 400 - PES_HEADER_SIZE);
+    pes_set_headerlength(buffer, 0);
+    uref_block_unmap(uref, 0);
+    payload_size = 400;
+    dataalignment = UBASE_ERR_INVALID;
+    end = UBASE_ERR_NONE;
+    nb_packets++;
+    for (int i = 0; i < PES_HEADER_SIZE_NOPTS + 400; i += TS_PAYLOAD) {
+        struct uref *dup = uref_dup(uref);
+        assert(dup != NULL);
+        ubase_assert(uref_block_resize(dup, i,
+                    PES_HEADER_SIZE_NOPTS + 400 - i < TS_PAYLOAD ?
+                    PES_HEADER_SIZE_NOPTS + 400 - i : TS_PAYLOAD));
+        if (!i)
+            uref_block_set_start(dup);
+        else
+            assert(nb_packets == 1);
+        upipe_input(upipe_ts_pesd, dup, NULL);
+    }
+    assert(!nb_packets);
+    uref_free(uref);
+
+    /* PES of unknown length are output when the next one starts */
+    uref = uref_block_alloc(uref_mgr, ubuf_mgr, PES_HEADER_SIZE_NOPTS + 300);
+    assert(uref != NULL);
+    size = -1;
+    ubase_assert(uref_block_write(uref, 0, &size, &buffer));
+    assert(size == PES_HEADER_SIZE_NOPTS + 300);
+    pes_init(buffer);
+    pes_set_streamid(buffer, PES_STREAM_ID_VIDEO_MPEG);
+    pes_set_length(buffer, 0);
+    pes_set_headerlength(buffer, 0);
+    uref_block_unmap(uref, 0);
+    payload_size = 300;
+    nb_packets++;
+    for (int i = 0; i < PES_HEADER_SIZE_NOPTS + 300; i += TS_PAYLOAD) {
+        struct uref *dup = uref_dup(uref);
+        assert(dup != NULL);
+        ubase_assert(uref_block_resize(dup, i,
+                    PES_HEADER_SIZE_NOPTS + 300 - i < TS_PAYLOAD ?
+                    PES_HEADER_SIZE_NOPTS + 300 - i : TS_PAYLOAD));
+        if (!i)
+            uref_block_set_start(dup);
+        upipe_input(upipe_ts_pesd, dup, NULL);
+    }
+    assert(nb_packets == 1);
+    /* the next PES is freed with the pipe */
+    uref_block_set_start(uref);
+    upipe_input(upipe_ts_pesd, uref, NULL);
+    assert(!nb_packets);
+
     upipe_release(upipe_ts_pesd);
     upipe_mgr_release(upipe_ts_pesd_mgr); // nop
 
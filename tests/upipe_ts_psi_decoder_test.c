@@ -0,0 +1,230 @@
+/*
+ * Copyright (C) 2017 OpenHeadend S.A.R.L.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/** @file
+ * @short unit tests for the PSI decoder helpers (CRC and section comparison)
+ */
+
+#undef NDEBUG
+
+#include <upipe/ubase.h>
+#include <upipe/umem.h>
+#include <upipe/umem_alloc.h>
+#include <upipe/udict.h>
+#include <upipe/udict_inline.h>
+#include <upipe/ubuf.h>
+#include <upipe/ubuf_block.h>
+#include <upipe/ubuf_block_mem.h>
+#include <upipe/uref.h>
+#include <upipe/uref_block.h>
+#include <upipe/uref_std.h>
+
+#include "../lib/upipe-ts/upipe_ts_psi_decoder.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include <bitstream/mpeg/psi.h>
+
+#define UDICT_POOL_DEPTH 0
+#define UREF_POOL_DEPTH 0
+#define UBUF_POOL_DEPTH 0
+
+/** PAT with TSID 1, version 0, program 1 on PID 0x100, and its CRC */
+static const uint8_t pat[] = {
+    0x00, 0xb0, 0x0d, 0x00, 0x01, 0xc1, 0x00, 0x00,
+    0x00, 0x01, 0xe1, 0x00, 0xe8, 0xf9, 0x5e, 0x7d
+};
+
+static struct uref_mgr *uref_mgr;
+static struct ubuf_mgr *ubuf_mgr;
+
+/** helper function to build a section uref */
+static struct uref *section_alloc(const uint8_t *buffer, size_t size)
+{
+    struct uref *uref = uref_block_alloc(uref_mgr, ubuf_mgr, size);
+    assert(uref != NULL);
+    int wanted = size;
+    uint8_t *w;
+    ubase_assert(uref_block_write(uref, 0, &wanted, &w));
+    assert(wanted == size);
+    memcpy(w, buffer, size);
+    ubase_assert(uref_block_unmap(uref, 0));
+    return uref;
+}
+
+/** helper function to build a section uref made of two segments */
+static struct uref *section_alloc_split(const uint8_t *buffer, size_t size,
+                                        size_t split)
+{
+    struct uref *uref = section_alloc(buffer, split);
+    struct ubuf *ubuf = ubuf_block_alloc(ubuf_mgr, size - split);
+    assert(ubuf != NULL);
+    int wanted = size - split;
+    uint8_t *w;
+    ubase_assert(ubuf_block_write(ubuf, 0, &wanted, &w));
+    assert(wanted == size - split);
+    memcpy(w, buffer + split, wanted);
+    ubase_assert(ubuf_block_unmap(ubuf, 0));
+    ubase_assert(uref_block_append(uref, ubuf));
+    return uref;
+}
+
+/** helper function to build a long syntax section with a random payload */
+static void section_build(uint8_t *buffer, uint16_t length, bool syntax)
+{
+    buffer[0] = 0x42;
+    buffer[1] = (syntax ? 0x80 : 0) | 0x30;
+    psi_set_length(buffer, length);
+    for (unsigned i = PSI_HEADER_SIZE; i < PSI_HEADER_SIZE + length; i++)
+        buffer[i] = rand();
+    if (syntax)
+        psi_set_crc(buffer);
+}
+
+static void test_crc(void)
+{
+    uint8_t buffer[PSI_PRIVATE_MAX_SIZE + PSI_HEADER_SIZE];
+
+    /* known answer */
+    assert(upipe_ts_psid_check_crc(pat));
+    memcpy(buffer, pat, sizeof(pat));
+    buffer[sizeof(pat) - 1] ^= 0x01;
+    assert(!upipe_ts_psid_check_crc(buffer));
+    memcpy(buffer, pat, sizeof(pat));
+    buffer[9] ^= 0x80;
+    assert(!upipe_ts_psid_check_crc(buffer));
+
+    /* sections too short to hold a CRC */
+    buffer[1] = 0xb0;
+    psi_set_length(buffer, PSI_CRC_SIZE - 1);
+    assert(!upipe_ts_psid_check_crc(buffer));
+
+    /* every length, to exercise the eight-octet loop and the tail */
+    for (uint16_t length = PSI_CRC_SIZE; length <= PSI_PRIVATE_MAX_SIZE;
+         length++) {
+        section_build(buffer, length, true);
+        assert(psi_check_crc(buffer));
+        assert(upipe_ts_psid_check_crc(buffer));
+
+        unsigned offset = rand() % (PSI_HEADER_SIZE + length);
+        uint8_t bit = 1 << (rand() % 8);
+        if (offset == 1 || offset == 2)
+            /* don't corrupt the length */
+            offset = PSI_HEADER_SIZE + length - 1;
+        buffer[offset] ^= bit;
+        assert(!psi_check_crc(buffer));
+        assert(!upipe_ts_psid_check_crc(buffer));
+    }
+}
+
+static void test_equal(void)
+{
+    uint8_t buffer[sizeof(pat)];
+    struct uref *section1 = section_alloc(pat, sizeof(pat));
+    struct uref *section2 = section_alloc_split(pat, sizeof(pat), 5);
+
+    assert(upipe_ts_psid_equal(NULL, NULL));
+    assert(!upipe_ts_psid_equal(section1, NULL));
+    assert(!upipe_ts_psid_equal(NULL, section1));
+    assert(upipe_ts_psid_equal(section1, section2));
+    uref_free(section2);
+
+    /* CRC mismatch with an identical header */
+    memcpy(buffer, pat, sizeof(pat));
+    buffer[11] = 0x01;
+    psi_set_crc(buffer);
+    section2 = section_alloc_split(buffer, sizeof(buffer), 13);
+    assert(!upipe_ts_psid_equal(section1, section2));
+    uref_free(section2);
+
+    /* new version */
+    memcpy(buffer, pat, sizeof(pat));
+    psi_set_version(buffer, 1);
+    psi_set_crc(buffer);
+    section2 = section_alloc(buffer, sizeof(buffer));
+    assert(!upipe_ts_psid_equal(section1, section2));
+    uref_free(section2);
+
+    /* different section number */
+    memcpy(buffer, pat, sizeof(pat));
+    psi_set_section(buffer, 1);
+    psi_set_lastsection(buffer, 1);
+    psi_set_crc(buffer);
+    section2 = section_alloc(buffer, sizeof(buffer));
+    assert(!upipe_ts_psid_equal(section1, section2));
+    uref_free(section2);
+
+    /* same header and CRC: the payload is not compared */
+    memcpy(buffer, pat, sizeof(pat));
+    buffer[9] = 0x02;
+    section2 = section_alloc(buffer, sizeof(buffer));
+    assert(upipe_ts_psid_equal(section1, section2));
+    uref_free(section2);
+
+    /* different size */
+    section2 = section_alloc(pat, sizeof(pat) - 4);
+    assert(!upipe_ts_psid_equal(section1, section2));
+    uref_free(section2);
+    uref_free(section1);
+
+    /* short syntax sections are compared octet by octet */
+    uint8_t tdt[PSI_HEADER_SIZE + 5];
+    section_build(tdt, 5, false);
+    section1 = section_alloc(tdt, sizeof(tdt));
+    section2 = section_alloc_split(tdt, sizeof(tdt), 4);
+    assert(upipe_ts_psid_equal(section1, section2));
+    uref_free(section2);
+    tdt[4] ^= 0x01;
+    section2 = section_alloc(tdt, sizeof(tdt));
+    assert(!upipe_ts_psid_equal(section1, section2));
+    uref_free(section2);
+    uref_free(section1);
+}
+
+int main(int argc, char *argv[])
+{
+    struct umem_mgr *umem_mgr = umem_alloc_mgr_alloc();
+    assert(umem_mgr != NULL);
+    struct udict_mgr *udict_mgr = udict_inline_mgr_alloc(UDICT_POOL_DEPTH,
+                                                         umem_mgr, -1, -1);
+    assert(udict_mgr != NULL);
+    uref_mgr = uref_std_mgr_alloc(UREF_POOL_DEPTH, udict_mgr, 0);
+    assert(uref_mgr != NULL);
+    ubuf_mgr = ubuf_block_mem_mgr_alloc(UBUF_POOL_DEPTH, UBUF_POOL_DEPTH,
+                                        umem_mgr, 0, 0, -1, 0);
+    assert(ubuf_mgr != NULL);
+
+    test_crc();
+    test_equal();
+
+    uref_mgr_release(uref_mgr);
+    ubuf_mgr_release(ubuf_mgr);
+    udict_mgr_release(udict_mgr);
+    umem_mgr_release(umem_mgr);
+    return 0;
+}
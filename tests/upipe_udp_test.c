@@ -49,6 +49,7 @@
 #include <upipe/ubuf_block_mem.h>
 #include <upipe/uref.h>
 #include <upipe/uref_block.h>
+#include <upipe/uref_clock.h>
 #include <upipe/uref_flow.h>
 #include <upipe/uref_block_flow.h>
 #include <upipe/uref_std.h>
@@ -62,11 +63,16 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <inttypes.h>
+#include <time.h>
 #include <assert.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
@@ -80,6 +86,8 @@
 #define UPROBE_LOG_LEVEL UPROBE_LOG_DEBUG
 #define BUF_SIZE 256
 #define FORMAT "This is packet number %d"
+/** latency of the paced flows */
+#define PACING_LATENCY (UCLOCK_FREQ / 50)
 
 /* FIXME: uncomment or remove */
 /*static void usage(const char *argv0) {
@@ -206,6 +214,131 @@ static struct upipe_mgr udpsrc_test_mgr = {
     .upipe_control = test_control
 };
 
+#ifdef __linux__
+/** helper uclock on CLOCK_MONOTONIC, which is also the SO_TXTIME clock of
+ * the fq pacing mode */
+static uint64_t pacing_now(struct uclock *uclock)
+{
+    struct timespec ts;
+    assert(clock_gettime(CLOCK_MONOTONIC, &ts) == 0);
+    return (uint64_t)ts.tv_sec * UCLOCK_FREQ +
+           (uint64_t)ts.tv_nsec * (UCLOCK_FREQ / 1000000) / 1000;
+}
+
+/** number of datagrams sent with sendmsg */
+static unsigned int sendmsg_count = 0;
+/** date at which the last datagram was sent */
+static uint64_t sendmsg_date = 0;
+/** SO_TXTIME departure date of the last datagram in nanoseconds, or 0 */
+static uint64_t sendmsg_txtime = 0;
+
+/** helper wrapping sendmsg to check the datagrams of udp sinks */
+ssize_t sendmsg(int fd, const struct msghdr *msg, int flags)
+{
+    sendmsg_count++;
+    sendmsg_date = pacing_now(NULL);
+    sendmsg_txtime = 0;
+#ifdef SCM_TXTIME
+    struct cmsghdr *cmsg;
+    for (cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL;
+         cmsg = CMSG_NXTHDR((struct msghdr *)msg, cmsg))
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TXTIME) {
+            assert(cmsg->cmsg_len == CMSG_LEN(sizeof(uint64_t)));
+            memcpy(&sendmsg_txtime, CMSG_DATA(cmsg), sizeof(uint64_t));
+        }
+#endif
+    return syscall(SYS_sendmsg, fd, msg, flags);
+}
+
+/** checks that a live udp sink sends a datagram at its departure date */
+static void test_pacing(struct upump_mgr *upump_mgr, struct uprobe *logger,
+                        enum upipe_udpsink_pacing pacing)
+{
+    struct uclock uclock;
+    uclock.refcount = NULL;
+    uclock.uclock_now = pacing_now;
+    uclock.uclock_to_real = uclock.uclock_from_real = NULL;
+
+    /* receiver */
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    assert(fd != -1);
+    struct sockaddr_in sin;
+    socklen_t sinlen = sizeof(sin);
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    assert(bind(fd, (struct sockaddr *)&sin, sizeof(sin)) == 0);
+    assert(getsockname(fd, (struct sockaddr *)&sin, &sinlen) == 0);
+    char uri[32];
+    snprintf(uri, sizeof(uri), "127.0.0.1:%hu", ntohs(sin.sin_port));
+
+    struct upipe_mgr *upipe_udpsink_mgr = upipe_udpsink_mgr_alloc();
+    assert(upipe_udpsink_mgr != NULL);
+    struct upipe *upipe = upipe_void_alloc(upipe_udpsink_mgr,
+            uprobe_pfx_alloc(uprobe_uclock_alloc(uprobe_use(logger), &uclock),
+                             UPROBE_LOG_LEVEL, "udp sink paced"));
+    assert(upipe != NULL);
+    upipe_mgr_release(upipe_udpsink_mgr); /* nop */
+    struct uref *flow_def = uref_block_flow_alloc_def(uref_mgr, "bar");
+    assert(flow_def != NULL);
+    ubase_assert(uref_clock_set_latency(flow_def, PACING_LATENCY));
+    ubase_assert(upipe_set_flow_def(upipe, flow_def));
+    uref_free(flow_def);
+    ubase_assert(upipe_attach_uclock(upipe));
+    ubase_assert(upipe_set_uri(upipe, uri));
+    ubase_assert(upipe_udpsink_set_pacing(upipe, pacing));
+    enum upipe_udpsink_pacing current;
+    ubase_assert(upipe_udpsink_get_pacing(upipe, &current));
+    if (current != pacing) {
+        printf("pacing mode %d is not supported, skipping\n", pacing);
+        upipe_release(upipe);
+        close(fd);
+        return;
+    }
+
+    struct uref *uref = uref_block_alloc(uref_mgr, ubuf_mgr, BUF_SIZE);
+    assert(uref != NULL);
+    uint8_t *buf;
+    int size = -1;
+    ubase_assert(uref_block_write(uref, 0, &size, &buf));
+    assert(size == BUF_SIZE);
+    memset(buf, 0, size);
+    snprintf((char *)buf, BUF_SIZE, FORMAT, counter);
+    uref_block_unmap(uref, 0);
+    uint64_t cr_sys = pacing_now(NULL);
+    uref_clock_set_cr_sys(uref, cr_sys);
+
+    /* the datagram is held until shortly before its departure date */
+    unsigned int count = sendmsg_count;
+    upipe_input(upipe, uref, NULL);
+    assert(sendmsg_count == count);
+    upump_mgr_run(upump_mgr, NULL);
+    assert(sendmsg_count == count + 1);
+
+    uint64_t departure = cr_sys + PACING_LATENCY;
+    if (pacing == UPIPE_UDPSINK_PACING_BUSY) {
+        assert(sendmsg_date >= departure);
+        assert(!sendmsg_txtime);
+    } else {
+        /* the departure date is converted to nanoseconds of the same clock;
+         * it is only later if the datagram was handed late to the kernel */
+        uint64_t departure_ns = departure * 1000 / (UCLOCK_FREQ / 1000000);
+        printf("SO_TXTIME %"PRIu64" ns, expected %"PRIu64" ns\n",
+               sendmsg_txtime, departure_ns);
+        assert(sendmsg_txtime + 1000 >= departure_ns);
+        assert(sendmsg_txtime < departure_ns + 10000000);
+    }
+
+    char rbuf[BUF_SIZE], str[BUF_SIZE];
+    assert(recv(fd, rbuf, sizeof(rbuf), MSG_DONTWAIT) == BUF_SIZE);
+    snprintf(str, sizeof(str), FORMAT, counter);
+    assert(strncmp(str, rbuf, BUF_SIZE) == 0);
+
+    upipe_release(upipe);
+    close(fd);
+}
+#endif
+
 /* packet generator */
 static void genpackets(struct upump *unused)
 {
@@ -364,6 +497,16 @@ int main(int argc, char *argv[])
     assert(ret);
     ubase_assert(upipe_set_uri(upipe_udpsink, udp_uri+1));
 
+    /* SO_TXTIME may not be available, in which case the sink busy-polls */
+    enum upipe_udpsink_pacing pacing;
+    ubase_assert(upipe_udpsink_get_pacing(upipe_udpsink, &pacing));
+    assert(pacing == UPIPE_UDPSINK_PACING_TIMER);
+    ubase_assert(upipe_udpsink_set_pacing(upipe_udpsink,
+                                          UPIPE_UDPSINK_PACING_TXTIME_FQ));
+    ubase_assert(upipe_udpsink_get_pacing(upipe_udpsink, &pacing));
+    assert(pacing == UPIPE_UDPSINK_PACING_TXTIME_FQ ||
+           pacing == UPIPE_UDPSINK_PACING_BUSY);
+
     /* redefine write pump */
     write_pump = upump_alloc_idler(upump_mgr, genpackets2, NULL, NULL);
     assert(write_pump);
@@ -372,6 +515,12 @@ int main(int argc, char *argv[])
     /* fire again */
     upump_mgr_run(upump_mgr, NULL);
 
+#ifdef __linux__
+    /* now test the pacing modes of live sinks */
+    test_pacing(upump_mgr, logger, UPIPE_UDPSINK_PACING_BUSY);
+    test_pacing(upump_mgr, logger, UPIPE_UDPSINK_PACING_TXTIME_FQ);
+#endif
+
     /* release */
     upump_free(write_pump);
     upipe_release(upipe_udpsrc);
@@ -61,7 +61,7 @@
 #define UBUF_ALIGN 32
 
 #define TEST_WIDTH 1920
-#define TEST_HEIGHT 1
+#define TEST_HEIGHT 4
 
 const char *v210_chroma = "u10y10v10y10u10y10v10y10u10y10v10y10";
 
@@ -99,6 +99,33 @@ static void fill_in(struct uref *uref)
     uref_pic_plane_unmap(uref, v210_chroma, 0, 0, -1, -1);
 }
 
+/* fill picture with a different chroma on each line of a group of 4 */
+static void fill_in_chroma(struct uref *uref)
+{
+    size_t hsize, vsize, stride;
+    uint8_t *buffer = 0;
+    ubase_assert(uref_pic_plane_write(uref, v210_chroma, 0, 0, -1, -1, &buffer));
+    ubase_assert(uref_pic_plane_size(uref, v210_chroma, &stride, NULL, NULL, NULL));
+    assert(buffer);
+    ubase_assert(uref_pic_size(uref, &hsize, &vsize, NULL));
+    for (int y = 0; y < vsize; y++) {
+        uint8_t *dst = buffer;
+        int c = 200 + 200 * (y % 4);
+        for (int x = 0; x < hsize - 5; x += 6) {
+            uint32_t val;
+            WRITE_PIXELS_10(c, 512, c);
+            WRITE_PIXELS_10(512, c, 512);
+            WRITE_PIXELS_10(c, 512, c);
+            WRITE_PIXELS_10(512, c, 512);
+        }
+        buffer += stride;
+    }
+    uref_pic_plane_unmap(uref, v210_chroma, 0, 0, -1, -1);
+}
+
+/** expected 8-bit chroma of even and odd 4:2:0 chroma lines, if not NULL */
+static const uint8_t *expected_chroma = NULL;
+
 /** helper phony pipe */
 static void test_free(struct upipe *upipe)
 {
@@ -136,7 +163,27 @@ static void test_input(struct upipe *upipe, struct uref *uref,
     assert(w > 0);
     assert(h > 0);
 
-    if (ubase_check(uref_pic_plane_read(uref, "y8", 0, 0, -1, -1, &buffer)) &&
+    if (expected_chroma != NULL) {
+        /* test u8 and v8 planes */
+        const char *chromas[2] = { "u8", "v8" };
+        for (int i = 0; i < 2; i++) {
+            ubase_assert(uref_pic_plane_read(uref, chromas[i], 0, 0, -1, -1,
+                                             &buffer));
+            ubase_assert(uref_pic_plane_size(uref, chromas[i], &stride,
+                                             &wsub, &hsub, NULL));
+            for (int y = 0; y < h / hsub; y++) {
+                for (int x = 0; x < w / wsub; x++)
+                    assert(buffer[x] == expected_chroma[y % 2]);
+                buffer += stride;
+            }
+            uref_pic_plane_unmap(uref, chromas[i], 0, 0, -1, -1);
+        }
+
+        upipe_dbg(upipe, "u8 and v8 planes tested correctly");
+        test_sucessful = true;
+    }
+
+    else if (ubase_check(uref_pic_plane_read(uref, "y8", 0, 0, -1, -1, &buffer)) &&
         ubase_check(uref_pic_plane_size(uref, "y8", &stride, NULL, NULL, NULL))) {
         /* test y8 plane */
         for (int y = 0; y < h; y++) {
@@ -240,9 +287,9 @@ int main(int argc, char **argv)
     assert(uref_mgr);
 
     struct ubuf_mgr *pic_mgr = ubuf_pic_mem_mgr_alloc(UBUF_POOL_DEPTH,
-            UBUF_POOL_DEPTH, umem_mgr, 1, -1, -1, -1, -1, UBUF_ALIGN, 0);
+            UBUF_POOL_DEPTH, umem_mgr, 6, -1, -1, -1, -1, UBUF_ALIGN, 0);
     assert(pic_mgr);
-    ubase_assert(ubuf_pic_mem_mgr_add_plane(pic_mgr, v210_chroma, 1, 1, 1));
+    ubase_assert(ubuf_pic_mem_mgr_add_plane(pic_mgr, v210_chroma, 1, 1, 16));
 
     /* allocate reference picture */
     struct uref *input_uref = uref_pic_alloc(uref_mgr, pic_mgr,
@@ -278,6 +325,14 @@ int main(int argc, char **argv)
     ubase_assert(uref_pic_flow_set_hsize(out_flow_10, TEST_WIDTH));
     ubase_assert(uref_pic_flow_set_vsize(out_flow_10, TEST_HEIGHT));
 
+    struct uref *out_flow_420 = uref_pic_flow_alloc_def(uref_mgr, 1);
+    assert(out_flow_420);
+    ubase_assert(uref_pic_flow_add_plane(out_flow_420, 1, 1, 1, "y8"));
+    ubase_assert(uref_pic_flow_add_plane(out_flow_420, 2, 2, 1, "u8"));
+    ubase_assert(uref_pic_flow_add_plane(out_flow_420, 2, 2, 1, "v8"));
+    ubase_assert(uref_pic_flow_set_hsize(out_flow_420, TEST_WIDTH));
+    ubase_assert(uref_pic_flow_set_vsize(out_flow_420, TEST_HEIGHT));
+
     /* create a probe */
     struct uprobe uprobe;
     uprobe_init(&uprobe, catch, NULL);
@@ -316,10 +371,54 @@ int main(int argc, char **argv)
     struct uref *pic = uref_dup(input_uref);
     assert(pic);
     upipe_input(v210dec, pic, 0);
+    assert(test_sucessful);
+    upipe_release(v210dec);
+
+    /* decode the same picture to 4:2:0 */
+    test_sucessful = false;
+    v210dec = upipe_flow_alloc(upipe_v210dec_mgr, uprobe_use(logger_v210),
+                               out_flow_420);
+    assert(v210dec);
+    ubase_assert(upipe_set_output(v210dec, test));
+    ubase_assert(upipe_set_flow_def(v210dec, in_flow_def));
+    pic = uref_dup(input_uref);
+    assert(pic);
+    ubase_assert(uref_pic_set_progressive(pic));
+    upipe_input(v210dec, pic, 0);
+    assert(test_sucessful);
+
+    /* progressive chroma is averaged over lines 0/1 and 2/3 */
+    static const uint8_t progressive_chroma[2] = { 75, 175 };
+    fill_in_chroma(input_uref);
+    test_sucessful = false;
+    expected_chroma = progressive_chroma;
+    pic = uref_dup(input_uref);
+    assert(pic);
+    ubase_assert(uref_pic_set_progressive(pic));
+    upipe_input(v210dec, pic, 0);
+    assert(test_sucessful);
+
+    /* interlaced pictures need a multiple of 4 lines */
+    test_sucessful = false;
+    pic = uref_pic_alloc(uref_mgr, pic_mgr, TEST_WIDTH, 2);
+    assert(pic);
+    fill_in_chroma(pic);
+    upipe_input(v210dec, pic, 0);
+    assert(!test_sucessful);
+
+    /* interlaced chroma is averaged over lines 0/2 and 1/3 */
+    static const uint8_t interlaced_chroma[2] = { 100, 150 };
+    test_sucessful = false;
+    expected_chroma = interlaced_chroma;
+    pic = uref_dup(input_uref);
+    assert(pic);
+    upipe_input(v210dec, pic, 0);
+    assert(test_sucessful);
 
     uref_free(in_flow_def);
     uref_free(out_flow_8);
     uref_free(out_flow_10);
+    uref_free(out_flow_420);
     /* release v210dec pipe */
     uref_free(input_uref);
     upipe_release(v210dec);
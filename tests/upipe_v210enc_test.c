@@ -58,7 +58,7 @@
 #define UPROBE_LOG_LEVEL UPROBE_LOG_VERBOSE
 
 #define TEST_WIDTH 1920
-#define TEST_HEIGHT 1
+#define TEST_HEIGHT 2
 
 #define VALUE_Y 64
 #define VALUE_U 128
@@ -282,7 +282,8 @@ int main(int argc, char **argv)
     /* build v210enc pipe */
     struct upipe_mgr *upipe_v210enc_mgr = upipe_v210enc_mgr_alloc();
     assert(upipe_v210enc_mgr);
-    struct upipe *v210enc = upipe_void_alloc(upipe_v210enc_mgr, logger_v210);
+    struct upipe *v210enc = upipe_void_alloc(upipe_v210enc_mgr,
+                                             uprobe_use(logger_v210));
     assert(v210enc);
 
     /* build phony pipe */
@@ -297,19 +298,55 @@ int main(int argc, char **argv)
     struct uref *pic = uref_dup(input_uref);
     assert(pic);
     upipe_input(v210enc, pic, 0);
+    assert(test_sucessful);
 
     uref_free(in_flow_def);
     /* release v210enc pipe */
     uref_free(input_uref);
     upipe_release(v210enc);
+
+    /* planar 4:2:0, packed with repeated chroma lines */
+    struct ubuf_mgr *pic_420_mgr = ubuf_pic_mem_mgr_alloc_fourcc(
+            UBUF_POOL_DEPTH, UBUF_POOL_DEPTH, umem_mgr, "I420",
+            -1, -1, -1, -1, 0, 0);
+    assert(pic_420_mgr);
+    input_uref = uref_pic_alloc(uref_mgr, pic_420_mgr, TEST_WIDTH,
+                                TEST_HEIGHT);
+    assert(input_uref);
+    fill_in(input_uref, "y8", 1, 1, 1, VALUE_Y);
+    fill_in(input_uref, "u8", 2, 2, 1, VALUE_U);
+    fill_in(input_uref, "v8", 2, 2, 1, VALUE_V);
+
+    in_flow_def = uref_pic_flow_alloc_def(uref_mgr, 1);
+    assert(in_flow_def);
+    ubase_assert(uref_pic_flow_add_plane(in_flow_def, 1, 1, 1, "y8"));
+    ubase_assert(uref_pic_flow_add_plane(in_flow_def, 2, 2, 1, "u8"));
+    ubase_assert(uref_pic_flow_add_plane(in_flow_def, 2, 2, 1, "v8"));
+    ubase_assert(uref_pic_flow_set_hsize(in_flow_def, TEST_WIDTH));
+    ubase_assert(uref_pic_flow_set_vsize(in_flow_def, TEST_HEIGHT));
+
+    test_sucessful = false;
+    v210enc = upipe_void_alloc(upipe_v210enc_mgr, uprobe_use(logger_v210));
+    assert(v210enc);
+    ubase_assert(upipe_set_output(v210enc, test));
+    ubase_assert(upipe_set_flow_def(v210enc, in_flow_def));
+    pic = uref_dup(input_uref);
+    assert(pic);
+    upipe_input(v210enc, pic, 0);
+
+    uref_free(in_flow_def);
+    uref_free(input_uref);
+    upipe_release(v210enc);
     test_free(test);
 
     /* release managers */
     upipe_mgr_release(upipe_v210enc_mgr); // no-op
     ubuf_mgr_release(pic_mgr);
+    ubuf_mgr_release(pic_420_mgr);
     uref_mgr_release(uref_mgr);
     umem_mgr_release(umem_mgr);
     udict_mgr_release(udict_mgr);
+    uprobe_release(logger_v210);
     uprobe_release(logger);
     uprobe_clean(&uprobe);
 
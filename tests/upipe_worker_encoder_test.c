@@ -0,0 +1,417 @@
+/*
+ * Copyright (C) 2017 OpenHeadend S.A.R.L.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** @file
+ * @short unit tests for upipe_worker_encoder (using upump_ev)
+ */
+
+#undef NDEBUG
+
+#include <upipe/ubase.h>
+#include <upipe/urefcount.h>
+#include <upipe/uprobe.h>
+#include <upipe/uprobe_stdio.h>
+#include <upipe/uprobe_prefix.h>
+#include <upipe-pthread/uprobe_pthread_upump_mgr.h>
+#include <upipe-pthread/uprobe_pthread_assert.h>
+#include <upipe/umem.h>
+#include <upipe/umem_alloc.h>
+#include <upipe/udict.h>
+#include <upipe/udict_inline.h>
+#include <upipe/uref.h>
+#include <upipe/uref_std.h>
+#include <upipe/uclock.h>
+#include <upipe/uclock_std.h>
+#include <upipe/urequest.h>
+#include <upipe/upump.h>
+#include <upump-ev/upump_ev.h>
+#include <upipe/upipe.h>
+#include <upipe-modules/upipe_worker_encoder.h>
+#include <upipe-modules/upipe_transfer.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <assert.h>
+
+#define UDICT_POOL_DEPTH 0
+#define UREF_POOL_DEPTH 0
+#define UPUMP_POOL 0
+#define UPUMP_BLOCKER_POOL 0
+#define XFER_QUEUE 255
+#define XFER_POOL 1
+#define WENC_QUEUE 4
+#define NB_PACKETS 30
+#define ENCODE_TIME_US 5000
+
+static struct uprobe *logger;
+static struct uref_mgr *uref_mgr;
+static struct uclock *uclock;
+static unsigned int nb_sent = 0;
+static unsigned int nb_encoded = 0;
+static unsigned int nb_received = 0;
+static pthread_t wenc_thread_id;
+static struct upipe *upipe_handle;
+static struct upump_mgr *main_upump_mgr;
+
+/** helper phony encoder pipe, slow and with one frame of delay */
+struct test_pipe {
+    struct urefcount urefcount;
+    struct upipe *output;
+    struct uref *delayed;
+    struct upipe upipe;
+};
+
+/** helper phony pipe */
+static void test_free(struct urefcount *urefcount)
+{
+    struct test_pipe *test_pipe =
+        container_of(urefcount, struct test_pipe, urefcount);
+    upipe_dbg(&test_pipe->upipe, "dead");
+    uref_free(test_pipe->delayed);
+    upipe_release(test_pipe->output);
+    urefcount_clean(&test_pipe->urefcount);
+    upipe_clean(&test_pipe->upipe);
+    free(test_pipe);
+}
+
+/** helper phony pipe */
+static struct upipe *test_alloc(struct upipe_mgr *mgr,
+                                struct uprobe *uprobe, uint32_t signature,
+                                va_list args)
+{
+    struct test_pipe *test_pipe = malloc(sizeof(struct test_pipe));
+    assert(test_pipe != NULL);
+    upipe_init(&test_pipe->upipe, mgr, uprobe);
+    urefcount_init(&test_pipe->urefcount, test_free);
+    test_pipe->upipe.refcount = &test_pipe->urefcount;
+    test_pipe->output = NULL;
+    test_pipe->delayed = NULL;
+    return &test_pipe->upipe;
+}
+
+/** helper phony pipe */
+static void test_input(struct upipe *upipe, struct uref *uref,
+                       struct upump **upump_p)
+{
+    struct test_pipe *test_pipe = container_of(upipe, struct test_pipe, upipe);
+    assert(pthread_equal(pthread_self(), wenc_thread_id));
+    usleep(ENCODE_TIME_US);
+    nb_encoded++;
+
+    struct uref *output = test_pipe->delayed;
+    test_pipe->delayed = uref;
+    if (output == NULL)
+        return;
+    if (nb_encoded % 2) {
+        /* output a new uref, without the attributes of the input */
+        uref_free(output);
+        output = uref_alloc(uref_mgr);
+        assert(output != NULL);
+    }
+    upipe_input(test_pipe->output, output, upump_p);
+}
+
+/** helper phony pipe */
+static int test_control(struct upipe *upipe, int command, va_list args)
+{
+    struct test_pipe *test_pipe = container_of(upipe, struct test_pipe, upipe);
+    switch (command) {
+        case UPIPE_ATTACH_UPUMP_MGR:
+            assert(pthread_equal(pthread_self(), wenc_thread_id));
+            return UBASE_ERR_NONE;
+        case UPIPE_GET_OUTPUT: {
+            struct upipe **p = va_arg(args, struct upipe **);
+            *p = test_pipe->output;
+            return UBASE_ERR_NONE;
+        }
+        case UPIPE_SET_OUTPUT: {
+            struct upipe *output = va_arg(args, struct upipe *);
+            assert(output != NULL);
+            upipe_release(test_pipe->output);
+            test_pipe->output = upipe_use(output);
+            return UBASE_ERR_NONE;
+        }
+        case UPIPE_SET_FLOW_DEF: {
+            assert(pthread_equal(pthread_self(), wenc_thread_id));
+            struct uref *flow_def = va_arg(args, struct uref *);
+            return upipe_set_flow_def(test_pipe->output, flow_def);
+        }
+        default:
+            assert(0);
+            return UBASE_ERR_UNHANDLED;
+    }
+}
+
+/** helper phony pipe */
+static struct upipe_mgr test_mgr = {
+    .refcount = NULL,
+    .upipe_alloc = test_alloc,
+    .upipe_input = test_input,
+    .upipe_control = test_control
+};
+
+/** releases the bin outside of its output callback */
+static void release_handle(struct upump *upump)
+{
+    upump_stop(upump);
+    upump_free(upump);
+    upipe_release(upipe_handle);
+    upipe_handle = NULL;
+}
+
+/** helper phony sink */
+static struct upipe *sink_alloc(struct upipe_mgr *mgr,
+                                struct uprobe *uprobe, uint32_t signature,
+                                va_list args)
+{
+    struct upipe *upipe = malloc(sizeof(struct upipe));
+    assert(upipe != NULL);
+    upipe_init(upipe, mgr, uprobe);
+    return upipe;
+}
+
+/** helper phony sink */
+static void sink_input(struct upipe *upipe, struct uref *uref,
+                       struct upump **upump_p)
+{
+    uint64_t date;
+    assert(!ubase_check(uref_attr_get_unsigned(uref, &date, UDICT_TYPE_UNSIGNED,
+                                               "wenc.date")));
+    uref_free(uref);
+    nb_received++;
+
+    unsigned int depth, max_depth;
+    uint64_t latency, max_latency;
+    ubase_assert(upipe_wenc_get_stats(upipe_handle, &depth, NULL,
+                                      NULL, NULL));
+    assert(depth == nb_sent - nb_received);
+    /* the last frame stays in the encoder */
+    if (nb_received < NB_PACKETS - 1)
+        return;
+
+    ubase_assert(upipe_wenc_get_stats(upipe_handle, &depth, &max_depth,
+                                      &latency, &max_latency));
+    assert(nb_sent == NB_PACKETS);
+    assert(depth == 1);
+    /* the input queue filled up, and then blocked the source */
+    assert(max_depth >= WENC_QUEUE);
+    assert(max_depth <= 2 * WENC_QUEUE + 4);
+    /* a frame is output after the next one is encoded */
+    assert(latency != UINT64_MAX);
+    assert(latency >= 2 * ENCODE_TIME_US * (UCLOCK_FREQ / 1000000));
+    assert(max_latency >= latency);
+
+    ubase_assert(upipe_wenc_get_stats(upipe_handle, NULL, &max_depth,
+                                      NULL, &max_latency));
+    assert(max_depth == depth);
+    assert(max_latency == latency);
+
+    struct upump *upump = upump_alloc_idler(main_upump_mgr, release_handle,
+                                            NULL, NULL);
+    assert(upump != NULL);
+    upump_start(upump);
+}
+
+/** helper phony sink */
+static int sink_control(struct upipe *upipe, int command, va_list args)
+{
+    switch (command) {
+        case UPIPE_REGISTER_REQUEST: {
+            struct urequest *urequest = va_arg(args, struct urequest *);
+            if (urequest->type == UREQUEST_UCLOCK)
+                return urequest_provide_uclock(urequest, uclock_use(uclock));
+            return UBASE_ERR_NONE;
+        }
+        case UPIPE_SET_FLOW_DEF:
+        case UPIPE_UNREGISTER_REQUEST:
+            return UBASE_ERR_NONE;
+        default:
+            return UBASE_ERR_UNHANDLED;
+    }
+}
+
+/** helper phony sink */
+static void sink_free(struct upipe *upipe)
+{
+    upipe_clean(upipe);
+    free(upipe);
+}
+
+/** helper phony sink */
+static struct upipe_mgr sink_mgr = {
+    .refcount = NULL,
+    .upipe_alloc = sink_alloc,
+    .upipe_input = sink_input,
+    .upipe_control = sink_control
+};
+
+/** feeds the bin as fast as the input queue allows */
+static void source_idler(struct upump *upump)
+{
+    struct uref *uref = uref_alloc(uref_mgr);
+    assert(uref != NULL);
+    nb_sent++;
+    upipe_input(upipe_handle, uref, &upump);
+    if (nb_sent == NB_PACKETS)
+        upump_stop(upump);
+}
+
+static void *thread(void *_upipe_xfer_mgr)
+{
+    struct upipe_mgr *upipe_xfer_mgr = (struct upipe_mgr *)_upipe_xfer_mgr;
+
+    struct upump_mgr *upump_mgr = upump_ev_mgr_alloc_loop(UPUMP_POOL,
+                                                          UPUMP_BLOCKER_POOL);
+    assert(upump_mgr != NULL);
+    uprobe_pthread_upump_mgr_set(logger, upump_mgr);
+
+    ubase_assert(upipe_xfer_mgr_attach(upipe_xfer_mgr, upump_mgr));
+    upipe_mgr_release(upipe_xfer_mgr);
+
+    upump_mgr_run(upump_mgr, NULL);
+
+    upump_mgr_release(upump_mgr);
+
+    return NULL;
+}
+
+/** definition of our uprobe */
+static int catch(struct uprobe *uprobe, struct upipe *upipe, int event, va_list args)
+{
+    switch (event) {
+        case UPROBE_READY:
+        case UPROBE_DEAD:
+        case UPROBE_NEW_FLOW_DEF:
+        case UPROBE_NEED_UPUMP_MGR:
+        case UPROBE_SOURCE_END:
+        case UPROBE_STALLED:
+            break;
+        default:
+            assert(0);
+            break;
+    }
+    return UBASE_ERR_NONE;
+}
+
+int main(int argc, char **argv)
+{
+    struct upump_mgr *upump_mgr =
+        upump_ev_mgr_alloc_default(UPUMP_POOL, UPUMP_BLOCKER_POOL);
+    assert(upump_mgr != NULL);
+    main_upump_mgr = upump_mgr;
+
+    struct umem_mgr *umem_mgr = umem_alloc_mgr_alloc();
+    assert(umem_mgr != NULL);
+    struct udict_mgr *udict_mgr = udict_inline_mgr_alloc(UDICT_POOL_DEPTH,
+                                                         umem_mgr, -1, -1);
+    assert(udict_mgr != NULL);
+    uref_mgr = uref_std_mgr_alloc(UREF_POOL_DEPTH, udict_mgr, 0);
+    assert(uref_mgr != NULL);
+    uclock = uclock_std_alloc(0);
+    assert(uclock != NULL);
+
+    struct uprobe uprobe;
+    uprobe_init(&uprobe, catch, NULL);
+    logger = uprobe_stdio_alloc(&uprobe, stdout, UPROBE_LOG_VERBOSE);
+    assert(logger != NULL);
+    logger = uprobe_pthread_upump_mgr_alloc(logger);
+    assert(logger != NULL);
+    uprobe_pthread_upump_mgr_set(logger, upump_mgr);
+    struct uprobe *uprobe_main =
+        uprobe_pthread_assert_alloc(uprobe_use(logger));
+    assert(uprobe_main != NULL);
+    uprobe_pthread_assert_set(uprobe_main, pthread_self());
+    struct uprobe *uprobe_remote =
+        uprobe_pthread_assert_alloc(uprobe_use(logger));
+    assert(uprobe_remote != NULL);
+
+    struct upipe *upipe_test = upipe_void_alloc(&test_mgr,
+            uprobe_pfx_alloc(uprobe_use(uprobe_remote), UPROBE_LOG_VERBOSE,
+                             "test"));
+    assert(upipe_test != NULL);
+
+    struct upipe_mgr *upipe_xfer_mgr =
+        upipe_xfer_mgr_alloc(XFER_QUEUE, XFER_POOL, NULL);
+    assert(upipe_xfer_mgr != NULL);
+
+    upipe_mgr_use(upipe_xfer_mgr);
+    assert(pthread_create(&wenc_thread_id, NULL, thread, upipe_xfer_mgr) == 0);
+    uprobe_pthread_assert_set(uprobe_remote, wenc_thread_id);
+
+    struct upipe_mgr *upipe_wenc_mgr = upipe_wenc_mgr_alloc(upipe_xfer_mgr);
+    assert(upipe_wenc_mgr != NULL);
+    upipe_mgr_release(upipe_xfer_mgr);
+
+    upipe_handle = upipe_wenc_alloc(upipe_wenc_mgr,
+            uprobe_pfx_alloc(uprobe_use(uprobe_main), UPROBE_LOG_VERBOSE,
+                             "wenc"),
+            upipe_test,
+            uprobe_pfx_alloc(uprobe_use(uprobe_remote), UPROBE_LOG_VERBOSE,
+                             "wenc_x"),
+            WENC_QUEUE, WENC_QUEUE);
+    /* from now on upipe_test shouldn't be accessed from this thread */
+    assert(upipe_handle != NULL);
+    upipe_mgr_release(upipe_wenc_mgr);
+    upipe_attach_upump_mgr(upipe_handle);
+
+    struct upipe *sink = upipe_void_alloc(&sink_mgr,
+            uprobe_pfx_alloc(uprobe_use(uprobe_main), UPROBE_LOG_VERBOSE,
+                             "sink"));
+    assert(sink != NULL);
+    ubase_assert(upipe_set_output(upipe_handle, sink));
+    upipe_attach_uclock(upipe_handle);
+
+    struct uref *uref = uref_alloc(uref_mgr);
+    ubase_assert(uref_flow_set_def(uref, "void."));
+    ubase_assert(upipe_set_flow_def(upipe_handle, uref));
+    uref_free(uref);
+
+    struct upump *source = upump_alloc_idler(upump_mgr, source_idler,
+                                             NULL, NULL);
+    assert(source != NULL);
+    upump_start(source);
+
+    upump_mgr_run(upump_mgr, NULL);
+
+    assert(!pthread_join(wenc_thread_id, NULL));
+    assert(nb_sent == NB_PACKETS);
+    assert(nb_encoded == NB_PACKETS);
+    assert(nb_received == NB_PACKETS - 1);
+    assert(upipe_handle == NULL);
+
+    upump_free(source);
+    sink_free(sink);
+    uclock_release(uclock);
+    uprobe_release(uprobe_remote);
+    uprobe_release(uprobe_main);
+    upump_mgr_release(upump_mgr);
+    uref_mgr_release(uref_mgr);
+    udict_mgr_release(udict_mgr);
+    umem_mgr_release(umem_mgr);
+    uprobe_release(logger);
+
+    return 0;
+}
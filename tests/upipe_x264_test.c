@@ -77,6 +77,14 @@
 /** phony pipe to test upipe_x264 */
 struct x264_test {
     int counter;
+    /** packet held until the next one, to check zero-copy mode */
+    struct uref *held;
+    /** copy of the content of the held packet */
+    uint8_t *snapshot;
+    /** size of the held packet */
+    size_t snapshot_size;
+    /** hash of the output */
+    uint32_t hash;
     struct upipe upipe;
 };
 
@@ -91,6 +99,10 @@ static struct upipe *test_alloc(struct upipe_mgr *mgr, struct uprobe *uprobe,
     assert(x264_test != NULL);
     upipe_init(&x264_test->upipe, mgr, uprobe);
     x264_test->counter = 0;
+    x264_test->held = NULL;
+    x264_test->snapshot = NULL;
+    x264_test->snapshot_size = 0;
+    x264_test->hash = 2166136261;
     upipe_throw_ready(&x264_test->upipe);
     return &x264_test->upipe;
 }
@@ -114,7 +126,26 @@ static void test_input(struct upipe *upipe, struct uref *uref,
                  x264_test->counter, pts, dts);
     x264_test->counter++;
 
-    uref_free(uref);
+    /* the previous packet must be left intact by the encoder */
+    if (x264_test->held != NULL) {
+        uint8_t buffer[x264_test->snapshot_size];
+        ubase_assert(uref_block_extract(x264_test->held, 0,
+                                        x264_test->snapshot_size, buffer));
+        assert(!memcmp(buffer, x264_test->snapshot,
+                       x264_test->snapshot_size));
+        uref_free(x264_test->held);
+        free(x264_test->snapshot);
+    }
+
+    ubase_assert(uref_block_size(uref, &x264_test->snapshot_size));
+    x264_test->snapshot = malloc(x264_test->snapshot_size);
+    assert(x264_test->snapshot != NULL);
+    ubase_assert(uref_block_extract(uref, 0, x264_test->snapshot_size,
+                                    x264_test->snapshot));
+    for (size_t i = 0; i < x264_test->snapshot_size; i++)
+        x264_test->hash = (x264_test->hash ^ x264_test->snapshot[i]) *
+                          16777619;
+    x264_test->held = uref;
 }
 
 /** helper phony pipe */
@@ -139,6 +170,8 @@ static int test_control(struct upipe *upipe, int command, va_list args)
 static void test_free(struct upipe *upipe)
 {
     struct x264_test *x264_test = x264_test_from_upipe(upipe);
+    uref_free(x264_test->held);
+    free(x264_test->snapshot);
     upipe_throw_dead(upipe);
     upipe_clean(upipe);
     free(x264_test);
@@ -195,43 +228,24 @@ static int catch(struct uprobe *uprobe, struct upipe *upipe,
     return UBASE_ERR_NONE;
 }
 
-int main(int argc, char **argv)
+/** encodes pictures and checks the output
+ *
+ * @param uref_mgr uref manager
+ * @param pic_mgr picture buffer manager
+ * @param logger probe hierarchy
+ * @param zerocopy true to output the NAL buffer of x264 without copy
+ * @param hash_p filled in with the hash of the output
+ */
+static void test_encode(struct uref_mgr *uref_mgr, struct ubuf_mgr *pic_mgr,
+                        struct uprobe *logger, bool zerocopy,
+                        uint32_t *hash_p)
 {
-    printf("Compiled %s %s (%s)\n", __DATE__, __TIME__, __FILE__);
-
+    /* x264 manager */
+    struct upipe_mgr *upipe_x264_mgr = upipe_x264_mgr_alloc();
     struct uref *pic;
     int counter;
     uint64_t pts;
 
-    /* upipe env */
-    struct umem_mgr *umem_mgr = umem_alloc_mgr_alloc();
-    assert(umem_mgr != NULL);
-    struct udict_mgr *udict_mgr = udict_inline_mgr_alloc(UDICT_POOL_DEPTH, umem_mgr, -1, -1);
-    assert(udict_mgr != NULL);
-    struct uref_mgr *uref_mgr = uref_std_mgr_alloc(UREF_POOL_DEPTH, udict_mgr, 0);
-    assert(uref_mgr != NULL);
-    /* planar YUV (I420) */
-    struct ubuf_mgr *pic_mgr = ubuf_pic_mem_mgr_alloc(UBUF_POOL_DEPTH, UBUF_POOL_DEPTH, umem_mgr, 1,
-                                      UBUF_PREPEND, UBUF_APPEND,
-                                      UBUF_PREPEND, UBUF_APPEND,
-                                      UBUF_ALIGN, UBUF_ALIGN_OFFSET);
-    assert(pic_mgr != NULL);
-    ubase_assert(ubuf_pic_mem_mgr_add_plane(pic_mgr, "y8", 1, 1, 1));
-    ubase_assert(ubuf_pic_mem_mgr_add_plane(pic_mgr, "u8", 2, 2, 1));
-    ubase_assert(ubuf_pic_mem_mgr_add_plane(pic_mgr, "v8", 2, 2, 1));
-
-    struct uprobe uprobe;
-    uprobe_init(&uprobe, catch, NULL);
-    struct uprobe *logger = uprobe_stdio_alloc(&uprobe, stdout,
-                                               UPROBE_LOG_LEVEL);
-    assert(logger != NULL);
-    logger = uprobe_ubuf_mem_alloc(logger, umem_mgr, UBUF_POOL_DEPTH,
-                                   UBUF_POOL_DEPTH);
-    assert(logger != NULL);
-
-    /* x264 manager */
-    struct upipe_mgr *upipe_x264_mgr = upipe_x264_mgr_alloc();
-
     /* send flow definition */
     struct uref *flow_def = uref_pic_flow_alloc_def(uref_mgr, 1);
     assert(flow_def);
@@ -263,6 +277,7 @@ int main(int argc, char **argv)
     ubase_assert(upipe_x264_set_default_preset(x264, "faster", NULL));
     ubase_assert(upipe_x264_set_profile(x264, "high"));
     ubase_assert(upipe_x264_set_default(x264));
+    ubase_assert(upipe_x264_set_zerocopy(x264, zerocopy));
 
     /* encoding test */
     for (counter = 0; counter < LIMIT; counter ++) {
@@ -276,12 +291,51 @@ int main(int argc, char **argv)
         upipe_input(x264, pic, NULL);
     }
 
-    /* release pipes */
+    /* release pipes, flushing the delayed pictures */
     upipe_release(x264);
+    assert(x264_test_from_upipe(x264_test)->counter == LIMIT);
+    *hash_p = x264_test_from_upipe(x264_test)->hash;
     test_free(x264_test);
+    upipe_mgr_release(upipe_x264_mgr); // noop
+}
+
+int main(int argc, char **argv)
+{
+    printf("Compiled %s %s (%s)\n", __DATE__, __TIME__, __FILE__);
+
+    /* upipe env */
+    struct umem_mgr *umem_mgr = umem_alloc_mgr_alloc();
+    assert(umem_mgr != NULL);
+    struct udict_mgr *udict_mgr = udict_inline_mgr_alloc(UDICT_POOL_DEPTH, umem_mgr, -1, -1);
+    assert(udict_mgr != NULL);
+    struct uref_mgr *uref_mgr = uref_std_mgr_alloc(UREF_POOL_DEPTH, udict_mgr, 0);
+    assert(uref_mgr != NULL);
+    /* planar YUV (I420) */
+    struct ubuf_mgr *pic_mgr = ubuf_pic_mem_mgr_alloc(UBUF_POOL_DEPTH, UBUF_POOL_DEPTH, umem_mgr, 1,
+                                      UBUF_PREPEND, UBUF_APPEND,
+                                      UBUF_PREPEND, UBUF_APPEND,
+                                      UBUF_ALIGN, UBUF_ALIGN_OFFSET);
+    assert(pic_mgr != NULL);
+    ubase_assert(ubuf_pic_mem_mgr_add_plane(pic_mgr, "y8", 1, 1, 1));
+    ubase_assert(ubuf_pic_mem_mgr_add_plane(pic_mgr, "u8", 2, 2, 1));
+    ubase_assert(ubuf_pic_mem_mgr_add_plane(pic_mgr, "v8", 2, 2, 1));
+
+    struct uprobe uprobe;
+    uprobe_init(&uprobe, catch, NULL);
+    struct uprobe *logger = uprobe_stdio_alloc(&uprobe, stdout,
+                                               UPROBE_LOG_LEVEL);
+    assert(logger != NULL);
+    logger = uprobe_ubuf_mem_alloc(logger, umem_mgr, UBUF_POOL_DEPTH,
+                                   UBUF_POOL_DEPTH);
+    assert(logger != NULL);
+
+    /* the default copy mode, then the zero-copy mode */
+    uint32_t hash, hash_zerocopy;
+    test_encode(uref_mgr, pic_mgr, logger, false, &hash);
+    test_encode(uref_mgr, pic_mgr, logger, true, &hash_zerocopy);
+    assert(hash == hash_zerocopy);
 
     /* clean everything */
-    upipe_mgr_release(upipe_x264_mgr); // noop
     ubuf_mgr_release(pic_mgr);
     uref_mgr_release(uref_mgr);
     uprobe_release(logger);
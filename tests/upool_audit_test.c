@@ -0,0 +1,208 @@
+/*
+ * Copyright (C) 2017 OpenHeadend S.A.R.L.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** @file
+ * @short unit tests for the pool audit
+ */
+
+#undef NDEBUG
+
+#include <upipe/ubase.h>
+#include <upipe/uprobe.h>
+#include <upipe/uprobe_stdio.h>
+#include <upipe/uprobe_prefix.h>
+#include <upipe/umem.h>
+#include <upipe/umem_pool.h>
+#include <upipe/udict.h>
+#include <upipe/udict_inline.h>
+#include <upipe/uref.h>
+#include <upipe/uref_std.h>
+#include <upipe/upipe.h>
+#include <upipe/upipe_dump.h>
+#include <upipe/upool_audit.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define UDICT_POOL_DEPTH 1
+#define UREF_POOL_DEPTH 1
+#define UPROBE_LOG_LEVEL UPROBE_LOG_DEBUG
+
+static struct upipe *test_pipe = NULL;
+static unsigned int nb_inside = 0;
+static unsigned int nb_outside = 0;
+static struct uref *held = NULL;
+
+/** definition of our uprobe */
+static int catch(struct uprobe *uprobe, struct upipe *upipe,
+                 int event, va_list args)
+{
+    switch (event) {
+        case UPROBE_READY:
+        case UPROBE_DEAD:
+        case UPROBE_LOG:
+            break;
+        case UPROBE_POOL_MISS: {
+            const char *name = va_arg(args, const char *);
+            assert(name != NULL);
+            if (upipe == NULL)
+                nb_outside++;
+            else {
+                assert(upipe == test_pipe);
+                nb_inside++;
+            }
+            break;
+        }
+        default:
+            assert(0);
+            break;
+    }
+    return UBASE_ERR_NONE;
+}
+
+/** helper phony pipe keeping a copy of its input */
+static struct upipe *test_alloc(struct upipe_mgr *mgr,
+                                struct uprobe *uprobe,
+                                uint32_t signature, va_list args)
+{
+    struct upipe *upipe = malloc(sizeof(struct upipe));
+    assert(upipe != NULL);
+    upipe_init(upipe, mgr, uprobe);
+    return upipe;
+}
+
+/** helper phony pipe */
+static void test_input(struct upipe *upipe, struct uref *uref,
+                       struct upump **upump_p)
+{
+    assert(held == NULL);
+    held = uref_dup(uref);
+    assert(held != NULL);
+    uref_free(uref);
+}
+
+/** helper phony pipe */
+static void test_free(struct upipe *upipe)
+{
+    upipe_clean(upipe);
+    free(upipe);
+}
+
+/** helper phony pipe */
+static struct upipe_mgr test_mgr = {
+    .refcount = NULL,
+    .signature = UBASE_FOURCC('t','e','s','t'),
+    .upipe_alloc = test_alloc,
+    .upipe_input = test_input,
+    .upipe_control = NULL
+};
+
+int main(int argc, char **argv)
+{
+    struct umem_mgr *umem_mgr = umem_pool_mgr_alloc_simple(1);
+    assert(umem_mgr != NULL);
+    struct udict_mgr *udict_mgr = udict_inline_mgr_alloc(UDICT_POOL_DEPTH,
+                                                         umem_mgr, -1, -1);
+    assert(udict_mgr != NULL);
+    struct uref_mgr *uref_mgr = uref_std_mgr_alloc(UREF_POOL_DEPTH, udict_mgr,
+                                                   0);
+    assert(uref_mgr != NULL);
+
+    struct uprobe uprobe;
+    uprobe_init(&uprobe, catch, NULL);
+    struct uprobe *logger = uprobe_stdio_alloc(uprobe_use(&uprobe), stdout,
+                                               UPROBE_LOG_LEVEL);
+    assert(logger != NULL);
+
+    test_pipe = upipe_void_alloc(&test_mgr,
+            uprobe_pfx_alloc(uprobe_use(logger), UPROBE_LOG_LEVEL, "test"));
+    assert(test_pipe != NULL);
+
+    /* warm up the pools */
+    struct uref *uref = uref_alloc(uref_mgr);
+    assert(uref != NULL);
+    uref_free(uref);
+    assert(!upool_audit_misses());
+
+    upool_audit_set(UPOOL_AUDIT_EVENT, logger);
+
+    /* steady state */
+    uref = uref_alloc(uref_mgr);
+    assert(uref != NULL);
+    uref_free(uref);
+    assert(!upool_audit_misses());
+    assert(!nb_inside && !nb_outside);
+
+    /* the copy kept by the pipe exceeds the depth of the pools */
+    upipe_input(test_pipe, uref_alloc(uref_mgr), NULL);
+    assert(nb_inside);
+    assert(!nb_outside);
+    assert(upool_audit_misses() == nb_inside);
+    uint64_t pool_misses;
+    ubase_assert(uprobe_pfx_get_pool_misses(test_pipe->uprobe, &pool_misses));
+    assert(pool_misses == nb_inside);
+
+    char *label = upipe_dump_upipe_label_default(test_pipe);
+    assert(label != NULL);
+    assert(strstr(label, "pool misses") != NULL);
+    free(label);
+
+    /* outside of any pipe */
+    uref = uref_alloc(uref_mgr);
+    assert(uref != NULL);
+    struct uref *uref2 = uref_alloc(uref_mgr);
+    assert(uref2 != NULL);
+    assert(nb_outside);
+    assert(upool_audit_misses() == nb_inside + nb_outside);
+    uref_free(uref2);
+    uref_free(uref);
+
+    /* the pipe is no longer running */
+    unsigned int inside = nb_inside;
+    uref_free(held);
+    held = NULL;
+    uref = uref_alloc(uref_mgr);
+    uref2 = uref_alloc(uref_mgr);
+    assert(nb_inside == inside);
+    uref_free(uref2);
+    uref_free(uref);
+
+    upool_audit_set(UPOOL_AUDIT_NONE, NULL);
+    unsigned int outside = nb_outside;
+    uref = uref_alloc(uref_mgr);
+    uref2 = uref_alloc(uref_mgr);
+    assert(nb_outside == outside);
+    assert(!upool_audit_misses());
+    uref_free(uref2);
+    uref_free(uref);
+
+    test_free(test_pipe);
+    uref_mgr_release(uref_mgr);
+    udict_mgr_release(udict_mgr);
+    umem_mgr_release(umem_mgr);
+    uprobe_release(logger);
+    uprobe_clean(&uprobe);
+    return 0;
+}
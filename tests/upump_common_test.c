@@ -29,11 +29,15 @@
 
 #undef NDEBUG
 
+#include <upipe/uclock.h>
+#include <upipe/uclock_std.h>
 #include <upipe/upump.h>
 #include <upipe/upump_blocker.h>
+#include <upipe/upump_common.h>
 #include <upump-ev/upump_ev.h>
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -48,6 +52,11 @@ static const char *padding = "This is an initialized bit of space used to pad su
  * the buffer space of a pipe. */
 #define MIN_READ (128*1024)
 #define MIN_TIMEOUT 3
+#define REARMS 5
+#define WHEEL_TIMERS 64
+/** interval between the timeouts of the wheel timers (3 ms), so that some
+ * of them are beyond the first level of the wheel */
+#define WHEEL_STEP UINT64_C(81000)
 
 static int pipefd[2];
 static struct upump_mgr *mgr;
@@ -62,6 +71,19 @@ static struct upump_blocker *blocker = NULL;
 static ssize_t bytes_written = 0, bytes_read = 0;
 static unsigned timeout_count = 0;
 static bool timer_done = false;
+static struct upump *rearm_timer = NULL;
+static unsigned rearm_count = 0;
+static struct upump *wheel_timers[WHEEL_TIMERS];
+static struct upump *wheel_repeat = NULL;
+static struct upump *wheel_stopped = NULL;
+static unsigned wheel_count = 0;
+static unsigned wheel_repeat_count = 0;
+static struct uclock *cached_uclock = NULL;
+static struct upump *iteration = NULL;
+static struct upump *iteration_timer = NULL;
+static unsigned iteration_count = 0;
+static unsigned iteration_timer_count = 0;
+static uint64_t iteration_now = 0;
 
 static void blocker_cb(struct upump_blocker *blocker)
 {
@@ -138,6 +160,54 @@ static void timer_cb(struct upump *upump)
     }
 }
 
+static void rearm_timer_cb(struct upump *upump)
+{
+    printf("rearm timer passed\n");
+    if (++rearm_count < REARMS)
+        ubase_assert(upump_rearm(upump, timeout / 100 * rearm_count, 0));
+}
+
+static void wheel_timer_cb(struct upump *upump)
+{
+    unsigned int i = upump_get_opaque(upump, uintptr_t);
+    assert(wheel_timers[i] == upump);
+    /* timers trigger in the order of their timeouts */
+    assert(wheel_count == i);
+    wheel_count++;
+    upump_stop(upump);
+}
+
+static void wheel_repeat_cb(struct upump *upump)
+{
+    if (++wheel_repeat_count >= MIN_TIMEOUT) {
+        printf("wheel timers passed\n");
+        upump_stop(upump);
+    }
+}
+
+static void wheel_stopped_cb(struct upump *upump)
+{
+    abort();
+}
+
+static void iteration_cb(struct upump *upump)
+{
+    iteration_count++;
+}
+
+static void iteration_timer_cb(struct upump *upump)
+{
+    /* the cached time only changes between iterations */
+    uint64_t now = uclock_now(cached_uclock);
+    assert(now == uclock_now(cached_uclock));
+    assert(now > iteration_now);
+    iteration_now = now;
+    if (++iteration_timer_count >= MIN_TIMEOUT) {
+        printf("iteration pumps passed\n");
+        upump_stop(upump);
+    }
+}
+
 void run(struct upump_mgr *mgr)
 {
     long flags;
@@ -191,5 +261,66 @@ void run(struct upump_mgr *mgr)
     upump_free(timer);
     upump_free(timer_again);
 
+    /* Re-armed timers */
+    rearm_timer = upump_alloc_timer(mgr, rearm_timer_cb, NULL, NULL,
+                                    timeout, 0);
+    assert(rearm_timer != NULL);
+    ubase_assert(upump_rearm(rearm_timer, timeout / 100, 0));
+    upump_mgr_run(mgr, NULL);
+    assert(rearm_count == REARMS);
+    upump_stop(rearm_timer);
+    upump_free(rearm_timer);
+
+    /* Wheel timers */
+    for (unsigned int i = 0; i < WHEEL_TIMERS; i++) {
+        wheel_timers[i] = upump_alloc_wheel_timer(mgr, wheel_timer_cb,
+                (void *)(uintptr_t)i, NULL, WHEEL_STEP * (i + 1), 0);
+        assert(wheel_timers[i] != NULL);
+    }
+    /* start them in reverse order */
+    for (unsigned int i = WHEEL_TIMERS; i > 0; i--)
+        upump_start(wheel_timers[i - 1]);
+    /* the pump driving the wheel sleeps until the first timeout */
+    struct upump_common_wheel *wheel =
+        &upump_common_mgr_from_upump_mgr(mgr)->wheel;
+    assert(wheel->upump != NULL);
+    assert(wheel->deadline >= wheel->tick + WHEEL_STEP / UPUMP_WHEEL_TICK);
+    wheel_repeat = upump_alloc_wheel_timer(mgr, wheel_repeat_cb, NULL, NULL,
+            WHEEL_STEP * WHEEL_TIMERS, WHEEL_STEP * WHEEL_TIMERS);
+    assert(wheel_repeat != NULL);
+    upump_start(wheel_repeat);
+    wheel_stopped = upump_alloc_wheel_timer(mgr, wheel_stopped_cb, NULL, NULL,
+                                            WHEEL_STEP, 0);
+    assert(wheel_stopped != NULL);
+    upump_start(wheel_stopped);
+    upump_stop(wheel_stopped);
+    upump_mgr_run(mgr, NULL);
+    assert(wheel_count == WHEEL_TIMERS);
+    assert(wheel_repeat_count == MIN_TIMEOUT);
+    for (unsigned int i = 0; i < WHEEL_TIMERS; i++)
+        upump_free(wheel_timers[i]);
+    upump_free(wheel_repeat);
+    upump_free(wheel_stopped);
+
+    /* Iteration pumps, which not all managers support */
+    cached_uclock = uclock_std_alloc_cached(0, mgr);
+    if (cached_uclock != NULL) {
+        iteration = upump_alloc_iteration(mgr, iteration_cb, NULL, NULL);
+        assert(iteration != NULL);
+        upump_set_status(iteration, false);
+        upump_start(iteration);
+        iteration_timer = upump_alloc_timer(mgr, iteration_timer_cb, NULL,
+                                            NULL, timeout / 100,
+                                            timeout / 100);
+        assert(iteration_timer != NULL);
+        upump_start(iteration_timer);
+        upump_mgr_run(mgr, NULL);
+        assert(iteration_timer_count == MIN_TIMEOUT);
+        assert(iteration_count >= MIN_TIMEOUT);
+        upump_free(iteration);
+        upump_free(iteration_timer);
+        uclock_release(cached_uclock);
+    }
+
     upump_mgr_release(mgr);
 }